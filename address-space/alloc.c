@@ -2,11 +2,140 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/mman.h>
 
+#define MiB * (1024LL * 1024)
 #define GiB * (1024LL * 1024 * 1024)
 
-int main() {
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+
+// Huge page modes: ./alloc <mode> [MiB]
+//
+// - 4k:   normal pages (THP disabled for the mapping)
+// - thp:  transparent huge pages, madvise(MADV_HUGEPAGE)
+// - 2m:   hugetlbfs 2 MiB pages (MAP_HUGETLB; needs vm.nr_hugepages)
+// - 1g:   hugetlbfs 1 GiB pages (needs hugepagesz=1G hugepages=N at boot)
+//
+// Each mode touches every 4 KiB of the mapping, then reads it at random
+// (where the TLB misses are), and reports how much of it /proc/self/smaps
+// says is backed by huge pages.
+struct mode {
+    const char *name;
+    int flags, advice;
+    size_t align;
+};
+
+static const struct mode modes[] = {
+    { "4k",  0,                          MADV_NOHUGEPAGE, 4096 },
+    { "thp", 0,                          MADV_HUGEPAGE,   2 MiB },
+    { "2m",  MAP_HUGETLB | MAP_HUGE_2MB, 0,               2 MiB },
+    { "1g",  MAP_HUGETLB | MAP_HUGE_1GB, 0,               1 GiB },
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Sums the huge page fields of the smaps entry of the mapping at p (in
+// KiB): AnonHugePages for THP, Private/Shared_Hugetlb for hugetlbfs.
+static long huge_kib(void *p) {
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    char line[256];
+    long kib = 0, v;
+    int in = 0;
+
+    if (!fp) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        uintptr_t start, end;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            // A mapping header line: "start-end perms offset ..."
+            in = (uintptr_t)p >= start && (uintptr_t)p < end;
+        } else if (in && (sscanf(line, "AnonHugePages: %ld kB", &v) == 1 ||
+                          sscanf(line, "Private_Hugetlb: %ld kB", &v) == 1 ||
+                          sscanf(line, "Shared_Hugetlb: %ld kB", &v) == 1)) {
+            kib += v;
+        }
+    }
+    fclose(fp);
+    return kib;
+}
+
+static int huge_pages(const struct mode *m, size_t size) {
+    size = (size + m->align - 1) & ~(m->align - 1);
+
+    // THP needs a 2 MiB aligned range: map more and skip to the boundary.
+    size_t extra = m->flags ? 0 : m->align;
+    uint8_t *raw = mmap(NULL, size + extra, PROT_READ | PROT_WRITE,
+                        MAP_ANONYMOUS | MAP_PRIVATE | m->flags, -1, 0);
+    if (raw == MAP_FAILED) {
+        perror("cannot map");
+        if (m->flags) {
+            fprintf(stderr, "(reserve huge pages first, e.g. sysctl vm.nr_hugepages=512)\n");
+        }
+        return 1;
+    }
+    volatile uint8_t *p = m->flags ? raw
+        : (uint8_t *)(((uintptr_t)raw + m->align - 1) & ~(uintptr_t)(m->align - 1));
+    if (m->advice && madvise((void *)p, size, m->advice) != 0) {
+        perror("madvise");
+    }
+
+    size_t n = size / 4096;
+    double t = now();
+    for (size_t i = 0; i < n; i++) {
+        p[i * 4096] = 1;
+    }
+    t = now() - t;
+    printf("%-4s first touch: %8.3f ms, %7.1f ns/4K, %6.2f GiB/s\n", m->name, t * 1e3, t * 1e9 / n,
+           size / t / (1 GiB));
+
+    // Random reads over the whole region: with 4 KiB pages nearly every
+    // one is a TLB miss once the region is much larger than the TLB.
+    uint64_t x = 88172645463325252ULL;
+    size_t reads = 1 << 24;
+    t = now();
+    for (size_t i = 0; i < reads; i++) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        (void)p[x % size];
+    }
+    t = now() - t;
+    printf("%-4s random read:  %8.3f ms, %7.2f ns/read\n", m->name, t * 1e3, t * 1e9 / reads);
+
+    long kib = huge_kib((void *)p);
+    printf("%-4s huge pages:   %ld of %zu KiB (%.1f%%)\n", m->name, kib, size / 1024,
+           kib < 0 ? 0 : 100.0 * kib * 1024 / size);
+    munmap(raw, size + extra);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        long long mib = argc > 2 ? atoll(argv[2]) : 1024;
+        size_t size = mib MiB;
+        int ret = 0, found = 0;
+        for (int i = 0; mib >= 1 && i < sizeof(modes) / sizeof(modes[0]); i++) {
+            if (strcmp(argv[1], modes[i].name) == 0 || strcmp(argv[1], "all") == 0) {
+                ret |= huge_pages(&modes[i], size);
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Usage: %s [4k|thp|2m|1g|all] [MiB]\n", argv[0]);
+            return 1;
+        }
+        return ret;
+    }
+
     volatile uint8_t *p = mmap(
         NULL,
         8 GiB,
@@ -0,0 +1,157 @@
+// Small-object churn: arena.h against glibc malloc().
+//
+// Every thread keeps a window of live objects and replaces the oldest one
+// with a new one, over and over, like a program that builds and drops
+// lots of small nodes. This is done with
+//
+// - malloc() and free() of 16..128 bytes;
+// - a pool of 128-byte objects with a per-thread cache (pool_get/put);
+// - an arena, which cannot free single objects: it allocates until the
+//   window has been replaced and then resets (as if the objects of one
+//   request or one frame died together).
+//
+// Usage: ./arena-bench [-t max-threads] [-n ops-per-thread] [-w window] [-H]
+//   -H: back the arenas with transparent huge pages
+
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SIZE 128
+
+enum { MALLOC, POOL, ARENA };
+static const char *names[] = { "malloc/free", "pool (per-thread cache)", "arena (bulk reset)" };
+
+static long ops = 10000000;
+static int window = 1024, flags;
+static struct pool pool;
+
+struct worker {
+    pthread_t thread;
+    int kind;
+    double seconds;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *churn(void *arg) {
+    struct worker *w = arg;
+    void **live = calloc(window, sizeof(void *));
+    uint64_t x = 88172645463325252ULL ^ (uintptr_t)w;
+    struct pool_cache cache;
+    struct arena arena;
+
+    if (w->kind == POOL) {
+        pool_cache_init(&cache, &pool);
+    }
+    if (w->kind == ARENA && arena_init(&arena, (size_t)window * MAX_SIZE, flags) != 0) {
+        perror("arena_init");
+        exit(1);
+    }
+
+    double t = now();
+    for (long i = 0; i < ops; i++) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        size_t size = 16 + x % (MAX_SIZE - 15);
+        int slot = i % window;
+        void *p = NULL;
+
+        switch (w->kind) {
+        case MALLOC:
+            free(live[slot]);
+            p = malloc(size);
+            break;
+        case POOL:
+            if (live[slot]) {
+                pool_put(&cache, live[slot]);
+            }
+            p = pool_get(&cache);
+            break;
+        case ARENA:
+            if (slot == 0) {
+                arena_reset(&arena);
+            }
+            p = arena_alloc(&arena, size);
+            break;
+        }
+        if (!p) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        *(volatile char *)p = (char)i;  // Use it
+        live[slot] = p;
+    }
+    w->seconds = now() - t;
+
+    if (w->kind == MALLOC) {
+        for (int i = 0; i < window; i++) {
+            free(live[i]);
+        }
+    }
+    if (w->kind == ARENA) {
+        arena_destroy(&arena);
+    }
+    free(live);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:w:H")) != -1) {
+        switch (opt) {
+        case 't': max_threads = atol(optarg); break;
+        case 'n': ops = atol(optarg); break;
+        case 'w': window = atoi(optarg); break;
+        case 'H': flags |= ARENA_HUGE; break;
+        default:
+            fprintf(stderr, "Usage: %s [-t max-threads] [-n ops-per-thread] [-w window] [-H]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_threads < 1 || window < 1 || ops < 1) {
+        return 1;
+    }
+
+    printf("%ld ops per thread, %d live objects per thread, %d..%d bytes\n\n", ops, window, 16, MAX_SIZE);
+    printf("| %-24s | threads | ns/op | Mops/s (all threads) |\n", "allocator");
+    printf("|--------------------------|---------|-------|----------------------|\n");
+    for (int kind = MALLOC; kind <= ARENA; kind++) {
+        for (long threads = 1;; threads *= 2) {
+            if (threads > max_threads) {
+                threads = max_threads;
+            }
+            struct worker w[threads];
+            if (kind == POOL && pool_init(&pool, MAX_SIZE, (size_t)1 << 32, flags) != 0) {
+                perror("pool_init");
+                return 1;
+            }
+            double t = now();
+            for (int i = 0; i < threads; i++) {
+                w[i].kind = kind;
+                pthread_create(&w[i].thread, NULL, churn, &w[i]);
+            }
+            double thread_seconds = 0;
+            for (int i = 0; i < threads; i++) {
+                pthread_join(w[i].thread, NULL);
+                thread_seconds += w[i].seconds;
+            }
+            t = now() - t;
+            if (kind == POOL) {
+                pool_destroy(&pool);
+            }
+            printf("| %-24s | %7ld | %5.1f | %20.1f |\n", names[kind], threads, thread_seconds * 1e9 / (ops * threads),
+                   ops * threads / t / 1e6);
+            if (threads >= max_threads) {
+                break;
+            }
+        }
+    }
+}
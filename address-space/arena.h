@@ -0,0 +1,238 @@
+// Arena and pool allocators on top of mmap()
+//
+// mmap-demo.c and alloc.c map memory directly; this turns such a mapping
+// into two allocators for programs that make lots of small objects:
+//
+// - An arena hands out memory by bumping a pointer through one large
+//   mapping. There is no free(): all objects go away at once with
+//   arena_reset(), which is as cheap as setting the pointer back.
+//
+//       struct arena a;
+//       arena_init(&a, 1 << 30, 0);     // Reserves 1 GiB, touches none
+//       char *s = arena_alloc(&a, 100);
+//       ...
+//       arena_reset(&a);                // Frees everything
+//
+// - A pool hands out objects of one size, carved from an arena in slabs,
+//   and takes them back in a free list. Each thread keeps a small cache
+//   of free objects, so that pool_get() and pool_put() only take the
+//   pool's lock once every POOL_BATCH calls:
+//
+//       struct pool p;
+//       pool_init(&p, sizeof(struct node), 1 << 30, 0);
+//       static _Thread_local struct pool_cache c;  // One per thread
+//       pool_cache_init(&c, &p);
+//       struct node *n = pool_get(&c);
+//       pool_put(&c, n);
+//
+// With ARENA_HUGE, the mapping is 2 MiB aligned and madvise(MADV_HUGEPAGE)
+// asks for transparent huge pages (see alloc.c thp).
+//
+// All of it is in this header, so there is nothing to build or link:
+// include it and compile with -pthread.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define ARENA_ALIGN 16          // Alignment of arena_alloc() results
+#define ARENA_HUGE  1           // arena_init() flag: back with huge pages
+#define ARENA_HUGE_PAGE (2 << 20)
+#define POOL_BATCH  32          // Objects moved between a cache and its pool at once
+#define POOL_SLAB   (64 << 10)  // Bytes carved from the arena at once
+
+struct arena {
+    uint8_t *base, *cur, *end;
+    void *map;                  // The whole mapping (base may be aligned up)
+    size_t map_size;
+};
+
+// Reserves size bytes of address space (memory is only allocated when
+// first touched). Returns 0 on success.
+static inline int arena_init(struct arena *a, size_t size, int flags) {
+    size_t extra = (flags & ARENA_HUGE) ? ARENA_HUGE_PAGE : 0;
+
+    memset(a, 0, sizeof(*a));
+    a->map_size = size + extra;
+    a->map = mmap(NULL, a->map_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (a->map == MAP_FAILED) {
+        a->map = NULL;
+        return -1;
+    }
+    a->base = a->map;
+    if (flags & ARENA_HUGE) {
+        a->base = (uint8_t *)(((uintptr_t)a->map + ARENA_HUGE_PAGE - 1) & ~(uintptr_t)(ARENA_HUGE_PAGE - 1));
+        madvise(a->base, size, MADV_HUGEPAGE);  // Only a hint: fine if it fails
+    }
+    a->cur = a->base;
+    a->end = a->base + size;
+    return 0;
+}
+
+// size bytes, ARENA_ALIGN aligned; NULL when the arena is full.
+static inline void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > (size_t)(a->end - a->cur)) {
+        return NULL;
+    }
+    void *p = a->cur;
+    a->cur += size;
+    return p;
+}
+
+// Frees all objects. The pages stay mapped (and are reused without
+// faulting again); arena_trim() gives them back to the kernel.
+static inline void arena_reset(struct arena *a) {
+    a->cur = a->base;
+}
+
+static inline void arena_trim(struct arena *a) {
+    madvise(a->base, a->end - a->base, MADV_DONTNEED);
+    a->cur = a->base;
+}
+
+static inline void arena_destroy(struct arena *a) {
+    if (a->map) {
+        munmap(a->map, a->map_size);
+    }
+    memset(a, 0, sizeof(*a));
+}
+
+// Free objects are linked through their first word.
+struct pool_free {
+    struct pool_free *next;
+};
+
+struct pool {
+    size_t size;                // Object size
+    struct arena arena;
+    pthread_mutex_t lock;       // Protects everything below
+    struct pool_free *free;
+    uint8_t *slab, *slab_end;   // Rest of the current slab
+    uint64_t generation;        // Incremented by pool_reset()
+};
+
+struct pool_cache {
+    struct pool *pool;
+    struct pool_free *free;
+    uint32_t count;
+    uint64_t generation;
+};
+
+// A pool of objects of size bytes, in an arena of at most arena_size
+// bytes. Returns 0 on success.
+static inline int pool_init(struct pool *p, size_t size, size_t arena_size, int flags) {
+    memset(p, 0, sizeof(*p));
+    p->size = size < sizeof(struct pool_free) ? sizeof(struct pool_free) : size;
+    p->size = (p->size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    pthread_mutex_init(&p->lock, NULL);
+    return arena_init(&p->arena, arena_size, flags);
+}
+
+static inline void pool_destroy(struct pool *p) {
+    arena_destroy(&p->arena);
+    pthread_mutex_destroy(&p->lock);
+}
+
+static inline void pool_cache_init(struct pool_cache *c, struct pool *p) {
+    memset(c, 0, sizeof(*c));
+    c->pool = p;
+    c->generation = __atomic_load_n(&p->generation, __ATOMIC_ACQUIRE);
+}
+
+// Moves up to POOL_BATCH objects from the pool to the cache (the pool's
+// free list first, then new ones from the slab).
+static inline void pool_refill(struct pool_cache *c) {
+    struct pool *p = c->pool;
+
+    pthread_mutex_lock(&p->lock);
+    c->generation = p->generation;
+    while (c->count < POOL_BATCH) {
+        struct pool_free *f = p->free;
+        if (f) {
+            p->free = f->next;
+        } else {
+            if (p->slab == p->slab_end) {
+                size_t n = POOL_SLAB / p->size ? POOL_SLAB / p->size : 1;
+                p->slab = arena_alloc(&p->arena, n * p->size);
+                p->slab_end = p->slab ? p->slab + n * p->size : NULL;
+                if (!p->slab) {
+                    break;
+                }
+            }
+            f = (struct pool_free *)p->slab;
+            p->slab += p->size;
+        }
+        f->next = c->free;
+        c->free = f;
+        c->count++;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Gives all but keep objects of the cache back to the pool.
+static inline void pool_flush(struct pool_cache *c, uint32_t keep) {
+    struct pool *p = c->pool;
+    struct pool_free *first = c->free, *last = NULL;
+
+    while (c->count > keep) {
+        last = c->free;
+        c->free = c->free->next;
+        c->count--;
+    }
+    if (last) {
+        pthread_mutex_lock(&p->lock);
+        last->next = p->free;
+        p->free = first;
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+// An object; NULL when the arena is full.
+static inline void *pool_get(struct pool_cache *c) {
+    if (c->generation != __atomic_load_n(&c->pool->generation, __ATOMIC_ACQUIRE)) {
+        c->free = NULL;  // The pool was reset: the cached objects are gone
+        c->count = 0;
+    }
+    if (!c->free) {
+        pool_refill(c);
+        if (!c->free) {
+            return NULL;
+        }
+    }
+    struct pool_free *f = c->free;
+    c->free = f->next;
+    c->count--;
+    return f;
+}
+
+static inline void pool_put(struct pool_cache *c, void *obj) {
+    if (c->generation != __atomic_load_n(&c->pool->generation, __ATOMIC_ACQUIRE)) {
+        return;  // From before a reset: it no longer exists
+    }
+    struct pool_free *f = obj;
+    f->next = c->free;
+    c->free = f;
+    if (++c->count >= 2 * POOL_BATCH) {
+        pool_flush(c, POOL_BATCH);
+    }
+}
+
+// Frees all objects of the pool at once. Caches notice at their next
+// pool_get() or pool_put(); no thread may use an object of the pool at
+// the same time.
+static inline void pool_reset(struct pool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->free = NULL;
+    p->slab = p->slab_end = NULL;
+    arena_reset(&p->arena);
+    __atomic_add_fetch(&p->generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&p->lock);
+}
+
+#endif
@@ -0,0 +1,201 @@
+// Page fault and mapping cost benchmark.
+//
+// alloc.c shows that mmap() only reserves address space: memory is only
+// allocated when a page is first touched, in the page fault handler. This
+// measures what that costs on this host:
+//
+// - first touch of every page (demand faulting), in order and at random;
+// - touching the same pages again, once they are mapped;
+// - MAP_POPULATE, which faults everything in inside mmap();
+// - 4 KiB pages vs. transparent huge pages (madvise(MADV_HUGEPAGE));
+// - munmap() while other threads of the process are running, which needs
+//   a TLB shootdown (an inter-processor interrupt) on their CPUs.
+//
+// Usage: ./fault-bench [-s MiB] [-t max-threads] [-r repeats]
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MiB * (1024LL * 1024)
+#define HUGE_PAGE (2 MiB)
+
+static size_t page;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint8_t *map(size_t size, int flags) {
+    uint8_t *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE | flags, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("cannot map");
+        exit(1);
+    }
+    return p;
+}
+
+// A huge-page aligned region (the kernel only uses huge pages for
+// aligned 2 MiB ranges); the unaligned head and tail are unmapped.
+static uint8_t *map_aligned(size_t size) {
+    uint8_t *p = map(size + HUGE_PAGE, 0);
+    uint8_t *q = (uint8_t *)(((uintptr_t)p + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+    if (q > p) {
+        munmap(p, q - p);
+    }
+    munmap(q + size, p + size + HUGE_PAGE - (q + size));
+    return q;
+}
+
+static void touch(volatile uint8_t *p, size_t npages, const size_t *order) {
+    for (size_t i = 0; i < npages; i++) {
+        p[(order ? order[i] : i) * page] = 1;
+    }
+}
+
+static void row(const char *what, size_t npages, double t) {
+    printf("| %-36s | %8zu | %10.3f | %10.1f | %8.2f |\n", what, npages, t * 1e3, t * 1e9 / npages,
+           npages * page / t / (1 MiB * 1024));
+}
+
+// Threads that keep running in the same address space, so that munmap()
+// has to shoot down their TLB entries.
+static atomic_int stop;
+
+static void *spin(void *arg) {
+    volatile uint8_t *p = arg;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        p[0]++;
+    }
+    return NULL;
+}
+
+static void bench_munmap(int threads, int repeats) {
+    const size_t npages = 64;
+    pthread_t tid[threads];
+    uint8_t *scratch = map(threads * page, 0);
+
+    atomic_store(&stop, 0);
+    for (int i = 1; i < threads; i++) {
+        pthread_create(&tid[i], NULL, spin, scratch + i * page);
+    }
+    usleep(10000);  // Let them get going
+
+    double total = 0;
+    for (int r = 0; r < repeats; r++) {
+        uint8_t *p = map(npages * page, 0);
+        touch(p, npages, NULL);
+        double t = now();
+        munmap(p, npages * page);
+        total += now() - t;
+    }
+
+    atomic_store(&stop, 1);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    munmap(scratch, threads * page);
+    printf("| %7d | %7d | %10.3f | %10.1f |\n", threads, repeats, total * 1e3, total * 1e9 / repeats);
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = 256 MiB;
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int repeats = 1000, opt;
+
+    while ((opt = getopt(argc, argv, "s:t:r:")) != -1) {
+        switch (opt) {
+        case 's': size = atoll(optarg) MiB; break;
+        case 't': max_threads = atol(optarg); break;
+        case 'r': repeats = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-s MiB] [-t max-threads] [-r repeats]\n", argv[0]);
+            return 1;
+        }
+    }
+    page = sysconf(_SC_PAGESIZE);
+    size = (size + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    size_t npages = size / page;
+
+    // A random order of all pages (Fisher-Yates with xorshift)
+    size_t *order = malloc(npages * sizeof(size_t));
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < npages; i++) {
+        order[i] = i;
+    }
+    for (size_t i = npages - 1; i > 0; i--) {
+        x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+        size_t j = x % (i + 1), tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    printf("%zu MiB, %zu-byte pages, %ld CPUs\n\n", (size_t)(size / (1 MiB)), page, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("| %-36s | %8s | %10s | %10s | %8s |\n", "test", "pages", "ms", "ns/page", "GiB/s");
+    printf("|--------------------------------------|----------|------------|------------|----------|\n");
+
+    // Demand faulting, and touching pages that are already there
+    for (int random = 0; random <= 1; random++) {
+        uint8_t *p = map(size, 0);
+        madvise(p, size, MADV_NOHUGEPAGE);
+        double t = now();
+        touch(p, npages, random ? order : NULL);
+        row(random ? "first touch, random" : "first touch, sequential", npages, now() - t);
+        t = now();
+        touch(p, npages, random ? order : NULL);
+        row(random ? "touch mapped pages, random" : "touch mapped pages, sequential", npages, now() - t);
+        munmap(p, size);
+    }
+
+    // Faulting everything in at mmap() time
+    double t = now();
+    uint8_t *p = map(size, MAP_POPULATE);
+    row("mmap(MAP_POPULATE)", npages, now() - t);
+    t = now();
+    touch(p, npages, NULL);
+    row("touch populated pages, sequential", npages, now() - t);
+    t = now();
+    munmap(p, size);
+    row("munmap", npages, now() - t);
+
+    // 4 KiB vs. transparent huge pages
+    for (int huge = 0; huge <= 1; huge++) {
+        p = map_aligned(size);
+        if (madvise(p, size, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) != 0) {
+            printf("| %-36s | unavailable |\n", huge ? "MADV_HUGEPAGE" : "MADV_NOHUGEPAGE");
+        } else {
+            t = now();
+            touch(p, npages, order);
+            row(huge ? "first touch, MADV_HUGEPAGE, random" : "first touch, 4 KiB pages, random", npages, now() - t);
+            t = now();
+            touch(p, npages, order);
+            row(huge ? "touch mapped, MADV_HUGEPAGE, random" : "touch mapped, 4 KiB pages, random", npages, now() - t);
+        }
+        munmap(p, size);
+    }
+
+    // munmap() and TLB shootdowns, by number of running threads
+    printf("\nmunmap() of 64 touched pages, with other threads running:\n\n");
+    printf("| threads | munmaps | %10s | %10s |\n", "ms", "ns/munmap");
+    printf("|---------|---------|------------|------------|\n");
+    for (long threads = 1;; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+        bench_munmap(threads, repeats);
+        if (threads >= max_threads) {
+            break;
+        }
+    }
+
+    free(order);
+}
@@ -0,0 +1,168 @@
+// Samples the memory use of a running process over time.
+//
+// statedump shows one moment; this reads /proc/<pid>/smaps every -i ms
+// (keeping the fd open and reusing two buffers) and writes a time series
+// that plot.py turns into a chart. Only what changed since the previous
+// sample is written, so a process at rest costs one line per sample:
+//
+//   # memsample <pid> <interval-ms>
+//   T <ms> <rss> <pss> <anonymous> <swap>        totals, every sample
+//   + <start> <end> <rss> <pss> <perms> <name>  mapping is new or changed
+//   - <start>                                   mapping is gone
+//
+// Sizes are in KiB, addresses in hex; mappings are identified by start.
+// With -r, only the totals are sampled (from smaps_rollup, which is much
+// cheaper for processes with many mappings).
+//
+// Usage: ./memsample [-i ms] [-n samples] [-o file] [-r] pid
+
+#include "procmaps.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_MAPS 65536
+
+struct entry {
+    uintptr_t start, end;
+    long rss, pss;
+    char perms[5];
+    const char *name;
+};
+
+// The current and the previous sample (whose names point into the other
+// buffer), swapped after every sample.
+static char bufs[2][16 << 20];
+static struct entry entries[2][MAX_MAPS];
+static int counts[2];
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    stop = 1;
+}
+
+static long ms_since(const struct timespec *t0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - t0->tv_sec) * 1000 + (ts.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+// Reads one sample into entries[cur]; returns -1 when the process is gone
+// (or has called execve(): the open file still refers to the old address
+// space).
+static int sample(int fd, int cur, struct pm_usage *total) {
+    char *pos = bufs[cur];
+    struct pm_map m;
+    int n = 0;
+
+    memset(total, 0, sizeof(*total));
+    if (pm_read(fd, bufs[cur], sizeof(bufs[cur])) <= 0) {
+        return -1;  // An exited process has an empty smaps
+    }
+    while (pm_next(&pos, &m)) {
+        total->rss += m.usage.rss;
+        total->pss += m.usage.pss;
+        total->anonymous += m.usage.anonymous;
+        total->swap += m.usage.swap;
+        if (n < MAX_MAPS) {
+            struct entry *e = &entries[cur][n++];
+            *e = (struct entry){ m.start, m.end, m.usage.rss, m.usage.pss, "", m.name };
+            memcpy(e->perms, m.perms, sizeof(e->perms));
+        }
+    }
+    counts[cur] = n;
+    return 0;
+}
+
+// Writes the differences between two samples; both are sorted by start,
+// like the maps file itself.
+static void diff(FILE *fp, const struct entry *prev, int np, const struct entry *cur, int nc) {
+    int i = 0, j = 0;
+
+    while (i < np || j < nc) {
+        if (j == nc || (i < np && prev[i].start < cur[j].start)) {
+            fprintf(fp, "- %lx\n", prev[i++].start);
+        } else {
+            const struct entry *e = &cur[j];
+            if (i == np || prev[i].start > e->start || prev[i].end != e->end || prev[i].rss != e->rss ||
+                prev[i].pss != e->pss) {
+                fprintf(fp, "+ %lx %lx %ld %ld %s %s\n", e->start, e->end, e->rss, e->pss, e->perms,
+                        *e->name ? e->name : "-");
+            }
+            if (i < np && prev[i].start == e->start) {
+                i++;
+            }
+            j++;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long interval = 100, samples = -1;
+    const char *file = NULL;
+    int rollup = 0, opt;
+
+    while ((opt = getopt(argc, argv, "i:n:o:r")) != -1) {
+        switch (opt) {
+        case 'i': interval = atol(optarg); break;
+        case 'n': samples = atol(optarg); break;
+        case 'o': file = optarg; break;
+        case 'r': rollup = 1; break;
+        default: goto usage;
+        }
+    }
+    if (optind >= argc || interval <= 0) {
+usage:
+        fprintf(stderr, "Usage: %s [-i ms] [-n samples] [-o file] [-r] pid\n", argv[0]);
+        return 1;
+    }
+    pid_t pid = atoi(argv[optind]);
+
+    const char *what = rollup ? "smaps_rollup" : "smaps";
+    int fd = pm_open(pid, what);
+    if (fd < 0) {
+        perror("smaps");
+        return 1;
+    }
+    FILE *fp = file ? fopen(file, "w") : stdout;
+    if (!fp) {
+        perror(file);
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    struct timespec t0, next;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    next = t0;
+    fprintf(fp, "# memsample %d %ld\n", (int)pid, interval);
+
+    int cur = 0;
+    for (long s = 0; !stop && s != samples; s++) {
+        struct pm_usage total;
+        long t = ms_since(&t0);
+
+        if (sample(fd, cur, &total) < 0) {
+            close(fd);
+            if ((fd = pm_open(pid, what)) < 0 || sample(fd, cur, &total) < 0) {
+                break;
+            }
+        }
+        fprintf(fp, "T %ld %ld %ld %ld %ld\n", t, total.rss, total.pss, total.anonymous, total.swap);
+        if (!rollup) {
+            diff(fp, entries[!cur], counts[!cur], entries[cur], counts[cur]);
+            cur = !cur;
+        }
+        fflush(fp);
+
+        // An absolute deadline, so that the time spent sampling does not
+        // add up to drift.
+        next.tv_nsec += interval % 1000 * 1000000;
+        next.tv_sec += interval / 1000 + next.tv_nsec / 1000000000;
+        next.tv_nsec %= 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    if (file) {
+        fclose(fp);
+    }
+}
@@ -0,0 +1,80 @@
+# Plots a memsample time series.
+#
+#   ./memsample -o samples.txt <pid>      (Ctrl-C to stop)
+#   python3 plot.py samples.txt           writes samples.svg
+#
+# The chart has the RSS, PSS, anonymous and swap totals over time; below
+# it, the mappings with the most RSS at the last sample are printed as a
+# markdown table, like the one statedump writes to plot.md.
+
+import sys
+
+WIDTH, HEIGHT, MARGIN = 900, 400, 60
+SERIES = [("RSS", 1, "#1f77b4"), ("PSS", 2, "#ff7f0e"), ("Anonymous", 3, "#2ca02c"), ("Swap", 4, "#d62728")]
+
+
+def read(path):
+    header, samples, mappings = "", [], {}
+    with open(path) as f:
+        for line in f:
+            parts = line.split()
+            if not parts:
+                continue
+            if parts[0] == "#":
+                header = line[1:].strip()
+            elif parts[0] == "T":
+                samples.append([int(x) for x in parts[1:]])
+            elif parts[0] == "+":
+                start, end, rss, pss, perms = parts[1:6]
+                name = " ".join(parts[6:])
+                mappings[start] = (int(start, 16), int(end, 16), int(rss), int(pss), perms, name)
+            elif parts[0] == "-":
+                mappings.pop(parts[1], None)
+    return header, samples, list(mappings.values())
+
+
+def svg(samples, title):
+    t_max = max(s[0] for s in samples) or 1
+    y_max = max(max(s[1:]) for s in samples) or 1
+    x = lambda t: MARGIN + t * (WIDTH - 2 * MARGIN) / t_max
+    y = lambda kib: HEIGHT - MARGIN - kib * (HEIGHT - 2 * MARGIN) / y_max
+
+    out = [f'<svg xmlns="http://www.w3.org/2000/svg" width="{WIDTH}" height="{HEIGHT}" font-family="sans-serif" font-size="12">',
+           f'<rect width="{WIDTH}" height="{HEIGHT}" fill="white"/>',
+           f'<text x="{WIDTH / 2}" y="20" text-anchor="middle">{title}</text>',
+           f'<line x1="{MARGIN}" y1="{y(0)}" x2="{WIDTH - MARGIN}" y2="{y(0)}" stroke="black"/>',
+           f'<line x1="{MARGIN}" y1="{y(0)}" x2="{MARGIN}" y2="{y(y_max)}" stroke="black"/>',
+           f'<text x="{WIDTH / 2}" y="{HEIGHT - 20}" text-anchor="middle">time (s)</text>']
+    for i in range(5):
+        kib, t = y_max * i / 4, t_max * i / 4
+        out.append(f'<text x="{MARGIN - 5}" y="{y(kib) + 4}" text-anchor="end">{kib / 1024:.1f}M</text>')
+        out.append(f'<text x="{x(t)}" y="{y(0) + 16}" text-anchor="middle">{t / 1000:.1f}</text>')
+    for n, (name, col, color) in enumerate(SERIES):
+        points = " ".join(f"{x(s[0]):.1f},{y(s[col]):.1f}" for s in samples)
+        out.append(f'<polyline points="{points}" fill="none" stroke="{color}"/>')
+        out.append(f'<text x="{MARGIN + 10 + n * 100}" y="{MARGIN - 10}" fill="{color}">{name}</text>')
+    out.append("</svg>")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(f"Usage: {sys.argv[0]} samples.txt")
+    path = sys.argv[1]
+    header, samples, mappings = read(path)
+    if not samples:
+        sys.exit(f"{path}: no samples")
+
+    out = path.rsplit(".", 1)[0] + ".svg"
+    with open(out, "w") as f:
+        f.write(svg(samples, header))
+    print(f"{len(samples)} samples, chart written to {out}\n")
+
+    if mappings:
+        print("| Start Address | End Address | Size | Permissions | RSS (KiB) | PSS (KiB) | Name |")
+        print("|---------------|-------------|------|-------------|-----------|-----------|------|")
+        for start, end, rss, pss, perms, name in sorted(mappings, key=lambda m: -m[2])[:20]:
+            print(f"| 0x{start:x} | 0x{end:x} | 0x{end - start:x} | {perms} | {rss} | {pss} | {name} |")
+
+
+main()
@@ -0,0 +1,199 @@
+// /proc/<pid>/maps, smaps and smaps_rollup without gdb
+//
+// statedump.py asks gdb for "info proc mappings", which takes seconds.
+// The kernel has the same information in /proc/<pid>/maps; this reads
+// the file into a caller's buffer in one go and parses it in place (no
+// allocation, no stdio), fast enough to take snapshots in a loop:
+//
+//       static char buf[1 << 20];
+//       int fd = pm_open(pid, "smaps");
+//       if (pm_read(fd, buf, sizeof(buf)) >= 0) {
+//           char *pos = buf;
+//           struct pm_map m;
+//           while (pm_next(&pos, &m)) {
+//               printf("%lx-%lx %s %ld kB\n", m.start, m.end, m.name, m.usage.rss);
+//           }
+//       }
+//
+// pm_next() reads one mapping: its maps line, and for smaps and
+// smaps_rollup the "Key: N kB" lines after it as well. smaps_rollup is a
+// single entry with the total of all mappings.
+//
+// m.name points into the buffer (pm_next() terminates it), so it is only
+// valid until the buffer is read again. Keep the fd open and call
+// pm_read() again for the next snapshot.
+//
+// Everything is in this header: include it, there is nothing to link.
+
+#ifndef PROCMAPS_H
+#define PROCMAPS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Memory use of a mapping (or of the process, from smaps_rollup), in KiB.
+// All zero for /proc/<pid>/maps.
+struct pm_usage {
+    long rss, pss, pss_anon, pss_file, pss_shmem;
+    long shared_clean, shared_dirty, private_clean, private_dirty;
+    long referenced, anonymous, anon_huge, swap, swap_pss, locked;
+};
+
+struct pm_map {
+    uintptr_t start, end;
+    uint64_t offset, inode;
+    unsigned major, minor;
+    char perms[5];              // "r-xp"
+    const char *name;           // Path, [heap], [stack], ... or ""
+    struct pm_usage usage;
+};
+
+// Opens /proc/<pid>/<file> ("maps", "smaps" or "smaps_rollup"); pid 0
+// is the calling process. Returns the fd, or -1.
+static inline int pm_open(pid_t pid, const char *file) {
+    char path[64];
+
+    if (pid) {
+        snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, file);
+    } else {
+        snprintf(path, sizeof(path), "/proc/self/%s", file);
+    }
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// Reads the whole file from the start into buf and NUL-terminates it.
+// Returns its length, or -1 with errno = ENOBUFS if it does not fit.
+static inline ssize_t pm_read(int fd, char *buf, size_t size) {
+    size_t len = 0;
+    ssize_t n;
+
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        return -1;
+    }
+    // The kernel fills as much of buf as it can, so this is one read()
+    // plus the one that sees the end of the file.
+    while (len + 1 < size && (n = read(fd, buf + len, size - 1 - len)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        len += n;
+    }
+    buf[len] = '\0';
+    if (len + 1 >= size) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    return len;
+}
+
+static inline uint64_t pm_hex(char **p) {
+    uint64_t v = 0;
+    for (;; (*p)++) {
+        unsigned c = (unsigned char)**p;
+        if (c - '0' < 10) {
+            v = v << 4 | (c - '0');
+        } else if ((c | 0x20) - 'a' < 6) {
+            v = v << 4 | ((c | 0x20) - 'a' + 10);
+        } else {
+            return v;
+        }
+    }
+}
+
+static inline uint64_t pm_dec(char **p) {
+    uint64_t v = 0;
+    while ((unsigned)(**p - '0') < 10) {
+        v = v * 10 + (*(*p)++ - '0');
+    }
+    return v;
+}
+
+static inline void pm_skip(char **p, char c) {
+    while (**p == c) {
+        (*p)++;
+    }
+}
+
+// smaps keys and where they go; the others (KSM, VmFlags, ...) are skipped.
+static const struct pm_field {
+    const char *key;
+    size_t len, offset;
+} pm_fields[] = {
+#define PM_FIELD(key, field) { key, sizeof(key) - 1, offsetof(struct pm_usage, field) }
+    PM_FIELD("Rss", rss),
+    PM_FIELD("Pss", pss),
+    PM_FIELD("Pss_Anon", pss_anon),
+    PM_FIELD("Pss_File", pss_file),
+    PM_FIELD("Pss_Shmem", pss_shmem),
+    PM_FIELD("Shared_Clean", shared_clean),
+    PM_FIELD("Shared_Dirty", shared_dirty),
+    PM_FIELD("Private_Clean", private_clean),
+    PM_FIELD("Private_Dirty", private_dirty),
+    PM_FIELD("Referenced", referenced),
+    PM_FIELD("Anonymous", anonymous),
+    PM_FIELD("AnonHugePages", anon_huge),
+    PM_FIELD("Swap", swap),
+    PM_FIELD("SwapPss", swap_pss),
+    PM_FIELD("Locked", locked),
+#undef PM_FIELD
+};
+
+// Parses the mapping at *pos and moves *pos past it. Returns 0 at the
+// end of the buffer.
+static inline int pm_next(char **pos, struct pm_map *m) {
+    char *p = *pos;
+
+    memset(m, 0, sizeof(*m));
+    if (!*p) {
+        return 0;
+    }
+
+    // "start-end perms offset major:minor inode    name"
+    m->start = pm_hex(&p), p++;
+    m->end = pm_hex(&p), p++;
+    memcpy(m->perms, p, 4), p += 5;
+    m->offset = pm_hex(&p), p++;
+    m->major = pm_hex(&p), p++;
+    m->minor = pm_hex(&p), p++;
+    m->inode = pm_dec(&p);
+    pm_skip(&p, ' ');
+    m->name = p;
+    p = strchr(p, '\n');
+    if (!p) {
+        *pos = (char *)m->name + strlen(m->name);
+        return 1;
+    }
+    *p++ = '\0';
+
+    // "Key:   N kB" lines, up to the next mapping (which starts with a
+    // lower-case hex digit; keys start with an upper-case letter)
+    while (*p >= 'A' && *p <= 'Z') {
+        char *key = p, *colon = strchr(p, ':');
+        if (!colon) {
+            break;
+        }
+        for (size_t i = 0; i < sizeof(pm_fields) / sizeof(pm_fields[0]); i++) {
+            if (pm_fields[i].len == (size_t)(colon - key) && memcmp(key, pm_fields[i].key, pm_fields[i].len) == 0) {
+                p = colon + 1;
+                pm_skip(&p, ' ');
+                *(long *)((char *)&m->usage + pm_fields[i].offset) = pm_dec(&p);
+                break;
+            }
+        }
+        p = strchr(colon, '\n');
+        p = p ? p + 1 : colon + strlen(colon);
+    }
+    *pos = p;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,114 @@
+// statedump without gdb: the memory mappings of a process as markdown.
+//
+// Writes the "Memory Mappings" table of statedump.py (see plot.md) from
+// /proc/<pid>/maps, followed by the totals of /proc/<pid>/smaps_rollup.
+// There are no registers: those need gdb (or ptrace) to stop the process.
+//
+// Usage: ./statedump [-o file] [-n snapshots] [pid]
+//   pid defaults to statedump itself;
+//   -n takes that many snapshots in a row (writing the last one) and
+//      reports the time per snapshot on stderr.
+
+#include "procmaps.h"
+#include <stdlib.h>
+#include <time.h>
+
+static char maps[4 << 20], rollup[4096], out[8 << 20];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Formats one snapshot into out; returns its length, or -1.
+static int snapshot(int maps_fd, int rollup_fd) {
+    struct pm_map m;
+    char *pos = maps;
+    int len = 0;
+
+#define OUT(...) len += snprintf(out + len, len < sizeof(out) ? sizeof(out) - len : 0, __VA_ARGS__)
+    if (pm_read(maps_fd, maps, sizeof(maps)) < 0) {
+        return -1;
+    }
+    OUT("# Memory Mappings\n\n");
+    OUT("| Start Address | End Address | Size | Permissions | Name |\n");
+    OUT("|---------------|-------------|------|--------------|------|\n");
+    while (pm_next(&pos, &m)) {
+        OUT("| 0x%lx | 0x%lx | 0x%lx | %s | %s |\n", m.start, m.end, m.end - m.start, m.perms, m.name);
+    }
+
+    if (rollup_fd >= 0) {
+        pos = rollup;
+        if (pm_read(rollup_fd, rollup, sizeof(rollup)) < 0 || !pm_next(&pos, &m)) {
+            return -1;
+        }
+        struct pm_usage *u = &m.usage;
+        OUT("\n# Memory Usage\n\n");
+        OUT("| Field | KiB |\n");
+        OUT("|-------|-----|\n");
+        OUT("| Rss | %ld |\n| Pss | %ld |\n", u->rss, u->pss);
+        OUT("| Pss_Anon | %ld |\n| Pss_File | %ld |\n| Pss_Shmem | %ld |\n", u->pss_anon, u->pss_file, u->pss_shmem);
+        OUT("| Shared_Clean | %ld |\n| Shared_Dirty | %ld |\n", u->shared_clean, u->shared_dirty);
+        OUT("| Private_Clean | %ld |\n| Private_Dirty | %ld |\n", u->private_clean, u->private_dirty);
+        OUT("| Anonymous | %ld |\n| AnonHugePages | %ld |\n", u->anonymous, u->anon_huge);
+        OUT("| Swap | %ld |\n| Locked | %ld |\n", u->swap, u->locked);
+    }
+#undef OUT
+    if (len >= sizeof(out)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    return len;
+}
+
+int main(int argc, char *argv[]) {
+    const char *file = NULL;
+    long snapshots = 1;
+    pid_t pid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:n:")) != -1) {
+        switch (opt) {
+        case 'o': file = optarg; break;
+        case 'n': snapshots = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-o file] [-n snapshots] [pid]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        pid = atoi(argv[optind]);
+    }
+
+    int maps_fd = pm_open(pid, "maps");
+    if (maps_fd < 0) {
+        perror("maps");
+        return 1;
+    }
+    int rollup_fd = pm_open(pid, "smaps_rollup");  // Linux 4.14 and later
+
+    int len = -1;
+    double t = now();
+    for (long i = 0; i < snapshots; i++) {
+        if ((len = snapshot(maps_fd, rollup_fd)) < 0) {
+            perror("snapshot");
+            return 1;
+        }
+    }
+    t = now() - t;
+    if (snapshots > 1) {
+        fprintf(stderr, "%ld snapshots, %.1f us per snapshot\n", snapshots, t * 1e6 / snapshots);
+    }
+
+    FILE *fp = file ? fopen(file, "w") : stdout;
+    if (!fp) {
+        perror(file);
+        return 1;
+    }
+    fwrite(out, 1, len, fp);
+    if (file) {
+        fclose(fp);
+        printf("Markdown table written to %s\n", file);
+    }
+}
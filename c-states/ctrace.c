@@ -0,0 +1,1312 @@
+// ctrace: the states of a C program, without gdb.
+//
+// tracer.py drives gdb through pexpect ("step", "info locals", and regular
+// expressions over the output), milliseconds per line. This does the same
+// with ptrace() directly: it reads the DWARF debug information of the
+// program once, runs it to main(), and single-steps it. Every time the
+// program reaches the start of a source line, the locals and arguments of
+// the current function are read from its stack frame and written as a
+// JSON line:
+//
+//   {"step":3,"func":"main","line":5,"statement":"if (n % 2 == 0) {","state":{"n":"5","steps":"0"}}
+//
+// With -m, the trace is also written as a mermaid state diagram, like
+// sample.md, and with -d as a graphviz dot file. Both are written as the
+// program runs, so very long traces do not have to fit in memory.
+//
+// Calls into shared libraries (printf() and friends) are run at full speed
+// rather than stepped.
+//
+// With -b, there is no single-stepping: a breakpoint on every line of the
+// line table stops the program, and a state is only recorded when the
+// locals differ from the last one. Equal states (the same function and
+// values) are one node of the diagram, with a count of visits, so that
+// recursive programs like hanoi() give a small graph ("node" and
+// "visits" are added to the JSON lines).
+//
+// Usage: ./ctrace [-b] [-m plot.md] [-d graph.dot] [-n max-states] program [args...]
+//
+// The program must be built with -g -O0 (see the Makefile), for x86-64:
+// locals are found at DW_OP_fbreg offsets from the frame's CFA, which is
+// rbp + 16 past the prologue.
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// DWARF constants (from the DWARF 5 standard, section 7)
+#define DW_TAG_array_type        0x01
+#define DW_TAG_formal_parameter  0x05
+#define DW_TAG_lexical_block     0x0b
+#define DW_TAG_pointer_type      0x0f
+#define DW_TAG_compile_unit      0x11
+#define DW_TAG_typedef           0x16
+#define DW_TAG_base_type         0x24
+#define DW_TAG_const_type        0x26
+#define DW_TAG_subprogram        0x2e
+#define DW_TAG_variable          0x34
+#define DW_TAG_volatile_type     0x35
+
+#define DW_AT_location   0x02
+#define DW_AT_name       0x03
+#define DW_AT_byte_size  0x0b
+#define DW_AT_stmt_list  0x10
+#define DW_AT_low_pc     0x11
+#define DW_AT_high_pc    0x12
+#define DW_AT_comp_dir   0x1b
+#define DW_AT_encoding   0x3e
+#define DW_AT_type       0x49
+
+#define DW_ATE_boolean        0x02
+#define DW_ATE_float          0x04
+#define DW_ATE_signed_char    0x06
+#define DW_ATE_unsigned       0x07
+#define DW_ATE_unsigned_char  0x08
+
+#define DW_OP_fbreg 0x91
+
+#define MAX_STATE 1024          // Bytes of formatted locals per state
+
+static void die(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        die("realloc");
+    }
+    return p;
+}
+
+// Appends one element to a growable array
+#define PUSH(arr, n, cap, ...) do { \
+        if ((n) == (cap)) { \
+            (cap) = (cap) ? 2 * (cap) : 64; \
+            (arr) = xrealloc((arr), (cap) * sizeof(*(arr))); \
+        } \
+        (arr)[(n)++] = (__typeof__(*(arr))){ __VA_ARGS__ }; \
+    } while (0)
+
+// ---------------------------------------------------------------------------
+// ELF sections
+
+struct section {
+    const uint8_t *data;
+    size_t size;
+};
+
+static struct section debug_info, debug_abbrev, debug_line, debug_str, debug_line_str;
+static int pie;
+
+static void load_elf(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        die(path);
+    }
+    const uint8_t *elf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (elf == MAP_FAILED) {
+        die("mmap");
+    }
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)elf;
+    if (st.st_size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_machine != EM_X86_64) {
+        fprintf(stderr, "%s: not an x86-64 ELF file\n", path);
+        exit(1);
+    }
+    pie = eh->e_type == ET_DYN;
+
+    const Elf64_Shdr *sh = (const Elf64_Shdr *)(elf + eh->e_shoff);
+    const char *names = (const char *)elf + sh[eh->e_shstrndx].sh_offset;
+    static const struct {
+        const char *name;
+        struct section *s;
+    } wanted[] = {
+        { ".debug_info", &debug_info },
+        { ".debug_abbrev", &debug_abbrev },
+        { ".debug_line", &debug_line },
+        { ".debug_str", &debug_str },
+        { ".debug_line_str", &debug_line_str },
+    };
+    for (int i = 0; i < eh->e_shnum; i++) {
+        for (int j = 0; j < sizeof(wanted) / sizeof(wanted[0]); j++) {
+            if (sh[i].sh_type != SHT_NOBITS && strcmp(names + sh[i].sh_name, wanted[j].name) == 0) {
+                *wanted[j].s = (struct section){ elf + sh[i].sh_offset, sh[i].sh_size };
+            }
+        }
+    }
+    if (!debug_info.data || !debug_abbrev.data || !debug_line.data) {
+        fprintf(stderr, "%s: no debug information (build it with -g)\n", path);
+        exit(1);
+    }
+}
+
+static uint64_t uleb(const uint8_t **p) {
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t b = *(*p)++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+}
+
+static int64_t sleb(const uint8_t **p) {
+    int64_t v = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *(*p)++;
+        v |= (int64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    if (shift < 64 && (b & 0x40)) {
+        v |= -((int64_t)1 << shift);
+    }
+    return v;
+}
+
+static uint64_t fixed(const uint8_t **p, int n) {
+    uint64_t v = 0;
+    memcpy(&v, *p, n);  // Little endian
+    *p += n;
+    return v;
+}
+
+// ---------------------------------------------------------------------------
+// .debug_info: functions, their variables, and types
+
+struct type {
+    uint64_t offset;            // In .debug_info
+    int tag, encoding;
+    uint64_t size, type;        // type: the type this one refers to (0: none)
+};
+
+struct var {
+    const char *name;
+    uint64_t type;
+    int64_t fbreg;              // Offset from the CFA
+    uint64_t low, high;         // Scope (a lexical block, or the function)
+};
+
+struct func {
+    const char *name;
+    uint64_t low, high;
+    int first_var, nvars;
+};
+
+static struct type *types;
+static struct var *vars;
+static struct func *funcs;
+static int ntypes, nvars, nfuncs, types_cap, vars_cap, funcs_cap;
+
+struct abbrev {
+    uint64_t tag;
+    int children, nattrs;
+    struct { uint64_t name, form; int64_t implicit; } *attrs;
+};
+
+struct unit {
+    uint64_t offset;            // Of the unit header, for CU-relative refs
+    int version, addr_size, offset_size;
+    struct abbrev *abbrevs;
+    uint64_t nabbrevs;
+};
+
+static void read_abbrevs(struct unit *u, uint64_t offset) {
+    const uint8_t *p = debug_abbrev.data + offset;
+    uint64_t code;
+
+    u->abbrevs = NULL;
+    u->nabbrevs = 0;
+    while ((code = uleb(&p)) != 0) {
+        if (code >= u->nabbrevs) {
+            uint64_t n = code + 64;
+            u->abbrevs = xrealloc(u->abbrevs, n * sizeof(struct abbrev));
+            memset(u->abbrevs + u->nabbrevs, 0, (n - u->nabbrevs) * sizeof(struct abbrev));
+            u->nabbrevs = n;
+        }
+        struct abbrev *a = &u->abbrevs[code];
+        int cap = 0;
+        a->tag = uleb(&p);
+        a->children = *p++;
+        for (;;) {
+            uint64_t name = uleb(&p), form = uleb(&p);
+            int64_t implicit = form == 0x21 ? sleb(&p) : 0;  // DW_FORM_implicit_const
+            if (!name && !form) {
+                break;
+            }
+            if (a->nattrs == cap) {
+                cap = cap ? 2 * cap : 8;
+                a->attrs = xrealloc(a->attrs, cap * sizeof(*a->attrs));
+            }
+            a->attrs[a->nattrs].name = name;
+            a->attrs[a->nattrs].form = form;
+            a->attrs[a->nattrs++].implicit = implicit;
+        }
+    }
+}
+
+struct value {
+    uint64_t u;                 // Constants, addresses, absolute DIE offsets
+    const char *str;
+    const uint8_t *block;
+    int is_data;                // A constant class form (for DW_AT_high_pc)
+};
+
+// Reads an attribute value of the given form and moves p past it.
+static struct value read_form(const struct unit *u, uint64_t form, int64_t implicit, const uint8_t **p) {
+    struct value v = { 0 };
+    int os = u->offset_size;
+
+    switch (form) {
+    case 0x01: v.u = fixed(p, u->addr_size); break;                    // addr
+    case 0x03: v.u = fixed(p, 2); v.block = *p; *p += v.u; break;      // block2
+    case 0x04: v.u = fixed(p, 4); v.block = *p; *p += v.u; break;      // block4
+    case 0x05: v.u = fixed(p, 2); v.is_data = 1; break;                // data2
+    case 0x06: v.u = fixed(p, 4); v.is_data = 1; break;                // data4
+    case 0x07: v.u = fixed(p, 8); v.is_data = 1; break;                // data8
+    case 0x08: v.str = (const char *)*p; *p += strlen(v.str) + 1; break;  // string
+    case 0x09:                                                          // block
+    case 0x18: v.u = uleb(p); v.block = *p; *p += v.u; break;          // exprloc
+    case 0x0a: v.u = fixed(p, 1); v.block = *p; *p += v.u; break;      // block1
+    case 0x0b: v.u = fixed(p, 1); v.is_data = 1; break;                // data1
+    case 0x0c: v.u = fixed(p, 1); break;                               // flag
+    case 0x0d: v.u = sleb(p); v.is_data = 1; break;                    // sdata
+    case 0x0e: v.u = fixed(p, os); v.str = debug_str.data ? (const char *)debug_str.data + v.u : NULL; break;
+    case 0x0f: v.u = uleb(p); v.is_data = 1; break;                    // udata
+    case 0x10: v.u = fixed(p, os); break;                              // ref_addr
+    case 0x11: v.u = u->offset + fixed(p, 1); break;                   // ref1
+    case 0x12: v.u = u->offset + fixed(p, 2); break;                   // ref2
+    case 0x13: v.u = u->offset + fixed(p, 4); break;                   // ref4
+    case 0x14: v.u = u->offset + fixed(p, 8); break;                   // ref8
+    case 0x15: v.u = u->offset + uleb(p); break;                       // ref_udata
+    case 0x16: form = uleb(p); return read_form(u, form, 0, p);        // indirect
+    case 0x17: v.u = fixed(p, os); break;                              // sec_offset
+    case 0x19: v.u = 1; break;                                         // flag_present
+    case 0x1a: case 0x1b: case 0x22: case 0x23: uleb(p); break;        // strx, addrx, loclistx, rnglistx
+    case 0x1c: *p += 4; break;                                         // ref_sup4
+    case 0x1d: *p += os; break;                                        // strp_sup
+    case 0x1e: *p += 16; break;                                        // data16
+    case 0x1f: v.u = fixed(p, os); v.str = debug_line_str.data ? (const char *)debug_line_str.data + v.u : NULL; break;
+    case 0x20: case 0x24: *p += 8; break;                              // ref_sig8, ref_sup8
+    case 0x21: v.u = implicit; v.is_data = 1; break;                   // implicit_const
+    case 0x25: case 0x29: *p += 1; break;                              // strx1, addrx1
+    case 0x26: case 0x2a: *p += 2; break;                              // strx2, addrx2
+    case 0x27: case 0x2b: *p += 3; break;                              // strx3, addrx3
+    case 0x28: case 0x2c: *p += 4; break;                              // strx4, addrx4
+    default:
+        fprintf(stderr, "unsupported DWARF form 0x%lx\n", (unsigned long)form);
+        exit(1);
+    }
+    return v;
+}
+
+static uint64_t *stmt_lists;
+static const char **comp_dirs;
+static int nunits, units_cap;
+
+static void read_debug_info(void) {
+    const uint8_t *p = debug_info.data, *end = debug_info.data + debug_info.size;
+
+    while (p < end) {
+        struct unit u = { .offset = p - debug_info.data, .offset_size = 4 };
+        uint64_t length = fixed(&p, 4), abbrev_offset;
+        if (length == 0xffffffff) {
+            length = fixed(&p, 8);
+            u.offset_size = 8;
+        }
+        const uint8_t *unit_end = p + length;
+        u.version = fixed(&p, 2);
+        if (u.version >= 5) {
+            p++;  // unit_type
+            u.addr_size = *p++;
+            abbrev_offset = fixed(&p, u.offset_size);
+        } else {
+            abbrev_offset = fixed(&p, u.offset_size);
+            u.addr_size = *p++;
+        }
+        read_abbrevs(&u, abbrev_offset);
+
+        // The scopes that contain the current DIE: for each depth, the
+        // function (or -1) and the pc range of the innermost block.
+        struct { int func; uint64_t low, high; } scope[256];
+        int depth = 0;
+        scope[0].func = -1;
+
+        while (p < unit_end) {
+            uint64_t offset = p - debug_info.data, code = uleb(&p);
+            if (code == 0) {
+                depth--;
+                if (depth <= 0) {
+                    depth = 0;
+                }
+                continue;
+            }
+            if (code >= u.nabbrevs || !u.abbrevs[code].tag) {
+                fprintf(stderr, "bad DWARF abbreviation %lu\n", (unsigned long)code);
+                exit(1);
+            }
+            const struct abbrev *a = &u.abbrevs[code];
+            const char *name = NULL, *comp_dir = NULL;
+            uint64_t low = 0, high = 0, type = 0, size = 0, encoding = 0, stmt_list = -1;
+            int high_is_size = 0, has_fbreg = 0;
+            int64_t fbreg = 0;
+
+            for (int i = 0; i < a->nattrs; i++) {
+                struct value v = read_form(&u, a->attrs[i].form, a->attrs[i].implicit, &p);
+                switch (a->attrs[i].name) {
+                case DW_AT_name: name = v.str; break;
+                case DW_AT_comp_dir: comp_dir = v.str; break;
+                case DW_AT_low_pc: low = v.u; break;
+                case DW_AT_high_pc: high = v.u; high_is_size = v.is_data; break;
+                case DW_AT_type: type = v.u; break;
+                case DW_AT_byte_size: size = v.u; break;
+                case DW_AT_encoding: encoding = v.u; break;
+                case DW_AT_stmt_list: stmt_list = v.u; break;
+                case DW_AT_location:
+                    if (v.block && v.u > 0 && v.block[0] == DW_OP_fbreg) {
+                        const uint8_t *q = v.block + 1;
+                        fbreg = sleb(&q);
+                        has_fbreg = 1;
+                    }
+                    break;
+                }
+            }
+            if (high_is_size) {
+                high += low;
+            }
+
+            int func = scope[depth].func;
+            uint64_t scope_low = scope[depth].low, scope_high = scope[depth].high;
+            switch (a->tag) {
+            case DW_TAG_compile_unit:
+                PUSH(stmt_lists, nunits, units_cap, stmt_list);
+                comp_dirs = xrealloc(comp_dirs, units_cap * sizeof(*comp_dirs));
+                comp_dirs[nunits - 1] = comp_dir;
+                break;
+            case DW_TAG_subprogram:
+                if (name && high > low) {
+                    PUSH(funcs, nfuncs, funcs_cap, name, low, high, nvars, 0);
+                    func = nfuncs - 1;
+                    scope_low = low, scope_high = high;
+                }
+                break;
+            case DW_TAG_lexical_block:
+                if (high > low) {
+                    scope_low = low, scope_high = high;
+                }
+                break;
+            case DW_TAG_formal_parameter:
+            case DW_TAG_variable:
+                if (func >= 0 && name && has_fbreg && funcs[func].first_var + funcs[func].nvars == nvars) {
+                    PUSH(vars, nvars, vars_cap, name, type, fbreg, scope_low, scope_high);
+                    funcs[func].nvars++;
+                }
+                break;
+            case DW_TAG_base_type:
+            case DW_TAG_pointer_type:
+            case DW_TAG_typedef:
+            case DW_TAG_const_type:
+            case DW_TAG_volatile_type:
+            case DW_TAG_array_type:
+                PUSH(types, ntypes, types_cap, offset, a->tag, encoding, size, type);
+                break;
+            }
+            if (a->children) {
+                if (++depth >= sizeof(scope) / sizeof(scope[0])) {
+                    fprintf(stderr, "DWARF tree too deep\n");
+                    exit(1);
+                }
+                scope[depth].func = func;
+                scope[depth].low = scope_low;
+                scope[depth].high = scope_high;
+            }
+        }
+        for (uint64_t i = 0; i < u.nabbrevs; i++) {
+            free(u.abbrevs[i].attrs);
+        }
+        free(u.abbrevs);
+        p = unit_end;
+    }
+}
+
+// Types are pushed in .debug_info order, so they are sorted by offset.
+static const struct type *find_type(uint64_t offset) {
+    int lo = 0, hi = ntypes;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (types[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < ntypes && types[lo].offset == offset ? &types[lo] : NULL;
+}
+
+static const struct func *find_func(uint64_t pc) {
+    for (int i = 0; i < nfuncs; i++) {
+        if (pc >= funcs[i].low && pc < funcs[i].high) {
+            return &funcs[i];
+        }
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// .debug_line: where each source line starts
+
+struct line {
+    uint64_t addr;
+    int line, file, order;
+};
+
+struct source {
+    char *path;
+    char *text;                 // Loaded when first needed
+    char **lines;
+    int nlines, loaded;
+};
+
+static struct line *lines;
+static struct source *sources;
+static int nlines, nsources, lines_cap, sources_cap;
+
+static int add_source(const char *dir, const char *name) {
+    char *path;
+    if (name[0] == '/' || !dir) {
+        path = strdup(name);
+    } else if (asprintf(&path, "%s/%s", dir, name) < 0) {
+        die("asprintf");
+    }
+    PUSH(sources, nsources, sources_cap, path, NULL, NULL, 0, 0);
+    return nsources - 1;
+}
+
+// Reads a DWARF 5 directory or file name table; returns source indices
+// for files, or the directory names.
+static int read_entries(const struct unit *u, const uint8_t **p, const char **dirs, int ndirs, const char **names,
+                        int *files) {
+    int nformats = *(*p)++;
+    uint64_t formats[16][2];
+    for (int i = 0; i < nformats && i < 16; i++) {
+        formats[i][0] = uleb(p);
+        formats[i][1] = uleb(p);
+    }
+    int n = uleb(p);
+    for (int i = 0; i < n; i++) {
+        const char *name = NULL;
+        uint64_t dir = 0;
+        for (int j = 0; j < nformats; j++) {
+            struct value v = read_form(u, formats[j][1], 0, p);
+            if (formats[j][0] == 1) {         // DW_LNCT_path
+                name = v.str;
+            } else if (formats[j][0] == 2) {  // DW_LNCT_directory_index
+                dir = v.u;
+            }
+        }
+        if (names && i < 256) {
+            names[i] = name;
+        }
+        if (files && i < 256) {
+            files[i] = add_source(dir < ndirs ? dirs[dir] : NULL, name ? name : "?");
+        }
+    }
+    return n;
+}
+
+static void read_line_program(uint64_t offset, const char *comp_dir) {
+    const uint8_t *p = debug_line.data + offset;
+    struct unit u = { .offset_size = 4, .addr_size = 8 };
+    uint64_t length = fixed(&p, 4);
+    if (length == 0xffffffff) {
+        length = fixed(&p, 8);
+        u.offset_size = 8;
+    }
+    const uint8_t *end = p + length;
+    int version = fixed(&p, 2);
+    if (version >= 5) {
+        u.addr_size = *p++;
+        p++;  // segment_selector_size
+    }
+    uint64_t header_length = fixed(&p, u.offset_size);
+    const uint8_t *program = p + header_length;
+    int min_inst = *p++;
+    if (version >= 4) {
+        p++;  // maximum_operations_per_instruction
+    }
+    int default_is_stmt = *p++;
+    int line_base = (int8_t)*p++, line_range = *p++, opcode_base = *p++;
+    const uint8_t *opcode_lengths = p;
+    p += opcode_base - 1;
+
+    const char *dirs[256] = { comp_dir };
+    int files[256], ndirs = 1, nfiles = 0;
+    if (version >= 5) {
+        ndirs = read_entries(&u, &p, NULL, 0, dirs, NULL);
+        nfiles = read_entries(&u, &p, dirs, ndirs, NULL, files);
+    } else {
+        // include_directories and file_names, both ending with an empty string
+        while (*p && ndirs < 256) {
+            dirs[ndirs++] = (const char *)p;
+            p += strlen((const char *)p) + 1;
+        }
+        p++;
+        files[nfiles++] = -1;  // DWARF 4 file numbers start at 1
+        while (*p && nfiles < 256) {
+            const char *name = (const char *)p;
+            p += strlen(name) + 1;
+            uint64_t dir = uleb(&p);
+            uleb(&p), uleb(&p);  // mtime, length
+            files[nfiles++] = add_source(dir < ndirs ? dirs[dir] : NULL, name);
+        }
+    }
+
+    // The line number state machine (DWARF 5, section 6.2.5)
+    p = program;
+    uint64_t addr = 0;
+    int file = 1, line = 1, is_stmt = default_is_stmt;
+#define ROW() do { \
+        if (is_stmt && file >= 0 && file < nfiles && files[file] >= 0) { \
+            PUSH(lines, nlines, lines_cap, addr, line, files[file], nlines); \
+        } \
+    } while (0)
+    while (p < end) {
+        uint8_t op = *p++;
+        if (op >= opcode_base) {
+            op -= opcode_base;
+            addr += (op / line_range) * min_inst;
+            line += line_base + op % line_range;
+            ROW();
+            continue;
+        }
+        switch (op) {
+        case 0: {  // Extended opcode
+            uint64_t len = uleb(&p);
+            const uint8_t *next = p + len;
+            switch (*p++) {
+            case 1:  // DW_LNE_end_sequence
+                addr = 0, file = 1, line = 1, is_stmt = default_is_stmt;
+                break;
+            case 2:  // DW_LNE_set_address
+                addr = fixed(&p, u.addr_size);
+                break;
+            }
+            p = next;
+            break;
+        }
+        case 1: ROW(); break;                                   // DW_LNS_copy
+        case 2: addr += uleb(&p) * min_inst; break;             // DW_LNS_advance_pc
+        case 3: line += sleb(&p); break;                        // DW_LNS_advance_line
+        case 4: file = uleb(&p); break;                         // DW_LNS_set_file
+        case 5: uleb(&p); break;                                // DW_LNS_set_column
+        case 6: is_stmt = !is_stmt; break;                      // DW_LNS_negate_stmt
+        case 7: break;                                          // DW_LNS_set_basic_block
+        case 8: addr += ((255 - opcode_base) / line_range) * min_inst; break;  // DW_LNS_const_add_pc
+        case 9: addr += fixed(&p, 2); break;                    // DW_LNS_fixed_advance_pc
+        default:
+            for (int i = 0; i < opcode_lengths[op - 1]; i++) {
+                uleb(&p);
+            }
+        }
+    }
+#undef ROW
+}
+
+static int by_addr(const void *a, const void *b) {
+    const struct line *x = a, *y = b;
+    if (x->addr != y->addr) {
+        return x->addr < y->addr ? -1 : 1;
+    }
+    return x->order - y->order;
+}
+
+static void read_lines(void) {
+    for (int i = 0; i < nunits; i++) {
+        if (stmt_lists[i] != (uint64_t)-1 && stmt_lists[i] < debug_line.size) {
+            read_line_program(stmt_lists[i], comp_dirs[i]);
+        }
+    }
+    // Sorted by address; of several rows at one address, the last counts.
+    qsort(lines, nlines, sizeof(struct line), by_addr);
+    int n = 0;
+    for (int i = 0; i < nlines; i++) {
+        if (n > 0 && lines[n - 1].addr == lines[i].addr) {
+            n--;
+        }
+        lines[n++] = lines[i];
+    }
+    nlines = n;
+}
+
+// The line that starts exactly at pc, if any
+static const struct line *line_at(uint64_t pc) {
+    int lo = 0, hi = nlines;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (lines[mid].addr < pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < nlines && lines[lo].addr == pc ? &lines[lo] : NULL;
+}
+
+// The text of a source line, without indentation ("" if not available)
+static const char *source_line(int file, int line) {
+    struct source *s = &sources[file];
+    if (!s->loaded) {
+        s->loaded = 1;
+        FILE *fp = fopen(s->path, "r");
+        size_t size = 0;
+        if (fp && getdelim(&s->text, &size, '\0', fp) > 0) {
+            int cap = 0;
+            for (char *p = s->text; *p;) {
+                char *nl = strchr(p, '\n');
+                PUSH(s->lines, s->nlines, cap, p);
+                if (!nl) {
+                    break;
+                }
+                *nl = '\0';
+                p = nl + 1;
+            }
+        }
+        if (fp) {
+            fclose(fp);
+        }
+    }
+    if (line < 1 || line > s->nlines) {
+        return "";
+    }
+    char *p = s->lines[line - 1];
+    size_t n = strlen(p);
+    if (n > 0 && p[n - 1] == '\r') {
+        p[n - 1] = '\0';
+    }
+    return p + strspn(p, " \t");
+}
+
+// ---------------------------------------------------------------------------
+// The traced process
+
+static pid_t child;
+static uint64_t base;           // Load address (PIE)
+
+static uint64_t peek(uint64_t addr) {
+    errno = 0;
+    uint64_t v = ptrace(PTRACE_PEEKDATA, child, (void *)addr, NULL);
+    if (errno) {
+        die("PTRACE_PEEKDATA");
+    }
+    return v;
+}
+
+static int read_memory(uint64_t addr, void *buf, size_t size) {
+    struct iovec local = { buf, size }, remote = { (void *)addr, size };
+    return process_vm_readv(child, &local, 1, &remote, 1, 0) == (ssize_t)size ? 0 : -1;
+}
+
+// Waits for the child to stop; returns 0 once it has exited.
+static int wait_child(int *status) {
+    if (waitpid(child, status, 0) < 0) {
+        die("waitpid");
+    }
+    return !WIFEXITED(*status) && !WIFSIGNALED(*status);
+}
+
+// Runs the child up to addr (a breakpoint); returns 0 if it exits first.
+static int run_to(uint64_t addr) {
+    uint64_t word = peek(addr);
+    struct user_regs_struct regs;
+    int status;
+
+    if (ptrace(PTRACE_POKEDATA, child, (void *)addr, (void *)((word & ~0xffUL) | 0xcc)) < 0) {
+        die("PTRACE_POKEDATA");
+    }
+    for (;;) {
+        ptrace(PTRACE_CONT, child, NULL, NULL);
+        if (!wait_child(&status)) {
+            return 0;
+        }
+        ptrace(PTRACE_GETREGS, child, NULL, &regs);
+        if (WSTOPSIG(status) == SIGTRAP && regs.rip == addr + 1) {
+            break;
+        }
+    }
+    ptrace(PTRACE_POKEDATA, child, (void *)addr, (void *)word);
+    regs.rip = addr;
+    ptrace(PTRACE_SETREGS, child, NULL, &regs);
+    return 1;
+}
+
+static uint64_t load_base(void) {
+    char path[64];
+    unsigned long start = 0;
+
+    if (!pie) {
+        return 0;
+    }
+    // The program is mapped first: below the heap and the libraries
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int)child);
+    FILE *fp = fopen(path, "r");
+    if (!fp || fscanf(fp, "%lx-", &start) != 1) {
+        die(path);
+    }
+    fclose(fp);
+    return start;
+}
+
+// Formats a value of the given type like gdb does, as far as it can.
+static void format_value(char *out, size_t size, uint64_t type_offset, uint64_t addr) {
+    const struct type *t = find_type(type_offset);
+    while (t && (t->tag == DW_TAG_typedef || t->tag == DW_TAG_const_type || t->tag == DW_TAG_volatile_type)) {
+        t = find_type(t->type);
+    }
+    uint8_t bytes[8] = { 0 };
+
+    if (!t || t->tag == DW_TAG_array_type) {
+        snprintf(out, size, "{...}");
+        return;
+    }
+    uint64_t n = t->tag == DW_TAG_pointer_type ? 8 : t->size;
+    if (n == 0 || n > 8 || read_memory(addr, bytes, n) < 0) {
+        snprintf(out, size, "<unreadable>");
+        return;
+    }
+    uint64_t u;
+    memcpy(&u, bytes, 8);
+    int64_t s = n < 8 ? (int64_t)(u << (64 - 8 * n)) >> (64 - 8 * n) : (int64_t)u;
+
+    if (t->tag == DW_TAG_pointer_type) {
+        snprintf(out, size, "0x%lx", (unsigned long)u);
+    } else if (t->encoding == DW_ATE_float) {
+        float f;
+        double d;
+        memcpy(&f, bytes, 4);
+        memcpy(&d, bytes, 8);
+        snprintf(out, size, "%g", n == 4 ? f : d);
+    } else if (t->encoding == DW_ATE_boolean) {
+        snprintf(out, size, "%s", u ? "true" : "false");
+    } else if (t->encoding == DW_ATE_signed_char || t->encoding == DW_ATE_unsigned_char) {
+        int c = t->encoding == DW_ATE_signed_char ? (int)s : (int)(u & 0xff);
+        if ((c & 0x7f) >= 32 && c < 127 && c != '\'' && c != '\\') {
+            snprintf(out, size, "%d '%c'", c, c);
+        } else {
+            snprintf(out, size, "%d", c);
+        }
+    } else if (t->encoding == DW_ATE_unsigned) {
+        snprintf(out, size, "%lu", (unsigned long)(n < 8 ? u & ((1UL << 8 * n) - 1) : u));
+    } else {
+        snprintf(out, size, "%ld", (long)s);
+    }
+}
+
+// The locals of the current frame, as JSON members and as the text of a
+// mermaid state
+struct state {
+    char json[MAX_STATE], text[MAX_STATE];
+    uint64_t hash;
+};
+
+static void append(char *buf, int *len, const char *fmt, const char *a, const char *b, const char *c) {
+    if (*len < MAX_STATE) {
+        *len += snprintf(buf + *len, MAX_STATE - *len, fmt, a, b, c);
+    }
+}
+
+static uint64_t fnv1a(uint64_t h, const char *s) {
+    for (; *s; s++) {
+        h = (h ^ (uint8_t)*s) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void read_state(const struct func *f, uint64_t pc, uint64_t cfa, struct state *st, int with_func) {
+    int json_len = 0, text_len = 0;
+
+    st->json[0] = st->text[0] = '\0';
+    if (with_func) {
+        append(st->text, &text_len, "%s()%s%s", f->name, "", "");
+    }
+    for (int i = 0; i < f->nvars; i++) {
+        const struct var *v = &vars[f->first_var + i];
+        char value[128], name[128], quoted[256];
+        if (pc < v->low || pc >= v->high) {
+            continue;
+        }
+        format_value(value, sizeof(value), v->type, cfa + v->fbreg);
+        snprintf(name, sizeof(name), "\"%s\"", v->name);  // DWARF names need no escaping
+        int q = 0;
+        quoted[q++] = '"';
+        for (const char *s = value; *s && q < sizeof(quoted) - 3; s++) {
+            if (*s == '"' || *s == '\\') {
+                quoted[q++] = '\\';
+            }
+            quoted[q++] = *s;
+        }
+        quoted[q++] = '"';
+        quoted[q] = '\0';
+        append(st->json, &json_len, "%s%s:%s", json_len ? "," : "", name, quoted);
+        append(st->text, &text_len, "%s%s = %s", text_len ? "<br>" : "", v->name, value);
+    }
+    st->hash = fnv1a(fnv1a(0xcbf29ce484222325ULL, f->name), st->text);
+}
+
+static void json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(fp, "\\%c", *s);
+        } else if ((unsigned char)*s < 32) {
+            fprintf(fp, "\\u%04x", *s);
+        } else {
+            fputc(*s, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+// "2 - int n = 5, steps = 0": mermaid labels end at a ':' and cannot
+// contain '"'; the trailing ';' is dropped like in sample.md.
+static char *edge_label(const struct line *l) {
+    char *label;
+    if (asprintf(&label, "%d - %s", l->line, source_line(l->file, l->line)) < 0) {
+        die("asprintf");
+    }
+    for (char *p = label; *p; p++) {
+        if (*p == '"' || *p == ':') {
+            *p = '\'';
+        }
+    }
+    size_t n = strlen(label);
+    if (n > 0 && label[n - 1] == ';') {
+        label[n - 1] = '\0';
+    }
+    return label;
+}
+
+// The state diagram, written while the program runs. Without -b, every
+// recorded step is a new node and the nodes form a chain. With -b, a node
+// is a distinct state (function and locals), and an edge a distinct
+// (from, to, line); revisiting one only counts it.
+//
+// Nothing of the graph is kept in memory: nodes and edges are written
+// out as they are discovered, and the index that finds a state again is
+// a hash table in a file (mapped, so the kernel pages it out as it
+// grows), with the state texts in another one. Visit counts are only
+// known at the end: they are added to the nodes then (mermaid joins all
+// descriptions of a state, and dot all attributes of a node).
+struct slot {
+    uint64_t hash;
+    uint32_t used;              // Node: id + 1; edge: from + 1; 0: empty
+    uint32_t a;                 // Node: text length; edge: to
+    uint64_t b;                 // Node: text offset; edge: line index
+    uint64_t count;             // Visits
+};
+
+struct index {
+    struct slot *slots;
+    uint64_t size, used;
+};
+
+static struct index node_index, edge_index;
+static int text_fd = -1;
+static uint64_t text_len;
+static int nnodes;
+static long nedges, nsteps;
+static FILE *mermaid, *dot;
+
+// A zero-filled, unlinked file of size bytes in $TMPDIR, mapped
+static struct slot *map_index(uint64_t size) {
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/ctrace.XXXXXX", dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0 || unlink(path) < 0 || ftruncate(fd, size) < 0) {
+        die(path);
+    }
+    struct slot *slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (slots == MAP_FAILED) {
+        die("mmap");
+    }
+    return slots;
+}
+
+static int text_of(const struct slot *s, char *buf) {
+    return pread(text_fd, buf, s->a, s->b) == s->a ? (buf[s->a] = '\0', 0) : -1;
+}
+
+static int node_matches(const struct slot *s, const void *text) {
+    char buf[MAX_STATE];
+    return s->a == strlen(text) && text_of(s, buf) == 0 && strcmp(buf, text) == 0;
+}
+
+static int edge_matches(const struct slot *s, const void *key) {
+    const struct slot *e = key;
+    return s->used == e->used && s->a == e->a && s->b == e->b;
+}
+
+// The slot for hash: the matching one, or the empty one to fill in.
+static struct slot *index_find(struct index *t, uint64_t hash, int (*match)(const struct slot *, const void *),
+                               const void *key) {
+    if (2 * (t->used + 1) > t->size) {
+        struct index bigger = { .size = t->size ? 2 * t->size : 1 << 16, .used = t->used };
+        bigger.slots = map_index(bigger.size * sizeof(struct slot));
+        for (uint64_t i = 0; i < t->size; i++) {
+            if (t->slots[i].used) {
+                uint64_t j = t->slots[i].hash & (bigger.size - 1);
+                while (bigger.slots[j].used) {
+                    j = (j + 1) & (bigger.size - 1);
+                }
+                bigger.slots[j] = t->slots[i];
+            }
+        }
+        if (t->slots) {
+            munmap(t->slots, t->size * sizeof(struct slot));
+        }
+        *t = bigger;
+    }
+    uint64_t i = hash & (t->size - 1);
+    while (t->slots[i].used && (t->slots[i].hash != hash || !match(&t->slots[i], key))) {
+        i = (i + 1) & (t->size - 1);
+    }
+    return &t->slots[i];
+}
+
+// Writes s for a dot label: "<br>" becomes a line break, quotes escaped.
+static void dot_label(FILE *fp, const char *s) {
+    for (; *s; s++) {
+        if (strncmp(s, "<br>", 4) == 0) {
+            fputs("\\n", fp);
+            s += 3;
+        } else {
+            if (*s == '"' || *s == '\\') {
+                fputc('\\', fp);
+            }
+            fputc(*s, fp);
+        }
+    }
+}
+
+static void graph_open(const char *mermaid_path, const char *dot_path) {
+    if (mermaid_path) {
+        if (!(mermaid = fopen(mermaid_path, "w"))) {
+            die(mermaid_path);
+        }
+        fprintf(mermaid, "```mermaid\nstateDiagram-v2\n");
+    }
+    if (dot_path) {
+        if (!(dot = fopen(dot_path, "w"))) {
+            die(dot_path);
+        }
+        fprintf(dot, "digraph states {\n  node [shape=box, style=filled, fillcolor=lightblue];\n");
+    }
+}
+
+// The node of a state (always a new one unless dedup is set)
+static int graph_node(const struct state *st, int dedup, long *visits) {
+    struct slot *s = NULL;
+    if (dedup) {
+        if (text_fd < 0) {
+            text_fd = fileno(tmpfile());
+        }
+        s = index_find(&node_index, st->hash, node_matches, st->text);
+        if (s->used) {
+            *visits = ++s->count;
+            return s->used - 1;
+        }
+        uint32_t len = strlen(st->text);
+        if (pwrite(text_fd, st->text, len, text_len) != len) {
+            die("pwrite");
+        }
+        *s = (struct slot){ st->hash, nnodes + 1, len, text_len, 1 };
+        text_len += len;
+        node_index.used++;
+    }
+    *visits = 1;
+    if (mermaid) {
+        fprintf(mermaid, "    S%d: %s\n", nnodes, st->text);
+        if (nnodes == 0) {
+            fprintf(mermaid, "    [*] --> S0\n");
+        }
+    }
+    if (dot) {
+        fprintf(dot, "  S%d [label=\"", nnodes);
+        dot_label(dot, st->text);
+        fprintf(dot, "\"];\n");
+    }
+    return nnodes++;
+}
+
+static void graph_edge(int from, int to, const struct line *line, int dedup) {
+    if (dedup) {
+        struct slot e = { 0, from + 1, to, line - lines, 1 };
+        e.hash = (from * 0x9e3779b97f4a7c15ULL) ^ (to * 0xff51afd7ed558ccdULL) ^ (e.b * 0xc4ceb9fe1a85ec53ULL);
+        struct slot *s = index_find(&edge_index, e.hash, edge_matches, &e);
+        if (s->used) {
+            s->count++;
+            return;
+        }
+        *s = e;
+        edge_index.used++;
+    }
+    nedges++;
+    if (!mermaid && !dot) {
+        return;
+    }
+    char *label = edge_label(line);
+    if (mermaid) {
+        fprintf(mermaid, "    S%d --> S%d : %s\n", from, to, label);
+    }
+    if (dot) {
+        fprintf(dot, "  S%d -> S%d [label=\"", from, to);
+        dot_label(dot, label);
+        fprintf(dot, "\"];\n");
+    }
+    free(label);
+}
+
+static void graph_close(void) {
+    for (uint64_t i = 0; i < node_index.size; i++) {
+        const struct slot *s = &node_index.slots[i];
+        if (s->used && s->count > 1) {
+            if (mermaid) {
+                fprintf(mermaid, "    S%u: (%lu visits)\n", s->used - 1, (unsigned long)s->count);
+            }
+            if (dot) {
+                fprintf(dot, "  S%u [xlabel=\"%lu visits\"];\n", s->used - 1, (unsigned long)s->count);
+            }
+        }
+    }
+    if (mermaid) {
+        fprintf(mermaid, "```\n");
+        fclose(mermaid);
+    }
+    if (dot) {
+        fprintf(dot, "}\n");
+        fclose(dot);
+    }
+}
+
+// Writes a state at the start of a line as a JSON line, and adds it to
+// the diagram. With dedup, a state equal to the current one is not
+// recorded again; the edge to the next state will carry the last line.
+static int current = -1;
+static char current_text[MAX_STATE];
+static const struct line *current_line;
+
+static void record(const struct func *f, const struct line *l, uint64_t pc, uint64_t cfa, int dedup) {
+    struct state st;
+    read_state(f, pc, cfa, &st, dedup);
+    if (dedup && current >= 0 && strcmp(current_text, st.text) == 0) {
+        current_line = l;
+        return;
+    }
+
+    long visits;
+    int node = graph_node(&st, dedup, &visits);
+    if (current >= 0) {
+        graph_edge(current, node, current_line, dedup);
+    }
+    printf("{\"step\":%ld,\"func\":", nsteps++);
+    json_string(stdout, f->name);
+    printf(",\"line\":%d,\"statement\":", l->line);
+    json_string(stdout, source_line(l->file, l->line));
+    printf(",\"state\":{%s}", st.json);
+    if (dedup) {
+        printf(",\"node\":%d,\"visits\":%ld", node, visits);
+    }
+    printf("}\n");
+    current = node;
+    strcpy(current_text, st.text);
+    current_line = l;
+}
+
+// Replaces the byte at addr, keeping its neighbours (which can be other
+// breakpoints).
+static uint8_t poke_byte(uint64_t addr, uint8_t byte) {
+    uint64_t word = peek(addr);
+    if (ptrace(PTRACE_POKEDATA, child, (void *)addr, (void *)((word & ~0xffUL) | byte)) < 0) {
+        die("PTRACE_POKEDATA");
+    }
+    return word & 0xff;
+}
+
+// Single-steps the program from main(), recording every line it gets to.
+static int trace_steps(const struct func *main_func, long max_states) {
+    // Like gdb's "step", a line is recorded once when the program gets to
+    // it, not again for its other rows in the line table (a loop condition,
+    // the epilogue of "}", ...) as long as it stays in the same frame.
+    const struct line *last = NULL;
+    uint64_t last_cfa = 0;
+    int status;
+
+    int running = run_to(base + main_func->low);
+    while (running && nsteps < max_states) {
+        struct user_regs_struct regs;
+        ptrace(PTRACE_GETREGS, child, NULL, &regs);
+        uint64_t pc = regs.rip - base;
+        const struct func *f = find_func(pc);
+
+        if (!f) {
+            // Left the program's code. After a call (into the PLT), the
+            // return address is on top of the stack: run to it at full
+            // speed. After main() returns, just let the program finish.
+            uint64_t ret = peek(regs.rsp);
+            if (!find_func(ret - base)) {
+                break;
+            }
+            running = run_to(ret);
+            continue;
+        }
+        const struct line *l = line_at(pc);
+        uint64_t cfa = regs.rbp + 16;
+        if (l && pc != f->low && (!last || l->line != last->line || l->file != last->file || cfa != last_cfa)) {
+            record(f, l, pc, cfa, 0);
+            last = l;
+            last_cfa = cfa;
+        }
+
+        ptrace(PTRACE_SINGLESTEP, child, NULL, NULL);
+        running = wait_child(&status);
+        if (running && WSTOPSIG(status) != SIGTRAP) {
+            // Deliver it with the next step
+            ptrace(PTRACE_SINGLESTEP, child, NULL, (void *)(long)WSTOPSIG(status));
+            running = wait_child(&status);
+        }
+    }
+    return running;
+}
+
+// -b: a breakpoint at the start of every line, and the program runs at
+// full speed in between. Only changes of state are recorded.
+static int trace_breakpoints(long max_states) {
+    uint8_t *saved = xrealloc(NULL, nlines);
+    int status;
+
+    for (int i = 0; i < nlines; i++) {
+        const struct func *f = find_func(lines[i].addr);
+        if (f && lines[i].addr != f->low) {
+            saved[i] = poke_byte(base + lines[i].addr, 0xcc);
+        }
+    }
+
+    int running = 1, sig = 0;
+    while (nsteps < max_states) {
+        ptrace(PTRACE_CONT, child, NULL, (void *)(long)sig);
+        if (!(running = wait_child(&status))) {
+            break;
+        }
+        sig = WSTOPSIG(status) == SIGTRAP ? 0 : WSTOPSIG(status);
+        struct user_regs_struct regs;
+        ptrace(PTRACE_GETREGS, child, NULL, &regs);
+        const struct line *l = line_at(regs.rip - 1 - base);
+        if (sig || !l) {
+            continue;
+        }
+
+        // Back to the breakpoint, record, and step over the original
+        // instruction
+        regs.rip--;
+        ptrace(PTRACE_SETREGS, child, NULL, &regs);
+        record(find_func(l->addr), l, l->addr, regs.rbp + 16, 1);
+        poke_byte(regs.rip, saved[l - lines]);
+        ptrace(PTRACE_SINGLESTEP, child, NULL, NULL);
+        if (!(running = wait_child(&status))) {
+            break;
+        }
+        poke_byte(regs.rip, 0xcc);
+    }
+    free(saved);
+    return running;
+}
+
+int main(int argc, char *argv[]) {
+    const char *mermaid_path = NULL, *dot_path = NULL;
+    long max_states = 100000;
+    int breakpoints = 0, opt;
+
+    while ((opt = getopt(argc, argv, "+bd:m:n:")) != -1) {
+        switch (opt) {
+        case 'b': breakpoints = 1; break;
+        case 'd': dot_path = optarg; break;
+        case 'm': mermaid_path = optarg; break;
+        case 'n': max_states = atol(optarg); break;
+        default: goto usage;
+        }
+    }
+    if (optind >= argc) {
+usage:
+        fprintf(stderr, "Usage: %s [-b] [-m plot.md] [-d graph.dot] [-n max-states] program [args...]\n", argv[0]);
+        return 1;
+    }
+
+    load_elf(argv[optind]);
+    read_debug_info();
+    read_lines();
+    const struct func *main_func = NULL;
+    for (int i = 0; i < nfuncs; i++) {
+        if (strcmp(funcs[i].name, "main") == 0) {
+            main_func = &funcs[i];
+        }
+    }
+    if (!main_func) {
+        fprintf(stderr, "%s: no main() in the debug information\n", argv[optind]);
+        return 1;
+    }
+
+    child = fork();
+    if (child < 0) {
+        die("fork");
+    }
+    if (child == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        execv(argv[optind], argv + optind);
+        perror(argv[optind]);
+        _exit(127);
+    }
+    int status;
+    if (!wait_child(&status)) {  // Stopped at execv()
+        return 1;
+    }
+    ptrace(PTRACE_SETOPTIONS, child, NULL, (void *)PTRACE_O_EXITKILL);
+    base = load_base();
+
+    graph_open(mermaid_path, dot_path);
+    int running = breakpoints ? trace_breakpoints(max_states) : trace_steps(main_func, max_states);
+    if (running) {
+        if (nsteps >= max_states) {
+            kill(child, SIGKILL);
+        } else {
+            ptrace(PTRACE_DETACH, child, NULL, NULL);
+        }
+        waitpid(child, &status, 0);
+    }
+    fflush(stdout);
+    graph_close();
+    if (mermaid_path || dot_path) {
+        fprintf(stderr, "%d states, %ld transitions written\n", nnodes, nedges);
+    }
+    return 0;
+}
@@ -9,9 +9,11 @@ import java.io.*;
 
 public class FibonacciStateVisualizer {
     private VirtualMachine vm;
-    private final List<StateNode> stateNodes = new ArrayList<>();
-    private final Map<Long, StateNode> threadCallMap = new HashMap<>();
+    // 每个线程当前的调用栈（只保存还没有返回的调用）
+    private final Map<Long, Deque<StateNode>> callStacks = new HashMap<>();
     private int nodeCounter = 0;
+    // 节点和边在发现时就写入 .dot 文件，不在内存中保存整棵调用树
+    private PrintWriter dotWriter;
 
     public static void main(String[] args) {
         if (args.length < 1) {
@@ -73,6 +75,9 @@ public class FibonacciStateVisualizer {
             methodExitRequest.addClassFilter("org.example.Fibonacci");
             methodExitRequest.enable();
 
+            String fileName = "fibonacci_" + n + "_state_graph.dot";
+            openDotGraph(fileName);
+
             // 处理事件
             System.out.println("开始事件循环");
             EventQueue eventQueue = vm.eventQueue();
@@ -96,9 +101,9 @@ public class FibonacciStateVisualizer {
                 eventSet.resume();
             }
 
-            // 生成图
-            generateDotGraph("fibonacci_" + n + "_state_graph.dot");
-            System.out.println("状态图已生成: fibonacci_" + n + "_state_graph.dot");
+            // 结束图
+            closeDotGraph();
+            System.out.println("状态图已生成: " + fileName);
 
         } catch (Exception e) {
             e.printStackTrace();
@@ -134,16 +139,15 @@ public class FibonacciStateVisualizer {
 
                     // 创建新的状态节点
                     StateNode node = new StateNode(nodeCounter++, "fibonacci", n, 0, thread.uniqueID());
-                    stateNodes.add(node);
 
-                    // 建立调用关系
-                    if (threadCallMap.containsKey(thread.uniqueID())) {
-                        StateNode parent = threadCallMap.get(thread.uniqueID());
-                        parent.addChild(node);
+                    // 建立调用关系：边现在就可以写出
+                    Deque<StateNode> stack = callStacks.computeIfAbsent(thread.uniqueID(), id -> new ArrayDeque<>());
+                    if (!stack.isEmpty()) {
+                        dotWriter.println("  node" + stack.peek().getId() + " -> node" + node.getId() + ";");
                     }
 
-                    // 更新当前线程的调用节点
-                    threadCallMap.put(thread.uniqueID(), node);
+                    // 压入当前线程的调用栈
+                    stack.push(node);
                 }
             }
         } catch (Exception e) {
@@ -166,26 +170,17 @@ public class FibonacciStateVisualizer {
             if (returnValue instanceof IntegerValue) {
                 int result = ((IntegerValue) returnValue).value();
 
-                // 更新当前节点的返回值
-                if (threadCallMap.containsKey(thread.uniqueID())) {
-                    StateNode currentNode = threadCallMap.get(thread.uniqueID());
+                // 更新当前节点的返回值，弹出调用栈（栈顶下面就是父调用节点）
+                Deque<StateNode> stack = callStacks.get(thread.uniqueID());
+                if (stack != null && !stack.isEmpty()) {
+                    StateNode currentNode = stack.pop();
                     currentNode.setReturnValue(result);
 
                     System.out.println("退出 fibonacci(" + currentNode.getParamValue() + ") = " + result);
 
-                    // 恢复到父调用节点
-                    try {
-                        // 找到可能的父节点
-                        for (StateNode node : stateNodes) {
-                            if (node.getThreadId() == thread.uniqueID() &&
-                                    node.hasChildNode(currentNode.getId())) {
-                                threadCallMap.put(thread.uniqueID(), node);
-                                break;
-                            }
-                        }
-                    } catch (Exception e) {
-                        // 忽略可能的线程状态异常
-                    }
+                    // 返回值已知，节点可以写出了
+                    dotWriter.println("  node" + currentNode.getId() + " [label=\"fibonacci(" +
+                            currentNode.getParamValue() + ")\\nreturn " + currentNode.getReturnValue() + "\"];");
                 }
             }
         } catch (Exception e) {
@@ -193,29 +188,16 @@ public class FibonacciStateVisualizer {
         }
     }
 
-    private void generateDotGraph(String fileName) {
-        try (PrintWriter writer = new PrintWriter(new FileWriter(fileName))) {
-            writer.println("digraph FibonacciStates {");
-            writer.println("  rankdir=LR;");
-            writer.println("  node [shape=box, style=filled, fillcolor=lightblue];");
-
-            // 输出所有节点
-            for (StateNode node : stateNodes) {
-                writer.println("  node" + node.getId() + " [label=\"fibonacci(" +
-                        node.getParamValue() + ")\\nreturn " + node.getReturnValue() + "\"];");
-            }
-
-            // 输出所有边
-            for (StateNode node : stateNodes) {
-                for (StateNode child : node.getChildren()) {
-                    writer.println("  node" + node.getId() + " -> node" + child.getId() + ";");
-                }
-            }
+    private void openDotGraph(String fileName) throws IOException {
+        dotWriter = new PrintWriter(new BufferedWriter(new FileWriter(fileName)));
+        dotWriter.println("digraph FibonacciStates {");
+        dotWriter.println("  rankdir=LR;");
+        dotWriter.println("  node [shape=box, style=filled, fillcolor=lightblue];");
+    }
 
-            writer.println("}");
-        } catch (IOException e) {
-            e.printStackTrace();
-        }
+    private void closeDotGraph() {
+        dotWriter.println("}");
+        dotWriter.close();
     }
 
     /**
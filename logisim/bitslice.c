@@ -0,0 +1,188 @@
+#include <logisim.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Exhaustive test of a 4-bit ripple-carry adder (a + b + cin: 512 input
+// vectors), once with bool wires and once with bit-sliced wires, where
+// each lane of a wire64 (or wire256) carries a different input vector.
+// Then 64 copies of the 2-bit counter from logisim.c, one per lane of a
+// reg64, each starting from its own state.
+
+#define ROUNDS 20000
+#define NVEC   512  // 4 + 4 + 1 input bits
+
+// A full adder from NAND gates, for any wire type: W is empty for bool,
+// 64 or 256, and picks the NAND##W gate to use.
+#define FULL_ADDER(W, T, A, B, CIN, S, COUT) do { \
+    T t = NAND##W(A, B); \
+    T x = NAND##W(NAND##W(A, t), NAND##W(B, t));  /* A xor B */ \
+    T u = NAND##W(x, CIN); \
+    S = NAND##W(NAND##W(x, u), NAND##W(CIN, u)); \
+    COUT = NAND##W(t, u); \
+} while (0)
+
+#define ADDER4(W, T, A, B, CIN, S, COUT) do { \
+    T c1, c2, c3; \
+    FULL_ADDER(W, T, A[0], B[0], CIN, S[0], c1); \
+    FULL_ADDER(W, T, A[1], B[1], c1, S[1], c2); \
+    FULL_ADDER(W, T, A[2], B[2], c2, S[2], c3); \
+    FULL_ADDER(W, T, A[3], B[3], c3, S[3], COUT); \
+} while (0)
+
+// Input vector v has a = v[3:0], b = v[7:4], cin = v[8]; its result is
+// the 5-bit a + b + cin.
+static int expected(int v) {
+    return (v & 15) + ((v >> 4) & 15) + (v >> 8);
+}
+
+// Lane i of a 64-lane word gets vector base + i. Bits 0-5 of the vector
+// number are the lane index, so those inputs follow a fixed pattern in
+// every word; bits 6-8 are the same in all lanes of the word.
+static const wire64 lane_bit[6] = {
+    0xaaaaaaaaaaaaaaaaull, 0xccccccccccccccccull, 0xf0f0f0f0f0f0f0f0ull,
+    0xff00ff00ff00ff00ull, 0xffff0000ffff0000ull, 0xffffffff00000000ull,
+};
+
+static wire64 input64(int base, int bit) {
+    if (bit < 6) {
+        return lane_bit[bit];
+    }
+    return (base >> bit) & 1 ? ONES64 : 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Each engine evaluates all NVEC vectors and leaves the 5 result bits in
+// out[bit][word], bit-sliced: vector v is lane v % 64 of word v / 64.
+typedef wire64 result[5][NVEC / 64];
+
+static void adder_bool(result out) {
+    memset(out, 0, sizeof(result));
+    for (int v = 0; v < NVEC; v++) {
+        wire a[4], b[4], s[4], cin = v >> 8, cout;
+        for (int i = 0; i < 4; i++) {
+            a[i] = (v >> i) & 1;
+            b[i] = (v >> (4 + i)) & 1;
+        }
+        ADDER4(, wire, a, b, cin, s, cout);
+        for (int i = 0; i < 4; i++) {
+            out[i][v / 64] |= (wire64)s[i] << (v % 64);
+        }
+        out[4][v / 64] |= (wire64)cout << (v % 64);
+    }
+}
+
+static void adder_64(result out) {
+    for (int base = 0; base < NVEC; base += 64) {
+        wire64 a[4], b[4], s[4], cin = input64(base, 8), cout;
+        for (int i = 0; i < 4; i++) {
+            a[i] = input64(base, i);
+            b[i] = input64(base, 4 + i);
+        }
+        ADDER4(64, wire64, a, b, cin, s, cout);
+        for (int i = 0; i < 4; i++) {
+            out[i][base / 64] = s[i];
+        }
+        out[4][base / 64] = cout;
+    }
+}
+
+#ifdef __AVX2__
+// Each 64-bit element e of a wire256 is one wire64 for vectors base + 64e.
+static wire256 input256(int base, int bit) {
+    return _mm256_set_epi64x(input64(base + 192, bit), input64(base + 128, bit),
+                             input64(base + 64, bit), input64(base, bit));
+}
+
+static void adder_256(result out) {
+    for (int base = 0; base < NVEC; base += 256) {
+        wire256 a[4], b[4], s[4], cin = input256(base, 8), cout;
+        for (int i = 0; i < 4; i++) {
+            a[i] = input256(base, i);
+            b[i] = input256(base, 4 + i);
+        }
+        ADDER4(256, wire256, a, b, cin, s, cout);
+        for (int i = 0; i < 4; i++) {
+            _mm256_storeu_si256((__m256i *)&out[i][base / 64], s[i]);
+        }
+        _mm256_storeu_si256((__m256i *)&out[4][base / 64], cout);
+    }
+}
+#endif
+
+// Returns the number of vectors with a wrong sum.
+static int check(result out) {
+    int errors = 0;
+    for (int v = 0; v < NVEC; v++) {
+        int sum = 0;
+        for (int i = 0; i < 5; i++) {
+            sum |= (int)((out[i][v / 64] >> (v % 64)) & 1) << i;
+        }
+        errors += sum != expected(v);
+    }
+    return errors;
+}
+
+static void run(const char *name, void (*adder)(result), double *base) {
+    static result out;
+    double t = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        adder(out);
+        __asm__ volatile("" : : "r"(out) : "memory");  // Keep every round
+    }
+    t = now() - t;
+    if (*base == 0) {
+        *base = t;
+    }
+    printf("%-8s %d errors, %8.2f ns/vector (%.1fx)\n", name, check(out), t * 1e9 / ROUNDS / NVEC, *base / t);
+}
+
+// The 2-bit counter of logisim.c, with every wire and flip-flop 64 lanes
+// wide. Lane i starts in state i % 4 and is checked against the same
+// counter on bool wires.
+static int counter_64(int cycles) {
+    wire64 X = lane_bit[1], Y = lane_bit[0], X1, Y1;
+    reg64 b1 = {.in = &X1, .out = &X};
+    reg64 b0 = {.in = &Y1, .out = &Y};
+    wire x[64], y[64];
+    int errors = 0;
+
+    for (int lane = 0; lane < 64; lane++) {
+        x[lane] = (lane >> 1) & 1;
+        y[lane] = lane & 1;
+    }
+    for (int n = 0; n < cycles; n++) {
+        X1 = AND64(NOT64(X), Y);
+        Y1 = NOT64(OR64(X, Y));
+        LATCH(b0);
+        LATCH(b1);
+        DRIVE(b0);
+        DRIVE(b1);
+
+        for (int lane = 0; lane < 64; lane++) {
+            wire x1 = AND(NOT(x[lane]), y[lane]);
+            wire y1 = NOT(OR(x[lane], y[lane]));
+            x[lane] = x1;
+            y[lane] = y1;
+            errors += ((X >> lane) & 1) != x[lane] || ((Y >> lane) & 1) != y[lane];
+        }
+    }
+    return errors;
+}
+
+int main() {
+    double base = 0;
+
+    printf("4-bit adder, %d vectors x %d rounds\n", NVEC, ROUNDS);
+    run("bool", adder_bool, &base);
+    run("wire64", adder_64, &base);
+#ifdef __AVX2__
+    run("wire256", adder_256, &base);
+#endif
+    printf("2-bit counter x 64 lanes: %d errors\n", counter_64(100));
+}
@@ -0,0 +1,74 @@
+# Generates the bigger benchmark netlists (make bench) from a few Python
+# loops, since writing out every bit by hand would be tedious:
+#
+#     python3 circuits/gen.py adder > circuits/adder.net
+import sys
+
+
+def xor(a, b):
+    return f'AND(OR({a}, {b}), NAND({a}, {b}))'
+
+
+def mux(sel, a, b):
+    # sel ? b : a
+    return f'OR(AND(NOT({sel}), {a}), AND({sel}, {b}))'
+
+
+def adder(n=32):
+    # n-bit accumulator: s <= s + x, with a ripple-carry adder
+    print(f'# {n}-bit accumulator: s <= s + x (ripple-carry adder)')
+    print('input ' + ', '.join(f'x{i}' for i in range(n)) + ';')
+    print('c0 = 0;')
+    for i in range(n):
+        print(f'p{i} = {xor(f"s{i}", f"x{i}")};')
+        print(f'reg s{i} <= {xor(f"p{i}", f"c{i}")};')
+        print(f'c{i + 1} = OR(AND(s{i}, x{i}), AND(p{i}, c{i}));')
+    print('output ' + ', '.join(f's{i}' for i in range(n)) + f', c{n};')
+
+
+def alu(n=16):
+    # r <= a op b, op: 0 add, 1 and, 2 or, 3 xor; the carry goes to flag cf
+    print(f'# {n}-bit ALU: r <= a + b, a & b, a | b or a ^ b (op1 op0), carry into cf')
+    print('input ' + ', '.join([f'a{i}' for i in range(n)] + [f'b{i}' for i in range(n)] + ['op0', 'op1']) + ';')
+    print('c0 = 0;')
+    for i in range(n):
+        print(f'x{i} = {xor(f"a{i}", f"b{i}")};')
+        print(f'sum{i} = {xor(f"x{i}", f"c{i}")};')
+        print(f'c{i + 1} = OR(AND(a{i}, b{i}), AND(x{i}, c{i}));')
+        print(f'lo{i} = {mux("op0", f"sum{i}", f"AND(a{i}, b{i})")};')
+        print(f'hi{i} = {mux("op0", f"OR(a{i}, b{i})", f"x{i}")};')
+        print(f'reg r{i} <= {mux("op1", f"lo{i}", f"hi{i}")};')
+    print(f'reg cf <= AND(c{n}, NOT(OR(op0, op1)));')
+    print('output ' + ', '.join(f'r{i}' for i in range(n)) + ', cf;')
+
+
+def regfile(nregs=16, n=16):
+    # nregs registers of n bits, one write port (we, wa, wd), one read port
+    bits = (nregs - 1).bit_length()
+    print(f'# Register file: {nregs} x {n} bits, one write port (we, wa, wd), one read port (ra -> rd)')
+    print('input ' + ', '.join(['we'] + [f'wa{k}' for k in range(bits)] + [f'wd{i}' for i in range(n)] +
+                               [f'ra{k}' for k in range(bits)]) + ';')
+    for r in range(nregs):
+        match = ', '.join(f'wa{k}' if r >> k & 1 else f'NOT(wa{k})' for k in range(bits))
+        print(f'w{r} = AND(we, {match});')
+        for i in range(n):
+            print(f'reg q{r}_{i} <= {mux(f"w{r}", f"q{r}_{i}", f"wd{i}")};')
+    for i in range(n):
+        # A tree of 2-way muxes, one level per read address bit
+        level = [f'q{r}_{i}' for r in range(nregs)]
+        for k in range(bits):
+            nxt = []
+            for j in range(0, len(level), 2):
+                name = f'm{k}_{j // 2}_{i}'
+                print(f'{name} = {mux(f"ra{k}", level[j], level[j + 1])};')
+                nxt.append(name)
+            level = nxt
+        print(f'rd{i} = {level[0]};')
+    print('output ' + ', '.join(f'rd{i}' for i in range(n)) + ';')
+
+
+if __name__ == '__main__':
+    circuits = {'adder': adder, 'alu': alu, 'regfile': regfile}
+    if len(sys.argv) != 2 or sys.argv[1] not in circuits:
+        sys.exit(f'Usage: {sys.argv[0]} ' + '|'.join(circuits))
+    circuits[sys.argv[1]]()
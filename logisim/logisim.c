@@ -1,12 +1,139 @@
 #include <logisim.h>
+#include <vcd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 
 // Wire and registers in the circuit
 wire X, Y, X1, Y1, A, B, C, D, E, F, G;
 reg b1 = {.in = &X1, .out = &X};
 reg b0 = {.in = &Y1, .out = &Y};
 
-int main() {
+#define DEFAULT_FPS 60
+
+// Clock and display settings (see usage())
+double freq = 1;        // Clock frequency in Hz; 0 runs as fast as possible
+double fps = -1;        // Display frames per second; 0 shows every change
+long long max_cycles;   // Stop after this many cycles; 0 runs forever
+const char *vcd_file;   // Record all wires into this VCD file
+int binary;             // Send binary frames instead of text lines
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f <hz>] [-r <fps>] [-n <cycles>] [-w <file.vcd>] [-b]\n", prog);
+    fprintf(stderr, "- -f: clock frequency (default 1); 0 runs the clock as fast as possible\n");
+    fprintf(stderr, "- -r: display at most <fps> frames per second; 0 shows every output change\n");
+    fprintf(stderr, "      (default: every change up to %d Hz, %d frames per second above)\n", DEFAULT_FPS, DEFAULT_FPS);
+    fprintf(stderr, "- -n: stop after <cycles> cycles\n");
+    fprintf(stderr, "- -w: record the waveforms of all wires (one time unit per cycle)\n");
+    fprintf(stderr, "- -b: send packed binary frames to seg-display.py instead of text\n");
+    exit(1);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Sleeps until t (on the now() clock). Sleeping to an absolute deadline
+// instead of for a relative time keeps the error of one sleep from adding
+// up over many cycles. Only an interrupted sleep is restarted; any other
+// error is reported and the clock runs on unpaced.
+static void sleep_until(double t) {
+    struct timespec ts = {.tv_sec = (time_t)t, .tv_nsec = (long)((t - (time_t)t) * 1e9)};
+    int err;
+    while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR) {
+    }
+    if (err != 0) {
+        fprintf(stderr, "Error: clock_nanosleep: %s\n", strerror(err));
+        freq = 0;
+    }
+}
+
+// Binary frames: a magic byte, the number of digits, a frame sequence
+// number (32-bit little endian), then one byte per digit with segment A in
+// bit 0 up to G in bit 6. A frame is a single write(), and seg-display.py
+// can skip to the newest frame in the pipe without parsing the others.
+#define FRAME_MAGIC 0xa5
+
+static void display_binary(void) {
+    static uint32_t seq;
+    uint8_t frame[7] = {FRAME_MAGIC, 1, seq, seq >> 8, seq >> 16, seq >> 24,
+                        A | B << 1 | C << 2 | D << 3 | E << 4 | F << 5 | G << 6};
+    seq++;
+    if (write(STDOUT_FILENO, frame, sizeof(frame)) != sizeof(frame)) {
+        exit(0);  // The display went away
+    }
+}
+
+// Sends the output wires to seg-display.py as one line ("A = 1; ...").
+static void display(void) {
+    if (binary) {
+        display_binary();
+        return;
+    }
+    #define PRINT(X) printf(#X " = %d; ", X)
+    PRINT(A);
+    PRINT(B);
+    PRINT(C);
+    PRINT(D);
+    PRINT(E);
+    PRINT(F);
+    PRINT(G);
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "f:r:n:w:b")) != -1) {
+        switch (opt) {
+        case 'f': freq = atof(optarg); break;
+        case 'r': fps = atof(optarg); break;
+        case 'n': max_cycles = atoll(optarg); break;
+        case 'w': vcd_file = optarg; break;
+        case 'b': binary = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (freq < 0 || optind != argc) {
+        usage(argv[0]);
+    }
+    if (fps < 0) {
+        // Nobody can see changes faster than this anyway.
+        fps = freq == 0 || freq > DEFAULT_FPS ? DEFAULT_FPS : 0;
+    }
+
+    // Reading the clock every cycle would cost more than the circuit
+    // itself, so time is only looked at every `slice` cycles: about once a
+    // millisecond when the clock is paced, every 1024 cycles otherwise.
+    struct vcd vcd;
+    if (vcd_file) {
+        #define TRACE(X) vcd_bool(&vcd, #X, &X)
+        if (vcd_open(&vcd, vcd_file) != 0) {
+            fprintf(stderr, "Error: cannot create \"%s\"\n", vcd_file);
+            return 1;
+        }
+        TRACE(X);
+        TRACE(Y);
+        TRACE(X1);
+        TRACE(Y1);
+        TRACE(A);
+        TRACE(B);
+        TRACE(C);
+        TRACE(D);
+        TRACE(E);
+        TRACE(F);
+        TRACE(G);
+    }
+
+    long long slice = freq == 0 ? 1024 : freq > 1000 ? (long long)(freq / 1000) : 1;
+    double start = now(), next_frame = start;
+    long long cycle = 0;
+    int shown = -1;
+
     CLOCK_CYCLE {
         // 1. Propagate wire values through combinatorial logic
         X1 = AND(NOT(X), Y);
@@ -16,24 +143,46 @@ int main() {
         C = NOT(X);
         F = Y1;
         G = X;
+        if (vcd_file) {
+            vcd_sample(&vcd, cycle);
+        }
 
         // 2. Edge triggering: Lock values in the flip-flops
-        b0.value = *b0.in;
-        b1.value = *b1.in;
-        *b0.out = b0.value;
-        *b1.out = b1.value;
-
-        // 3. End of a cycle; display output wire values
-        #define PRINT(X) printf(#X " = %d; ", X)
-        PRINT(A);
-        PRINT(B);
-        PRINT(C);
-        PRINT(D);
-        PRINT(E);
-        PRINT(F);
-        PRINT(G);
-        printf("\n");
-        fflush(stdout);
-        sleep(1);
+        LATCH(b0);
+        LATCH(b1);
+        DRIVE(b0);
+        DRIVE(b1);
+
+        // 3. End of a cycle; display output wire values. Without a frame
+        // rate, a frame is sent whenever an output changed; with one, the
+        // latest outputs are sent at most fps times a second.
+        cycle++;
+        int outputs = A | B << 1 | C << 2 | D << 3 | E << 4 | F << 5 | G << 6;
+        if (fps == 0 && outputs != shown) {
+            display();
+            shown = outputs;
+        }
+        if (max_cycles && cycle == max_cycles) {
+            break;
+        }
+        if (cycle % slice == 0) {
+            double t = now();
+            if (fps > 0 && t >= next_frame) {
+                display();
+                next_frame = t + 1 / fps;
+            }
+            // 4. Wait for the next clock edge
+            if (freq > 0) {
+                sleep_until(start + cycle / freq);
+            }
+        }
+    }
+    if (fps > 0) {
+        display();
+    }
+    if (vcd_file && vcd_close(&vcd) != 0) {
+        fprintf(stderr, "Error: writing \"%s\" failed\n", vcd_file);
+        return 1;
     }
+    fprintf(stderr, "%lld cycles in %.3f s\n", cycle, now() - start);
 }
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 
 // Wires
@@ -41,3 +42,57 @@ typedef struct {
 // a real circuit. We assume that all flip-flops are updated simultaneously
 // on the end of a cycle.
 #define CLOCK_CYCLE while (1)
+
+// Bit-sliced wires
+// The bool wire above simulates one instance of a circuit per clock cycle.
+// A bit-sliced wire packs the same wire of many independent instances into
+// one machine word: bit (lane) i of every wire64 belongs to instance i. A
+// bitwise operation on two words is then one gate evaluated in all lanes
+// at once, so e.g. an exhaustive test feeding a different input vector to
+// each lane runs 64 vectors per pass instead of one.
+typedef uint64_t wire64;
+
+// A wire64 driven high in every lane (the constant 1).
+#define ONES64      (~(wire64)0)
+
+// The same gates as above, on all lanes.
+#define NAND64(X, Y)  (~((X) & (Y)))
+#define NOT64(X)      (NAND64(X, ONES64))
+#define AND64(X, Y)   (NOT64(NAND64(X, Y)))
+#define OR64(X, Y)    (NAND64(NOT64(X), NOT64(Y)))
+
+// A flip-flop for every lane of a wire64.
+typedef struct {
+    wire64 value;  // The values stored, one per lane
+    wire64 *in;    // Pointer to the input wire
+    wire64 *out;   // Pointer to the output wire
+} reg64;
+
+// With AVX2 (e.g. gcc -mavx2 or -march=native), a 256-bit register holds
+// 256 lanes, and each gate is still a single vector instruction.
+#ifdef __AVX2__
+#include <immintrin.h>
+
+typedef __m256i wire256;
+
+#define ONES256       (_mm256_set1_epi64x(-1))
+
+#define NAND256(X, Y) (_mm256_xor_si256(_mm256_and_si256(X, Y), ONES256))
+#define NOT256(X)     (NAND256(X, ONES256))
+#define AND256(X, Y)  (NOT256(NAND256(X, Y)))
+#define OR256(X, Y)   (NAND256(NOT256(X), NOT256(Y)))
+
+typedef struct {
+    wire256 value;
+    wire256 *in;
+    wire256 *out;
+} reg256;
+#endif
+
+// Edge triggering
+// The two halves of the flip-flop update at the end of a cycle, for any
+// of the reg types: first every flip-flop samples its input, and only then
+// do all of them drive their outputs, so that no flip-flop sees another
+// one's new value within the same cycle.
+#define LATCH(R)    ((R).value = *(R).in)
+#define DRIVE(R)    (*(R).out = (R).value)
@@ -0,0 +1,229 @@
+// Event-driven evaluation of a compiled netlist (see netlist.h)
+//
+// netlist_propagate() evaluates every gate in every cycle. In a large
+// circuit, most wires keep their value from one cycle to the next: only a
+// few flip-flops toggle, and only the gates downstream of them can change.
+// The event-driven simulator keeps, for every wire, the list of gates that
+// read it (its fan-out). A gate is only evaluated when one of its inputs
+// changed, and only if its output changes are the gates reading it
+// scheduled in turn. Gates still run in level order: a gate of level l
+// only has inputs of lower levels, so by the time its level comes, all of
+// its inputs are final and it is evaluated at most once per cycle. The
+// same goes for the flip-flops: only those whose input changed since the
+// last edge are latched.
+//
+// All 64 lanes of a wire count as one wire here: a gate is evaluated if
+// its inputs changed in any lane.
+
+#ifndef NETLIST_EVENT_H
+#define NETLIST_EVENT_H
+
+#include "netlist.h"
+
+struct nl_event {
+    const struct netlist *nl;
+    uint32_t *fanout;       // Gates reading slot s: fanout[first[s]] .. fanout[first[s + 1] - 1]
+    uint32_t *first;
+    uint32_t *queue;        // Scheduled gates of level l: queue[level[l - 1]] .. (queued[l] of them)
+    uint32_t *queued;
+    uint32_t *level;        // Per gate
+    uint8_t *scheduled;     // Per gate
+    uint32_t lo, hi;        // Lowest and highest level with gates scheduled
+    uint32_t *reg_fanout;   // Flip-flops reading slot s, like fanout
+    uint32_t *reg_first;
+    uint32_t *latch, *latching;  // Flip-flops to latch at the next edge
+    uint32_t nlatch;
+    uint8_t *reg_scheduled;
+    int all;                // Evaluate every gate and flip-flop (the first cycle)
+    uint64_t changes;       // Wires changed since the last propagate
+
+    // Activity of the last cycle, and totals
+    uint64_t evaluated, toggled;  // Gates evaluated, wires changed
+    uint64_t total_evaluated, total_toggled, cycles;
+};
+
+static inline void nl_event_free(struct nl_event *e) {
+    free(e->fanout);
+    free(e->first);
+    free(e->queue);
+    free(e->queued);
+    free(e->level);
+    free(e->scheduled);
+    free(e->reg_fanout);
+    free(e->reg_first);
+    free(e->latch);
+    free(e->latching);
+    free(e->reg_scheduled);
+    memset(e, 0, sizeof(*e));
+}
+
+// Builds the fan-out lists of nl. Returns 0 on success.
+static inline int nl_event_init(struct nl_event *e, const struct netlist *nl) {
+    memset(e, 0, sizeof(*e));
+    e->nl = nl;
+    e->first = calloc(nl->nwires + 1, sizeof(uint32_t));
+    e->fanout = malloc((2 * nl->ngates + 1) * sizeof(uint32_t));
+    e->queue = malloc((nl->ngates + 1) * sizeof(uint32_t));
+    e->queued = calloc(nl->nlevels + 1, sizeof(uint32_t));
+    e->level = malloc((nl->ngates + 1) * sizeof(uint32_t));
+    e->scheduled = calloc(nl->ngates + 1, 1);
+    e->reg_first = calloc(nl->nwires + 1, sizeof(uint32_t));
+    e->reg_fanout = malloc((nl->nregs + 1) * sizeof(uint32_t));
+    e->latch = malloc((nl->nregs + 1) * sizeof(uint32_t));
+    e->latching = malloc((nl->nregs + 1) * sizeof(uint32_t));
+    e->reg_scheduled = calloc(nl->nregs + 1, 1);
+    if (!e->first || !e->fanout || !e->queue || !e->queued || !e->level || !e->scheduled || !e->reg_first ||
+        !e->reg_fanout || !e->latch || !e->latching || !e->reg_scheduled) {
+        nl_event_free(e);
+        return -1;
+    }
+    for (uint32_t l = 1; l <= nl->nlevels; l++) {
+        for (uint32_t i = nl->level[l - 1]; i < nl->level[l]; i++) {
+            e->level[i] = l;
+        }
+    }
+
+    // Count the readers of each slot, then fill the lists (the constant-1
+    // input of a NOT never changes, so it has no fan-out).
+    for (uint32_t i = 0; i < nl->ngates; i++) {
+        const struct nl_gate *g = &nl->gates[i];
+        e->first[g->a + 1]++;
+        if (g->op == NL_NAND) {
+            e->first[g->b + 1]++;
+        }
+    }
+    for (uint32_t s = 0; s < nl->nwires; s++) {
+        e->first[s + 1] += e->first[s];
+    }
+    for (uint32_t i = 0; i < nl->nregs; i++) {
+        e->reg_first[nl->regs[i].in + 1]++;
+    }
+    for (uint32_t s = 0; s < nl->nwires; s++) {
+        e->reg_first[s + 1] += e->reg_first[s];
+    }
+    uint32_t *fill = calloc(nl->nwires + 1, sizeof(uint32_t));
+    if (!fill) {
+        nl_event_free(e);
+        return -1;
+    }
+    for (uint32_t i = 0; i < nl->ngates; i++) {
+        const struct nl_gate *g = &nl->gates[i];
+        e->fanout[e->first[g->a] + fill[g->a]++] = i;
+        if (g->op == NL_NAND) {
+            e->fanout[e->first[g->b] + fill[g->b]++] = i;
+        }
+    }
+    memset(fill, 0, (nl->nwires + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < nl->nregs; i++) {
+        uint32_t s = nl->regs[i].in;
+        e->reg_fanout[e->reg_first[s] + fill[s]++] = i;
+    }
+    free(fill);
+    e->lo = nl->nlevels + 1;
+    e->all = 1;
+    return 0;
+}
+
+// Schedules the gates and flip-flops reading slot s.
+static inline void nl_event_changed(struct nl_event *e, uint32_t s) {
+    e->changes++;
+    for (uint32_t k = e->first[s]; k < e->first[s + 1]; k++) {
+        uint32_t i = e->fanout[k];
+        if (!e->scheduled[i]) {
+            uint32_t l = e->level[i];
+            e->scheduled[i] = 1;
+            e->queue[e->nl->level[l - 1] + e->queued[l]++] = i;
+            e->lo = l < e->lo ? l : e->lo;
+            e->hi = l > e->hi ? l : e->hi;
+        }
+    }
+    for (uint32_t k = e->reg_first[s]; k < e->reg_first[s + 1]; k++) {
+        uint32_t r = e->reg_fanout[k];
+        if (!e->reg_scheduled[r]) {
+            e->reg_scheduled[r] = 1;
+            e->latch[e->nlatch++] = r;
+        }
+    }
+}
+
+// Drives an input (or any slot from outside) with v.
+static inline void nl_event_set(struct nl_event *e, wire64 *w, uint32_t s, wire64 v) {
+    if (w[s] != v) {
+        w[s] = v;
+        nl_event_changed(e, s);
+    }
+}
+
+// 1. Propagate: evaluates the scheduled gates, level by level.
+static inline void nl_event_propagate(struct nl_event *e, wire64 *w) {
+    const struct netlist *nl = e->nl;
+
+    e->evaluated = 0;
+    if (e->all) {
+        e->all = 0;
+        for (uint32_t i = 0; i < nl->ngates; i++) {
+            const struct nl_gate *g = &nl->gates[i];
+            wire64 v = NAND64(w[g->a], w[g->b]);
+            e->changes += v != w[g->out];
+            w[g->out] = v;
+        }
+        memset(e->queued, 0, (nl->nlevels + 1) * sizeof(uint32_t));
+        memset(e->scheduled, 0, nl->ngates);
+        e->lo = nl->nlevels + 1;
+        e->hi = 0;
+        e->evaluated = nl->ngates;
+    }
+    // Evaluating a level can only schedule higher ones, so hi may grow.
+    for (uint32_t l = e->lo; l <= e->hi; l++) {
+        const uint32_t *q = &e->queue[nl->level[l - 1]];
+        for (uint32_t k = 0; k < e->queued[l]; k++) {
+            const struct nl_gate *g = &nl->gates[q[k]];
+            wire64 v = NAND64(w[g->a], w[g->b]);
+            e->scheduled[q[k]] = 0;
+            if (v != w[g->out]) {
+                w[g->out] = v;
+                nl_event_changed(e, g->out);
+            }
+        }
+        e->evaluated += e->queued[l];
+        e->queued[l] = 0;
+    }
+    e->lo = nl->nlevels + 1;
+    e->hi = 0;
+    e->toggled = e->changes;
+    e->changes = 0;
+    e->total_evaluated += e->evaluated;
+    e->total_toggled += e->toggled;
+    e->cycles++;
+}
+
+// 2. Edge triggering: latches the flip-flops whose input changed (all of
+// them at the first edge), and schedules the gates reading those that
+// toggled for the next propagate. Their changes count for the activity of
+// the next cycle.
+static inline void nl_event_latch(struct nl_event *e, wire64 *w, wire64 *next) {
+    const struct netlist *nl = e->nl;
+    uint32_t n = e->nlatch;
+
+    if (e->cycles == 1) {
+        n = nl->nregs;
+        for (uint32_t i = 0; i < n; i++) {
+            e->latch[i] = i;
+        }
+    }
+    // All flip-flops sample their inputs before any of them changes, and
+    // the ones scheduled while they change are latched at the next edge.
+    uint32_t *latching = e->latch;
+    e->latch = e->latching;
+    e->latching = latching;
+    e->nlatch = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        next[k] = w[nl->regs[latching[k]].in];
+        e->reg_scheduled[latching[k]] = 0;
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        nl_event_set(e, w, nl->regs[latching[k]].out, next[k]);
+    }
+}
+
+#endif
@@ -0,0 +1,202 @@
+// Multi-threaded evaluation of a compiled netlist (see netlist.h)
+//
+// The gates of one level never read each other (their inputs all come from
+// lower levels), so a level can be split among threads however we like, as
+// long as no thread starts on the next level before all of them finished
+// this one. Each thread takes a contiguous part of every large level, with
+// a barrier after each level. Small levels are not worth a barrier each:
+// runs of them are evaluated by a single thread (thread 0) in one stage.
+//
+// The two phases of logisim.c stay as they are: after the last level, all
+// threads sample the inputs of their part of the flip-flops, wait for each
+// other, and only then drive the outputs.
+//
+// The threads spin on the barrier for a while before yielding the CPU,
+// since a level often takes less time than going to sleep and waking up.
+
+#ifndef NETLIST_PARALLEL_H
+#define NETLIST_PARALLEL_H
+
+#include "netlist.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define NL_PAR_GRAIN 128   // Fewest gates per thread worth splitting a level for
+#define NL_PAR_SPIN  4096  // Barrier spins before sched_yield()
+
+enum { NL_PAR_PROPAGATE, NL_PAR_LATCH, NL_PAR_EXIT };
+
+// gates[begin] .. gates[end - 1], split among all threads or run by thread 0
+struct nl_stage {
+    uint32_t begin, end;
+    int split;
+};
+
+struct nl_parallel;
+
+struct nl_worker {
+    struct nl_parallel *p;
+    uint32_t id;
+    pthread_t thread;
+};
+
+struct nl_parallel {
+    const struct netlist *nl;
+    wire64 *w, *next;
+    uint32_t nthreads;
+    struct nl_worker *workers;
+    struct nl_stage *stages;
+    uint32_t nstages;
+    int cmd;
+    uint32_t arrived, sense;  // Barrier
+    uint32_t main_sense;      // Barrier sense of the calling thread (thread 0)
+};
+
+static inline void nl_par_barrier(struct nl_parallel *p, uint32_t *sense) {
+    *sense = !*sense;
+    if (__atomic_add_fetch(&p->arrived, 1, __ATOMIC_ACQ_REL) == p->nthreads) {
+        __atomic_store_n(&p->arrived, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&p->sense, *sense, __ATOMIC_RELEASE);
+        return;
+    }
+    for (uint32_t spins = 0; __atomic_load_n(&p->sense, __ATOMIC_ACQUIRE) != *sense; spins++) {
+        if (spins >= NL_PAR_SPIN) {
+            sched_yield();
+        }
+    }
+}
+
+// The part [*begin, *end) of n items that thread id works on
+static inline void nl_par_part(uint32_t n, uint32_t id, uint32_t nthreads, uint32_t *begin, uint32_t *end) {
+    *begin = (uint64_t)n * id / nthreads;
+    *end = (uint64_t)n * (id + 1) / nthreads;
+}
+
+static inline void nl_par_run(struct nl_parallel *p, uint32_t id, int cmd, uint32_t *sense) {
+    const struct netlist *nl = p->nl;
+    wire64 *w = p->w;
+    uint32_t begin, end;
+
+    if (cmd == NL_PAR_PROPAGATE) {
+        for (uint32_t s = 0; s < p->nstages; s++) {
+            const struct nl_stage *st = &p->stages[s];
+            if (st->split) {
+                nl_par_part(st->end - st->begin, id, p->nthreads, &begin, &end);
+                begin += st->begin;
+                end += st->begin;
+            } else {
+                begin = st->begin;
+                end = id == 0 ? st->end : st->begin;
+            }
+            for (uint32_t i = begin; i < end; i++) {
+                const struct nl_gate *g = &nl->gates[i];
+                w[g->out] = NAND64(w[g->a], w[g->b]);
+            }
+            if (s + 1 < p->nstages) {
+                nl_par_barrier(p, sense);
+            }
+        }
+    } else {
+        nl_par_part(nl->nregs, id, p->nthreads, &begin, &end);
+        for (uint32_t i = begin; i < end; i++) {
+            p->next[i] = w[nl->regs[i].in];
+        }
+        nl_par_barrier(p, sense);
+        for (uint32_t i = begin; i < end; i++) {
+            w[nl->regs[i].out] = p->next[i];
+        }
+    }
+}
+
+static void *nl_par_worker(void *arg) {
+    struct nl_worker *wk = arg;
+    struct nl_parallel *p = wk->p;
+    uint32_t sense = 0;
+
+    for (;;) {
+        nl_par_barrier(p, &sense);  // Wait for a command
+        int cmd = p->cmd;
+        if (cmd == NL_PAR_EXIT) {
+            return NULL;
+        }
+        nl_par_run(p, wk->id, cmd, &sense);
+        nl_par_barrier(p, &sense);  // Done
+    }
+}
+
+// Runs cmd on all threads; the calling thread is thread 0.
+static inline void nl_par_command(struct nl_parallel *p, int cmd) {
+    p->cmd = cmd;
+    nl_par_barrier(p, &p->main_sense);
+    if (cmd != NL_PAR_EXIT) {
+        nl_par_run(p, 0, cmd, &p->main_sense);
+        nl_par_barrier(p, &p->main_sense);
+    }
+}
+
+static inline void nl_parallel_free(struct nl_parallel *p) {
+    if (p->workers) {
+        nl_par_command(p, NL_PAR_EXIT);
+        for (uint32_t i = 1; i < p->nthreads; i++) {
+            pthread_join(p->workers[i].thread, NULL);
+        }
+    }
+    free(p->workers);
+    free(p->stages);
+    free(p->next);
+    memset(p, 0, sizeof(*p));
+}
+
+// Plans the stages of nl for nthreads threads (including the calling one)
+// and starts the other threads, which work on the wires w. Returns 0 on
+// success.
+static inline int nl_parallel_init(struct nl_parallel *p, const struct netlist *nl, wire64 *w, uint32_t nthreads) {
+    memset(p, 0, sizeof(*p));
+    p->nl = nl;
+    p->w = w;
+    p->nthreads = nthreads ? nthreads : 1;
+    p->stages = malloc((nl->nlevels + 1) * sizeof(struct nl_stage));
+    p->next = malloc((nl->nregs + 1) * sizeof(wire64));
+    if (!p->stages || !p->next) {
+        nl_parallel_free(p);
+        return -1;
+    }
+    for (uint32_t l = 1; l <= nl->nlevels; l++) {
+        uint32_t begin = nl->level[l - 1], end = nl->level[l];
+        int split = p->nthreads > 1 && end - begin >= NL_PAR_GRAIN * p->nthreads;
+        struct nl_stage *last = p->nstages ? &p->stages[p->nstages - 1] : NULL;
+        if (!split && last && !last->split) {
+            last->end = end;  // Another small level for thread 0
+        } else {
+            p->stages[p->nstages++] = (struct nl_stage){.begin = begin, .end = end, .split = split};
+        }
+    }
+
+    p->workers = calloc(p->nthreads, sizeof(struct nl_worker));
+    if (!p->workers) {
+        nl_parallel_free(p);
+        return -1;
+    }
+    for (uint32_t i = 1; i < p->nthreads; i++) {
+        p->workers[i].p = p;
+        p->workers[i].id = i;
+        if (pthread_create(&p->workers[i].thread, NULL, nl_par_worker, &p->workers[i]) != 0) {
+            p->nthreads = i;  // Stop the ones already running
+            nl_parallel_free(p);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 1. Propagate, on all threads
+static inline void nl_parallel_propagate(struct nl_parallel *p) {
+    nl_par_command(p, NL_PAR_PROPAGATE);
+}
+
+// 2. Edge triggering, on all threads
+static inline void nl_parallel_latch(struct nl_parallel *p) {
+    nl_par_command(p, NL_PAR_LATCH);
+}
+
+#endif
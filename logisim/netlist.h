@@ -0,0 +1,697 @@
+// Netlists: circuits as data instead of C statements
+//
+// A netlist file describes the same kind of circuit as logisim.c, in
+// nearly the same notation. The 2-bit counter (circuits/counter.net):
+//
+//     reg X <= X1;            # Flip-flop: output X, input X1
+//     reg Y <= Y1;
+//     X1 = AND(NOT(X), Y);
+//     Y1 = NOT(OR(X, Y));
+//     A = D = E = NOT(Y);
+//     B = 1;
+//     ...
+//     output A, B, C, D, E, F, G;
+//
+// `input a, b;` declares wires driven from outside the circuit (by a test
+// bench) in every cycle; `wire` declarations are allowed but not needed.
+// The gates are the ones of logisim.h; AND, OR and NAND also take more
+// than two inputs. Comments start with # or //.
+//
+// netlist_compile() turns such a file into a program for one clock cycle:
+//
+// 1. Gates are lowered to NAND, exactly like the macros in logisim.h do:
+//    NOT(X) = NAND(X, 1), AND = NOT(NAND), OR = NAND(NOT, NOT).
+// 2. Redundant logic is removed: NOT(NOT(X)), which the AND and OR
+//    expansions produce all the time, gates with constant inputs, wires
+//    that only copy another wire, identical gates (computed only once),
+//    and gates that no output or flip-flop depends on.
+// 3. The remaining gates are levelized: the level of a gate is one more
+//    than the highest level of its inputs, where flip-flops, inputs and
+//    constants are at level 0. Evaluating the gates in level order
+//    computes each of them exactly once, after all of its inputs.
+//
+// The values of all wires live in one array of bit-sliced wire64 (see
+// logisim.h), so every cycle simulates 64 instances of the circuit. The
+// index of a wire in that array is its "slot": slot 0 is the constant 0,
+// slot 1 the constant 1, then come the inputs, the flip-flop outputs and
+// the gate outputs in level order.
+
+#ifndef NETLIST_H
+#define NETLIST_H
+
+#include <logisim.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NL_NONE UINT32_MAX
+
+enum { NL_ZERO, NL_ONE, NL_INPUT, NL_REG, NL_NOT, NL_NAND, NL_WIRE };
+
+// A gate of the compiled program: w[out] = NAND(w[a], w[b]). NOT gates are
+// NAND(X, 1), i.e. their b is the constant-1 slot.
+struct nl_gate {
+    uint32_t op;  // NL_NOT or NL_NAND
+    uint32_t out, a, b;
+};
+
+// A flip-flop: w[out] <= w[in] at the end of the cycle.
+struct nl_reg {
+    uint32_t out, in;
+};
+
+// A name of a slot (one slot may have several, like A, D and E above).
+struct nl_name {
+    char *name;
+    uint32_t slot;
+};
+
+struct netlist {
+    uint32_t nwires;                   // Slots
+    uint32_t ngates;
+    struct nl_gate *gates;             // In level order
+    uint32_t nlevels;
+    uint32_t *level;                   // Level l is gates[level[l - 1]] .. gates[level[l] - 1]
+    uint32_t ninputs, nregs, noutputs, nnames;
+    struct nl_name *inputs;            // In declaration order
+    struct nl_reg *regs;
+    struct nl_name *reg_names;
+    struct nl_name *outputs;
+    struct nl_name *names;             // Every named wire left in the program
+
+    uint32_t parsed_gates;             // NOT and NAND gates before optimization
+    uint32_t nots_removed;             // NOT(NOT(X)) pairs removed
+};
+
+// Parser and compiler internals
+
+struct nl_node {
+    uint32_t op, a, b;
+    const char *name;  // For wires, inputs and flip-flops
+    uint32_t id;       // Compiled node, once built
+    uint32_t busy;     // Being built (finding it again means a loop)
+};
+
+struct nl_sym {
+    char *name;
+    uint32_t node;
+};
+
+struct nl_parser {
+    FILE *f;
+    const char *file;
+    int line, c;
+    int tok;          // Current token: a character, or one of NL_TOK_*
+    char text[64];    // Its text, for identifiers and numbers
+    uint32_t bare;    // The last expression was just this wire (or NL_NONE)
+    jmp_buf error;
+
+    struct nl_node *nodes;
+    uint32_t nnodes, node_cap;
+    struct nl_sym *syms;     // Hash table
+    uint32_t nsyms, sym_cap;
+    uint32_t *decl[3];       // Inputs, flip-flops and outputs, in order
+    uint32_t ndecl[3];
+
+    struct nl_gate *g;       // Compiled nodes; level in g[].out
+    uint32_t ng, ng_cap;
+    uint32_t *hash;          // Compiled gates by (op, a, b)
+    uint32_t hash_cap;
+    uint32_t *slot, *count;  // Slot of each compiled node; gates per level
+    struct netlist *nl;
+};
+
+enum { NL_TOK_EOF = 256, NL_TOK_IDENT, NL_TOK_NUM, NL_TOK_LATCH };
+enum { NL_DECL_INPUT, NL_DECL_REG, NL_DECL_OUTPUT };
+
+static void nl_error(struct nl_parser *p, const char *fmt, const char *arg) {
+    if (p->line) {
+        fprintf(stderr, "%s:%d: error: ", p->file, p->line);
+    } else {
+        fprintf(stderr, "%s: error: ", p->file);
+    }
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    longjmp(p->error, 1);
+}
+
+static void *nl_grow(struct nl_parser *p, void *array, uint32_t *cap, uint32_t need, size_t size) {
+    if (need <= *cap) {
+        return array;
+    }
+    uint32_t n = *cap ? *cap : 16;
+    while (n < need) {
+        n *= 2;
+    }
+    array = realloc(array, n * size);
+    if (!array) {
+        nl_error(p, "%s", "out of memory");
+    }
+    *cap = n;
+    return array;
+}
+
+static void nl_next(struct nl_parser *p) {
+    for (;;) {
+        while (isspace(p->c)) {
+            if (p->c == '\n') {
+                p->line++;
+            }
+            p->c = fgetc(p->f);
+        }
+        if (p->c == '#' || p->c == '/') {
+            int c = p->c;
+            p->c = fgetc(p->f);
+            if (c == '/' && p->c != '/') {
+                nl_error(p, "%s", "unexpected '/'");
+            }
+            while (p->c != '\n' && p->c != EOF) {
+                p->c = fgetc(p->f);
+            }
+            continue;
+        }
+        break;
+    }
+    if (p->c == EOF) {
+        p->tok = NL_TOK_EOF;
+        strcpy(p->text, "end of file");
+        return;
+    }
+    size_t n = 0;
+    if (isalnum(p->c) || p->c == '_') {
+        p->tok = isdigit(p->c) ? NL_TOK_NUM : NL_TOK_IDENT;
+        while (isalnum(p->c) || p->c == '_') {
+            if (n == sizeof(p->text) - 1) {
+                nl_error(p, "%s", "name too long");
+            }
+            p->text[n++] = p->c;
+            p->c = fgetc(p->f);
+        }
+        p->text[n] = 0;
+        return;
+    }
+    p->tok = p->c;
+    p->text[0] = p->c;
+    p->text[1] = 0;
+    p->c = fgetc(p->f);
+    if (p->tok == '<' && p->c == '=') {
+        p->tok = NL_TOK_LATCH;
+        strcpy(p->text, "<=");
+        p->c = fgetc(p->f);
+    }
+}
+
+static void nl_expect(struct nl_parser *p, int tok, const char *what) {
+    if (p->tok != tok) {
+        fprintf(stderr, "%s:%d: error: expected %s before '%s'\n", p->file, p->line, what, p->text);
+        longjmp(p->error, 1);
+    }
+    nl_next(p);
+}
+
+static uint32_t nl_node(struct nl_parser *p, uint32_t op, uint32_t a, uint32_t b) {
+    p->nodes = nl_grow(p, p->nodes, &p->node_cap, p->nnodes + 1, sizeof(*p->nodes));
+    p->nodes[p->nnodes] = (struct nl_node){.op = op, .a = a, .b = b, .id = NL_NONE};
+    return p->nnodes++;
+}
+
+static uint32_t nl_hash_name(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
+// The wire (or input, or flip-flop) called name; new names are undriven
+// wires.
+static uint32_t nl_sym(struct nl_parser *p, const char *name) {
+    if (2 * (p->nsyms + 1) > p->sym_cap) {
+        struct nl_sym *old = p->syms;
+        uint32_t old_cap = p->sym_cap;
+        p->sym_cap = old_cap ? 2 * old_cap : 64;
+        p->syms = calloc(p->sym_cap, sizeof(*p->syms));
+        if (!p->syms) {
+            nl_error(p, "%s", "out of memory");
+        }
+        for (uint32_t i = 0; i < old_cap; i++) {
+            if (old[i].name) {
+                uint32_t h = nl_hash_name(old[i].name) & (p->sym_cap - 1);
+                while (p->syms[h].name) {
+                    h = (h + 1) & (p->sym_cap - 1);
+                }
+                p->syms[h] = old[i];
+            }
+        }
+        free(old);
+    }
+    uint32_t h = nl_hash_name(name) & (p->sym_cap - 1);
+    while (p->syms[h].name) {
+        if (strcmp(p->syms[h].name, name) == 0) {
+            return p->syms[h].node;
+        }
+        h = (h + 1) & (p->sym_cap - 1);
+    }
+    uint32_t n = nl_node(p, NL_WIRE, NL_NONE, NL_NONE);
+    p->syms[h].name = strdup(name);
+    p->syms[h].node = n;
+    p->nodes[n].name = p->syms[h].name;
+    p->nsyms++;
+    return n;
+}
+
+static const char *nl_name(struct nl_parser *p, uint32_t n) {
+    return p->nodes[n].name;
+}
+
+static uint32_t nl_not(struct nl_parser *p, uint32_t x) {
+    return nl_node(p, NL_NOT, x, NL_ONE);
+}
+
+static uint32_t nl_expr(struct nl_parser *p) {
+    p->bare = NL_NONE;
+    if (p->tok == NL_TOK_NUM) {
+        if (strcmp(p->text, "0") != 0 && strcmp(p->text, "1") != 0) {
+            nl_error(p, "constant %s is not 0 or 1", p->text);
+        }
+        uint32_t n = p->text[0] == '1' ? NL_ONE : NL_ZERO;
+        nl_next(p);
+        return n;
+    }
+    if (p->tok != NL_TOK_IDENT) {
+        nl_error(p, "expected an expression before '%s'", p->text);
+    }
+    char name[sizeof(p->text)];
+    strcpy(name, p->text);
+    nl_next(p);
+    if (p->tok != '(') {
+        uint32_t n = nl_sym(p, name);
+        p->bare = n;
+        return n;
+    }
+
+    // A gate
+    int op = strcmp(name, "NOT") == 0 ? 'N' : strcmp(name, "NAND") == 0 ? 'D' :
+             strcmp(name, "AND") == 0 ? 'A' : strcmp(name, "OR") == 0 ? 'O' : 0;
+    if (!op) {
+        nl_error(p, "unknown gate %s", name);
+    }
+    nl_next(p);
+    uint32_t x = nl_expr(p), nargs = 1;
+    while (p->tok == ',') {
+        nl_next(p);
+        uint32_t y = nl_expr(p);
+        // Fold more inputs from the left: AND(a, b, c) = AND(AND(a, b), c)
+        x = op == 'O' ? nl_node(p, NL_NAND, nl_not(p, x), nl_not(p, y))
+                      : nl_not(p, nl_node(p, NL_NAND, x, y));
+        nargs++;
+    }
+    nl_expect(p, ')', "')'");
+    p->bare = NL_NONE;
+    if ((op == 'N') != (nargs == 1)) {
+        nl_error(p, op == 'N' ? "%s takes one input" : "%s takes two or more inputs", name);
+    }
+    if (op == 'N' || op == 'D') {
+        return nl_not(p, x);  // NAND(...) = NOT(AND(...))
+    }
+    return x;
+}
+
+static void nl_drive(struct nl_parser *p, uint32_t n, uint32_t op, uint32_t driver) {
+    struct nl_node *node = &p->nodes[n];
+    if (node->op != NL_WIRE || node->a != NL_NONE) {
+        nl_error(p, node->op == NL_INPUT ? "%s is an input" : node->op == NL_REG ? "%s is a flip-flop output"
+                                                                                 : "%s is driven twice",
+                 nl_name(p, n));
+    }
+    node->op = op;
+    node->a = driver;
+}
+
+static void nl_declare(struct nl_parser *p, int kind, uint32_t n) {
+    p->decl[kind] = realloc(p->decl[kind], (p->ndecl[kind] + 1) * sizeof(uint32_t));
+    if (!p->decl[kind]) {
+        nl_error(p, "%s", "out of memory");
+    }
+    p->decl[kind][p->ndecl[kind]++] = n;
+}
+
+static void nl_statement(struct nl_parser *p) {
+    if (p->tok == NL_TOK_IDENT && (!strcmp(p->text, "wire") || !strcmp(p->text, "input") ||
+                                   !strcmp(p->text, "output"))) {
+        int kind = p->text[0] == 'w' ? -1 : p->text[0] == 'i' ? NL_DECL_INPUT : NL_DECL_OUTPUT;
+        do {
+            nl_next(p);
+            if (p->tok != NL_TOK_IDENT) {
+                nl_error(p, "expected a wire name before '%s'", p->text);
+            }
+            uint32_t n = nl_sym(p, p->text);
+            if (kind == NL_DECL_INPUT) {
+                nl_drive(p, n, NL_INPUT, NL_NONE);
+            }
+            if (kind >= 0) {
+                nl_declare(p, kind, n);
+            }
+            nl_next(p);
+        } while (p->tok == ',');
+        nl_expect(p, ';', "';'");
+        return;
+    }
+    if (p->tok == NL_TOK_IDENT && !strcmp(p->text, "reg")) {
+        nl_next(p);
+        if (p->tok != NL_TOK_IDENT) {
+            nl_error(p, "expected a flip-flop name before '%s'", p->text);
+        }
+        uint32_t n = nl_sym(p, p->text);
+        nl_next(p);
+        nl_expect(p, NL_TOK_LATCH, "'<='");
+        nl_drive(p, n, NL_REG, nl_expr(p));
+        nl_declare(p, NL_DECL_REG, n);
+        nl_expect(p, ';', "';'");
+        return;
+    }
+
+    // target = [target = ...] expression;
+    uint32_t targets[64], ntargets = 0, e;
+    for (;;) {
+        e = nl_expr(p);
+        if (p->tok != '=') {
+            break;
+        }
+        if (p->bare == NL_NONE) {
+            nl_error(p, "%s", "left side of '=' is not a wire");
+        }
+        if (ntargets == 64) {
+            nl_error(p, "%s", "too many '='");
+        }
+        targets[ntargets++] = p->bare;
+        nl_next(p);
+    }
+    if (ntargets == 0) {
+        nl_error(p, "expected '=' before '%s'", p->text);
+    }
+    for (uint32_t i = 0; i < ntargets; i++) {
+        nl_drive(p, targets[i], NL_WIRE, e);
+    }
+    nl_expect(p, ';', "';'");
+}
+
+// Compiled nodes, with the simplifications of step 2
+
+static uint32_t nl_gate(struct nl_parser *p, uint32_t op, uint32_t a, uint32_t b) {
+    uint32_t mask = p->hash_cap - 1;
+    uint32_t h = ((a * 0x9e3779b1u) ^ (b * 0x85ebca6bu) ^ op) & mask;
+    for (; p->hash[h] != NL_NONE; h = (h + 1) & mask) {
+        struct nl_gate *g = &p->g[p->hash[h]];
+        if (g->op == op && g->a == a && g->b == b) {
+            return p->hash[h];
+        }
+    }
+    p->g = nl_grow(p, p->g, &p->ng_cap, p->ng + 1, sizeof(*p->g));
+    uint32_t la = p->g[a].out, lb = p->g[b].out;
+    p->g[p->ng] = (struct nl_gate){.op = op, .out = 1 + (la > lb ? la : lb), .a = a, .b = b};
+    p->hash[h] = p->ng;
+    return p->ng++;
+}
+
+static uint32_t nl_make_not(struct nl_parser *p, uint32_t x) {
+    if (x <= NL_ONE) {
+        return !x;
+    }
+    if (p->g[x].op == NL_NOT) {
+        p->nl->nots_removed++;
+        return p->g[x].a;
+    }
+    return nl_gate(p, NL_NOT, x, NL_ONE);
+}
+
+static uint32_t nl_make_nand(struct nl_parser *p, uint32_t x, uint32_t y) {
+    if (x > y) {
+        uint32_t t = x;
+        x = y;
+        y = t;
+    }
+    if (x == NL_ZERO) {
+        return NL_ONE;
+    }
+    if (x == NL_ONE || x == y) {
+        return nl_make_not(p, y);
+    }
+    return nl_gate(p, NL_NAND, x, y);
+}
+
+static uint32_t nl_build(struct nl_parser *p, uint32_t n) {
+    struct nl_node *node = &p->nodes[n];
+    if (node->id != NL_NONE) {
+        return node->id;
+    }
+    if (node->busy) {
+        const char *name = nl_name(p, n);
+        nl_error(p, "combinational loop through %s", name ? name : "an unnamed gate");
+    }
+    node->busy = 1;
+    uint32_t id;
+    switch (node->op) {
+    case NL_WIRE:
+        if (node->a == NL_NONE) {
+            nl_error(p, "wire %s is never driven", nl_name(p, n));
+        }
+        id = nl_build(p, node->a);
+        break;
+    case NL_NOT:
+        id = nl_make_not(p, nl_build(p, node->a));
+        break;
+    default: {
+        uint32_t x = nl_build(p, node->a);
+        id = nl_make_nand(p, x, nl_build(p, node->b));
+        break;
+    }
+    }
+    node = &p->nodes[n];
+    node->busy = 0;
+    node->id = id;
+    return id;
+}
+
+static void nl_names(struct nl_parser *p, struct nl_name *names, int kind, const uint32_t *slot) {
+    for (uint32_t i = 0; i < p->ndecl[kind]; i++) {
+        uint32_t n = p->decl[kind][i];
+        names[i].name = strdup(nl_name(p, n));
+        names[i].slot = slot[nl_build(p, n)];
+    }
+}
+
+static void netlist_free(struct netlist *nl) {
+    for (uint32_t i = 0; i < nl->nnames; i++) {
+        free(nl->names[i].name);
+    }
+    for (uint32_t i = 0; i < nl->ninputs; i++) {
+        free(nl->inputs[i].name);
+    }
+    for (uint32_t i = 0; i < nl->nregs; i++) {
+        free(nl->reg_names[i].name);
+    }
+    for (uint32_t i = 0; i < nl->noutputs; i++) {
+        free(nl->outputs[i].name);
+    }
+    free(nl->gates);
+    free(nl->level);
+    free(nl->inputs);
+    free(nl->regs);
+    free(nl->reg_names);
+    free(nl->outputs);
+    free(nl->names);
+    memset(nl, 0, sizeof(*nl));
+}
+
+// Compiles the netlist file `file` (already opened as f). Returns 0 on
+// success; errors are reported on stderr.
+static int netlist_compile(struct netlist *nl, FILE *f, const char *file) {
+    struct nl_parser parser = {.f = f, .file = file, .line = 1}, *p = &parser;
+    uint32_t *slot, *count;
+    int ret = -1;
+
+    memset(nl, 0, sizeof(*nl));
+    p->nl = nl;
+    if (setjmp(p->error)) {
+        goto out;
+    }
+
+    // Parse. Nodes 0 and 1 are the constants.
+    nl_node(p, NL_ZERO, NL_NONE, NL_NONE);
+    nl_node(p, NL_ONE, NL_NONE, NL_NONE);
+    p->c = fgetc(f);
+    nl_next(p);
+    while (p->tok != NL_TOK_EOF) {
+        nl_statement(p);
+    }
+    p->line = 0;  // Errors from here on are about the whole file
+    for (uint32_t i = 0; i < p->nnodes; i++) {
+        nl->parsed_gates += p->nodes[i].op == NL_NOT || p->nodes[i].op == NL_NAND;
+    }
+
+    // Build the compiled nodes from the outputs and flip-flop inputs.
+    // Constants, inputs and flip-flops come first, in that order.
+    p->hash_cap = 64;
+    while (p->hash_cap < 2 * (nl->parsed_gates + 1)) {
+        p->hash_cap *= 2;
+    }
+    p->hash = malloc(p->hash_cap * sizeof(uint32_t));
+    if (!p->hash) {
+        nl_error(p, "%s", "out of memory");
+    }
+    memset(p->hash, 0xff, p->hash_cap * sizeof(uint32_t));
+    for (uint32_t i = 0; i < 2 + p->ndecl[NL_DECL_INPUT] + p->ndecl[NL_DECL_REG]; i++) {
+        uint32_t n = i < 2 ? i : i - 2 < p->ndecl[NL_DECL_INPUT] ? p->decl[NL_DECL_INPUT][i - 2]
+                                                                 : p->decl[NL_DECL_REG][i - 2 - p->ndecl[NL_DECL_INPUT]];
+        p->g = nl_grow(p, p->g, &p->ng_cap, p->ng + 1, sizeof(*p->g));
+        p->g[p->ng] = (struct nl_gate){.op = p->nodes[n].op, .out = 0, .a = NL_NONE, .b = NL_NONE};
+        p->nodes[n].id = p->ng++;
+    }
+    uint32_t first_gate = p->ng;
+    for (uint32_t i = 0; i < p->ndecl[NL_DECL_OUTPUT]; i++) {
+        nl_build(p, p->decl[NL_DECL_OUTPUT][i]);
+    }
+    for (uint32_t i = 0; i < p->ndecl[NL_DECL_REG]; i++) {
+        nl_build(p, p->nodes[p->decl[NL_DECL_REG][i]].a);
+    }
+
+    // Some gates were made and then simplified away again (like the inner
+    // NOT of a NOT(NOT(X))): keep only the ones an output or a flip-flop
+    // depends on. Gates were made after their inputs, so one pass from the
+    // last to the first finds them all. Live gates get slot 0 for now.
+    slot = p->slot = malloc(p->ng * sizeof(uint32_t));
+    if (!slot) {
+        nl_error(p, "%s", "out of memory");
+    }
+    for (uint32_t i = 0; i < p->ng; i++) {
+        slot[i] = i < first_gate ? i : NL_NONE;
+    }
+    for (uint32_t i = 0; i < p->ndecl[NL_DECL_OUTPUT] + p->ndecl[NL_DECL_REG]; i++) {
+        uint32_t n = i < p->ndecl[NL_DECL_OUTPUT] ? p->decl[NL_DECL_OUTPUT][i]
+                                                  : p->nodes[p->decl[NL_DECL_REG][i - p->ndecl[NL_DECL_OUTPUT]]].a;
+        if (p->nodes[n].id >= first_gate) {
+            slot[p->nodes[n].id] = 0;
+        }
+    }
+    for (uint32_t i = p->ng; i-- > first_gate;) {
+        if (slot[i] != NL_NONE) {
+            nl->ngates++;
+            slot[p->g[i].a] = p->g[i].a < first_gate ? p->g[i].a : 0;
+            slot[p->g[i].b] = p->g[i].b < first_gate ? p->g[i].b : 0;
+            if (p->g[i].out > nl->nlevels) {
+                nl->nlevels = p->g[i].out;
+            }
+        }
+    }
+
+    // Levelize: sort the gates by level (counting sort, stable) and give
+    // them their slots in that order.
+    nl->nwires = first_gate + nl->ngates;
+    count = p->count = calloc(nl->nlevels + 2, sizeof(uint32_t));
+    nl->level = calloc(nl->nlevels + 1, sizeof(uint32_t));
+    nl->gates = malloc((nl->ngates + 1) * sizeof(struct nl_gate));
+    if (!count || !nl->level || !nl->gates) {
+        nl_error(p, "%s", "out of memory");
+    }
+    for (uint32_t i = first_gate; i < p->ng; i++) {
+        if (slot[i] != NL_NONE) {
+            count[p->g[i].out]++;
+        }
+    }
+    for (uint32_t l = 1; l <= nl->nlevels; l++) {
+        nl->level[l] = nl->level[l - 1] + count[l];
+        count[l] = nl->level[l - 1];  // Now the next free index of level l
+    }
+    for (uint32_t i = first_gate; i < p->ng; i++) {
+        if (slot[i] != NL_NONE) {
+            slot[i] = first_gate + count[p->g[i].out]++;
+        }
+    }
+    for (uint32_t i = first_gate; i < p->ng; i++) {
+        if (slot[i] != NL_NONE) {
+            nl->gates[slot[i] - first_gate] =
+                (struct nl_gate){.op = p->g[i].op, .out = slot[i], .a = slot[p->g[i].a], .b = slot[p->g[i].b]};
+        }
+    }
+
+    // Inputs, flip-flops, outputs and the names of all wires left
+    nl->ninputs = p->ndecl[NL_DECL_INPUT];
+    nl->nregs = p->ndecl[NL_DECL_REG];
+    nl->noutputs = p->ndecl[NL_DECL_OUTPUT];
+    nl->inputs = calloc(nl->ninputs + 1, sizeof(struct nl_name));
+    nl->regs = calloc(nl->nregs + 1, sizeof(struct nl_reg));
+    nl->reg_names = calloc(nl->nregs + 1, sizeof(struct nl_name));
+    nl->outputs = calloc(nl->noutputs + 1, sizeof(struct nl_name));
+    nl->names = calloc(p->nsyms + 1, sizeof(struct nl_name));
+    if (!nl->inputs || !nl->regs || !nl->reg_names || !nl->outputs || !nl->names) {
+        nl_error(p, "%s", "out of memory");
+    }
+    nl_names(p, nl->inputs, NL_DECL_INPUT, slot);
+    nl_names(p, nl->reg_names, NL_DECL_REG, slot);
+    nl_names(p, nl->outputs, NL_DECL_OUTPUT, slot);
+    for (uint32_t i = 0; i < nl->nregs; i++) {
+        nl->regs[i].out = nl->reg_names[i].slot;
+        nl->regs[i].in = slot[nl_build(p, p->nodes[p->decl[NL_DECL_REG][i]].a)];
+    }
+    for (uint32_t n = 0; n < p->nnodes; n++) {
+        if (nl_name(p, n) && p->nodes[n].id != NL_NONE && slot[p->nodes[n].id] != NL_NONE) {
+            nl->names[nl->nnames].name = strdup(nl_name(p, n));
+            nl->names[nl->nnames++].slot = slot[p->nodes[n].id];
+        }
+    }
+    ret = 0;
+
+out:
+    if (ret != 0) {
+        netlist_free(nl);
+    }
+    for (uint32_t i = 0; i < p->sym_cap; i++) {
+        free(p->syms[i].name);
+    }
+    for (int k = 0; k < 3; k++) {
+        free(p->decl[k]);
+    }
+    free(p->syms);
+    free(p->nodes);
+    free(p->g);
+    free(p->hash);
+    free(p->slot);
+    free(p->count);
+    return ret;
+}
+
+// Sets up the wires of a circuit for its first cycle: the constants, and
+// zero in every input and flip-flop (like the globals in logisim.c).
+static inline void netlist_reset(const struct netlist *nl, wire64 *w) {
+    memset(w, 0, nl->nwires * sizeof(wire64));
+    w[NL_ONE] = ONES64;
+}
+
+// One clock cycle is netlist_propagate() and netlist_latch(). Outputs are
+// read in between, like the wires printed by logisim.c (an output that is
+// just a flip-flop, like G = X, shows its value from before the edge).
+
+// 1. Propagate wire values through the gates, in level order.
+static inline void netlist_propagate(const struct netlist *nl, wire64 *w) {
+    for (uint32_t i = 0; i < nl->ngates; i++) {
+        const struct nl_gate *g = &nl->gates[i];
+        w[g->out] = NAND64(w[g->a], w[g->b]);
+    }
+}
+
+// 2. Edge triggering: latch all flip-flops (next is scratch space for nregs
+// values).
+static inline void netlist_latch(const struct netlist *nl, wire64 *w, wire64 *next) {
+    for (uint32_t i = 0; i < nl->nregs; i++) {
+        next[i] = w[nl->regs[i].in];
+    }
+    for (uint32_t i = 0; i < nl->nregs; i++) {
+        w[nl->regs[i].out] = next[i];
+    }
+}
+
+#endif
@@ -0,0 +1,77 @@
+// nlbench: speed of a circuit compiled by nlc (make bench)
+//
+// Built once per circuit and wire width, with the straight-line C of nlc
+// included as CIRCUIT:
+//
+//     ./nlc -w 64 -p circuit circuits/adder.net > build/adder-64.c
+//     gcc -O2 -I. -DCIRCUIT='"build/adder-64.c"' -DLANES=64 -o build/adder-64 nlbench.c
+//
+// The inputs get random values every -c cycles like in nlsim, and the
+// speed is printed in the same format as nlsim -q, so the compiled code
+// can be compared with the interpreted engines.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include CIRCUIT
+
+#ifndef LANES
+#define LANES 64
+#endif
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+int main(int argc, char *argv[]) {
+    long long cycles = 1000000, change = 1;
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:s:")) != -1) {
+        switch (opt) {
+        case 'n': cycles = atoll(optarg); break;
+        case 'c': change = atoll(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 0) | 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n <cycles>] [-c <cycles>] [-s <seed>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    circuit_wire *w = malloc(circuit_nwires * sizeof(circuit_wire));
+    if (!w) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    circuit_reset(w);
+    double t = now();
+    for (long long n = 0; n < cycles; n++) {
+        if (change && n % change == 0) {
+            for (uint32_t i = 0; i < circuit_ninputs; i++) {
+                uint64_t v = xorshift(&seed);
+                w[circuit_inputs[i]] = (circuit_wire)(LANES == 1 ? v & 1 : v);
+            }
+        }
+        circuit_cycle(w);
+        // Without inputs (the counter), the compiler could otherwise run
+        // all the cycles at compile time
+        __asm__ volatile("" : : "r"(w) : "memory");
+    }
+    t = now() - t;
+
+    fprintf(stderr, "%lld cycles in %.3f s: %.3g cycles/s, %.3g gate evaluations/s (x%d lanes)\n", cycles, t,
+            cycles / t, (double)circuit_ngates * cycles / t, LANES);
+    free(w);
+    return 0;
+}
@@ -0,0 +1,140 @@
+// nlc: compiles a netlist (see netlist.h) to straight-line C.
+//
+// The generated code has one statement per gate, in level order, on an
+// array of wires of the chosen type (bool, wire64 or wire256 of
+// logisim.h), so a cycle is just a sequence of NAND and NOT macros with
+// no loops, branches or dependency tracking left.
+
+#include "netlist.h"
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-w 1|64|256] [-p <prefix>] [-s] <circuit.net>\n", prog);
+    fprintf(stderr, "- -w: lanes per wire: bool, wire64 (default) or wire256\n");
+    fprintf(stderr, "- -p: prefix of the generated names (default: the file name)\n");
+    fprintf(stderr, "- -s: print statistics of the compiled circuit to stderr\n");
+    exit(1);
+}
+
+static void emit_slots(FILE *out, const char *prefix, const char *what, const struct nl_name *names, uint32_t n) {
+    fprintf(out, "static const uint32_t %s_n%s = %u;\n", prefix, what, n);
+    fprintf(out, "static const uint32_t %s_%s[] = {", prefix, what);
+    for (uint32_t i = 0; i < n; i++) {
+        fprintf(out, "%u, ", names[i].slot);
+    }
+    fprintf(out, "0};\n");
+    fprintf(out, "static const char *const %s_%s_names[] = {", prefix, what);
+    for (uint32_t i = 0; i < n; i++) {
+        fprintf(out, "\"%s\", ", names[i].name);
+    }
+    fprintf(out, "NULL};\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *prefix = NULL;
+    int lanes = 64, stats = 0, opt;
+    while ((opt = getopt(argc, argv, "w:p:s")) != -1) {
+        switch (opt) {
+        case 'w': lanes = atoi(optarg); break;
+        case 'p': prefix = optarg; break;
+        case 's': stats = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || (lanes != 1 && lanes != 64 && lanes != 256)) {
+        usage(argv[0]);
+    }
+    const char *file = argv[optind];
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        fprintf(stderr, "Error: netlist \"%s\" not found\n", file);
+        return 1;
+    }
+    struct netlist nl;
+    int ret = netlist_compile(&nl, f, file);
+    fclose(f);
+    if (ret != 0) {
+        return 1;
+    }
+
+    // Default prefix: the file name without directory and extension
+    char name[64];
+    if (!prefix) {
+        const char *base = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+        size_t n = strcspn(base, ".");
+        n = n < sizeof(name) - 1 ? n : sizeof(name) - 1;
+        memcpy(name, base, n);
+        name[n] = 0;
+        for (char *c = name; *c; c++) {
+            if (!isalnum((unsigned char)*c)) {
+                *c = '_';
+            }
+        }
+        prefix = name;
+    }
+    const char *type = lanes == 1 ? "wire" : lanes == 64 ? "wire64" : "wire256";
+    const char *suffix = lanes == 1 ? "" : lanes == 64 ? "64" : "256";
+    const char *one = lanes == 1 ? "1" : lanes == 64 ? "ONES64" : "ONES256";
+
+    // The first name of each slot, for comments
+    const char **slot_name = calloc(nl.nwires, sizeof(char *));
+    if (!slot_name) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < nl.nnames; i++) {
+        if (!slot_name[nl.names[i].slot]) {
+            slot_name[nl.names[i].slot] = nl.names[i].name;
+        }
+    }
+
+    FILE *out = stdout;
+    fprintf(out, "// Generated by nlc from %s; do not edit.\n", file);
+    fprintf(out, "// %u inputs, %u flip-flops, %u outputs; %u gates in %u levels.\n\n", nl.ninputs, nl.nregs,
+            nl.noutputs, nl.ngates, nl.nlevels);
+    fprintf(out, "#include <logisim.h>\n\n");
+    fprintf(out, "typedef %s %s_wire;\n\n", type, prefix);
+    fprintf(out, "static const uint32_t %s_nwires = %u;\n", prefix, nl.nwires);
+    fprintf(out, "static const uint32_t %s_ngates = %u;\n", prefix, nl.ngates);
+    emit_slots(out, prefix, "inputs", nl.inputs, nl.ninputs);
+    emit_slots(out, prefix, "regs", nl.reg_names, nl.nregs);
+    emit_slots(out, prefix, "outputs", nl.outputs, nl.noutputs);
+
+    fprintf(out, "\n// Wires for the first cycle: the constants, all else 0.\n");
+    fprintf(out, "static void %s_reset(%s_wire *w) {\n", prefix, prefix);
+    fprintf(out, "    for (uint32_t i = 0; i < %u; i++) {\n", nl.nwires);
+    fprintf(out, "        w[i] = %s;\n", lanes == 256 ? "_mm256_setzero_si256()" : "0");
+    fprintf(out, "    }\n");
+    fprintf(out, "    w[1] = %s;\n", one);
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "static void %s_cycle(%s_wire *w) {\n", prefix, prefix);
+    fprintf(out, "    // 1. Propagate wire values through combinatorial logic\n");
+    for (uint32_t l = 1; l <= nl.nlevels; l++) {
+        fprintf(out, "    // Level %u\n", l);
+        for (uint32_t i = nl.level[l - 1]; i < nl.level[l]; i++) {
+            const struct nl_gate *g = &nl.gates[i];
+            if (g->op == NL_NOT) {
+                fprintf(out, "    w[%u] = NOT%s(w[%u]);", g->out, suffix, g->a);
+            } else {
+                fprintf(out, "    w[%u] = NAND%s(w[%u], w[%u]);", g->out, suffix, g->a, g->b);
+            }
+            fprintf(out, slot_name[g->out] ? "  // %s\n" : "\n", slot_name[g->out]);
+        }
+    }
+    fprintf(out, "\n    // 2. Edge triggering: Lock values in the flip-flops\n");
+    for (uint32_t i = 0; i < nl.nregs; i++) {
+        fprintf(out, "    %s_wire q%u = w[%u];\n", prefix, i, nl.regs[i].in);
+    }
+    for (uint32_t i = 0; i < nl.nregs; i++) {
+        fprintf(out, "    w[%u] = q%u;  // %s\n", nl.regs[i].out, i, nl.reg_names[i].name);
+    }
+    fprintf(out, "}\n");
+
+    if (stats) {
+        fprintf(stderr, "%s: %u gates parsed, %u compiled (%u NOT(NOT(X)) removed), %u levels, %u wires\n", file,
+                nl.parsed_gates, nl.ngates, nl.nots_removed, nl.nlevels, nl.nwires);
+    }
+    free(slot_name);
+    netlist_free(&nl);
+    return 0;
+}
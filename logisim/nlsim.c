@@ -0,0 +1,183 @@
+// nlsim: runs a netlist (see netlist.h) without generating any C.
+//
+// The compiled gates are kept as an instruction array and interpreted
+// one cycle at a time, either all of them (-e level), only those whose
+// inputs changed (-e event, see netlist-event.h), or all of them on
+// several threads (-e parallel, see netlist-parallel.h). Inputs get new random
+// values every cycle (or every -c cycles). The outputs of lane 0 are
+// printed like logisim.c does, so
+//
+//     ./nlsim circuits/counter.net | python3 seg-display.py
+//
+// shows the same display as `make run` (just without the 1 Hz clock).
+
+#include "netlist.h"
+#include "netlist-event.h"
+#include "netlist-parallel.h"
+#include "vcd.h"
+#include <time.h>
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-e level|event|parallel] [-t <threads>] [-n <cycles>] [-c <cycles>] [-q] [-a] "
+                    "[-s <seed>] [-w <file.vcd>] <circuit.net>\n", prog);
+    fprintf(stderr, "- -e: evaluate all gates in level order (default), only those whose inputs changed,\n");
+    fprintf(stderr, "      or all gates on several threads\n");
+    fprintf(stderr, "- -t: threads for -e parallel (default 4)\n");
+    fprintf(stderr, "- -n: cycles to run (default 16)\n");
+    fprintf(stderr, "- -c: change the inputs every <cycles> cycles (default 1; 0: inputs stay 0)\n");
+    fprintf(stderr, "- -a: print the activity (gates evaluated, wires changed) of every cycle to stderr\n");
+    fprintf(stderr, "- -q: do not print the outputs, only the simulation speed\n");
+    fprintf(stderr, "- -s: seed of the random inputs\n");
+    fprintf(stderr, "- -w: record the waveforms of all named wires (lane 0, one time unit per cycle)\n");
+    exit(1);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+int main(int argc, char *argv[]) {
+    long long cycles = 16, change = 1;
+    uint64_t seed = 1;
+    const char *vcd_file = NULL;
+    int quiet = 0, activity = 0, event = 0, parallel = 0, threads = 4, opt;
+    while ((opt = getopt(argc, argv, "e:t:n:c:qas:w:")) != -1) {
+        switch (opt) {
+        case 'e':
+            event = strcmp(optarg, "event") == 0;
+            parallel = strcmp(optarg, "parallel") == 0;
+            if (!event && !parallel && strcmp(optarg, "level") != 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 't': threads = atoi(optarg); break;
+        case 'n': cycles = atoll(optarg); break;
+        case 'c': change = atoll(optarg); break;
+        case 'a': activity = 1; break;
+        case 'w': vcd_file = optarg; break;
+        case 'q': quiet = 1; break;
+        case 's': seed = strtoull(optarg, NULL, 0) | 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || cycles < 0 || change < 0 || threads < 1) {
+        usage(argv[0]);
+    }
+    FILE *f = fopen(argv[optind], "r");
+    if (!f) {
+        fprintf(stderr, "Error: netlist \"%s\" not found\n", argv[optind]);
+        return 1;
+    }
+    struct netlist nl;
+    int ret = netlist_compile(&nl, f, argv[optind]);
+    fclose(f);
+    if (ret != 0) {
+        return 1;
+    }
+
+    struct nl_event ev;
+    struct nl_parallel par;
+    wire64 *w = malloc(nl.nwires * sizeof(wire64));
+    wire64 *next = malloc((nl.nregs + 1) * sizeof(wire64));
+    if (!w || !next || (event && nl_event_init(&ev, &nl) != 0) ||
+        (parallel && nl_parallel_init(&par, &nl, w, threads) != 0)) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    if (parallel && !quiet) {
+        fprintf(stderr, "%u levels in %u stages\n", nl.nlevels, par.nstages);
+    }
+    netlist_reset(&nl, w);
+    struct vcd vcd;
+    if (vcd_file) {
+        if (vcd_open(&vcd, vcd_file) != 0) {
+            fprintf(stderr, "Error: cannot create \"%s\"\n", vcd_file);
+            return 1;
+        }
+        for (uint32_t i = 0; i < nl.nnames; i++) {
+            vcd_lane(&vcd, nl.names[i].name, &w[nl.names[i].slot]);
+        }
+    }
+
+    double t = now();
+    uint64_t evaluated = 0;
+    for (long long n = 0; n < cycles; n++) {
+        if (change && n % change == 0) {
+            for (uint32_t i = 0; i < nl.ninputs; i++) {
+                if (event) {
+                    nl_event_set(&ev, w, nl.inputs[i].slot, xorshift(&seed));
+                } else {
+                    w[nl.inputs[i].slot] = xorshift(&seed);
+                }
+            }
+        }
+        if (event) {
+            nl_event_propagate(&ev, w);
+            evaluated += ev.evaluated;
+            if (activity) {
+                fprintf(stderr, "cycle %lld: %llu of %u gates evaluated (%.1f%%), %llu wires changed\n", n,
+                        (unsigned long long)ev.evaluated, nl.ngates, nl.ngates ? 100.0 * ev.evaluated / nl.ngates : 0,
+                        (unsigned long long)ev.toggled);
+            }
+        } else {
+            if (parallel) {
+                nl_parallel_propagate(&par);
+            } else {
+                netlist_propagate(&nl, w);
+            }
+            evaluated += nl.ngates;
+            if (activity) {
+                fprintf(stderr, "cycle %lld: %u of %u gates evaluated (100%%)\n", n, nl.ngates, nl.ngates);
+            }
+        }
+        if (vcd_file) {
+            vcd_sample(&vcd, n);
+        }
+        if (!quiet) {
+            for (uint32_t i = 0; i < nl.noutputs; i++) {
+                printf("%s = %d; ", nl.outputs[i].name, (int)(w[nl.outputs[i].slot] & 1));
+            }
+            printf("\n");
+        }
+        if (event) {
+            nl_event_latch(&ev, w, next);
+        } else if (parallel) {
+            nl_parallel_latch(&par);
+        } else {
+            netlist_latch(&nl, w, next);
+        }
+    }
+    t = now() - t;
+    if (quiet) {
+        fprintf(stderr, "%lld cycles in %.3f s: %.3g cycles/s, %.3g gate evaluations/s (x64 lanes)\n", cycles, t,
+                cycles / t, evaluated / t);
+        if (event && cycles) {
+            fprintf(stderr, "activity: %.1f%% of gates evaluated, %.1f wires changed per cycle\n",
+                    nl.ngates ? 100.0 * ev.total_evaluated / ((double)nl.ngates * cycles) : 0,
+                    (double)ev.total_toggled / cycles);
+        }
+    }
+    if (vcd_file && vcd_close(&vcd) != 0) {
+        fprintf(stderr, "Error: writing \"%s\" failed\n", vcd_file);
+        return 1;
+    }
+    if (event) {
+        nl_event_free(&ev);
+    }
+    if (parallel) {
+        nl_parallel_free(&par);
+    }
+    free(w);
+    free(next);
+    netlist_free(&nl);
+    return 0;
+}
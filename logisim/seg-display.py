@@ -1,4 +1,6 @@
 import fileinput
+import os
+import sys
 
 TEMPLATE = '''
      AAAAAAAAA
@@ -12,29 +14,109 @@ TEMPLATE = '''
    EE       CC
    EE       CC
     DDDDDDDDD
-''' 
+'''
 
 # These are ANSI Escape Codes
 CLEAR = '\033[2J\033[1;1f'  # Clear screen and move cursor to top-left
 WHITE = '\033[37m░\033[0m'  # A white block
 BLACK = '\033[31m█\033[0m'  # A black block
 
-for line in fileinput.input():
-    # Execute the input line (like "A=0; B=1; ...") as Python code; the
-    # variables A, B, ... will be stored in ctx.
-    exec(line, (ctx := {}))
+# Binary frames (logisim -b): a magic byte, the number of digits, a 32-bit
+# little-endian frame sequence number, then one byte per digit with
+# segment A in bit 0 up to G in bit 6.
+MAGIC = 0xa5
+MAGIC_BYTE = bytes([MAGIC])
+HEADER = 6
 
-    # Initialize the display with a clear screen and the template.
-    disp = CLEAR + TEMPLATE
 
-    for ch in 'ABCDEFG':
-        # Determine the block color.
-        block = {
-            0: WHITE,
-            1: BLACK,
-        }.get(ctx.get(ch, 0), '?')
+def draw(digits):
+    # Fill one template per digit and put the digits side by side.
+    columns = []
+    for ctx in digits:
+        disp = TEMPLATE
+        for ch in 'ABCDEFG':
+            # Determine the block color.
+            block = {
+                0: WHITE,
+                1: BLACK,
+            }.get(ctx.get(ch, 0), '?')
+
+            # Replace each character in the template with its block.
+            disp = disp.replace(ch, block)
+        columns.append(disp.split('\n'))
+    return '\n'.join(' '.join(row) for row in zip(*columns))
+
+
+def text_frames(lines):
+    for line in lines:
+        # Execute the input line (like "A=0; B=1; ...") as Python code; the
+        # variables A, B, ... will be stored in ctx.
+        exec(line, (ctx := {}))
+        yield [ctx], ''
+
 
-        # Replace each character in the template with its block.
-        disp = disp.replace(ch, block)
+def binary_frames(fd, data):
+    # Read whatever is in the pipe and only draw its last complete frame:
+    # when the simulation sends frames faster than we can draw them, the
+    # older ones are stale anyway, and skipping them keeps the pipe from
+    # backing up. The sequence numbers tell how many were dropped.
+    last, dropped = None, 0
+    while True:
+        frame, pos = None, 0
+        while True:
+            start = data.find(MAGIC_BYTE, pos)
+            if start < 0 or len(data) - start < HEADER:
+                pos = start if start >= 0 else len(data)
+                break
+            end = start + HEADER + data[start + 1]
+            if end > len(data):
+                pos = start
+                break
+            frame, pos = data[start:end], end
+            # Frames of the same size usually follow back to back: jump
+            # straight to the last one if it is where it should be.
+            size = end - start
+            last_start = start + ((len(data) - start) // size - 1) * size
+            if last_start > start and data[last_start] == MAGIC and data[last_start + 1] == data[start + 1]:
+                pos = last_start
+        data = data[pos:]
+        if frame is not None:
+            seq = int.from_bytes(frame[2:6], 'little')
+            if last is not None:
+                dropped += (seq - last - 1) % (1 << 32)
+            last = seq
+            digits = [{ch: (b >> i) & 1 for i, ch in enumerate('ABCDEFG')} for b in frame[HEADER:]]
+            yield digits, f'frame {seq}, {dropped} dropped\n'
+        chunk = os.read(fd, 1 << 16)
+        if not chunk:
+            return
+        data += chunk
 
-    print(disp)
+
+def frames():
+    # Text lines come from files or stdin; binary frames are recognized by
+    # their first byte on stdin.
+    if len(sys.argv) > 1:
+        return text_frames(fileinput.input())
+    fd = sys.stdin.fileno()
+    first = os.read(fd, 1 << 16)
+    if first[:1] == MAGIC_BYTE:
+        return binary_frames(fd, first)
+
+    def lines(data):
+        while True:
+            *complete, data = data.split(b'\n')
+            for line in complete:
+                yield line.decode()
+            chunk = os.read(fd, 1 << 16)
+            if not chunk:
+                if data:
+                    yield data.decode()
+                return
+            data += chunk
+    return text_frames(lines(first))
+
+
+for digits, status in frames():
+    # Initialize the display with a clear screen and the template.
+    print(CLEAR + draw(digits) + status, flush=True)
@@ -0,0 +1,290 @@
+// Waveform recorder: writes wire values over time as a VCD file
+//
+// VCD (value change dump) is the text format that waveform viewers like
+// GTKWave read. Instead of printing every wire in every cycle like PRINT()
+// in logisim.c, the recorder is told about the wires once:
+//
+//     struct vcd v;
+//     vcd_open(&v, "counter.vcd");
+//     vcd_bool(&v, "X", &X);        // A bool wire (logisim.h)
+//     vcd_lane(&v, "A", &w[slot]);  // Lane 0 of a wire64 (netlist.h)
+//     CLOCK_CYCLE {
+//         ...
+//         vcd_sample(&v, cycle);
+//     }
+//     vcd_close(&v);
+//
+// vcd_sample() only compares each wire with its previous value and, if it
+// changed, appends a 32-bit entry (wire number and new value) to an
+// in-memory delta buffer; a cycle in which nothing changed costs no
+// memory at all. Full buffers are handed to a writer thread, which turns
+// them into VCD text and writes it out, so formatting and I/O overlap
+// with the simulation instead of adding to it. The simulation only waits
+// when the writer is VCD_BUFFERS buffers behind.
+
+#ifndef VCD_H
+#define VCD_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VCD_BUFFER  (1 << 20)   // Entries (4 MiB) per buffer
+#define VCD_BUFFERS 4
+#define VCD_TIME    0xffffffffu // Entry: the next two entries are a new time
+
+struct vcd_signal {
+    char *name;
+    const void *wire;
+    bool lane;      // wire64 (lane 0) rather than bool
+    bool value;
+};
+
+struct vcd {
+    FILE *f;
+    struct vcd_signal *signals;
+    uint32_t nsignals;
+    bool started;
+    uint64_t time;           // Of the last time entry
+    uint64_t changes;        // Entries written so far (for statistics)
+
+    // Buffers: the one being filled, and a queue of full ones for the
+    // writer thread
+    uint32_t *buf;
+    uint32_t len;
+    uint32_t *full[VCD_BUFFERS], full_len[VCD_BUFFERS];
+    uint32_t head, count;    // Queue of full buffers
+    uint32_t *spare[VCD_BUFFERS];
+    uint32_t nspare;
+    bool done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t writer;
+};
+
+// The identifier of signal i in the file: base-94 in the printable ASCII
+// characters, as VCD wants.
+static inline void vcd_id(uint32_t i, char *id) {
+    do {
+        *id++ = '!' + i % 94;
+        i /= 94;
+    } while (i);
+    *id = 0;
+}
+
+// Turns n entries into VCD text. This is where the time goes when a lot
+// changes, so it formats by hand into a large buffer instead of calling
+// fprintf() for every line.
+static void vcd_write(struct vcd *v, const uint32_t *e, uint32_t n) {
+    char out[1 << 16], id[8];
+    size_t len = 0;
+
+    for (uint32_t k = 0; k < n; k++) {
+        if (len > sizeof(out) - 32) {
+            fwrite(out, 1, len, v->f);
+            len = 0;
+        }
+        if (e[k] == VCD_TIME) {
+            unsigned long long t = (unsigned long long)e[k + 1] | (unsigned long long)e[k + 2] << 32;
+            char digits[24];
+            int nd = 0;
+            do {
+                digits[nd++] = '0' + t % 10;
+                t /= 10;
+            } while (t);
+            out[len++] = '#';
+            while (nd) {
+                out[len++] = digits[--nd];
+            }
+            k += 2;
+        } else {
+            out[len++] = '0' + (e[k] & 1);
+            vcd_id(e[k] >> 1, id);
+            for (char *c = id; *c; c++) {
+                out[len++] = *c;
+            }
+        }
+        out[len++] = '\n';
+    }
+    fwrite(out, 1, len, v->f);
+}
+
+static void *vcd_writer(void *arg) {
+    struct vcd *v = arg;
+
+    pthread_mutex_lock(&v->lock);
+    for (;;) {
+        while (v->count == 0 && !v->done) {
+            pthread_cond_wait(&v->cond, &v->lock);
+        }
+        if (v->count == 0) {
+            break;
+        }
+        uint32_t *e = v->full[v->head], n = v->full_len[v->head];
+        pthread_mutex_unlock(&v->lock);
+        vcd_write(v, e, n);
+        pthread_mutex_lock(&v->lock);
+        v->head = (v->head + 1) % VCD_BUFFERS;
+        v->count--;
+        v->spare[v->nspare++] = e;
+        pthread_cond_broadcast(&v->cond);
+    }
+    pthread_mutex_unlock(&v->lock);
+    return NULL;
+}
+
+// Hands the current buffer to the writer and takes a spare one.
+static void vcd_flush(struct vcd *v) {
+    pthread_mutex_lock(&v->lock);
+    while (v->count == VCD_BUFFERS || v->nspare == 0) {
+        pthread_cond_wait(&v->cond, &v->lock);
+    }
+    v->full[(v->head + v->count) % VCD_BUFFERS] = v->buf;
+    v->full_len[(v->head + v->count) % VCD_BUFFERS] = v->len;
+    v->count++;
+    v->buf = v->spare[--v->nspare];
+    v->len = 0;
+    pthread_cond_broadcast(&v->cond);
+    pthread_mutex_unlock(&v->lock);
+}
+
+// Creates the VCD file. Returns 0 on success.
+static inline int vcd_open(struct vcd *v, const char *file) {
+    memset(v, 0, sizeof(*v));
+    v->f = fopen(file, "w");
+    if (!v->f) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline int vcd_add(struct vcd *v, const char *name, const void *wire, bool lane) {
+    if (v->started) {
+        return -1;
+    }
+    struct vcd_signal *s = realloc(v->signals, (v->nsignals + 1) * sizeof(*s));
+    if (!s) {
+        return -1;
+    }
+    v->signals = s;
+    s[v->nsignals++] = (struct vcd_signal){.name = strdup(name), .wire = wire, .lane = lane};
+    return 0;
+}
+
+// Registers a wire, before the first vcd_sample().
+static inline int vcd_bool(struct vcd *v, const char *name, const bool *wire) {
+    return vcd_add(v, name, wire, false);
+}
+
+static inline int vcd_lane(struct vcd *v, const char *name, const uint64_t *wire) {
+    return vcd_add(v, name, wire, true);
+}
+
+static inline bool vcd_value(const struct vcd_signal *s) {
+    return s->lane ? *(const uint64_t *)s->wire & 1 : *(const bool *)s->wire;
+}
+
+// Writes the header and the initial values, and starts the writer.
+static int vcd_start(struct vcd *v, uint64_t time) {
+    char id[8];
+
+    fprintf(v->f, "$timescale 1ns $end\n");
+    fprintf(v->f, "$scope module logisim $end\n");
+    for (uint32_t i = 0; i < v->nsignals; i++) {
+        vcd_id(i, id);
+        fprintf(v->f, "$var wire 1 %s %s $end\n", id, v->signals[i].name);
+    }
+    fprintf(v->f, "$upscope $end\n$enddefinitions $end\n");
+    fprintf(v->f, "#%llu\n$dumpvars\n", (unsigned long long)time);
+    for (uint32_t i = 0; i < v->nsignals; i++) {
+        v->signals[i].value = vcd_value(&v->signals[i]);
+        vcd_id(i, id);
+        fprintf(v->f, "%d%s\n", v->signals[i].value, id);
+    }
+    fprintf(v->f, "$end\n");
+
+    pthread_mutex_init(&v->lock, NULL);
+    pthread_cond_init(&v->cond, NULL);
+    for (int i = 0; i < VCD_BUFFERS; i++) {
+        v->spare[i] = malloc(VCD_BUFFER * sizeof(uint32_t));
+        if (!v->spare[i]) {
+            return -1;
+        }
+    }
+    v->nspare = VCD_BUFFERS - 1;
+    v->buf = v->spare[VCD_BUFFERS - 1];
+    v->time = time;
+    v->started = true;
+    if (pthread_create(&v->writer, NULL, vcd_writer, v) != 0) {
+        v->started = false;
+        return -1;
+    }
+    return 0;
+}
+
+// Records the wires that changed since the last sample, at the given time
+// (which only ever grows). Returns 0 on success.
+static inline int vcd_sample(struct vcd *v, uint64_t time) {
+    if (!v->started) {
+        return vcd_start(v, time);
+    }
+    bool stamped = time == v->time;
+    for (uint32_t i = 0; i < v->nsignals; i++) {
+        struct vcd_signal *s = &v->signals[i];
+        bool value = vcd_value(s);
+        if (value == s->value) {
+            continue;
+        }
+        if (v->len + 4 > VCD_BUFFER) {
+            vcd_flush(v);
+        }
+        if (!stamped) {
+            v->buf[v->len++] = VCD_TIME;
+            v->buf[v->len++] = (uint32_t)time;
+            v->buf[v->len++] = (uint32_t)(time >> 32);
+            v->time = time;
+            stamped = true;
+        }
+        v->buf[v->len++] = i << 1 | value;
+        s->value = value;
+        v->changes++;
+    }
+    return 0;
+}
+
+// Writes out everything recorded and closes the file. Returns 0 if all of
+// it was written.
+static inline int vcd_close(struct vcd *v) {
+    int ret = 0;
+    if (v->started) {
+        vcd_flush(v);
+        pthread_mutex_lock(&v->lock);
+        v->done = true;
+        pthread_cond_broadcast(&v->cond);
+        pthread_mutex_unlock(&v->lock);
+        pthread_join(v->writer, NULL);
+        for (uint32_t i = 0; i < v->nspare; i++) {
+            free(v->spare[i]);
+        }
+        free(v->buf);
+        pthread_mutex_destroy(&v->lock);
+        pthread_cond_destroy(&v->cond);
+    }
+    if (v->f) {
+        ret = ferror(v->f) ? -1 : 0;
+        if (fclose(v->f) != 0) {
+            ret = -1;
+        }
+    }
+    for (uint32_t i = 0; i < v->nsignals; i++) {
+        free(v->signals[i].name);
+    }
+    free(v->signals);
+    memset(v, 0, sizeof(*v));
+    return ret;
+}
+
+#endif
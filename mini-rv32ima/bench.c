@@ -0,0 +1,251 @@
+// Benchmarks of the mini-rv32ima engines (make bench).
+//
+// Runs a few small guest kernels, each several times, on the engine this
+// file is compiled for (plain switch, -DRV32IMA_THREADED or -DRV32IMA_JIT)
+// and reports guest MIPS with its run-to-run spread, and host (TSC) cycles
+// per guest instruction. The kernels are tiny, so they are assembled right
+// here with the encoding macros below instead of needing a cross compiler.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "mini-rv32ima.h"
+
+#define BENCH_RAM  (1024 * 1024)
+#define BENCH_TEXT 0x10000 // Code below, data above
+#define BENCH_RUNS 5
+
+// RV32IMA encodings
+#define R_TYPE(f7, rs2, rs1, f3, rd, op) ((f7) << 25 | (rs2) << 20 | (rs1) << 15 | (f3) << 12 | (rd) << 7 | (op))
+#define I_TYPE(imm, rs1, f3, rd, op) (((uint32_t)(imm) & 0xfff) << 20 | (rs1) << 15 | (f3) << 12 | (rd) << 7 | (op))
+#define S_TYPE(imm, rs2, rs1, f3) \
+    ((((uint32_t)(imm) >> 5) & 0x7f) << 25 | (rs2) << 20 | (rs1) << 15 | (f3) << 12 | ((imm) & 0x1f) << 7 | 0x23)
+#define B_TYPE(imm, rs2, rs1, f3) \
+    ((((uint32_t)(imm) >> 12) & 1) << 31 | (((uint32_t)(imm) >> 5) & 0x3f) << 25 | (rs2) << 20 | (rs1) << 15 | \
+     (f3) << 12 | (((uint32_t)(imm) >> 1) & 0xf) << 8 | (((uint32_t)(imm) >> 11) & 1) << 7 | 0x63)
+#define J_TYPE(imm, rd) \
+    ((((uint32_t)(imm) >> 20) & 1) << 31 | (((uint32_t)(imm) >> 1) & 0x3ff) << 21 | \
+     (((uint32_t)(imm) >> 11) & 1) << 20 | (((uint32_t)(imm) >> 12) & 0xff) << 12 | (rd) << 7 | 0x6f)
+#define AMO(f5, rs2, rs1, rd) R_TYPE((f5) << 2, rs2, rs1, 2, rd, 0x2f)
+
+#define LUI(rd, imm)       ((uint32_t)(imm) & 0xfffff000) | (rd) << 7 | 0x37
+#define LI(rd, v)          LUI(rd, (uint32_t)(v) + 0x800), ADDI(rd, rd, (v) & 0xfff) // 2 insts
+#define ADDI(rd, rs1, imm) I_TYPE(imm, rs1, 0, rd, 0x13)
+#define ANDI(rd, rs1, imm) I_TYPE(imm, rs1, 7, rd, 0x13)
+#define SLLI(rd, rs1, sh)  I_TYPE(sh, rs1, 1, rd, 0x13)
+#define SRLI(rd, rs1, sh)  I_TYPE(sh, rs1, 5, rd, 0x13)
+#define ADD(rd, rs1, rs2)  R_TYPE(0, rs2, rs1, 0, rd, 0x33)
+#define XOR(rd, rs1, rs2)  R_TYPE(0, rs2, rs1, 4, rd, 0x33)
+#define OR(rd, rs1, rs2)   R_TYPE(0, rs2, rs1, 6, rd, 0x33)
+#define MUL(rd, rs1, rs2)  R_TYPE(1, rs2, rs1, 0, rd, 0x33)
+#define MULH(rd, rs1, rs2) R_TYPE(1, rs2, rs1, 1, rd, 0x33)
+#define DIV(rd, rs1, rs2)  R_TYPE(1, rs2, rs1, 4, rd, 0x33)
+#define DIVU(rd, rs1, rs2) R_TYPE(1, rs2, rs1, 5, rd, 0x33)
+#define REM(rd, rs1, rs2)  R_TYPE(1, rs2, rs1, 6, rd, 0x33)
+#define LW(rd, rs1, imm)   I_TYPE(imm, rs1, 2, rd, 0x03)
+#define SW(rs2, rs1, imm)  S_TYPE(imm, rs2, rs1, 2)
+#define BEQ(rs1, rs2, ofs) B_TYPE(ofs, rs2, rs1, 0)
+#define BNE(rs1, rs2, ofs) B_TYPE(ofs, rs2, rs1, 1)
+#define JAL(rd, ofs)       J_TYPE(ofs, rd)
+#define RET                I_TYPE(0, RA, 0, Z, 0x67)
+#define AMOADD(rd, rs2, rs1)  AMO(0x00, rs2, rs1, rd)
+#define AMOSWAP(rd, rs2, rs1) AMO(0x01, rs2, rs1, rd)
+#define LR(rd, rs1)           AMO(0x02, 0, rs1, rd)
+#define SC(rd, rs2, rs1)      AMO(0x03, rs2, rs1, rd)
+#define AMOMAXU(rd, rs2, rs1) AMO(0x1c, rs2, rs1, rd)
+
+// Branch offsets below are in instructions from the branch itself.
+#define I4(n) ((n) * 4)
+
+// Plain ALU work: 7 instructions per iteration.
+static const uint32_t k_intloop[] = {
+    LI(T0, 3000000),
+    ADD(T1, T1, T0),       // loop:
+    XOR(T2, T2, T1),
+    SLLI(T3, T1, 3),
+    SRLI(T4, T2, 5),
+    OR(T5, T3, T4),
+    ADDI(T0, T0, -1),
+    BNE(T0, Z, I4(-6)),
+    RET,
+};
+
+// Copies 16 KiB from 0x10000 to 0x20000, 1500 times.
+static const uint32_t k_memcpy[] = {
+    LI(S0, 1500),
+    LUI(A0, 0x10000),      // outer:
+    LUI(A1, 0x20000),
+    LUI(A2, 0x14000),
+    LW(T0, A0, 0),         // inner:
+    LW(T1, A0, 4),
+    SW(T0, A1, 0),
+    SW(T1, A1, 4),
+    ADDI(A0, A0, 8),
+    ADDI(A1, A1, 8),
+    BNE(A0, A2, I4(-6)),
+    ADDI(S0, S0, -1),
+    BNE(S0, Z, I4(-11)),
+    RET,
+};
+
+// RV32M: 8 instructions per iteration.
+static const uint32_t k_muldiv[] = {
+    LI(T0, 2500000),
+    LI(T1, 12345),
+    MUL(T2, T0, T1),       // loop:
+    MULH(T3, T0, T1),
+    DIV(T4, T2, T1),
+    REM(T5, T2, T0),
+    DIVU(T6, T3, T0),
+    ADD(T1, T1, T4),
+    ADDI(T0, T0, -1),
+    BNE(T0, Z, I4(-7)),
+    RET,
+};
+
+// Two data-dependent (xorshift) branches per iteration.
+static const uint32_t k_branch[] = {
+    LI(T0, 1300000),
+    LI(T1, 0x12345678),
+    SLLI(T2, T1, 13),      // loop:
+    XOR(T1, T1, T2),
+    SRLI(T2, T1, 17),
+    XOR(T1, T1, T2),
+    SLLI(T2, T1, 5),
+    XOR(T1, T1, T2),
+    ANDI(T3, T1, 1),
+    BEQ(T3, Z, I4(3)),
+    ADDI(A0, A0, 1),
+    JAL(Z, I4(2)),
+    ADDI(A1, A1, 1),
+    ANDI(T3, T1, 2),
+    BNE(T3, Z, I4(2)),
+    ADDI(A2, A2, 1),
+    ADDI(T0, T0, -1),
+    BNE(T0, Z, I4(-15)),
+    RET,
+};
+
+// RV32A: AMOs and an LR/SC pair on two words at 0x10000.
+static const uint32_t k_amo[] = {
+    LI(T0, 2500000),
+    LUI(A0, 0x10000),
+    ADDI(T1, Z, 1),
+    ADDI(A1, A0, 4),
+    AMOADD(T2, T1, A0),    // loop:
+    AMOSWAP(T3, T2, A1),
+    LR(T4, A0),
+    ADD(T4, T4, T1),
+    SC(T5, T4, A0),
+    AMOMAXU(T6, T0, A1),
+    ADDI(T0, T0, -1),
+    BNE(T0, Z, I4(-7)),
+    RET,
+};
+
+static const struct kernel {
+    const char * name;
+    const uint32_t * code;
+    uint32_t size;
+} kernels[] = {
+    {"intloop", k_intloop, sizeof(k_intloop)},
+    {"memcpy", k_memcpy, sizeof(k_memcpy)},
+    {"muldiv", k_muldiv, sizeof(k_muldiv)},
+    {"branch", k_branch, sizeof(k_branch)},
+    {"amo", k_amo, sizeof(k_amo)},
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t host_cycles(void) {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Runs the kernel to its final RET (back to pc 0) from a fresh state.
+// Returns the guest instruction count.
+static uint64_t run_kernel(const struct kernel * k, uint8_t * ram, uint64_t * ns, uint64_t * cycles) {
+    static struct rv32ima_icache icache;
+    struct CPUState state;
+
+    memset(ram, 0, BENCH_RAM);
+    memcpy(ram, k->code, k->size);
+    memset(&state, 0, sizeof(state));
+    state.mem = ram;
+    state.mem_size = BENCH_RAM;
+    state.regs[SP] = BENCH_RAM;
+    state.halt_pc = 0;
+    state.halt_enabled = 1;
+    if (rv32ima_icache_init(&icache, 0, BENCH_TEXT) == 0) {
+        state.icache = &icache;
+    }
+
+    uint64_t t0 = now_ns(), c0 = host_cycles();
+    int ret;
+    do {
+        ret = rv32ima_run(&state, 1, UINT32_MAX, NULL);
+    } while (ret == 0 && state.csrs[PC] != 0);
+    *cycles = host_cycles() - c0;
+    *ns = now_ns() - t0;
+
+    if (state.icache) {
+        rv32ima_icache_free(&icache);
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Error: kernel %s stopped with ret=%d at pc %08x\n", k->name, ret, state.csrs[PC]);
+        exit(1);
+    }
+    return ((uint64_t)state.csrs[CYCLEH] << 32) | state.csrs[CYCLEL];
+}
+
+int main(int argc, char ** argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : BENCH_RUNS;
+    uint8_t * ram = malloc(BENCH_RAM);
+    if (runs < 1 || !ram) {
+        printf("Usage: %s [<runs>]\n", argv[0]);
+        return 1;
+    }
+#if defined(RV32IMA_JIT)
+    const char * engine = "jit";
+#elif defined(RV32IMA_THREADED)
+    const char * engine = "threaded";
+#else
+    const char * engine = "switch";
+#endif
+    printf("engine: %s, %d runs per kernel\n", engine, runs);
+    printf("%-8s %12s %10s %8s %12s\n", "kernel", "insts", "MIPS", "+-%", "cycles/inst");
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i ++) {
+        double sum = 0, sum2 = 0, cpi = 0;
+        uint64_t insts = 0;
+        for (int r = 0; r < runs; r ++) {
+            uint64_t ns, cycles;
+            insts = run_kernel(&kernels[i], ram, &ns, &cycles);
+            double mips = insts * 1e3 / (ns ? ns : 1);
+            sum += mips;
+            sum2 += mips * mips;
+            cpi += (double)cycles / insts;
+        }
+        double mean = sum / runs;
+        double sd = runs > 1 ? sqrt(fmax(0, (sum2 - sum * sum / runs) / (runs - 1))) : 0;
+        printf("%-8s %12llu %10.1f %7.1f%% ", kernels[i].name, (unsigned long long)insts, mean, 100 * sd / mean);
+        if (host_cycles()) {
+            printf("%12.2f\n", cpi / runs);
+        } else {
+            printf("%12s\n", "n/a");
+        }
+    }
+    return 0;
+}
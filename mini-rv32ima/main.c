@@ -3,15 +3,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 
 #include "mini-rv32ima.h"
+#include "mini-rv32ima-snapshot.h"
+#include "mini-rv32ima-trace.h"
 
-#define RAM_SIZE (64*1024*1024) // Just default RAM amount is 64MB.
+#define RAM_SIZE (64*1024*1024) // Just default RAM amount is 64MB (-m).
 #define RAM_TEXT_START   0
 #define RAM_TEXT_END     RAM_STACK_START
-#define RAM_STACK_START (RAM_SIZE/2)
-#define RAM_STACK_END    RAM_SIZE
+#define RAM_STACK_START (ram_size/2)
+#define RAM_STACK_END    ram_size
+
+static uint32_t ram_size = RAM_SIZE;
 
 void DumpState(struct CPUState * core) {
 	uint32_t pc = core->csrs[PC];
@@ -37,7 +50,7 @@ void DumpState(struct CPUState * core) {
 	uint32_t * csrs = core->csrs;
     printf("CYCLEL:%08x CYCLEH:%08x EXTRAFLAGS:%08x\n", csrs[CYCLEL], csrs[CYCLEH], csrs[EXTRAFLAGS]);
     printf("stack (sp:%08x):\n", regs[2]);
-    for (int sp = regs[2]; sp < core->mem_size; sp += sizeof(int32_t)) {
+    for (uint32_t sp = regs[2]; sp < RAM_STACK_END; sp += sizeof(int32_t)) {
         printf("%08x: %08x\n", sp, core->mem[sp]);
     }
     printf("%#08x\n", RAM_STACK_END);
@@ -56,90 +69,932 @@ int xtoi(char * s) {
     return res;
 }
 
+// Monotonic, so -t and -c host don't jump with the wall clock.
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(uint64_t us) {
+    struct timespec ts = {us / 1000000, us % 1000000 * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+#define MAX_HARTS 64
+#define HART_STACK_SIZE (256*1024) // Distance between the harts' initial sp
+
+#define TRACE_RECORDS (1 << 20)
+#define MAX_GUEST_MEM  0x10000000 // RAM (+ -i input) must stay below the MMIO window
+
+static void usage(void) {
+    printf("Usage: ./mini-rv32ima [-l <insts>] [-t <ms>] [-m <MiB>] [-p <harts>] [-s <pc> [-f]] [-b <manifest> [-j <workers>]] [-P <top>] [-T <file> [-N <records>]] [-i <file>] [-c <n>|host] <path_testcase> <arg1> <arg2> ... <argn>\n");
+    printf("                     [-- <arg1> ... <argn> [-- ...]]\n");
+    printf("- The testcase file should be a rv32i binary with 0 offset to the first line of instruction,\n");
+    printf("  or a RV32 ELF executable (loaded at its segment addresses, started at its entry point).\n");
+    printf("- Note that we only support dec/hex int-type mainargs for simplicity.\n");
+    printf("- -l: stop after <insts> instructions (default 0: no limit).\n");
+    printf("- -t: stop after <ms> milliseconds of wall-clock time (default 0: no limit).\n");
+    printf("- -c: guest timer (mtime) rate: 1us per <n> instructions, or the host's monotonic clock\n");
+    printf("      with host (default: 1us per instruction). WFI then skips (<n>) or sleeps (host) to\n");
+    printf("      the next timer interrupt instead of stopping a single hart.\n");
+    printf("- -m: guest RAM size in MiB (default %d, at most %d).\n", RAM_SIZE >> 20, MAX_GUEST_MEM >> 20);
+    printf("- -i: map <file> read-only (copy-on-write) right after RAM; the guest gets its address\n");
+    printf("      and length in a0/a1, and the mainargs count/address in a2/a3 instead.\n");
+    printf("- -p: run <harts> harts (1..%d) on their own threads, sharing RAM; each starts at the\n", MAX_HARTS);
+    printf("      entry point with its own stack and reads its id from mhartid.\n");
+    printf("- -s: run up to <pc> once (with the first mainargs), snapshot there, then run the rest\n");
+    printf("      from the snapshot once per mainargs group (separated by --).\n");
+    printf("- -P: profile the run and print the <top> hottest PCs (and ELF functions) at the end.\n");
+    printf("- -T: write a binary trace of the last -N <records> instructions (default %d) to <file>;\n", TRACE_RECORDS);
+    printf("      ./tracedump <file> prints it.\n");
+    printf("- -b: batch mode: run every line of <manifest> (\"<path_testcase> <arg1> ... <argn>\") as\n");
+    printf("      its own guest on -j <workers> threads (default: one per CPU), one result line per job.\n");
+    printf("- -f: with -s, fork() a copy-on-write child per run instead of restoring dirty pages.\n");
+    printf("- The guest has an 8250 UART at %#x for its console: stores to it are written to stdout\n", RV32IMA_UART_BASE);
+    printf("  (line buffered), loads read stdin without blocking.\n");
+}
+
+static int quiet; // -b: only the per-job result lines go to stdout
+
+// The guest's 8250 console (batch jobs have none: their output is dropped)
+static struct rv32ima_uart console;
+static int profile_top; // -P
+static uint32_t input_addr, input_len; // -i
+
+// Puts the (dec/hex int-type) mainargs on top of the stack, and their count
+// and address into a0/a1; set_sp also points sp below them (guest entry).
+static void put_mainargs(struct CPUState * state, int argc, char ** argv, int set_sp) {
+    #define MAX_MAINARGS 4
+    if (argc > MAX_MAINARGS && !quiet) {
+        printf("[mini-rv32ima] WARN: mainargs should <= %d, the excess ones will be discarded\n", MAX_MAINARGS);
+    }
+    int margc = (argc > MAX_MAINARGS ? MAX_MAINARGS : argc);
+    int margs[MAX_MAINARGS] = {0};
+    if (!quiet) printf("[mini-rv32ima] mainargs:\n");
+    for (int i = 0; i < margc; i ++) {
+        if (argv[i][0] == '0' && argv[i][1] == 'x') {
+            margs[i] = xtoi(argv[i]);
+        } else {
+            margs[i] = atoi(argv[i]);
+        }
+        if (!quiet) printf("- %d\n", margs[i]);
+    }
+    uint32_t sp = RAM_STACK_END - margc * sizeof(int32_t);
+    memcpy(state->mem + sp, margs, RAM_STACK_END - sp);
+    if (set_sp) {
+        state->regs[SP] = sp;
+    }
+	state->regs[A0] = margc;
+	state->regs[A1] = sp;
+    if (input_addr) {
+        // -i: the input file comes first
+        state->regs[A2] = margc;
+        state->regs[A3] = sp;
+        state->regs[A0] = input_addr;
+        state->regs[A1] = input_len;
+    }
+}
+
+// Instructions per rv32ima_run() call when only the wall clock is limited
+#define WALL_CHECK_INSTS (1 << 20)
+
+// With -p, harts only run this many instructions between looking at the
+// others (stop requests; MSIP is picked up at the start of every batch)
+#define SMP_BATCH_INSTS (1 << 14)
+
+static uint64_t inst_limit = 0, time_limit_ms = 0;
+static struct rv32ima_trace_header * trace; // -T
+
+// -c: with a clock, the core runs with elapsedUs = 0 and the timer is set
+// between batches instead. A batch ends where the timer would pass
+// mtimecmp, so the core only has its instruction count to check and the
+// interrupt is on time; it's also kept to CLOCK_BATCH_US of guest time
+// (-c <n>) or CLOCK_HOST_INSTS instructions (-c host), so that mtime reads
+// and mtimecmp writes are never far behind.
+#define CLOCK_BATCH_US 256
+#define CLOCK_HOST_INSTS (1 << 16)
+
+static uint32_t clock_ratio; // -c <n>: instructions per guest microsecond
+static int clock_host;       // -c host
+
+struct guest_clock {
+    uint64_t host0, timer0; // -c host: timer = timer0 + now_us() - host0
+    uint32_t frac;          // -c <n>: instructions not yet making up a microsecond
+};
+
+static uint64_t get_timer(const struct CPUState * state) {
+    return ((uint64_t)state->csrs[TIMERH] << 32) | state->csrs[TIMERL];
+}
+
+static void set_timer(struct CPUState * state, uint64_t timer) {
+    state->csrs[TIMERL] = (uint32_t)timer;
+    state->csrs[TIMERH] = timer >> 32;
+}
+
+static uint64_t get_timermatch(const struct CPUState * state) {
+    return ((uint64_t)state->csrs[TIMERMATCHH] << 32) | state->csrs[TIMERMATCHL];
+}
+
+// Brings the timer up to date and returns how many of count instructions
+// the next batch may run.
+static uint32_t clock_batch(struct guest_clock * clk, struct CPUState * state, uint32_t count) {
+    uint64_t timer = get_timer(state), match = get_timermatch(state), insts;
+    if (clock_host) {
+        set_timer(state, clk->timer0 + now_us() - clk->host0);
+        insts = CLOCK_HOST_INSTS;
+    } else if (match >= timer && match - timer < CLOCK_BATCH_US) {
+        insts = (match + 1 - timer) * clock_ratio - clk->frac;
+    } else {
+        insts = (uint64_t)CLOCK_BATCH_US * clock_ratio;
+    }
+    return count < insts ? count : insts;
+}
+
+// -c <n>: time for the instructions a batch executed.
+static void clock_advance(struct guest_clock * clk, struct CPUState * state, uint32_t executed) {
+    if (clock_ratio) {
+        uint64_t insts = (uint64_t)clk->frac + executed;
+        set_timer(state, get_timer(state) + insts / clock_ratio);
+        clk->frac = insts % clock_ratio;
+    }
+}
+
+// The guest executed WFI: move its timer (-c <n>) or sleep (-c host, no
+// later than the -t deadline) to when its timer interrupt is due. Returns 0
+// if it has none set, so nothing would ever wake a single hart.
+static int clock_wfi(struct guest_clock * clk, struct CPUState * state, uint64_t deadline) {
+    uint64_t match = get_timermatch(state);
+    if (!match) {
+        return 0;
+    }
+    if (clock_ratio) {
+        if (get_timer(state) <= match) set_timer(state, match + 1);
+        clk->frac = 0;
+    } else if (match + 1 > clk->timer0) {
+        uint64_t wake = clk->host0 + (match + 1 - clk->timer0);
+        sleep_until_us(deadline && deadline < wake ? deadline : wake);
+    }
+    return 1;
+}
+
+// Opens (creates) the -T trace file with room for capacity records, and
+// starts it from state's registers.
+static int trace_open(const char * filename, uint32_t capacity, const struct CPUState * state) {
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    uint64_t size = rv32ima_trace_size(capacity);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    trace = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (trace == MAP_FAILED) {
+        trace = NULL;
+        return -1;
+    }
+    trace->magic = RV32IMA_TRACE_MAGIC;
+    trace->version = RV32IMA_TRACE_VERSION;
+    trace->record_size = sizeof(struct rv32ima_trace_record);
+    trace->capacity = capacity;
+    memcpy(trace->regs, state->regs, sizeof(trace->regs));
+    return 0;
+}
+
+// One step with a trace record: what the instruction was, where it
+// accessed memory and what it left in rd.
+static int traced_step(struct CPUState * state, uint32_t elapsedUs, uint32_t * executed) {
+    struct rv32ima_trace_record r;
+    struct rv32ima_insn in;
+    memset(&r, 0, sizeof(r));
+    r.pc = state->csrs[PC];
+    uint32_t ofs = r.pc - state->mem_offset;
+    if (ofs < state->mem_size - 3 && !(ofs & 3)) {
+        memcpy(&r.ir, state->mem + ofs, 4);
+    }
+    rv32ima_decode(r.ir, &in);
+    if ((in.op >= OP_LB && in.op <= OP_STORE_BAD) || (in.op >= OP_LR && in.op <= OP_AMO_BAD)) {
+        r.mem_addr = state->regs[in.rs1] + (in.op >= OP_LR ? 0 : in.imm);
+        r.flags |= RV32IMA_TRACE_MEM;
+    }
+    int ret = rv32ima_run(state, elapsedUs, 1, executed);
+    if (!*executed) {
+        return ret;
+    }
+    if (in.rd && in.op != OP_ILLEGAL) {
+        r.rd = in.rd;
+        r.rd_value = state->regs[in.rd];
+        r.flags |= RV32IMA_TRACE_RD;
+    }
+    r.cyclel = state->csrs[CYCLEL];
+    r.cycleh = state->csrs[CYCLEH];
+    r.extraflags = state->csrs[EXTRAFLAGS];
+    rv32ima_trace_append(trace, &r);
+    return ret;
+}
+static uint32_t nharts = 1;
+static int smp_stop; // -p: hart 0 is done, so are the others
+
+// Runs the guest until its PC reaches halt_pc, the core returns nonzero
+// (returned) or a -l/-t limit is hit (returns -1).
+static int run_guest(struct CPUState * state, uint32_t halt_pc) {
+    int ret;
+    int clocked = clock_ratio || clock_host;
+    state->halt_pc = halt_pc;
+    state->halt_enabled = 1;
+    if (!inst_limit && !time_limit_ms && nharts == 1 && !trace && !clocked) {
+        // run to completion: nothing to account for between batches
+        do {
+            ret = rv32ima_run(state, 1, UINT32_MAX, NULL);
+        } while (ret == 0 && state->csrs[PC] != halt_pc);
+        if (ret != 0 && !quiet) {
+            rv32ima_uart_flush(state->uart);
+            printf("minirv32ima ret=%d !=0\n", ret);
+        }
+        return ret;
+    }
+    uint64_t left = inst_limit ? inst_limit : UINT64_MAX;
+    uint64_t deadline = time_limit_ms ? now_us() + time_limit_ms * 1000 : 0;
+    struct guest_clock clk = {now_us(), get_timer(state), 0};
+    do {
+        uint32_t count = left < UINT32_MAX ? left : UINT32_MAX;
+        if (deadline && count > WALL_CHECK_INSTS)
+            count = WALL_CHECK_INSTS;
+        if (nharts > 1 && count > SMP_BATCH_INSTS)
+            count = SMP_BATCH_INSTS;
+        if (clocked)
+            count = clock_batch(&clk, state, count);
+        uint32_t executed;
+        if (trace) {
+            ret = traced_step(state, !clocked, &executed);
+        } else {
+            ret = rv32ima_run(state, !clocked, count, &executed);
+        }
+        left -= executed;
+        if (clocked)
+            clock_advance(&clk, state, executed);
+        if (nharts > 1) {
+            if (__atomic_load_n(&smp_stop, __ATOMIC_RELAXED))
+                return ret;
+            if (ret == 1) {
+                // WFI: wait for an interrupt while the other harts run (an
+                // instruction clock only moves on when it's skipped ahead)
+                if (clock_ratio)
+                    clock_wfi(&clk, state, deadline);
+                sched_yield();
+                ret = 0;
+            }
+        } else if (ret == 1 && clocked && clock_wfi(&clk, state, deadline)) {
+            ret = 0;
+        }
+        if (ret != 0 && !quiet) {
+            rv32ima_uart_flush(state->uart);
+            printf("minirv32ima ret=%d !=0\n", ret);
+        }
+        if (ret != 0 || state->csrs[PC] == halt_pc)
+            return ret;
+        if (inst_limit && !left) {
+            fprintf(stderr, "Error: instruction limit (%llu) exceeded\n", (unsigned long long)inst_limit);
+            return -1;
+        }
+        if (deadline && now_us() >= deadline) {
+            fprintf(stderr, "Error: time limit (%llu ms) exceeded\n", (unsigned long long)time_limit_ms);
+            return -1;
+        }
+    } while (1);
+}
+
+// run_guest(), then writes out what's left of the guest's console output.
+static int emulate(struct CPUState * state, uint32_t halt_pc) {
+    int ret = run_guest(state, halt_pc);
+    rv32ima_uart_flush(state->uart);
+    return ret;
+}
+
+// -P: function symbols of an ELF testcase, sorted by address
+struct symbol {
+    uint32_t addr, size;
+    const char * name;
+};
+
+static struct symbol * symbols;
+static int nsymbols;
+
+static int symbol_cmp(const void * a, const void * b) {
+    const struct symbol * x = a, * y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+// Reads the STT_FUNC symbols of the testcase, if it's an ELF file with a
+// symbol table (the file stays mapped: names point into it).
+static void load_symbols(const char * image_filename) {
+    int fd = open(image_filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Elf32_Ehdr)) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+    const uint8_t * file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        return;
+    }
+    const Elf32_Ehdr * eh = (const Elf32_Ehdr *)file;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+        eh->e_shentsize != sizeof(Elf32_Shdr) || eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf32_Shdr) > (size_t)st.st_size) {
+        return;
+    }
+    const Elf32_Shdr * sh = (const Elf32_Shdr *)(file + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i ++) {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum ||
+            sh[i].sh_offset + (size_t)sh[i].sh_size > (size_t)st.st_size) {
+            continue;
+        }
+        const Elf32_Sym * sym = (const Elf32_Sym *)(file + sh[i].sh_offset);
+        const Elf32_Shdr * strtab = &sh[sh[i].sh_link];
+        int n = sh[i].sh_size / sizeof(Elf32_Sym);
+        symbols = realloc(symbols, (nsymbols + n) * sizeof(struct symbol));
+        for (int j = 0; j < n; j ++) {
+            if (ELF32_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_shndx == SHN_UNDEF ||
+                sym[j].st_name >= strtab->sh_size) {
+                continue;
+            }
+            symbols[nsymbols ++] = (struct symbol){sym[j].st_value, sym[j].st_size,
+                                                   (const char *)file + strtab->sh_offset + sym[j].st_name};
+        }
+    }
+    qsort(symbols, nsymbols, sizeof(struct symbol), symbol_cmp);
+}
+
+// Last symbol starting at or before addr (and covering it, if sized).
+static const struct symbol * find_symbol(uint32_t addr) {
+    int lo = 0, hi = nsymbols;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (symbols[mid].addr <= addr) lo = mid + 1; else hi = mid;
+    }
+    if (lo == 0) return NULL;
+    const struct symbol * sym = &symbols[lo - 1];
+    return (sym->size && addr - sym->addr >= sym->size) ? NULL : sym;
+}
+
+struct hot_spot {
+    uint32_t pc;
+    uint64_t count;
+};
+
+static int hot_spot_cmp(const void * a, const void * b) {
+    const struct hot_spot * x = a, * y = b;
+    return x->count > y->count ? -1 : x->count < y->count;
+}
+
+// Prints the top hottest PCs (and functions, with symbols) of the profile.
+static void print_profile(struct CPUState * state, int top) {
+    uint32_t n = state->profile_size / 4, nspots = 0;
+    uint64_t total = state->profile_other;
+    struct hot_spot * spots = malloc(n * sizeof(*spots));
+    struct hot_spot * funcs = calloc(nsymbols ? nsymbols : 1, sizeof(*funcs));
+    for (uint32_t i = 0; i < n; i ++) {
+        if (!state->profile[i]) continue;
+        uint32_t pc = state->mem_offset + state->profile_base + i * 4;
+        spots[nspots ++] = (struct hot_spot){pc, state->profile[i]};
+        total += state->profile[i];
+        const struct symbol * sym = find_symbol(pc);
+        if (sym) {
+            funcs[sym - symbols].pc = sym->addr;
+            funcs[sym - symbols].count += state->profile[i];
+        }
+    }
+    qsort(spots, nspots, sizeof(*spots), hot_spot_cmp);
+    printf("profile: %llu instructions (%llu outside of text)\n",
+           (unsigned long long)total, (unsigned long long)state->profile_other);
+    printf("%12s %6s  %-8s\n", "count", "%", "pc");
+    for (uint32_t i = 0; i < nspots && i < (uint32_t)top; i ++) {
+        const struct symbol * sym = find_symbol(spots[i].pc);
+        printf("%12llu %5.1f%%  %08x", (unsigned long long)spots[i].count, 100.0 * spots[i].count / total, spots[i].pc);
+        if (sym) printf("  %s+%#x", sym->name, spots[i].pc - sym->addr);
+        printf("\n");
+    }
+    if (nsymbols) {
+        qsort(funcs, nsymbols, sizeof(*funcs), hot_spot_cmp);
+        printf("%12s %6s  %s\n", "count", "%", "function");
+        for (int i = 0; i < nsymbols && i < top && funcs[i].count; i ++) {
+            printf("%12llu %5.1f%%  %s\n", (unsigned long long)funcs[i].count, 100.0 * funcs[i].count / total,
+                   find_symbol(funcs[i].pc)->name);
+        }
+    }
+    free(spots);
+    free(funcs);
+}
+
+static void * hart_main(void * arg) {
+    struct CPUState * state = arg;
+    emulate(state, 0);
+    if (state->hartid == 0) {
+        __atomic_store_n(&smp_stop, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// Runs nharts copies of the loaded guest (boot is hart 0), one host thread
+// each, until hart 0 is done. All harts share RAM, but have their own stack
+// and decode cache.
+static int run_smp(struct CPUState * boot) {
+    static struct CPUState * harts[MAX_HARTS];
+    static pthread_t threads[MAX_HARTS];
+    for (uint32_t i = 0; i < nharts; i ++) {
+        struct CPUState * hart = boot;
+        if (i > 0) {
+            hart = malloc(sizeof(*hart));
+            if (!hart) {
+                fprintf(stderr, "Error: failed to allocate hart %u\n", i);
+                return 1;
+            }
+            *hart = *boot;
+            if (boot->icache) {
+                hart->icache = malloc(sizeof(*hart->icache));
+                if (!hart->icache || rv32ima_icache_init(hart->icache, boot->icache->base, boot->icache->size) != 0) {
+                    printf("[mini-rv32ima] WARN: no decode cache for hart %u\n", i);
+                    free(hart->icache);
+                    hart->icache = NULL;
+                }
+            }
+            hart->regs[SP] -= i * HART_STACK_SIZE;
+        }
+        hart->hartid = i;
+        hart->harts = harts;
+        hart->nharts = nharts;
+        harts[i] = hart;
+    }
+    for (uint32_t i = 0; i < nharts; i ++) {
+        if (pthread_create(&threads[i], NULL, hart_main, harts[i]) != 0) {
+            fprintf(stderr, "Error: failed to start hart %u\n", i);
+            exit(1);
+        }
+    }
+    for (uint32_t i = 0; i < nharts; i ++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (uint32_t i = 1; i < nharts; i ++) {
+        printf("hart %u finally: PC:%08x a0:%08x\n", i, harts[i]->csrs[PC], harts[i]->regs[A0]);
+    }
+    printf("finally:\n");
+    DumpState(boot);
+    if (boot->profile) print_profile(boot, profile_top);
+    return 0;
+}
+
+#define PAGE_SIZE 4096
+
+// Places the PT_LOAD segments of the ELF32 (RISC-V) executable fd into
+// guest RAM. Whole pages that belong to a single segment are mapped from
+// the file copy-on-write, so read-only segments cost no copying at all; the
+// partial head/tail pages are copied, and BSS is left to the demand-zero
+// RAM. With copy, everything is copied (RAM stays anonymous memory).
+// Returns the entry point and the range of the executable segments in
+// [*text_lo, *text_hi), or -1 if fd isn't a usable ELF file.
+static int load_elf(struct CPUState * state, int fd, int copy, uint32_t * entry, uint32_t * text_lo, uint32_t * text_hi) {
+    Elf32_Ehdr eh;
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0) {
+        return -1;
+    }
+    if (eh.e_ident[EI_CLASS] != ELFCLASS32 || eh.e_machine != EM_RISCV || eh.e_type != ET_EXEC ||
+        eh.e_phentsize != sizeof(Elf32_Phdr)) {
+        fprintf(stderr, "Error: not a RV32 ELF executable\n");
+        return -1;
+    }
+    *text_lo = UINT32_MAX;
+    *text_hi = 0;
+    for (int i = 0; i < eh.e_phnum; i ++) {
+        Elf32_Phdr ph;
+        if (pread(fd, &ph, sizeof(ph), eh.e_phoff + i * sizeof(ph)) != sizeof(ph)) {
+            return -1;
+        }
+        if (ph.p_type != PT_LOAD || ph.p_memsz == 0) {
+            continue;
+        }
+        uint32_t start = ph.p_vaddr - state->mem_offset;
+        if (ph.p_filesz > ph.p_memsz || start >= state->mem_size || ph.p_memsz > state->mem_size - start) {
+            fprintf(stderr, "Error: segment %d (%#x+%#x) is outside of RAM\n", i, ph.p_vaddr, ph.p_memsz);
+            return -1;
+        }
+
+        // [head, tail) is the page-aligned part we can map from the file
+        uint32_t end = start + ph.p_filesz;
+        uint32_t head = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        uint32_t tail = end & ~(PAGE_SIZE - 1);
+        if (copy || (ph.p_offset - start) % PAGE_SIZE != 0 || head >= tail) {
+            head = tail = end; // misaligned in the file: copy it all
+        }
+        if (head < tail && mmap(state->mem + head, tail - head, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                                fd, ph.p_offset + (head - start)) == MAP_FAILED) {
+            return -1;
+        }
+        if (pread(fd, state->mem + start, head - start, ph.p_offset) != (ssize_t)(head - start) ||
+            pread(fd, state->mem + tail, end - tail, ph.p_offset + (tail - start)) != (ssize_t)(end - tail)) {
+            return -1;
+        }
+        if (ph.p_flags & PF_X) {
+            if (start < *text_lo) *text_lo = start;
+            if (start + ph.p_memsz > *text_hi) *text_hi = start + ph.p_memsz;
+        }
+    }
+    if (*text_lo >= *text_hi) {
+        *text_lo = *text_hi = 0;
+    }
+    *entry = eh.e_entry;
+    return 0;
+}
+
+// Loads the testcase into RAM and points the PC at its first instruction:
+// an ELF executable goes where its headers say, a flat binary is mapped
+// copy-on-write over the start of RAM instead of copying it (the tail of
+// its last page reads as 0), or read into it with copy. Returns the text
+// range in [*text_lo, *text_hi), or -1 on errors.
+static int load_image(struct CPUState * state, const char * image_filename, int copy, uint32_t * text_lo, uint32_t * text_hi) {
+    int fd = open(image_filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error: image file \"%s\" not found\n", image_filename);
+        if (fd >= 0) close(fd);
+        return -1;
+	}
+    *text_lo = RAM_TEXT_START;
+    *text_hi = RAM_TEXT_END;
+    state->csrs[PC] = state->mem_offset;
+    uint32_t entry;
+    char magic[SELFMAG];
+    if (pread(fd, magic, SELFMAG, 0) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0) {
+        int err = load_elf(state, fd, copy, &entry, text_lo, text_hi);
+        close(fd);
+        if (err != 0) {
+            fprintf(stderr, "Error: Failed to load ELF file\n");
+            return -1;
+        }
+        if (!quiet) printf("[mini-rv32ima] ELF entry = %#x, text = [%#x, %#x)\n", entry, *text_lo, *text_hi);
+        state->csrs[PC] = entry;
+        return 0;
+    }
+    long flen = st.st_size;
+    if (flen > RAM_TEXT_END - RAM_TEXT_START) {
+        fprintf(stderr, "Error: image file size too big (%#lx bytes)\n", flen);
+        close(fd);
+        return -1;
+    }
+    if (flen > 0 && (copy ? pread(fd, state->mem + RAM_TEXT_START, flen, 0) != flen
+                          : mmap(state->mem + RAM_TEXT_START, flen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+        fprintf(stderr, "Error: Failed to load image file\n");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// Zeroes the RAM the previous batch job used. Resident pages are cleared
+// in place, so the next job doesn't fault them in again; the rest (never
+// touched, or swapped out) is dropped back to demand-zero memory.
+static void ram_reset(uint8_t * mem, uint32_t size, unsigned char * resident) {
+    uint32_t npages = size / PAGE_SIZE;
+    if (mincore(mem, size, resident) != 0) {
+        madvise(mem, size, MADV_DONTNEED);
+        return;
+    }
+    for (uint32_t i = 0; i < npages; ) {
+        uint32_t j = i;
+        while (j < npages && (resident[j] & 1) == (resident[i] & 1)) j ++;
+        if (resident[i] & 1) {
+            memset(mem + (size_t)i * PAGE_SIZE, 0, (size_t)(j - i) * PAGE_SIZE);
+        } else {
+            madvise(mem + (size_t)i * PAGE_SIZE, (size_t)(j - i) * PAGE_SIZE, MADV_DONTNEED);
+        }
+        i = j;
+    }
+}
+
+// -b: one worker per thread, each with its own RAM and decode cache that are
+// reused for every job it picks from the manifest.
+struct batch_worker {
+    pthread_t thread;
+    struct CPUState state;
+    struct rv32ima_icache icache;
+    int has_icache;
+    unsigned char * resident;
+};
+
+static char ** batch_jobs;
+static int batch_njobs, batch_next;
+
+static void batch_run_job(struct batch_worker * w, int job) {
+    // split "image arg1 arg2 ..."
+    char line[4096], * args[2 + MAX_MAINARGS + 1], * save;
+    int nargs = 0;
+    snprintf(line, sizeof(line), "%s", batch_jobs[job]);
+    for (char * tok = strtok_r(line, " \t\r\n", &save); tok && nargs < (int)(sizeof(args) / sizeof(args[0])); tok = strtok_r(NULL, " \t\r\n", &save)) {
+        args[nargs ++] = tok;
+    }
+    if (nargs == 0) {
+        return;
+    }
+
+    struct CPUState * state = &w->state;
+    uint8_t * mem = state->mem;
+    ram_reset(mem, ram_size, w->resident);
+    memset(state, 0, sizeof(*state));
+    state->mem = mem;
+    state->mem_size = ram_size;
+    state->mem_offset = RAM_TEXT_START;
+    if (w->has_icache) {
+        rv32ima_icache_flush(&w->icache);
+        state->icache = &w->icache;
+    }
+
+    uint32_t text_lo, text_hi;
+    uint64_t start = now_us();
+    if (load_image(state, args[0], 1, &text_lo, &text_hi) != 0) {
+        printf("job %d: %s load-error\n", job, args[0]);
+        return;
+    }
+    put_mainargs(state, nargs - 1, args + 1, 1);
+    int ret = emulate(state, 0);
+    uint64_t insts = ((uint64_t)state->csrs[CYCLEH] << 32) | state->csrs[CYCLEL];
+    printf("job %d: %s ret=%d pc=%08x a0=%08x insts=%llu us=%llu\n", job, args[0], ret, state->csrs[PC],
+           state->regs[A0], (unsigned long long)insts, (unsigned long long)(now_us() - start));
+}
+
+static void * batch_main(void * arg) {
+    struct batch_worker * w = arg;
+    int job;
+    while ((job = __atomic_fetch_add(&batch_next, 1, __ATOMIC_RELAXED)) < batch_njobs) {
+        batch_run_job(w, job);
+    }
+    return NULL;
+}
+
+// Runs every line of the manifest ("image arg1 arg2 ...", # comments) as
+// its own guest, on nworkers threads; prints one result line per job.
+static int run_batch(const char * manifest, int nworkers) {
+    FILE * f = fopen(manifest, "r");
+    if (!f) {
+        fprintf(stderr, "Error: manifest \"%s\" not found\n", manifest);
+        return 1;
+    }
+    char line[4096];
+    int cap = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char * p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0') {
+            continue;
+        }
+        if (batch_njobs == cap) {
+            cap = cap ? cap * 2 : 64;
+            batch_jobs = realloc(batch_jobs, cap * sizeof(char *));
+        }
+        batch_jobs[batch_njobs ++] = strdup(p);
+    }
+    fclose(f);
+
+    struct batch_worker * workers = calloc(nworkers, sizeof(*workers));
+    for (int i = 0; i < nworkers; i ++) {
+        struct batch_worker * w = &workers[i];
+        w->state.mem = mmap(NULL, ram_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        w->resident = malloc(ram_size / PAGE_SIZE);
+        if (w->state.mem == MAP_FAILED || !w->resident) {
+            fprintf(stderr, "Error: failed to allocate ram image.\n");
+            return 1;
+        }
+        w->has_icache = rv32ima_icache_init(&w->icache, RAM_TEXT_START, RAM_TEXT_END - RAM_TEXT_START) == 0;
+        if (pthread_create(&w->thread, NULL, batch_main, w) != 0) {
+            fprintf(stderr, "Error: failed to start worker %d\n", i);
+            return 1;
+        }
+    }
+    for (int i = 0; i < nworkers; i ++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    return 0;
+}
+
 int main(int argc, char ** argv) {
+    // get the options (stop at the testcase: later arguments are mainargs)
+    long long snap_pc = -1;
+    int snap_fork = 0;
+    int opt;
+    const char * manifest = NULL;
+    long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char * trace_file = NULL, * input_file = NULL;
+    uint32_t trace_records = TRACE_RECORDS;
+    while ((opt = getopt(argc, argv, "+l:t:m:p:s:fb:j:P:T:N:i:c:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (!strcmp(optarg, "host")) {
+                clock_host = 1;
+            } else if ((clock_ratio = strtoul(optarg, NULL, 0)) < 1) {
+                fprintf(stderr, "Error: -c takes instructions per microsecond (>= 1) or host\n");
+                return 1;
+            }
+            break;
+        case 'P': profile_top = strtol(optarg, NULL, 0); break;
+        case 'T': trace_file = optarg; break;
+        case 'i': input_file = optarg; break;
+        case 'N': trace_records = strtoul(optarg, NULL, 0); break;
+        case 'b': manifest = optarg; break;
+        case 'j': nworkers = strtol(optarg, NULL, 0); break;
+        case 'p':
+            nharts = strtoul(optarg, NULL, 0);
+            if (nharts < 1 || nharts > MAX_HARTS) {
+                fprintf(stderr, "Error: hart count must be 1..%d\n", MAX_HARTS);
+                return 1;
+            }
+            break;
+        case 's': snap_pc = strtoul(optarg, NULL, 0); break;
+        case 'f': snap_fork = 1; break;
+        case 'l': inst_limit = strtoull(optarg, NULL, 0); break;
+        case 't': time_limit_ms = strtoull(optarg, NULL, 0); break;
+        case 'm': {
+            unsigned long mib = strtoul(optarg, NULL, 0);
+            if (mib < 1 || mib > MAX_GUEST_MEM >> 20) {
+                fprintf(stderr, "Error: RAM size must be 1..%d MiB\n", MAX_GUEST_MEM >> 20);
+                return 1;
+            }
+            ram_size = mib << 20;
+            break;
+        }
+        default: usage(); return opt == 'h' ? 0 : 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (nharts > 1 && snap_pc >= 0) {
+        fprintf(stderr, "Error: -s works with a single hart only\n");
+        return 1;
+    }
+    if (trace_file && (nharts > 1 || manifest || trace_records == 0)) {
+        fprintf(stderr, "Error: -T needs a single hart, no -b and -N > 0\n");
+        return 1;
+    }
+    if (manifest) {
+        if (nharts > 1 || snap_pc >= 0) {
+            fprintf(stderr, "Error: -b can't be combined with -p or -s\n");
+            return 1;
+        }
+        quiet = 1;
+        return run_batch(manifest, nworkers > 0 ? nworkers : 1);
+    }
+
     // get the testcase
     if (argc < 2) {
-        printf("Usage: ./mini-rv32ima <path_testcase> <arg1> <arg2> ... <argn>\n");
-        printf("- The testcase file should be a rv32i binary with 0 offset to the first line of instruction.\n");
-        printf("- Note that we only support dec/hex int-type mainargs for simplicity.\n");
+        usage();
         return 0;
     }
     char * image_filename = argv[1];
     printf("[mini-rv32ima] load image file: %s\n", image_filename);
 
-    // allocate ram image
+    // allocate ram image: demand-zero pages, only what the guest touches
+    // costs anything
     struct CPUState state;
-    printf("[mini-rv32ima] alloc ram size = %#x\n", RAM_SIZE);
+    printf("[mini-rv32ima] alloc ram size = %#x\n", ram_size);
     memset(&state, 0, sizeof(state));
-    state.mem = malloc(RAM_SIZE);
-    if (!state.mem) {
+
+    // -i: the input file goes right after RAM, so reserve room for it too
+    int input_fd = -1;
+    uint32_t input_size = 0;
+    if (input_file) {
+        struct stat st;
+        input_fd = open(input_file, O_RDONLY);
+        if (input_fd < 0 || fstat(input_fd, &st) < 0) {
+            fprintf(stderr, "Error: input file \"%s\" not found\n", input_file);
+            return 1;
+        }
+        if (st.st_size > MAX_GUEST_MEM - ram_size) {
+            fprintf(stderr, "Error: input file too big for %u MiB RAM (%#llx bytes)\n", ram_size >> 20, (unsigned long long)st.st_size);
+            return 1;
+        }
+        input_len = st.st_size;
+        input_size = (input_len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    }
+    state.mem = mmap(NULL, (size_t)ram_size + input_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (state.mem == MAP_FAILED) {
 		fprintf(stderr, "Error: failed to allocate ram image.\n");
 		return 1;
 	}
-    state.mem_size = RAM_SIZE;
-    memset(state.mem, 0, state.mem_size);
+    // MAP_PRIVATE: the guest reads the page cache itself, and a stray store
+    // only costs a private copy of that page
+    if (input_size && mmap(state.mem + ram_size, input_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, input_fd, 0) == MAP_FAILED) {
+        fprintf(stderr, "Error: failed to map input file \"%s\"\n", input_file);
+        return 1;
+    }
+    if (input_fd >= 0) {
+        close(input_fd);
+    }
+    state.mem_size = ram_size + input_size;
     state.mem_offset = RAM_TEXT_START;
     state.csrs[PC] = state.mem_offset;
+    console.out = stdout;
+    console.in_fd = STDIN_FILENO;
+    state.uart = &console;
 
     // load insts from testcase
-    FILE * f = fopen(image_filename, "rb");
-    if (!f || ferror(f)) {
-        fprintf(stderr, "Error: image file \"%s\" not found\n", image_filename);
-        return 1;
-	}
-    fseek(f, 0, SEEK_END);
-    long flen = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    if (flen > RAM_TEXT_END - RAM_TEXT_START) {
-        fprintf(stderr, "Error: image file size too big (%#lx bytes)\n", flen);
-        fclose(f);
+    uint32_t text_lo, text_hi;
+    if (load_image(&state, image_filename, 0, &text_lo, &text_hi) != 0) {
         return 1;
     }
-    if (fread(state.mem + RAM_TEXT_START, flen, 1, f) != 1) {
-        fprintf(stderr, "Error: Failed to load image file\n");
-        return 1;
+
+    // decode cache over the text segment (optional: we can run without it)
+    static struct rv32ima_icache icache;
+    if (text_hi > text_lo && rv32ima_icache_init(&icache, text_lo, text_hi - text_lo) == 0) {
+        state.icache = &icache;
+    } else {
+        printf("[mini-rv32ima] WARN: no decode cache\n");
     }
-    fclose(f);
 
+    // execution profile over the text segment (calloc: only touched pages)
+    if (profile_top > 0) {
+        state.profile = calloc((text_hi - text_lo) / 4 + 1, sizeof(uint64_t));
+        if (!state.profile) {
+            fprintf(stderr, "Error: failed to allocate the profile\n");
+            return 1;
+        }
+        state.profile_base = text_lo;
+        state.profile_size = text_hi - text_lo;
+        load_symbols(image_filename);
+    }
 
-    // get mainargs
-    #define MAX_MAINARGS 4
-    if (argc > 2 + MAX_MAINARGS) {
-        printf("[mini-rv32ima] WARN: mainargs should <= %d, the excess ones will be discarded\n", MAX_MAINARGS);
+    // get mainargs: argv[2..] up to the first "--" (the rest are for -s)
+    int margc = 0;
+    while (2 + margc < argc && strcmp(argv[2 + margc], "--") != 0) {
+        margc ++;
     }
-    int margc = (argc > 2 + MAX_MAINARGS ? MAX_MAINARGS : argc - 2);
-    int margs[MAX_MAINARGS] = {0};
-    printf("[mini-rv32ima] mainargs:\n");
-    for (int i = 0; i < margc; i ++) {
-        if (argv[2 + i][0] == '0' && argv[2 + i][1] == 'x') {
-            margs[i] = xtoi(argv[2 + i]);
-        } else {
-            margs[i] = atoi(argv[2 + i]);
-        }
-        printf("- %d\n", margs[i]);
+    if (input_file) {
+        input_addr = state.mem_offset + ram_size;
+        printf("[mini-rv32ima] input file: %s at %#x (%#x bytes)\n", input_file, input_addr, input_len);
+    }
+    put_mainargs(&state, margc, argv + 2, 1);
+
+    if (trace_file && trace_open(trace_file, trace_records, &state) != 0) {
+        fprintf(stderr, "Error: failed to create trace file \"%s\"\n", trace_file);
+        return 1;
     }
-    uint32_t sp = RAM_STACK_END - margc * sizeof(int32_t);
-    memcpy(state.mem + sp, margs, RAM_STACK_END - sp);
-	state.regs[SP] = sp;
-	state.regs[A0] = margc;
-	state.regs[A1] = sp;
 
     // do emulation
     printf("initially:\n");
     DumpState(&state);
-    int ret;
-    int debug_climit = 10000;
-    do {
-        ret = rv32ima_step(&state, 1);
-        if (ret != 0) printf("minirv32ima ret=%d !=0\n", ret);
-        // DumpState(&state);
-        if (--debug_climit <= 0) {
-            fprintf(stderr, "Error: debug_climit exceed\n");
-            break;
+    // the guest's main() returns to address 0: stop the batch right there
+    if (nharts > 1) {
+        return run_smp(&state);
+    }
+    if (snap_pc < 0) {
+        emulate(&state, 0);
+        printf("finally:\n");
+        DumpState(&state);
+        if (state.profile) print_profile(&state, profile_top);
+        return 0;
+    }
+
+    // warm up to the snapshot point, then one run per mainargs group
+    if (emulate(&state, snap_pc) != 0 || state.csrs[PC] != snap_pc) {
+        fprintf(stderr, "Error: guest did not reach the snapshot pc %#llx\n", snap_pc);
+        return 1;
+    }
+    static struct rv32ima_snapshot snap;
+    if (!snap_fork && rv32ima_snapshot_take(&snap, &state) != 0) {
+        fprintf(stderr, "Error: failed to take a snapshot\n");
+        return 1;
+    }
+    char ** group = argv + 2;
+    int ngroup = margc;
+    for (int run = 0; run == 0 || group < argv + argc; run ++) {
+        printf("[mini-rv32ima] run %d from pc %#llx\n", run, snap_pc);
+        pid_t pid = 0;
+        if (snap_fork) {
+            fflush(stdout);
+            pid = fork();
+            if (pid < 0) {
+                fprintf(stderr, "Error: fork failed\n");
+                return 1;
+            }
+        } else if (run > 0) {
+            rv32ima_snapshot_restore(&snap, &state);
         }
-    } while (ret == 0 && state.csrs[PC] != 0);
-    printf("finally:\n");
-    DumpState(&state);
-    // return
+        if (pid == 0) {
+            if (run > 0) {
+                put_mainargs(&state, ngroup, group, 0);
+            }
+            emulate(&state, 0);
+            printf("finally:\n");
+            DumpState(&state);
+            if (state.profile) print_profile(&state, profile_top);
+            if (snap_fork) {
+                fflush(stdout);
+                _exit(0);
+            }
+        } else {
+            waitpid(pid, NULL, 0);
+        }
+        // next group
+        group += ngroup + 1;
+        for (ngroup = 0; group + ngroup < argv + argc && strcmp(group[ngroup], "--") != 0; ngroup ++);
+    }
     return 0;
-}
\ No newline at end of file
+}
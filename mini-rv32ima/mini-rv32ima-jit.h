@@ -0,0 +1,312 @@
+// Lightweight x86-64 JIT for mini-rv32ima (build with -DRV32IMA_JIT).
+//
+// Hot threaded-code blocks (see RV32IMA_THREADED in mini-rv32ima.h) are
+// compiled to native code once they have been entered
+// RV32IMA_JIT_THRESHOLD times. The generated function follows the SysV
+// calling convention:
+//
+//     uint64_t native(uint32_t *regs, uint8_t *mem, const uint8_t *pages);
+//
+// Guest registers stay in memory at a pinned base (rdi = state->regs), each
+// instruction loads its operands into eax/ecx, computes, and stores rd back
+// (x0 is never written, so loads of it read 0). rsi is the host address of
+// guest offset 0 and r8 the decode cache page flags.
+//
+// The native code covers exactly the ops a block may contain. Whatever it
+// cannot do on its own (MMIO or faulting accesses, stores into pages with
+// cached code) makes it return to rv32ima_run(), which lets the switch
+// interpreter take it from there. Return value:
+//
+//     bits  0..31  next guest PC
+//     bits 32..39  instructions retired (JIT_EXIT_BAIL, JIT_EXIT_STORE)
+//     bits 40..47  enum rv32ima_jit_exit
+//
+// Whole blocks retire through the same path as interpreted ones, so
+// CYCLEL/CYCLEH, the timer and the batch budget stay exact.
+
+#if !defined(__x86_64__)
+#error "RV32IMA_JIT needs an x86-64 host"
+#endif
+
+enum rv32ima_jit_exit {
+    JIT_EXIT_FALL,     // Whole block, left through the fall-through exit
+    JIT_EXIT_TAKEN,    // Whole block, left through a taken branch/JAL
+    JIT_EXIT_INDIRECT, // Whole block, left through JALR
+    JIT_EXIT_BAIL,     // Stopped in front of an op for the interpreter
+    JIT_EXIT_STORE,    // Stopped right after a store into cached code
+};
+
+// Longest code emitted by jit_return(), jit_address() and jit_check_code(),
+// and for one guest op: SH, which checks both of its bytes for cached code
+// (SW only needs 112 bytes, loads 39, everything else less).
+#define JIT_RETURN_BYTES     11
+#define JIT_ADDRESS_BYTES    (20 + JIT_RETURN_BYTES)
+#define JIT_CHECK_CODE_BYTES (27 + JIT_RETURN_BYTES)
+#define JIT_MAX_OP_BYTES     (JIT_ADDRESS_BYTES + 3 + 4 + 2 * JIT_CHECK_CODE_BYTES)
+
+#define E1(b) (*p++ = (uint8_t)(b))
+#define E4(v) do { uint32_t v_ = (v); memcpy(p, &v_, 4); p += 4; } while (0)
+#define E8(v) do { uint64_t v_ = (v); memcpy(p, &v_, 8); p += 8; } while (0)
+
+// Host registers used by the generated code.
+enum { JIT_EAX = 0, JIT_ECX = 1, JIT_EDX = 2 };
+
+#define JIT_RESULT(why, k, pc) (((uint64_t)(why) << 40) | ((uint64_t)(k) << 32) | (uint32_t)(pc))
+
+static inline uint8_t *jit_load_reg(uint8_t *p, int host, int r) {
+    E1(0x8B); E1(0x47 | host << 3); E1(r * 4);       // mov host, [rdi + 4 * r]
+    return p;
+}
+
+static inline uint8_t *jit_store_reg(uint8_t *p, int r, int host) {
+    E1(0x89); E1(0x47 | host << 3); E1(r * 4);       // mov [rdi + 4 * r], host
+    return p;
+}
+
+static inline uint8_t *jit_store_imm(uint8_t *p, int r, uint32_t imm) {
+    E1(0xC7); E1(0x47); E1(r * 4); E4(imm);          // mov dword [rdi + 4 * r], imm
+    return p;
+}
+
+static inline uint8_t *jit_return(uint8_t *p, uint64_t result) {
+    E1(0x48); E1(0xB8); E8(result);                  // movabs rax, result
+    E1(0xC3);                                        // ret
+    return p;
+}
+
+// eax = guest address (rs1 + imm) - mem_offset; returns (bails) in front of
+// op k unless the width-wide access is plain RAM, with the same range check
+// as rv32ima_run() (RV32IMA_IN_RAM).
+static inline uint8_t *jit_address(uint8_t *p, struct CPUState *state, const struct rv32ima_top *op, uint32_t width, uint32_t k, uint32_t pc) {
+    p = jit_load_reg(p, JIT_EAX, op->rs1);
+    E1(0x05); E4(op->imm);                           // add eax, imm
+    E1(0x2D); E4(state->mem_offset);                 // sub eax, mem_offset
+    E1(0x3D); E4(state->mem_size - width + 1);       // cmp eax, mem_size - width + 1
+    E1(0x72); E1(11);                                // jb ok
+    p = jit_return(p, JIT_RESULT(JIT_EXIT_BAIL, k, pc));
+    return p;                                        // ok:
+}
+
+// After a store at eax (+ width - 1): leave if it hit a page with cached
+// code, so that rv32ima_run() can invalidate it.
+static inline uint8_t *jit_check_code(uint8_t *p, struct rv32ima_icache *ic, int last, uint32_t k, uint32_t pc) {
+    if (last) {
+        E1(0x8D); E1(0x50); E1(last);                // lea edx, [rax + last]
+    } else {
+        E1(0x89); E1(0xC2);                          // mov edx, eax
+    }
+    E1(0x81); E1(0xEA); E4(ic->base);                // sub edx, base
+    E1(0x81); E1(0xFA); E4(ic->size);                // cmp edx, size
+    E1(0x73); E1(21);                                // jae skip
+    E1(0xC1); E1(0xEA); E1(RV32IMA_PAGE_SHIFT);      // shr edx, PAGE_SHIFT
+    E1(0x41); E1(0x80); E1(0x3C); E1(0x10); E1(0);   // cmp byte [r8 + rdx], 0
+    E1(0x74); E1(11);                                // je skip
+    p = jit_return(p, JIT_RESULT(JIT_EXIT_STORE, k + 1, pc + 4));
+    return p;                                        // skip:
+}
+
+// Compiles blk into the executable buffer. Returns 0 (blk stays
+// interpreted) if the buffer is missing or full.
+static int rv32ima_jit_compile(struct CPUState *state, struct rv32ima_block *blk) {
+    struct rv32ima_icache *ic = state->icache;
+    uint32_t need = (blk->len + 2) * JIT_MAX_OP_BYTES;
+
+    if (!ic->jit || ic->jit_used + need > RV32IMA_JIT_SIZE)
+        return 0;
+
+    uint8_t *start = ic->jit + ic->jit_used;
+    uint8_t *p = start;
+
+    E1(0x49); E1(0x89); E1(0xD0);                    // mov r8, rdx
+
+    for (uint32_t k = 0; ; k++) {
+        const struct rv32ima_top *op = &blk->ops[k];
+        uint32_t pc = blk->pc + k * 4;
+
+        switch (op->op) {
+        case OP_LUI:
+            p = jit_store_imm(p, op->rd, op->imm);
+            continue;
+        case OP_FENCE:
+            continue;
+
+        case OP_ADDI: case OP_SLTI: case OP_SLTIU: case OP_XORI: case OP_ORI: case OP_ANDI:
+        case OP_SLLI: case OP_SRLI: case OP_SRAI:
+        case OP_ADD: case OP_SUB: case OP_SLL: case OP_SLT: case OP_SLTU: case OP_XOR:
+        case OP_SRL: case OP_SRA: case OP_OR: case OP_AND:
+        case OP_MUL: case OP_MULH: case OP_MULHSU: case OP_MULHU:
+        case OP_DIV: case OP_DIVU: case OP_REM: case OP_REMU:
+            p = jit_load_reg(p, JIT_EAX, op->rs1);
+            if (op->op <= OP_SRAI) {
+                E1(0xB9); E4(op->imm);               // mov ecx, imm
+            } else {
+                p = jit_load_reg(p, JIT_ECX, op->rs2);
+            }
+            switch (op->op) {
+            case OP_ADDI: case OP_ADD: E1(0x01); E1(0xC8); break; // add eax, ecx
+            case OP_SUB: E1(0x29); E1(0xC8); break;               // sub eax, ecx
+            case OP_XORI: case OP_XOR: E1(0x31); E1(0xC8); break; // xor eax, ecx
+            case OP_ORI: case OP_OR: E1(0x09); E1(0xC8); break;   // or eax, ecx
+            case OP_ANDI: case OP_AND: E1(0x21); E1(0xC8); break; // and eax, ecx
+            case OP_SLLI: case OP_SLL: E1(0xD3); E1(0xE0); break; // shl eax, cl
+            case OP_SRLI: case OP_SRL: E1(0xD3); E1(0xE8); break; // shr eax, cl
+            case OP_SRAI: case OP_SRA: E1(0xD3); E1(0xF8); break; // sar eax, cl
+            case OP_SLTI: case OP_SLT: case OP_SLTIU: case OP_SLTU:
+                E1(0x39); E1(0xC8);                               // cmp eax, ecx
+                E1(0x0F); E1((op->op == OP_SLTI || op->op == OP_SLT) ? 0x9C : 0x92); E1(0xC0); // setl/setb al
+                E1(0x0F); E1(0xB6); E1(0xC0);                     // movzx eax, al
+                break;
+            case OP_MUL: E1(0x0F); E1(0xAF); E1(0xC1); break;     // imul eax, ecx
+            case OP_MULH:
+                E1(0x48); E1(0x63); E1(0xC0);                     // movsxd rax, eax
+                E1(0x48); E1(0x63); E1(0xC9);                     // movsxd rcx, ecx
+                E1(0x48); E1(0x0F); E1(0xAF); E1(0xC1);           // imul rax, rcx
+                E1(0x48); E1(0xC1); E1(0xF8); E1(32);             // sar rax, 32
+                break;
+            case OP_MULHSU:
+                E1(0x48); E1(0x63); E1(0xC0);                     // movsxd rax, eax
+                E1(0x48); E1(0x0F); E1(0xAF); E1(0xC1);           // imul rax, rcx
+                E1(0x48); E1(0xC1); E1(0xE8); E1(32);             // shr rax, 32
+                break;
+            case OP_MULHU:
+                E1(0x48); E1(0x0F); E1(0xAF); E1(0xC1);           // imul rax, rcx
+                E1(0x48); E1(0xC1); E1(0xE8); E1(32);             // shr rax, 32
+                break;
+            case OP_DIV: {
+                static const uint8_t code[] = {
+                    0x85, 0xC9,                   // test ecx, ecx
+                    0x75, 0x07,                   // jnz 1f
+                    0xB8, 0xFF, 0xFF, 0xFF, 0xFF, // mov eax, -1
+                    0xEB, 0x0F,                   // jmp 3f
+                    0x83, 0xF9, 0xFF,             // 1: cmp ecx, -1
+                    0x75, 0x07,                   // jne 2f
+                    0x3D, 0x00, 0x00, 0x00, 0x80, // cmp eax, INT32_MIN
+                    0x74, 0x03,                   // je 3f (result: rs1)
+                    0x99,                         // 2: cdq
+                    0xF7, 0xF9,                   // idiv ecx
+                };                                // 3:
+                memcpy(p, code, sizeof(code));
+                p += sizeof(code);
+                break;
+            }
+            case OP_REM: {
+                static const uint8_t code[] = {
+                    0x85, 0xC9,                   // test ecx, ecx
+                    0x74, 0x15,                   // jz 3f (result: rs1)
+                    0x83, 0xF9, 0xFF,             // cmp ecx, -1
+                    0x75, 0x0B,                   // jne 2f
+                    0x3D, 0x00, 0x00, 0x00, 0x80, // cmp eax, INT32_MIN
+                    0x75, 0x04,                   // jne 2f
+                    0x31, 0xC0,                   // xor eax, eax
+                    0xEB, 0x05,                   // jmp 3f
+                    0x99,                         // 2: cdq
+                    0xF7, 0xF9,                   // idiv ecx
+                    0x89, 0xD0,                   // mov eax, edx
+                };                                // 3:
+                memcpy(p, code, sizeof(code));
+                p += sizeof(code);
+                break;
+            }
+            case OP_DIVU: {
+                static const uint8_t code[] = {
+                    0x85, 0xC9,                   // test ecx, ecx
+                    0x75, 0x07,                   // jnz 1f
+                    0xB8, 0xFF, 0xFF, 0xFF, 0xFF, // mov eax, -1
+                    0xEB, 0x04,                   // jmp 2f
+                    0x31, 0xD2,                   // 1: xor edx, edx
+                    0xF7, 0xF1,                   // div ecx
+                };                                // 2:
+                memcpy(p, code, sizeof(code));
+                p += sizeof(code);
+                break;
+            }
+            case OP_REMU: {
+                static const uint8_t code[] = {
+                    0x85, 0xC9,                   // test ecx, ecx
+                    0x74, 0x06,                   // jz 1f (result: rs1)
+                    0x31, 0xD2,                   // xor edx, edx
+                    0xF7, 0xF1,                   // div ecx
+                    0x89, 0xD0,                   // mov eax, edx
+                };                                // 1:
+                memcpy(p, code, sizeof(code));
+                p += sizeof(code);
+                break;
+            }
+            }
+            p = jit_store_reg(p, op->rd, JIT_EAX);
+            continue;
+
+        case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU:
+            p = jit_address(p, state, op, op->op == OP_LW ? 4 : (op->op == OP_LH || op->op == OP_LHU) ? 2 : 1, k, pc);
+            switch (op->op) {
+            case OP_LB: E1(0x0F); E1(0xBE); break;        // movsx eax, byte [rsi + rax]
+            case OP_LH: E1(0x0F); E1(0xBF); break;        // movsx eax, word [rsi + rax]
+            case OP_LW: E1(0x8B); break;                  // mov eax, [rsi + rax]
+            case OP_LBU: E1(0x0F); E1(0xB6); break;       // movzx eax, byte [rsi + rax]
+            case OP_LHU: E1(0x0F); E1(0xB7); break;       // movzx eax, word [rsi + rax]
+            }
+            E1(0x04); E1(0x06);
+            if (op->rd)
+                p = jit_store_reg(p, op->rd, JIT_EAX);
+            continue;
+
+        case OP_SB: case OP_SH: case OP_SW:
+            p = jit_address(p, state, op, op->op == OP_SW ? 4 : op->op == OP_SH ? 2 : 1, k, pc);
+            p = jit_load_reg(p, JIT_ECX, op->rs2);
+            switch (op->op) {
+            case OP_SB: E1(0x88); break;                  // mov [rsi + rax], cl
+            case OP_SH: E1(0x66); E1(0x89); break;        // mov [rsi + rax], cx
+            case OP_SW: E1(0x89); break;                  // mov [rsi + rax], ecx
+            }
+            E1(0x0C); E1(0x06);
+            p = jit_check_code(p, ic, 0, k, pc);
+            if (op->op != OP_SB)
+                p = jit_check_code(p, ic, op->op == OP_SH ? 1 : 3, k, pc);
+            continue;
+
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BGE: case OP_BLTU: case OP_BGEU: {
+            static const uint8_t jcc[] = {
+                [OP_BEQ - OP_BEQ] = 0x74, [OP_BNE - OP_BEQ] = 0x75,  // je, jne
+                [OP_BLT - OP_BEQ] = 0x7C, [OP_BGE - OP_BEQ] = 0x7D,  // jl, jge
+                [OP_BLTU - OP_BEQ] = 0x72, [OP_BGEU - OP_BEQ] = 0x73, // jb, jae
+            };
+            p = jit_load_reg(p, JIT_EAX, op->rs1);
+            E1(0x3B); E1(0x47); E1(op->rs2 * 4);          // cmp eax, [rdi + 4 * rs2]
+            E1(jcc[op->op - OP_BEQ]); E1(11);             // jcc taken
+            p = jit_return(p, JIT_RESULT(JIT_EXIT_FALL, 0, blk->end));
+            p = jit_return(p, JIT_RESULT(JIT_EXIT_TAKEN, 0, op->imm)); // taken:
+            break;
+        }
+        case OP_JAL:
+            if (op->rd)
+                p = jit_store_imm(p, op->rd, blk->end);
+            p = jit_return(p, JIT_RESULT(JIT_EXIT_TAKEN, 0, op->imm));
+            break;
+        case OP_JALR:
+            p = jit_load_reg(p, JIT_EAX, op->rs1);
+            E1(0x05); E4(op->imm);                        // add eax, imm
+            E1(0x83); E1(0xE0); E1(0xFE);                 // and eax, ~1
+            if (op->rd)
+                p = jit_store_imm(p, op->rd, blk->end);
+            E1(0x48); E1(0xB9); E8(JIT_RESULT(JIT_EXIT_INDIRECT, 0, 0)); // movabs rcx, result
+            E1(0x48); E1(0x09); E1(0xC8);                 // or rax, rcx
+            E1(0xC3);                                     // ret
+            break;
+        case OP_EXIT:
+            p = jit_return(p, JIT_RESULT(JIT_EXIT_FALL, 0, blk->end));
+            break;
+        default: // Not a block op: can't happen, but stay safe
+            p = jit_return(p, JIT_RESULT(JIT_EXIT_BAIL, k, pc));
+            break;
+        }
+        break;
+    }
+
+    ic->jit_used = ((p - ic->jit) + 15) & ~15u;
+    blk->native = (rv32ima_native_fn)start;
+    return 1;
+}
+
+#undef E1
+#undef E4
+#undef E8
@@ -0,0 +1,113 @@
+// Snapshot and restore of a mini-rv32ima guest (CPUState + RAM).
+//
+// rv32ima_snapshot_take() saves the registers/CSRs and a copy of RAM, then
+// write-protects RAM. The first store to each page after that takes a
+// SIGSEGV, which marks the page dirty and unprotects it. Every engine
+// (switch, threaded, JIT) writes RAM directly, so this catches all of them
+// without touching the core. rv32ima_snapshot_restore() then only has to
+// copy back the dirty pages, so a restore costs as much as the working set
+// of the last run, not the size of RAM.
+//
+// Only one snapshot can be armed at a time (it owns the SIGSEGV handler).
+// RAM must be page aligned, e.g. mmap()ed as in main.c.
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define RV32IMA_SNAP_PAGE 4096
+
+struct rv32ima_snapshot {
+    struct CPUState state; // Registers and CSRs at snapshot time
+    uint8_t *mem;          // Guest RAM it was taken from
+    uint32_t size;
+    uint8_t *copy;         // RAM contents at snapshot time
+    uint8_t *dirty;        // One byte per page: stored to since then
+    uint32_t ndirty;
+    uint32_t *list;        // The dirty pages, in fault order
+};
+
+static struct rv32ima_snapshot *rv32ima_snap_armed;
+
+static void rv32ima_snap_fault(int sig, siginfo_t *si, void *uc) {
+    struct rv32ima_snapshot *s = rv32ima_snap_armed;
+    uint8_t *addr = si->si_addr;
+    (void)uc;
+
+    if (s && addr >= s->mem && addr < s->mem + s->size) {
+        uint32_t page = (addr - s->mem) / RV32IMA_SNAP_PAGE;
+        if (!s->dirty[page] &&
+            mprotect(s->mem + (size_t)page * RV32IMA_SNAP_PAGE, RV32IMA_SNAP_PAGE, PROT_READ | PROT_WRITE) == 0) {
+            s->dirty[page] = 1;
+            s->list[s->ndirty++] = page;
+            return; // Retry the store
+        }
+    }
+    // A real crash: let it happen with the default action.
+    signal(sig, SIG_DFL);
+}
+
+static inline void rv32ima_snapshot_free(struct rv32ima_snapshot *s) {
+    if (rv32ima_snap_armed == s) {
+        mprotect(s->mem, s->size, PROT_READ | PROT_WRITE);
+        rv32ima_snap_armed = NULL;
+    }
+    if (s->copy)
+        munmap(s->copy, s->size);
+    free(s->dirty);
+    free(s->list);
+    memset(s, 0, sizeof(*s));
+}
+
+// Snapshots state and its RAM. Pages that read as all zero are skipped, so
+// the copy stays as sparse as RAM itself. Returns 0 on success.
+static inline int rv32ima_snapshot_take(struct rv32ima_snapshot *s, const struct CPUState *state) {
+    static const uint8_t zero[RV32IMA_SNAP_PAGE];
+    uint32_t npages = (state->mem_size + RV32IMA_SNAP_PAGE - 1) / RV32IMA_SNAP_PAGE;
+
+    memset(s, 0, sizeof(*s));
+    s->state = *state;
+    s->mem = state->mem;
+    s->size = npages * RV32IMA_SNAP_PAGE;
+    s->copy = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    s->dirty = calloc(npages, 1);
+    s->list = malloc(npages * sizeof(uint32_t));
+    if (s->copy == MAP_FAILED || !s->dirty || !s->list) {
+        if (s->copy == MAP_FAILED)
+            s->copy = NULL;
+        rv32ima_snapshot_free(s);
+        return -1;
+    }
+    for (uint32_t ofs = 0; ofs < s->size; ofs += RV32IMA_SNAP_PAGE)
+        if (memcmp(s->mem + ofs, zero, RV32IMA_SNAP_PAGE) != 0)
+            memcpy(s->copy + ofs, s->mem + ofs, RV32IMA_SNAP_PAGE);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = rv32ima_snap_fault;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGSEGV, &sa, NULL) != 0 || mprotect(s->mem, s->size, PROT_READ) != 0) {
+        rv32ima_snapshot_free(s);
+        return -1;
+    }
+    rv32ima_snap_armed = s;
+    return 0;
+}
+
+// Puts state and RAM back to the snapshot, copying only the dirty pages
+// (and dropping any cached code on them).
+static inline void rv32ima_snapshot_restore(struct rv32ima_snapshot *s, struct CPUState *state) {
+    for (uint32_t i = 0; i < s->ndirty; i++) {
+        uint32_t page = s->list[i];
+        size_t ofs = (size_t)page * RV32IMA_SNAP_PAGE;
+
+        memcpy(s->mem + ofs, s->copy + ofs, RV32IMA_SNAP_PAGE);
+        mprotect(s->mem + ofs, RV32IMA_SNAP_PAGE, PROT_READ);
+        s->dirty[page] = 0;
+        if (s->state.icache)
+            rv32ima_icache_store(s->state.icache, ofs);
+    }
+    s->ndirty = 0;
+    *state = s->state;
+}
@@ -0,0 +1,56 @@
+// Binary instruction trace of mini-rv32ima (main.c -T), and its file format.
+//
+// The trace file is a header followed by a ring of fixed-size records, one
+// per executed instruction, written through a shared mmap() (no stdio, no
+// formatting on the hot path). Once the ring is full the oldest records are
+// overwritten; the header keeps the register file as it was right before
+// the oldest record still in the ring, so a decoder (tracedump.c) can
+// replay the ring into full register dumps in the DumpState() format.
+
+#include <stdint.h>
+
+#define RV32IMA_TRACE_MAGIC   0x52545652 // "RVTR"
+#define RV32IMA_TRACE_VERSION 1
+
+#define RV32IMA_TRACE_RD  1 // rd (nonzero) gets rd_value
+#define RV32IMA_TRACE_MEM 2 // mem_addr is the load/store/AMO address
+
+struct rv32ima_trace_record {
+    uint32_t pc, ir;
+    uint32_t rd_value;       // regs[rd] after the instruction
+    uint32_t mem_addr;
+    uint32_t cyclel, cycleh; // CYCLEL/CYCLEH after the instruction
+    uint32_t extraflags;
+    uint8_t rd, flags;
+    uint16_t reserved;
+};
+
+struct rv32ima_trace_header {
+    uint32_t magic, version;
+    uint32_t record_size, capacity; // Records in the ring
+    uint64_t count;                 // Records written so far (ring: count % capacity)
+    uint32_t regs[32];              // Registers before the oldest record kept
+    struct rv32ima_trace_record ring[];
+};
+
+// Byte size of a trace file with capacity records.
+static inline uint64_t rv32ima_trace_size(uint32_t capacity) {
+    return sizeof(struct rv32ima_trace_header) + (uint64_t)capacity * sizeof(struct rv32ima_trace_record);
+}
+
+// Applies a record to a register file.
+static inline void rv32ima_trace_apply(uint32_t *regs, const struct rv32ima_trace_record *r) {
+    if ((r->flags & RV32IMA_TRACE_RD) && r->rd)
+        regs[r->rd] = r->rd_value;
+}
+
+// Appends r to the ring, first folding the record it replaces into the
+// header registers.
+static inline void rv32ima_trace_append(struct rv32ima_trace_header *t, const struct rv32ima_trace_record *r) {
+    struct rv32ima_trace_record *slot = &t->ring[t->count % t->capacity];
+
+    if (t->count >= t->capacity)
+        rv32ima_trace_apply(t->regs, slot);
+    *slot = *r;
+    t->count++;
+}
@@ -0,0 +1,162 @@
+// 8250 UART console of mini-rv32ima, at 0x10000000 (CPUState.uart).
+//
+// The registers are the usual 8250 ones, one byte apart. There is no line
+// to raise interrupts on, so a guest polls LSR like the NS16550 drivers of
+// OpenSBI, Linux's earlycon and the bare-metal examples do.
+//
+// THR writes go into a host-side buffer, written out (in one fwrite) on
+// newline, when it is full, when the guest waits for input and at the end
+// of the run (rv32ima_uart_flush()), so printing a byte costs no syscall.
+// Input is read ahead without blocking: RBR/LSR only look at the host fd
+// every RV32IMA_UART_POLL reads with nothing buffered, which keeps a guest
+// spinning on LSR (for THRE or for input) from turning into a poll() per
+// load.
+//
+// Harts share the device; a spinlock keeps their bytes in order.
+
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define RV32IMA_UART_BASE 0x10000000
+#define RV32IMA_UART_SIZE 8
+#define RV32IMA_UART_BUF  4096
+#define RV32IMA_UART_POLL 256
+
+// Registers (offsets from RV32IMA_UART_BASE)
+#define UART_RBR 0 // Read: received byte (THR on write, DLL with DLAB)
+#define UART_IER 1 // (DLM with DLAB)
+#define UART_IIR 2 // Read: interrupt id (FCR on write)
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_MSR 6
+#define UART_SCR 7
+
+#define UART_LCR_DLAB 0x80
+#define UART_LSR_DR   0x01 // Data ready
+#define UART_LSR_THRE 0x20 // Transmit holding register empty
+#define UART_LSR_TEMT 0x40 // Transmitter empty
+
+struct rv32ima_uart {
+    FILE *out;  // Guest output
+    int in_fd;  // Guest input (-1: none, or at EOF)
+    uint32_t lock;
+
+    // Registers the guest can write and read back
+    uint8_t ier, lcr, mcr, scr, dll, dlm;
+
+    uint32_t out_len;
+    uint32_t polls;   // RBR/LSR reads since the last look at in_fd
+    uint8_t wrote;    // Output since then
+    uint32_t in_pos, in_len;
+    uint8_t in[256];
+    char buf[RV32IMA_UART_BUF];
+};
+
+static inline void rv32ima_uart_lock(struct rv32ima_uart *u) {
+    while (__atomic_exchange_n(&u->lock, 1, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static inline void rv32ima_uart_unlock(struct rv32ima_uart *u) {
+    __atomic_store_n(&u->lock, 0, __ATOMIC_RELEASE);
+}
+
+static void rv32ima_uart_write_out(struct rv32ima_uart *u) {
+    if (u->out_len) {
+        fwrite(u->buf, 1, u->out_len, u->out);
+        fflush(u->out);
+        u->out_len = 0;
+    }
+}
+
+// Looks for input on in_fd (every RV32IMA_UART_POLL calls). A guest that
+// polls without printing anything in between is waiting, so its prompt
+// goes out first.
+static void rv32ima_uart_poll(struct rv32ima_uart *u) {
+    if (++u->polls < RV32IMA_UART_POLL)
+        return;
+    u->polls = 0;
+    if (!u->wrote)
+        rv32ima_uart_write_out(u);
+    u->wrote = 0;
+    if (u->in_fd < 0)
+        return;
+    struct pollfd pfd = {u->in_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0)
+        return;
+    ssize_t n = (pfd.revents & POLLNVAL) ? 0 : read(u->in_fd, u->in, sizeof(u->in));
+    if (n > 0) {
+        u->in_pos = 0;
+        u->in_len = n;
+    } else if (n == 0 || (pfd.revents & (POLLHUP | POLLNVAL))) {
+        u->in_fd = -1;
+    }
+}
+
+// Guest load of register reg.
+static uint32_t rv32ima_uart_load(struct rv32ima_uart *u, uint32_t reg) {
+    uint32_t val = 0;
+    rv32ima_uart_lock(u);
+    switch (reg) {
+    case UART_RBR:
+        if (u->lcr & UART_LCR_DLAB) {
+            val = u->dll;
+            break;
+        }
+        if (u->in_pos == u->in_len)
+            rv32ima_uart_poll(u);
+        if (u->in_pos < u->in_len)
+            val = u->in[u->in_pos++];
+        break;
+    case UART_IER: val = (u->lcr & UART_LCR_DLAB) ? u->dlm : u->ier; break;
+    case UART_IIR: val = 0x01; break; // No interrupt pending
+    case UART_LCR: val = u->lcr; break;
+    case UART_MCR: val = u->mcr; break;
+    case UART_LSR:
+        if (u->in_pos == u->in_len)
+            rv32ima_uart_poll(u);
+        val = UART_LSR_THRE | UART_LSR_TEMT | (u->in_pos < u->in_len ? UART_LSR_DR : 0);
+        break;
+    case UART_MSR: val = 0xb0; break; // DCD, DSR and CTS
+    case UART_SCR: val = u->scr; break;
+    }
+    rv32ima_uart_unlock(u);
+    return val;
+}
+
+// Guest store of (the low byte of) val to register reg.
+static void rv32ima_uart_store(struct rv32ima_uart *u, uint32_t reg, uint32_t val) {
+    uint8_t c = val;
+    rv32ima_uart_lock(u);
+    switch (reg) {
+    case UART_RBR:
+        if (u->lcr & UART_LCR_DLAB) {
+            u->dll = c;
+            break;
+        }
+        u->buf[u->out_len++] = c;
+        u->wrote = 1;
+        if (c == '\n' || u->out_len == RV32IMA_UART_BUF)
+            rv32ima_uart_write_out(u);
+        break;
+    case UART_IER:
+        if (u->lcr & UART_LCR_DLAB) u->dlm = c;
+        else u->ier = c & 0x0f;
+        break;
+    case UART_LCR: u->lcr = c; break;
+    case UART_MCR: u->mcr = c & 0x1f; break;
+    case UART_SCR: u->scr = c; break;
+    }
+    rv32ima_uart_unlock(u);
+}
+
+// Writes out whatever the guest printed since the last newline.
+static inline void rv32ima_uart_flush(struct rv32ima_uart *u) {
+    if (u) {
+        rv32ima_uart_lock(u);
+        rv32ima_uart_write_out(u);
+        rv32ima_uart_unlock(u);
+    }
+}
@@ -10,6 +10,11 @@
 // See: The RISC-V Reader (http://www.riscvbook.com/)
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef RV32IMA_JIT
+#include <sys/mman.h>
+#endif
 
 enum RV32IMA_REG {
     Z,  // x0: Zero Register.
@@ -72,6 +77,117 @@ enum RV32IMA_CSR {
                  // (Comments above are generated by GPT)
 };
 
+// Decoded instructions
+// rv32ima_step() used to re-extract opcode, register numbers and immediates
+// from the raw instruction word on every step. Instead, an instruction is
+// decoded once into a struct rv32ima_insn: a fine-grained operation plus its
+// pre-extracted operands. The decoded form is then executed by a single flat
+// switch (see rv32ima_step()).
+enum RV32IMA_OP {
+    OP_UNDECODED, // Empty decode cache slot (must be zero)
+    OP_ILLEGAL,   // Anything we don't understand: illegal instruction trap
+    OP_LUI, OP_AUIPC, OP_JAL, OP_JALR,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+    OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU,
+    OP_LOAD_BAD,  // Load with invalid funct3 (MMIO window is still decoded)
+    OP_SB, OP_SH, OP_SW,
+    OP_STORE_BAD, // Store with invalid funct3 (MMIO window is still decoded)
+    OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI, OP_ORI, OP_ANDI,
+    OP_SLLI, OP_SRLI, OP_SRAI,
+    OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA,
+    OP_OR, OP_AND,
+    OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU,
+    OP_FENCE, OP_FENCE_I,
+    OP_CSR,       // Zicsr: imm = CSR number, rs2 = funct3 (microop)
+    OP_WFI, OP_MRET, OP_ECALL, OP_EBREAK,
+    OP_LR, OP_SC,
+    OP_AMOSWAP, OP_AMOADD, OP_AMOXOR, OP_AMOAND, OP_AMOOR,
+    OP_AMOMIN, OP_AMOMAX, OP_AMOMINU, OP_AMOMAXU,
+    OP_AMO_BAD,   // RV32A with unsupported funct5 (still access-checked)
+
+    OP_EXIT,      // Threaded code only: fall through to the next block
+
+    OP_COUNT,
+};
+
+struct rv32ima_insn {
+    uint8_t op;          // enum RV32IMA_OP
+    uint8_t rd, rs1, rs2;
+    uint32_t imm;        // Sign-extended immediate (or CSR number)
+};
+
+// Decode cache
+// A direct-mapped table with one decoded slot per instruction word in the
+// guest text range [base, base + size) (offsets into mem). Slots are filled
+// on first execution. A store into a page that holds decoded slots wipes
+// that page, and FENCE.I wipes everything, so self-modifying code behaves
+// exactly as it does without the cache.
+#define RV32IMA_PAGE_SHIFT 12
+
+#define RV32IMA_PAGE_DECODED 1 // Page holds decoded slots
+#define RV32IMA_PAGE_CODE    2 // Page holds translated block code
+#define RV32IMA_PAGE_ENTRY   4 // Page holds block entry points
+
+#ifdef RV32IMA_JIT
+#define RV32IMA_THREADED // The JIT compiles hot threaded-code blocks
+#ifndef RV32IMA_JIT_THRESHOLD
+#define RV32IMA_JIT_THRESHOLD 256      // Block entries before compiling
+#endif
+#define RV32IMA_JIT_SIZE      (16 << 20) // Native code; flushed with blocks
+#endif
+
+#ifdef RV32IMA_THREADED
+// Threaded code
+// Built with -DRV32IMA_THREADED, rv32ima_run() translates straight-line
+// guest code (ALU ops, loads and stores) up to and including a branch or
+// jump into a block: an array of handler addresses plus pre-extracted
+// operands, dispatched with computed goto. Blocks remember the block at
+// their taken/fall-through exits, so hot loops jump from block to block
+// without a lookup. Everything else (CSRs, system instructions, AMOs,
+// MMIO and faulting accesses) goes through the switch interpreter, which
+// keeps the two engines architecturally identical.
+#define RV32IMA_BLOCK_MAX   64         // Instructions per block
+#define RV32IMA_ARENA_SIZE  (16 << 20) // Translated code; flushed when full
+#define RV32IMA_NOBLOCK     ((struct rv32ima_block *)1) // Untranslatable PC
+
+struct rv32ima_top {
+    const void *handler; // Label in rv32ima_run()
+    uint8_t op;          // enum RV32IMA_OP
+    uint8_t rd, rs1, rs2;
+    uint32_t imm;        // Immediate, or absolute target for branches
+};
+
+// Native code for a block: runs it against regs and mem and returns the
+// exit (see mini-rv32ima-jit.h).
+typedef uint64_t (*rv32ima_native_fn)(uint32_t *regs, uint8_t *mem, const uint8_t *pages);
+
+struct rv32ima_block {
+    uint32_t pc, end, len;           // Guest range [pc, end), len insns
+    struct rv32ima_block *next[2];   // Chained fall-through/taken successors
+#ifdef RV32IMA_JIT
+    uint32_t hits;                   // Entries so far (JIT profile)
+    rv32ima_native_fn native;        // Compiled code, once hot
+#endif
+    struct rv32ima_top ops[];        // len ops (+ exit op on fall-through)
+};
+#endif
+
+struct rv32ima_icache {
+    uint32_t base, size;         // Covered range (offsets into mem)
+    struct rv32ima_insn *insns;  // size / 4 slots
+    uint8_t *pages;              // Per page: RV32IMA_PAGE_* flags
+#ifdef RV32IMA_THREADED
+    struct rv32ima_block **blocks; // Block entered at each slot
+    uint8_t *arena;
+    uint32_t arena_used;
+    uint32_t generation;           // Bumped on every block flush
+#endif
+#ifdef RV32IMA_JIT
+    uint8_t *jit;                  // Executable buffer for native blocks
+    uint32_t jit_used;
+#endif
+};
+
 struct CPUState {
     // Processor internal state
     uint32_t regs[32], csrs[CSR_COUNT];
@@ -79,249 +195,875 @@ struct CPUState {
     // Memory state
     uint8_t *mem;
     uint32_t mem_offset, mem_size;
-};
 
-static inline int32_t rv32ima_step(struct CPUState *state, uint32_t elapsedUs) {
-    #define CSR(x) (state->csrs[x])
-    #define REG(x) (state->regs[x])
-    #define MEM(x) (&state->mem[x])
+    // Optional decode cache (NULL: decode every instruction)
+    struct rv32ima_icache *icache;
+
+    // Optional stop address: rv32ima_run() ends its batch as soon as the
+    // PC lands on halt_pc (main.c: the guest's main() returns to 0).
+    uint32_t halt_pc;
+    uint8_t halt_enabled;
+
+    // SMP: harts sharing mem, each run by its own host thread. harts is
+    // NULL for a single hart. msip is this hart's CLINT software interrupt
+    // bit, which other harts set and clear (atomically).
+    struct CPUState **harts;
+    uint32_t nharts, hartid;
+    uint32_t msip;
+    uint32_t lr_value; // Word seen by the last LR.W (for SC.W on SMP)
+
+    // Optional execution profile (NULL: off): profile[(ofs - profile_base)
+    // / 4] counts the instructions run at RAM offset ofs, for offsets in
+    // [profile_base, profile_base + profile_size); the rest go to
+    // profile_other.
+    uint64_t *profile;
+    uint32_t profile_base, profile_size;
+    uint64_t profile_other;
+
+    // Optional 8250 console at RV32IMA_UART_BASE (NULL: its registers read
+    // 0 and stores to them are dropped); harts share it.
+    struct rv32ima_uart *uart;
+};
 
-    uint32_t new_timer = CSR(TIMERL) + elapsedUs;
-    if (new_timer < CSR(TIMERL)) {
-        CSR(TIMERH)++;
+// Counts n instructions at RAM offsets ofs, ofs + 4, ... in the profile.
+static inline void rv32ima_profile(struct CPUState *state, uint32_t ofs, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++, ofs += 4) {
+        uint32_t idx = ofs - state->profile_base;
+        if (idx < state->profile_size)
+            state->profile[idx >> 2]++;
+        else
+            state->profile_other++;
     }
+}
 
-    CSR(TIMERL) = new_timer;
+// Hart id (CLINT slot) -> its state; a single hart is its own hart 0.
+static inline struct CPUState *rv32ima_hart(struct CPUState *state, uint32_t id) {
+    return state->harts ? state->harts[id] : state;
+}
 
-    // Handle Timer interrupt.
+static inline uint32_t rv32ima_nharts(const struct CPUState *state) {
+    return state->harts ? state->nharts : 1;
+}
 
-    uint64_t timer = ((uint64_t)CSR(TIMERH) << 32) | CSR(TIMERL);
-    uint64_t timermatch = ((uint64_t)CSR(TIMERMATCHH) << 32) | CSR(TIMERMATCHL);
+static inline void rv32ima_icache_free(struct rv32ima_icache *ic) {
+    free(ic->insns);
+    free(ic->pages);
+    ic->insns = NULL;
+    ic->pages = NULL;
+#ifdef RV32IMA_THREADED
+    free(ic->blocks);
+    free(ic->arena);
+    ic->blocks = NULL;
+    ic->arena = NULL;
+#endif
+#ifdef RV32IMA_JIT
+    if (ic->jit)
+        munmap(ic->jit, RV32IMA_JIT_SIZE);
+    ic->jit = NULL;
+#endif
+}
 
-    if ((CSR(TIMERMATCHH) || CSR(TIMERMATCHL)) && (timer > timermatch)) {
-        CSR(EXTRAFLAGS) &= ~4;
-        CSR(MIP) |= 1 << 7;
-    } else {
-        CSR(MIP) &= ~(1 << 7);
+// Allocates the decode cache for [base, base + size), widened to whole
+// pages (an ELF's text segment rarely ends on a page boundary, and pages
+// are what gets wiped and flushed). Slots are calloc()ed, so only the
+// touched part of the table is ever backed by physical memory. Returns 0
+// on success.
+static inline int rv32ima_icache_init(struct rv32ima_icache *ic, uint32_t base, uint32_t size) {
+    uint32_t mask = (1u << RV32IMA_PAGE_SHIFT) - 1;
+    uint32_t end = (base + size + mask) & ~mask;
+    base &= ~mask;
+    size = end - base;
+    memset(ic, 0, sizeof(*ic));
+    ic->base = base;
+    ic->size = size;
+    ic->insns = calloc(size / 4, sizeof(struct rv32ima_insn));
+    ic->pages = calloc((size >> RV32IMA_PAGE_SHIFT) + 1, 1);
+    int ok = ic->insns && ic->pages;
+#ifdef RV32IMA_THREADED
+    ic->blocks = calloc(size / 4, sizeof(struct rv32ima_block *));
+    ic->arena = malloc(RV32IMA_ARENA_SIZE);
+    ok = ok && ic->blocks && ic->arena;
+#endif
+#ifdef RV32IMA_JIT
+    // Without an executable buffer blocks simply stay interpreted.
+    ic->jit = mmap(NULL, RV32IMA_JIT_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ic->jit == MAP_FAILED)
+        ic->jit = NULL;
+#endif
+    if (!ok) {
+        rv32ima_icache_free(ic);
+        return -1;
     }
+    return 0;
+}
 
-    // If WFI (waiting for interrupt), don't run processor.
-    if (CSR(EXTRAFLAGS) & 4)
-        return 1;
+static inline void rv32ima_icache_wipe_page(struct rv32ima_icache *ic, uint32_t page) {
+    memset(&ic->insns[page << (RV32IMA_PAGE_SHIFT - 2)], 0,
+           sizeof(struct rv32ima_insn) << (RV32IMA_PAGE_SHIFT - 2));
+    ic->pages[page] &= ~RV32IMA_PAGE_DECODED;
+}
 
-    uint32_t trap = 0;
-    uint32_t rval = 0;
-    uint32_t pc = CSR(PC);
-    uint32_t cycle = CSR(CYCLEL);
+#ifdef RV32IMA_THREADED
+// Drops all translated blocks. Chains only ever point into the arena, so
+// they go away with it.
+static inline void rv32ima_block_flush(struct rv32ima_icache *ic) {
+    uint32_t npages = ic->size >> RV32IMA_PAGE_SHIFT;
+    for (uint32_t i = 0; i < npages; i++) {
+        if (ic->pages[i] & RV32IMA_PAGE_ENTRY) {
+            memset(&ic->blocks[i << (RV32IMA_PAGE_SHIFT - 2)], 0,
+                   sizeof(struct rv32ima_block *) << (RV32IMA_PAGE_SHIFT - 2));
+        }
+        ic->pages[i] &= ~(RV32IMA_PAGE_CODE | RV32IMA_PAGE_ENTRY);
+    }
+    ic->arena_used = 0;
+    ic->generation++;
+#ifdef RV32IMA_JIT
+    ic->jit_used = 0;
+#endif
+}
+#endif
 
-    // Timer interrupt.
-    if ((CSR(MIP) & (1 << 7)) && (CSR(MIE) & (1 << 7) /*mtie*/) && (CSR(MSTATUS) & 0x8 /*mie*/)) {
-        trap = 0x80000007;
-        pc -= 4;
-        goto cycle_end;
+// Drops every decoded slot and block (FENCE.I).
+static inline void rv32ima_icache_flush(struct rv32ima_icache *ic) {
+    uint32_t npages = ic->size >> RV32IMA_PAGE_SHIFT;
+    for (uint32_t i = 0; i < npages; i++) {
+        if (ic->pages[i] & RV32IMA_PAGE_DECODED)
+            rv32ima_icache_wipe_page(ic, i);
     }
+#ifdef RV32IMA_THREADED
+    rv32ima_block_flush(ic);
+#endif
+}
 
-    // Otherwise, execute a single-step instruction.
-    uint32_t ir = 0;
-    rval = 0;
-    cycle++;
-    uint32_t ofs_pc = pc - state->mem_offset;
-
-    if (ofs_pc >= state->mem_size) {
-        trap = 1 + 1; // Handle access violation on instruction read.
-        goto cycle_end;
-    } else if (ofs_pc & 3) {
-        trap = 1 + 0; // Handle PC-misaligned access
-        goto cycle_end;
-    } else {
-        ir = *(uint32_t *)MEM(ofs_pc);
-        uint32_t rdid = (ir >> 7) & 0x1f;
-
-        switch (ir & 0x7f) {
-        case 0x37: // LUI (0b0110111)
-            rval = (ir & 0xfffff000); break;
-        case 0x17: // AUIPC (0b0010111)
-            rval = pc + (ir & 0xfffff000); break;
-        case 0x6F: { // JAL (0b1101111)
-            int32_t reladdy = ((ir & 0x80000000) >> 11) | ((ir & 0x7fe00000) >> 20) | ((ir & 0x00100000) >> 9) | ((ir & 0x000ff000));
-            if (reladdy & 0x00100000)
-                reladdy |= 0xffe00000; // Sign extension.
-            rval = pc + 4;
-            pc = pc + reladdy - 4;
-            break;
+// Called for every RAM store at offset ofs (covering ofs..ofs+3 at most).
+// Returns nonzero if cached code was thrown away.
+static inline int rv32ima_icache_store(struct rv32ima_icache *ic, uint32_t ofs) {
+    int hit = 0;
+    for (uint32_t end = ofs + 3; ; ofs = end) {
+        uint32_t idx = ofs - ic->base;
+        if (idx < ic->size && ic->pages[idx >> RV32IMA_PAGE_SHIFT]) {
+            uint32_t page = idx >> RV32IMA_PAGE_SHIFT;
+            if (ic->pages[page] & RV32IMA_PAGE_DECODED)
+                rv32ima_icache_wipe_page(ic, page);
+#ifdef RV32IMA_THREADED
+            if (ic->pages[page] & RV32IMA_PAGE_CODE)
+                rv32ima_block_flush(ic);
+#endif
+            hit = 1;
         }
-        case 0x67: { // JALR (0b1100111)
-            uint32_t imm = ir >> 20;
-            int32_t imm_se = imm | ((imm & 0x800) ? 0xfffff000 : 0);
-            rval = pc + 4;
-            pc = ((REG((ir >> 15) & 0x1f) + imm_se) & ~1) - 4;
+        if (ofs == end || ((ofs ^ end) >> RV32IMA_PAGE_SHIFT) == 0)
             break;
+    }
+    return hit;
+}
+
+static inline void rv32ima_decode(uint32_t ir, struct rv32ima_insn *in) {
+    uint32_t rdid = (ir >> 7) & 0x1f;
+    uint32_t funct3 = (ir >> 12) & 0x7;
+    uint32_t imm_i = (uint32_t)((int32_t)ir >> 20);
+    uint32_t op = OP_ILLEGAL;
+    uint32_t imm = 0;
+
+    in->rs1 = (ir >> 15) & 0x1f;
+    in->rs2 = (ir >> 20) & 0x1f;
+
+    switch (ir & 0x7f) {
+    case 0x37: // LUI (0b0110111)
+        op = OP_LUI; imm = ir & 0xfffff000; break;
+    case 0x17: // AUIPC (0b0010111)
+        op = OP_AUIPC; imm = ir & 0xfffff000; break;
+    case 0x6F: { // JAL (0b1101111)
+        int32_t reladdy = ((ir & 0x80000000) >> 11) | ((ir & 0x7fe00000) >> 20) | ((ir & 0x00100000) >> 9) | ((ir & 0x000ff000));
+        if (reladdy & 0x00100000)
+            reladdy |= 0xffe00000; // Sign extension.
+        op = OP_JAL; imm = reladdy;
+        break;
+    }
+    case 0x67: // JALR (0b1100111)
+        op = OP_JALR; imm = imm_i; break;
+    case 0x63: { // Branch (0b1100011)
+        uint32_t immm4 = ((ir & 0xf00) >> 7) | ((ir & 0x7e000000) >> 20) | ((ir & 0x80) << 4) | ((ir >> 31) << 12);
+        if (immm4 & 0x1000)
+            immm4 |= 0xffffe000;
+        static const uint8_t ops[8] = {
+            OP_BEQ, OP_BNE, OP_ILLEGAL, OP_ILLEGAL, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+        };
+        op = ops[funct3]; imm = immm4; rdid = 0;
+        break;
+    }
+    case 0x03: { // Load (0b0000011)
+        static const uint8_t ops[8] = {
+            OP_LB, OP_LH, OP_LW, OP_LOAD_BAD, OP_LBU, OP_LHU, OP_LOAD_BAD, OP_LOAD_BAD,
+        };
+        op = ops[funct3]; imm = imm_i;
+        break;
+    }
+    case 0x23: { // Store (0b0100011)
+        uint32_t addy = ((ir >> 7) & 0x1f) | ((ir & 0xfe000000) >> 20);
+        if (addy & 0x800)
+            addy |= 0xfffff000;
+        static const uint8_t ops[8] = {
+            OP_SB, OP_SH, OP_SW, OP_STORE_BAD, OP_STORE_BAD, OP_STORE_BAD, OP_STORE_BAD, OP_STORE_BAD,
+        };
+        op = ops[funct3]; imm = addy; rdid = 0;
+        break;
+    }
+    case 0x13: { // Op-immediate 0b0010011
+        static const uint8_t ops[8] = {
+            OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_ORI, OP_ANDI,
+        };
+        op = ops[funct3]; imm = imm_i;
+        if (funct3 == 1 || funct3 == 5) {
+            imm &= 0x1f; // Shift amount
+            if (funct3 == 5 && (ir & 0x40000000))
+                op = OP_SRAI;
+        }
+        break;
+    }
+    case 0x33: { // Op 0b0110011
+        static const uint8_t ops[8] = {
+            OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND,
+        };
+        static const uint8_t mops[8] = { // 0x02000000 = RV32M
+            OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU,
+        };
+        if (ir & 0x02000000) {
+            op = mops[funct3];
+        } else {
+            op = ops[funct3];
+            if (funct3 == 0 && (ir & 0x40000000))
+                op = OP_SUB;
+            else if (funct3 == 5 && (ir & 0x40000000))
+                op = OP_SRA;
         }
-        case 0x63: { // Branch (0b1100011)
-            uint32_t immm4 = ((ir & 0xf00) >> 7) | ((ir & 0x7e000000) >> 20) | ((ir & 0x80) << 4) | ((ir >> 31) << 12);
-            if (immm4 & 0x1000)
-                immm4 |= 0xffffe000;
-            int32_t rs1 = REG((ir >> 15) & 0x1f);
-            int32_t rs2 = REG((ir >> 20) & 0x1f);
-            immm4 = pc + immm4 - 4;
+        break;
+    }
+    case 0x0f: // 0b0001111
+        // fencetype = (ir >> 12) & 0b111; only FENCE.I matters (decode cache).
+        op = (funct3 == 1) ? OP_FENCE_I : OP_FENCE;
+        rdid = 0;
+        break;
+    case 0x73: { // Zifencei+Zicsr  (0b1110011)
+        uint32_t csrno = ir >> 20;
+        if (funct3 & 3) { // It's a Zicsr function.
+            op = OP_CSR; imm = csrno; in->rs2 = funct3;
+        } else if (funct3 == 0) { // "SYSTEM" 0b000
             rdid = 0;
-            switch ((ir >> 12) & 0x7)
-            {
-            // BEQ, BNE, BLT, BGE, BLTU, BGEU
-            case 0: if (rs1 == rs2) pc = immm4; break;
-            case 1: if (rs1 != rs2) pc = immm4; break;
-            case 4: if (rs1 < rs2) pc = immm4; break;
-            case 5: if (rs1 >= rs2) pc = immm4; break; // BGE
-            case 6: if ((uint32_t)rs1 < (uint32_t)rs2) pc = immm4; break; // BLTU
-            case 7: if ((uint32_t)rs1 >= (uint32_t)rs2) pc = immm4; break; // BGEU
-            default:
-                trap = (2 + 1);
+            if (csrno == 0x105) // WFI (Wait for interrupts)
+                op = OP_WFI;
+            else if ((csrno & 0xff) == 0x02) // MRET
+                op = OP_MRET;
+            else if (csrno == 0) // ECALL
+                op = OP_ECALL;
+            else if (csrno == 1) // EBREAK
+                op = OP_EBREAK;
+        }
+        break;
+    }
+    case 0x2f: { // RV32A (0b00101111)
+        switch ((ir >> 27) & 0x1f) {
+        case 2: op = OP_LR; break;       // LR.W (0b00010)
+        case 3: op = OP_SC; break;       // SC.W (0b00011)
+        case 1: op = OP_AMOSWAP; break;  // AMOSWAP.W (0b00001)
+        case 0: op = OP_AMOADD; break;   // AMOADD.W (0b00000)
+        case 4: op = OP_AMOXOR; break;   // AMOXOR.W (0b00100)
+        case 12: op = OP_AMOAND; break;  // AMOAND.W (0b01100)
+        case 8: op = OP_AMOOR; break;    // AMOOR.W (0b01000)
+        case 16: op = OP_AMOMIN; break;  // AMOMIN.W (0b10000)
+        case 20: op = OP_AMOMAX; break;  // AMOMAX.W (0b10100)
+        case 24: op = OP_AMOMINU; break; // AMOMINU.W (0b11000)
+        case 28: op = OP_AMOMAXU; break; // AMOMAXU.W (0b11100)
+        default: op = OP_AMO_BAD; break; // Not supported.
+        }
+        break;
+    }
+    }
+
+    in->op = op;
+    in->rd = rdid;
+    in->imm = imm;
+}
+
+// Register-immediate, register-register and RV32M computation. op is
+// always a compile-time constant at the call sites, so this folds away;
+// it exists so that every execution engine shares one definition.
+static inline uint32_t rv32ima_alu(uint32_t op, uint32_t rs1, uint32_t rs2) {
+    switch (op) {
+    case OP_ADDI: case OP_ADD: return rs1 + rs2;
+    case OP_SLTI: case OP_SLT: return (int32_t)rs1 < (int32_t)rs2;
+    case OP_SLTIU: case OP_SLTU: return rs1 < rs2;
+    case OP_XORI: case OP_XOR: return rs1 ^ rs2;
+    case OP_ORI: case OP_OR: return rs1 | rs2;
+    case OP_ANDI: case OP_AND: return rs1 & rs2;
+    case OP_SLLI: case OP_SLL: return rs1 << (rs2 & 0x1F);
+    case OP_SRLI: case OP_SRL: return rs1 >> (rs2 & 0x1F);
+    case OP_SRAI: case OP_SRA: return ((int32_t)rs1) >> (rs2 & 0x1F);
+    case OP_SUB: return rs1 - rs2;
+
+    case OP_MUL: return rs1 * rs2;
+    case OP_MULH: return ((int64_t)((int32_t)rs1) * (int64_t)((int32_t)rs2)) >> 32;
+    case OP_MULHSU: return ((int64_t)((int32_t)rs1) * (uint64_t)rs2) >> 32;
+    case OP_MULHU: return ((uint64_t)rs1 * (uint64_t)rs2) >> 32;
+    case OP_DIV:
+        if (rs2 == 0)
+            return -1;
+        return ((int32_t)rs1 == INT32_MIN && (int32_t)rs2 == -1) ? rs1 : ((int32_t)rs1 / (int32_t)rs2);
+    case OP_DIVU:
+        if (rs2 == 0)
+            return 0xffffffff;
+        return rs1 / rs2;
+    case OP_REM:
+        if (rs2 == 0)
+            return rs1;
+        return ((int32_t)rs1 == INT32_MIN && (int32_t)rs2 == -1) ? 0 : ((uint32_t)((int32_t)rs1 % (int32_t)rs2));
+    case OP_REMU:
+        if (rs2 == 0)
+            return rs1;
+        return rs1 % rs2;
+    }
+    return 0;
+}
+
+// Guest memory access. The fast path is one unsigned compare of the RAM
+// offset against the last valid start for the access width; MMIO and access
+// faults are left to the out-of-line slow paths below.
+#define RV32IMA_IN_RAM(state, ofs, width) ((ofs) <= (state)->mem_size - (width))
+
+#include "mini-rv32ima-uart.h"
+
+// Loads outside RAM: the UART, the CLINT timer and MSIP reads, or a load
+// access fault (the trap is returned, +1 like in rv32ima_run()).
+static __attribute__((noinline)) uint32_t rv32ima_load_slow(struct CPUState *state, uint32_t addy, uint64_t timer, uint32_t *rval) {
+    if (addy >= 0x10000000 && addy < 0x12000000) {
+        if (addy - RV32IMA_UART_BASE < RV32IMA_UART_SIZE)
+            *rval = state->uart ? rv32ima_uart_load(state->uart, addy - RV32IMA_UART_BASE) : 0;
+        else if (addy == 0x1100bffc) *rval = timer >> 32;
+        else if (addy == 0x1100bff8) *rval = (uint32_t)timer;
+        else if (addy - 0x11000000 < 4 * rv32ima_nharts(state) && !(addy & 3)) // CLNT MSIP
+            *rval = __atomic_load_n(&rv32ima_hart(state, (addy - 0x11000000) / 4)->msip, __ATOMIC_ACQUIRE);
+        return 0;
+    }
+    *rval = addy;
+    return 5 + 1;
+}
+
+// Stores outside RAM other than SYSCON (which ends the run, so the caller
+// handles it): the UART, CLINT timer match writes, or a store access fault.
+static __attribute__((noinline)) uint32_t rv32ima_store_slow(struct CPUState *state, uint32_t addy, uint32_t val) {
+    if (addy >= 0x10000000 && addy < 0x12000000) {
+        uint32_t id;
+        if (addy - RV32IMA_UART_BASE < RV32IMA_UART_SIZE) {
+            if (state->uart)
+                rv32ima_uart_store(state->uart, addy - RV32IMA_UART_BASE, val);
+        } else if ((id = (addy - 0x11004000) / 8) < rv32ima_nharts(state) && !(addy & 3)) // CLNT mtimecmp
+            rv32ima_hart(state, id)->csrs[(addy & 4) ? TIMERMATCHH : TIMERMATCHL] = val;
+        else if ((id = (addy - 0x11000000) / 4) < rv32ima_nharts(state) && !(addy & 3)) // CLNT MSIP
+            __atomic_store_n(&rv32ima_hart(state, id)->msip, val & 1, __ATOMIC_RELEASE);
+        return 0;
+    }
+    return 7 + 1; // Store access fault.
+}
+
+// Returns the decoded instruction at (in-range, aligned) offset ofs_pc,
+// either from the decode cache or decoded into *tmp.
+static inline const struct rv32ima_insn *rv32ima_fetch(struct CPUState *state, uint32_t ofs_pc, struct rv32ima_insn *tmp) {
+    struct rv32ima_icache *ic = state->icache;
+    if (ic) {
+        uint32_t idx = ofs_pc - ic->base;
+        if (idx < ic->size) {
+            struct rv32ima_insn *in = &ic->insns[idx >> 2];
+            if (in->op == OP_UNDECODED) {
+                rv32ima_decode(*(uint32_t *)&state->mem[ofs_pc], in);
+                ic->pages[idx >> RV32IMA_PAGE_SHIFT] |= RV32IMA_PAGE_DECODED;
             }
+            return in;
+        }
+    }
+    rv32ima_decode(*(uint32_t *)&state->mem[ofs_pc], tmp);
+    return tmp;
+}
+
+#ifdef RV32IMA_THREADED
+// Translates the block starting at (aligned) guest pc, whose offset into
+// mem is idx in the decode cache range. labels[] maps each enum RV32IMA_OP
+// that may appear in a block to its handler (NULL: ends the block before
+// that instruction). Returns RV32IMA_NOBLOCK if not even the first
+// instruction qualifies.
+static struct rv32ima_block *rv32ima_translate(struct CPUState *state, uint32_t pc, uint32_t idx, const void *const *labels) {
+    struct rv32ima_icache *ic = state->icache;
+    size_t maxsize = sizeof(struct rv32ima_block) + (RV32IMA_BLOCK_MAX + 1) * sizeof(struct rv32ima_top);
+
+    if (ic->arena_used + maxsize > RV32IMA_ARENA_SIZE)
+        rv32ima_block_flush(ic);
+
+    struct rv32ima_block *blk = (struct rv32ima_block *)(ic->arena + ic->arena_used);
+    uint32_t len = 0, end = idx;
+    int terminated = 0;
+
+    while (len < RV32IMA_BLOCK_MAX && end - ic->base < ic->size && !terminated) {
+        struct rv32ima_insn in;
+        struct rv32ima_top *op = &blk->ops[len];
+        uint32_t ipc = pc + len * 4;
+
+        rv32ima_decode(*(uint32_t *)&state->mem[end], &in);
+        if (!labels[in.op])
+            break;
+
+        switch (in.op) {
+        case OP_AUIPC: // Constant once the PC is known
+            in.op = OP_LUI;
+            in.imm += ipc;
             break;
+        case OP_JAL:
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BGE: case OP_BLTU: case OP_BGEU:
+            in.imm += ipc;
+            terminated = 1;
+            break;
+        case OP_JALR:
+            terminated = 1;
+            break;
+        case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU:
+        case OP_SB: case OP_SH: case OP_SW:
+            break;
+        default: // Plain computation: writes to x0 do nothing at all
+            if (in.rd == 0)
+                in.op = OP_FENCE;
         }
-        case 0x03: { // Load (0b0000011)
-            uint32_t rs1 = REG((ir >> 15) & 0x1f);
-            uint32_t imm = ir >> 20;
-            int32_t imm_se = imm | ((imm & 0x800) ? 0xfffff000 : 0);
-            uint32_t rsval = rs1 + imm_se;
-
-            rsval -= state->mem_offset;
-            if (rsval >= state->mem_size - 3) {
-                rsval += state->mem_offset;
-                if (rsval >= 0x10000000 && rsval < 0x12000000) {
-                    if (rsval == 0x1100bffc) rval = CSR(TIMERH);
-                    else if (rsval == 0x1100bff8) rval = CSR(TIMERL);
-                } else {
-                    trap = (5 + 1);
-                    rval = rsval;
+
+        op->handler = labels[in.op];
+        op->op = in.op;
+        op->rd = in.rd;
+        op->rs1 = in.rs1;
+        op->rs2 = in.rs2;
+        op->imm = in.imm;
+        len++;
+        end += 4;
+    }
+
+    uint32_t slot = (idx - ic->base) >> 2;
+    ic->pages[(idx - ic->base) >> RV32IMA_PAGE_SHIFT] |= RV32IMA_PAGE_ENTRY;
+    if (len == 0) {
+        ic->blocks[slot] = RV32IMA_NOBLOCK;
+        return RV32IMA_NOBLOCK;
+    }
+
+    if (!terminated) {
+        blk->ops[len].handler = labels[OP_EXIT];
+        blk->ops[len].op = OP_EXIT;
+    }
+    blk->pc = pc;
+    blk->end = pc + len * 4;
+    blk->len = len;
+    blk->next[0] = blk->next[1] = NULL;
+#ifdef RV32IMA_JIT
+    blk->hits = 0;
+    blk->native = NULL;
+#endif
+    ic->arena_used += sizeof(struct rv32ima_block) + (len + !terminated) * sizeof(struct rv32ima_top);
+    ic->arena_used = (ic->arena_used + 15) & ~15u;
+
+    for (uint32_t ofs = idx - ic->base; ofs < end - ic->base; ofs += 1 << RV32IMA_PAGE_SHIFT)
+        ic->pages[ofs >> RV32IMA_PAGE_SHIFT] |= RV32IMA_PAGE_CODE;
+    ic->pages[(end - 4 - ic->base) >> RV32IMA_PAGE_SHIFT] |= RV32IMA_PAGE_CODE;
+    ic->blocks[slot] = blk;
+    return blk;
+}
+
+// Returns the block entered at pc, translating it on first use, or NULL.
+static inline struct rv32ima_block *rv32ima_block_lookup(struct CPUState *state, uint32_t pc, const void *const *labels) {
+    struct rv32ima_icache *ic = state->icache;
+    uint32_t idx = pc - state->mem_offset;
+
+    if (!ic || idx - ic->base >= ic->size || (idx & 3))
+        return NULL;
+
+    struct rv32ima_block *blk = ic->blocks[(idx - ic->base) >> 2];
+    if (!blk)
+        blk = rv32ima_translate(state, pc, idx, labels);
+    return blk == RV32IMA_NOBLOCK ? NULL : blk;
+}
+#endif
+
+#ifdef RV32IMA_JIT
+#include "mini-rv32ima-jit.h"
+#endif
+
+// Runs up to count instructions, exactly as if rv32ima_step(state,
+// elapsedUs) were called count times in a row and stopped at the first
+// nonzero return (which is returned). *executed (optional) gets the number
+// of steps taken. A batch also ends early when the PC lands on halt_pc.
+//
+// Unlike a loop of single steps, guest state stays in host registers and
+// the timer comparison, MIP update, WFI and interrupt checks are skipped
+// unless something could have changed them: a timer deadline, a CSR write,
+// MRET, a trap or a CLINT store.
+static inline int32_t rv32ima_run(struct CPUState *state, uint32_t elapsedUs, uint32_t count, uint32_t *executed) {
+    #define CSR(x) (state->csrs[x])
+    #define REG(x) (state->regs[x])
+    #define MEM(x) (&state->mem[x])
+
+    uint64_t timer = ((uint64_t)CSR(TIMERH) << 32) | CSR(TIMERL);
+    uint64_t deadline = 0; // Next timer value at which MIP.MTIP may flip
+    uint32_t pc = CSR(PC);
+    uint32_t cycle = CSR(CYCLEL);
+    uint32_t halt_pc = state->halt_pc;
+    int halt = state->halt_enabled;
+    int prof = state->profile != NULL;
+    uint32_t n = 0;
+    int32_t ret = 0;
+    int sync = 1;
+
+#ifdef RV32IMA_THREADED
+    static const void *const labels[OP_COUNT] = {
+        [OP_LUI] = &&T_OP_LUI, [OP_AUIPC] = &&T_OP_LUI, [OP_JAL] = &&T_OP_JAL, [OP_JALR] = &&T_OP_JALR,
+        [OP_BEQ] = &&T_OP_BEQ, [OP_BNE] = &&T_OP_BNE, [OP_BLT] = &&T_OP_BLT,
+        [OP_BGE] = &&T_OP_BGE, [OP_BLTU] = &&T_OP_BLTU, [OP_BGEU] = &&T_OP_BGEU,
+        [OP_LB] = &&T_OP_LB, [OP_LH] = &&T_OP_LH, [OP_LW] = &&T_OP_LW,
+        [OP_LBU] = &&T_OP_LBU, [OP_LHU] = &&T_OP_LHU,
+        [OP_SB] = &&T_OP_SB, [OP_SH] = &&T_OP_SH, [OP_SW] = &&T_OP_SW,
+        [OP_ADDI] = &&T_OP_ADDI, [OP_SLTI] = &&T_OP_SLTI, [OP_SLTIU] = &&T_OP_SLTIU,
+        [OP_XORI] = &&T_OP_XORI, [OP_ORI] = &&T_OP_ORI, [OP_ANDI] = &&T_OP_ANDI,
+        [OP_SLLI] = &&T_OP_SLLI, [OP_SRLI] = &&T_OP_SRLI, [OP_SRAI] = &&T_OP_SRAI,
+        [OP_ADD] = &&T_OP_ADD, [OP_SUB] = &&T_OP_SUB, [OP_SLL] = &&T_OP_SLL,
+        [OP_SLT] = &&T_OP_SLT, [OP_SLTU] = &&T_OP_SLTU, [OP_XOR] = &&T_OP_XOR,
+        [OP_SRL] = &&T_OP_SRL, [OP_SRA] = &&T_OP_SRA, [OP_OR] = &&T_OP_OR, [OP_AND] = &&T_OP_AND,
+        [OP_MUL] = &&T_OP_MUL, [OP_MULH] = &&T_OP_MULH, [OP_MULHSU] = &&T_OP_MULHSU,
+        [OP_MULHU] = &&T_OP_MULHU, [OP_DIV] = &&T_OP_DIV, [OP_DIVU] = &&T_OP_DIVU,
+        [OP_REM] = &&T_OP_REM, [OP_REMU] = &&T_OP_REMU,
+        [OP_FENCE] = &&T_OP_FENCE, [OP_EXIT] = &&T_OP_EXIT,
+    };
+#endif
+
+    while (n < count) {
+#ifdef RV32IMA_THREADED
+        // Run as many whole blocks as fit in the batch. Blocks never touch
+        // the timer or interrupt state, so the per-step checks can be
+        // skipped as long as a block ends before the next timer deadline
+        // (and, with halt_pc, doesn't run across it).
+        struct rv32ima_block *blk = sync ? NULL : rv32ima_block_lookup(state, pc, labels);
+        while (blk && n + blk->len <= count &&
+               timer + (uint64_t)blk->len * elapsedUs < deadline &&
+               !(halt && halt_pc - blk->pc - 4 < (blk->len - 1) * 4)) {
+            const struct rv32ima_top *op = blk->ops;
+            struct rv32ima_block *next;
+            uint32_t slot, k, gen;
+
+            #define NEXT() do { op++; goto *op->handler; } while (0)
+            #define RETIRE(k) do { \
+                if (prof) \
+                    rv32ima_profile(state, blk->pc - state->mem_offset, (k)); \
+                n += (k); \
+                timer += (uint64_t)(k) * elapsedUs; \
+                if (cycle + (k) < cycle) \
+                    CSR(CYCLEH)++; \
+                cycle += (k); \
+            } while (0)
+
+#ifdef RV32IMA_JIT
+            if (blk->native || (++blk->hits == RV32IMA_JIT_THRESHOLD && rv32ima_jit_compile(state, blk))) {
+                uint64_t r = blk->native(state->regs, state->mem, state->icache->pages);
+                uint32_t why = r >> 40;
+
+                pc = (uint32_t)r;
+                if (why <= JIT_EXIT_INDIRECT) {
+                    slot = why;
+                    goto T_exit;
                 }
-            } else {
-                switch ((ir >> 12) & 0x7)
-                {
-                // LB, LH, LW, LBU, LHU
-                case 0: rval = *(int8_t *)MEM(rsval); break;
-                case 1: rval = *(int16_t *)MEM(rsval); break;
-                case 2: rval = *(uint32_t *)MEM(rsval); break;
-                case 4: rval = *(uint8_t *)MEM(rsval); break;
-                case 5: rval = *(uint16_t *)MEM(rsval); break;
-                default: trap = (2 + 1);
+                k = (r >> 32) & 0xff;
+                RETIRE(k);
+                if (why == JIT_EXIT_STORE) { // Redo the invalidation in C
+                    op = &blk->ops[k - 1];
+                    rv32ima_icache_store(state->icache, REG(op->rs1) + op->imm - state->mem_offset);
                 }
+                break;
             }
+#endif
+            goto *op->handler;
+
+            #define T_ALU(o, b) T_##o: REG(op->rd) = rv32ima_alu(o, REG(op->rs1), b); NEXT();
+            T_ALU(OP_ADDI, op->imm) T_ALU(OP_SLTI, op->imm) T_ALU(OP_SLTIU, op->imm)
+            T_ALU(OP_XORI, op->imm) T_ALU(OP_ORI, op->imm) T_ALU(OP_ANDI, op->imm)
+            T_ALU(OP_SLLI, op->imm) T_ALU(OP_SRLI, op->imm) T_ALU(OP_SRAI, op->imm)
+            T_ALU(OP_ADD, REG(op->rs2)) T_ALU(OP_SUB, REG(op->rs2)) T_ALU(OP_SLL, REG(op->rs2))
+            T_ALU(OP_SLT, REG(op->rs2)) T_ALU(OP_SLTU, REG(op->rs2)) T_ALU(OP_XOR, REG(op->rs2))
+            T_ALU(OP_SRL, REG(op->rs2)) T_ALU(OP_SRA, REG(op->rs2)) T_ALU(OP_OR, REG(op->rs2))
+            T_ALU(OP_AND, REG(op->rs2))
+            T_ALU(OP_MUL, REG(op->rs2)) T_ALU(OP_MULH, REG(op->rs2)) T_ALU(OP_MULHSU, REG(op->rs2))
+            T_ALU(OP_MULHU, REG(op->rs2)) T_ALU(OP_DIV, REG(op->rs2)) T_ALU(OP_DIVU, REG(op->rs2))
+            T_ALU(OP_REM, REG(op->rs2)) T_ALU(OP_REMU, REG(op->rs2))
+            #undef T_ALU
+
+        T_OP_LUI:
+            REG(op->rd) = op->imm;
+            NEXT();
+        T_OP_FENCE:
+            NEXT();
+
+            // Loads and stores only take the plain RAM case; MMIO and faults
+            // bail out so that the switch interpreter executes them.
+            #define T_LOAD(o, type) T_##o: { \
+                uint32_t addy = REG(op->rs1) + op->imm - state->mem_offset; \
+                if (!RV32IMA_IN_RAM(state, addy, sizeof(type))) \
+                    goto T_bail; \
+                uint32_t v = *(type *)MEM(addy); \
+                if (op->rd) \
+                    REG(op->rd) = v; \
+                NEXT(); \
+            }
+            T_LOAD(OP_LB, int8_t) T_LOAD(OP_LH, int16_t) T_LOAD(OP_LW, uint32_t)
+            T_LOAD(OP_LBU, uint8_t) T_LOAD(OP_LHU, uint16_t)
+            #undef T_LOAD
+
+            // A store that hits translated code ends the block right after
+            // itself: the rest of it may be stale (or its memory reused).
+            #define T_STORE(o, type) T_##o: { \
+                uint32_t addy = REG(op->rs1) + op->imm - state->mem_offset; \
+                if (!RV32IMA_IN_RAM(state, addy, sizeof(type))) \
+                    goto T_bail; \
+                *(type *)MEM(addy) = REG(op->rs2); \
+                if (rv32ima_icache_store(state->icache, addy)) { \
+                    op++; \
+                    goto T_bail; \
+                } \
+                NEXT(); \
+            }
+            T_STORE(OP_SB, uint8_t) T_STORE(OP_SH, uint16_t) T_STORE(OP_SW, uint32_t)
+            #undef T_STORE
+
+            #define T_BRANCH(o, cond) T_##o: \
+                slot = (cond); \
+                pc = slot ? op->imm : blk->end; \
+                goto T_exit;
+            T_BRANCH(OP_BEQ, REG(op->rs1) == REG(op->rs2))
+            T_BRANCH(OP_BNE, REG(op->rs1) != REG(op->rs2))
+            T_BRANCH(OP_BLT, (int32_t)REG(op->rs1) < (int32_t)REG(op->rs2))
+            T_BRANCH(OP_BGE, (int32_t)REG(op->rs1) >= (int32_t)REG(op->rs2))
+            T_BRANCH(OP_BLTU, REG(op->rs1) < REG(op->rs2))
+            T_BRANCH(OP_BGEU, REG(op->rs1) >= REG(op->rs2))
+            #undef T_BRANCH
+
+        T_OP_JAL:
+            if (op->rd)
+                REG(op->rd) = blk->end;
+            pc = op->imm;
+            slot = 1;
+            goto T_exit;
+        T_OP_JALR:
+            pc = (REG(op->rs1) + op->imm) & ~1;
+            if (op->rd)
+                REG(op->rd) = blk->end;
+            slot = 2; // Indirect: not chained
+            goto T_exit;
+        T_OP_EXIT:
+            pc = blk->end;
+            slot = 0;
+            goto T_exit;
+
+        T_bail:
+            // Stop in front of op, which the switch interpreter executes.
+            k = op - blk->ops;
+            RETIRE(k);
+            pc = blk->pc + k * 4;
             break;
+
+        T_exit:
+            RETIRE(blk->len);
+            if (halt && pc == halt_pc)
+                goto done;
+            if (slot < 2 && blk->next[slot]) {
+                blk = blk->next[slot];
+                continue;
+            }
+            gen = state->icache->generation;
+            next = rv32ima_block_lookup(state, pc, labels);
+            if (slot < 2 && gen == state->icache->generation)
+                blk->next[slot] = next;
+            blk = next;
+
+            #undef NEXT
+            #undef RETIRE
         }
-        case 0x23: { // Store (0b0100011)
-            uint32_t rs1 = REG((ir >> 15) & 0x1f);
-            uint32_t rs2 = REG((ir >> 20) & 0x1f);
-            uint32_t addy = ((ir >> 7) & 0x1f) | ((ir & 0xfe000000) >> 20);
-            if (addy & 0x800)
-                addy |= 0xfffff000;
-            addy += rs1 - state->mem_offset;
-            rdid = 0;
 
-            if (addy >= state->mem_size - 3) {
-                addy += state->mem_offset;
-                if (addy >= 0x10000000 && addy < 0x12000000) {
-                    // Should be stuff like SYSCON, 8250, CLNT
-                    if (addy == 0x11004004) // CLNT
-                        CSR(TIMERMATCHH) = rs2;
-                    else if (addy == 0x11004000) // CLNT
-                        CSR(TIMERMATCHL) = rs2;
-                    else if (addy == 0x11100000) { // SYSCON (reboot, poweroff, etc.)
-                        CSR(PC) = pc + 4;
-                        return rs2; // NOTE: PC will be PC of Syscon.
-                    }
-                }
-                else
-                {
-                    trap = (7 + 1); // Store access fault.
-                    rval = addy;
-                }
+        if (n >= count)
+            break;
+#endif
+
+        uint32_t trap = 0;
+        uint32_t rval = 0;
+
+        n++;
+        timer += elapsedUs;
+
+        if (sync || timer >= deadline) {
+            // Handle Timer interrupt.
+            uint64_t timermatch = ((uint64_t)CSR(TIMERMATCHH) << 32) | CSR(TIMERMATCHL);
+
+            sync = 0;
+            if (timermatch && (timer > timermatch)) {
+                CSR(EXTRAFLAGS) &= ~4;
+                CSR(MIP) |= 1 << 7;
+                deadline = UINT64_MAX;
             } else {
-                switch ((ir >> 12) & 0x7) { // SB, SH, SW
-                case 0: *(uint8_t *)MEM(addy) = rs2; break;
-                case 1: *(uint16_t *)MEM(addy) = rs2; break;
-                case 2: *(uint32_t *)MEM(addy) = rs2; break;
-                default:
-                    trap = (2 + 1);
+                CSR(MIP) &= ~(1 << 7);
+                deadline = timermatch ? timermatch + 1 : UINT64_MAX;
+            }
+
+            // SMP: software interrupt from another hart (checked on every
+            // batch, which starts with sync set).
+            if (state->harts) {
+                if (__atomic_load_n(&state->msip, __ATOMIC_ACQUIRE)) {
+                    CSR(EXTRAFLAGS) &= ~4;
+                    CSR(MIP) |= 1 << 3;
+                } else {
+                    CSR(MIP) &= ~(1 << 3);
                 }
             }
-            break;
+
+            // If WFI (waiting for interrupt), don't run processor.
+            if (CSR(EXTRAFLAGS) & 4) {
+                ret = 1;
+                goto done;
+            }
+
+            // Software, then timer interrupt.
+            uint32_t pending = CSR(MIP) & CSR(MIE) & (state->harts ? (1 << 3) | (1 << 7) : (1 << 7));
+            if (pending && (CSR(MSTATUS) & 0x8 /*mie*/)) {
+                trap = (pending & (1 << 3)) ? 0x80000003 : 0x80000007;
+                pc -= 4;
+                goto cycle_end;
+            }
         }
-        case 0x13:   // Op-immediate 0b0010011
-        case 0x33: { // Op           0b0110011
-            uint32_t imm = ir >> 20;
-            imm = imm | ((imm & 0x800) ? 0xfffff000 : 0);
-            uint32_t rs1 = REG((ir >> 15) & 0x1f);
-            uint32_t is_reg = !!(ir & 0x20);
-            uint32_t rs2 = is_reg ? REG(imm & 0x1f) : imm;
-
-            if (is_reg && (ir & 0x02000000)) {
-                switch ((ir >> 12) & 7) { // 0x02000000 = RV32M
-                case 0: rval = rs1 * rs2; break; // MUL
-                case 1: rval = ((int64_t)((int32_t)rs1) * (int64_t)((int32_t)rs2)) >> 32; break; // MULH
-                case 2: rval = ((int64_t)((int32_t)rs1) * (uint64_t)rs2) >> 32; break; // MULHSU
-                case 3: rval = ((uint64_t)rs1 * (uint64_t)rs2) >> 32; break; // MULHU
-                case 4:
-                    if (rs2 == 0)
-                        rval = -1;
-                    else
-                        rval = ((int32_t)rs1 == INT32_MIN && (int32_t)rs2 == -1) ? rs1 : ((int32_t)rs1 / (int32_t)rs2);
-                    break; // DIV
-                case 5:
-                    if (rs2 == 0)
-                        rval = 0xffffffff;
-                    else
-                        rval = rs1 / rs2;
-                    break; // DIVU
-                case 6:
-                    if (rs2 == 0)
-                        rval = rs1;
-                    else
-                        rval = ((int32_t)rs1 == INT32_MIN && (int32_t)rs2 == -1) ? 0 : ((uint32_t)((int32_t)rs1 % (int32_t)rs2));
-                    break; // REM
-                case 7:
-                    if (rs2 == 0)
-                        rval = rs1;
-                    else
-                        rval = rs1 % rs2;
-                    break; // REMU
+
+        // Otherwise, execute a single-step instruction.
+        uint32_t ofs_pc = pc - state->mem_offset;
+
+        if (prof)
+            rv32ima_profile(state, ofs_pc, 1);
+
+        if (ofs_pc >= state->mem_size) {
+            trap = 1 + 1; // Handle access violation on instruction read.
+            goto cycle_end;
+        } else if (ofs_pc & 3) {
+            trap = 1 + 0; // Handle PC-misaligned access
+            goto cycle_end;
+        } else {
+            struct rv32ima_insn tmp;
+            const struct rv32ima_insn *in = rv32ima_fetch(state, ofs_pc, &tmp);
+            uint32_t rdid = in->rd;
+            uint32_t rs1 = REG(in->rs1);
+            uint32_t rs2 = REG(in->rs2);
+            uint32_t imm = in->imm;
+
+            switch (in->op) {
+            case OP_LUI: rval = imm; break;
+            case OP_AUIPC: rval = pc + imm; break;
+            case OP_JAL:
+                rval = pc + 4;
+                pc = pc + imm - 4;
+                break;
+            case OP_JALR:
+                rval = pc + 4;
+                pc = ((rs1 + imm) & ~1) - 4;
+                break;
+
+            // BEQ, BNE, BLT, BGE, BLTU, BGEU
+            case OP_BEQ: if (rs1 == rs2) pc = pc + imm - 4; break;
+            case OP_BNE: if (rs1 != rs2) pc = pc + imm - 4; break;
+            case OP_BLT: if ((int32_t)rs1 < (int32_t)rs2) pc = pc + imm - 4; break;
+            case OP_BGE: if ((int32_t)rs1 >= (int32_t)rs2) pc = pc + imm - 4; break;
+            case OP_BLTU: if (rs1 < rs2) pc = pc + imm - 4; break;
+            case OP_BGEU: if (rs1 >= rs2) pc = pc + imm - 4; break;
+
+            // Loads and stores: only plain RAM is handled inline.
+            #define LOAD(o, type) case o: { \
+                uint32_t addy = rs1 + imm - state->mem_offset; \
+                if (RV32IMA_IN_RAM(state, addy, sizeof(type))) \
+                    rval = *(type *)MEM(addy); \
+                else \
+                    trap = rv32ima_load_slow(state, addy + state->mem_offset, timer, &rval); \
+                break; \
+            }
+            LOAD(OP_LB, int8_t) LOAD(OP_LH, int16_t) LOAD(OP_LW, uint32_t)
+            LOAD(OP_LBU, uint8_t) LOAD(OP_LHU, uint16_t)
+            #undef LOAD
+            case OP_LOAD_BAD: {
+                uint32_t addy = rs1 + imm - state->mem_offset;
+                if (RV32IMA_IN_RAM(state, addy, 4))
+                    trap = (2 + 1);
+                else
+                    trap = rv32ima_load_slow(state, addy + state->mem_offset, timer, &rval);
+                break;
+            }
+
+            #define STORE(o, type) case o: { \
+                uint32_t addy = rs1 + imm - state->mem_offset; \
+                if (RV32IMA_IN_RAM(state, addy, sizeof(type))) { \
+                    *(type *)MEM(addy) = rs2; \
+                    if (state->icache) \
+                        rv32ima_icache_store(state->icache, addy); \
+                    break; \
+                } \
+                goto store_slow; \
+            }
+            STORE(OP_SB, uint8_t) STORE(OP_SH, uint16_t) STORE(OP_SW, uint32_t)
+            #undef STORE
+            case OP_STORE_BAD: {
+                uint32_t addy = rs1 + imm - state->mem_offset;
+                if (RV32IMA_IN_RAM(state, addy, 4)) {
+                    trap = (2 + 1);
+                    break;
                 }
-            } else {
-                switch ((ir >> 12) & 7) { // These could be either op-immediate or op commands.  Be careful.
-                case 0: rval = (is_reg && (ir & 0x40000000)) ? (rs1 - rs2) : (rs1 + rs2); break;
-                case 1: rval = rs1 << (rs2 & 0x1F); break;
-                case 2: rval = (int32_t)rs1 < (int32_t)rs2; break;
-                case 3: rval = rs1 < rs2; break;
-                case 4: rval = rs1 ^ rs2; break;
-                case 5: rval = (ir & 0x40000000) ? (((int32_t)rs1) >> (rs2 & 0x1F)) : (rs1 >> (rs2 & 0x1F)); break;
-                case 6: rval = rs1 | rs2; break;
-                case 7: rval = rs1 & rs2; break;
+            store_slow:
+                addy = rs1 + imm;
+                if (addy == 0x11100000) { // SYSCON (reboot, poweroff, etc.)
+                    pc += 4;
+                    ret = rs2; // NOTE: PC will be PC of Syscon.
+                    goto done;
                 }
+                trap = rv32ima_store_slow(state, addy, rs2);
+                if (trap)
+                    rval = addy;
+                sync = 1;
+                break;
             }
-            break;
-        }
-        case 0x0f:    // 0b0001111
-            rdid = 0; // fencetype = (ir >> 12) & 0b111; We ignore fences in this impl.
-            break;
-        case 0x73: { // Zifencei+Zicsr  (0b1110011)
-            uint32_t csrno = ir >> 20;
-            uint32_t microop = (ir >> 12) & 0x7;
-            if ((microop & 3)) { // It's a Zicsr function.
-                int rs1imm = (ir >> 15) & 0x1f;
-                uint32_t rs1 = REG(rs1imm);
+
+            // Integer computation: see rv32ima_alu().
+            #define ALU(o, b) case o: rval = rv32ima_alu(o, rs1, b); break;
+            ALU(OP_ADDI, imm) ALU(OP_SLTI, imm) ALU(OP_SLTIU, imm)
+            ALU(OP_XORI, imm) ALU(OP_ORI, imm) ALU(OP_ANDI, imm)
+            ALU(OP_SLLI, imm) ALU(OP_SRLI, imm) ALU(OP_SRAI, imm)
+            ALU(OP_ADD, rs2) ALU(OP_SUB, rs2) ALU(OP_SLL, rs2) ALU(OP_SLT, rs2)
+            ALU(OP_SLTU, rs2) ALU(OP_XOR, rs2) ALU(OP_SRL, rs2) ALU(OP_SRA, rs2)
+            ALU(OP_OR, rs2) ALU(OP_AND, rs2)
+            ALU(OP_MUL, rs2) ALU(OP_MULH, rs2) ALU(OP_MULHSU, rs2) ALU(OP_MULHU, rs2)
+            ALU(OP_DIV, rs2) ALU(OP_DIVU, rs2) ALU(OP_REM, rs2) ALU(OP_REMU, rs2)
+            #undef ALU
+
+            case OP_FENCE: break; // We ignore fences in this impl.
+            case OP_FENCE_I:
+                if (state->icache)
+                    rv32ima_icache_flush(state->icache);
+                break;
+
+            case OP_CSR: {
+                uint32_t csrno = imm;
+                uint32_t microop = in->rs2;
+                int rs1imm = in->rs1;
                 uint32_t writeval = rs1;
 
                 switch (csrno) {
                 case 0x340: rval = CSR(MSCRATCH); break;
                 case 0x305: rval = CSR(MTVEC); break;
                 case 0x304: rval = CSR(MIE); break;
-                case 0xC00: rval = cycle; break;
+                case 0xC00: rval = cycle + 1; break;
                 case 0x344: rval = CSR(MIP); break;
                 case 0x341: rval = CSR(MEPC); break;
                 case 0x300: rval = CSR(MSTATUS); break; // mstatus
                 case 0x342: rval = CSR(MCAUSE); break;
                 case 0x343: rval = CSR(MTVAL); break;
                 case 0xf11: rval = 0xff0ff0ff; break; // mvendorid
+                case 0xf14: rval = state->hartid; break; // mhartid
                 case 0x301: rval = 0x40401101; break; // misa (XLEN=32, IMA+X)
                 default:
                     break;
@@ -348,125 +1090,148 @@ static inline int32_t rv32ima_step(struct CPUState *state, uint32_t elapsedUs) {
                 default:
                     break;
                 }
+                sync = 1;
+                break;
             }
-            else if (microop == 0x0) { // "SYSTEM" 0b000
-                rdid = 0;
-                if (csrno == 0x105) { // WFI (Wait for interrupts)
-                    CSR(MSTATUS) |= 8;    // Enable interrupts
-                    CSR(EXTRAFLAGS) |= 4; // Infor environment we want to go to sleep.
-                    CSR(PC) = pc + 4;
-                    return 1;
-                } else if (((csrno & 0xff) == 0x02)) { // MRET
-                    uint32_t startmstatus = CSR(MSTATUS);
-                    uint32_t startextraflags = CSR(EXTRAFLAGS);
-                    CSR(MSTATUS) = ((startmstatus & 0x80) >> 4) | ((startextraflags & 3) << 11) | 0x80;
-                    CSR(EXTRAFLAGS) = (startextraflags & ~3) | ((startmstatus >> 11) & 3);
-                    pc = CSR(MEPC) - 4;
-                } else {
-                    switch (csrno) {
-                    case 0:
-                        trap = (CSR(EXTRAFLAGS) & 3) ? (11 + 1) : (8 + 1);
-                        break; // ECALL; 8 = "Environment call from U-mode"; 11 = "Environment call from M-mode"
-                    case 1:
-                        trap = (3 + 1);
-                        break; // EBREAK 3 = "Breakpoint"
-                    default:
-                        trap = (2 + 1);
-                        break; // Illegal opcode.
-                    }
-                }
+            case OP_WFI: // WFI (Wait for interrupts)
+                CSR(MSTATUS) |= 8;    // Enable interrupts
+                CSR(EXTRAFLAGS) |= 4; // Infor environment we want to go to sleep.
+                pc += 4;
+                ret = 1;
+                goto done;
+            case OP_MRET: {
+                uint32_t startmstatus = CSR(MSTATUS);
+                uint32_t startextraflags = CSR(EXTRAFLAGS);
+                CSR(MSTATUS) = ((startmstatus & 0x80) >> 4) | ((startextraflags & 3) << 11) | 0x80;
+                CSR(EXTRAFLAGS) = (startextraflags & ~3) | ((startmstatus >> 11) & 3);
+                pc = CSR(MEPC) - 4;
+                sync = 1;
+                break;
             }
-            else
-                trap = (2 + 1);
-            break;
-        }
-        case 0x2f: { // RV32A (0b00101111)
-            uint32_t rs1 = REG((ir >> 15) & 0x1f);
-            uint32_t rs2 = REG((ir >> 20) & 0x1f);
-            uint32_t irmid = (ir >> 27) & 0x1f;
-
-            rs1 -= state->mem_offset;
-
-            // We don't implement load/store from UART or CLNT with RV32A here.
-
-            if (rs1 >= state->mem_size - 3) {
-                trap = (7 + 1); // Store/AMO access fault
-                rval = rs1 + state->mem_offset;
-            } else {
-                rval = *(uint32_t *)MEM(rs1);
+            case OP_ECALL:
+                // 8 = "Environment call from U-mode"; 11 = "Environment call from M-mode"
+                trap = (CSR(EXTRAFLAGS) & 3) ? (11 + 1) : (8 + 1);
+                break;
+            case OP_EBREAK:
+                trap = (3 + 1); // 3 = "Breakpoint"
+                break;
 
+            case OP_LR: case OP_SC:
+            case OP_AMOSWAP: case OP_AMOADD: case OP_AMOXOR: case OP_AMOAND: case OP_AMOOR:
+            case OP_AMOMIN: case OP_AMOMAX: case OP_AMOMINU: case OP_AMOMAXU:
+            case OP_AMO_BAD: {
+                // We don't implement load/store from UART or CLNT with RV32A here.
+                uint32_t addy = rs1 - state->mem_offset;
+                if (!RV32IMA_IN_RAM(state, addy, 4)) {
+                    trap = (7 + 1); // Store/AMO access fault
+                    rval = addy + state->mem_offset;
+                    break;
+                }
+                // Every read-modify-write is one host atomic, so that harts
+                // on other threads see it whole.
                 // Referenced a little bit of https://github.com/franzflasch/riscv_em/blob/master/src/core/core.c
-                uint32_t dowrite = 1;
-                switch (irmid) {
-                case 2: // LR.W (0b00010)
-                    dowrite = 0;
-                    CSR(EXTRAFLAGS) = (CSR(EXTRAFLAGS) & 0x07) | (rs1 << 3);
+                uint32_t *word = (uint32_t *)MEM(addy);
+                uint32_t written = 1;
+                switch (in->op) {
+                case OP_LR:
+                    rval = state->lr_value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+                    written = 0;
+                    CSR(EXTRAFLAGS) = (CSR(EXTRAFLAGS) & 0x07) | (addy << 3);
+                    break;
+                case OP_SC: // (Make sure we have a slot, and, it's valid)
+                    rval = (CSR(EXTRAFLAGS) >> 3 != (addy & 0x1fffffff)); // Validate that our reservation slot is OK.
+                    if (!rval && state->harts) {
+                        // SMP: also fail if another hart changed the word since LR.
+                        uint32_t expect = state->lr_value;
+                        rval = !__atomic_compare_exchange_n(word, &expect, rs2, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+                    } else if (!rval) {
+                        *word = rs2;
+                    }
+                    written = !rval; // Only write if slot is valid.
                     break;
-                case 3:                                                  // SC.W (0b00011) (Make sure we have a slot, and, it's valid)
-                    rval = (CSR(EXTRAFLAGS) >> 3 != (rs1 & 0x1fffffff)); // Validate that our reservation slot is OK.
-                    dowrite = !rval;                                     // Only write if slot is valid.
+                case OP_AMOSWAP: rval = __atomic_exchange_n(word, rs2, __ATOMIC_SEQ_CST); break;
+                case OP_AMOADD: rval = __atomic_fetch_add(word, rs2, __ATOMIC_SEQ_CST); break;
+                case OP_AMOXOR: rval = __atomic_fetch_xor(word, rs2, __ATOMIC_SEQ_CST); break;
+                case OP_AMOAND: rval = __atomic_fetch_and(word, rs2, __ATOMIC_SEQ_CST); break;
+                case OP_AMOOR: rval = __atomic_fetch_or(word, rs2, __ATOMIC_SEQ_CST); break;
+                case OP_AMOMIN: case OP_AMOMAX: case OP_AMOMINU: case OP_AMOMAXU: {
+                    uint32_t val;
+                    rval = __atomic_load_n(word, __ATOMIC_RELAXED);
+                    do {
+                        switch (in->op) {
+                        case OP_AMOMIN: val = ((int32_t)rs2 < (int32_t)rval) ? rs2 : rval; break;
+                        case OP_AMOMAX: val = ((int32_t)rs2 > (int32_t)rval) ? rs2 : rval; break;
+                        case OP_AMOMINU: val = (rs2 < rval) ? rs2 : rval; break;
+                        default: val = (rs2 > rval) ? rs2 : rval; break;
+                        }
+                    } while (!__atomic_compare_exchange_n(word, &rval, val, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
                     break;
-                case 1:
-                    break; // AMOSWAP.W (0b00001)
-                case 0: rs2 += rval; break; // AMOADD.W (0b00000)
-                case 4: rs2 ^= rval; break; // AMOXOR.W (0b00100)
-                case 12: rs2 &= rval; break; // AMOAND.W (0b01100)
-                case 8: rs2 |= rval; break; // AMOOR.W (0b01000)
-                case 16: rs2 = ((int32_t)rs2 < (int32_t)rval) ? rs2 : rval; break; // AMOMIN.W (0b10000)
-                case 20: rs2 = ((int32_t)rs2 > (int32_t)rval) ? rs2 : rval; break; // AMOMAX.W (0b10100)
-                case 24: rs2 = (rs2 < rval) ? rs2 : rval; break; // AMOMINU.W (0b11000)
-                case 28: rs2 = (rs2 > rval) ? rs2 : rval; break; // AMOMAXU.W (0b11100)
+                }
                 default:
                     trap = (2 + 1);
-                    dowrite = 0;
+                    written = 0;
                     break; // Not supported.
                 }
-                if (dowrite)
-                    *(uint32_t *)MEM(rs1) = rs2;
+                if (written && state->icache)
+                    rv32ima_icache_store(state->icache, addy);
+                break;
+            }
+            default:
+                trap = (2 + 1); // Fault: Invalid opcode.
             }
-            break;
-        }
-        default:
-            trap = (2 + 1); // Fault: Invalid opcode.
-        }
 
-        // If there was a trap, do NOT allow register writeback.
-        if (trap)
-            goto cycle_end;
+            // If there was a trap, do NOT allow register writeback.
+            if (trap)
+                goto cycle_end;
 
-        if (rdid) {
-            state->regs[rdid] = rval;
+            if (rdid) {
+                state->regs[rdid] = rval;
+            }
         }
-    }
 
-    pc += 4;
+        pc += 4;
+
+    cycle_end:
+        if (!(trap & 0x80000000) && ++cycle == 0)
+            CSR(CYCLEH)++;
 
-cycle_end:
-    // Handle traps and interrupts.
-    if (trap) {
-        if (trap & 0x80000000) { // It's an interrupt, not a trap.
-            CSR(MCAUSE) = trap;
-            CSR(MTVAL) = 0;
-            pc += 4; // PC needs to point to where the PC will return to.
-        } else {
-            CSR(MCAUSE) = trap - 1;
-            CSR(MTVAL) = (trap > 5 && trap <= 8) ? rval : pc;
-        }
-        CSR(MEPC) = pc;
-        // On an interrupt, the system moves current MIE into MPIE
-        CSR(MSTATUS) = ((CSR(MSTATUS) & 0x08) << 4) | ((CSR(EXTRAFLAGS) & 3) << 11);
-        pc = (CSR(MTVEC) - 4);
+        // Handle traps and interrupts.
+        if (trap) {
+            if (trap & 0x80000000) { // It's an interrupt, not a trap.
+                CSR(MCAUSE) = trap;
+                CSR(MTVAL) = 0;
+                pc += 4; // PC needs to point to where the PC will return to.
+            } else {
+                CSR(MCAUSE) = trap - 1;
+                CSR(MTVAL) = (trap > 5 && trap <= 8) ? rval : pc;
+            }
+            CSR(MEPC) = pc;
+            // On an interrupt, the system moves current MIE into MPIE
+            CSR(MSTATUS) = ((CSR(MSTATUS) & 0x08) << 4) | ((CSR(EXTRAFLAGS) & 3) << 11);
+            pc = (CSR(MTVEC) - 4);
 
-        // If trapping, always enter machine mode.
-        CSR(EXTRAFLAGS) |= 3;
+            // If trapping, always enter machine mode.
+            CSR(EXTRAFLAGS) |= 3;
 
-        trap = 0;
-        pc += 4;
+            trap = 0;
+            pc += 4;
+            sync = 1;
+        }
+
+        if (halt && pc == halt_pc)
+            break;
     }
 
-    if (CSR(CYCLEL) > cycle)
-        CSR(CYCLEH)++;
+done:
+    CSR(TIMERL) = (uint32_t)timer;
+    CSR(TIMERH) = timer >> 32;
     CSR(CYCLEL) = cycle;
     CSR(PC) = pc;
-    return 0;
+    if (executed)
+        *executed = n;
+    return ret;
+}
+
+static inline int32_t rv32ima_step(struct CPUState *state, uint32_t elapsedUs) {
+    return rv32ima_run(state, elapsedUs, 1, NULL);
 }
@@ -0,0 +1,185 @@
+// Regression tests of the mini-rv32ima engines (make test).
+//
+// Built like bench.c, once per engine, and with AddressSanitizer. Each test
+// runs a small guest assembled with bench.c's encoding macros and checks
+// the registers and memory it ends with.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mini-rv32ima.h"
+
+#define TEST_RAM (1024 * 1024)
+
+#define R_TYPE(f7, rs2, rs1, f3, rd, op) ((f7) << 25 | (rs2) << 20 | (rs1) << 15 | (f3) << 12 | (rd) << 7 | (op))
+#define I_TYPE(imm, rs1, f3, rd, op) (((uint32_t)(imm) & 0xfff) << 20 | (rs1) << 15 | (f3) << 12 | (rd) << 7 | (op))
+#define S_TYPE(imm, rs2, rs1, f3) \
+    ((((uint32_t)(imm) >> 5) & 0x7f) << 25 | (rs2) << 20 | (rs1) << 15 | (f3) << 12 | ((imm) & 0x1f) << 7 | 0x23)
+#define B_TYPE(imm, rs2, rs1, f3) \
+    ((((uint32_t)(imm) >> 12) & 1) << 31 | (((uint32_t)(imm) >> 5) & 0x3f) << 25 | (rs2) << 20 | (rs1) << 15 | \
+     (f3) << 12 | (((uint32_t)(imm) >> 1) & 0xf) << 8 | (((uint32_t)(imm) >> 11) & 1) << 7 | 0x63)
+#define J_TYPE(imm, rd) \
+    ((((uint32_t)(imm) >> 20) & 1) << 31 | (((uint32_t)(imm) >> 1) & 0x3ff) << 21 | \
+     (((uint32_t)(imm) >> 11) & 1) << 20 | (((uint32_t)(imm) >> 12) & 0xff) << 12 | (rd) << 7 | 0x6f)
+
+#define LUI(rd, imm)       ((uint32_t)(imm) & 0xfffff000) | (rd) << 7 | 0x37
+#define ADDI(rd, rs1, imm) I_TYPE(imm, rs1, 0, rd, 0x13)
+#define ADD(rd, rs1, rs2)  R_TYPE(0, rs2, rs1, 0, rd, 0x33)
+#define SH(rs2, rs1, imm)  S_TYPE(imm, rs2, rs1, 1)
+#define SW(rs2, rs1, imm)  S_TYPE(imm, rs2, rs1, 2)
+#define BNE(rs1, rs2, ofs) B_TYPE(ofs, rs2, rs1, 1)
+#define JAL(rd, ofs)       J_TYPE(ofs, rd)
+#define RET                I_TYPE(0, RA, 0, Z, 0x67)
+#define FENCE_I            I_TYPE(0, 0, 1, 0, 0x0f)
+
+static int failures;
+static struct rv32ima_icache icache;
+
+// Runs the guest in ram from pc 0 until it returns there, with a decode
+// cache over [text_lo, text_hi) exactly as given (main.c passes an ELF's
+// text segment, which need not be page aligned). With the JIT, the first
+// jit_used bytes of its buffer count as taken, to compile near the end.
+static void run(const char * name, uint8_t * ram, uint32_t text_lo, uint32_t text_hi, uint32_t jit_used,
+                struct CPUState * state) {
+    memset(state, 0, sizeof(*state));
+    state->mem = ram;
+    state->mem_size = TEST_RAM;
+    state->regs[SP] = TEST_RAM;
+    state->halt_pc = 0;
+    state->halt_enabled = 1;
+    if (rv32ima_icache_init(&icache, text_lo, text_hi - text_lo) == 0) {
+        state->icache = &icache;
+#ifdef RV32IMA_JIT
+        icache.jit_used = jit_used;
+#else
+        (void)jit_used;
+#endif
+    }
+    int ret;
+    do {
+        ret = rv32ima_run(state, 1, UINT32_MAX, NULL);
+    } while (ret == 0 && state->csrs[PC] != 0);
+    if (state->icache) {
+        rv32ima_icache_free(&icache);
+    }
+    if (ret != 0) {
+        printf("FAIL %s: stopped with ret=%d at pc %08x\n", name, ret, state->csrs[PC]);
+        failures++;
+    }
+}
+
+static void expect(const char * name, const char * what, uint32_t got, uint32_t want) {
+    if (got != want) {
+        printf("FAIL %s: %s is %u, expected %u\n", name, what, got, want);
+        failures++;
+    }
+}
+
+// A function in the last, partial page of the text is called until it is
+// hot (compiled by the threaded engine and the JIT), rewritten, FENCE.I'd
+// and called again: the new code must run, and nothing may touch the
+// decode cache beyond its end.
+static void test_unaligned_text(uint8_t * ram) {
+    const char * name = "unaligned_text";
+    const uint32_t text_lo = 0x24, text_hi = 0x1234, f = text_hi - 8;
+    uint32_t * p = (uint32_t *)ram, * start;
+    struct CPUState state;
+
+    memset(ram, 0, TEST_RAM);
+    *p++ = JAL(Z, text_lo);
+    p = (uint32_t *)(ram + text_lo);
+    *p++ = ADDI(S0, RA, 0);
+    *p++ = ADDI(T2, Z, 1000);
+    start = p; // S1 += f() 1000 times
+    *p = JAL(RA, f - (uint32_t)((uint8_t *)p - ram)); p++;
+    *p++ = ADD(S1, S1, A0);
+    *p++ = ADDI(T2, T2, -1);
+    *p = BNE(T2, Z, (int32_t)((uint8_t *)start - (uint8_t *)p)); p++;
+    *p++ = LUI(T0, f);
+    *p++ = ADDI(T0, T0, f & 0xfff);
+    *p++ = LUI(T1, ADDI(A0, Z, 2) + 0x800);
+    *p++ = ADDI(T1, T1, ADDI(A0, Z, 2) & 0xfff);
+    *p++ = SW(T1, T0, 0);
+    *p++ = FENCE_I;
+    *p++ = ADDI(T2, Z, 1000);
+    start = p; // S2 += f() 1000 times
+    *p = JAL(RA, f - (uint32_t)((uint8_t *)p - ram)); p++;
+    *p++ = ADD(S2, S2, A0);
+    *p++ = ADDI(T2, T2, -1);
+    *p = BNE(T2, Z, (int32_t)((uint8_t *)start - (uint8_t *)p)); p++;
+    *p++ = ADDI(RA, S0, 0);
+    *p++ = RET;
+    p = (uint32_t *)(ram + f);
+    *p++ = ADDI(A0, Z, 1);
+    *p++ = RET;
+
+    run(name, ram, text_lo, text_hi, 0, &state);
+    expect(name, "s1 (before the rewrite)", state.regs[S1], 1000);
+    expect(name, "s2 (after the rewrite)", state.regs[S2], 2000);
+}
+
+// A block of nothing but stores (SH, the op with the longest native code)
+// is compiled into the very end of the JIT buffer: the code must fit in
+// what rv32ima_jit_compile() reserves for it, and the stores must land.
+static void test_store_block(uint8_t * ram) {
+    const char * name = "store_block";
+    const uint32_t f = 0x100, calls = 300; // Past RV32IMA_JIT_THRESHOLD
+    uint32_t * p = (uint32_t *)ram, * start;
+    uint32_t jit_used = 0;
+    struct CPUState state;
+
+    memset(ram, 0, TEST_RAM);
+    *p++ = ADDI(S0, RA, 0);
+    *p++ = ADDI(T2, Z, calls);
+    start = p; // f(t2) until t2 is 0
+    *p = JAL(RA, f - (uint32_t)((uint8_t *)p - ram)); p++;
+    *p++ = ADDI(T2, T2, -1);
+    *p = BNE(T2, Z, (int32_t)((uint8_t *)start - (uint8_t *)p)); p++;
+    *p++ = ADDI(RA, S0, 0);
+    *p++ = RET;
+    p = (uint32_t *)(ram + f);
+    for (int i = 1; i <= 64; i++) { // One whole block
+        *p++ = SH(T2, SP, -2 * i);
+    }
+    *p++ = RET;
+
+#ifdef RV32IMA_JIT
+    jit_used = (RV32IMA_JIT_SIZE - (64 + 2) * JIT_MAX_OP_BYTES) & ~15u;
+#endif
+    run(name, ram, 0, 0x1000, jit_used, &state);
+    for (int i = 1; i <= 64; i++) {
+        uint16_t v;
+        memcpy(&v, ram + TEST_RAM - 2 * i, 2);
+        expect(name, "stored halfword", v, 1);
+    }
+#ifdef RV32IMA_JIT
+    if (icache.jit_used <= jit_used) {
+        printf("FAIL %s: the block was not compiled\n", name);
+        failures++;
+    }
+    if (icache.jit_used > RV32IMA_JIT_SIZE) {
+        printf("FAIL %s: native code ends %u bytes past the buffer\n", name, icache.jit_used - RV32IMA_JIT_SIZE);
+        failures++;
+    }
+#endif
+}
+
+int main(void) {
+    uint8_t * ram = malloc(TEST_RAM);
+    if (!ram) {
+        return 1;
+    }
+#if defined(RV32IMA_JIT)
+    const char * engine = "jit";
+#elif defined(RV32IMA_THREADED)
+    const char * engine = "threaded";
+#else
+    const char * engine = "switch";
+#endif
+    test_unaligned_text(ram);
+    test_store_block(ram);
+    printf("%s: %s\n", engine, failures ? "FAIL" : "ok");
+    free(ram);
+    return failures != 0;
+}
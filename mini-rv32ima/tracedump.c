@@ -0,0 +1,75 @@
+// Decoder for mini-rv32ima binary traces (./mini-rv32ima -T <file> ...).
+//
+// Replays the records in the ring and prints the state after each one in
+// the same text format as DumpState() in main.c (without the stack dump:
+// the trace has no memory contents), plus the memory address for loads,
+// stores and AMOs.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mini-rv32ima-trace.h"
+
+static void dump(const struct rv32ima_trace_record *r, const uint32_t *regs) {
+    printf(" PC:%08x [%08x]", r->pc, r->ir);
+    if (r->flags & RV32IMA_TRACE_MEM) {
+        printf(" mem:%08x", r->mem_addr);
+    }
+    printf("\n");
+    printf("  Z:%08x  ra:%08x  sp:%08x  gp:%08x\n", regs[0], regs[1], regs[2], regs[3]);
+    printf(" tp:%08x  t0:%08x  t1:%08x  t2:%08x\n", regs[4], regs[5], regs[6], regs[7]);
+    printf(" s0:%08x  s1:%08x  a0:%08x  a1:%08x\n", regs[8], regs[9], regs[10], regs[11]);
+    printf(" a2:%08x  a3:%08x  a4:%08x  a5:%08x\n", regs[12], regs[13], regs[14], regs[15]);
+    printf(" a6:%08x  a7:%08x  s2:%08x  s3:%08x\n", regs[16], regs[17], regs[18], regs[19]);
+    printf(" s4:%08x  s5:%08x  s6:%08x  s7:%08x\n", regs[20], regs[21], regs[22], regs[23]);
+    printf(" s8:%08x  s9:%08x s10:%08x s11:%08x\n", regs[24], regs[25], regs[26], regs[27]);
+    printf(" t3:%08x  t4:%08x  t5:%08x  t6:%08x\n", regs[28], regs[29], regs[30], regs[31]);
+    printf("CYCLEL:%08x CYCLEH:%08x EXTRAFLAGS:%08x\n", r->cyclel, r->cycleh, r->extraflags);
+    printf("\n");
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        printf("Usage: ./tracedump <trace_file> [<last_n>]\n");
+        printf("- Prints the state after every instruction kept in the trace (or the last <last_n>).\n");
+        return 0;
+    }
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error: trace file \"%s\" not found\n", argv[1]);
+        return 1;
+    }
+    const struct rv32ima_trace_header * t = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (t == MAP_FAILED || (size_t)st.st_size < sizeof(*t) || t->magic != RV32IMA_TRACE_MAGIC ||
+        t->version != RV32IMA_TRACE_VERSION || t->record_size != sizeof(struct rv32ima_trace_record) ||
+        t->capacity == 0 || (uint64_t)st.st_size < rv32ima_trace_size(t->capacity)) {
+        fprintf(stderr, "Error: \"%s\" is not a mini-rv32ima trace\n", argv[1]);
+        return 1;
+    }
+
+    uint64_t kept = t->count < t->capacity ? t->count : t->capacity;
+    uint64_t first = t->count - kept;
+    uint64_t skip = 0;
+    if (argc > 2) {
+        uint64_t last = strtoull(argv[2], NULL, 0);
+        skip = last < kept ? kept - last : 0;
+    }
+    uint32_t regs[32];
+    memcpy(regs, t->regs, sizeof(regs));
+    printf("trace: %llu instructions, %llu kept\n", (unsigned long long)t->count, (unsigned long long)kept);
+    for (uint64_t i = first; i < t->count; i ++) {
+        const struct rv32ima_trace_record * r = &t->ring[i % t->capacity];
+        rv32ima_trace_apply(regs, r);
+        if (i - first >= skip) {
+            dump(r, regs);
+        }
+    }
+    return 0;
+}
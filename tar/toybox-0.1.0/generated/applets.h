@@ -0,0 +1,53 @@
+// Generated by scripts/mkapplets.py, do not edit.
+
+#define APPLET_SEED 96u
+#define APPLET_BITS 8
+
+static const unsigned short applet_hash[1<<APPLET_BITS] = {
+	[14] = 0 USE_PATCH(+TOY_patch+1),
+	[19] = 0 USE_COUNT(+TOY_count+1),
+	[22] = 0 USE_NETCAT(+TOY_netcat+1),
+	[26] = 0 USE_TEE(+TOY_tee+1),
+	[30] = 0 USE_HELLO(+TOY_hello+1),
+	[34] = 0 USE_READLINK(+TOY_readlink+1),
+	[36] = 0 USE_DMESG(+TOY_dmesg+1),
+	[37] = 0 USE_YES(+TOY_yes+1),
+	[38] = 0 USE_SORT(+TOY_sort+1),
+	[46] = 0 USE_TOYSH(+TOY_toysh+1),
+	[52] = 0 USE_PWD(+TOY_pwd+1),
+	[54] = 0 USE_TRUE(+TOY_true+1),
+	[57] = 0 USE_UNAME(+TOY_uname+1),
+	[58] = 0 USE_HELP(+TOY_help+1),
+	[63] = 0 USE_RMDIR(+TOY_rmdir+1),
+	[67] = 0 USE_TOYSH(+TOY_exit+1),
+	[68] = 0 USE_CHROOT(+TOY_chroot+1),
+	[72] = 0 USE_ONEIT(+TOY_oneit+1),
+	[77] = 0 USE_ECHO(+TOY_echo+1),
+	[82] = 0 USE_TOUCH(+TOY_touch+1),
+	[87] = 0 USE_BASENAME(+TOY_basename+1),
+	[95] = 0 USE_MDEV(+TOY_mdev+1),
+	[106] = 0 USE_TOYSH(+TOY_sh+1),
+	[113] = 0 USE_SHA1SUM(+TOY_sha1sum+1),
+	[114] = TOY_toybox+1,
+	[115] = 0 USE_NETCAT(+TOY_nc+1),
+	[118] = 0 USE_DF(+TOY_df+1),
+	[120] = 0 USE_SED(+TOY_sed+1),
+	[128] = 0 USE_MKE2FS(+TOY_mke2fs+1),
+	[130] = 0 USE_CP(+TOY_cp+1),
+	[136] = 0 USE_SYNC(+TOY_sync+1),
+	[141] = 0 USE_SEQ(+TOY_seq+1),
+	[150] = 0 USE_TOYSH(+TOY_cd+1),
+	[155] = 0 USE_TOYSH(+TOY_hash+1),
+	[159] = 0 USE_FALSE(+TOY_false+1),
+	[179] = 0 USE_SLEEP(+TOY_sleep+1),
+	[188] = 0 USE_DIRNAME(+TOY_dirname+1),
+	[189] = 0 USE_BZCAT(+TOY_bzcat+1),
+	[199] = 0 USE_CKSUM(+TOY_cksum+1),
+	[203] = 0 USE_CAT(+TOY_cat+1),
+	[213] = 0 USE_CATV(+TOY_catv+1),
+	[227] = 0 USE_MKFIFO(+TOY_mkfifo+1),
+	[239] = 0 USE_CHVT(+TOY_chvt+1),
+	[244] = 0 USE_WHICH(+TOY_which+1),
+	[246] = 0 USE_MKSWAP(+TOY_mkswap+1),
+	[249] = 0 USE_TTY(+TOY_tty+1),
+};
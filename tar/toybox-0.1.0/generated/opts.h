@@ -0,0 +1,542 @@
+// Generated by scripts/mkopts.py, do not edit.
+
+#define OPTSPEC_toybox 0
+
+#define OPTSPEC_basename (&optspec_basename)
+#if CFG_BASENAME
+static struct optspec optspec_basename = {0, 0, 1, 2, 1, 0, 0, 0,
+	{0}
+};
+#endif
+
+#define OPTSPEC_bzcat (&optspec_bzcat)
+#if CFG_BZCAT
+static struct optdef optdef_bzcat[] = {
+	{{0x1, 0x0, 0x0}, 'l', '#', 0, 0},
+	{{0x2, 0x0, 0x0}, 's', '#', 0, 1},
+	{{0x4, 0x0, 0x0}, 'X', ':', 0, 2},
+	{{0x8, 0x0, 0x0}, 'j', '#', 0, 3},
+};
+static struct optspec optspec_bzcat = {optdef_bzcat, 0, 0, INT_MAX, 0, 0, 0, 4,
+	{[88] = 3, [106] = 4, [108] = 1, [115] = 2}
+};
+#endif
+
+#define OPTSPEC_cat (&optspec_cat)
+#if CFG_CAT
+static struct optdef optdef_cat[] = {
+	{{0x1, 0x0, 0x0}, 'u', 0, 0, -1},
+};
+static struct optspec optspec_cat = {optdef_cat, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[117] = 1}
+};
+#endif
+
+#define OPTSPEC_catv (&optspec_catv)
+#if CFG_CATV
+static struct optdef optdef_catv[] = {
+	{{0x1, 0x0, 0x0}, 'e', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 't', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'v', 0, 0, -1},
+};
+static struct optspec optspec_catv = {optdef_catv, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[101] = 1, [116] = 2, [118] = 3}
+};
+#endif
+
+#define OPTSPEC_chroot (&optspec_chroot)
+#if CFG_CHROOT
+static struct optspec optspec_chroot = {0, 0, 1, INT_MAX, 2, 0, 0, 0,
+	{0}
+};
+#endif
+
+#define OPTSPEC_chvt (&optspec_chvt)
+#if CFG_CHVT
+static struct optspec optspec_chvt = {0, 0, 1, INT_MAX, 1, 0, 0, 0,
+	{0}
+};
+#endif
+
+#define OPTSPEC_cksum (&optspec_cksum)
+#if CFG_CKSUM
+static struct optdef optdef_cksum[] = {
+	{{0x1, 0x0, 0x0}, 'N', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'L', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'P', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, 'I', 0, 0, -1},
+};
+static struct optspec optspec_cksum = {optdef_cksum, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[73] = 4, [76] = 2, [78] = 1, [80] = 3}
+};
+#endif
+
+#define OPTSPEC_count 0
+
+#define OPTSPEC_cp (&optspec_cp)
+#if CFG_CP
+static struct optdef optdef_cp[] = {
+	{{0x1, 0x0, 0x0}, 'f', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'i', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'P', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, 'L', 0, 0, -1},
+	{{0x10, 0x0, 0x0}, 'H', 0, 0, -1},
+	{{0x2e0, 0x0, 0x0}, 'a', 0, 0, -1},
+	{{0x40, 0x0, 0x0}, 'p', 0, 0, -1},
+	{{0x80, 0x0, 0x0}, 'd', 0, 0, -1},
+	{{0x300, 0x0, 0x0}, 'R', 0, 0, -1},
+	{{0x200, 0x0, 0x0}, 'r', 0, 0, -1},
+	{{0x400, 0x0, 0x0}, 'l', 0, 0, -1},
+	{{0x800, 0x0, 0x0}, 's', 0, 0, -1},
+	{{0x1000, 0x0, 0x0}, 'v', 0, 0, -1},
+	{{0x2000, 0x0, 0x0}, 'j', '#', 0, 0},
+};
+static struct optspec optspec_cp = {optdef_cp, 0, 2, INT_MAX, 0, 0, 0, 1,
+	{[72] = 5, [76] = 4, [80] = 3, [82] = 9, [97] = 6, [100] = 8, [102] = 1, [105] = 2, [106] = 14, [108] = 11, [112] = 7, [114] = 10, [115] = 12, [118] = 13}
+};
+#endif
+
+#define OPTSPEC_df (&optspec_df)
+#if CFG_DF
+static struct optdef optdef_df[] = {
+	{{0x1, 0x0, 0x0}, 'a', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 't', '*', 0, 0},
+	{{0x4, 0x0, 0x0}, 'k', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, 'P', 0, 0, -1},
+};
+static struct optspec optspec_df = {optdef_df, 0, 0, INT_MAX, 0, 0, 0, 1,
+	{[80] = 4, [97] = 1, [107] = 3, [116] = 2}
+};
+#endif
+
+#define OPTSPEC_dirname (&optspec_dirname)
+#if CFG_DIRNAME
+static struct optspec optspec_dirname = {0, 0, 1, 1, 1, 0, 0, 0,
+	{0}
+};
+#endif
+
+#define OPTSPEC_dmesg (&optspec_dmesg)
+#if CFG_DMESG
+static struct optdef optdef_dmesg[] = {
+	{{0x1, 0x0, 0x0}, 'c', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'n', '#', 0, 0},
+	{{0x4, 0x0, 0x0}, 's', '#', 0, 1},
+	{{0x8, 0x0, 0x0}, 'w', 0, 0, -1},
+	{{0x10, 0x0, 0x0}, 'l', '#', 0, 2},
+};
+static struct optspec optspec_dmesg = {optdef_dmesg, 0, 0, INT_MAX, 0, 0, 0, 3,
+	{[99] = 1, [108] = 5, [110] = 2, [115] = 3, [119] = 4}
+};
+#endif
+
+#define OPTSPEC_echo (&optspec_echo)
+#if CFG_ECHO
+static struct optdef optdef_echo[] = {
+	{{0x1, 0x0, 0x0}, 'n', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'e', 0, 0, -1},
+};
+static struct optspec optspec_echo = {optdef_echo, 0, 0, INT_MAX, 1, 1, 0, 0,
+	{[101] = 2, [110] = 1}
+};
+#endif
+
+#define OPTSPEC_false 0
+
+#define OPTSPEC_hello (&optspec_hello)
+#if CFG_HELLO
+static struct optdef optdef_hello[] = {
+	{{0x1, 0x0, 0x0}, 'a', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'b', ':', 0, 0},
+	{{0x4, 0x0, 0x0}, 'c', '#', 0, 1},
+	{{0x8, 0x0, 0x0}, 'd', '*', 0, 2},
+	{{0x10, 0x0, 0x0}, 'e', '@', 0, 3},
+};
+static struct optspec optspec_hello = {optdef_hello, 0, 0, INT_MAX, 0, 0, 0, 4,
+	{[97] = 1, [98] = 2, [99] = 3, [100] = 4, [101] = 5}
+};
+#endif
+
+#define OPTSPEC_help (&optspec_help)
+#if CFG_HELP
+static struct optspec optspec_help = {0, 0, 1, INT_MAX, 1, 0, 0, 0,
+	{0}
+};
+#endif
+
+#define OPTSPEC_mdev (&optspec_mdev)
+#if CFG_MDEV
+static struct optdef optdef_mdev[] = {
+	{{0x1, 0x0, 0x0}, 's', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'd', 0, 0, -1},
+};
+static struct optspec optspec_mdev = {optdef_mdev, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[100] = 2, [115] = 1}
+};
+#endif
+
+#define OPTSPEC_mke2fs (&optspec_mke2fs)
+#if CFG_MKE2FS
+static struct optdef optdef_mke2fs[] = {
+	{{0x1, 0x0, 0x0}, 'b', '#', 0, 0},
+	{{0x2, 0x0, 0x0}, 'i', '#', 0, 1},
+	{{0x4, 0x0, 0x0}, 'N', '#', 0, 2},
+	{{0x8, 0x0, 0x0}, 'm', '#', 0, 3},
+	{{0x10, 0x0, 0x0}, 'q', 0, 0, -1},
+	{{0x20, 0x0, 0x0}, 'n', 0, 0, -1},
+	{{0x40, 0x0, 0x0}, 'F', 0, 0, -1},
+	{{0x80, 0x0, 0x0}, 'g', ':', 0, 4},
+};
+static struct optspec optspec_mke2fs = {optdef_mke2fs, 0, 1, 2, 0, 0, 0, 5,
+	{[70] = 7, [78] = 3, [98] = 1, [103] = 8, [105] = 2, [109] = 4, [110] = 6, [113] = 5}
+};
+#endif
+
+#define OPTSPEC_mkfifo (&optspec_mkfifo)
+#if CFG_MKFIFO
+static struct optdef optdef_mkfifo[] = {
+	{{0x1, 0x0, 0x0}, 'm', ':', 0, 0},
+};
+static struct optspec optspec_mkfifo = {optdef_mkfifo, 0, 1, INT_MAX, 0, 0, 0, 1,
+	{[109] = 1}
+};
+#endif
+
+#define OPTSPEC_mkswap (&optspec_mkswap)
+#if CFG_MKSWAP
+static struct optspec optspec_mkswap = {0, 0, 1, 2, 1, 0, 0, 0,
+	{0}
+};
+#endif
+
+#define OPTSPEC_nc (&optspec_nc)
+#if CFG_NETCAT
+#if CFG_NETCAT_LISTEN
+static struct optdef optdef_nc[] = {
+	{{0x1, 0x0, 0x0}, 'f', ':', 0, 0},
+	{{0x2, 0x0, 0x0}, 'q', '#', 0, 1},
+	{{0x4, 0x0, 0x0}, 's', ':', 0, 2},
+	{{0x8, 0x0, 0x0}, 'p', '#', 0, 3},
+	{{0x10, 0x0, 0x0}, 'w', '#', 0, 4},
+	{{0x20, 0x0, 0x0}, 'L', 0, 2, -1},
+	{{0x40, 0x0, 0x0}, 'l', 0, 2, -1},
+	{{0x80, 0x0, 0x0}, 't', 0, 0, -1},
+	{{0x100, 0x0, 0x0}, 'j', '#', 0, 5},
+	{{0x200, 0x0, 0x0}, 'F', ':', 0, 6},
+};
+static struct optspec optspec_nc = {optdef_nc, 0, 0, INT_MAX, 0, 0, 0, 7,
+	{[70] = 10, [76] = 6, [102] = 1, [106] = 9, [108] = 7, [112] = 4, [113] = 2, [115] = 3, [116] = 8, [119] = 5}
+};
+#else
+static struct optdef optdef_nc[] = {
+	{{0x1, 0x0, 0x0}, 'f', ':', 0, 0},
+	{{0x2, 0x0, 0x0}, 'q', '#', 0, 1},
+	{{0x4, 0x0, 0x0}, 's', ':', 0, 2},
+	{{0x8, 0x0, 0x0}, 'p', '#', 0, 3},
+	{{0x10, 0x0, 0x0}, 'w', '#', 0, 4},
+};
+static struct optspec optspec_nc = {optdef_nc, 0, 0, INT_MAX, 0, 0, 0, 5,
+	{[102] = 1, [112] = 4, [113] = 2, [115] = 3, [119] = 5}
+};
+#endif
+#endif
+
+#define OPTSPEC_netcat (&optspec_netcat)
+#if CFG_NETCAT
+#if CFG_NETCAT_LISTEN
+static struct optdef optdef_netcat[] = {
+	{{0x1, 0x0, 0x0}, 'f', ':', 0, 0},
+	{{0x2, 0x0, 0x0}, 'q', '#', 0, 1},
+	{{0x4, 0x0, 0x0}, 's', ':', 0, 2},
+	{{0x8, 0x0, 0x0}, 'p', '#', 0, 3},
+	{{0x10, 0x0, 0x0}, 'w', '#', 0, 4},
+	{{0x20, 0x0, 0x0}, 'L', 0, 2, -1},
+	{{0x40, 0x0, 0x0}, 'l', 0, 2, -1},
+	{{0x80, 0x0, 0x0}, 't', 0, 0, -1},
+	{{0x100, 0x0, 0x0}, 'j', '#', 0, 5},
+	{{0x200, 0x0, 0x0}, 'F', ':', 0, 6},
+};
+static struct optspec optspec_netcat = {optdef_netcat, 0, 0, INT_MAX, 0, 0, 0, 7,
+	{[70] = 10, [76] = 6, [102] = 1, [106] = 9, [108] = 7, [112] = 4, [113] = 2, [115] = 3, [116] = 8, [119] = 5}
+};
+#else
+static struct optdef optdef_netcat[] = {
+	{{0x1, 0x0, 0x0}, 'f', ':', 0, 0},
+	{{0x2, 0x0, 0x0}, 'q', '#', 0, 1},
+	{{0x4, 0x0, 0x0}, 's', ':', 0, 2},
+	{{0x8, 0x0, 0x0}, 'p', '#', 0, 3},
+	{{0x10, 0x0, 0x0}, 'w', '#', 0, 4},
+};
+static struct optspec optspec_netcat = {optdef_netcat, 0, 0, INT_MAX, 0, 0, 0, 5,
+	{[102] = 1, [112] = 4, [113] = 2, [115] = 3, [119] = 5}
+};
+#endif
+#endif
+
+#define OPTSPEC_oneit (&optspec_oneit)
+#if CFG_ONEIT
+static struct optdef optdef_oneit[] = {
+	{{0x1, 0x0, 0x0}, 'p', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'c', ':', 0, 0},
+};
+static struct optspec optspec_oneit = {optdef_oneit, 0, 1, INT_MAX, 1, 0, 0, 1,
+	{[99] = 2, [112] = 1}
+};
+#endif
+
+#define OPTSPEC_patch (&optspec_patch)
+#if CFG_PATCH
+static struct optdef optdef_patch[] = {
+	{{0x1, 0x0, 0x0}, 'R', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'i', ':', 0, 0},
+	{{0x4, 0x0, 0x0}, 'p', '#', 0, 1},
+	{{0x8, 0x0, 0x0}, 'u', 0, 0, -1},
+	{{0x10, 0x0, 0x0}, 'j', '#', 0, 2},
+};
+static struct optspec optspec_patch = {optdef_patch, 0, 0, INT_MAX, 0, 0, 0, 3,
+	{[82] = 1, [105] = 2, [106] = 5, [112] = 3, [117] = 4}
+};
+#endif
+
+#define OPTSPEC_pwd 0
+
+#define OPTSPEC_readlink (&optspec_readlink)
+#if CFG_READLINK
+static struct optdef optdef_readlink[] = {
+	{{0x1, 0x0, 0x0}, 'f', 0, 0, -1},
+};
+static struct optspec optspec_readlink = {optdef_readlink, 0, 1, INT_MAX, 0, 0, 0, 0,
+	{[102] = 1}
+};
+#endif
+
+#define OPTSPEC_rmdir (&optspec_rmdir)
+#if CFG_RMDIR
+static struct optdef optdef_rmdir[] = {
+	{{0x1, 0x0, 0x0}, 'p', 0, 0, -1},
+};
+static struct optspec optspec_rmdir = {optdef_rmdir, 0, 1, INT_MAX, 0, 0, 0, 0,
+	{[112] = 1}
+};
+#endif
+
+#define OPTSPEC_sed (&optspec_sed)
+#if CFG_SED
+static struct optdef optdef_sed[] = {
+	{{0x1, 0x0, 0x0}, 'e', '*', 0, 0},
+	{{0x2, 0x0, 0x0}, 'n', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'r', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, 'i', 0, 0, -1},
+};
+static struct optspec optspec_sed = {optdef_sed, 0, 0, INT_MAX, 0, 0, 0, 1,
+	{[101] = 1, [105] = 4, [110] = 2, [114] = 3}
+};
+#endif
+
+#define OPTSPEC_seq (&optspec_seq)
+#if CFG_SEQ
+static struct optspec optspec_seq = {0, 0, 1, 3, 1, 1, 0, 0,
+	{0}
+};
+#endif
+
+#define OPTSPEC_sha1sum (&optspec_sha1sum)
+#if CFG_SHA1SUM
+static struct optdef optdef_sha1sum[] = {
+	{{0x1, 0x0, 0x0}, 'j', '#', 0, 0},
+};
+static struct optspec optspec_sha1sum = {optdef_sha1sum, 0, 0, INT_MAX, 0, 0, 0, 1,
+	{[106] = 1}
+};
+#endif
+
+#define OPTSPEC_sleep (&optspec_sleep)
+#if CFG_SLEEP
+static struct optspec optspec_sleep = {0, 0, 1, INT_MAX, 1, 0, 0, 0,
+	{0}
+};
+#endif
+
+#define OPTSPEC_sort (&optspec_sort)
+#if CFG_SORT
+#if CFG_SORT_BIG && CFG_SORT_PARALLEL
+static struct optdef optdef_sort[] = {
+	{{0x1, 0x0, 0x0}, 'n', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'u', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'r', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, 'i', 0, 0, -1},
+	{{0x10, 0x0, 0x0}, 'f', 0, 0, -1},
+	{{0x20, 0x0, 0x0}, 'd', 0, 0, -1},
+	{{0x40, 0x0, 0x0}, 'z', 0, 0, -1},
+	{{0x80, 0x0, 0x0}, 's', 0, 0, -1},
+	{{0x100, 0x0, 0x0}, 'c', 0, 0, -1},
+	{{0x200, 0x0, 0x0}, 'M', 0, 0, -1},
+	{{0x400, 0x0, 0x0}, 'g', 0, 0, -1},
+	{{0x800, 0x0, 0x0}, 'b', 0, 0, -1},
+	{{0x1000, 0x0, 0x0}, 't', ':', 0, 0},
+	{{0x2000, 0x0, 0x0}, 'k', '*', 0, 1},
+	{{0x4000, 0x0, 0x0}, 'o', ':', 0, 2},
+	{{0x8000, 0x0, 0x0}, 'm', 0, 0, -1},
+	{{0x10000, 0x0, 0x0}, 'T', ':', 0, 3},
+	{{0x20000, 0x0, 0x0}, 'S', ':', 0, 4},
+	{{0x40000, 0x0, 0x0}, -1, ':', 0, 5},
+};
+static struct longdef longdef_sort[] = {
+	{"parallel", 8, 18},
+	{0}
+};
+static struct optspec optspec_sort = {optdef_sort, longdef_sort, 0, INT_MAX, 0, 0, 0, 6,
+	{[77] = 10, [83] = 18, [84] = 17, [98] = 12, [99] = 9, [100] = 6, [102] = 5, [103] = 11, [105] = 4, [107] = 14, [109] = 16, [110] = 1, [111] = 15, [114] = 3, [115] = 8, [116] = 13, [117] = 2, [122] = 7}
+};
+#elif CFG_SORT_BIG && !CFG_SORT_PARALLEL
+static struct optdef optdef_sort[] = {
+	{{0x1, 0x0, 0x0}, 'n', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'u', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'r', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, 'i', 0, 0, -1},
+	{{0x10, 0x0, 0x0}, 'f', 0, 0, -1},
+	{{0x20, 0x0, 0x0}, 'd', 0, 0, -1},
+	{{0x40, 0x0, 0x0}, 'z', 0, 0, -1},
+	{{0x80, 0x0, 0x0}, 's', 0, 0, -1},
+	{{0x100, 0x0, 0x0}, 'c', 0, 0, -1},
+	{{0x200, 0x0, 0x0}, 'M', 0, 0, -1},
+	{{0x400, 0x0, 0x0}, 'g', 0, 0, -1},
+	{{0x800, 0x0, 0x0}, 'b', 0, 0, -1},
+	{{0x1000, 0x0, 0x0}, 't', ':', 0, 0},
+	{{0x2000, 0x0, 0x0}, 'k', '*', 0, 1},
+	{{0x4000, 0x0, 0x0}, 'o', ':', 0, 2},
+	{{0x8000, 0x0, 0x0}, 'm', 0, 0, -1},
+	{{0x10000, 0x0, 0x0}, 'T', ':', 0, 3},
+	{{0x20000, 0x0, 0x0}, 'S', ':', 0, 4},
+};
+static struct optspec optspec_sort = {optdef_sort, 0, 0, INT_MAX, 0, 0, 0, 5,
+	{[77] = 10, [83] = 18, [84] = 17, [98] = 12, [99] = 9, [100] = 6, [102] = 5, [103] = 11, [105] = 4, [107] = 14, [109] = 16, [110] = 1, [111] = 15, [114] = 3, [115] = 8, [116] = 13, [117] = 2, [122] = 7}
+};
+#elif !CFG_SORT_BIG && CFG_SORT_PARALLEL
+static struct optdef optdef_sort[] = {
+	{{0x1, 0x0, 0x0}, 'n', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'u', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'r', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, -1, ':', 0, 0},
+};
+static struct longdef longdef_sort[] = {
+	{"parallel", 8, 3},
+	{0}
+};
+static struct optspec optspec_sort = {optdef_sort, longdef_sort, 0, INT_MAX, 0, 0, 0, 1,
+	{[110] = 1, [114] = 3, [117] = 2}
+};
+#else
+static struct optdef optdef_sort[] = {
+	{{0x1, 0x0, 0x0}, 'n', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'u', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'r', 0, 0, -1},
+};
+static struct optspec optspec_sort = {optdef_sort, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[110] = 1, [114] = 3, [117] = 2}
+};
+#endif
+#endif
+
+#define OPTSPEC_sync 0
+
+#define OPTSPEC_tee (&optspec_tee)
+#if CFG_TEE
+static struct optdef optdef_tee[] = {
+	{{0x1, 0x0, 0x0}, 'a', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'i', 0, 0, -1},
+};
+static struct optspec optspec_tee = {optdef_tee, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[97] = 1, [105] = 2}
+};
+#endif
+
+#define OPTSPEC_touch (&optspec_touch)
+#if CFG_TOUCH
+static struct optdef optdef_touch[] = {
+	{{0x1, 0x0, 0x0}, 'a', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'c', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'm', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, 'r', ':', 0, 0},
+	{{0x10, 0x0, 0x0}, 't', ':', 0, 1},
+	{{0x20, 0x0, 0x0}, 'l', '#', 0, 2},
+};
+static struct optspec optspec_touch = {optdef_touch, 0, 0, INT_MAX, 0, 0, 0, 3,
+	{[97] = 1, [99] = 2, [108] = 6, [109] = 3, [114] = 4, [116] = 5}
+};
+#endif
+
+#define OPTSPEC_cd 0
+
+#define OPTSPEC_exit 0
+
+#define OPTSPEC_hash (&optspec_hash)
+#if CFG_TOYSH
+static struct optdef optdef_hash[] = {
+	{{0x1, 0x0, 0x0}, 'r', 0, 0, -1},
+};
+static struct optspec optspec_hash = {optdef_hash, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[114] = 1}
+};
+#endif
+
+#define OPTSPEC_sh (&optspec_sh)
+#if CFG_TOYSH
+static struct optdef optdef_sh[] = {
+	{{0x1, 0x0, 0x0}, 'i', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'c', ':', 0, 0},
+};
+static struct optspec optspec_sh = {optdef_sh, 0, 0, INT_MAX, 0, 0, 0, 1,
+	{[99] = 2, [105] = 1}
+};
+#endif
+
+#define OPTSPEC_toysh (&optspec_toysh)
+#if CFG_TOYSH
+static struct optdef optdef_toysh[] = {
+	{{0x1, 0x0, 0x0}, 'i', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'c', ':', 0, 0},
+};
+static struct optspec optspec_toysh = {optdef_toysh, 0, 0, INT_MAX, 0, 0, 0, 1,
+	{[99] = 2, [105] = 1}
+};
+#endif
+
+#define OPTSPEC_true 0
+
+#define OPTSPEC_tty (&optspec_tty)
+#if CFG_TTY
+static struct optdef optdef_tty[] = {
+	{{0x1, 0x0, 0x0}, 's', 0, 0, -1},
+};
+static struct optspec optspec_tty = {optdef_tty, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[115] = 1}
+};
+#endif
+
+#define OPTSPEC_uname (&optspec_uname)
+#if CFG_UNAME
+static struct optdef optdef_uname[] = {
+	{{0x1, 0x0, 0x0}, 's', 0, 0, -1},
+	{{0x2, 0x0, 0x0}, 'n', 0, 0, -1},
+	{{0x4, 0x0, 0x0}, 'r', 0, 0, -1},
+	{{0x8, 0x0, 0x0}, 'v', 0, 0, -1},
+	{{0x10, 0x0, 0x0}, 'm', 0, 0, -1},
+	{{0x20, 0x0, 0x0}, 'a', 0, 0, -1},
+};
+static struct optspec optspec_uname = {optdef_uname, 0, 0, INT_MAX, 0, 0, 0, 0,
+	{[97] = 6, [109] = 5, [110] = 2, [114] = 3, [115] = 1, [118] = 4}
+};
+#endif
+
+#define OPTSPEC_which (&optspec_which)
+#if CFG_WHICH
+static struct optdef optdef_which[] = {
+	{{0x1, 0x0, 0x0}, 'a', 0, 0, -1},
+};
+static struct optspec optspec_which = {optdef_which, 0, 1, INT_MAX, 0, 0, 0, 0,
+	{[97] = 1}
+};
+#endif
+
+#define OPTSPEC_yes 0
@@ -136,6 +136,7 @@ load:
 	conf_unsaved = 0;
 
 	def_flags = SYMBOL_DEF << def;
+	expr_generation++;
 	for_all_symbols(i, sym) {
 		sym->flags |= SYMBOL_CHANGED;
 		sym->flags &= ~(def_flags|SYMBOL_VALID);
@@ -358,8 +359,10 @@ int conf_read(const char *name)
 			case S_STRING:
 			case S_INT:
 			case S_HEX:
-				if (!sym_string_within_range(sym, sym->def[S_DEF_USER].val))
+				if (!sym_string_within_range(sym, sym->def[S_DEF_USER].val)) {
 					sym->flags &= ~(SYMBOL_VALID|SYMBOL_DEF_USER);
+					expr_generation++;
+				}
 			default:
 				break;
 			}
@@ -396,6 +399,7 @@ struct menu *next_menu(struct menu *menu)
 
 int conf_write(const char *name)
 {
+	static char buf[65536];
 	FILE *out;
 	struct symbol *sym;
 	struct menu *menu;
@@ -440,6 +444,7 @@ int conf_write(const char *name)
 	}
 	if (!out)
 		return 1;
+	setvbuf(out, buf, _IOFBF, sizeof(buf));
 
 	sym = sym_lookup("KCONFIG_VERSION", 0);
 	sym_calc_value(sym);
@@ -572,125 +577,153 @@ int conf_write(const char *name)
 	return 0;
 }
 
-int conf_split_config(void)
+/*
+ * Touch include/config/<symbol>.h if the value of sym differs from the one
+ * in the previous auto.conf (read as S_DEF_AUTO), so that make rebuilds
+ * only what depends on the symbols that did change.
+ */
+static int conf_split_symbol(struct symbol *sym)
 {
-	char *name, path[128];
-	char *s, *d, c;
-	struct symbol *sym;
+	char path[128], *s, *d, c;
 	struct stat sb;
-	int res, i, fd;
-
-	name = getenv("KCONFIG_AUTOCONFIG");
-	if (!name)
-		name = "include/config/auto.conf";
-	conf_read_simple(name, S_DEF_AUTO);
-
-	if (chdir("include/config"))
-		return 1;
+	int fd;
 
-	res = 0;
-	for_all_symbols(i, sym) {
-		sym_calc_value(sym);
-		if ((sym->flags & SYMBOL_AUTO) || !sym->name)
-			continue;
-		if (sym->flags & SYMBOL_WRITE) {
-			if (sym->flags & SYMBOL_DEF_AUTO) {
-				/*
-				 * symbol has old and new value,
-				 * so compare them...
-				 */
-				switch (sym->type) {
-				case S_BOOLEAN:
-				case S_TRISTATE:
-					if (sym_get_tristate_value(sym) ==
-					    sym->def[S_DEF_AUTO].tri)
-						continue;
-					break;
-				case S_STRING:
-				case S_HEX:
-				case S_INT:
-					if (!strcmp(sym_get_string_value(sym),
-						    sym->def[S_DEF_AUTO].val))
-						continue;
-					break;
-				default:
-					break;
-				}
-			} else {
-				/*
-				 * If there is no old value, only 'no' (unset)
-				 * is allowed as new value.
-				 */
-				switch (sym->type) {
-				case S_BOOLEAN:
-				case S_TRISTATE:
-					if (sym_get_tristate_value(sym) == no)
-						continue;
-					break;
-				default:
-					break;
-				}
-			}
-		} else if (!(sym->flags & SYMBOL_DEF_AUTO))
-			/* There is neither an old nor a new value. */
-			continue;
-		/* else
-		 *	There is an old value, but no new value ('no' (unset)
-		 *	isn't saved in auto.conf, so the old value is always
-		 *	different from 'no').
-		 */
-
-		/* Replace all '_' and append ".h" */
-		s = sym->name;
-		d = path;
-		while ((c = *s++)) {
-			c = tolower(c);
-			*d++ = (c == '_') ? '/' : c;
-		}
-		strcpy(d, ".h");
-
-		/* Assume directory path already exists. */
-		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-		if (fd == -1) {
-			if (errno != ENOENT) {
-				res = 1;
+	if ((sym->flags & SYMBOL_AUTO) || !sym->name)
+		return 0;
+	if (sym->flags & SYMBOL_WRITE) {
+		if (sym->flags & SYMBOL_DEF_AUTO) {
+			/*
+			 * symbol has old and new value,
+			 * so compare them...
+			 */
+			switch (sym->type) {
+			case S_BOOLEAN:
+			case S_TRISTATE:
+				if (sym_get_tristate_value(sym) ==
+				    sym->def[S_DEF_AUTO].tri)
+					return 0;
+				break;
+			case S_STRING:
+			case S_HEX:
+			case S_INT:
+				if (!strcmp(sym_get_string_value(sym),
+					    sym->def[S_DEF_AUTO].val))
+					return 0;
+				break;
+			default:
 				break;
 			}
+		} else {
 			/*
-			 * Create directory components,
-			 * unless they exist already.
+			 * If there is no old value, only 'no' (unset)
+			 * is allowed as new value.
 			 */
-			d = path;
-			while ((d = strchr(d, '/'))) {
-				*d = 0;
-				if (stat(path, &sb) && mkdir(path, 0755)) {
-					res = 1;
-					goto out;
-				}
-				*d++ = '/';
-			}
-			/* Try it again. */
-			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-			if (fd == -1) {
-				res = 1;
+			switch (sym->type) {
+			case S_BOOLEAN:
+			case S_TRISTATE:
+				if (sym_get_tristate_value(sym) == no)
+					return 0;
+				break;
+			default:
 				break;
 			}
 		}
-		close(fd);
+	} else if (!(sym->flags & SYMBOL_DEF_AUTO))
+		/* There is neither an old nor a new value. */
+		return 0;
+	/* else
+	 *	There is an old value, but no new value ('no' (unset)
+	 *	isn't saved in auto.conf, so the old value is always
+	 *	different from 'no').
+	 */
+
+	/* Replace all '_' and append ".h" */
+	strcpy(path, "include/config/");
+	s = sym->name;
+	d = path + strlen(path);
+	while ((c = *s++) && d < path + sizeof(path) - 3) {
+		c = tolower(c);
+		*d++ = (c == '_') ? '/' : c;
 	}
-out:
-	if (chdir("../.."))
-		return 1;
+	strcpy(d, ".h");
+
+	/* Assume directory path already exists. */
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			return 1;
+		/*
+		 * Create directory components below include/config,
+		 * unless they exist already.
+		 */
+		d = path + strlen("include/config/");
+		while ((d = strchr(d, '/'))) {
+			*d = 0;
+			if (stat(path, &sb) && mkdir(path, 0755))
+				return 1;
+			*d++ = '/';
+		}
+		/* Try it again. */
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1)
+			return 1;
+	}
+	close(fd);
+
+	return 0;
+}
+
+/* Read a whole file into a malloc()ed, NUL terminated buffer. */
+static char *conf_slurp(const char *name)
+{
+	FILE *in = fopen(name, "r");
+	char *buf = NULL;
+	size_t len = 0, size = 0, n;
+
+	if (!in)
+		return NULL;
+	do {
+		if (len + 1 >= size)
+			buf = realloc(buf, size = size ? 2 * size : 65536);
+		n = fread(buf + len, 1, size - len - 1, in);
+		len += n;
+	} while (n);
+	buf[len] = 0;
+	fclose(in);
 
-	return res;
+	return buf;
 }
 
+/*
+ * Does the new header have the same definitions as the old one?  Only the
+ * comment at the top (with the time it was written) is allowed to differ.
+ */
+static int conf_same_header(const char *new, const char *old)
+{
+	char *a = conf_slurp(new), *b = conf_slurp(old), *sa, *sb;
+	int same = 0;
+
+	if (a && b && (sa = strstr(a, " */\n")) && (sb = strstr(b, " */\n")))
+		same = !strcmp(sa, sb);
+	free(a);
+	free(b);
+
+	return same;
+}
+
+/*
+ * Write auto.conf and autoconf.h and touch the split include/config files
+ * in a single pass over the symbols.  autoconf.h is left alone when no
+ * definition in it changed, so that nothing including it gets rebuilt.
+ */
 int conf_write_autoconf(void)
 {
+	static char buf[65536], buf_h[65536];
 	struct symbol *sym;
 	const char *str;
 	char *name;
 	FILE *out, *out_h;
+	struct stat sb;
 	time_t now;
 	int i, l;
 
@@ -698,7 +731,12 @@ int conf_write_autoconf(void)
 
 	file_write_dep("include/config/auto.conf.cmd");
 
-	if (conf_split_config())
+	name = getenv("KCONFIG_AUTOCONFIG");
+	if (!name)
+		name = "include/config/auto.conf";
+	conf_read_simple(name, S_DEF_AUTO);
+
+	if (stat("include/config", &sb) || !S_ISDIR(sb.st_mode))
 		return 1;
 
 	out = fopen(".tmpconfig", "w");
@@ -710,6 +748,8 @@ int conf_write_autoconf(void)
 		fclose(out);
 		return 1;
 	}
+	setvbuf(out, buf, _IOFBF, sizeof(buf));
+	setvbuf(out_h, buf_h, _IOFBF, sizeof(buf_h));
 
 	sym = sym_lookup("KCONFIG_VERSION", 0);
 	sym_calc_value(sym);
@@ -730,6 +770,11 @@ int conf_write_autoconf(void)
 
 	for_all_symbols(i, sym) {
 		sym_calc_value(sym);
+		if (conf_split_symbol(sym)) {
+			fclose(out);
+			fclose(out_h);
+			return 1;
+		}
 		if (!(sym->flags & SYMBOL_WRITE) || !sym->name)
 			continue;
 		switch (sym->type) {
@@ -784,13 +829,15 @@ int conf_write_autoconf(void)
 			break;
 		}
 	}
-	fclose(out);
-	fclose(out_h);
+	if (fclose(out) | fclose(out_h))
+		return 1;
 
 	name = getenv("KCONFIG_AUTOHEADER");
 	if (!name)
 		name = "include/linux/autoconf.h";
-	if (rename(".tmpconfig.h", name))
+	if (conf_same_header(".tmpconfig.h", name))
+		unlink(".tmpconfig.h");
+	else if (rename(".tmpconfig.h", name))
 		return 1;
 	name = getenv("KCONFIG_AUTOCONFIG");
 	if (!name)
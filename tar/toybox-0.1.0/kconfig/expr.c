@@ -12,6 +12,13 @@
 
 #define DEBUG_EXPR	0
 
+/*
+ * Bumped whenever a symbol value may have changed or an expression was
+ * rewritten in place; the values cached by expr_calc_value() are only
+ * valid for the generation they were computed in.
+ */
+int expr_generation = 1;
+
 struct expr *expr_alloc_symbol(struct symbol *sym)
 {
 	struct expr *e = malloc(sizeof(*e));
@@ -170,6 +177,7 @@ void expr_eliminate_eq(struct expr **ep1, struct expr **ep2)
 {
 	if (!e1 || !e2)
 		return;
+	expr_generation++;
 	switch (e1->type) {
 	case E_OR:
 	case E_AND:
@@ -207,6 +215,8 @@ int expr_eq(struct expr *e1, struct expr *e2)
 		return expr_eq(e1->left.expr, e2->left.expr);
 	case E_AND:
 	case E_OR:
+		if (e1 == e2)
+			return 1;
 		e1 = expr_copy(e1);
 		e2 = expr_copy(e2);
 		old_count = trans_count;
@@ -237,6 +247,7 @@ struct expr *expr_eliminate_yn(struct expr *e)
 {
 	struct expr *tmp;
 
+	expr_generation++;
 	if (e) switch (e->type) {
 	case E_AND:
 		e->left.expr = expr_eliminate_yn(e->left.expr);
@@ -323,6 +334,7 @@ struct expr *expr_trans_bool(struct expr *e)
 {
 	if (!e)
 		return NULL;
+	expr_generation++;
 	switch (e->type) {
 	case E_AND:
 	case E_OR:
@@ -619,6 +631,7 @@ struct expr *expr_eliminate_dups(struct expr *e)
 	int oldcount;
 	if (!e)
 		return e;
+	expr_generation++;
 
 	oldcount = trans_count;
 	while (1) {
@@ -644,6 +657,7 @@ struct expr *expr_transform(struct expr *e)
 
 	if (!e)
 		return NULL;
+	expr_generation++;
 	switch (e->type) {
 	case E_EQUAL:
 	case E_UNEQUAL:
@@ -854,6 +868,7 @@ void expr_extract_eq(enum expr_type type, struct expr **ep, struct expr **ep1, s
 {
 #define e1 (*ep1)
 #define e2 (*ep2)
+	expr_generation++;
 	if (e1->type == type) {
 		expr_extract_eq(type, ep, &e1->left.expr, &e2);
 		expr_extract_eq(type, ep, &e1->right.expr, &e2);
@@ -883,6 +898,7 @@ struct expr *expr_trans_compare(struct expr *e, enum expr_type type, struct symb
 {
 	struct expr *e1, *e2;
 
+	expr_generation++;
 	if (!e) {
 		e = expr_alloc_symbol(sym);
 		if (type == E_UNEQUAL)
@@ -940,18 +956,12 @@ struct expr *expr_trans_compare(struct expr *e, enum expr_type type, struct symb
 	return NULL;
 }
 
-tristate expr_calc_value(struct expr *e)
+static tristate __expr_calc_value(struct expr *e)
 {
 	tristate val1, val2;
 	const char *str1, *str2;
 
-	if (!e)
-		return yes;
-
 	switch (e->type) {
-	case E_SYMBOL:
-		sym_calc_value(e->left.sym);
-		return e->left.sym->curr.tri;
 	case E_AND:
 		val1 = expr_calc_value(e->left.expr);
 		val2 = expr_calc_value(e->right.expr);
@@ -981,6 +991,30 @@ tristate expr_calc_value(struct expr *e)
 	}
 }
 
+/*
+ * The same dependencies are evaluated over and over (for every prompt,
+ * default and select of a menu, and again on every redraw), so the value
+ * of each subexpression is kept until the next generation.  A value
+ * computed while the generation changed underneath (a symbol it reads was
+ * recalculated) is tagged with the old one and never used.
+ */
+tristate expr_calc_value(struct expr *e)
+{
+	int gen = expr_generation;
+
+	if (!e)
+		return yes;
+	if (e->type == E_SYMBOL) {
+		sym_calc_value(e->left.sym);
+		return e->left.sym->curr.tri;
+	}
+	if (e->gen != gen) {
+		e->val = __expr_calc_value(e);
+		e->gen = gen;
+	}
+	return e->val;
+}
+
 int expr_compare_type(enum expr_type t1, enum expr_type t2)
 {
 #if 0
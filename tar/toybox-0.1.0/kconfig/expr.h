@@ -43,6 +43,9 @@ union expr_data {
 struct expr {
 	enum expr_type type;
 	union expr_data left, right;
+	/* value of the last expr_calc_value(), if gen == expr_generation */
+	tristate val;
+	int gen;
 };
 
 #define E_OR(dep1, dep2)	(((dep1)>(dep2))?(dep1):(dep2))
@@ -69,8 +72,8 @@ enum {
 };
 
 struct symbol {
-	struct symbol *next;
 	char *name;
+	unsigned int hash;
 	char *help;
 	enum symbol_type type;
 	struct symbol_value curr;
@@ -80,9 +83,11 @@ struct symbol {
 	struct property *prop;
 	struct expr *dep, *dep2;
 	struct expr_value rev_dep;
+	struct symbol **users;
+	int users_count, visit;
 };
 
-#define for_all_symbols(i, sym) for (i = 0; i < 257; i++) for (sym = symbol_hash[i]; sym; sym = sym->next) if (sym->type != S_OTHER)
+#define for_all_symbols(i, sym) for (i = 0; i < symbol_table_size; i++) if ((sym = symbol_table[i]) && sym->type != S_OTHER)
 
 #define SYMBOL_CONST		0x0001
 #define SYMBOL_CHECK		0x0008
@@ -103,8 +108,7 @@ struct symbol {
 #define SYMBOL_DEF4		0x80000
 
 #define SYMBOL_MAXLENGTH	256
-#define SYMBOL_HASHSIZE		257
-#define SYMBOL_HASHMASK		0xff
+#define SYMBOL_TABLE_MIN	1024
 
 enum prop_type {
 	P_UNKNOWN, P_PROMPT, P_COMMENT, P_MENU, P_DEFAULT, P_CHOICE, P_SELECT, P_RANGE
@@ -158,6 +162,7 @@ extern struct symbol symbol_yes, symbol_no, symbol_mod;
 extern struct symbol *modules_sym;
 extern struct symbol *sym_defconfig_list;
 extern int cdebug;
+extern int expr_generation;
 struct expr *expr_alloc_symbol(struct symbol *sym);
 struct expr *expr_alloc_one(enum expr_type type, struct expr *ce);
 struct expr *expr_alloc_two(enum expr_type type, struct expr *e1, struct expr *e2);
@@ -78,6 +78,7 @@ struct expr *menu_check_dep(struct expr *e)
 {
 	if (!e)
 		return e;
+	expr_generation++;
 
 	switch (e->type) {
 	case E_NOT:
@@ -30,6 +30,16 @@ struct symbol symbol_yes = {
 	.flags = SYMBOL_VALID,
 };
 
+/*
+ * All the symbols, in an open addressing table (linear probing) that
+ * doubles when it gets 3/4 full.  Each symbol caches its hash, so a probe
+ * only calls strcmp() on a likely match.  Symbols without a name (choices)
+ * are in the table for for_all_symbols() but can't be looked up.
+ */
+struct symbol **symbol_table;
+int symbol_table_size;
+static int symbol_count;
+
 int sym_change_count;
 struct symbol *sym_defconfig_list;
 struct symbol *modules_sym;
@@ -260,9 +270,14 @@ static struct symbol *sym_calc_choice(struct symbol *sym)
 	return NULL;
 }
 
+static inline bool sym_value_changed(struct symbol_value *a, struct symbol_value *b)
+{
+	return a->val != b->val || a->tri != b->tri;
+}
+
 void sym_calc_value(struct symbol *sym)
 {
-	struct symbol_value newval, oldval;
+	struct symbol_value newval, oldval, defval;
 	struct property *prop;
 	struct expr *e;
 
@@ -288,6 +303,8 @@ void sym_calc_value(struct symbol *sym)
 	default:
 		sym->curr.val = sym->name;
 		sym->curr.tri = no;
+		if (sym_value_changed(&oldval, &sym->curr))
+			expr_generation++;
 		return;
 	}
 	if (!sym_is_choice_value(sym))
@@ -296,7 +313,9 @@ void sym_calc_value(struct symbol *sym)
 	sym_calc_visibility(sym);
 
 	/* set default if recursively called */
-	sym->curr = newval;
+	sym->curr = defval = newval;
+	if (sym_value_changed(&oldval, &defval))
+		expr_generation++;
 
 	switch (sym_get_type(sym)) {
 	case S_BOOLEAN:
@@ -352,6 +371,8 @@ void sym_calc_value(struct symbol *sym)
 	if (sym_is_choice(sym) && newval.tri == yes)
 		sym->curr.val = sym_calc_choice(sym);
 	sym_validate_range(sym);
+	if (sym_value_changed(&defval, &sym->curr))
+		expr_generation++;
 
 	if (memcmp(&oldval, &sym->curr, sizeof(oldval))) {
 		sym_set_changed(sym);
@@ -380,10 +401,117 @@ void sym_clear_all_valid(void)
 	for_all_symbols(i, sym)
 		sym->flags &= ~SYMBOL_VALID;
 	sym_change_count++;
+	expr_generation++;
 	if (modules_sym)
 		sym_calc_value(modules_sym);
 }
 
+/*
+ * Reverse dependencies: sym->users are the symbols whose value, visibility
+ * or range read sym.  They are collected from the properties of every
+ * symbol the first time a value is set (all the menus are parsed by then),
+ * so that setting a value only has to recompute what depends on it.
+ */
+static bool sym_users_built;
+static int sym_visit;
+
+static void sym_add_user(struct symbol *sym, struct symbol *user)
+{
+	int n = sym ? sym->users_count : 0;
+
+	if (!sym || sym == user || sym->flags & SYMBOL_CONST)
+		return;
+	if (n && sym->users[n - 1] == user)
+		return;
+	if (!(n & (n - 1)))
+		sym->users = realloc(sym->users, (n ? 2 * n : 1) * sizeof(*sym->users));
+	sym->users[sym->users_count++] = user;
+}
+
+static void expr_add_users(struct expr *e, struct symbol *user)
+{
+	if (!e)
+		return;
+
+	switch (e->type) {
+	case E_SYMBOL:
+		sym_add_user(e->left.sym, user);
+		break;
+	case E_NOT:
+		expr_add_users(e->left.expr, user);
+		break;
+	case E_EQUAL:
+	case E_UNEQUAL:
+	case E_RANGE:
+		sym_add_user(e->left.sym, user);
+		sym_add_user(e->right.sym, user);
+		break;
+	case E_OR:
+	case E_AND:
+		expr_add_users(e->left.expr, user);
+		expr_add_users(e->right.expr, user);
+		break;
+	case E_CHOICE:
+		sym_add_user(e->right.sym, user);
+		expr_add_users(e->left.expr, user);
+		break;
+	default:
+		;
+	}
+}
+
+static void sym_build_users(void)
+{
+	struct symbol *sym;
+	struct property *prop;
+	int i;
+
+	for_all_symbols(i, sym) {
+		for (prop = sym->prop; prop; prop = prop->next) {
+			expr_add_users(prop->expr, sym);
+			expr_add_users(prop->visible.expr, sym);
+		}
+		expr_add_users(sym->rev_dep.expr, sym);
+		expr_add_users(sym->dep, sym);
+		expr_add_users(sym->dep2, sym);
+	}
+	sym_users_built = true;
+}
+
+static void sym_invalidate(struct symbol *sym)
+{
+	int i;
+
+	if (sym->visit == sym_visit)
+		return;
+	sym->visit = sym_visit;
+	sym->flags &= ~SYMBOL_VALID;
+	for (i = 0; i < sym->users_count; i++)
+		sym_invalidate(sym->users[i]);
+}
+
+/*
+ * The user value of sym changed: invalidate it and everything that depends
+ * on it, or everything if that turns modules on or off (which changes the
+ * type of every tristate symbol).
+ */
+void sym_clear_valid(struct symbol *sym)
+{
+	tristate old_modules_val = modules_val;
+
+	if (!sym_users_built)
+		sym_build_users();
+	sym_visit++;
+	sym_invalidate(sym);
+	sym_change_count++;
+	expr_generation++;
+	if (modules_sym && !(modules_sym->flags & SYMBOL_VALID)) {
+		sym_calc_value(modules_sym);
+		if (modules_val != old_modules_val)
+			sym_clear_all_valid();
+	}
+}
+
 void sym_set_changed(struct symbol *sym)
 {
 	struct property *prop;
@@ -454,7 +582,7 @@ bool sym_set_tristate_value(struct symbol *sym, tristate val)
 
 	sym->def[S_DEF_USER].tri = val;
 	if (oldval != val)
-		sym_clear_all_valid();
+		sym_clear_valid(sym);
 
 	return true;
 }
@@ -611,7 +739,7 @@ bool sym_set_string_value(struct symbol *sym, const char *newval)
 
 	strcpy(val, newval);
 	free((void *)oldval);
-	sym_clear_all_valid();
+	sym_clear_valid(sym);
 
 	return true;
 }
@@ -644,12 +772,61 @@ bool sym_is_changable(struct symbol *sym)
 	return sym->visible > sym->rev_dep.tri;
 }
 
+/* FNV-1a: unlike a sum of the characters, it doesn't collide on anagrams */
+static unsigned int sym_hash(const char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619;
+	return hash;
+}
+
+static void sym_insert(struct symbol *symbol)
+{
+	unsigned int i, mask;
+
+	if (4 * (symbol_count + 1) > 3 * symbol_table_size) {
+		struct symbol **old = symbol_table;
+		int old_size = symbol_table_size;
+
+		symbol_table_size = old_size ? 2 * old_size : SYMBOL_TABLE_MIN;
+		symbol_table = calloc(symbol_table_size, sizeof(*symbol_table));
+		symbol_count = 0;
+		for (i = 0; i < old_size; i++)
+			if (old[i])
+				sym_insert(old[i]);
+		free(old);
+	}
+	mask = symbol_table_size - 1;
+	for (i = symbol->hash & mask; symbol_table[i]; i = (i + 1) & mask)
+		;
+	symbol_table[i] = symbol;
+	symbol_count++;
+}
+
+/* The symbol with this name that is (or isn't) const, or NULL */
+static struct symbol *sym_probe(const char *name, unsigned int hash, int isconst)
+{
+	struct symbol *symbol;
+	unsigned int i, mask = symbol_table_size - 1;
+
+	if (!symbol_table)
+		return NULL;
+	for (i = hash & mask; (symbol = symbol_table[i]); i = (i + 1) & mask) {
+		if (symbol->hash == hash && symbol->name &&
+		    !strcmp(symbol->name, name) &&
+		    !(symbol->flags & SYMBOL_CONST) == !isconst)
+			return symbol;
+	}
+	return NULL;
+}
+
 struct symbol *sym_lookup(const char *name, int isconst)
 {
 	struct symbol *symbol;
-	const char *ptr;
 	char *new_name;
-	int hash = 0;
+	unsigned int hash = 0;
 
 	if (name) {
 		if (name[0] && !name[1]) {
@@ -659,22 +836,13 @@ struct symbol *sym_lookup(const char *name, int isconst)
 			case 'n': return &symbol_no;
 			}
 		}
-		for (ptr = name; *ptr; ptr++)
-			hash += *ptr;
-		hash &= 0xff;
-
-		for (symbol = symbol_hash[hash]; symbol; symbol = symbol->next) {
-			if (!strcmp(symbol->name, name)) {
-				if ((isconst && symbol->flags & SYMBOL_CONST) ||
-				    (!isconst && !(symbol->flags & SYMBOL_CONST)))
-					return symbol;
-			}
-		}
+		hash = sym_hash(name);
+		symbol = sym_probe(name, hash, isconst);
+		if (symbol)
+			return symbol;
 		new_name = strdup(name);
-	} else {
+	} else
 		new_name = NULL;
-		hash = 256;
-	}
 
 	symbol = malloc(sizeof(*symbol));
 	memset(symbol, 0, sizeof(*symbol));
@@ -683,18 +851,14 @@ struct symbol *sym_lookup(const char *name, int isconst)
 	if (isconst)
 		symbol->flags |= SYMBOL_CONST;
 
-	symbol->next = symbol_hash[hash];
-	symbol_hash[hash] = symbol;
+	symbol->hash = hash;
+	sym_insert(symbol);
 
 	return symbol;
 }
 
 struct symbol *sym_find(const char *name)
 {
-	struct symbol *symbol = NULL;
-	const char *ptr;
-	int hash = 0;
-
 	if (!name)
 		return NULL;
 
@@ -705,17 +869,7 @@ struct symbol *sym_find(const char *name)
 		case 'n': return &symbol_no;
 		}
 	}
-	for (ptr = name; *ptr; ptr++)
-		hash += *ptr;
-	hash &= 0xff;
-
-	for (symbol = symbol_hash[hash]; symbol; symbol = symbol->next) {
-		if (!strcmp(symbol->name, name) &&
-		    !(symbol->flags & SYMBOL_CONST))
-				break;
-	}
-
-	return symbol;
+	return sym_probe(name, sym_hash(name), 0);
 }
 
 struct symbol **sym_re_search(const char *pattern)
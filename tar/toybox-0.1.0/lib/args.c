@@ -50,6 +50,10 @@
  * union "this" (see generated/globals.h), which it treats as an array of longs
  * (note that sizeof(long)==sizeof(pointer) is guaranteed by LP64).
  *
+ * The get_opt string isn't parsed at runtime: scripts/mkopts.py turns it into
+ * the struct optspec in toys.which->optspec (see generated/opts.h), so
+ * handling each option character is a table lookup.
+ *
  * You don't have to free the option strings, which point into the environment
  * space.  List objects should be freed by main() when command_main() returns.
  *
@@ -68,22 +72,12 @@
  *       this[1]="fruit" (argument to -b)
  */
 
-// Linked list of all known options (get_opt string is parsed into this).
-struct opts {
-	struct opts *next;
-	long *arg;         // Pointer into union "this" to store arguments at.
-	uint32_t edx[3];   // Flag mask to enable/disable/exclude.
-	int c;             // Short argument character
-	int flags;         // |=1, ^=2
-	char type;         // Type of arguments to store
-};
-
 // State during argument parsing.
 struct getoptflagstate
 {
 	int argc;
 	char *arg;
-	struct opts *opts, *this;
+	struct optdef *this;
 	int noerror, nodash_now, stopearly;
 	uint32_t excludes;
 };
@@ -93,7 +87,7 @@ struct getoptflagstate
 static int gotflag(struct getoptflagstate *gof)
 {
 	int type;
-	struct opts *opt = gof->this;
+	struct optdef *opt = gof->this;
 
 	// Did we recognize this option?
 	if (!opt) {
@@ -109,29 +103,35 @@ static int gotflag(struct getoptflagstate *gof)
 	gof->arg++;
 	type = opt->type;
 	if (type) {
+		long *arg = (long *)&this + opt->slot;
 
 		// Handle "-xblah" and "-x blah", but also a third case: "abxc blah"
 		// to make "tar xCjfv blah1 blah2 thingy" work like
 		// "tar -x -C blah1 -j -f blah2 -v thingy"
 		if (!gof->nodash_now && !gof->arg[0]) {
 			gof->arg = toys.argv[++gof->argc];
-			// TODO: The following line doesn't display --longopt correctly
-			if (!gof->arg) error_exit("Missing argument to -%c",opt->c);
+			if (!gof->arg) {
+				char *s = toys.argv[gof->argc-1];
+
+				// A --longopt is the whole argument before the missing one.
+				if (s[0]=='-' && s[1]=='-') error_exit("Missing argument to %s", s);
+				error_exit("Missing argument to -%c",opt->c);
+			}
 		}
 
 		// Grab argument.
 		if (!gof->arg && !(gof->arg = toys.argv[++(gof->argc)]))
 			error_exit("Missing argument");
-		if (type == ':') *(opt->arg) = (long)gof->arg;
+		if (type == ':') *arg = (long)gof->arg;
 		else if (type == '*') {
 			struct arg_list **list;
 
-			list = (struct arg_list **)opt->arg;
+			list = (struct arg_list **)arg;
 			while (*list) list=&((*list)->next);
 			*list = xzalloc(sizeof(struct arg_list));
 			(*list)->arg = gof->arg;
-		} else if (type == '#') *(opt->arg) = atolx((char *)gof->arg);
-		else if (type == '@') ++*(opt->arg);
+		} else if (type == '#') *arg = atolx((char *)gof->arg);
+		else if (type == '@') ++*arg;
 
 		gof->arg = "";
 	}
@@ -142,129 +142,25 @@ static int gotflag(struct getoptflagstate *gof)
 
 // Fill out toys.optflags and toys.optargs.
 
-static char *plustildenot = "+~!";
 void get_optflags(void)
 {
-	int nodash = 0, minargs = 0, maxargs;
-	struct longopts {
-		struct longopts *next;
-		struct opts *opt;
-		char *str;
-		int len;
-	} *longopts = NULL;
+	struct optspec *spec = toys.which->optspec;
 	struct getoptflagstate gof;
-	long *nextarg = (long *)&this, saveflags;
-	char *options = toys.which->options;
+	long saveflags;
 	char *letters[]={"s",""};
+	int maxargs;
 
 	if (CFG_HELP) toys.exithelp++;
 	// Allocate memory for optargs
 	maxargs = 0;
 	while (toys.argv[maxargs++]);
 	toys.optargs = xzalloc(sizeof(char *)*maxargs);
-	maxargs = INT_MAX;
 	bzero(&gof, sizeof(struct getoptflagstate));
+	gof.stopearly = spec->stopearly;
+	gof.noerror = spec->noerror;
 
-	// Parse option format
-	if (options) {
-
-		// Parse leading special behavior indicators
-		for (;;) {
-			if (*options == '^') gof.stopearly++;
-			else if (*options == '<') minargs=*(++options)-'0';
-			else if (*options == '>') maxargs=*(++options)-'0';
-			else if (*options == '?') gof.noerror++;
-			else if (*options == '&') nodash++;
-			else break;
-			options++;
-		}
-
-		if (!*options) gof.stopearly++;
-		// Parse rest of opts into array
-		while (*options) {
-			char *temp;
-
-			// Allocate a new option entry when necessary
-			if (!gof.this) {
-				gof.this = xzalloc(sizeof(struct opts));
-				gof.this->next = gof.opts;
-				gof.opts = gof.this;
-				++*(gof.this->edx);
-			}
-			// Each option must start with "(" or an option character.  (Bare
-			// longopts only come at the start of the string.)
-			if (*options == '(') {
-				char *end;
-				struct longopts *lo = xmalloc(sizeof(struct longopts));
-
-				// Find the end of the longopt
-				for (end = ++options; *end && *end != ')'; end++);
-				if (CFG_TOYBOX_DEBUG && !*end)
-					error_exit("Bug1 in get_opt");
-
-				// Allocate and init a new struct longopts
-				lo = xmalloc(sizeof(struct longopts));
-				lo->next = longopts;
-				lo->opt = gof.this;
-				lo->str = options;
-				lo->len = end-options;
-				longopts = lo;
-				options = end;
-
-				// Mark this as struct opt as used, even when no short opt.
-				if (!gof.this->c) gof.this->c = -1;
-
-			// If this is the start of a new option that wasn't a longopt,
-
-			} else if (strchr(":*#@", *options)) {
-				gof.this->type = *options;
-			} else if (0 != (temp = strchr(plustildenot, *options))) {
-				int i=0, idx = temp - plustildenot;
-				struct opts *opt;
-
-				if (!*++options && CFG_TOYBOX_DEBUG)
-					error_exit("Bug2 in get_opt");
-				// Find this option flag (in previously parsed struct opt)
-				for (opt = gof.this; ; opt = opt->next) {
-					if (CFG_TOYBOX_DEBUG && !opt) error_exit("Bug3 in get_opt");
-					if (opt->c == *options) break;
-					i++;
-				}
-				gof.this->edx[idx] |= 1<<i;
-
-			} else if (*options == '[') {
-			} else if (*options == '|') gof.this->flags |= 1;
-			else if (*options == '^') gof.this->flags |= 2;
-
-			// At this point, we've hit the end of the previous option.  The
-			// current character is the start of a new option.  If we've already
-			// assigned an option to this struct, loop to allocate a new one.
-			// (It'll get back here afterwards and fall through to next else.)
-			else if(gof.this->c) {
-				gof.this = NULL;
-				continue;
-
-			// Claim this option, loop to see what's after it.
-			} else gof.this->c = *options;
-
-			options++;
-		}
-	}
-
-	// Initialize enable/disable/exclude masks and pointers to store arguments.
-	// (We have to calculate all this ahead of time because longopts jump into
-	// the middle of the list.)
-	gof.argc = 0;
-	for (gof.this = gof.opts; gof.this; gof.this = gof.this->next) {
-		int i;
-
-		for (i=0;i<3;i++) gof.this->edx[i] <<= gof.argc;
-		gof.argc++;
-		if (gof.this->type) {
-			gof.this->arg = (void *)nextarg;
-			*(nextarg++) = 0;
-		}
-	}
+	// Start with no option arguments.
+	memset(&this, 0, spec->slots*sizeof(long));
 
 	// Iterate through command line arguments, skipping argv[0]
 	for (gof.argc=1; toys.argv[gof.argc]; gof.argc++) {
@@ -283,7 +179,7 @@ void get_optflags(void)
 			if (!gof.arg[1]) goto notflag;
 			gof.arg++;
 			if (*gof.arg=='-') {
-				struct longopts *lo;
+				struct longdef *lo = spec->longopts;
 
 				gof.arg++;
 				// Handle --
@@ -293,22 +189,22 @@ void get_optflags(void)
 				}
 				// Handle --longopt
 
-				for (lo = longopts; lo; lo = lo->next) {
+				for (; lo && lo->len; lo++) {
 					if (!strncmp(gof.arg, lo->str, lo->len)) {
+						// It's a match.  Leave gof.arg one before the "=value"
+						// (or the end), where gotflag() expects it.
 						if (gof.arg[lo->len]) {
-							if (gof.arg[lo->len]=='=' && lo->opt->type)
-								gof.arg += lo->len;
+							if (gof.arg[lo->len]=='='
+								&& spec->opts[lo->opt].type) gof.arg += lo->len;
 							else continue;
-						}
-						// It's a match.
-						gof.arg = "";
-						gof.this = lo->opt;
+						} else gof.arg += lo->len-1;
+						gof.this = spec->opts + lo->opt;
 						break;
 					}
 				}
 
 				// Should we handle this --longopt as a non-option argument?
-				if (!lo && gof.noerror) {
+				if (!gof.this && gof.noerror) {
 					gof.arg-=2;
 					goto notflag;
 				}
@@ -320,7 +216,8 @@ void get_optflags(void)
 
 		// Handle things that don't start with a dash.
 		} else {
-			if (nodash && (nodash>1 || gof.argc == 1)) gof.nodash_now = 1;
+			if (spec->nodash && (spec->nodash>1 || gof.argc == 1))
+				gof.nodash_now = 1;
 			else goto notflag;
 		}
 
@@ -328,10 +225,11 @@ void get_optflags(void)
 		// each entry (could be -abc meaning -a -b -c)
 		saveflags = toys.optflags;
 		while (*gof.arg) {
+			unsigned char c = *gof.arg;
+			int i = c < sizeof(spec->bychar) ? spec->bychar[c] : 0;
 
 			// Identify next option char.
-			for (gof.this = gof.opts; gof.this; gof.this = gof.this->next)
-				if (*gof.arg == gof.this->c) break;
+			gof.this = i ? spec->opts+i-1 : NULL;
 
 			// Handle option char (advancing past what was used)
 			if (gotflag(&gof) ) {
@@ -349,11 +247,13 @@ notflag:
 	}
 
 	// Sanity check
-	if (toys.optc<minargs) {
-		error_exit("Need%s %d argument%s", letters[!!(minargs-1)], minargs,
-		letters[!(minargs-1)]);
+	if (toys.optc<spec->minargs) {
+		error_exit("Need%s %d argument%s", letters[!!(spec->minargs-1)],
+			spec->minargs, letters[!(spec->minargs-1)]);
+	}
+	if (toys.optc>spec->maxargs) {
+		error_exit("Max %d argument%s", spec->maxargs,
+			letters[!(spec->maxargs-1)]);
 	}
-	if (toys.optc>maxargs)
-		error_exit("Max %d argument%s", maxargs, letters[!(maxargs-1)]);
 	if (CFG_HELP) toys.exithelp = 0;
 }
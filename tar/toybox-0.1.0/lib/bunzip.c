@@ -11,36 +11,42 @@
 */
 
 #include "toys.h"
-
-#define THREADS 1
+#include <pthread.h>
 
 // Constants for huffman coding
 #define MAX_GROUPS               6
 #define GROUP_SIZE               50     /* 64 would have been more efficient */
 #define MAX_HUFCODE_BITS         20     /* Longest huffman code allowed */
 #define MAX_SYMBOLS              258    /* 256 literals + RUNA + RUNB */
+#define HUFF_LOOKUP_BITS         10     /* Codes this long or less use lookup[] */
 #define SYMBOL_RUNA              0
 #define SYMBOL_RUNB              1
 
 // Other housekeeping constants
-#define IOBUF_SIZE               4096
+#define BUNZIP_IOBUF_SIZE        4096
+#define INBUF_SIZE               65536
 
 // Status return values
 #define RETVAL_LAST_BLOCK        (-100)
 #define RETVAL_NOT_BZIP_DATA     (-1)
 #define RETVAL_DATA_ERROR        (-2)
 #define RETVAL_OBSOLETE_INPUT    (-3)
+#define RETVAL_UNEXPECTED_EOF    (-4)
 
 char *bunzip_errors[]={
 	NULL,
 	"Not bzip data",
 	"Data error",
-	"Obsolete (pre 0.9.5) bzip format not supported."
+	"Obsolete (pre 0.9.5) bzip format not supported.",
+	"Unexpected input EOF"
 };
 
 // This is what we know about each huffman coding group
 struct group_data {
 	int limit[MAX_HUFCODE_BITS+1], base[MAX_HUFCODE_BITS], permute[MAX_SYMBOLS];
+	// Indexed by the next HUFF_LOOKUP_BITS of input: symbol<<5 | code length,
+	// or 0 if the code is longer than that.
+	unsigned short lookup[1<<HUFF_LOOKUP_BITS];
 	char minLen, maxLen;
 };
 
@@ -59,13 +65,15 @@ struct bwdata {
 // memory that persists between calls to bunzip
 struct bunzip_data {
 
-	// Input stream, input buffer, input bit buffer
-	int in_fd, inbufCount, inbufPos;
+	// Input stream, input buffer, input bit buffer.  With in_fd -1 the input
+	// is all in inbuf, and overrun counts reads past the end of it.
+	int in_fd, inbufCount, inbufPos, overrun;
 	char *inbuf;
-	unsigned int inbufBitCount, inbufBits;
+	unsigned int inbufBitCount;
+	unsigned long long inbufBits;
 
 	// Output buffer
-	char outbuf[IOBUF_SIZE];
+	char outbuf[BUNZIP_IOBUF_SIZE];
 	int outbufPos;
 
 	unsigned int totalCRC;
@@ -76,49 +84,45 @@ struct bunzip_data {
 	int symTotal, groupCount, nSelectors;
 	unsigned char symToByte[256], mtfSymbol[256];
 
-	// The CRC values stored in the block header and calculated from the data
-	unsigned int crc32Table[256];
-
 	// Second pass decompression data (burrows-wheeler transform)
 	unsigned int dbufSize;
-	struct bwdata bwdata[THREADS];
+	struct bwdata bwdata;
 };
 
 // Return the next nnn bits of input.  All reads from the compressed input
 // are done through this function.  All reads are big endian.
 static unsigned int get_bits(struct bunzip_data *bd, char bits_wanted)
 {
-	unsigned int bits = 0;
-
 	// If we need to get more data from the byte buffer, do so.  (Loop getting
 	// one byte at a time to enforce endianness and avoid unaligned access.)
 	while (bd->inbufBitCount < bits_wanted) {
 
 		// If we need to read more data from file into byte buffer, do so
 		if (bd->inbufPos == bd->inbufCount) {
-			if (0 >= (bd->inbufCount = read(bd->in_fd, bd->inbuf, IOBUF_SIZE)))
+			if (bd->in_fd < 0) {
+				static char zeroes[BUNZIP_IOBUF_SIZE];
+
+				bd->overrun++;
+				bd->inbuf = zeroes;
+				bd->inbufCount = BUNZIP_IOBUF_SIZE;
+			} else if (0 >= (bd->inbufCount = read(bd->in_fd, bd->inbuf, INBUF_SIZE)))
 				error_exit("Unexpected input EOF");
 			bd->inbufPos = 0;
 		}
 
-		// Avoid 32-bit overflow (dump bit buffer to top of output)
-		if (bd->inbufBitCount>=24) {
-			bits = bd->inbufBits&((1<<bd->inbufBitCount)-1);
-			bits_wanted -= bd->inbufBitCount;
-			bits <<= bits_wanted;
-			bd->inbufBitCount = 0;
-		}
-
-		// Grab next 8 bits of input from buffer.
-		bd->inbufBits = (bd->inbufBits<<8) | bd->inbuf[bd->inbufPos++];
-		bd->inbufBitCount += 8;
+		// Grab as many bytes as fit in the 64 bit buffer, so the huffman
+		// decoder can mostly peek at it without calling us.
+		do {
+			bd->inbufBits = (bd->inbufBits<<8)
+				| (unsigned char)bd->inbuf[bd->inbufPos++];
+			bd->inbufBitCount += 8;
+		} while (bd->inbufBitCount <= 56 && bd->inbufPos < bd->inbufCount);
 	}
 
 	// Calculate result
 	bd->inbufBitCount -= bits_wanted;
-	bits |= (bd->inbufBits>>bd->inbufBitCount) & ((1<<bits_wanted)-1);
 
-	return bits;
+	return (bd->inbufBits>>bd->inbufBitCount) & ((1ULL<<bits_wanted)-1);
 }
 
 /* Read block header at start of a new compressed data block.  Consists of:
@@ -286,6 +290,20 @@ static int read_block_header(struct bunzip_data *bd, struct bwdata *bw)
 		limit[maxLen] = pp+temp[maxLen]-1;
 		limit[maxLen+1] = INT_MAX;
 		base[minLen] = 0;
+
+		// Fill in lookup[]: all the HUFF_LOOKUP_BITS values that start with
+		// a given short code decode to its symbol.
+		memset(hufGroup->lookup, 0, sizeof(hufGroup->lookup));
+		for (ii = minLen; ii <= maxLen && ii <= HUFF_LOOKUP_BITS; ii++) {
+			for (pp = limit[ii]-temp[ii]+1; pp <= limit[ii]; pp++) {
+				int shift = HUFF_LOOKUP_BITS-ii;
+
+				kk = (hufGroup->permute[pp-base[ii]] << 5) | ii;
+				for (hh = pp << shift; hh < (pp+1) << shift
+						&& hh < (1<<HUFF_LOOKUP_BITS); hh++)
+					hufGroup->lookup[hh] = kk;
+			}
+		}
 	}
 
 	return 0;
@@ -338,26 +356,40 @@ static int read_huffman_data(struct bunzip_data *bd, struct bwdata *bw)
 			limit = hufGroup->limit-1;
 		}
 
-		// Read next huffman-coded symbol (into jj).
-		ii = hufGroup->minLen;
-		jj = get_bits(bd, ii);
-		while (jj > limit[ii]) {
-			// if (ii > hufGroup->maxLen) return RETVAL_DATA_ERROR;
-			ii++;
-
-			// Unroll get_bits() to avoid a function call when the data's in
-			// the buffer already.
-			kk = bd->inbufBitCount
-			   	? (bd->inbufBits >> --(bd->inbufBitCount)) & 1
-				: get_bits(bd, 1);
-			jj = (jj << 1) | kk;
+		// Read next huffman-coded symbol (into nextSym).  Peek at the next
+		// HUFF_LOOKUP_BITS of input, which decode the short codes directly.
+		if (bd->inbufBitCount < HUFF_LOOKUP_BITS) {
+			get_bits(bd, HUFF_LOOKUP_BITS);
+			bd->inbufBitCount += HUFF_LOOKUP_BITS;
 		}
-		// Huffman decode jj into nextSym (with bounds checking)
-		jj-=base[ii];
+		jj = (bd->inbufBits >> (bd->inbufBitCount-HUFF_LOOKUP_BITS))
+			& ((1<<HUFF_LOOKUP_BITS)-1);
+		if ((kk = hufGroup->lookup[jj])) {
+			bd->inbufBitCount -= kk&31;
+			nextSym = kk>>5;
+		} else {
+			// Longer codes: keep reading bits until jj <= limit[bit count].
+			ii = hufGroup->minLen;
+			if (ii <= HUFF_LOOKUP_BITS) ii = HUFF_LOOKUP_BITS+1;
+			if (ii > hufGroup->maxLen) return RETVAL_DATA_ERROR;
+			jj = get_bits(bd, ii);
+			while (jj > limit[ii]) {
+				ii++;
+
+				// Unroll get_bits() to avoid a function call when the data's
+				// in the buffer already.
+				kk = bd->inbufBitCount
+					? (bd->inbufBits >> --(bd->inbufBitCount)) & 1
+					: get_bits(bd, 1);
+				jj = (jj << 1) | kk;
+			}
+			// Huffman decode jj into nextSym (with bounds checking)
+			jj-=base[ii];
 
-		if (ii > hufGroup->maxLen || (unsigned)jj >= MAX_SYMBOLS)
-			return RETVAL_DATA_ERROR;
-		nextSym = hufGroup->permute[jj];
+			if (ii > hufGroup->maxLen || (unsigned)jj >= MAX_SYMBOLS)
+				return RETVAL_DATA_ERROR;
+			nextSym = hufGroup->permute[jj];
+		}
 
 		// If this is a repeated run, loop collecting data
 		if ((unsigned)nextSym <= SYMBOL_RUNB) {
@@ -478,11 +510,10 @@ void burrows_wheeler_prep(struct bunzip_data *bd, struct bwdata *bw)
 // Decompress a block of text to intermediate buffer
 int read_bunzip_data(struct bunzip_data *bd)
 {
-	int rc = read_block_header(bd, bd->bwdata);
-	if (!rc) rc=read_huffman_data(bd, bd->bwdata);
+	int rc = read_block_header(bd, &bd->bwdata);
+	if (!rc) rc=read_huffman_data(bd, &bd->bwdata);
 
-	// First thing that can be done by a background thread.
-	burrows_wheeler_prep(bd, bd->bwdata);
+	burrows_wheeler_prep(bd, &bd->bwdata);
 
 	return rc;
 }
@@ -547,10 +578,10 @@ int write_bunzip_data(struct bunzip_data *bd, struct bwdata *bw, int out_fd, cha
 
 			// Output bytes to buffer, flushing to file if necessary
 			while (copies--) {
-				if (bd->outbufPos == IOBUF_SIZE) flush_bunzip_outbuf(bd,out_fd);
+				if (bd->outbufPos == BUNZIP_IOBUF_SIZE) flush_bunzip_outbuf(bd,out_fd);
 				bd->outbuf[bd->outbufPos++] = outbyte;
 				bw->dataCRC = (bw->dataCRC << 8)
-								^ bd->crc32Table[(bw->dataCRC >> 24) ^ outbyte];
+								^ crc_tables[0][0][(bw->dataCRC >> 24) ^ outbyte];
 			}
 			if (current!=previous) run=0;
 		}
@@ -596,7 +627,7 @@ int start_bunzip(struct bunzip_data **bdp, int src_fd, char *inbuf, int len)
 
 	// Figure out how much data to allocate.
 	i = sizeof(struct bunzip_data);
-	if (!len) i += IOBUF_SIZE;
+	if (!len) i += INBUF_SIZE;
 
 	// Allocate bunzip_data.  Most fields initialize to zero.
 	bd = *bdp = xzalloc(i);
@@ -609,8 +640,6 @@ int start_bunzip(struct bunzip_data **bdp, int src_fd, char *inbuf, int len)
 		bd->in_fd = src_fd;
 	}
 
-	crc_init(bd->crc32Table, 0);
-
 	// Ensure that file starts with "BZh".
     for (i=0;i<3;i++)
 		if (get_bits(bd,8)!="BZh"[i]) return RETVAL_NOT_BZIP_DATA;
@@ -619,27 +648,484 @@ int start_bunzip(struct bunzip_data **bdp, int src_fd, char *inbuf, int len)
 	// uncompressed data.  Allocate intermediate buffer for block.
 	i = get_bits(bd, 8);
 	if (i<'1' || i>'9') return RETVAL_NOT_BZIP_DATA;
-	bd->dbufSize = 100000*(i-'0')*THREADS;
-	for (i=0; i<THREADS; i++)
-		bd->bwdata[i].dbuf = xmalloc(bd->dbufSize * sizeof(int));
+	bd->dbufSize = 100000*(i-'0');
+	bd->bwdata.dbuf = xmalloc(bd->dbufSize * sizeof(int));
 
 	return 0;
 }
 
+// Multithreaded decompression.  Blocks are bit aligned and don't say how
+// long they are, so the calling thread scans ahead for the 48 bit block
+// magic and hands each candidate to a worker thread, which decodes it from
+// a copy of the input into memory (with its own bunzip_data for the huffman
+// tables and dbuf).  The magic can also turn up inside compressed data:
+// a candidate only counts if the block before it ended where it starts, and
+// a block cut short by a bogus candidate is decoded again with the next
+// slice of input appended.  The output is written in order.
+
+struct bunzip_job {
+	struct bunzip_job *next;
+	long long start, end;	// Bit offsets of this block and the one after it
+	char *data, *out;		// Input from start's byte on, output
+	int len, own, bit;		// own: bytes up to the next candidate's
+	int outlen, rc, done;
+	unsigned int crc, headerCRC;
+};
+
+struct bunzip_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t more, done;
+	struct bunzip_job *jobs, **tail, *todo;	// todo: first one not started
+	int queued, stop;
+	unsigned int dbufSize;
+
+	// Input not yet handed out, from byte offset base.
+	int in_fd, len, size, scan;
+	char *buf;
+	long long base, cand;
+	unsigned long long magic;
+};
+
+static struct bunzip_data *bunzip_alloc(unsigned int dbufSize)
+{
+	struct bunzip_data *bd = xzalloc(sizeof(struct bunzip_data));
+
+	bd->in_fd = -1;
+	bd->dbufSize = dbufSize;
+	bd->bwdata.dbuf = xmalloc(dbufSize * sizeof(int));
+
+	return bd;
+}
+
+// Undo the burrows-wheeler transform of a whole block into job->out.  This
+// is the loop in write_bunzip_data() without the interruptions.
+
+static void unburrow_block(struct bwdata *bw, struct bunzip_job *job)
+{
+	unsigned int *dbuf = bw->dbuf;
+	int count = bw->writeCount, pos = bw->writePos, current = bw->writeCurrent,
+		run = bw->writeRun, size = count+256, len = 0, previous;
+	char *out = xmalloc(size);
+
+	while (count--) {
+		previous = current;
+		pos = dbuf[pos];
+		current = pos&0xff;
+		pos >>= 8;
+
+		if (len+256 > size) out = xrealloc(out, size *= 2);
+		if (run++ == 3) {
+			memset(out+len, previous, current);
+			len += current;
+			current = -1;
+		} else out[len++] = current;
+		if (current!=previous) run=0;
+	}
+	job->out = out;
+	job->outlen = len;
+	job->crc = ~crc_update(0xffffffff, out, len, 0);
+}
+
+static void bunzip_block(struct bunzip_data *bd, struct bunzip_job *job)
+{
+	struct bwdata *bw = &bd->bwdata;
+
+	bd->inbuf = job->data;
+	bd->inbufCount = job->len;
+	bd->inbufPos = bd->inbufBitCount = bd->overrun = 0;
+	get_bits(bd, job->bit);
+
+	job->rc = read_block_header(bd, bw);
+	if (!job->rc) job->rc = read_huffman_data(bd, bw);
+	job->end = job->start - job->bit + 8LL*bd->inbufPos - bd->inbufBitCount;
+	job->headerCRC = bw->headerCRC;
+	if (bd->overrun) job->rc = RETVAL_UNEXPECTED_EOF;
+	else if (!job->rc) {
+		burrows_wheeler_prep(bd, bw);
+		unburrow_block(bw, job);
+	}
+}
+
+static void *bunzip_worker(void *arg)
+{
+	struct bunzip_pool *pool = arg;
+	struct bunzip_data *bd = bunzip_alloc(pool->dbufSize);
+	struct bunzip_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->todo && !pool->stop)
+			pthread_cond_wait(&pool->more, &pool->lock);
+		if (pool->stop) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		job = pool->todo;
+		pool->todo = job->next;
+		pthread_mutex_unlock(&pool->lock);
+
+		bunzip_block(bd, job);
+
+		pthread_mutex_lock(&pool->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	free(bd->bwdata.dbuf);
+	free(bd);
+
+	return NULL;
+}
+
+// Find the next block (or end of stream) magic after pool->cand and return
+// its bit offset, or -1 at end of input.
+
+static long long bunzip_scan(struct bunzip_pool *pool)
+{
+	int i;
+
+	for (;;) {
+		if (pool->scan == pool->len) {
+			if (pool->len == pool->size)
+				pool->buf = xrealloc(pool->buf, pool->size *= 2);
+			i = read(pool->in_fd, pool->buf+pool->len, pool->size-pool->len);
+			if (i<1) return -1;
+			pool->len += i;
+		}
+		pool->magic = (pool->magic<<8) | (unsigned char)pool->buf[pool->scan++];
+		for (i=7; i>=0; i--) {
+			unsigned long long ll = (pool->magic>>i) & 0xffffffffffffULL;
+
+			if (ll == 0x314159265359ULL || ll == 0x177245385090ULL)
+				return 8*(pool->base+pool->scan)-i-48;
+		}
+	}
+}
+
+// Queue a job for the block at pool->cand, up to the next candidate.
+
+static void bunzip_queue(struct bunzip_pool *pool)
+{
+	struct bunzip_job *job = xzalloc(sizeof(struct bunzip_job));
+	long long next = bunzip_scan(pool);
+	int skip = (pool->cand>>3) - pool->base;
+
+	job->start = pool->cand;
+	job->bit = pool->cand&7;
+	job->len = job->own = pool->len - skip;
+
+	// The huffman decoder peeks a few bytes past the end of a block, which
+	// run into the next one.
+	if (next >= 0) {
+		job->own = (next>>3) - (pool->cand>>3);
+		if (job->len > job->own+8) job->len = job->own+8;
+	}
+	job->data = xmalloc(job->len);
+	memcpy(job->data, pool->buf+skip, job->len);
+
+	// Keep the input from the next candidate on.
+	skip += job->own;
+	pool->len -= skip;
+	pool->scan -= skip;
+	pool->base += skip;
+	memmove(pool->buf, pool->buf+skip, pool->len);
+	pool->cand = next;
+
+	pthread_mutex_lock(&pool->lock);
+	*pool->tail = job;
+	pool->tail = &job->next;
+	if (!pool->todo) pool->todo = job;
+	pool->queued++;
+	pthread_cond_signal(&pool->more);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void bunzip_wait(struct bunzip_pool *pool, struct bunzip_job *job)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (!job->done) pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void bunzip_free(struct bunzip_job *job)
+{
+	free(job->data);
+	free(job->out);
+	free(job);
+}
+
+static void bunzip_index_add(struct bunzip_index *index, long long bit,
+	unsigned int crc, int len)
+{
+	struct bunzip_block *block;
+
+	if (!(index->count&63))
+		index->blocks = xrealloc(index->blocks,
+			(index->count+64)*sizeof(struct bunzip_block));
+	block = index->blocks + index->count++;
+	block->bit = bit;
+	block->offset = index->size;
+	block->crc = crc;
+	index->size += len;
+}
+
+// Decompress the rest of bd's input to dst_fd (if it's not -1) with threads
+// worker threads, adding the blocks to index (if it's not NULL).  Returns 0
+// or a RETVAL_ error.
+
+static int bunzip_parallel(struct bunzip_data *bd, int dst_fd, int threads,
+	struct bunzip_index *index)
+{
+	struct bunzip_pool pool;
+	struct bunzip_data *retry = NULL;
+	struct bunzip_job *job, *more;
+	pthread_t *workers = xmalloc(threads*sizeof(pthread_t));
+	long long expected = 32;
+	int i, rc = RETVAL_UNEXPECTED_EOF;
+
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.more, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pool.tail = &pool.jobs;
+	pool.dbufSize = bd->dbufSize;
+	pool.in_fd = bd->in_fd;
+	pool.size = 1<<20;
+	pool.buf = xmalloc(pool.size);
+	memcpy(pool.buf, bd->inbuf, pool.len = bd->inbufCount);
+	pool.scan = bd->inbufPos - bd->inbufBitCount/8;
+	pool.cand = bunzip_scan(&pool);
+	for (i=0; i<threads; i++)
+		pthread_create(workers+i, NULL, bunzip_worker, &pool);
+
+	for (;;) {
+		// Keep the workers a couple of blocks ahead of the output.
+		while (pool.cand >= 0 && pool.queued < 2*threads) bunzip_queue(&pool);
+		if (!(job = pool.jobs)) break;
+		bunzip_wait(&pool, job);
+
+		// A bogus candidate inside the previous block?
+		if (job->start < expected) goto next;
+		if (job->start > expected) {
+			rc = RETVAL_DATA_ERROR;
+			break;
+		}
+
+		// A real block cut short by a bogus candidate inside it.
+		for (more = job; job->rc == RETVAL_UNEXPECTED_EOF; ) {
+			char *data;
+
+			if (!more->next) {
+				if (pool.cand < 0) break;
+				bunzip_queue(&pool);
+			}
+			more = more->next;
+			data = xmalloc(job->own+more->len);
+			memcpy(data, job->data, job->own);
+			memcpy(data+job->own, more->data, more->len);
+			free(job->data);
+			job->data = data;
+			job->len = job->own+more->len;
+			job->own += more->own;
+			if (!retry) retry = bunzip_alloc(bd->dbufSize);
+			bunzip_block(retry, job);
+		}
+
+		if ((rc = job->rc)) {
+			if (rc == RETVAL_LAST_BLOCK) {
+				rc = job->headerCRC == bd->totalCRC ? 0 : RETVAL_DATA_ERROR;
+				if (index) bunzip_index_add(index, job->start, job->headerCRC, 0);
+			}
+			break;
+		}
+		if (job->crc != job->headerCRC) {
+			rc = RETVAL_DATA_ERROR;
+			break;
+		}
+		if (index) bunzip_index_add(index, job->start, job->crc, job->outlen);
+		if (dst_fd != -1) xwrite(dst_fd, job->out, job->outlen);
+		bd->totalCRC = ((bd->totalCRC << 1) | (bd->totalCRC >> 31)) ^ job->crc;
+		expected = job->end;
+next:
+		pthread_mutex_lock(&pool.lock);
+		if (!(pool.jobs = job->next)) pool.tail = &pool.jobs;
+		pool.queued--;
+		pthread_mutex_unlock(&pool.lock);
+		bunzip_free(job);
+	}
+
+	// Anything still queued is past the end of the stream.
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.more);
+	pthread_mutex_unlock(&pool.lock);
+	for (i=0; i<threads; i++) pthread_join(workers[i], NULL);
+	while ((job = pool.jobs)) {
+		pool.jobs = job->next;
+		bunzip_free(job);
+	}
+	if (retry) {
+		free(retry->bwdata.dbuf);
+		free(retry);
+	}
+	free(pool.buf);
+	free(workers);
+
+	return rc;
+}
+
 // Example usage: decompress src_fd to dst_fd.  (Stops at end of bzip data,
-// not end of file.)
-void bunzipStream(int src_fd, int dst_fd)
+// not end of file.)  With threads>1, blocks are decompressed in parallel.
+void bunzipStream(int src_fd, int dst_fd, int threads)
 {
 	struct bunzip_data *bd;
-	int i, j;
+	int i;
 
 	if (!(i = start_bunzip(&bd,src_fd,0,0))) {
-		i = write_bunzip_data(bd,bd->bwdata,dst_fd,0,0);
-		if (i==RETVAL_LAST_BLOCK && bd->bwdata[0].headerCRC==bd->totalCRC)
-			i = 0;
+		if (threads>1) i = bunzip_parallel(bd, dst_fd, threads, NULL);
+		else {
+			i = write_bunzip_data(bd,&bd->bwdata,dst_fd,0,0);
+			if (i==RETVAL_LAST_BLOCK)
+				i = bd->bwdata.headerCRC==bd->totalCRC ? 0 : RETVAL_DATA_ERROR;
+		}
 	}
 	flush_bunzip_outbuf(bd,dst_fd);
-	for (j=0; j<THREADS; j++) free(bd->bwdata[j].dbuf);
+	free(bd->bwdata.dbuf);
 	free(bd);
 	if (i) error_exit(bunzip_errors[-i]);
 }
+
+// Random access.  An index has the bit offset (from the start of the file),
+// uncompressed offset and CRC of each block, plus an entry for the end of
+// stream marker.  Building one decompresses the whole file once, after that
+// reading a range of it only decompresses the blocks it touches.
+
+struct bunzip_index *bunzip_index(int src_fd, int threads)
+{
+	struct bunzip_index *index = xzalloc(sizeof(struct bunzip_index));
+	struct bunzip_data *bd;
+	int i;
+
+	if (!(i = start_bunzip(&bd,src_fd,0,0))) {
+		index->level = bd->dbufSize/100000;
+		i = bunzip_parallel(bd, -1, threads>1 ? threads : 1, index);
+	}
+	free(bd->bwdata.dbuf);
+	free(bd);
+	if (i) error_exit(bunzip_errors[-i]);
+
+	return index;
+}
+
+void bunzip_index_free(struct bunzip_index *index)
+{
+	if (index) free(index->blocks);
+	free(index);
+}
+
+// The saved index is text: "bzindex level count", then "bit offset crc"
+// for each entry.
+
+void bunzip_index_save(struct bunzip_index *index, int fd)
+{
+	int i, len = sprintf(toybuf, "bzindex %d %d\n", index->level, index->count);
+
+	for (i=0; i<index->count; i++) {
+		struct bunzip_block *block = index->blocks+i;
+
+		if (len > sizeof(toybuf)-64) {
+			xwrite(fd, toybuf, len);
+			len = 0;
+		}
+		len += sprintf(toybuf+len, "%lld %lld %08x\n", block->bit,
+			block->offset, block->crc);
+	}
+	xwrite(fd, toybuf, len);
+}
+
+// Returns NULL if fd doesn't contain an index.
+
+struct bunzip_index *bunzip_index_load(int fd)
+{
+	struct bunzip_index *index = xzalloc(sizeof(struct bunzip_index));
+	char *line = get_line(fd);
+	int i;
+
+	if (!line || 2 != sscanf(line, "bzindex %d %d", &index->level,
+		&index->count) || index->level<1 || index->level>9
+		|| index->count<1) goto bad;
+	index->blocks = xmalloc(index->count*sizeof(struct bunzip_block));
+	for (i=0; i<index->count; i++) {
+		struct bunzip_block *block = index->blocks+i;
+
+		free(line);
+		if (!(line = get_line(fd)) || 3 != sscanf(line, "%lld %lld %x",
+			&block->bit, &block->offset, &block->crc)) goto bad;
+		if (i && (block->bit <= block[-1].bit
+			|| block->offset < block[-1].offset)) goto bad;
+	}
+	free(line);
+	index->size = index->blocks[index->count-1].offset;
+
+	return index;
+
+bad:
+	free(line);
+	bunzip_index_free(index);
+
+	return NULL;
+}
+
+// Write len bytes (or with len<0, everything) of src_fd's uncompressed data
+// from offset on to dst_fd.  src_fd has to be seekable.
+
+void bunzip_range(int src_fd, struct bunzip_index *index, long long offset,
+	long long len, int dst_fd)
+{
+	struct bunzip_data *bd = bunzip_alloc(100000*index->level);
+	struct bunzip_block *block;
+	long long end = index->size;
+	int lo = 0, hi = index->count-1;
+
+	if (len>=0 && offset+len<end) end = offset+len;
+
+	// Find the last block starting at or before offset.
+	while (hi-lo>1) {
+		int mid = (lo+hi)/2;
+
+		if (index->blocks[mid].offset <= offset) lo = mid;
+		else hi = mid;
+	}
+
+	for (block = index->blocks+lo; offset<end; block++) {
+		struct bunzip_job job;
+		long long skip;
+		int rc;
+
+		memset(&job, 0, sizeof(job));
+		job.start = block->bit;
+		job.bit = block->bit&7;
+		job.len = (block[1].bit>>3) + 8 - (block->bit>>3);
+		job.data = xmalloc(job.len);
+		xlseek(src_fd, block->bit>>3, SEEK_SET);
+		if (0 > (job.len = readall(src_fd, job.data, job.len)))
+			perror_exit("read");
+		bunzip_block(bd, &job);
+
+		// An index that doesn't match the file is a data error.
+		if (!(rc = job.rc) && (job.crc != block->crc || job.end != block[1].bit
+			|| job.outlen != block[1].offset-block->offset))
+				rc = RETVAL_DATA_ERROR;
+		if (rc) error_exit(bunzip_errors[-rc]);
+
+		skip = offset - block->offset;
+		len = job.outlen - skip;
+		if (len > end-offset) len = end-offset;
+		xwrite(dst_fd, job.out+skip, len);
+		offset += len;
+		free(job.data);
+		free(job.out);
+	}
+	free(bd->bwdata.dbuf);
+	free(bd);
+}
@@ -5,8 +5,7 @@
  */
 
 #include "toys.h"
-
-// NOTE: This uses toybuf.  Possibly it shouldn't do that.
+#include <pthread.h>
 
 // Create a dirtree node from a path.
 
@@ -42,49 +41,544 @@ struct dirtree *dirtree_add_node(char *path)
 	return dt;
 }
 
-// Given a directory (in a writeable PATH_MAX buffer), recursively read in a
-// directory tree.
+// The path of the entry being looked at, which callbacks can append to (mdev
+// adds "/dev"): there are always at least DIRTREE_SPARE bytes after it.
+
+#define DIRTREE_SPARE 4096
+#define DIRTREE_DENTS 32768
+
+struct dirtree_path {
+	char *path;
+	int size;
+};
+
+// Read the directory open at dirfd (closing it after) with big getdents64()
+// batches, and fstatat() each entry relative to it so the kernel doesn't
+// walk the whole path again for every file.
+
+static struct dirtree *dirtree_fdread(int dirfd, struct dirtree_path *dp,
+	int len, struct dirtree *parent, int flags,
+	int (*callback)(char *path, struct dirtree *node))
+{
+	struct dirtree *dtroot = NULL, *this, **ddt = &dtroot;
+	char *dents = xmalloc(DIRTREE_DENTS);
+	long count, pos;
+
+	while (0 < (count = getdents64(dirfd, dents, DIRTREE_DENTS))) {
+		for (pos = 0; pos < count; pos += ((struct dirent64 *)(dents+pos))->d_reclen) {
+			struct dirent64 *entry = (void *)(dents+pos);
+			int norecurse = 0, namelen, fd;
+
+			// Skip "." and ".."
+			if (entry->d_name[0]=='.') {
+				if (!entry->d_name[1]) continue;
+				if (entry->d_name[1]=='.' && !entry->d_name[2]) continue;
+			}
+
+			namelen = strlen(entry->d_name);
+			if (len+namelen+2+DIRTREE_SPARE > dp->size) {
+				dp->size = 2*(len+namelen+2+DIRTREE_SPARE);
+				dp->path = xrealloc(dp->path, dp->size);
+			}
+			dp->path[len] = '/';
+			memcpy(dp->path+len+1, entry->d_name, namelen+1);
+
+			this = xzalloc(sizeof(struct dirtree)+namelen+1);
+			strcpy(this->name, entry->d_name);
+
+			// The type is all some callers need, and it comes with the name.
+			if ((flags & DIRTREE_NOSTAT) && entry->d_type != DT_UNKNOWN)
+				this->st.st_mode = DTTOIF(entry->d_type);
+			else if (fstatat(dirfd, this->name, &(this->st), AT_SYMLINK_NOFOLLOW)) {
+				error_msg("Skipped '%s'", this->name);
+				free(this);
+				continue;
+			}
+			*ddt = this;
+			this->parent = parent;
+			this->depth = parent ? parent->depth + 1 : 1;
+			if (callback) norecurse = callback(dp->path, this);
+			if (!norecurse && S_ISDIR(this->st.st_mode)) {
+				fd = openat(dirfd, this->name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+				if (fd<0) perror_msg("No %s", dp->path);
+				else this->child = dirtree_fdread(fd, dp, len+1+namelen, this,
+					flags, callback);
+			}
+			if (callback) free(this);
+			else ddt = &(this->next);
+			dp->path[len]=0;
+		}
+	}
+	if (count<0) perror_msg("%s", dp->path);
+	close(dirfd);
+	free(dents);
+
+	return dtroot;
+}
+
+// Given a directory path, recursively read in a directory tree.
 //
 // If callback==NULL, allocate tree of struct dirtree and
 // return root of tree.  Otherwise call callback(node) on each hit, free
 // structures after use, and return NULL.
+//
+// The path the callback sees is a copy, with room (DIRTREE_SPARE) to append
+// to, and can be longer than PATH_MAX.  With DIRTREE_NOSTAT in flags, node->st
+// only has the file type in st_mode, when the filesystem says what it is.
+
+struct dirtree *dirtree_flagread(char *path, struct dirtree *parent, int flags,
+					int (*callback)(char *path, struct dirtree *node))
+{
+	struct dirtree_path dp;
+	int len = strlen(path), fd;
+
+	if (0>(fd = open(path, O_RDONLY|O_DIRECTORY))) {
+		perror_msg("No %s", path);
+		return NULL;
+	}
+	dp.size = len+1+DIRTREE_SPARE;
+	dp.path = xmalloc(dp.size);
+	strcpy(dp.path, path);
+	parent = dirtree_fdread(fd, &dp, len, parent, flags, callback);
+	free(dp.path);
+
+	return parent;
+}
 
 struct dirtree *dirtree_read(char *path, struct dirtree *parent,
 					int (*callback)(char *path, struct dirtree *node))
 {
-	struct dirtree *dtroot = NULL, *this, **ddt = &dtroot;
-	DIR *dir;
-	int len = strlen(path);
-
-	if (!(dir = opendir(path))) perror_msg("No %s", path);
-	else for (;;) {
-		int norecurse = 0;
-		struct dirent *entry = readdir(dir);
-		if (!entry) {
-			closedir(dir);
-			break;
+	return dirtree_flagread(path, parent, 0, callback);
+}
+
+// Parallel walk: a pool of threads lists directories, each one opened by
+// the path queued for it (so there's no fd held per pending directory).
+//
+// Without DIRTREE_ORDERED the workers call callback themselves, as they find
+// each entry, so it has to be thread safe, and a node is only freed once all
+// its children are (node->walk counts the references to it). A directory is
+// still seen before anything in it.  With DIRTREE_ORDERED the workers only
+// list the directories (and queue the subdirectories they find) while the
+// calling thread makes the callbacks, in the same order dirtree_read() would.
+// node->walk then has DIRTREE_READY once node->child is filled in, and
+// DIRTREE_CANCEL if the callback didn't want it after all.
+
+#define DIRTREE_READY  1
+#define DIRTREE_CANCEL 2
+
+struct dirtree_job {
+	struct dirtree_job *next;
+	struct dirtree *node;
+	char path[];
+};
+
+struct dirtree_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t more, ready;
+	struct dirtree_job *queue, **tail;
+	struct dirtree *root, *parent;
+	int busy, flags;	// busy: jobs queued or running
+	int (*callback)(char *path, struct dirtree *node);
+};
+
+static void dirtree_queue(struct dirtree_pool *pool, struct dirtree *node,
+	char *path)
+{
+	struct dirtree_job *job = xmalloc(sizeof(struct dirtree_job)+strlen(path)+1);
+
+	job->node = node;
+	strcpy(job->path, path);
+	pthread_mutex_lock(&pool->lock);
+	pool->busy++;
+
+	// Ordered walks want the directories in the order they'll be visited,
+	// the others go depth first to keep the queue short.
+	if (pool->flags & DIRTREE_ORDERED) {
+		job->next = NULL;
+		*pool->tail = job;
+		pool->tail = &job->next;
+	} else {
+		if (!(job->next = pool->queue)) pool->tail = &job->next;
+		pool->queue = job;
+	}
+	pthread_cond_signal(&pool->more);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// Drop a reference to node, freeing it (and then its parent) when it was the
+// last one.  The root and the caller's parent aren't ours to free.
+
+static void dirtree_unref(struct dirtree_pool *pool, struct dirtree *node)
+{
+	struct dirtree *parent;
+
+	while (node && node != pool->root && node != pool->parent
+		&& !__atomic_sub_fetch(&node->walk, 1, __ATOMIC_ACQ_REL))
+	{
+		parent = node->parent;
+		free(node);
+		node = parent;
+	}
+}
+
+static void dirtree_list(struct dirtree_pool *pool, struct dirtree_job *job)
+{
+	struct dirtree *dir = job->node, *this, **ddt = &dir->child;
+	struct dirtree_path dp;
+	int ordered = pool->flags & DIRTREE_ORDERED, len = strlen(job->path);
+	int fd = -1, namelen, norecurse;
+	char *dents = NULL;
+	long count, pos;
+
+	if (ordered) {
+		pthread_mutex_lock(&pool->lock);
+		if (dir->walk & DIRTREE_CANCEL) len = -1;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	if (len>=0 && 0>(fd = open(job->path, O_RDONLY|O_DIRECTORY)))
+		perror_msg("No %s", job->path);
+	if (fd>=0) {
+		dp.size = len+1+DIRTREE_SPARE;
+		dp.path = xmalloc(dp.size);
+		strcpy(dp.path, job->path);
+		dents = xmalloc(DIRTREE_DENTS);
+	}
+
+	while (fd>=0 && 0 < (count = getdents64(fd, dents, DIRTREE_DENTS))) {
+		for (pos = 0; pos < count; pos += ((struct dirent64 *)(dents+pos))->d_reclen) {
+			struct dirent64 *entry = (void *)(dents+pos);
+
+			if (entry->d_name[0]=='.') {
+				if (!entry->d_name[1]) continue;
+				if (entry->d_name[1]=='.' && !entry->d_name[2]) continue;
+			}
+
+			namelen = strlen(entry->d_name);
+			if (len+namelen+2+DIRTREE_SPARE > dp.size) {
+				dp.size = 2*(len+namelen+2+DIRTREE_SPARE);
+				dp.path = xrealloc(dp.path, dp.size);
+			}
+			dp.path[len] = '/';
+			memcpy(dp.path+len+1, entry->d_name, namelen+1);
+
+			this = xzalloc(sizeof(struct dirtree)+namelen+1);
+			strcpy(this->name, entry->d_name);
+			if ((pool->flags & DIRTREE_NOSTAT) && entry->d_type != DT_UNKNOWN)
+				this->st.st_mode = DTTOIF(entry->d_type);
+			else if (fstatat(fd, this->name, &(this->st), AT_SYMLINK_NOFOLLOW)) {
+				error_msg("Skipped '%s'", this->name);
+				free(this);
+				continue;
+			}
+			this->parent = dir == pool->root ? pool->parent : dir;
+			this->depth = this->parent ? this->parent->depth + 1 : 1;
+
+			if (pool->callback && !ordered) {
+				this->walk = 1;
+				if (dir != pool->root)
+					__atomic_add_fetch(&dir->walk, 1, __ATOMIC_RELAXED);
+				norecurse = pool->callback(dp.path, this);
+				if (!norecurse && S_ISDIR(this->st.st_mode)) {
+					this->walk++;
+					dirtree_queue(pool, this, dp.path);
+				}
+				dirtree_unref(pool, this);
+			} else {
+				*ddt = this;
+				ddt = &(this->next);
+				if (S_ISDIR(this->st.st_mode)) dirtree_queue(pool, this, dp.path);
+			}
+			dp.path[len] = 0;
 		}
+	}
+	if (fd>=0) {
+		if (count<0) perror_msg("%s", job->path);
+		close(fd);
+		free(dents);
+		free(dp.path);
+	}
+
+	if (ordered) {
+		pthread_mutex_lock(&pool->lock);
+		dir->walk |= DIRTREE_READY;
+		pthread_cond_broadcast(&pool->ready);
+		pthread_mutex_unlock(&pool->lock);
+	} else if (pool->callback) dirtree_unref(pool, dir);
+	free(job);
+}
 
-		// Skip "." and ".."
-		if (entry->d_name[0]=='.') {
-			if (!entry->d_name[1]) continue;
-			if (entry->d_name[1]=='.' && !entry->d_name[2]) continue;
+// Run jobs until there are none left, queued or running.
+
+static void *dirtree_worker(void *arg)
+{
+	struct dirtree_pool *pool = arg;
+	struct dirtree_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->queue && pool->busy) pthread_cond_wait(&pool->more, &pool->lock);
+		if (!(job = pool->queue)) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
 		}
+		if (!(pool->queue = job->next)) pool->tail = &pool->queue;
+		pthread_mutex_unlock(&pool->lock);
+
+		dirtree_list(pool, job);
 
-		snprintf(path+len, sizeof(toybuf)-len, "/%s", entry->d_name);
-		*ddt = this = dirtree_add_node(path);
-		if (!this) continue;
-		this->parent = parent;
-		this->depth = parent ? parent->depth + 1 : 1;
-		if (callback) norecurse = callback(path, this);
-		if (!norecurse && S_ISDIR(this->st.st_mode))
-			this->child = dirtree_read(path, this, callback);
-		if (callback) free(this);
-		else ddt = &(this->next);
-		path[len]=0;
+		pthread_mutex_lock(&pool->lock);
+		if (!--pool->busy) pthread_cond_broadcast(&pool->more);
+		pthread_mutex_unlock(&pool->lock);
 	}
+}
 
-	return dtroot;
+static void dirtree_wait(struct dirtree_pool *pool, struct dirtree *dir)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (!(dir->walk & DIRTREE_READY))
+		pthread_cond_wait(&pool->ready, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// Free a directory the callback didn't want to recurse into, along with
+// whatever the workers already read ahead under it.
+
+static void dirtree_prune(struct dirtree_pool *pool, struct dirtree *dir)
+{
+	struct dirtree *this;
+
+	pthread_mutex_lock(&pool->lock);
+	dir->walk |= DIRTREE_CANCEL;
+	pthread_mutex_unlock(&pool->lock);
+	dirtree_wait(pool, dir);
+	while ((this = dir->child)) {
+		dir->child = this->next;
+		if (S_ISDIR(this->st.st_mode)) dirtree_prune(pool, this);
+		free(this);
+	}
+}
+
+// The calling thread's half of an ordered walk: callbacks for dir's
+// children, once a worker has listed them.
+
+static void dirtree_ordered(struct dirtree_pool *pool, struct dirtree *dir,
+	struct dirtree_path *dp, int len)
+{
+	struct dirtree *this;
+	int namelen;
+
+	dirtree_wait(pool, dir);
+	while ((this = dir->child)) {
+		dir->child = this->next;
+		namelen = strlen(this->name);
+		if (len+namelen+2+DIRTREE_SPARE > dp->size) {
+			dp->size = 2*(len+namelen+2+DIRTREE_SPARE);
+			dp->path = xrealloc(dp->path, dp->size);
+		}
+		dp->path[len] = '/';
+		memcpy(dp->path+len+1, this->name, namelen+1);
+		if (S_ISDIR(this->st.st_mode)) {
+			if (pool->callback(dp->path, this)) dirtree_prune(pool, this);
+			else dirtree_ordered(pool, this, dp, len+1+namelen);
+		} else pool->callback(dp->path, this);
+		free(this);
+		dp->path[len] = 0;
+	}
+}
+
+// dirtree_flagread() with the directories read by up to threads threads.
+//
+// Without a callback it builds the same tree dirtree_read() would.  With
+// one, the callback runs on the worker threads unless flags has
+// DIRTREE_ORDERED, in which case the calling thread makes every call, in
+// order, while the workers read ahead.  Either way a directory's callback
+// comes before those of its contents, and node->parent stays valid.
+
+struct dirtree *dirtree_read_parallel(char *path, struct dirtree *parent,
+	int threads, int flags, int (*callback)(char *path, struct dirtree *node))
+{
+	struct dirtree_pool pool;
+	struct dirtree root;
+	struct dirtree_path dp;
+	pthread_t *workers;
+	int i;
+
+	if (threads<2) return dirtree_flagread(path, parent, flags, callback);
+	if (!callback) flags &= ~DIRTREE_ORDERED;
+
+	memset(&pool, 0, sizeof(pool));
+	memset(&root, 0, sizeof(root));
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.more, NULL);
+	pthread_cond_init(&pool.ready, NULL);
+	pool.tail = &pool.queue;
+	pool.root = &root;
+	pool.parent = parent;
+	pool.flags = flags;
+	pool.callback = callback;
+
+	// The calling thread is one of the workers, unless it's making the
+	// callbacks.
+	dirtree_queue(&pool, &root, path);
+	if (!(flags & DIRTREE_ORDERED)) threads--;
+	workers = xmalloc(threads*sizeof(pthread_t));
+	for (i=0; i<threads; i++)
+		if (pthread_create(workers+i, NULL, dirtree_worker, &pool))
+			perror_exit("pthread_create");
+	if (flags & DIRTREE_ORDERED) {
+		dp.size = strlen(path)+1+DIRTREE_SPARE;
+		dp.path = xmalloc(dp.size);
+		strcpy(dp.path, path);
+		dirtree_ordered(&pool, &root, &dp, strlen(path));
+		free(dp.path);
+	} else dirtree_worker(&pool);
+	for (i=0; i<threads; i++) pthread_join(workers[i], NULL);
+	free(workers);
+
+	pthread_mutex_destroy(&pool.lock);
+	pthread_cond_destroy(&pool.more);
+	pthread_cond_destroy(&pool.ready);
+
+	// root was only a placeholder: the top level's parent is the caller's.
+	return root.child;
+}
+
+// Packed trees hold the parts of struct stat the tree builders use, in an
+// array of nodes that refer to each other by index (so it can grow with
+// xrealloc()) and a pool of their names.  That's less than half the memory
+// of a tree of struct dirtree, in two allocations instead of one per node.
+// Nodes are added in the order dirtree_read() visits them, so walking the
+// array in order is a depth first walk of the tree.
+
+// Add a node with no links yet: the caller fills in next, child and parent.
+// A NULL st leaves its stat fields zeroed.  Returns the new node's index.
+
+unsigned dirtree_arena_add(struct dirtree_arena *da, char *name,
+	struct stat *st)
+{
+	struct dirnode *node;
+	long len = strlen(name)+1;
+
+	// Node 0 is never handed out, so 0 can mean none.
+	if (!da->count) da->count++;
+	if (da->count >= da->size) {
+		da->size = da->size ? 2*da->size : 1024;
+		da->node = xrealloc(da->node, da->size*sizeof(struct dirnode));
+	}
+	if (da->namelen+len > da->namesize) {
+		da->namesize = 2*(da->namesize+len);
+		da->names = xrealloc(da->names, da->namesize);
+	}
+
+	node = da->node+da->count;
+	memset(node, 0, sizeof(struct dirnode));
+	node->name = da->namelen;
+	memcpy(da->names+da->namelen, name, len);
+	da->namelen += len;
+	if (st) {
+		node->mode = st->st_mode;
+		node->nlink = st->st_nlink;
+		node->uid = st->st_uid;
+		node->gid = st->st_gid;
+		node->size = st->st_size;
+		node->ino = st->st_ino;
+		node->dev = st->st_dev;
+		node->atime = st->st_atime;
+		node->mtime = st->st_mtime;
+		node->ctime = st->st_ctime;
+	}
+
+	return da->count++;
+}
+
+// dirtree_fdread() without callbacks, into an arena.
+
+static unsigned dirtree_arena_fdread(struct dirtree_arena *da, int dirfd,
+	struct dirtree_path *dp, int len, unsigned parent, int flags)
+{
+	unsigned first = 0, last = 0, this, child;
+	char *dents = xmalloc(DIRTREE_DENTS);
+	struct stat st;
+	long count, pos;
+
+	while (0 < (count = getdents64(dirfd, dents, DIRTREE_DENTS))) {
+		for (pos = 0; pos < count; pos += ((struct dirent64 *)(dents+pos))->d_reclen) {
+			struct dirent64 *entry = (void *)(dents+pos);
+			int namelen, fd;
+
+			if (entry->d_name[0]=='.') {
+				if (!entry->d_name[1]) continue;
+				if (entry->d_name[1]=='.' && !entry->d_name[2]) continue;
+			}
+
+			namelen = strlen(entry->d_name);
+			if (len+namelen+2+DIRTREE_SPARE > dp->size) {
+				dp->size = 2*(len+namelen+2+DIRTREE_SPARE);
+				dp->path = xrealloc(dp->path, dp->size);
+			}
+			dp->path[len] = '/';
+			memcpy(dp->path+len+1, entry->d_name, namelen+1);
+
+			if ((flags & DIRTREE_NOSTAT) && entry->d_type != DT_UNKNOWN) {
+				memset(&st, 0, sizeof(st));
+				st.st_mode = DTTOIF(entry->d_type);
+			} else if (fstatat(dirfd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+				error_msg("Skipped '%s'", entry->d_name);
+				continue;
+			}
+			this = dirtree_arena_add(da, entry->d_name, &st);
+			da->node[this].parent = parent;
+			if (last) da->node[last].next = this;
+			else first = this;
+			last = this;
+
+			// The recursion can move da->node, so no pointers into it here.
+			if (S_ISDIR(st.st_mode)) {
+				fd = openat(dirfd, entry->d_name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW);
+				if (fd<0) perror_msg("No %s", dp->path);
+				else {
+					child = dirtree_arena_fdread(da, fd, dp, len+1+namelen, this,
+						flags);
+					da->node[this].child = child;
+				}
+			}
+			dp->path[len]=0;
+		}
+	}
+	if (count<0) perror_msg("%s", dp->path);
+	close(dirfd);
+	free(dents);
+
+	return first;
 }
 
+// Read the tree under path into da, like dirtree_flagread() without a
+// callback.  The top level's parent is parent, and the index of its first
+// node is returned (0 if there's nothing).
 
+unsigned dirtree_arena_read(struct dirtree_arena *da, char *path,
+	unsigned parent, int flags)
+{
+	struct dirtree_path dp;
+	int len = strlen(path), fd;
+	unsigned first;
+
+	if (0>(fd = open(path, O_RDONLY|O_DIRECTORY))) {
+		perror_msg("No %s", path);
+		return 0;
+	}
+	dp.size = len+1+DIRTREE_SPARE;
+	dp.path = xmalloc(dp.size);
+	strcpy(dp.path, path);
+	first = dirtree_arena_fdread(da, fd, &dp, len, parent, flags);
+	free(dp.path);
+
+	return first;
+}
+
+void dirtree_arena_free(struct dirtree_arena *da)
+{
+	free(da->node);
+	free(da->names);
+	memset(da, 0, sizeof(struct dirtree_arena));
+}
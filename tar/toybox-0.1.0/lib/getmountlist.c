@@ -7,39 +7,285 @@
 #include "toys.h"
 
 #include <mntent.h>
+#include <pthread.h>
 
 char *path_mounts = "/proc/mounts";
 
-// Get a list of mount points from /etc/mtab or /proc/mounts, including
-// statvfs() information.  This returns a reversed list, which is good for
-// finding overmounts and such.
+#define MOUNT_THREADS 16
 
-struct mtab_list *getmountlist(int die)
+// The stat() and statvfs() for each mount run on a pool of threads, so
+// hundreds of mounts don't take turns, and a mount that takes longer than the
+// timeout (a hung NFS server) is given up on.  Its thread is left blocked
+// and a new one takes its place, so the pool (which the blocked threads
+// still point to) is only freed when nothing was given up on.
+
+#define MOUNT_QUEUED  0
+#define MOUNT_RUNNING 1
+#define MOUNT_DONE    2
+#define MOUNT_LATE    3
+
+struct mount_thread {
+	struct mount_pool *pool;
+	pthread_t tid;
+	int job, late;
+};
+
+struct mount_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t change;
+	struct mtab_list **mt;
+	struct timespec *start;   // When each job's stats began
+	char *state;
+	struct mount_thread *threads;
+	int count, next, finished, nthreads, abandoned;
+};
+
+static void *mount_worker(void *arg)
+{
+	struct mount_thread *self = arg;
+	struct mount_pool *pool = self->pool;
+	struct stat st;
+	struct statvfs sv;
+	int i, gotst, gotsv;
+	char *dir;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!self->late && pool->next < pool->count) {
+		self->job = i = pool->next++;
+		pool->state[i] = MOUNT_RUNNING;
+		clock_gettime(CLOCK_MONOTONIC, pool->start+i);
+		dir = xstrdup(pool->mt[i]->dir);
+		pthread_mutex_unlock(&pool->lock);
+
+		// Get information about this filesystem.  Yes, we need both.
+		gotst = !stat(dir, &st);
+		gotsv = !statvfs(dir, &sv);
+		free(dir);
+
+		pthread_mutex_lock(&pool->lock);
+		if (pool->state[i] == MOUNT_RUNNING) {
+			if (gotst) pool->mt[i]->stat = st;
+			else memset(&pool->mt[i]->stat, 0, sizeof(st));
+			if (gotsv) pool->mt[i]->statvfs = sv;
+			pool->state[i] = MOUNT_DONE;
+			pool->finished++;
+			pthread_cond_broadcast(&pool->change);
+		}
+	}
+	self->job = -1;
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void mount_spawn(struct mount_pool *pool)
+{
+	struct mount_thread *t = pool->threads + pool->nthreads++;
+
+	t->pool = pool;
+	t->job = -1;
+	if (pthread_create(&t->tid, NULL, mount_worker, t))
+		perror_exit("pthread_create");
+}
+
+// Fill in the stat information of count mounts, waiting at most timeout
+// milliseconds for any one of them.  One that doesn't answer in time keeps
+// the st_dev from mountinfo and an empty statvfs.
+
+static void mount_stats(struct mtab_list **mt, int count, int timeout)
+{
+	struct mount_pool *pool = xzalloc(sizeof(struct mount_pool));
+	pthread_condattr_t attr;
+	int i;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pool->change, &attr);
+	pthread_condattr_destroy(&attr);
+	pool->mt = mt;
+	pool->count = count;
+	pool->start = xmalloc(count*sizeof(struct timespec));
+	pool->state = xzalloc(count);
+	// Room for a replacement for every mount that's given up on
+	pool->threads = xzalloc((MOUNT_THREADS+count)*sizeof(struct mount_thread));
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i<count && i<MOUNT_THREADS; i++) mount_spawn(pool);
+	while (pool->finished < count) {
+		struct timespec now, wake;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		wake.tv_sec = now.tv_sec + timeout/1000 + 1;
+		wake.tv_nsec = now.tv_nsec;
+		for (i = 0; i<pool->nthreads; i++) {
+			struct mount_thread *t = pool->threads+i;
+			struct timespec deadline;
+
+			if (t->late || t->job<0) continue;
+			deadline = pool->start[t->job];
+			deadline.tv_sec += timeout/1000;
+			deadline.tv_nsec += (timeout%1000)*1000000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			if (deadline.tv_sec < now.tv_sec || (deadline.tv_sec == now.tv_sec
+				&& deadline.tv_nsec <= now.tv_nsec))
+			{
+				pool->state[t->job] = MOUNT_LATE;
+				pool->finished++;
+				pool->abandoned++;
+				t->late++;
+				pthread_detach(t->tid);
+				if (pool->next < count) mount_spawn(pool);
+			} else if (deadline.tv_sec < wake.tv_sec || (deadline.tv_sec
+				== wake.tv_sec && deadline.tv_nsec < wake.tv_nsec)) wake = deadline;
+		}
+		if (pool->finished < count)
+			pthread_cond_timedwait(&pool->change, &pool->lock, &wake);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i<pool->nthreads; i++)
+		if (!pool->threads[i].late) pthread_join(pool->threads[i].tid, NULL);
+	if (!pool->abandoned) {
+		pthread_mutex_destroy(&pool->lock);
+		pthread_cond_destroy(&pool->change);
+		free(pool->start);
+		free(pool->state);
+		free(pool->threads);
+		free(pool);
+	}
+}
+
+static struct mtab_list *mount_add(char *device, char *dir, char *type)
 {
-	FILE *fp;
-	struct mtab_list *mtlist, *mt;
-	struct mntent me;
-	char evilbuf[2*PATH_MAX];
+	struct mtab_list *mt = xzalloc(sizeof(struct mtab_list) + strlen(device)
+		+ strlen(dir) + strlen(type) + 3);
+
+	// Remember information from /proc/mounts
+	strcpy(mt->type, type);
+	mt->dir = mt->type + strlen(mt->type) + 1;
+	strcpy(mt->dir, dir);
+	mt->device = mt->dir + strlen(mt->dir) + 1;
+	strcpy(mt->device, device);
+
+	return mt;
+}
 
-	mtlist = 0;
-	if (!(fp = setmntent(path_mounts, "r"))) {
-		if (die) error_exit("cannot open %s", path_mounts);
+static int mount_wanted(struct arg_list *types, char *type)
+{
+	for (; types; types = types->next) if (!strcmp(type, types->arg)) break;
+
+	return !types || !!types->arg;
+}
+
+// Undo the \ooo escapes mountinfo uses for spaces and such, and terminate
+// the field.  Returns the start of the next one.
+
+static char *mountinfo_field(char *s, char **field)
+{
+	char *out = s;
+
+	*field = s;
+	while (*s && *s != ' ' && *s != '\n') {
+		if (*s == '\\' && s[1] >= '0' && s[1] <= '3' && s[2] >= '0'
+			&& s[2] <= '7' && s[3] >= '0' && s[3] <= '7')
+		{
+			*(out++) = ((s[1]-'0')<<6) | ((s[2]-'0')<<3) | (s[3]-'0');
+			s += 4;
+		} else *(out++) = *(s++);
+	}
+	if (*s == ' ') s++;
+	*out = 0;
+
+	return s;
+}
+
+// Read all of /proc/self/mountinfo with big reads.  Returns it, or NULL.
+
+static char *mountinfo_read(void)
+{
+	int fd = open("/proc/self/mountinfo", O_RDONLY), len = 0, size = 65536;
+	char *buf;
+	ssize_t got;
+
+	if (fd<0) return NULL;
+	buf = xmalloc(size);
+	while (0 < (got = read(fd, buf+len, size-len-1))) {
+		len += got;
+		if (len+1 == size) buf = xrealloc(buf, size *= 2);
+	}
+	close(fd);
+	if (got<0) {
+		free(buf);
+		return NULL;
+	}
+	buf[len] = 0;
+
+	return buf;
+}
+
+// Get a list of mount points from /proc/self/mountinfo (or /etc/mtab or
+// /proc/mounts), including statvfs() information.  This returns a reversed
+// list, which is good for finding overmounts and such.  With types, only
+// mounts of those filesystem types are listed (or stat()ed).  A mount is
+// given timeout milliseconds to answer.
+
+struct mtab_list *getmountlist(int die, struct arg_list *types, int timeout)
+{
+	struct mtab_list *mtlist = 0, **mts = 0;
+	char *info = mountinfo_read(), *line, *next;
+	int count = 0, i;
+
+	if (info) {
+		for (line = info; *line; line = next) {
+			char *field[10], *s = line, *type, *device;
+			unsigned major = 0, minor = 0;
+
+			if (!(next = strchr(line, '\n'))) next = line+strlen(line);
+			else *(next++) = 0;
+
+			// "id parent major:minor root dir options [optional...] - type
+			// device superoptions"
+			for (i = 0; i<6 && *s; i++) s = mountinfo_field(s, field+i);
+			if (i<6) continue;
+			while (*s && strncmp(s, "- ", 2)) s = mountinfo_field(s, &type);
+			if (!*s) continue;
+			s = mountinfo_field(s+2, &type);
+			s = mountinfo_field(s, &device);
+			if (!mount_wanted(types, type)) continue;
+
+			sscanf(field[2], "%u:%u", &major, &minor);
+			if (!(count&63)) mts = xrealloc(mts, (count+64)*sizeof(*mts));
+			mts[count] = mount_add(device, field[4], type);
+			mts[count++]->stat.st_dev = makedev(major, minor);
+		}
+		free(info);
 	} else {
+		struct mntent me;
+		char evilbuf[2*PATH_MAX];
+		FILE *fp;
+
+		if (!(fp = setmntent(path_mounts, "r"))) {
+			if (die) error_exit("cannot open %s", path_mounts);
+			return 0;
+		}
 		while (getmntent_r(fp, &me, evilbuf, sizeof(evilbuf))) {
-			mt = xzalloc(sizeof(struct mtab_list) + strlen(me.mnt_fsname) +
-				strlen(me.mnt_dir) + strlen(me.mnt_type) + 3);
-			mt->next = mtlist;
-			// Get information about this filesystem.  Yes, we need both.
-			stat(me.mnt_dir, &(mt->stat));
-			statvfs(me.mnt_dir, &(mt->statvfs));
-			// Remember information from /proc/mounts
-			strcpy(mt->type, me.mnt_type);
-			mt->dir = mt->type + strlen(mt->type) + 1;
-			strcpy(mt->dir, me.mnt_dir);
-			mt->device = mt->dir + strlen(mt->dir) + 1;
-			strcpy(mt->device, me.mnt_fsname);
-			mtlist = mt;
+			if (!mount_wanted(types, me.mnt_type)) continue;
+			if (!(count&63)) mts = xrealloc(mts, (count+64)*sizeof(*mts));
+			mts[count++] = mount_add(me.mnt_fsname, me.mnt_dir, me.mnt_type);
 		}
+		endmntent(fp);
 	}
+
+	if (count) mount_stats(mts, count, timeout);
+	for (i = 0; i<count; i++) {
+		mts[i]->next = mtlist;
+		mtlist = mts[i];
+	}
+	free(mts);
+
 	return mtlist;
 }
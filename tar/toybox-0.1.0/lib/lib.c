@@ -10,6 +10,15 @@
  */
 
 #include "toys.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#endif
 
 // Strcpy with size checking: exit if there's not enough space for the string.
 void xstrcpy(char *dest, char *src, size_t size)
@@ -105,6 +114,42 @@ void *xrealloc(void *ptr, size_t size)
 	return ptr;
 }
 
+static pthread_key_t iobuf_key;
+
+// Free each thread's xiobuf() when it exits.
+static void iobuf_key_create(void)
+{
+	pthread_key_create(&iobuf_key, free);
+}
+
+// This thread's buffer for I/O loops: page aligned (so O_DIRECT can use it
+// too) and at least size bytes, or IOBUF_SIZE if size is 0.  toybuf is 4k
+// and shared by every thread; this moves IOBUF_SIZE per system call and
+// worker threads each get their own.  Asking for more than the buffer holds
+// grows it.  It belongs to the thread until it exits, so don't free() it,
+// and don't hold on to it across a call to anything that might use it too.
+char *xiobuf(size_t size)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	static __thread char *buf;
+	static __thread size_t len;
+	long page = sysconf(_SC_PAGESIZE);
+	void *ret;
+
+	if (!size) size = IOBUF_SIZE;
+	if (size <= len) return buf;
+
+	pthread_once(&once, iobuf_key_create);
+	size = (size+page-1) & ~(page-1);
+	if (posix_memalign(&ret, page, size)) error_exit("xiobuf");
+	free(buf);
+	buf = ret;
+	len = size;
+	pthread_setspecific(iobuf_key, buf);
+
+	return buf;
+}
+
 // Die unless we can allocate a copy of this many bytes of string.
 void *xstrndup(char *s, size_t n)
 {
@@ -204,6 +249,7 @@ int xopen(char *path, int flags)
 
 void xclose(int fd)
 {
+	drop_readahead(fd);
 	if (close(fd)) perror_exit("xclose");
 }
 
@@ -376,7 +422,7 @@ void xmkpath(char *path, int mode)
 struct string_list *find_in_path(char *path, char *filename)
 {
 	struct string_list *rlist = NULL, **prlist=&rlist;
-	char *cwd = xgetcwd();
+	char *cwd = NULL;
 
 	for (;;) {
 		char *next = path ? index(path, ':') : NULL;
@@ -384,6 +430,8 @@ struct string_list *find_in_path(char *path, char *filename)
 		struct string_list *rnext;
 		struct stat st;
 
+		// Only an empty entry means the current directory.
+		if (!len && !cwd) cwd = xgetcwd();
 		rnext = xmalloc(sizeof(void *) + strlen(filename)
 			+ (len ? len : strlen(cwd)) + 2);
 		if (!len) sprintf(rnext->str, "%s/%s", cwd, filename);
@@ -411,6 +459,82 @@ struct string_list *find_in_path(char *path, char *filename)
 	return rlist;
 }
 
+// Remembered results of find_in_path() for one $PATH, so a shell running the
+// same commands over and over doesn't search every directory each time.
+// Each entry's str is the filename, a NUL, and the executable found for it.
+
+#define PATH_CACHE_SIZE 256
+static struct path_cache {
+	char *path;
+	struct string_list *bucket[PATH_CACHE_SIZE];
+} path_cache;
+
+static unsigned path_cache_hash(char *filename)
+{
+	unsigned hash = 0;
+
+	while (*filename) hash = hash*31 + *(filename++);
+	return hash % PATH_CACHE_SIZE;
+}
+
+// Forget everything, as after $PATH changes or a cached file goes away.
+void path_cache_flush(void)
+{
+	int i;
+
+	for (i=0; i<PATH_CACHE_SIZE; i++) {
+		llist_free(path_cache.bucket[i], NULL);
+		path_cache.bucket[i] = NULL;
+	}
+	free(path_cache.path);
+	path_cache.path = NULL;
+}
+
+// Return the first executable filename in path (which the caller shouldn't
+// free), or NULL if there's none.  Misses aren't remembered, so a command
+// installed later is still found.  Names with a slash aren't searched for.
+
+char *path_cache_find(char *path, char *filename)
+{
+	struct string_list *list, **bucket;
+	int len = strlen(filename);
+
+	if (!path || index(filename, '/')) return NULL;
+	if (path_cache.path && strcmp(path, path_cache.path)) path_cache_flush();
+	if (!path_cache.path) path_cache.path = xstrdup(path);
+
+	bucket = path_cache.bucket + path_cache_hash(filename);
+	for (list = *bucket; list; list = list->next)
+		if (!strcmp(list->str, filename)) return list->str+len+1;
+
+	for (list = find_in_path(path, filename); list; free(llist_pop(&list))) {
+		struct string_list *new;
+
+		if (access(list->str, X_OK)) continue;
+		new = xmalloc(sizeof(struct string_list) + len + strlen(list->str) + 2);
+		strcpy(new->str, filename);
+		strcpy(new->str+len+1, list->str);
+		new->next = *bucket;
+		*bucket = new;
+		llist_free(list, NULL);
+
+		return new->str+len+1;
+	}
+
+	return NULL;
+}
+
+// Call fn for the filename and executable of each remembered entry.
+void path_cache_walk(void (*fn)(char *filename, char *found))
+{
+	struct string_list *list;
+	int i;
+
+	for (i=0; i<PATH_CACHE_SIZE; i++)
+		for (list = path_cache.bucket[i]; list; list = list->next)
+			fn(list->str, list->str+strlen(list->str)+1);
+}
+
 // Convert unsigned int to ascii, writing into supplied buffer.  A truncated
 // result contains the first few digits of the result ala strncpy, and is
 // always null terminated (unless buflen is 0).
@@ -631,7 +755,10 @@ void loopfiles_rw(char **argv, int flags, void (*function)(int fd, char *name))
 			continue;
 		}
 		function(fd, *argv);
-		if (!flags) close(fd);
+		if (!flags) {
+			drop_readahead(fd);
+			close(fd);
+		}
 	} while (*++argv);
 }
 
@@ -641,17 +768,74 @@ void loopfiles(char **argv, void (*function)(int fd, char *name))
 	loopfiles_rw(argv, O_RDONLY, function);
 }
 
-// Slow, but small.
+// Read-ahead for get_rawline(): the first read of an fd allocates it a
+// READAHEAD sized buffer, which is freed again at end of file.  Anything
+// else that wants to read from that fd (or close it) before the end must
+// call drop_readahead() first, which gives back what wasn't used yet.
+
+#define READAHEAD 65536
+
+static struct readahead {
+	char *buf;
+	int start, end;
+} *readaheads;
+static int readahead_fds;
+
+// Put unused read-ahead back (by seeking back, which only works on files:
+// on a pipe it's lost) and free the buffer.
+void drop_readahead(int fd)
+{
+	struct readahead *ra = readaheads+fd;
+
+	if (fd<0 || fd>=readahead_fds || !ra->buf) return;
+	if (ra->end > ra->start) lseek(fd, ra->start-ra->end, SEEK_CUR);
+	free(ra->buf);
+	ra->buf = NULL;
+	ra->start = ra->end = 0;
+}
+
+// Read a line ending with end (which is included), or the rest of the
+// file if there's no end.  Returns NULL at end of file.
 
 char *get_rawline(int fd, long *plen, char end)
 {
-	char c, *buf = NULL;
-	long len = 0;
+	struct readahead *ra;
+	char *buf = NULL, *found;
+	long len = 0, size = 0, chunk;
+
+	if (fd >= readahead_fds) {
+		int n = fd+16;
+
+		readaheads = xrealloc(readaheads, n*sizeof(*readaheads));
+		memset(readaheads+readahead_fds, 0,
+			(n-readahead_fds)*sizeof(*readaheads));
+		readahead_fds = n;
+	}
+	ra = readaheads+fd;
 
 	for (;;) {
-		if (1>read(fd, &c, 1)) break;
-		if (!(len & 63)) buf=xrealloc(buf, len+65);
-		if ((buf[len++]=c) == end) break;
+		if (ra->start == ra->end) {
+			if (!ra->buf) ra->buf = xmalloc(READAHEAD);
+			ra->start = 0;
+			ra->end = read(fd, ra->buf, READAHEAD);
+			if (ra->end<1) {
+				ra->end = 0;
+				drop_readahead(fd);
+				break;
+			}
+		}
+
+		// Copy up to the end of the line, or everything there is.
+		found = memchr(ra->buf+ra->start, end, ra->end-ra->start);
+		chunk = (found ? found+1-ra->buf : ra->end) - ra->start;
+		if (len+chunk+1 > size) {
+			size = size*2 > len+chunk+1 ? size*2 : len+chunk+1;
+			buf = xrealloc(buf, size);
+		}
+		memcpy(buf+len, ra->buf+ra->start, chunk);
+		len += chunk;
+		ra->start += chunk;
+		if (found) break;
 	}
 	if (buf) buf[len]=0;
 	if (plen) *plen = len;
@@ -669,19 +853,70 @@ char *get_line(int fd)
 	return buf;
 }
 
-// Copy the rest of in to out and close both files.
+// Copy the rest of in to out, letting the kernel move the data when it
+// can: copy_file_range() between files, splice() to or from a pipe and
+// sendfile() from a file to anything else.  When the kernel won't (other
+// filesystems, O_APPEND, sockets on both ends...), or hasn't copied anything
+// yet when it says it's done (some /proc and /sys files), fall back to
+// read() and write() through a buffer.  Returns how much was copied, or -1
+// if reading failed (errno says why).  Failing to write is still fatal.
 
-void xsendfile(int in, int out)
+#define SENDFILE_CHUNK (1<<30)
+
+long long sendfile_all(int in, int out)
 {
+	struct stat st_in, st_out;
+	long long total = 0, ahead = 0;
 	long len;
-	char buf[4096];
+	int how = 0;
+	char *buf;
 
-	if (in<0) return;
+	if (in<0) return 0;
+
+	// Start with what get_rawline() already read.
+	if (in<readahead_fds && readaheads[in].buf) {
+		struct readahead *ra = readaheads+in;
+
+		xwrite(out, ra->buf+ra->start, ra->end-ra->start);
+		ahead = ra->end-ra->start;
+		ra->start = ra->end;
+		drop_readahead(in);
+	}
+
+	if (!fstat(in, &st_in) && !fstat(out, &st_out)) {
+		if (S_ISFIFO(st_in.st_mode) || S_ISFIFO(st_out.st_mode)) how = 's';
+		else if (S_ISREG(st_in.st_mode))
+			how = S_ISREG(st_out.st_mode) ? 'c' : 'f';
+	}
+	while (how) {
+		if (how == 'c')
+			len = copy_file_range(in, NULL, out, NULL, SENDFILE_CHUNK, 0);
+		else if (how == 's')
+			len = splice(in, NULL, out, NULL, SENDFILE_CHUNK, SPLICE_F_MOVE);
+		else len = sendfile(out, in, NULL, SENDFILE_CHUNK);
+
+		if (len>0) total += len;
+		else if (len<0 && errno==EINTR) continue;
+		else if (!len && total) return ahead+total;
+		// A file to file copy the kernel can't do still works as a sendfile.
+		else how = (how == 'c') ? 'f' : 0;
+	}
+
+	buf = xiobuf(0);
 	for (;;) {
-		len = xread(in, buf, 4096);
+		len = read(in, buf, IOBUF_SIZE);
+		if (len<0 && errno==EINTR) continue;
 		if (len<1) break;
 		xwrite(out, buf, len);
+		total += len;
 	}
+
+	return len<0 ? -1 : ahead+total;
+}
+
+void xsendfile(int in, int out)
+{
+	if (sendfile_all(in, out)<0) perror_exit("xsendfile");
 }
 
 // Open a temporary file to copy an existing file into.
@@ -705,6 +940,7 @@ int copy_tempfile(int fdin, char *name, char **tempname)
 // Abort the copy and delete the temporary file.
 void delete_tempfile(int fdin, int fdout, char **tempname)
 {
+	drop_readahead(fdin);
 	close(fdin);
 	close(fdout);
 	unlink(*tempname);
@@ -729,18 +965,190 @@ void replace_tempfile(int fdin, int fdout, char **tempname)
 	*tempname = NULL;
 }
 
-// Create a 256 entry CRC32 lookup table.
+// CRC32 of len bytes of data, continuing from crc.  Pre and post inversion
+// (and the length, for cksum) are up to the caller.  Little endian is the
+// reflected CRC32 of gzip and ethernet, big endian the one of cksum and bzip2.
+//
+// Eight bytes at a time through the eight crc_tables from scripts/mkcrc.py
+// (slicing by 8), or when the CPU can multiply without carries, by folding 64
+// bytes at a time.  Big endian input goes through the same (reflected)
+// folding with the bits of each byte reversed: a reflected CRC of reflected
+// data is the reflected CRC.
+
+#include "generated/crc.h"
 
-void crc_init(unsigned int *crc_table, int little_endian)
+static unsigned crc_rev32(unsigned crc)
 {
-	unsigned int i;
+	unsigned rev = 0;
+	int i;
+
+	for (i=0; i<32; i++, crc >>= 1) rev = (rev<<1)|(crc&1);
+	return rev;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// The folding constants are x^n mod P for the distances folded over, and the
+// Barrett ones P and x^64/P, all bit reflected (the same ones Linux uses).
+
+#define crc_fold(x, k) _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+	_mm_clmulepi64_si128(x, k, 0x11))
+
+__attribute__((target("pclmul,sse4.1,ssse3")))
+static __m128i crc_load(unsigned char *p, int rev)
+{
+	__m128i x = _mm_loadu_si128((void *)p), lo4 = _mm_set1_epi8(15),
+		nibbles = _mm_set_epi8(15,7,11,3,13,5,9,1,14,6,10,2,12,4,8,0);
+
+	if (!rev) return x;
+	return _mm_or_si128(
+		_mm_shuffle_epi8(_mm_slli_epi16(nibbles, 4), _mm_and_si128(x, lo4)),
+		_mm_shuffle_epi8(nibbles, _mm_and_si128(_mm_srli_epi16(x, 4), lo4)));
+}
+
+// len is a multiple of 16, at least 64.
+
+__attribute__((target("pclmul,sse4.1,ssse3")))
+static unsigned crc_clmul(unsigned crc, unsigned char *p, size_t len, int rev)
+{
+	const __m128i k21 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4),
+		k43 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0),
+		k5 = _mm_set_epi64x(0, 0x163cd6124),
+		poly = _mm_set_epi64x(0x1f7011641, 0x1db710641),
+		mask32 = _mm_set_epi32(0, 0, 0, ~0);
+	__m128i x[4], y;
+	int i;
+
+	for (i=0; i<4; i++) x[i] = crc_load(p+16*i, rev);
+	x[0] = _mm_xor_si128(x[0], _mm_cvtsi32_si128(crc));
+	for (p += 64, len -= 64; len >= 64; p += 64, len -= 64)
+		for (i=0; i<4; i++)
+			x[i] = _mm_xor_si128(crc_fold(x[i], k21), crc_load(p+16*i, rev));
+
+	// Down to 128 bits, then 64, 32, and reduce.
+	y = x[0];
+	for (i=1; i<4; i++) y = _mm_xor_si128(crc_fold(y, k43), x[i]);
+	for (; len; p += 16, len -= 16)
+		y = _mm_xor_si128(crc_fold(y, k43), crc_load(p, rev));
+	y = _mm_xor_si128(_mm_srli_si128(y, 8), _mm_clmulepi64_si128(k43, y, 0x01));
+	y = _mm_xor_si128(_mm_srli_si128(y, 4),
+		_mm_clmulepi64_si128(_mm_and_si128(y, mask32), k5, 0x00));
+	x[0] = _mm_clmulepi64_si128(_mm_and_si128(y, mask32), poly, 0x10);
+	x[0] = _mm_clmulepi64_si128(_mm_and_si128(x[0], mask32), poly, 0x00);
+
+	return _mm_extract_epi32(_mm_xor_si128(y, x[0]), 1);
+}
+
+static int crc_has_clmul(void)
+{
+	unsigned a, b, c, d;
+
+	return __get_cpuid(1, &a, &b, &c, &d)
+		&& (c & bit_PCLMUL) && (c & bit_SSE4_1) && (c & bit_SSSE3);
+}
+
+#elif defined(__aarch64__)
 
-	// Init the CRC32 table (big endian)
-	for (i=0; i<256; i++) {
-		unsigned int j, c = little_endian ? i : i<<24;
-		for (j=8; j; j--)
-			if (little_endian) c = (c&1) ? (c>>1)^0xEDB88320 : c>>1;
-			else c=c&0x80000000 ? (c<<1)^0x04c11db7 : (c<<1);
-		crc_table[i] = c;
+#define crc_mul(a, b) \
+	vreinterpretq_u64_p128(vmull_p64((poly64_t)(a), (poly64_t)(b)))
+
+__attribute__((target("+crypto")))
+static uint64x2_t crc_fold(uint64x2_t x, uint64_t klo, uint64_t khi)
+{
+	return veorq_u64(crc_mul(vgetq_lane_u64(x, 0), klo),
+		crc_mul(vgetq_lane_u64(x, 1), khi));
+}
+
+__attribute__((target("+crypto")))
+static uint64x2_t crc_load(unsigned char *p, int rev)
+{
+	uint8x16_t x = vld1q_u8(p);
+
+	return vreinterpretq_u64_u8(rev ? vrbitq_u8(x) : x);
+}
+
+__attribute__((target("+crypto")))
+static unsigned crc_clmul(unsigned crc, unsigned char *p, size_t len, int rev)
+{
+	uint8x16_t zero = vdupq_n_u8(0);
+	uint64x2_t x[4], y;
+	uint64_t t;
+	int i;
+
+	for (i=0; i<4; i++) x[i] = crc_load(p+16*i, rev);
+	x[0] = veorq_u64(x[0], vsetq_lane_u64(crc, vdupq_n_u64(0), 0));
+	for (p += 64, len -= 64; len >= 64; p += 64, len -= 64)
+		for (i=0; i<4; i++)
+			x[i] = veorq_u64(crc_fold(x[i], 0x154442bd4, 0x1c6e41596),
+				crc_load(p+16*i, rev));
+
+	y = x[0];
+	for (i=1; i<4; i++)
+		y = veorq_u64(crc_fold(y, 0x1751997d0, 0x0ccaa009e), x[i]);
+	for (; len; p += 16, len -= 16)
+		y = veorq_u64(crc_fold(y, 0x1751997d0, 0x0ccaa009e), crc_load(p, rev));
+	y = veorq_u64(vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(y), zero, 8)),
+		crc_mul(vgetq_lane_u64(y, 0), 0x0ccaa009e));
+	y = veorq_u64(vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(y), zero, 4)),
+		crc_mul(vgetq_lane_u64(y, 0) & 0xffffffff, 0x163cd6124));
+	t = vgetq_lane_u64(crc_mul(vgetq_lane_u64(y, 0) & 0xffffffff, 0x1f7011641), 0);
+	y = veorq_u64(y, crc_mul(t & 0xffffffff, 0x1db710641));
+
+	return vgetq_lane_u32(vreinterpretq_u32_u64(y), 1);
+}
+
+static int crc_has_clmul(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_PMULL);
+}
+
+#else
+
+static unsigned crc_clmul(unsigned crc, unsigned char *p, size_t len, int rev)
+{
+	return crc;
+}
+
+static int crc_has_clmul(void)
+{
+	return 0;
+}
+
+#endif
+
+unsigned crc_update(unsigned crc, void *data, size_t len, int little_endian)
+{
+	static int clmul = -1;
+	const unsigned (*t)[256] = crc_tables[!!little_endian];
+	unsigned char *p = data;
+	size_t n;
+
+	// Look at the CPU on first use.
+	if (clmul<0) clmul = crc_has_clmul();
+
+	if (clmul && len>=64) {
+		n = len & ~(size_t)15;
+		if (little_endian) crc = crc_clmul(crc, p, n, 0);
+		else crc = crc_rev32(crc_clmul(crc_rev32(crc), p, n, 1));
+		p += n;
+		len -= n;
 	}
+
+	if (little_endian) {
+		for (; len>=8; len-=8, p+=8) {
+			crc ^= p[0]|(p[1]<<8)|(p[2]<<16)|((unsigned)p[3]<<24);
+			crc = t[7][crc&255]^t[6][(crc>>8)&255]^t[5][(crc>>16)&255]
+				^t[4][crc>>24]^t[3][p[4]]^t[2][p[5]]^t[1][p[6]]^t[0][p[7]];
+		}
+		while (len--) crc = t[0][(crc^*p++)&255]^(crc>>8);
+	} else {
+		for (; len>=8; len-=8, p+=8) {
+			crc ^= ((unsigned)p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+			crc = t[7][crc>>24]^t[6][(crc>>16)&255]^t[5][(crc>>8)&255]
+				^t[4][crc&255]^t[3][p[4]]^t[2][p[5]]^t[1][p[6]]^t[0][p[7]];
+		}
+		while (len--) crc = (crc<<8)^t[0][(crc>>24)^*p++];
+	}
+
+	return crc;
 }
@@ -25,11 +25,46 @@ struct double_list {
 	char *data;
 };
 
+// Memory handed out from big blocks, to be freed all at once.
+struct arena {
+	struct arena *next;
+	long size, used;
+	char data[];
+};
+
 void llist_free(void *list, void (*freeit)(void *data));
 void *llist_pop(void *list);  // actually void **list, but the compiler's dumb
 struct double_list *dlist_add(struct double_list **list, char *data);
+void *arena_alloc(struct arena **arena, long size);
+void arena_free(struct arena **arena, int keep);
+struct double_list *dlist_add_arena(struct arena **arena,
+	struct double_list **list, char *data);
 
 // args.c
+
+// Option tables get_optflags() uses, generated from the NEWTOY() option
+// strings by scripts/mkopts.py.
+
+struct optdef {
+	uint32_t edx[3];   // Flag mask to enable/disable/exclude.
+	char c;            // Short argument character (-1 for a bare longopt)
+	char type;         // Type of arguments to store
+	char flags;        // |=1, ^=2
+	signed char slot;  // Which long in union "this" gets the argument
+};
+
+struct longdef {
+	char *str;
+	int len, opt;      // opt is the option's index in optspec.opts
+};
+
+struct optspec {
+	struct optdef *opts;       // One per flag bit, rightmost option first
+	struct longdef *longopts;  // Tried in order, ending with len 0
+	int minargs, maxargs, stopearly, noerror, nodash, slots;
+	unsigned char bychar[128]; // Index in opts plus one, per character
+};
+
 void get_optflags(void);
 
 // dirtree.c
@@ -37,12 +72,50 @@ struct dirtree {
 	struct dirtree *next, *child, *parent;
 	struct stat st;
 	int depth;
+	int walk;  // dirtree_read_parallel() bookkeeping
 	char name[];
 };
 
+#define DIRTREE_NOSTAT 1  // Only fill in the file type, if it's free
+#define DIRTREE_ORDERED 2 // Parallel walk, callbacks in order on one thread
+
 struct dirtree *dirtree_add_node(char *path);
+struct dirtree *dirtree_flagread(char *path, struct dirtree *parent, int flags,
+                    int (*callback)(char *path, struct dirtree *node));
 struct dirtree *dirtree_read(char *path, struct dirtree *parent,
                     int (*callback)(char *path, struct dirtree *node));
+struct dirtree *dirtree_read_parallel(char *path, struct dirtree *parent,
+                    int threads, int flags,
+                    int (*callback)(char *path, struct dirtree *node));
+
+// A packed tree: nodes linked by index in one array, names in one pool.
+struct dirnode {
+	unsigned next, child, parent;  // 0 for none
+	unsigned name;                 // Offset into dirtree_arena.names
+	mode_t mode;
+	unsigned nlink;
+	uid_t uid;
+	gid_t gid;
+	off_t size;
+	ino_t ino;
+	dev_t dev;
+	time_t atime, mtime, ctime;
+};
+
+struct dirtree_arena {
+	struct dirnode *node;  // node[0] isn't used
+	char *names;
+	unsigned count, size;
+	long namelen, namesize;
+};
+
+#define dirnode_name(da, i) ((da)->names+(da)->node[i].name)
+
+unsigned dirtree_arena_add(struct dirtree_arena *da, char *name,
+                    struct stat *st);
+unsigned dirtree_arena_read(struct dirtree_arena *da, char *path,
+                    unsigned parent, int flags);
+void dirtree_arena_free(struct dirtree_arena *da);
 
 // lib.c
 void xstrcpy(char *dest, char *src, size_t size);
@@ -54,6 +127,8 @@ void perror_exit(char *msg, ...) noreturn;
 void *xmalloc(size_t size);
 void *xzalloc(size_t size);
 void *xrealloc(void *ptr, size_t size);
+#define IOBUF_SIZE (128*1024)
+char *xiobuf(size_t size);
 void *xstrndup(char *s, size_t n);
 void *xstrdup(char *s);
 char *xmsprintf(char *format, ...);
@@ -82,6 +157,9 @@ char *xabspath(char *path);
 void xchdir(char *path);
 void xmkpath(char *path, int mode);
 struct string_list *find_in_path(char *path, char *filename);
+void path_cache_flush(void);
+char *path_cache_find(char *path, char *filename);
+void path_cache_walk(void (*fn)(char *filename, char *found));
 void utoa_to_buf(unsigned n, char *buf, unsigned buflen);
 void itoa_to_buf(int n, char *buf, unsigned buflen);
 char *utoa(unsigned n);
@@ -91,13 +169,19 @@ off_t fdlength(int fd);
 char *xreadlink(char *name);
 void loopfiles_rw(char **argv, int flags, void (*function)(int fd, char *name));
 void loopfiles(char **argv, void (*function)(int fd, char *name));
+void drop_readahead(int fd);
 char *get_rawline(int fd, long *plen, char end);
 char *get_line(int fd);
+long long sendfile_all(int in, int out);
 void xsendfile(int in, int out);
 int copy_tempfile(int fdin, char *name, char **tempname);
 void delete_tempfile(int fdin, int fdout, char **tempname);
 void replace_tempfile(int fdin, int fdout, char **tempname);
-void crc_init(unsigned int *crc_table, int little_endian);
+extern const unsigned crc_tables[2][8][256];
+unsigned crc_update(unsigned crc, void *data, size_t len, int little_endian);
+
+// readfiles.c
+void loopfiles_read(char **argv, void (*function)(char *name, char *data, long len));
 
 // getmountlist.c
 struct mtab_list {
@@ -109,6 +193,25 @@ struct mtab_list {
 	char type[0];
 };
 
-struct mtab_list *getmountlist(int die);
+struct mtab_list *getmountlist(int die, struct arg_list *types, int timeout);
+
+// bunzip.c
+void bunzipStream(int src_fd, int dst_fd, int threads);
+
+struct bunzip_block {
+	long long bit, offset;
+	unsigned int crc;
+};
+
+struct bunzip_index {
+	int level, count;
+	long long size;
+	struct bunzip_block *blocks;	// blocks[count-1] is the end of stream
+};
 
-void bunzipStream(int src_fd, int dst_fd);
+struct bunzip_index *bunzip_index(int src_fd, int threads);
+void bunzip_index_free(struct bunzip_index *index);
+void bunzip_index_save(struct bunzip_index *index, int fd);
+struct bunzip_index *bunzip_index_load(int fd);
+void bunzip_range(int src_fd, struct bunzip_index *index, long long offset,
+	long long len, int dst_fd);
@@ -35,11 +35,9 @@ void *llist_pop(void *list)
 	return (void *)next;
 }
 
-// Add an entry to the end off a doubly linked list
-struct double_list *dlist_add(struct double_list **list, char *data)
+static struct double_list *dlist_link(struct double_list **list,
+	struct double_list *line, char *data)
 {
-	struct double_list *line = xmalloc(sizeof(struct double_list));
-
 	line->data = data;
 	if (*list) {
 		line->next = *list;
@@ -50,3 +48,59 @@ struct double_list *dlist_add(struct double_list **list, char *data)
 
 	return line;
 }
+
+// Add an entry to the end off a doubly linked list
+struct double_list *dlist_add(struct double_list **list, char *data)
+{
+	return dlist_link(list, xmalloc(sizeof(struct double_list)), data);
+}
+
+// An arena is a list of blocks, newest first, that allocations are carved
+// out of in order.  Nothing in it is freed on its own: arena_free() frees the
+// lot, or with keep, all but the newest block, which is reused from the
+// start.  So a list built and thrown away over and over costs no malloc() at
+// all once the arena's big enough.
+
+#define ARENA_BLOCK 65536
+
+void *arena_alloc(struct arena **arena, long size)
+{
+	struct arena *block = *arena;
+	void *ret;
+
+	size = (size+15) & ~15L;
+	if (!block || block->used+size > block->size) {
+		long len = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+
+		block = xmalloc(sizeof(struct arena)+len);
+		block->next = *arena;
+		block->size = len;
+		block->used = 0;
+		*arena = block;
+	}
+	ret = block->data+block->used;
+	block->used += size;
+
+	return ret;
+}
+
+void arena_free(struct arena **arena, int keep)
+{
+	if (keep && *arena) {
+		llist_free((*arena)->next, NULL);
+		(*arena)->next = NULL;
+		(*arena)->used = 0;
+	} else {
+		llist_free(*arena, NULL);
+		*arena = NULL;
+	}
+}
+
+// dlist_add() with the node in an arena.  Don't free it, or pass the list
+// to llist_free() without a freeit() that leaves the node alone.
+struct double_list *dlist_add_arena(struct arena **arena,
+	struct double_list **list, char *data)
+{
+	return dlist_link(list, arena_alloc(arena, sizeof(struct double_list)),
+		data);
+}
@@ -0,0 +1,266 @@
+/* vi: set sw=4 ts=4 : */
+/* readfiles.c - Read a list of files ahead of the command using them. */
+
+#include "toys.h"
+
+// loopfiles_read() calls function(name, data, len) with the contents of each
+// file in argv in turn, in chunks of up to READFILES_CHUNK bytes, and then
+// with len 0 at the end of each file.  An empty argv reads stdin, and "-"
+// means stdin.  Files that can't be opened are reported and skipped (like
+// loopfiles()); a read error is reported and ends the file early.
+//
+// With io_uring, the next READFILES_AHEAD files are opened and their first
+// chunk read while function() works on the current one, and the current
+// file's next chunk is read into a second buffer meanwhile, so commands like
+// sha1sum and cksum on lots of small files don't wait for each open() and
+// read() in turn.  Without it (old kernels and headers, seccomp sandboxes
+// that don't allow it), the same callbacks come from plain read() calls.
+
+#define READFILES_CHUNK (128*1024)
+#define READFILES_AHEAD 8
+
+static void readfiles_plain(char **argv, void (*function)(char *, char *, long))
+{
+	char *buf = xiobuf(READFILES_CHUNK), *name = "-";
+	long len;
+	int fd;
+
+	do {
+		if (*argv) name = *argv;
+		if (!strcmp(name, "-")) fd = 0;
+		else if (0>(fd = open(name, O_RDONLY))) {
+			perror_msg("%s", name);
+			toys.exitval = 1;
+			continue;
+		}
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		while (0<(len = read(fd, buf, READFILES_CHUNK))) function(name, buf, len);
+		if (len<0) {
+			perror_msg("%s", name);
+			toys.exitval = 1;
+		}
+		function(name, buf, 0);
+		if (fd) close(fd);
+	} while (*argv && *++argv);
+}
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define READFILES_URING
+#endif
+#endif
+
+#ifdef READFILES_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// One file in the window: at most one open or read of it is in flight, and
+// at most one chunk it read is waiting to be handed to function().
+struct readfile {
+	char *name, *buf[2];
+	long long off;       // Where the next read starts (-1 for stdin)
+	int fd, err, eof;
+	int busy;            // An open or read is in flight
+	int next;            // Buffer the next read goes into
+	int ready;           // Buffer waiting for function(), or -1
+	long len;            // How much of it is data
+};
+
+static struct readfiles_ring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail,
+		*cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned queued;
+} ring;
+
+static int readfiles_setup(void)
+{
+	struct io_uring_params p;
+	size_t sq_len, cq_len;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring.fd = syscall(__NR_io_uring_setup, 2*READFILES_AHEAD, &p);
+	if (ring.fd<0) return -1;
+
+	// OPENAT and READ came with RW_CUR_POS (5.6), and both rings are in one
+	// mapping since 5.4.
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) goto fail;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) goto fail;
+	sq_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	cq_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if (cq_len>sq_len) sq_len = cq_len;
+	sq = cq = mmap(0, sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		ring.fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED) goto fail;
+	ring.sqes = mmap(0, p.sq_entries*sizeof(struct io_uring_sqe),
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring.fd,
+		IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED) goto fail;
+
+	ring.sq_head = (void *)(sq+p.sq_off.head);
+	ring.sq_tail = (void *)(sq+p.sq_off.tail);
+	ring.sq_mask = (void *)(sq+p.sq_off.ring_mask);
+	ring.sq_array = (void *)(sq+p.sq_off.array);
+	ring.cq_head = (void *)(cq+p.cq_off.head);
+	ring.cq_tail = (void *)(cq+p.cq_off.tail);
+	ring.cq_mask = (void *)(cq+p.cq_off.ring_mask);
+	ring.cqes = (void *)(cq+p.cq_off.cqes);
+
+	return 0;
+
+fail:
+	close(ring.fd);
+	return -1;
+}
+
+// Queue an open (name) or a read (of file->fd into buf) for file.
+static void readfiles_queue(struct readfile *file, int op, char *buf)
+{
+	unsigned tail = *ring.sq_tail, i = tail & *ring.sq_mask;
+	struct io_uring_sqe *sqe = ring.sqes+i;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->user_data = (unsigned long)file;
+	if (op == IORING_OP_OPENAT) {
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long)file->name;
+		sqe->open_flags = O_RDONLY;
+	} else {
+		sqe->fd = file->fd;
+		sqe->addr = (unsigned long)buf;
+		sqe->len = READFILES_CHUNK;
+		sqe->off = file->off;
+	}
+	ring.sq_array[i] = i;
+	__atomic_store_n(ring.sq_tail, tail+1, __ATOMIC_RELEASE);
+	ring.queued++;
+	file->busy = 1;
+}
+
+static void readfiles_read(struct readfile *file)
+{
+	readfiles_queue(file, IORING_OP_READ, file->buf[file->next]);
+}
+
+// Submit what's queued, wait for at least one completion and handle them
+// all.  Returns -1 if the kernel wouldn't take the requests.
+static int readfiles_wait(void)
+{
+	unsigned head, tail;
+	struct io_uring_cqe *cqe;
+	struct readfile *file;
+
+	while (0>syscall(__NR_io_uring_enter, ring.fd, ring.queued, 1,
+		IORING_ENTER_GETEVENTS, NULL, 0))
+			if (errno != EINTR) return -1;
+	ring.queued = 0;
+
+	head = *ring.cq_head;
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = ring.cqes + (head & *ring.cq_mask);
+		file = (void *)(unsigned long)cqe->user_data;
+		file->busy = 0;
+		if (file->fd<0) {
+			// An open finished: start reading.
+			if (cqe->res<0) file->err = -cqe->res;
+			else {
+				file->fd = cqe->res;
+				readfiles_read(file);
+			}
+		} else if (cqe->res<0) file->err = -cqe->res;
+		else {
+			file->ready = file->next;
+			file->next ^= 1;
+			file->len = cqe->res;
+			if (!cqe->res) file->eof = 1;
+			else if (file->off != -1) file->off += cqe->res;
+		}
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static void readfiles_start(struct readfile *file, char *name)
+{
+	file->name = name;
+	file->fd = -1;
+	file->err = file->eof = file->busy = file->next = 0;
+	file->ready = -1;
+	file->off = 0;
+	if (!strcmp(name, "-")) {
+		file->fd = 0;
+		file->off = -1;
+		readfiles_read(file);
+	} else readfiles_queue(file, IORING_OP_OPENAT, 0);
+}
+
+static int readfiles_uring(char **argv, void (*function)(char *, char *, long))
+{
+	struct readfile files[READFILES_AHEAD], *file;
+	char *stdin_only[] = {"-", 0};
+	int count, started, cur, i;
+
+	if (readfiles_setup()) return -1;
+	if (!*argv) argv = stdin_only;
+	for (count = 0; argv[count]; count++);
+	for (i = 0; i<READFILES_AHEAD; i++) {
+		files[i].buf[0] = xmalloc(READFILES_CHUNK);
+		files[i].buf[1] = xmalloc(READFILES_CHUNK);
+	}
+
+	for (started = cur = 0; cur<count; cur++) {
+		while (started<count && started<cur+READFILES_AHEAD) {
+			readfiles_start(files+started%READFILES_AHEAD, argv[started]);
+			started++;
+		}
+		file = files+cur%READFILES_AHEAD;
+
+		for (;;) {
+			if (file->ready>=0) {
+				char *buf = file->buf[file->ready];
+				long len = file->len;
+
+				// Read the next chunk while function() has this one.
+				file->ready = -1;
+				if (!file->eof && !file->busy) readfiles_read(file);
+				function(file->name, buf, len);
+				if (!len) break;
+			} else if (file->err) {
+				errno = file->err;
+				perror_msg("%s", file->name);
+				toys.exitval = 1;
+				if (file->fd>=0) function(file->name, file->buf[0], 0);
+				break;
+			} else if (readfiles_wait()) perror_exit("io_uring");
+		}
+
+		// Make sure nothing is still reading into the buffers before they're
+		// reused for a later file, then close this one.
+		while (file->busy) if (readfiles_wait()) perror_exit("io_uring");
+		if (file->fd>0) close(file->fd);
+	}
+
+	for (i = 0; i<READFILES_AHEAD; i++) {
+		free(files[i].buf[0]);
+		free(files[i].buf[1]);
+	}
+	close(ring.fd);
+
+	return 0;
+}
+#endif
+
+void loopfiles_read(char **argv, void (*function)(char *name, char *data, long len))
+{
+#ifdef READFILES_URING
+	if (!readfiles_uring(argv, function)) return;
+#endif
+	readfiles_plain(argv, function);
+}
@@ -6,12 +6,16 @@
 
 #include "toys.h"
 
+#include "generated/opts.h"
+
 // Populate toy_list[].
 
 #undef NEWTOY
 #undef OLDTOY
-#define NEWTOY(name, opts, flags) {#name, name##_main, opts, flags},
-#define OLDTOY(name, oldname, opts, flags) {#name, oldname##_main, opts, flags},
+#define NEWTOY(name, opts, flags) \
+	{#name, name##_main, opts, flags, OPTSPEC_##name},
+#define OLDTOY(name, oldname, opts, flags) \
+	{#name, oldname##_main, opts, flags, OPTSPEC_##name},
 
 struct toy_list toy_list[] = {
 #include "generated/newtoys.h"
@@ -19,6 +23,19 @@ struct toy_list toy_list[] = {
 
 #define TOY_LIST_LEN (sizeof(toy_list)/sizeof(struct toy_list))
 
+// Number the applets in toy_list[] order: TOY_cat is the index of "cat".
+
+#undef NEWTOY
+#undef OLDTOY
+#define NEWTOY(name, opts, flags) TOY_##name,
+#define OLDTOY(name, oldname, opts, flags) TOY_##name,
+
+enum {
+#include "generated/newtoys.h"
+};
+
+#include "generated/applets.h"
+
 // global context for this applet.
 
 struct toy_context toys;
@@ -27,27 +44,21 @@ char toybuf[4096];
 
 struct toy_list *toy_find(char *name)
 {
-	int top, bottom, middle;
+	unsigned hash = APPLET_SEED, slot;
+	char *s;
 
-	// If the name starts with "toybox", accept that as a match.  Otherwise
-	// skip the first entry, which is out of order.
+	// If the name starts with "toybox", accept that as a match.
 
 	if (!strncmp(name,"toybox",6)) return toy_list;
-	bottom = 1;
 
-	// Binary search to find this applet.
+	// Every applet has its own slot in the perfect hash table, so one strcmp()
+	// tells whether this is it.  (Same hash as scripts/mkapplets.py.)
 
-	top = TOY_LIST_LEN-1;
-	for (;;) {
-		int result;
+	for (s = name; *s; s++) hash = (hash ^ *(unsigned char *)s) * 16777619;
+	slot = applet_hash[hash >> (32-APPLET_BITS)];
+	if (slot && !strcmp(name, toy_list[slot-1].name)) return toy_list+slot-1;
 
-		middle = (top+bottom)/2;
-		if (middle<bottom || middle>top) return NULL;
-		result = strcmp(name,toy_list[middle].name);
-		if (!result) return toy_list+middle;
-		if (result<0) top=--middle;
-		else bottom = ++middle;
-	}
+	return NULL;
 }
 
 // Figure out whether or not anything is using the option parsing logic,
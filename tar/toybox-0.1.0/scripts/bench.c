@@ -0,0 +1,454 @@
+/* vi: set ts=4 :*/
+/* Time the applets that move a lot of data, next to another implementation.
+ *
+ *   bench [-n runs] [-d dir] [-r reference] ./toybox [name...]
+ *
+ * builds the test data in dir (default "benchdir", kept for the next run):
+ * a large text file, many small files, a deep tree, a sparse file and a
+ * bzip2 archive.  Then it runs each benchmark (or just the named ones) with
+ * toybox and with the reference: the command of the same name in $PATH
+ * (coreutils, usually), or "reference command" if one is given, such as
+ * -r busybox.  For each it prints the best time of the runs (default 3),
+ * the throughput, the peak RSS and the number of system calls.  The system
+ * calls are counted with ptrace in one more run, so that tracing doesn't
+ * slow down the timed ones.
+ *
+ * The data needs bzip2 in $PATH for the archive (bzcat is skipped without
+ * it) and about 1.5 gigabytes of disk, half of that in sparse files.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEXT_SIZE (32<<20)
+#define BIG_COPIES 8
+#define SPARSE_SIZE (1LL<<30)
+
+struct bench {
+	char *name;
+	char *args[12];     // toybox and the reference, unless ref is set
+	char *ref[12];      // the reference, when its options differ
+	char *in, *out;     // stdin (default /dev/null) and stdout
+	char *size;         // bytes processed: this file or tree, default out
+	char *need;         // skip the benchmark if this file is missing
+	void (*prep)(void); // before every run
+};
+
+static char *toybox, *reference;
+static unsigned long long seed = 1;
+
+static void die(char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static unsigned rnd(unsigned n)
+{
+	seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+	return (seed>>33) % n;
+}
+
+static FILE *xfopen(char *name, char *mode)
+{
+	FILE *fp = fopen(name, mode);
+
+	if (!fp) die(name);
+	return fp;
+}
+
+// Lines of words, so sort and patch see something like real text.
+static void make_text(char *name, long size)
+{
+	FILE *fp = xfopen(name, "w");
+	char words[1024][12];
+	long len = 0;
+	int i, j, n;
+
+	for (i=0; i<1024; i++) {
+		n = 1+rnd(10);
+		for (j=0; j<n; j++) words[i][j] = 'a'+rnd(26);
+		words[i][n] = 0;
+	}
+	while (len < size) {
+		n = 1+rnd(12);
+		for (i=0; i<n; i++)
+			len += fprintf(fp, i ? " %s" : "%s", words[rnd(1024)]);
+		fputc('\n', fp);
+		len++;
+	}
+	if (fclose(fp)) die(name);
+}
+
+static char *slurp(char *name, long *len)
+{
+	FILE *fp = xfopen(name, "r");
+	char *buf;
+
+	fseek(fp, 0, SEEK_END);
+	*len = ftell(fp);
+	rewind(fp);
+	buf = malloc(*len+1);
+	if (!buf || fread(buf, 1, *len, fp) != *len) die(name);
+	buf[*len] = 0;
+	fclose(fp);
+
+	return buf;
+}
+
+// A unified diff changing every 1000th line of text (as ptext), with 3 lines
+// of context.
+static void make_patch(char *name, char *text)
+{
+	FILE *fp = xfopen(name, "w");
+	char *buf, **lines;
+	long len, count = 0, i, j;
+
+	buf = slurp(text, &len);
+	lines = malloc((len/2+1)*sizeof(char *));
+	for (i=0; i<len; i++) {
+		lines[count++] = buf+i;
+		i += strcspn(buf+i, "\n");
+		buf[i] = 0;
+	}
+	fprintf(fp, "--- a/ptext\n+++ b/ptext\n");
+	for (i=500; i+3<count; i+=1000) {
+		fprintf(fp, "@@ -%ld,7 +%ld,7 @@\n", i-2, i-2);
+		for (j=i-3; j<i; j++) fprintf(fp, " %s\n", lines[j]);
+		fprintf(fp, "-%s\n+%s patched\n", lines[i], lines[i]);
+		for (j=i+1; j<i+4; j++) fprintf(fp, " %s\n", lines[j]);
+	}
+	if (fclose(fp)) die(name);
+	free(lines);
+	free(buf);
+}
+
+static void make_file(char *name, long size)
+{
+	static char block[8192];
+	int fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	long i;
+
+	if (fd<0) die(name);
+	for (i=0; i<sizeof(block); i++) block[i] = 'a'+rnd(26);
+	if (write(fd, block, size) != size) die(name);
+	close(fd);
+}
+
+static void make_dir(char *name)
+{
+	if (mkdir(name, 0755) && errno != EEXIST) die(name);
+}
+
+// 5000 files of 1-8k in 50 directories.
+static void make_small(void)
+{
+	char name[64];
+	int i, j;
+
+	make_dir("small");
+	for (i=0; i<50; i++) {
+		sprintf(name, "small/%02d", i);
+		make_dir(name);
+		for (j=0; j<100; j++) {
+			sprintf(name, "small/%02d/%03d", i, j);
+			make_file(name, 1024+rnd(7*1024));
+		}
+	}
+}
+
+// 100 nested directories with 10 files each.
+static void make_deep(void)
+{
+	char name[PATH_MAX], *end;
+	int i, j;
+
+	end = name + sprintf(name, "deep");
+	make_dir(name);
+	for (i=0; i<100; i++) {
+		for (j=0; j<10; j++) {
+			sprintf(end, "/f%d", j);
+			make_file(name, 2048);
+		}
+		end += sprintf(end, "/d%02d", i);
+		make_dir(name);
+	}
+}
+
+// One gigabyte with 64k of data every 64 megabytes.
+static void make_sparse(void)
+{
+	static char block[65536];
+	int fd = open("sparse", O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	long long off;
+
+	if (fd<0) die("sparse");
+	memset(block, 'x', sizeof(block));
+	for (off=0; off<SPARSE_SIZE; off+=64<<20)
+		if (pwrite(fd, block, sizeof(block), off) != sizeof(block))
+			die("sparse");
+	if (ftruncate(fd, SPARSE_SIZE)) die("sparse");
+	close(fd);
+}
+
+static void make_data(char *dir)
+{
+	FILE *fp;
+	long len;
+	char *buf;
+	int i;
+
+	make_dir(dir);
+	if (chdir(dir)) die(dir);
+	if (!access(".done", F_OK)) return;
+
+	fprintf(stderr, "Creating test data in %s\n", dir);
+	make_text("text", TEXT_SIZE);
+	buf = slurp("text", &len);
+	fp = xfopen("big", "w");
+	for (i=0; i<BIG_COPIES; i++) fwrite(buf, 1, len, fp);
+	if (fclose(fp)) die("big");
+	free(buf);
+	make_patch("text.patch", "text");
+	make_small();
+	make_deep();
+	make_sparse();
+	if (system("bzip2 -kf text"))
+		fprintf(stderr, "No bzip2, skipping bzcat\n");
+
+	close(open(".done", O_WRONLY|O_CREAT, 0644));
+}
+
+static void rm_tree(char *name)
+{
+	struct stat st;
+	struct dirent *dd;
+	char path[PATH_MAX];
+	DIR *dir;
+
+	if (lstat(name, &st)) return;
+	if (S_ISDIR(st.st_mode) && (dir = opendir(name))) {
+		while ((dd = readdir(dir))) {
+			if (!strcmp(dd->d_name, ".") || !strcmp(dd->d_name, "..")) continue;
+			snprintf(path, sizeof(path), "%s/%s", name, dd->d_name);
+			rm_tree(path);
+		}
+		closedir(dir);
+		rmdir(name);
+	} else unlink(name);
+}
+
+static long long du(char *name)
+{
+	struct stat st;
+	struct dirent *dd;
+	char path[PATH_MAX];
+	long long size = 0;
+	DIR *dir;
+
+	if (lstat(name, &st)) return 0;
+	if (!S_ISDIR(st.st_mode)) return st.st_size;
+	if ((dir = opendir(name))) {
+		while ((dd = readdir(dir))) {
+			if (!strcmp(dd->d_name, ".") || !strcmp(dd->d_name, "..")) continue;
+			snprintf(path, sizeof(path), "%s/%s", name, dd->d_name);
+			size += du(path);
+		}
+		closedir(dir);
+	}
+
+	return size;
+}
+
+static void prep_copy(void)
+{
+	rm_tree("copy");
+}
+
+static void prep_patch(void)
+{
+	char *buf;
+	long len;
+	FILE *fp;
+
+	buf = slurp("text", &len);
+	fp = xfopen("ptext", "w");
+	fwrite(buf, 1, len, fp);
+	if (fclose(fp)) die("ptext");
+	free(buf);
+}
+
+static void prep_image(void)
+{
+	rm_tree("image");
+}
+
+static struct bench benches[] = {
+	{"cat", {"cat", "big"}, {0}, 0, "/dev/null", "big"},
+	{"cat sparse", {"cat", "sparse"}, {0}, 0, "/dev/null", "sparse"},
+	{"sha1sum", {"sha1sum", "big"}, {0}, 0, "/dev/null", "big"},
+	{"cksum", {"cksum", "big"}, {0}, 0, "/dev/null", "big"},
+	{"sort", {"sort", "text"}, {0}, 0, "out", "text"},
+	{"bzcat", {"bzcat", "text.bz2"}, {0}, 0, "/dev/null", "text", "text.bz2"},
+	{"seq", {"seq", "10000000"}, {0}, 0, "out"},
+	{"patch", {"patch", "-p1", "-i", "text.patch"}, {0}, 0, "/dev/null",
+		"text", 0, prep_patch},
+	{"cp big", {"cp", "big", "copy"}, {0}, 0, 0, "big", 0, prep_copy},
+	{"cp sparse", {"cp", "sparse", "copy"}, {0}, 0, 0, "sparse", 0, prep_copy},
+	{"cp -r small", {"cp", "-r", "small", "copy"}, {0}, 0, 0, "small", 0,
+		prep_copy},
+	{"cp -r deep", {"cp", "-r", "deep", "copy"}, {0}, 0, 0, "deep", 0,
+		prep_copy},
+	{"mke2fs -g", {"mke2fs", "-q", "-b", "4096", "-g", "small", "image",
+		"65536"}, {"mke2fs", "-q", "-F", "-b", "4096", "-d", "small", "image",
+		"65536"}, 0, "/dev/null", "small", 0, prep_image},
+};
+
+// Run the command once with stdin and stdout redirected.  Returns the wall
+// time in seconds (or the system call count, if trace), or -1 if it failed.
+static double run(struct bench *b, char **argv, int trace, struct rusage *ru)
+{
+	struct timespec start, end;
+	long long calls = 0;
+	int status, fd;
+	pid_t pid;
+
+	if (b->prep) b->prep();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!(pid = fork())) {
+		fd = open(b->in ? b->in : "/dev/null", O_RDONLY);
+		if (fd<0 || dup2(fd, 0)<0) die(b->in);
+		if (b->out) {
+			fd = open(b->out, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+			if (fd<0 || dup2(fd, 1)<0) die(b->out);
+		}
+		if (trace) {
+			ptrace(PTRACE_TRACEME, 0, 0, 0);
+			raise(SIGSTOP);
+		}
+		execvp(*argv, argv);
+		die(*argv);
+	}
+	if (pid<0) die("fork");
+
+	if (!trace) {
+		if (wait4(pid, &status, 0, ru)<0) die("wait");
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) return -1;
+		return end.tv_sec-start.tv_sec + (end.tv_nsec-start.tv_nsec)/1e9;
+	}
+
+	// Count the system call stops of the command and all its threads.
+	// Every call stops on entry and on exit (except exit itself).
+	if (waitpid(pid, &status, 0)<0 || !WIFSTOPPED(status)) return -1;
+	ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACECLONE
+		|PTRACE_O_TRACEFORK|PTRACE_O_TRACEVFORK|PTRACE_O_EXITKILL);
+	if (ptrace(PTRACE_SYSCALL, pid, 0, 0)) return -1;
+	for (;;) {
+		int sig = 0;
+		pid_t p = waitpid(-1, &status, __WALL);
+
+		if (p<0) break;
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			if (p == pid && (WIFSIGNALED(status) || WEXITSTATUS(status)))
+				calls = -2;
+			continue;
+		}
+		if (WSTOPSIG(status) == (SIGTRAP|0x80)) {
+			if (calls >= 0) calls++;
+		} else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP)
+			sig = WSTOPSIG(status);
+		ptrace(PTRACE_SYSCALL, p, 0, sig);
+	}
+
+	return calls<0 ? -1 : (calls+1)/2;
+}
+
+// Time one implementation: argv is the benchmark's command line after the
+// toybox or reference prefix (if any).
+static void measure(struct bench *b, char *label, char *prefix, char **args,
+	int runs)
+{
+	char *argv[16];
+	struct rusage ru;
+	double best = -1, t, calls;
+	long long size;
+	long rss = 0;
+	int i, n = 0;
+
+	if (prefix) argv[n++] = prefix;
+	for (i=0; args[i]; i++) argv[n++] = args[i];
+	argv[n] = 0;
+
+	for (i=0; i<runs; i++) {
+		if ((t = run(b, argv, 0, &ru))<0) {
+			printf("%-12s %-10s failed\n", b->name, label);
+			return;
+		}
+		if (best<0 || t<best) best = t;
+		if (ru.ru_maxrss>rss) rss = ru.ru_maxrss;
+	}
+	calls = run(b, argv, 1, &ru);
+	size = du(b->size ? b->size : b->out);
+
+	printf("%-12s %-10s %8.3fs %9.1f MB/s %8ld KiB", b->name, label, best,
+		best>0 ? size/best/(1<<20) : 0, rss);
+	if (calls<0) printf("          -\n");
+	else printf(" %10.0f\n", calls);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	char *dir = "benchdir", path[PATH_MAX];
+	int i, j, runs = 3, opt;
+
+	while ((opt = getopt(argc, argv, "n:d:r:")) != -1) {
+		if (opt == 'n') runs = atoi(optarg);
+		else if (opt == 'd') dir = optarg;
+		else if (opt == 'r') reference = optarg;
+		else break;
+	}
+	if (opt != -1 || optind >= argc || runs<1) {
+		fprintf(stderr, "usage: bench [-n runs] [-d dir] [-r reference] "
+			"./toybox [name...]\n");
+		return 1;
+	}
+	if (!realpath(argv[optind], path)) die(argv[optind]);
+	toybox = strdup(path);
+	make_data(dir);
+
+	printf("%-12s %-10s %9s %14s %12s %10s\n", "benchmark", "command",
+		"time", "throughput", "peak RSS", "syscalls");
+	for (i=0; i<sizeof(benches)/sizeof(*benches); i++) {
+		struct bench *b = benches+i;
+
+		if (optind+1 < argc) {
+			for (j=optind+1; j<argc; j++) if (!strcmp(argv[j], b->name)) break;
+			if (j == argc) continue;
+		}
+		if (b->need && access(b->need, R_OK)) continue;
+		measure(b, "toybox", toybox, b->args, runs);
+		measure(b, reference ? reference : *b->args, reference,
+			*b->ref ? b->ref : b->args, runs);
+	}
+	rm_tree("copy");
+	rm_tree("image");
+	unlink("ptext");
+	unlink("out");
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+#!/usr/bin/python
+
+# Write the applet hash table toy_find() uses instead of a binary search of
+# toy_list[]: every applet in toys/*.c (plus "toybox") gets its own slot,
+# with a seed found here so no two names collide.  A slot holds the applet's
+# toy_list[] index plus one, behind its USE_ macro so applets that aren't
+# configured in leave it 0.
+
+import glob, re, sys
+
+names = [("toybox", None)]
+for f in sorted(glob.glob("toys/*.c")):
+  for line in open(f):
+    m = re.match(r"USE_(\w+)\((?:NEW|OLD)TOY\((\w+),", line)
+    if m: names.append((m.group(2), m.group(1)))
+
+def fnv(seed, name):
+  h = seed
+  for c in name.encode(): h = ((h ^ c) * 16777619) & 0xffffffff
+  return h
+
+bits = 1
+while 1 << bits < 4 * len(names): bits += 1
+for seed in range(1, 1 << 32):
+  slots = {}
+  for name, use in names:
+    slot = fnv(seed, name) >> (32 - bits)
+    if slot in slots: break
+    slots[slot] = (name, use)
+  else: break
+
+out = sys.stdout
+out.write("// Generated by scripts/mkapplets.py, do not edit.\n\n")
+out.write("#define APPLET_SEED %du\n#define APPLET_BITS %d\n\n" % (seed, bits))
+out.write("static const unsigned short applet_hash[1<<APPLET_BITS] = {\n")
+for slot in sorted(slots):
+  name, use = slots[slot]
+  if use: out.write("\t[%d] = 0 USE_%s(+TOY_%s+1),\n" % (slot, use, name))
+  else: out.write("\t[%d] = TOY_%s+1,\n" % (slot, name))
+out.write("};\n")
@@ -0,0 +1,36 @@
+#!/usr/bin/python
+
+# Write the CRC32 tables crc_update() uses, so no command has to build them
+# at runtime: crc_tables[little_endian][n][byte] is the CRC of the byte
+# followed by n zero bytes (table 0 is the usual byte at a time table, the
+# other seven are for slicing by 8).
+
+import sys
+
+def table(little_endian):
+  t = []
+  for i in range(256):
+    c = i if little_endian else i << 24
+    for j in range(8):
+      if little_endian: c = (c >> 1) ^ 0xEDB88320 if c & 1 else c >> 1
+      else: c = ((c << 1) ^ 0x04c11db7 if c & 0x80000000 else c << 1) & 0xffffffff
+    t.append(c)
+  tables = [t]
+  for n in range(1, 8):
+    p = tables[-1]
+    if little_endian: tables.append([(x >> 8) ^ t[x & 255] for x in p])
+    else: tables.append([((x << 8) & 0xffffffff) ^ t[x >> 24] for x in p])
+  return tables
+
+out = sys.stdout
+out.write("// Generated by scripts/mkcrc.py, do not edit.\n\n")
+out.write("const unsigned crc_tables[2][8][256] = {\n")
+for le in (0, 1):
+  out.write("\t{\n")
+  for t in table(le):
+    out.write("\t\t{\n")
+    for i in range(0, 256, 8):
+      out.write("\t\t\t" + " ".join("0x%08x," % x for x in t[i:i+8]) + "\n")
+    out.write("\t\t},\n")
+  out.write("\t},\n")
+out.write("};\n")
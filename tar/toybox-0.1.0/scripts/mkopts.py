@@ -0,0 +1,133 @@
+#!/usr/bin/python
+
+# Write the option tables get_optflags() uses instead of parsing each
+# applet's option string (see the top of lib/args.c) every time it runs.
+# Parts of an option string inside USE_X() depend on the configuration, so
+# each combination of them gets its own #if branch.
+
+import glob, itertools, re, sys
+
+def debug(msg):
+  sys.exit("mkopts: " + msg)
+
+# [(text, config or None)] for an option string: "ab" USE_X("c") "d"
+def pieces(expr):
+  out, use = [], None
+  for m in re.finditer(r'USE_(\w+)\(|"([^"]*)"|(\))|NULL|(\S)', expr):
+    if m.group(1): use = m.group(1)
+    elif m.group(2) is not None: out.append((m.group(2), use))
+    elif m.group(3): use = None
+    elif m.group(4): debug("can't parse " + expr)
+  return out
+
+# Same as the string parsing get_optflags() used to do.
+def parse(s):
+  spec = {"min": 0, "max": "INT_MAX", "stop": 0, "noerror": 0, "nodash": 0}
+  i = 0
+  while i < len(s):
+    c = s[i]
+    if c == "^": spec["stop"] += 1
+    elif c == "<": i += 1; spec["min"] = ord(s[i]) - 48
+    elif c == ">": i += 1; spec["max"] = ord(s[i]) - 48
+    elif c == "?": spec["noerror"] += 1
+    elif c == "&": spec["nodash"] += 1
+    else: break
+    i += 1
+  if i == len(s): spec["stop"] += 1
+
+  opts, longopts, this = [], [], None
+  while i < len(s):
+    c = s[i]
+    if not this:
+      this = {"c": 0, "type": 0, "flags": 0, "edx": [1, 0, 0]}
+      opts.append(this)
+    if c == "(":
+      end = s.find(")", i)
+      if end < 0: debug("unterminated longopt in " + s)
+      longopts.append((s[i+1:end], this))
+      i = end
+      if not this["c"]: this["c"] = -1
+    elif c in ":*#@": this["type"] = c
+    elif c in "+~!":
+      i += 1
+      for n, opt in enumerate(reversed(opts)):
+        if opt["c"] == s[i]: break
+      else: debug("no -%s before %s in %s" % (s[i], c, s))
+      this["edx"]["+~!".index(c)] |= 1 << n
+    elif c == "[": pass
+    elif c == "|": this["flags"] |= 1
+    elif c == "^": this["flags"] |= 2
+    elif this["c"]:
+      this = None
+      continue
+    else: this["c"] = c
+    i += 1
+
+  # The rightmost option is bit 0, and its argument goes in the first slot.
+  opts.reverse()
+  slots = 0
+  for bit, opt in enumerate(opts):
+    opt["edx"] = [x << bit for x in opt["edx"]]
+    opt["slot"] = -1
+    if opt["type"]:
+      opt["slot"] = slots
+      slots += 1
+  spec["slots"] = slots
+  spec["opts"] = opts
+  spec["longopts"] = [(name, opts.index(opt)) for name, opt in reversed(longopts)]
+  return spec
+
+def char(c):
+  if c in (0, -1): return str(c)
+  return "'\\''" if c == "'" else "'\\\\'" if c == "\\" else "'%s'" % c
+
+def table(name, spec):
+  out = []
+  opts, longopts = "0", "0"
+  if spec["opts"]:
+    opts = "optdef_" + name
+    out.append("static struct optdef %s[] = {\n" % opts)
+    for opt in spec["opts"]:
+      out.append("\t{{0x%x, 0x%x, 0x%x}, %s, %s, %d, %d},\n" % (tuple(opt["edx"])
+        + (char(opt["c"]), char(opt["type"]), opt["flags"], opt["slot"])))
+    out.append("};\n")
+  if spec["longopts"]:
+    longopts = "longdef_" + name
+    out.append("static struct longdef %s[] = {\n" % longopts)
+    for lname, opt in spec["longopts"]:
+      out.append('\t{"%s", %d, %d},\n' % (lname, len(lname), opt))
+    out.append("\t{0}\n};\n")
+  bychar = {}
+  for n, opt in enumerate(spec["opts"]):
+    c = opt["c"]
+    if c not in (0, -1) and ord(c) < 128: bychar.setdefault(ord(c), n + 1)
+  out.append("static struct optspec optspec_%s = {%s, %s, %d, %s, %d, %d, %d, %d,\n"
+    % (name, opts, longopts, spec["min"], spec["max"], spec["stop"],
+       spec["noerror"], spec["nodash"], spec["slots"]))
+  out.append("\t{%s}\n};\n" % (", ".join("[%d] = %d" % x for x in sorted(bychar.items())) or "0"))
+  return "".join(out)
+
+out = sys.stdout
+out.write("// Generated by scripts/mkopts.py, do not edit.\n\n")
+out.write("#define OPTSPEC_toybox 0\n")
+for f in sorted(glob.glob("toys/*.c")):
+  for line in open(f):
+    m = re.match(r"USE_(\w+)\((NEW|OLD)TOY\((\w+),(.*),[^,]*\)\)\s*$", line)
+    if not m: continue
+    use, name, expr = m.group(1), m.group(3), m.group(4)
+    if m.group(2) == "OLD": expr = expr.split(",", 1)[1]
+    if expr.strip() == "NULL":
+      out.write("\n#define OPTSPEC_%s 0\n" % name)
+      continue
+    parts = pieces(expr)
+    uses = sorted(set(u for t, u in parts if u))
+    out.write("\n#define OPTSPEC_%s (&optspec_%s)\n#if CFG_%s\n" % (name, name, use))
+    for n, on in enumerate(itertools.product((1, 0), repeat=len(uses))):
+      if uses:
+        if n == (1 << len(uses)) - 1: out.write("#else\n")
+        else: out.write("#%s %s\n" % ("if" if not n else "elif", " && ".join(
+          ("" if x else "!") + "CFG_" + u for u, x in zip(uses, on))))
+      s = "".join(t for t, u in parts if not u or on[uses.index(u)])
+      out.write(table(name, parse(s)))
+    if uses: out.write("#endif\n")
+    out.write("#endif\n")
@@ -0,0 +1,51 @@
+/* vi: set ts=4 :*/
+/* Time how long toybox takes to start, run an applet and exit.
+ *
+ * Shell scripts start small commands over and over, so this is what they
+ * pay per command:
+ *
+ *   startup [-n count] ./toybox true
+ *
+ * runs the command count times (default 1000) and prints the average.
+ */
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+extern char **environ;
+
+int main(int argc, char *argv[])
+{
+	struct timespec start, end;
+	long i, count = 1000;
+	int status;
+	pid_t pid;
+
+	if (argc>2 && !strcmp(argv[1], "-n")) {
+		count = atol(argv[2]);
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc<2 || count<1) {
+		fprintf(stderr, "usage: startup [-n count] command [args...]\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i=0; i<count; i++) {
+		if (posix_spawn(&pid, argv[1], NULL, NULL, argv+1, environ)) {
+			perror(argv[1]);
+			return 1;
+		}
+		waitpid(pid, &status, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%s: %.1f us per run\n", argv[1], ((end.tv_sec-start.tv_sec)*1e9
+		+ (end.tv_nsec-start.tv_nsec))/count/1000);
+	return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Runs tests/<command>.test for each command named on the command line
+# (default: every .test file) against ./toybox, in testdir/. A .test file
+# is a shell script calling
+#
+#   testing "name" "command" "expected output" "input file" "stdin"
+#
+# where the input file is written to ./input first, and the expected
+# output, input file and stdin may use printf %b escapes (\n, \x80, ...).
+# The commands run as themselves through symlinks to toybox in testdir,
+# which comes first in $PATH. VERBOSE=1 shows how failing tests differ.
+
+TOPDIR="$(cd "$(dirname "$0")"/.. && pwd)"
+TESTDIR="$TOPDIR/testdir"
+FAILCOUNT=0
+PASSCOUNT=0
+
+testing()
+{
+  NAME="$CMDNAME $1"
+
+  if [ -n "$4" ]
+  then
+    printf '%b' "$4" > input
+  else
+    rm -f input
+  fi
+  printf '%b' "$5" | eval "$2" > actual 2>&1
+  printf '%b' "$3" > expected
+
+  if cmp -s expected actual
+  then
+    echo "PASS: $NAME"
+    PASSCOUNT=$((PASSCOUNT+1))
+  else
+    echo "FAIL: $NAME"
+    FAILCOUNT=$((FAILCOUNT+1))
+    [ -n "$VERBOSE" ] && echo "  $2" && diff -u expected actual
+  fi
+  rm -f input expected actual
+}
+
+if [ $# -eq 0 ]
+then
+  set -- $(cd "$TOPDIR"/tests && ls *.test | sed 's/\.test$//')
+fi
+
+rm -rf "$TESTDIR" && mkdir "$TESTDIR" || exit 1
+export PATH="$TESTDIR:$PATH"
+cd "$TESTDIR" || exit 1
+for CMDNAME in "$@"
+do
+  ln -sf "$TOPDIR"/toybox "$TESTDIR/$CMDNAME"
+  . "$TOPDIR/tests/$CMDNAME.test"
+done
+cd "$TOPDIR" && rm -rf "$TESTDIR"
+
+echo "$PASSCOUNT passed, $FAILCOUNT failed"
+[ $FAILCOUNT -eq 0 ]
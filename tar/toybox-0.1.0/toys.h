@@ -20,6 +20,7 @@
 #include <pty.h>
 #include <pwd.h>
 #include <setjmp.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -28,8 +29,10 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -75,6 +78,7 @@ extern struct toy_list {
         void (*toy_main)(void);
         char *options;
         int flags;
+        struct optspec *optspec;
 } toy_list[];
 
 // Global context shared by all applets.
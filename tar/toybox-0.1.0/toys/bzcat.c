@@ -6,22 +6,64 @@
  *
  * Not in SUSv3.
 
-USE_BZCAT(NEWTOY(bzcat, NULL, TOYFLAG_USR|TOYFLAG_BIN))
+USE_BZCAT(NEWTOY(bzcat, "j#X:s#l#", TOYFLAG_USR|TOYFLAG_BIN))
 
 config BZCAT
 	bool "bzcat"
 	default y
 	help
-	  usage: bzcat [filename...]
+	  usage: bzcat [-j N] [-X INDEX] [-s OFFSET] [-l LEN] [filename...]
 
 	  Decompress listed files to stdout.  Use stdin if no files listed.
+
+		-j	decompress N blocks at once
+		-X	block index of the file (created if it doesn't exist)
+		-s	start output at byte OFFSET
+		-l	output only LEN bytes
+
+	  With -X, -s or -l only the blocks holding the output are decompressed
+	  (the file has to be seekable), once there's an index.
 */
 
 #include "toys.h"
 
+DEFINE_GLOBALS(
+	long length;
+	long start;
+	char *index;
+	long jobs;
+)
+
+#define TT this.bzcat
+
+#define FLAG_l 1
+#define FLAG_s 2
+#define FLAG_X 4
+
 static void do_bzcat(int fd, char *name)
 {
-    bunzipStream(fd, 1);
+	struct bunzip_index *index = NULL;
+	int ifd;
+
+	if (!(toys.optflags & (FLAG_X|FLAG_s|FLAG_l))) {
+		bunzipStream(fd, 1, TT.jobs);
+		return;
+	}
+
+	if (TT.index && -1 != (ifd = open(TT.index, O_RDONLY))) {
+		index = bunzip_index_load(ifd);
+		xclose(ifd);
+		if (!index) error_exit("bad index '%s'", TT.index);
+	} else {
+		index = bunzip_index(fd, TT.jobs);
+		if (TT.index) {
+			ifd = xcreate(TT.index, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+			bunzip_index_save(index, ifd);
+			xclose(ifd);
+		}
+	}
+	bunzip_range(fd, index, TT.start, (toys.optflags & FLAG_l) ? TT.length : -1, 1);
+	if (CFG_TOYBOX_FREE) bunzip_index_free(index);
 }
 
 void bzcat_main(void)
@@ -16,23 +16,35 @@ config CAT
 	  Copy (concatenate) files to stdout.  If no files listed, copy from stdin.
 	  Filename "-" is a synonym for stdin.
 
-	  -u	Copy one byte at a time (slow).
+	  -u	Unbuffered: write each read as soon as it's done.
 */
 
 #include "toys.h"
 
 static void do_cat(int fd, char *name)
 {
-	int len, size=toys.optflags ? 1 : sizeof(toybuf);
+	char *buf;
+	int len;
 
+	// Without -u, let the kernel move the data (splice, sendfile...).
+	if (!toys.optflags) {
+		if (sendfile_all(fd, 1)<0) {
+			perror_msg("%s",name);
+			toys.exitval = EXIT_FAILURE;
+		}
+		return;
+	}
+
+	// With -u, read() already returns whatever is there.  Pass it on.
+	buf = xiobuf(0);
 	for (;;) {
-		len = read(fd, toybuf, size);
+		len = read(fd, buf, IOBUF_SIZE);
 		if (len<0) {
 			perror_msg("%s",name);
 			toys.exitval = EXIT_FAILURE;
 		}
 		if (len<1) break;
-		xwrite(1, toybuf, len);
+		xwrite(1, buf, len);
 	}
 }
 
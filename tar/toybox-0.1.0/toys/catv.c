@@ -25,39 +25,103 @@ config CATV
 
 #include "toys.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Input is read CATV_BUF at a time, each byte becomes at most 4 ("M-^X").
+#define CATV_BUF 65536
+
+// How many bytes at the start of s print as themselves (32 to 126)?  The
+// others (including newline and tab) are left to the caller.
+
+static int catv_plain(unsigned char *s, int len)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128i lo = _mm_set1_epi8(32), hi = _mm_set1_epi8(126);
+
+	// Signed compares, so 128-255 are below 32.
+	for (; i+16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *)(s+i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, lo),
+			_mm_cmpgt_epi8(v, hi)));
+
+		if (mask) return i + __builtin_ctz(mask);
+	}
+#elif defined(__aarch64__)
+	uint8x16_t lo = vdupq_n_u8(32), hi = vdupq_n_u8(126);
+
+	for (; i+16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(s+i);
+
+		if (vmaxvq_u8(vorrq_u8(vcltq_u8(v, lo), vcgtq_u8(v, hi)))) break;
+	}
+#endif
+	while (i<len && s[i]>=32 && s[i]<127) i++;
+
+	return i;
+}
+
 // Callback function for loopfiles()
 
 static void do_catv(int fd, char *name)
 {
+	unsigned char *in = xmalloc(5*CATV_BUF), *out = in+CATV_BUF;
+
 	for(;;) {
-		int i, len;
+		int i, len, run, pos = 0;
 
-		len = read(fd, toybuf, sizeof(toybuf));
+		len = read(fd, in, CATV_BUF);
 		if (len < 0) toys.exitval = EXIT_FAILURE;
 		if (len < 1) break;
-		for (i=0; i<len; i++) {
-			char c=toybuf[i];
+		for (i=0; i<len; ) {
+			int c;
+
+			// Copy printable runs in bulk, escape the rest one at a time.
+			run = catv_plain(in+i, len-i);
+			memcpy(out+pos, in+i, run);
+			pos += run;
+			if ((i += run) == len) break;
+			c = in[i++];
 
 			if (c > 126 && (toys.optflags & 4)) {
+				if (c > 127) {
+					out[pos++] = 'M';
+					out[pos++] = '-';
+					c -= 128;
+
+					// With the high bit stripped, control characters are
+					// always escaped (M-^I and M-^J aren't tab or newline)
+					if (c < 32) {
+						out[pos++] = '^';
+						out[pos++] = c+'@';
+						continue;
+					}
+				}
 				if (c == 127) {
-					printf("^?");
+					out[pos++] = '^';
+					out[pos++] = '?';
 					continue;
-				} else {
-					printf("M-");
-					c -= 128;
 				}
 			}
 			if (c < 32) {
 				if (c == 10) {
-					if (toys.optflags & 1) xputc('$');
+					if (toys.optflags & 1) out[pos++] = '$';
 				} else if (toys.optflags & (c==9 ? 2 : 4)) {
-					printf("^%c", c+'@');
+					out[pos++] = '^';
+					out[pos++] = c+'@';
 					continue;
 				}
 			}
-			xputc(c);
+			out[pos++] = c;
 		}
+		xwrite(1, out, pos);
 	}
+	free(in);
 }
 
 void catv_main(void)
@@ -26,51 +26,38 @@ config CKSUM
 #include "toys.h"
 
 DEFINE_GLOBALS(
-	unsigned crc_table[256];
+	unsigned crc;
+	uint64_t llen;
 )
 
 #define TT this.cksum
 
-static unsigned cksum_be(unsigned crc, unsigned char c)
-{
-	return (crc<<8)^TT.crc_table[(crc>>24)^c];
-}
-
-static unsigned cksum_le(unsigned crc, unsigned char c)
-{
-	return TT.crc_table[(crc^c)&0xff] ^ (crc>>8);
-}
+// Callback for loopfiles_read(): CRC each chunk, print at the end of a file.
 
-static void do_cksum(int fd, char *name)
+static void do_cksum(char *name, char *data, long len)
 {
-	unsigned crc = (toys.optflags&4) ? 0xffffffff : 0;
-	uint64_t llen = 0, llen2;
-	unsigned (*cksum)(unsigned crc, unsigned char c);
+	unsigned crc = TT.crc;
+	uint64_t llen = TT.llen, llen2;
+	int le = toys.optflags&2;
 
-
-	cksum = (toys.optflags&2) ? cksum_le : cksum_be;
 	// CRC the data
 
-	for (;;) {
-		int len, i;
-
-		len = read(fd, toybuf, sizeof(toybuf));
-		if (len<0) {
-			perror_msg("%s",name);
-			toys.exitval = EXIT_FAILURE;
-		}
-		if (len<1) break;
-
-		llen += len;
-		for (i=0; i<len; i++) crc=cksum(crc, toybuf[i]);
+	if (len) {
+		TT.llen += len;
+		TT.crc = crc_update(crc, data, len, le);
+		return;
 	}
+	TT.crc = (toys.optflags&4) ? 0xffffffff : 0;
+	TT.llen = 0;
 
 	// CRC the length
 
 	llen2 = llen;
 	if (!(toys.optflags&1)) {
 		while (llen) {
-			crc = cksum(crc, llen);
+			unsigned char c = llen;
+
+			crc = crc_update(crc, &c, 1, le);
 			llen >>= 8;
 		}
 	}
@@ -82,6 +69,6 @@ static void do_cksum(int fd, char *name)
 
 void cksum_main(void)
 {
-	crc_init(TT.crc_table, toys.optflags&2);
-	loopfiles(toys.optargs, do_cksum);
+	TT.crc = (toys.optflags&4) ? 0xffffffff : 0;
+	loopfiles_read(toys.optargs, do_cksum);
 }
@@ -14,22 +14,92 @@ config COUNT
 	help
 	  usage: count
 
-	  Copy stdin to stdout, displaying simple progress indicator to stderr.
+	  Copy stdin to stdout, displaying simple progress indicator to stderr:
+	  bytes copied and throughput, and when stdin is a file, how much of it
+	  that is and the time left.
 */
 
 #include "toys.h"
 
+DEFINE_GLOBALS(
+	long long size;
+	double start, next;
+	int len;
+)
+
+#define TT this.count
+
+#define COUNT_CHUNK (1<<20)
+
+// CLOCK_MONOTONIC comes from the vdso, so checking it after every block
+// doesn't cost a system call.
+static double count_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void count_show(long long bytes, double now, char end)
+{
+	double rate = now > TT.start ? bytes/(now-TT.start) : 0;
+	int len = sprintf(toybuf, "%lld bytes, %.1f MB/s", bytes, rate/1e6);
+
+	if (TT.size && rate && bytes <= TT.size) {
+		long eta = (TT.size-bytes)/rate;
+
+		len += sprintf(toybuf+len, ", %d%%, ETA %ld:%02ld",
+			(int)(100*bytes/TT.size), eta/60, eta%60);
+	}
+
+	// Blank out the end of a longer previous line.
+	fdprintf(2, "%s%*s%c", toybuf, TT.len > len ? TT.len-len : 0, "", end);
+	TT.len = len;
+}
+
+// Data goes through splice() when either end is a pipe, else read() and
+// write().  The meter updates ten times a second at most.
 void count_main(void)
 {
-	uint64_t size = 0;
-	int len;
+	struct stat st_in, st_out;
+	long long total = 0;
+	double now;
+	char *buf = NULL;
+	long len;
+	int pipes = 0;
+
+	if (!fstat(0, &st_in)) {
+		off_t pos = lseek(0, 0, SEEK_CUR);
+
+		if (S_ISREG(st_in.st_mode) && pos >= 0 && st_in.st_size > pos)
+			TT.size = st_in.st_size-pos;
+		if (!fstat(1, &st_out))
+			pipes = S_ISFIFO(st_in.st_mode) || S_ISFIFO(st_out.st_mode);
+	}
+	TT.next = (TT.start = count_now())+0.1;
 
 	for (;;) {
-		len = xread(0, toybuf, sizeof(toybuf));
+		if (pipes) {
+			len = splice(0, NULL, 1, NULL, COUNT_CHUNK, SPLICE_F_MOVE);
+			if (len < 0) {
+				if (errno == EINTR) continue;
+				// Nothing moved: the other end can't splice (O_APPEND...).
+				if (errno != EINVAL) perror_exit("splice");
+				pipes = 0;
+				continue;
+			}
+		} else {
+			if (!buf) buf = xiobuf(0);
+			if ((len = xread(0, buf, IOBUF_SIZE))) xwrite(1, buf, len);
+		}
 		if (!len) break;
-		size += len;
-		xwrite(1, toybuf, len);
-		fdprintf(2, "%"PRIu64" bytes\r", size);
+		total += len;
+
+		if ((now = count_now()) >= TT.next) {
+			count_show(total, now, '\r');
+			TT.next = now+0.1;
+		}
 	}
-	fdprintf(2,"\n");
+	count_show(total, count_now(), '\n');
 }
@@ -7,13 +7,13 @@
  * See http://www.opengroup.org/onlinepubs/009695399/utilities/cp.html
  *
  * "R+ra+d+p+r"
-USE_CP(NEWTOY(cp, "<2vslrR+rdpa+d+p+rHLPif", TOYFLAG_BIN))
+USE_CP(NEWTOY(cp, "<2j#vslrR+rdpa+d+p+rHLPif", TOYFLAG_BIN))
 
 config CP
 	bool "cp"
 	default y
 	help
-	  usage: cp -fiprdal SOURCE... DEST
+	  usage: cp -fiprdal [-j N] SOURCE... DEST
 
 	  Copy files from SOURCE to DEST.  If more than one SOURCE, DEST must
 	  be a directory.
@@ -26,9 +26,11 @@ config CP
 		-a	same as -dpr
 		-l	hard link instead of copying
 		-v	verbose
+		-j	copy the data of N files at once
 */
 
 #include "toys.h"
+#include <pthread.h>
 
 #define FLAG_f 1
 #define FLAG_i 2	// todo
@@ -45,6 +47,8 @@ config CP
 #define FLAG_v 4098
 
 DEFINE_GLOBALS(
+	long jobs;
+
 	char *destname;
 	int destisdir;
 	int destisnew;
@@ -53,6 +57,59 @@ DEFINE_GLOBALS(
 
 #define TT this.cp
 
+// From linux/fs.h, which doesn't get along with sys/mount.h.
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+// Copy len bytes at offset from fdin to the same place in fdout.
+static void cp_range(int fdin, int fdout, off_t offset, off_t len)
+{
+	off_t in = offset, out = offset;
+	char *buf = NULL;
+	long n;
+
+	while (len > 0) {
+		if (!buf && 0<(n = copy_file_range(fdin, &in, fdout, &out, len, 0))) {
+			len -= n;
+			continue;
+		}
+		if (!buf) buf = xmalloc(1<<17);
+		n = pread(fdin, buf, len < (1<<17) ? len : (1<<17), in);
+		if (n<1 || n != pwrite(fdout, buf, n, out)) perror_exit("copy");
+		in += n;
+		out += n;
+		len -= n;
+	}
+	free(buf);
+}
+
+// Copy a regular file's contents: share the blocks if the filesystem can
+// (btrfs, xfs...), else copy only the data extents of a sparse file so the
+// holes stay holes, else let xsendfile() have the kernel copy it.
+
+static void cp_data(int fdin, int fdout, struct stat *srcst)
+{
+	off_t data, hole;
+
+	if (!ioctl(fdout, FICLONE, fdin)) return;
+
+	if (srcst->st_blocks*512 < srcst->st_size) {
+		for (hole = 0; 0 <= (data = lseek(fdin, hole, SEEK_DATA));) {
+			if (0 > (hole = lseek(fdin, data, SEEK_HOLE))) perror_exit("seek");
+			cp_range(fdin, fdout, data, hole-data);
+		}
+
+		// ENXIO is the end of the data.  Without SEEK_DATA, copy all of it.
+		if (errno == ENXIO) {
+			if (ftruncate(fdout, srcst->st_size)) perror_exit("truncate");
+			return;
+		}
+		if (hole) perror_exit("seek");
+	}
+	xsendfile(fdin, fdout);
+}
+
 // Copy an individual file or directory to target.
 
 void cp_file(char *src, char *dst, struct stat *srcst)
@@ -101,7 +158,7 @@ void cp_file(char *src, char *dst, struct stat *srcst)
 			unlink(dst);
 		}
 		if (fdout<0) perror_exit("%s", dst);
-		xsendfile(fdin, fdout);
+		cp_data(fdin, fdout, srcst);
 		close(fdin);
 	}
 
@@ -121,7 +178,72 @@ void cp_file(char *src, char *dst, struct stat *srcst)
 	xclose(fdout);
 }
 
-// Callback from dirtree_read() for each file/directory under a source dir.
+// With -j, the main thread creates the directories (so they're there, in
+// order, before anything goes in them) and queues regular files for the
+// workers, which copy the data and then set the -p metadata.  The queue
+// holds at most 4 files per worker, so walking a huge tree doesn't race
+// ahead of the copying.
+
+static struct cp_job {
+	struct cp_job *next;
+	char *src, *dst;
+	struct stat st;
+} *cp_queue, **cp_tail = &cp_queue;
+static int cp_queued, cp_done;
+static pthread_mutex_t cp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cp_more = PTHREAD_COND_INITIALIZER,
+	cp_less = PTHREAD_COND_INITIALIZER;
+
+static void *cp_worker(void *unused)
+{
+	struct cp_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&cp_lock);
+		while (!cp_queue && !cp_done) pthread_cond_wait(&cp_more, &cp_lock);
+		if ((job = cp_queue)) {
+			if (!(cp_queue = job->next)) cp_tail = &cp_queue;
+			cp_queued--;
+			pthread_cond_signal(&cp_less);
+		}
+		pthread_mutex_unlock(&cp_lock);
+		if (!job) return NULL;
+
+		cp_file(job->src, job->dst, &job->st);
+		free(job);
+	}
+}
+
+// Copy now, or queue it for a worker when it's a -j file copy.
+
+static void cp_queue_file(char *src, char *dst, struct stat *srcst)
+{
+	struct cp_job *job;
+	int len = strlen(src)+1;
+
+	if (TT.jobs<2 || !S_ISREG(srcst->st_mode) || (toys.optflags & FLAG_l)) {
+		cp_file(src, dst, srcst);
+		return;
+	}
+
+	// One allocation for the job and both names.
+	job = xmalloc(sizeof(struct cp_job)+len+strlen(dst)+1);
+	job->next = NULL;
+	job->src = strcpy((char *)(job+1), src);
+	job->dst = strcpy(job->src+len, dst);
+	job->st = *srcst;
+
+	pthread_mutex_lock(&cp_lock);
+	while (cp_queued >= 4*TT.jobs) pthread_cond_wait(&cp_less, &cp_lock);
+	*cp_tail = job;
+	cp_tail = &job->next;
+	cp_queued++;
+	pthread_cond_signal(&cp_more);
+	pthread_mutex_unlock(&cp_lock);
+}
+
+// Callback from dirtree_read_parallel() for each file/directory under a source
+// dir, always on the main thread and in order (directories before contents).
 
 int cp_node(char *path, struct dirtree *node)
 {
@@ -141,7 +263,7 @@ int cp_node(char *path, struct dirtree *node)
 	if (s != path) s++;
 
 	s = xmsprintf("%s/%s", TT.destname, s);
-	cp_file(path, s, &(node->st));
+	cp_queue_file(path, s, &(node->st));
 	free(s);
 
 	return 0;
@@ -150,6 +272,7 @@ int cp_node(char *path, struct dirtree *node)
 void cp_main(void)
 {
 	struct stat st;
+	pthread_t *workers = NULL;
 	int i;
 
 	// Grab target argument.  (Guaranteed to be there due to "<2" above.)
@@ -169,6 +292,13 @@ void cp_main(void)
 		else if (toys.optc > 1) goto error_notdir;
 	}
 
+	if (TT.jobs>1) {
+		workers = xmalloc(TT.jobs*sizeof(pthread_t));
+		for (i=0; i<TT.jobs; i++)
+			if (pthread_create(workers+i, NULL, cp_worker, NULL))
+				perror_exit("pthread_create");
+	}
+
 	// Handle sources
 
 	for (i=0; i<toys.optc; i++) {
@@ -204,12 +334,23 @@ void cp_main(void)
 				TT.keep_symlinks++;
 				strncpy(toybuf, src, sizeof(toybuf)-1);
 				toybuf[sizeof(toybuf)-1]=0;
-				dirtree_read(toybuf, NULL, cp_node);
+				dirtree_read_parallel(toybuf, NULL, TT.jobs, DIRTREE_ORDERED,
+					cp_node);
 			} else error_msg("Skipped dir '%s'", src);
-		} else cp_file(src, dst, &st);
+		} else cp_queue_file(src, dst, &st);
 		if (TT.destisdir) free(dst);
 	}
 
+	// Let the workers finish what's queued.
+	if (workers) {
+		pthread_mutex_lock(&cp_lock);
+		cp_done++;
+		pthread_cond_broadcast(&cp_more);
+		pthread_mutex_unlock(&cp_lock);
+		for (i=0; i<TT.jobs; i++) pthread_join(workers[i], NULL);
+		if (CFG_TOYBOX_FREE) free(workers);
+	}
+
 	return;
 
 error_notdir:
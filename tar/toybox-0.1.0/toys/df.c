@@ -105,7 +105,9 @@ void df_main(void)
 			TT.units);
 	} else puts("Filesystem\t1K-blocks\tUsed Available Use% Mounted on");
 
-	mtlist = getmountlist(1);
+	// Only stat filesystems of the -t types, and don't wait more than 5
+	// seconds for any one of them (a hung NFS server).
+	mtlist = getmountlist(1, TT.fstype, 5000);
 
 	// If we have a list of filesystems on the command line, loop through them.
 	if (*toys.optargs) {
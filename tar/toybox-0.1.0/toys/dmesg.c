@@ -6,54 +6,154 @@
  *
  * Not in SUSv3.
 
-USE_DMESG(NEWTOY(dmesg, "s#n#c", TOYFLAG_BIN))
+USE_DMESG(NEWTOY(dmesg, "l#ws#n#c", TOYFLAG_BIN))
 
 config DMESG
 	bool "dmesg"
 	default y
 	help
-	  usage: dmesg [-n level] [-s bufsize] | -c
+	  usage: dmesg [-l level] [-n level] [-s bufsize] | -c | -w
 
 	  Print or control the kernel ring buffer.
 
+	  -l	Only show messages of this level or more important (0-7).
 	  -n	Set kernel logging level (1-9).
-	  -s	Size of buffer to read (in bytes), default 16384.
+	  -s	Size of buffer to read (in bytes), default the kernel's.
 	  -c	Clear the ring buffer after printing.
+	  -w	Wait for new messages (from /dev/kmsg) and print them as they come.
 */
 
 #include "toys.h"
+#include <poll.h>
 #include <sys/klog.h>
 
 DEFINE_GLOBALS(
 	long level;
 	long size;
+	long show;
 )
 
 #define TT this.dmesg
 
+#define FLAG_w 8
+#define FLAG_l 16
+
+#define DMESG_BUF 65536
+
+// Is a message of this priority (facility*8+level) filtered out by -l?
+static int dmesg_hide(long prio)
+{
+	return (toys.optflags & FLAG_l) && (prio&7) > TT.show;
+}
+
+// Follow /dev/kmsg.  Each read() returns one record:
+//   "prio,sequence,microseconds,flags;message\n" then " KEY=value\n" lines
+// The header is parsed in place, and the (filtered) messages collect in a
+// buffer that is written out whenever there's nothing more to read yet.
+static void dmesg_follow(void)
+{
+	struct pollfd pfd;
+	char *out = xmalloc(DMESG_BUF), rec[8192];
+	int len = 0;
+
+	pfd.fd = xopen("/dev/kmsg", O_RDONLY|O_NONBLOCK);
+	pfd.events = POLLIN;
+	for (;;) {
+		char *s, *msg, *end;
+		long prio, sec, usec;
+		int n = read(pfd.fd, rec, sizeof(rec)-1);
+
+		if (n < 0) {
+			// EPIPE: records were overwritten before we read them, go on.
+			if (errno == EINTR || errno == EPIPE) continue;
+			if (errno != EAGAIN) perror_exit("/dev/kmsg");
+			if (len) xwrite(1, out, len);
+			len = 0;
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		if (!n) break;
+		rec[n] = 0;
+
+		// Filter on the level before looking at anything else.
+		prio = strtol(rec, &s, 10);
+		if (*s != ',' || dmesg_hide(prio)) continue;
+		strtol(s+1, &s, 10);
+		if (*s != ',') continue;
+		usec = strtoll(s+1, &s, 10);
+		if (!(msg = strchr(s, ';'))) continue;
+		if (!(end = strchr(++msg, '\n'))) end = rec+n;
+
+		if (len+(end-msg)+32 > DMESG_BUF) {
+			xwrite(1, out, len);
+			len = 0;
+		}
+		sec = usec/1000000;
+		len += sprintf(out+len, "[%5ld.%06ld] ", sec, usec-sec*1000000);
+
+		// The kernel escapes unprintable bytes (and \) as \xNN.
+		while (msg < end) {
+			char *esc = memchr(msg, '\\', end-msg);
+
+			if (!esc) esc = end;
+			memcpy(out+len, msg, esc-msg);
+			len += esc-msg;
+			if ((msg = esc) == end) break;
+			if (esc[1] == 'x' && isxdigit(esc[2]) && isxdigit(esc[3])) {
+				out[len++] = strtol((char []){esc[2], esc[3], 0}, NULL, 16);
+				msg += 4;
+			} else out[len++] = *msg++;
+		}
+		out[len++] = '\n';
+	}
+	if (len) xwrite(1, out, len);
+	if (CFG_TOYBOX_FREE) {
+		free(out);
+		close(pfd.fd);
+	}
+}
+
 void dmesg_main(void)
 {
 	// For -n just tell kernel to which messages to keep.
 	if (toys.optflags & 2) {
 		if (klogctl(8, NULL, TT.level))
 			error_exit("klogctl");
-	} else {
-		int size, i, last = '\n';
+	} else if (toys.optflags & FLAG_w) dmesg_follow();
+	else {
+		int size, i, len = 0;
 		char *data;
 
 		// Figure out how much data we need, and fetch it.
 		size = TT.size;
-		if (size<2) size = 16384;
+		if (size<2 && (size = klogctl(10, NULL, 0)) < 2) size = 16384;
 		data = xmalloc(size);
 		size = klogctl(3 + (toys.optflags&1), data, size);
 		if (size < 0) error_exit("klogctl");
 
-		// Display data, filtering out level markers.
+		// Filter out level markers (and filtered levels) in place, then write
+		// it all at once.
 		for (i=0; i<size; ) {
-			if (last=='\n' && data[i]=='<') i += 3;
-			else xputc(last = data[i++]);
+			char *nl = memchr(data+i, '\n', size-i), *s = data+i;
+			int end = nl ? nl+1-data : size;
+
+			if (*s == '<' && isdigit(s[1])) {
+				long prio = strtol(s+1, &s, 10);
+
+				if (*s == '>') {
+					if (dmesg_hide(prio)) {
+						i = end;
+						continue;
+					}
+					i = ++s-data;
+				}
+			}
+			memmove(data+len, data+i, end-i);
+			len += end-i;
+			i = end;
 		}
-		if (last!='\n') xputc('\n');
+		if (len && data[len-1] != '\n') data[len++] = '\n';
+		xwrite(1, data, len);
 		if (CFG_TOYBOX_FREE) free(data);
 	}
 }
@@ -7,16 +7,18 @@
  *
  * Not in SUSv3.
 
-USE_MDEV(NEWTOY(mdev, "s", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_UMASK))
+USE_MDEV(NEWTOY(mdev, "ds", TOYFLAG_USR|TOYFLAG_BIN|TOYFLAG_UMASK))
 
 config MDEV
 	bool "mdev"
 	default y
 	help
-	  usage: mdev [-s]
+	  usage: mdev [-ds]
 
 	  Create devices in /dev using information from /sys.
 
+	  -d	Stay running, creating and removing devices as the kernel reports
+	    	them (doesn't fork into the background).
 	  -s	Scan all entries in /sys to populate /dev.
 
 config MDEV_CONF
@@ -35,181 +37,356 @@ config MDEV_CONF
 
 #include "toys.h"
 #include "lib/xregcomp.h"
+#include <linux/netlink.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+DEFINE_GLOBALS(
+	struct mdev_rule *rules;
+	struct mdev_scan *scan;
+	int rulecount, scancount, nextscan, daemon;
+)
+
+#define TT this.mdev
+
+#define FLAG_s 1
+#define FLAG_d 2
+
+// A line of /etc/mdev.conf, parsed once when mdev starts.  A line that
+// doesn't parse is only an error for the devices its regex matches.
+struct mdev_rule {
+	regex_t match;
+	uid_t uid;
+	gid_t gid;
+	int mode, line, bad;
+};
+
+static void read_conf(void)
+{
+	char *conf, *pos, *end, *field[3], *s, *s2, *buf = 0;
+	int fd, len, line = 0, bufsize = 0;
+
+	if (-1==(fd = open("/etc/mdev.conf", O_RDONLY))) return;
+	len = lseek(fd, 0, SEEK_END);
+	conf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (conf==MAP_FAILED) return;
+
+	for (pos = conf; pos-conf<len; pos = ++end) {
+		struct mdev_rule *rule;
+		int fields;
+
+		line++;
+		// find end of this line
+		for (end = pos; end-conf<len && *end!='\n'; end++);
+
+		// Three fields: regex, uid:gid, mode.  They're cut out of a copy of
+		// the line, in one buffer reused for every line.
+		if (end-pos >= bufsize) buf = xrealloc(buf, bufsize = end-pos+1);
+		memcpy(buf, pos, end-pos);
+		buf[end-pos] = 0;
+		for (fields = 0, pos = buf; fields<3; fields++) {
+			// Skip whitespace
+			while (isspace(*pos)) pos++;
+			if (!*pos || *pos=='#') break;
+			for (s = pos; *s && !isspace(*s) && *s!='#'; s++);
+			field[fields] = pos;
+			// A '#' ending the field is where the next loop stops.
+			pos = s + !!isspace(*s);
+			*s = 0;
+		}
+		if (!fields) continue;
+
+		if (!(TT.rulecount&15))
+			TT.rules = xrealloc(TT.rules, (TT.rulecount+16)*sizeof(*rule));
+		rule = TT.rules+TT.rulecount++;
+		memset(rule, 0, sizeof(*rule));
+		rule->line = line;
+		xregcomp(&rule->match, field[0], REG_EXTENDED);
+		if (fields<3 || !(s = strchr(field[1], ':'))) {
+			rule->bad++;
+			continue;
+		}
 
-// mknod in /dev based on a path like "/sys/block/hda/hda1"
-static void make_device(char *path)
+		// Parse UID
+		*(s++) = 0;
+		rule->uid = strtoul(field[1], &s2, 10);
+		if (*s2) {
+			struct passwd *pass = getpwnam(field[1]);
+
+			if (pass) rule->uid = pass->pw_uid;
+			else rule->bad++;
+		}
+		// parse GID
+		rule->gid = strtoul(s, &s2, 10);
+		if (*s2) {
+			struct group *grp = getgrnam(s);
+
+			if (grp) rule->gid = grp->gr_gid;
+			else rule->bad++;
+		}
+		// mode
+		rule->mode = strtoul(field[2], &s2, 8);
+		if (*s2) rule->bad++;
+	}
+	munmap(conf, len);
+	free(buf);
+}
+
+// mknod /dev/name for a "major:minor" dev string, with the owner and mode
+// the first matching rule in /etc/mdev.conf gives it.
+static void make_device(char *name, char *dev, int type)
 {
-	char *device_name, *s, *temp;
-	int major, minor, type, len, fd;
+	char path[NAME_MAX+6];
+	int major, minor, i;
 	int mode = 0660;
 	uid_t uid = 0;
 	gid_t gid = 0;
 
-	// Try to read major/minor string
-
-	temp = strrchr(path, '/');
-	fd = open(path, O_RDONLY);
-	*temp=0;
-	temp++;
-	len = read(fd, temp, 64);
-	close(fd);
-	if (len<1) return;
-	temp[len] = 0;
-
-	// Determine device name, type, major and minor
-
-	device_name = strrchr(path, '/') + 1;
-	type = path[5]=='c' ? S_IFCHR : S_IFBLK;
 	major = minor = 0;
-	sscanf(temp, "%u:%u", &major, &minor);
-
-	// If we have a config file, look up permissions for this device
-
-	if (CFG_MDEV_CONF) {
-		char *conf, *pos, *end;
-
-		// mmap the config file
-		if (-1!=(fd = open("/etc/mdev.conf", O_RDONLY))) {
-			len = lseek(fd, 0, SEEK_END);
-			conf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
-			if (conf) {
-				int line = 0;
-
-				// Loop through lines in mmaped file
-				for (pos = conf; pos-conf<len;) {
-					int field;
-					char *end2;
-
-					line++;
-					// find end of this line
-					for(end = pos; end-conf<len && *end!='\n'; end++);
-
-					// Three fields: regex, uid:gid, mode
-					for (field = 3; field; field--) {
-						// Skip whitespace
-						while (pos<end && isspace(*pos)) pos++;
-						if (pos==end || *pos=='#') break;
-						for (end2 = pos;
-							end2<end && !isspace(*end2) && *end2!='#'; end2++);
-						switch(field) {
-							// Regex to match this device
-							case 3:
-							{
-								char *regex = strndupa(pos, end2-pos);
-								regex_t match;
-								regmatch_t off;
-								int result;
-
-								// Is this it?
-								xregcomp(&match, regex, REG_EXTENDED);
-								result=regexec(&match, device_name, 1, &off, 0);
-								regfree(&match);
-
-								// If not this device, skip rest of line
-								if (result || off.rm_so
-									|| off.rm_eo!=strlen(device_name))
-										goto end_line;
-
-								break;
-							}
-							// uid:gid
-							case 2:
-							{
-								char *s2;
-
-								// Find :
-								for(s = pos; s<end2 && *s!=':'; s++);
-								if (s==end2) goto end_line;
-
-								// Parse UID
-								uid = strtoul(pos,&s2,10);
-								if (s!=s2) {
-									struct passwd *pass;
-									pass = getpwnam(strndupa(pos, s-pos));
-									if (!pass) goto end_line;
-									uid = pass->pw_uid;
-								}
-								s++;
-								// parse GID
-								gid = strtoul(s,&s2,10);
-								if (end2!=s2) {
-									struct group *grp;
-									grp = getgrnam(strndupa(s, end2-s));
-									if (!grp) goto end_line;
-									gid = grp->gr_gid;
-								}
-								break;
-							}
-							// mode
-							case 1:
-							{
-								mode = strtoul(pos, &pos, 8);
-								if (pos!=end2) goto end_line;
-								goto found_device;
-							}
-						}
-						pos=end2;
-					}
-end_line:
-					// Did everything parse happily?
-					if (field && field!=3) error_exit("Bad line %d", line);
-
-					// Next line
-					pos = ++end;
-				}
-found_device:
-				munmap(conf, len);
-			}
-			close(fd);
+	sscanf(dev, "%u:%u", &major, &minor);
+
+	for (i=0; CFG_MDEV_CONF && i<TT.rulecount; i++) {
+		struct mdev_rule *rule = TT.rules+i;
+		regmatch_t off;
+
+		// Is this it?
+		if (regexec(&rule->match, name, 1, &off, 0) || off.rm_so
+			|| off.rm_eo!=strlen(name)) continue;
+		if (rule->bad) {
+			if (!TT.daemon) error_exit("Bad line %d", rule->line);
+			error_msg("Bad line %d", rule->line);
+			return;
 		}
+		uid = rule->uid;
+		gid = rule->gid;
+		mode = rule->mode;
+		break;
 	}
 
-	sprintf(temp, "/dev/%s", device_name);
-	if (mknod(temp, mode | type, makedev(major, minor)) && errno != EEXIST)
-		perror_exit("mknod %s failed", temp);
+	snprintf(path, sizeof(path), "/dev/%s", name);
+	if (mknod(path, mode | type, makedev(major, minor)) && errno != EEXIST) {
+		if (!TT.daemon) perror_exit("mknod %s failed", path);
+		perror_msg("mknod %s failed", path);
+		return;
+	}
 
 	// Dear gcc: shut up about ignoring the return value here.  If it doesn't
 	// work, what exactly are we supposed to do about it?
-	if (CFG_MDEV_CONF) mode=chown(temp, uid, gid);
+	if (CFG_MDEV_CONF) mode=chown(path, uid, gid);
 }
 
-static int callback(char *path, struct dirtree *node)
+// Coldplug handles the entries of /sys/class/* and /sys/block in parallel.
+// Each one is a device if it has a dev file, and the ones in /sys/block may
+// hold partitions.  Everything is opened relative to its directory.  (Circa
+// 2.6.25 the entries more than 2 deep are all either redundant (mouse#,
+// event#) or unnamed (every usb_* entry is called "device").)
+
+struct mdev_scan {
+	int dirfd, type, dtype;
+	char *name;
+};
+
+static void scan_entry(int dirfd, char *name, int dtype, int type, int depth)
 {
+	char buf[NAME_MAX+5], dev[64];
+	int fd, len;
+
 	// Entries in /sys/class/block aren't char devices, so skip 'em.  (We'll
 	// get block devices out of /sys/block.)
-	if(!strcmp(node->name, "block")) return 1;
+	if (!strcmp(name, "block")) return;
+	if (dtype==DT_UNKNOWN) {
+		struct stat st;
+
+		if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW)) return;
+		dtype = IFTODT(st.st_mode);
+	}
+	if (dtype!=DT_DIR && dtype!=DT_LNK) return;
 
 	// Does this directory have a "dev" entry in it?
-	if (S_ISDIR(node->st.st_mode) || S_ISLNK(node->st.st_mode)) {
-		char *dest = path+strlen(path);
-		strcpy(dest, "/dev");
-		if (!access(path, R_OK)) make_device(path);
-		*dest = 0;
+	snprintf(buf, sizeof(buf), "%s/dev", name);
+	if (-1!=(fd = openat(dirfd, buf, O_RDONLY))) {
+		len = read(fd, dev, sizeof(dev)-1);
+		close(fd);
+		if (len>0) {
+			dev[len] = 0;
+			make_device(name, dev, type);
+		}
+	}
+
+	if (depth<2 && dtype==DT_DIR
+		&& -1!=(fd = openat(dirfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW)))
+	{
+		DIR *dir = fdopendir(fd);
+		struct dirent *entry;
+
+		while ((entry = readdir(dir))) {
+			if (entry->d_name[0]=='.' && (!entry->d_name[1]
+				|| (entry->d_name[1]=='.' && !entry->d_name[2]))) continue;
+			scan_entry(fd, entry->d_name, entry->d_type, type, depth+1);
+		}
+		closedir(dir);
+	}
+}
+
+// Queue the entries of a directory under /sys for the scan.
+static int scan_queue(char *path, int type)
+{
+	struct dirent *entry;
+	DIR *dir;
+	int fd;
+
+	if (-1==(fd = open(path, O_RDONLY|O_DIRECTORY))) {
+		perror_msg("No %s", path);
+		return -1;
+	}
+	dir = fdopendir(fd);
+	while ((entry = readdir(dir))) {
+		struct mdev_scan *scan;
+
+		if (entry->d_name[0]=='.' && (!entry->d_name[1]
+			|| (entry->d_name[1]=='.' && !entry->d_name[2]))) continue;
+		if (!(TT.scancount&63))
+			TT.scan = xrealloc(TT.scan, (TT.scancount+64)*sizeof(*scan));
+		scan = TT.scan+TT.scancount++;
+		scan->dirfd = fd;
+		scan->type = type;
+		scan->dtype = entry->d_type;
+		scan->name = xstrdup(entry->d_name);
 	}
 
-	// Circa 2.6.25 the entries more than 2 deep are all either redundant
-	// (mouse#, event#) or unnamed (every usb_* entry is called "device").
-	return node->depth>1;
+	// Keep the fd for the workers: closedir() would close it.
+	return fd;
+}
+
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *scan_worker(void *unused)
+{
+	struct mdev_scan *scan;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&scan_lock);
+		i = TT.nextscan++;
+		pthread_mutex_unlock(&scan_lock);
+		if (i >= TT.scancount) return NULL;
+
+		scan = TT.scan+i;
+		scan_entry(scan->dirfd, scan->name, scan->dtype, scan->type, 1);
+	}
+}
+
+static void coldplug(void)
+{
+	pthread_t *workers;
+	int fds[2], i, nworkers;
+	long temp;
+
+	fds[0] = scan_queue("/sys/class", S_IFCHR);
+	fds[1] = scan_queue("/sys/block", S_IFBLK);
+
+	temp = sysconf(_SC_NPROCESSORS_ONLN);
+	if (temp < 4) temp = 4;
+	if (temp > 16) temp = 16;
+	if (temp > TT.scancount) temp = TT.scancount;
+	workers = xmalloc(temp*sizeof(pthread_t));
+	for (nworkers = 0; nworkers<temp-1; nworkers++)
+		if (pthread_create(workers+nworkers, NULL, scan_worker, NULL))
+			perror_exit("pthread_create");
+	scan_worker(NULL);
+	for (i = 0; i<nworkers; i++) pthread_join(workers[i], NULL);
+
+	if (CFG_TOYBOX_FREE) {
+		for (i = 0; i<TT.scancount; i++) free(TT.scan[i].name);
+		free(TT.scan);
+		free(workers);
+	}
+	for (i = 0; i<2; i++) if (fds[i] != -1) close(fds[i]);
+}
+
+// Hotplug: the kernel multicasts a uevent for each device added or removed,
+// a NUL separated list starting "add@/devices/..." and continuing with
+// KEY=value pairs.
+
+static int uevent_open(void)
+{
+	struct sockaddr_nl nl;
+	int fd, size = 1<<20;
+
+	memset(&nl, 0, sizeof(nl));
+	nl.nl_family = AF_NETLINK;
+	nl.nl_groups = 1;
+	fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (fd<0 || bind(fd, (void *)&nl, sizeof(nl))) perror_exit("netlink");
+
+	// Don't lose events while coldplug runs.
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)))
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	return fd;
+}
+
+static void uevent(int fd)
+{
+	char *action = 0, *devpath = 0, *subsystem = "", *major = 0, *minor = 0;
+	char *s, *name;
+	struct sockaddr_nl nl;
+	struct iovec iov = {toybuf, sizeof(toybuf)-1};
+	struct msghdr msg;
+	int len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &nl;
+	msg.msg_namelen = sizeof(nl);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (0>(len = recvmsg(fd, &msg, 0))) {
+		// ENOBUFS means events were lost, but the ones after still count.
+		if (errno==EINTR || errno==ENOBUFS) return;
+		perror_exit("netlink");
+	}
+
+	// Only believe the kernel.
+	if (nl.nl_pid) return;
+
+	toybuf[len] = 0;
+	for (s = toybuf; s<toybuf+len; s += strlen(s)+1) {
+		if (!strncmp(s, "ACTION=", 7)) action = s+7;
+		else if (!strncmp(s, "DEVPATH=", 8)) devpath = s+8;
+		else if (!strncmp(s, "SUBSYSTEM=", 10)) subsystem = s+10;
+		else if (!strncmp(s, "MAJOR=", 6)) major = s+6;
+		else if (!strncmp(s, "MINOR=", 6)) minor = s+6;
+	}
+	if (!action || !devpath || !major || !minor) return;
+
+	name = strrchr(devpath, '/')+1;
+	if (!*name || strlen(name)>NAME_MAX) return;
+	if (!strcmp(action, "add")) {
+		char dev[64];
+
+		snprintf(dev, sizeof(dev), "%s:%s", major, minor);
+		make_device(name, dev, strcmp(subsystem, "block") ? S_IFCHR : S_IFBLK);
+	} else if (!strcmp(action, "remove")) {
+		char path[NAME_MAX+6];
+
+		snprintf(path, sizeof(path), "/dev/%s", name);
+		if (unlink(path) && errno != ENOENT) perror_msg("unlink %s", path);
+	}
 }
 
 void mdev_main(void)
 {
-	// Handle -s
-
-	if (toys.optflags) {
-		xchdir("/sys/class");
-		strcpy(toybuf, "/sys/class");
-		dirtree_read(toybuf, NULL, callback);
-		strcpy(toybuf+5, "block");
-		dirtree_read(toybuf, NULL, callback);
+	int fd = -1;
+
+	if (CFG_MDEV_CONF) read_conf();
+
+	// Listen before scanning, so nothing added meanwhile is missed.
+	if (toys.optflags & FLAG_d) fd = uevent_open();
+	if (toys.optflags & FLAG_s) coldplug();
+
+	if (fd != -1) {
+		TT.daemon++;
+		for (;;) uevent(fd);
 	}
-//	if (toys.optflags) {
-//		strcpy(toybuf, "/sys/block");
-//		find_dev(toybuf);
-//		strcpy(toybuf, "/sys/class");
-//		find_dev(toybuf);
-//		return;
-//	}
-
-	// hotplug support goes here
 }
@@ -76,6 +76,12 @@ config MKE2FS_EXTENDED
 */
 
 #include "toys.h"
+#include <pthread.h>
+
+// From linux/fs.h, which doesn't get along with sys/mount.h.
+#ifndef BLKDISCARD
+#define BLKDISCARD _IO(0x12,119)
+#endif
 
 DEFINE_GLOBALS(
 	// Command line arguments.
@@ -86,7 +92,9 @@ DEFINE_GLOBALS(
 	char *gendir;          // Where to read dirtree from.
 
 	// Internal data.
-	struct dirtree *dt;    // Tree of files to copy into the new filesystem.
+	struct dirtree_arena dt; // Tree of files to copy into the new filesystem.
+	uint32_t *nodeblocks;  // Blocks used by each node of dt
+	uint32_t *nodestart;   // Where each node's blocks start (data_block() seq)
 	unsigned treeblocks;   // Blocks used by dt
 	unsigned treeinodes;   // Inodes used by dt
 
@@ -98,8 +106,16 @@ DEFINE_GLOBALS(
 
 	// For gene2fs
 	unsigned nextblock;    // Next data block to allocate
-	unsigned nextgroup;    // Next group we'll be allocating from
+	uint32_t *dataseq;     // Data blocks in the groups before each group.
+	unsigned *files;       // Regular files to copy into the image.
+	long filecount;
+	long nextfile;         // Next one for a worker to copy
 	int fsfd;              // File descriptor of filesystem (to output to).
+	int seekable;          // Can skip zeroes by seeking fsfd.
+	int zeroed;            // Unwritten parts of fsfd read back as zeroes.
+	char *outbuf;          // Output waiting to be written to fsfd.
+	long outlen;           // Bytes in outbuf.
+	off_t zeroes;          // Bytes to seek past after outbuf.
 
 	struct ext2_superblock sb;
 )
@@ -154,33 +170,37 @@ static uint32_t file_blocks_used(uint64_t size, uint32_t *blocklist)
 	return dblocks + iblocks + diblocks + tiblocks;
 }
 
-// Use the parent pointer to iterate through the tree non-recursively.
-static struct dirtree *treenext(struct dirtree *this)
+#define NODE(i) (TT.dt.node+(i))
+
+// Use the parent index to iterate through the tree non-recursively.
+static unsigned treenext(unsigned that)
 {
-	while (this && !this->next) this = this->parent;
-	if (this) this = this->next;
+	while (that && !NODE(that)->next) that = NODE(that)->parent;
+	if (that) that = NODE(that)->next;
 
-	return this;
+	return that;
 }
 
 // Recursively calculate the number of blocks used by each inode in the tree.
 // Returns blocks used by this directory, assigns bytes used to *size.
 // Writes total block count to TT.treeblocks and inode count to TT.treeinodes.
 
-static long check_treesize(struct dirtree *that, off_t *size)
+static long check_treesize(unsigned that, off_t *size)
 {
+	struct dirnode *node;
 	long blocks;
 
 	while (that) {
-		*size += sizeof(struct ext2_dentry) + strlen(that->name);
-
-		if (that->child)
-			that->st.st_blocks = check_treesize(that->child, &that->st.st_size);
-		else if (S_ISREG(that->st.st_mode)) {
-			 that->st.st_blocks = file_blocks_used(that->st.st_size, 0);
-			 TT.treeblocks += that->st.st_blocks;
+		node = NODE(that);
+		*size += sizeof(struct ext2_dentry) + strlen(dirnode_name(&TT.dt, that));
+
+		if (node->child)
+			TT.nodeblocks[that] = check_treesize(node->child, &node->size);
+		else if (S_ISREG(node->mode)) {
+			 TT.nodeblocks[that] = file_blocks_used(node->size, 0);
+			 TT.treeblocks += TT.nodeblocks[that];
 		}
-		that = that->next;
+		that = node->next;
 	}
 	TT.treeblocks += blocks = file_blocks_used(*size, 0);
 	TT.treeinodes++;
@@ -195,32 +215,33 @@ static long check_treesize(struct dirtree *that, off_t *size)
 // numbers of files (> 100,000) but can be done in very little code.
 // This rewrites inode numbers to their final values, allocating depth first.
 
-static void check_treelinks(struct dirtree *tree)
+static void check_treelinks(unsigned tree)
 {
-	struct dirtree *current=tree, *that;
+	struct dirnode *cur, *node;
+	unsigned current=tree, that;
 	long inode = INODES_RESERVED;
 
 	while (current) {
+		cur = NODE(current);
 		++inode;
 		// Since we can't hardlink to directories, we know their link count.
-		if (S_ISDIR(current->st.st_mode)) current->st.st_nlink = 2;
+		if (S_ISDIR(cur->mode)) cur->nlink = 2;
 		else {
-			dev_t new = current->st.st_dev;
+			dev_t new = cur->dev;
 
 			if (!new) continue;
 
 			// Look for other copies of current node
-			current->st.st_nlink = 0;
+			cur->nlink = 0;
 			for (that = tree; that; that = treenext(that)) {
-				if (current->st.st_ino == that->st.st_ino &&
-					current->st.st_dev == that->st.st_dev)
-				{
-					current->st.st_nlink++;
-					current->st.st_ino = inode;
+				node = NODE(that);
+				if (cur->ino == node->ino && cur->dev == node->dev) {
+					cur->nlink++;
+					cur->ino = inode;
 				}
 			}
 		}
-		current->st.st_ino = inode;
+		cur->ino = inode;
 		current = treenext(current);
 	}
 }
@@ -356,80 +377,319 @@ static int group_overhead(uint32_t group)
 {
 	// Return superblock backup overhead (if any), plus block/inode
 	// allocation bitmaps, plus inode tables.
-	return group_superblock_overhead(group) + 2 + get_inodespg(TT.inodespg)
+	return group_superblock_overhead(group) + 2 + TT.inodespg
 				/ (TT.blocksize/sizeof(struct ext2_inode));
 }
 
-// In bitmap "array" set "len" bits starting at position "start" (from 0).
-static void bits_set(char *array, int start, int len)
+// Blocks in group that aren't past the end of the filesystem.
+static uint32_t group_end(uint32_t group)
 {
-	while(len) {
-		if ((start&7) || len<8) {
-			array[start/8]|=(1<<(start&7));
-			start++;
-			len--;
-		} else {
-			array[start/8]=255;
-			start+=8;
-			len-=8;
+	if ((group+1)*(uint64_t)TT.blockbits > TT.blocks)
+		return TT.blocks & (TT.blockbits-1);
+	return TT.blockbits;
+}
+
+// Data blocks are allocated in order through the data area of each group
+// (what's left after the group overhead).  A node's blocks are a run of
+// this sequence, which starts at nodestart (nodeblocks long): look up where
+// a block of the sequence is in the filesystem.
+
+static uint32_t data_block(uint32_t seq)
+{
+	uint32_t lo = 0, hi = TT.groups, mid;
+
+	while (hi-lo > 1) {
+		mid = (lo+hi)/2;
+		if (TT.dataseq[mid] <= seq) lo = mid;
+		else hi = mid;
+	}
+
+	return lo*TT.blockbits + group_overhead(lo) + seq - TT.dataseq[lo];
+}
+
+static void alloc_tree(unsigned that)
+{
+	struct dirnode *node;
+
+	for (; that; that = node->next) {
+		node = NODE(that);
+		if (!S_ISREG(node->mode) && !node->child) TT.nodeblocks[that] = 0;
+		TT.nodestart[that] = TT.nextblock;
+		TT.nextblock += TT.nodeblocks[that];
+		if (S_ISREG(node->mode) && node->size) {
+			if (!(TT.filecount&255))
+				TT.files = xrealloc(TT.files,
+					(TT.filecount+256)*sizeof(unsigned));
+			TT.files[TT.filecount++] = that;
 		}
+		if (node->child) alloc_tree(node->child);
 	}
 }
 
-// Seek past len bytes (to maintain sparse file), or write zeroes if output
-// not seekable
-static void put_zeroes(int len)
+// Where a node's blocks go: data blocks in order, with each index block just
+// before the blocks it points to, like mke2fs does.  Fills out the 15 block
+// pointers of its inode.  With src != -1 also writes the index blocks into
+// the filesystem and copies the data there.
+
+struct file_map {
+	uint32_t seq, left, data;   // Next block of the sequence, data blocks left
+	uint32_t run, runlen, rundata;  // Data waiting to be copied
+	off_t size;
+	int src;
+};
+
+static void map_copy(struct file_map *fm)
 {
-	if(-1 == lseek(TT.fsfd, len, SEEK_SET)) {
-		memset(toybuf, 0, sizeof(toybuf));
-		while (len) {
-			int out = len > sizeof(toybuf) ? sizeof(toybuf) : len;
-			xwrite(TT.fsfd, toybuf, out);
-			len -= out;
+	off_t in = fm->rundata*(off_t)TT.blocksize, out = fm->run*(off_t)TT.blocksize,
+		len = fm->runlen*(off_t)TT.blocksize;
+	char *buf = NULL;
+	long n;
+
+	if (in+len > fm->size) len = fm->size-in;
+	while (len > 0) {
+		if (!buf && 0<(n = copy_file_range(fm->src, &in, TT.fsfd, &out, len, 0)))
+		{
+			len -= n;
+			continue;
 		}
+		if (!buf) buf = xmalloc(1<<17);
+		n = pread(fm->src, buf, len < (1<<17) ? len : (1<<17), in);
+		if (n<1 || n != pwrite(TT.fsfd, buf, n, out)) perror_exit("copy");
+		in += n;
+		out += n;
+		len -= n;
 	}
+	free(buf);
+	fm->runlen = 0;
 }
 
-// Fill out an inode structure from struct stat info in dirtree.
-static void fill_inode(struct ext2_inode *in, struct dirtree *that)
+// Map a level deep tree of index blocks (0 being a data block), return the
+// block it starts at.
+static uint32_t map_level(struct file_map *fm, int level)
 {
-	uint32_t fbu[15];
-	int temp;
+	uint32_t block = data_block(fm->seq++), *index, i;
+
+	if (!level) {
+		fm->left--;
+		if (fm->src != -1) {
+			if (fm->runlen && block == fm->run+fm->runlen) fm->runlen++;
+			else {
+				if (fm->runlen) map_copy(fm);
+				fm->run = block;
+				fm->runlen = 1;
+				fm->rundata = fm->data;
+			}
+		}
+		fm->data++;
+
+		return block;
+	}
+
+	index = xzalloc(TT.blocksize);
+	for (i = 0; i<TT.blocksize/4 && fm->left; i++)
+		index[i] = SWAP_LE32(map_level(fm, level-1));
+	if (fm->src != -1
+		&& TT.blocksize != pwrite(TT.fsfd, index, TT.blocksize,
+			block*(off_t)TT.blocksize))
+				perror_exit("write");
+	free(index);
+
+	return block;
+}
+
+static void map_file(unsigned that, uint32_t *blocklist, int src)
+{
+	struct file_map fm;
+	int i;
+
+	memset(&fm, 0, sizeof(fm));
+	fm.seq = TT.nodestart[that];
+	fm.left = (NODE(that)->size+(TT.blocksize-1))/TT.blocksize;
+	fm.size = NODE(that)->size;
+	fm.src = src;
+
+	for (i=0; i<12 && fm.left; i++) blocklist[i] = SWAP_LE32(map_level(&fm, 0));
+	for (i=1; i<4 && fm.left; i++)
+		blocklist[11+i] = SWAP_LE32(map_level(&fm, i));
+	if (fm.runlen) map_copy(&fm);
+}
+
+// The path of a node under TT.gendir.
+static char *tree_path(unsigned node)
+{
+	unsigned that;
+	long len = strlen(TT.gendir), i;
+	char *path, *s;
+
+	for (that = node; that; that = NODE(that)->parent)
+		len += strlen(dirnode_name(&TT.dt, that))+1;
+	s = (path = xmalloc(len+1)) + len;
+	*s = 0;
+	for (that = node; that; that = NODE(that)->parent) {
+		i = strlen(dirnode_name(&TT.dt, that));
+		memcpy(s -= i, dirnode_name(&TT.dt, that), i);
+		*--s = '/';
+	}
+	memcpy(path, TT.gendir, strlen(TT.gendir));
+
+	return path;
+}
+
+// Worker threads copy the files into the image while the main thread writes
+// the metadata: they only ever write to data blocks, at their own offsets.
+
+static pthread_mutex_t copy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *copy_worker(void *unused)
+{
+	uint32_t blocklist[15];
+	unsigned that;
+	char *path;
+	long i;
+	int fd;
+
+	for (;;) {
+		pthread_mutex_lock(&copy_lock);
+		i = TT.nextfile++;
+		pthread_mutex_unlock(&copy_lock);
+		if (i >= TT.filecount) return NULL;
+
+		that = TT.files[i];
+		path = tree_path(that);
+		fd = xopen(path, O_RDONLY);
+		map_file(that, blocklist, fd);
+		close(fd);
+		free(path);
+	}
+}
+
+// In bitmap "array" set "len" bits starting at position "start" (from 0).
+// The partial bytes at either end get masks, the whole bytes between memset().
+static void bits_set(char *array, int start, int len)
+{
+	int end = start+len;
+
+	if (len<1) return;
+	if (start/8 == (end-1)/8) {
+		array[start/8] |= ((1<<len)-1) << (start&7);
+		return;
+	}
+	if (start&7) {
+		array[start/8] |= 255 << (start&7);
+		start = (start|7)+1;
+	}
+	if (end&7) array[end/8] |= (1<<(end&7))-1;
+	memset(array+start/8, 255, end/8-start/8);
+}
+
+// Everything written to the filesystem goes through outbuf, so writes are a
+// megabyte at a time rather than a block at a time, and runs of zeroes skipped
+// in a seekable file add up to one lseek().
+
+#define OUTBUF (1<<20)
 
-	file_blocks_used(that->st.st_size, fbu);
+static void flush_out(void)
+{
+	if (TT.outlen) xwrite(TT.fsfd, TT.outbuf, TT.outlen);
+	TT.outlen = 0;
+	if (TT.zeroes && -1 == lseek(TT.fsfd, TT.zeroes, SEEK_CUR))
+		perror_exit("lseek");
+	TT.zeroes = 0;
+}
 
-	// If that inode needs data blocks allocated to it.
-	if (that->st.st_size) {
-		int i, group = TT.nextblock/TT.blockbits;
+static void put_data(void *data, long len)
+{
+	if (TT.zeroes) flush_out();
+	while (len) {
+		long out = OUTBUF-TT.outlen;
 
-		// TODO: teach this about indirect blocks.
-		for (i=0; i<15; i++) {
-			// If we just jumped into a new group, skip group overhead blocks.
-			while (group >= TT.nextgroup)
-				TT.nextblock += group_overhead(TT.nextgroup++);
+		if (!out) {
+			flush_out();
+			continue;
 		}
+		if (out > len) out = len;
+		if (data) {
+			memcpy(TT.outbuf+TT.outlen, data, out);
+			data = (char *)data + out;
+		} else memset(TT.outbuf+TT.outlen, 0, out);
+		TT.outlen += out;
+		len -= out;
 	}
+}
+
+// Next block of output, zeroed, to fill in before the next put_*() call.
+static void *put_block(void)
+{
+	char *block;
+
+	if (TT.zeroes || TT.outlen+TT.blocksize > OUTBUF) flush_out();
+	block = TT.outbuf+TT.outlen;
+	memset(block, 0, TT.blocksize);
+	TT.outlen += TT.blocksize;
+
+	return block;
+}
+
+// Seek past len bytes (to maintain sparse file), or write zeroes if output
+// not seekable
+static void put_zeroes(off_t len)
+{
+	if (TT.seekable) TT.zeroes += len;
+	else put_data(NULL, len);
+}
+
+// Make the image read back as zeroes without writing them, so blocks of
+// inode table with nothing in them can be skipped like data blocks.  A file
+// is zeroes past its end, and has the rest punched out.  A block device gets
+// discarded (which needn't read back as zeroes) then zeroed, which the
+// kernel does by unmapping where the device can.  Returns 0 if this didn't
+// work (and the zeroes have to be written).
+
+static int zero_image(off_t len)
+{
+	struct stat st;
+	uint64_t range[2] = {0, len};
+
+	if (!TT.seekable || fstat(TT.fsfd, &st)) return 0;
+	if (S_ISREG(st.st_mode)) {
+		if (st.st_size < len) len = st.st_size;
+		if (!len) return 1;
+	} else if (S_ISBLK(st.st_mode)) ioctl(TT.fsfd, BLKDISCARD, range);
+	else return 0;
+
+	return !fallocate(TT.fsfd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, 0, len)
+		|| !fallocate(TT.fsfd, FALLOC_FL_ZERO_RANGE|FALLOC_FL_KEEP_SIZE, 0, len);
+}
+
+// Fill out an inode structure from the stat info in dt.
+static void fill_inode(struct ext2_inode *in, unsigned that)
+{
+	struct dirnode *node = NODE(that);
+	int temp;
+
+	// If that inode has data blocks allocated to it.
+	if (TT.nodeblocks[that]) map_file(that, in->block, -1);
 	// TODO :  S_ISREG/DIR/CHR/BLK/FIFO/LNK/SOCK(m)
-	in->mode = SWAP_LE32(that->st.st_mode);
+	in->mode = SWAP_LE32(node->mode);
 
-	in->uid = SWAP_LE16(that->st.st_uid & 0xFFFF);
-	in->uid_high = SWAP_LE16(that->st.st_uid >> 16);
-	in->gid = SWAP_LE16(that->st.st_gid & 0xFFFF);
-	in->gid_high = SWAP_LE16(that->st.st_gid >> 16);
-	in->size = SWAP_LE32(that->st.st_size & 0xFFFFFFFF);
+	in->uid = SWAP_LE16(node->uid & 0xFFFF);
+	in->uid_high = SWAP_LE16(node->uid >> 16);
+	in->gid = SWAP_LE16(node->gid & 0xFFFF);
+	in->gid_high = SWAP_LE16(node->gid >> 16);
+	in->size = SWAP_LE32(node->size & 0xFFFFFFFF);
 
 	// Contortions to make the compiler not generate a warning for x>>32
 	// when x is 32 bits.  The optimizer should clean this up.
-	if (sizeof(that->st.st_size) > 4) temp = 32;
+	if (sizeof(node->size) > 4) temp = 32;
 	else temp = 0;
-	if (temp) in->dir_acl = SWAP_LE32(that->st.st_size >> temp);
+	if (temp) in->dir_acl = SWAP_LE32(node->size >> temp);
 	
-	in->atime = SWAP_LE32(that->st.st_atime);
-	in->ctime = SWAP_LE32(that->st.st_ctime);
-	in->mtime = SWAP_LE32(that->st.st_mtime);
+	in->atime = SWAP_LE32(node->atime);
+	in->ctime = SWAP_LE32(node->ctime);
+	in->mtime = SWAP_LE32(node->mtime);
 
-	in->links_count = SWAP_LE16(that->st.st_nlink);
-	in->blocks = SWAP_LE32(that->st.st_blocks);
+	in->links_count = SWAP_LE16(node->nlink);
+	in->blocks = SWAP_LE32(TT.nodeblocks[that]);
 	// in->faddr
 }
 
@@ -442,7 +702,9 @@ void mke2fs_main(void)
 	int i, temp;
 	off_t length;
 	uint32_t usedblocks, usedinodes, dtiblk, dtbblk;
-	struct dirtree *dti, *dtb;
+	unsigned dti, dtb;
+	pthread_t *workers = NULL;
+	int nworkers = 0;
 
 	// Handle command line arguments.
 
@@ -456,6 +718,8 @@ void mke2fs_main(void)
 
 	// For mke?fs, open file.  For gene?fs, create file.
 	TT.fsfd = xcreate(*toys.optargs, temp, 0777);
+	TT.seekable = -1 != lseek(TT.fsfd, 0, SEEK_CUR);
+	TT.outbuf = xmalloc(OUTBUF);
 	
 	// Determine appropriate block size and block count from file length.
 	// (If no length, default to 4k.  They can override it on the cmdline.)
@@ -465,29 +729,30 @@ void mke2fs_main(void)
 	TT.blockbits = 8*TT.blocksize;
 	if (!TT.blocks) TT.blocks = length/TT.blocksize;
 
+	// Add root directory inode.  This is iterated through for when finding
+	// blocks, but not when finding inodes.  The tree's parent pointers don't
+	// point back into this.
+
+	dtb = dirtree_arena_add(&TT.dt, "", NULL);
+	NODE(dtb)->mode = S_IFDIR|0755;
+	NODE(dtb)->ctime = NODE(dtb)->mtime = time(NULL);
+
 	// Collect gene2fs list or lost+found, calculate requirements.
 
 	if (TT.gendir) {
 		strncpy(toybuf, TT.gendir, sizeof(toybuf));
-		dti = dirtree_read(toybuf, NULL, NULL);
+		dti = dirtree_arena_read(&TT.dt, toybuf, 0, 0);
 	} else {
-		dti = xzalloc(sizeof(struct dirtree)+11);
-		strcpy(dti->name, "lost+found");
-		dti->st.st_mode = S_IFDIR|0755;
-		dti->st.st_ctime = dti->st.st_mtime = time(NULL);
+		dti = dirtree_arena_add(&TT.dt, "lost+found", NULL);
+		NODE(dti)->mode = S_IFDIR|0755;
+		NODE(dti)->ctime = NODE(dti)->mtime = time(NULL);
 	}
-
-	// Add root directory inode.  This is iterated through for when finding
-	// blocks, but not when finding inodes.  The tree's parent pointers don't
-	// point back into this.
-
-	dtb = xzalloc(sizeof(struct dirtree)+1);
-	dtb->st.st_mode = S_IFDIR|0755;
-	dtb->st.st_ctime = dtb->st.st_mtime = time(NULL);
-	dtb->child = dti;
+	NODE(dtb)->child = dti;
+	TT.nodeblocks = xzalloc(TT.dt.count*sizeof(uint32_t));
+	TT.nodestart = xmalloc(TT.dt.count*sizeof(uint32_t));
 	
 	// Figure out how much space is used by preset files
-	length = check_treesize(dtb, &(dtb->st.st_size));
+	length = check_treesize(dtb, &(NODE(dtb)->size));
 	check_treelinks(dtb);
 
 	// Figure out how many total inodes we need.
@@ -495,6 +760,8 @@ void mke2fs_main(void)
 	if (!TT.inodes) {
 		if (!TT.bytes_per_inode) TT.bytes_per_inode = 8192;
 		TT.inodes = (TT.blocks * (uint64_t)TT.blocksize) / TT.bytes_per_inode;
+		if (TT.inodes < TT.treeinodes+INODES_RESERVED)
+			TT.inodes = TT.treeinodes+INODES_RESERVED;
 	}
 
 	// If we're generating a filesystem and have no idea how many blocks it
@@ -506,6 +773,7 @@ void mke2fs_main(void)
 	for (;;) {
 		temp = TT.treeblocks;
 
+		TT.inodespg = get_inodespg(TT.inodes);
 		for (i = 0; i<TT.groups; i++) temp += group_overhead(i);
 
 		if (TT.blocks) {
@@ -524,19 +792,38 @@ void mke2fs_main(void)
 
 	init_superblock(&TT.sb);
 
+	TT.zeroed = zero_image(TT.blocks*(off_t)TT.blocksize);
+
+	// Give the tree its data blocks, and start copying the files' data in.
+	TT.dataseq = xmalloc((TT.groups+1)*sizeof(uint32_t));
+	for (i = TT.dataseq[0] = 0; i<TT.groups; i++)
+		TT.dataseq[i+1] = TT.dataseq[i] + group_end(i) - group_overhead(i);
+	alloc_tree(dtb);
+	if (TT.filecount) {
+		if (!TT.seekable) error_exit("Can't copy files to unseekable output");
+		temp = sysconf(_SC_NPROCESSORS_ONLN);
+		if (temp < 4) temp = 4;
+		if (temp > 16) temp = 16;
+		if (temp > TT.filecount) temp = TT.filecount;
+		workers = xmalloc(temp*sizeof(pthread_t));
+		for (nworkers = 0; nworkers<temp; nworkers++)
+			if (pthread_create(workers+nworkers, NULL, copy_worker, NULL))
+				perror_exit("pthread_create");
+	}
+
 	// Start writing.  Skip the first 1k to avoid the boot sector (if any).
 	put_zeroes(1024);
 
 	// Loop through block groups, write out each one.
 	dtiblk = dtbblk = usedblocks = usedinodes = 0;
 	for (i=0; i<TT.groups; i++) {
-		struct ext2_inode *in = (struct ext2_inode *)toybuf;
+		struct ext2_inode *in = NULL;
 		uint32_t start, itable, used, end;
+		char *bitmap;
 		int j, slot;
 
 		// Where does this group end?
-		end = TT.blockbits;
-		if ((i+1)*TT.blockbits > TT.blocks) end = TT.blocks & (TT.blockbits-1);
+		end = group_end(i);
 
 		// Blocks used by inode table
 		itable = (TT.inodespg*sizeof(struct ext2_inode))/TT.blocksize;
@@ -544,17 +831,16 @@ void mke2fs_main(void)
 		// If a superblock goes here, write it out.
 		start = group_superblock_overhead(i);
 		if (start) {
-			struct ext2_group *bg = (struct ext2_group *)toybuf;
+			struct ext2_group *bg = NULL;
 			int treeblocks = TT.treeblocks, treeinodes = TT.treeinodes;
 
 			TT.sb.block_group_nr = SWAP_LE16(i);
 
 			// Write superblock and pad it up to block size
-			xwrite(TT.fsfd, &TT.sb, sizeof(struct ext2_superblock));
+			put_data(&TT.sb, sizeof(struct ext2_superblock));
 			temp = TT.blocksize - sizeof(struct ext2_superblock);
 			if (!i && TT.blocksize > 1024) temp -= 1024;
-			memset(toybuf, 0, TT.blocksize);
-			xwrite(TT.fsfd, toybuf, temp);
+			put_data(NULL, temp);
 
 			// Loop through groups to write group descriptor table.
 			for(j=0; j<TT.groups; j++) {
@@ -564,10 +850,7 @@ void mke2fs_main(void)
 
 				// Find next array slot in this block (flush block if full).
 				slot = j % (TT.blocksize/sizeof(struct ext2_group));
-				if (!slot) {
-					if (j) xwrite(TT.fsfd, bg, TT.blocksize);
-					memset(bg, 0, TT.blocksize);
-				}
+				if (!slot) bg = put_block();
 
 				// How many free inodes in this group?
 				temp = TT.inodespg;
@@ -600,7 +883,6 @@ void mke2fs_main(void)
 				bg[slot].inode_table = SWAP_LE32(used);
 				bg[slot].used_dirs_count = 0;  // (TODO)
 			}
-			xwrite(TT.fsfd, bg, TT.blocksize);
 		}
 
 		// Now write out stuff that every block group has.
@@ -608,34 +890,38 @@ void mke2fs_main(void)
 		// Write block usage bitmap
 
 		start += 2 + itable;
-		memset(toybuf, 0, TT.blocksize);
-		bits_set(toybuf, 0, start);
-		bits_set(toybuf, end, TT.blockbits-end);
+		bitmap = put_block();
+		bits_set(bitmap, 0, start);
+		bits_set(bitmap, end, TT.blockbits-end);
 		temp = TT.treeblocks - usedblocks;
 		if (temp) {
-			if (end-start > temp) temp = end-start;
-			bits_set(toybuf, start, temp);
+			if (temp > end-start) temp = end-start;
+			bits_set(bitmap, start, temp);
+			usedblocks += temp;
 		}
-		xwrite(TT.fsfd, toybuf, TT.blocksize);
 
 		// Write inode bitmap
-		memset(toybuf, 0, TT.blocksize);
+		bitmap = put_block();
 		j = 0;
-		if (!i) bits_set(toybuf, 0, j = INODES_RESERVED);
-		bits_set(toybuf, TT.inodespg, slot = TT.blockbits-TT.inodespg);
+		if (!i) bits_set(bitmap, 0, j = INODES_RESERVED);
+		bits_set(bitmap, TT.inodespg, slot = TT.blockbits-TT.inodespg);
 		temp = TT.treeinodes - usedinodes;
 		if (temp) {
 			if (slot-j > temp) temp = slot-j;
-			bits_set(toybuf, j, temp);
+			bits_set(bitmap, j, temp);
 		}
-		xwrite(TT.fsfd, toybuf, TT.blocksize);
 
 		// Write inode table for this group (TODO)
 		for (j = 0; j<TT.inodespg; j++) {
 			slot = j % (TT.blocksize/sizeof(struct ext2_inode));
 			if (!slot) {
-				if (j) xwrite(TT.fsfd, in, TT.blocksize);
-				memset(in, 0, TT.blocksize);
+				// Past the last inode (and the root inode), skip the rest of
+				// an image that's zeroes already.
+				if (TT.zeroed && !dti && (i || j>2)) {
+					put_zeroes((TT.inodespg-j)*(off_t)sizeof(struct ext2_inode));
+					break;
+				}
+				in = put_block();
 			}
 			if (!i && j<INODES_RESERVED) {
 				// Write root inode
@@ -645,7 +931,6 @@ void mke2fs_main(void)
 				dti = treenext(dti);
 			}
 		}
-		xwrite(TT.fsfd, in, TT.blocksize);
 
 		while (dtb) {
 			// TODO write index data block
@@ -657,6 +942,25 @@ void mke2fs_main(void)
 			if (start == end) break;
 		}
 		// Write data blocks (TODO)
-		put_zeroes((end-start) * TT.blocksize);
+		put_zeroes((end-start) * (off_t)TT.blocksize);
+	}
+	flush_out();
+	while (nworkers) pthread_join(workers[--nworkers], NULL);
+
+	// Skipping the last data blocks doesn't make the file that long.
+	if (TT.seekable) {
+		length = lseek(TT.fsfd, 0, SEEK_CUR);
+		if (fdlength(TT.fsfd) < length && ftruncate(TT.fsfd, length))
+			perror_exit("ftruncate");
+	}
+
+	if (CFG_TOYBOX_FREE) {
+		free(TT.outbuf);
+		free(TT.dataseq);
+		free(TT.files);
+		free(TT.nodeblocks);
+		free(TT.nodestart);
+		dirtree_arena_free(&TT.dt);
+		free(workers);
 	}
 }
@@ -6,8 +6,8 @@
  *
  * Not in SUSv3.
 
-USE_NETCAT(OLDTOY(nc, netcat, USE_NETCAT_LISTEN("tl^L^")"w#p#s:q#f:", TOYFLAG_BIN))
-USE_NETCAT(NEWTOY(netcat, USE_NETCAT_LISTEN("tl^L^")"w#p#s:q#f:", TOYFLAG_BIN))
+USE_NETCAT(OLDTOY(nc, netcat, USE_NETCAT_LISTEN("F:j#tl^L^")"w#p#s:q#f:", TOYFLAG_BIN))
+USE_NETCAT(NEWTOY(netcat, USE_NETCAT_LISTEN("F:j#tl^L^")"w#p#s:q#f:", TOYFLAG_BIN))
 
 config NETCAT
 	bool "netcat"
@@ -33,6 +33,8 @@ config NETCAT_LISTEN
 	  -t    allocate tty (must come before -l or -L)
 	  -l	listen for one incoming connection.
 	  -L	listen for multiple incoming connections (server mode).
+	  -F	with -L, forward each connection to HOST:PORT (no fork per connection)
+	  -j	with -F, serve connections from N threads
 
 	  Any additional command line arguments after -l or -L are executed
 	  to handle each incoming connection.  If none, the connection is
@@ -44,6 +46,9 @@ config NETCAT_LISTEN
 
 #include "toys.h"
 #include "toynet.h"
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 
 DEFINE_GLOBALS(
 	char *filename;        // -f read from filename instead of network
@@ -51,6 +56,8 @@ DEFINE_GLOBALS(
 	char *source_address;  // -s Bind to a specific source address.
 	long port;             // -p Bind to a specific source port.
 	long wait;             // -w Wait # seconds for a connection.
+	long jobs;             // -j Threads serving -F connections.
+	char *forward;         // -F Forward -L connections to host:port.
 )
 
 #define TT this.netcat
@@ -88,12 +95,251 @@ static void lookup_port(char *str, uint16_t *port)
   *port = SWAP_BE16(atoi(str));
 }
 
+// Each direction of the poll loop splices from its input into a pipe and
+// from the pipe to its output, so the data never comes out of the kernel.
+// If either end can't splice (ttys, O_APPEND files...) it falls back to
+// read() and write() through a buffer.
+
+#define RELAY_PIPE (1<<20)	// Asked for, the kernel may give us less
+#define RELAY_BUF (1<<17)
+
+struct relay {
+	int pipe[2], size;	// size: 0 not set up yet, -1 can't splice
+	char *buf;
+};
+
+// Copy some of what's waiting on in to out.  Returns what read() would.
+
+static long relay(struct relay *r, int in, int out)
+{
+	long len, i;
+
+	if (!r->size) {
+		if (pipe(r->pipe)) r->size = r->pipe[0] = r->pipe[1] = -1;
+		else {
+			fcntl(r->pipe[1], F_SETPIPE_SZ, RELAY_PIPE);
+			if ((r->size = fcntl(r->pipe[1], F_GETPIPE_SZ)) < 1)
+				r->size = 65536;
+		}
+	}
+	if (r->size > 0) {
+		len = splice(in, NULL, r->pipe[1], NULL, r->size, SPLICE_F_MOVE);
+		if (len < 0 && errno == EINVAL) r->size = -1;
+		else {
+			for (i = len; i > 0; ) {
+				long j = splice(r->pipe[0], NULL, out, NULL, i, SPLICE_F_MOVE);
+
+				if (j < 0 && errno == EINTR) continue;
+				if (j < 0 && errno == EINVAL) {
+					// Output can't splice: empty the pipe the slow way.
+					r->size = -1;
+					if (!r->buf) r->buf = xmalloc(RELAY_BUF);
+					while (i) {
+						j = xread(r->pipe[0], r->buf, i < RELAY_BUF ? i : RELAY_BUF);
+						xwrite(out, r->buf, j);
+						i -= j;
+					}
+					break;
+				}
+				if (j < 1) perror_exit("splice");
+				i -= j;
+			}
+
+			return len;
+		}
+	}
+
+	if (!r->buf) r->buf = xmalloc(RELAY_BUF);
+	len = read(in, r->buf, RELAY_BUF);
+	if (len > 0) xwrite(out, r->buf, len);
+
+	return len;
+}
+
+// netcat -L -F: forward every incoming connection to another address,
+// serving them all from epoll loops instead of forking.  Each of the -j
+// threads has its own SO_REUSEPORT socket on the listening address, so the
+// kernel spreads the connections out and nothing is shared between them.
+// The data goes through a buffer per direction: with thousands of
+// connections, a pipe pair each for splice() would run out of fds.
+
+#define FWD_BUF 16384
+
+struct fwd_half {
+	int len, pos, eof;
+	char buf[FWD_BUF];
+};
+
+// fd[0] is the incoming connection, fd[1] the one we made.  half[0] copies
+// fd[0] to fd[1], half[1] the other way.
+struct fwd_conn {
+	struct fwd_conn *next;	// On the dead list
+	int fd[2], dead;
+	struct fwd_half half[2];
+};
+
+struct fwd_pool {
+	struct sockaddr_in listen, target;
+};
+
+// Move what we can from one side to the other.  Returns -1 on error.
+
+static int fwd_pump(int from, int to, struct fwd_half *h)
+{
+	int len;
+
+	for (;;) {
+		if (h->pos < h->len) {
+			len = send(to, h->buf+h->pos, h->len-h->pos, MSG_NOSIGNAL);
+			if (len < 0) return errno == EAGAIN ? 0 : -1;
+			h->pos += len;
+			continue;
+		}
+		if (h->eof) return 0;
+		len = read(from, h->buf, FWD_BUF);
+		if (len < 0) return errno == EAGAIN ? 0 : -1;
+		if (!len) {
+			h->eof++;
+			shutdown(to, SHUT_WR);
+			return 0;
+		}
+		h->pos = 0;
+		h->len = len;
+	}
+}
+
+static void fwd_accept(struct fwd_pool *pool, int epfd, int listenfd)
+{
+	struct epoll_event ev;
+	struct fwd_conn *conn;
+	int fd, i;
+
+	while (-1 != (fd = accept4(listenfd, NULL, NULL,
+		SOCK_NONBLOCK|SOCK_CLOEXEC)))
+	{
+		conn = xzalloc(sizeof(struct fwd_conn));
+		conn->fd[0] = fd;
+		conn->fd[1] = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+		if (conn->fd[1] < 0 || (connect(conn->fd[1],
+			(struct sockaddr *)&pool->target, sizeof(pool->target))
+			&& errno != EINPROGRESS))
+		{
+			perror_msg("connect");
+			close(conn->fd[1]);
+			close(fd);
+			free(conn);
+			continue;
+		}
+
+		// Edge triggered: every event pumps both directions until they'd
+		// block, so there's nothing left to be told about again.
+		ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+		ev.data.ptr = conn;
+		for (i=0; i<2; i++) epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd[i], &ev);
+	}
+}
+
+static void fwd_loop(struct fwd_pool *pool, int listenfd)
+{
+	struct epoll_event ev, events[64];
+	struct fwd_conn *conn, *dead;
+	int epfd = epoll_create1(EPOLL_CLOEXEC), i, n;
+
+	fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev))
+		perror_exit("epoll");
+
+	for (;;) {
+		if (0 > (n = epoll_wait(epfd, events, 64, -1))) {
+			if (errno == EINTR) continue;
+			perror_exit("epoll_wait");
+		}
+
+		// Both of a connection's fds can have events in this batch, so
+		// free what closed only once they've all been looked at.
+		dead = NULL;
+		for (i=0; i<n; i++) {
+			if (!(conn = events[i].data.ptr)) {
+				fwd_accept(pool, epfd, listenfd);
+				continue;
+			}
+			if (conn->dead) continue;
+			if (fwd_pump(conn->fd[0], conn->fd[1], conn->half) < 0
+				|| fwd_pump(conn->fd[1], conn->fd[0], conn->half+1) < 0
+				|| (conn->half[0].eof && conn->half[1].eof
+					&& conn->half[0].pos == conn->half[0].len
+					&& conn->half[1].pos == conn->half[1].len))
+			{
+				close(conn->fd[0]);
+				close(conn->fd[1]);
+				conn->dead++;
+				conn->next = dead;
+				dead = conn;
+			}
+		}
+		while ((conn = dead)) {
+			dead = conn->next;
+			free(conn);
+		}
+	}
+}
+
+// The main thread uses the socket netcat_main() made, the others open their
+// own on the same address.
+
+static void *fwd_worker(void *arg)
+{
+	struct fwd_pool *pool = arg;
+	int fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0), i = 1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &i, sizeof(i));
+	setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &i, sizeof(i));
+	if (bind(fd, (struct sockaddr *)&pool->listen, sizeof(pool->listen))
+		|| listen(fd, 128)) perror_exit("bind");
+	fwd_loop(pool, fd);
+
+	return NULL;
+}
+
+static void netcat_forward(int sockfd)
+{
+	struct fwd_pool pool;
+	struct rlimit rl;
+	socklen_t len = sizeof(pool.listen);
+	pthread_t thread;
+	char *port = strrchr(TT.forward, ':');
+	int i;
+
+	if (!port) error_exit("-F wants HOST:PORT");
+	*port++ = 0;
+	memset(&pool, 0, sizeof(pool));
+	pool.target.sin_family = AF_INET;
+	lookup_name(TT.forward, (uint32_t *)&pool.target.sin_addr);
+	lookup_port(port, &pool.target.sin_port);
+	getsockname(sockfd, (struct sockaddr *)&pool.listen, &len);
+
+	// Two fds per connection add up.
+	if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	for (i=1; i<TT.jobs; i++)
+		if (pthread_create(&thread, NULL, fwd_worker, &pool))
+			perror_exit("pthread_create");
+	fwd_loop(&pool, sockfd);
+}
+
 void netcat_main(void)
 {
 	int sockfd=-1, pollcount=2;
 	struct pollfd pollfds[2];
+	struct relay relays[2];
 
 	memset(pollfds, 0, 2*sizeof(struct pollfd));
+	memset(relays, 0, 2*sizeof(struct relay));
 	pollfds[0].events = pollfds[1].events = POLLIN;
 	set_alarm(TT.wait);
 
@@ -104,6 +350,9 @@ void netcat_main(void)
 	} else if (!(toys.optflags&(FLAG_l|FLAG_L)) && toys.optc!=2) toys.exithelp++;
 
 	if (toys.exithelp) error_exit("Argument count wrong");
+	if (CFG_NETCAT_LISTEN && TT.forward
+		&& (!(toys.optflags&FLAG_L) || toys.optc))
+			error_exit("-F needs -L and no command");
 
 	if (TT.filename) pollfds[0].fd = xopen(TT.filename, O_RDWR);
 	else {
@@ -116,6 +365,8 @@ void netcat_main(void)
 		fcntl(sockfd, F_SETFD, FD_CLOEXEC);
 		temp = 1;
 		setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &temp, sizeof(temp));
+		if (CFG_NETCAT_LISTEN && TT.forward)
+			setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &temp, sizeof(temp));
 		memset(&address, 0, sizeof(address));
 		address.sin_family = AF_INET;
 		if (TT.source_address || TT.port) {
@@ -141,12 +392,19 @@ void netcat_main(void)
 		} else {
 			socklen_t len = sizeof(address);
 
-			if (listen(sockfd, 5)) error_exit("listen");
+			// -F takes connections as fast as they come, make room for them.
+			if (listen(sockfd, TT.forward ? 128 : 5)) error_exit("listen");
 			if (!TT.port) {
 				getsockname(sockfd, &address, &len);
 				printf("%d\n", SWAP_BE16(address.sin_port));
 				fflush(stdout);
 			}
+
+			if (TT.forward) {
+				set_alarm(0);
+				netcat_forward(sockfd);
+			}
+
 			// Do we need to return immediately because -l has arguments?
 
 			if ((toys.optflags&FLAG_l) && toys.optc) {
@@ -209,9 +467,8 @@ void netcat_main(void)
 
 		for (i=0; i<pollcount; i++) {
 			if (pollfds[i].revents & POLLIN) {
-				int len = read(pollfds[i].fd, toybuf, sizeof(toybuf));
-				if (len<1) goto dohupnow;
-				xwrite(i ? pollfds[0].fd : 1, toybuf, len);
+				if (relay(relays+i, pollfds[i].fd, i ? pollfds[0].fd : 1) < 1)
+					goto dohupnow;
 			} else if (pollfds[i].revents & POLLHUP) {
 dohupnow:
 				// Close half-connection.  This is needed for things like
@@ -226,7 +483,16 @@ dohupnow:
 	}
 cleanup:
 	if (CFG_TOYBOX_FREE) {
+		int i;
+
 		close(pollfds[0].fd);
 		close(sockfd);
+		for (i=0; i<2; i++) {
+			if (relays[i].size) {
+				close(relays[i].pipe[0]);
+				close(relays[i].pipe[1]);
+			}
+			free(relays[i].buf);
+		}
 	}
 }
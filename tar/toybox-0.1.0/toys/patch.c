@@ -21,17 +21,18 @@
  * -F fuzz (number, default 2)
  * [file] which file to patch
 
-USE_PATCH(NEWTOY(patch, "up#i:R", TOYFLAG_USR|TOYFLAG_BIN))
+USE_PATCH(NEWTOY(patch, "j#up#i:R", TOYFLAG_USR|TOYFLAG_BIN))
 
 config PATCH
 	bool "patch"
 	default y
 	help
-	  usage: patch [-i file] [-p depth] [-Ru]
+	  usage: patch [-i file] [-p depth] [-j N] [-Ru]
 
 	  Apply a unified diff to one or more files.
 
 	  -i	Input file (defaults=stdin)
+	  -j	patch N files at once (output stays in patch order)
 	  -p	number of '/' to strip from start of file paths (default=all)
 	  -R	Reverse patch.
 	  -u	Ignored (only handles "unified" diffs)
@@ -49,11 +50,19 @@ config PATCH
 DEFINE_GLOBALS(
 	char *infile;
 	long prefix;
+	long jobs;
 
 	struct double_list *current_hunk;
+	struct arena *arena;
 	long oldline, oldlen, newline, newlen, linenum;
 	int context, state, filein, fileout, filepatch, hunknum;
 	char *tempname;
+
+	char *map;
+	long *lines, linecount, mapped;
+	unsigned *hashes;
+
+	char *section, *sectionend;
 )
 
 #define TT this.patch
@@ -62,6 +71,7 @@ DEFINE_GLOBALS(
 #define FLAG_PATHLEN 4
 
 // Dispose of a line of input, either by writing it out or discarding it.
+// (The line and its list node are in TT.arena, freed once the hunk's done.)
 
 // state < 2: just free
 // state = 2: write whole line to stderr
@@ -75,14 +85,120 @@ static void do_line(void *data)
 	if (TT.state>1 && *dlist->data != TT.state)
 		fdprintf(TT.state == 2 ? 2 : TT.fileout,
 			"%s\n", dlist->data+(TT.state>3 ? 1 : 0));
+}
+
+// The file being patched is read into memory in one go (mapped when it
+// can be), with the offset each line starts at (lines[linecount] being the
+// end of the file) and a hash of each line, so finding where a hunk goes
+// mostly compares hashes.  TT.linenum is the first line not written out yet.
+
+struct patch_line {
+	char *data;
+	long len;
+	unsigned hash;
+};
+
+static unsigned patch_hash(char *s, long len)
+{
+	unsigned long long h = len, w;
+
+	for (;; s += 8, len -= 8) {
+		w = 0;
+		memcpy(&w, s, len < 8 ? len : 8);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+		if (len <= 8) break;
+	}
+
+	return h ^ (h >> 32);
+}
+
+// Length of a line without its newline.
+static long patch_len(long line)
+{
+	long start = TT.lines[line], end = TT.lines[line+1];
+
+	if (end > start && TT.map[end-1] == '\n') end--;
+
+	return end-start;
+}
+
+static int patch_same(long line, struct patch_line *pl)
+{
+	return TT.hashes[line] == pl->hash && patch_len(line) == pl->len
+		&& !memcmp(TT.map+TT.lines[line], pl->data, pl->len);
+}
+
+static void patch_load(int fd)
+{
+	struct stat st;
+	long size = 0, len, i;
+	char *pos, *eol, *end;
+
+	TT.map = NULL;
+	TT.mapped = 0;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0
+		&& st.st_size == (long)st.st_size)
+	{
+		TT.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (TT.map == MAP_FAILED) TT.map = NULL;
+		else size = TT.mapped = st.st_size;
+	}
+	if (!TT.map) {
+		for (;;) {
+			TT.map = xrealloc(TT.map, size+65536);
+			len = read(fd, TT.map+size, 65536);
+			if (len < 0) perror_exit("read");
+			if (!len) break;
+			size += len;
+		}
+	}
+
+	TT.linecount = 0;
+	for (pos = TT.map, end = pos+size; pos < end; pos = eol) {
+		eol = memchr(pos, '\n', end-pos);
+		eol = eol ? eol+1 : end;
+		if (!(TT.linecount&1023)) {
+			TT.lines = xrealloc(TT.lines, (TT.linecount+1025)*sizeof(long));
+			TT.hashes = xrealloc(TT.hashes,
+				(TT.linecount+1024)*sizeof(unsigned));
+		}
+		i = TT.linecount++;
+		TT.lines[i] = pos-TT.map;
+		TT.hashes[i] = patch_hash(pos, eol-pos-(eol[-1] == '\n'));
+	}
+	if (!TT.lines) TT.lines = xmalloc(sizeof(long));
+	TT.lines[TT.linecount] = size;
+}
+
+static void patch_unload(void)
+{
+	if (TT.mapped) munmap(TT.map, TT.mapped);
+	else free(TT.map);
+	free(TT.lines);
+	free(TT.hashes);
+	TT.map = NULL;
+	TT.lines = NULL;
+	TT.hashes = NULL;
+	TT.linecount = TT.mapped = 0;
+}
 
-	free(dlist->data);
-	free(data);
+// Write lines from..to-1 of the file being patched out unchanged.
+static void patch_write(long from, long to)
+{
+	if (to > from)
+		xwrite(TT.fileout, TT.map+TT.lines[from],
+			TT.lines[to]-TT.lines[from]);
 }
 
 static void finish_oldfile(void)
 {
-	if (TT.tempname) replace_tempfile(TT.filein, TT.fileout, &TT.tempname);
+	if (TT.tempname) {
+		patch_write(TT.linenum, TT.linecount);
+		xclose(TT.filein);
+		replace_tempfile(-1, TT.fileout, &TT.tempname);
+	}
+	patch_unload();
 	TT.fileout = TT.filein = -1;
 }
 
@@ -106,8 +222,11 @@ static void fail_hunk(void)
 
 static int apply_hunk(void)
 {
-	struct double_list *plist, *buf = NULL, *check;
+	struct double_list *plist;
+	struct patch_line *want, *skip, *pl;
+	long *gaps, count = 0, size = 0, m = 0, n = 0, p, k = -1, i;
 	int matcheof = 0, reverse = toys.optflags & FLAG_REVERSE, backwarn = 0;
+	char *out;
 
 	// Break doubly linked list so we can use singly linked traversal function.
 	TT.current_hunk->prev->next = NULL;
@@ -116,127 +235,145 @@ static int apply_hunk(void)
 	for (plist = TT.current_hunk; plist; plist = plist->next) {
 		if (plist->data[0]==' ') matcheof++;
 		else matcheof = 0;
+		count++;
 	}
 	matcheof = matcheof < TT.context;
 
-	// Loop through input data searching for this hunk.  Match all context
-	// lines and all lines to be removed until we've found the end of a
-	// complete hunk.
-	plist = TT.current_hunk;
-	buf = NULL;
-	if (TT.context) for (;;) {
-		char *data = get_line(TT.filein);
-
-		TT.linenum++;
+	// Split the hunk into the lines the file has to have (context and lines
+	// to be removed), and the lines we'd be adding.  Gap k is the added lines
+	// before wanted line k: skip[k ? gaps[k-1] : 0] up to skip[gaps[k]].
+	// Like the hunk, these go away with TT.arena.
+	want = arena_alloc(&TT.arena, count*sizeof(struct patch_line));
+	skip = arena_alloc(&TT.arena, count*sizeof(struct patch_line));
+	gaps = arena_alloc(&TT.arena, count*sizeof(long));
+	for (plist = TT.current_hunk; plist; plist = plist->next) {
+		if (*plist->data == "+-"[reverse]) pl = skip+n++;
+		else {
+			gaps[m] = n;
+			pl = want+m++;
+		}
+		pl->data = plist->data+1;
+		pl->len = strlen(pl->data);
+		pl->hash = patch_hash(pl->data, pl->len);
+		size += pl->len+1;
+	}
 
-		// Figure out which line of hunk to compare with next.  (Skip lines
-		// of the hunk we'd be adding.)
-		while (plist && *plist->data == "+-"[reverse]) {
-			if (data && !strcmp(data, plist->data+1)) {
+	// Search the rest of the file for the first place all the wanted lines
+	// match.  A hunk that needs to match EOF can only go at the end.
+	// todo: teach the comparison to ignore whitespace.
+	p = TT.linenum;
+	if (TT.context) {
+		if (matcheof) p = TT.linecount-m;
+		for (; p >= TT.linenum && p+m <= TT.linecount; p++) {
+			for (k = 0; k < m; k++) {
 				if (!backwarn) {
-					fdprintf(2,"Possibly reversed hunk %d at %ld\n",
-						TT.hunknum, TT.linenum);
-					backwarn++;
+					for (i = k ? gaps[k-1] : 0; i < gaps[k]; i++) {
+						if (!patch_same(p+k, skip+i)) continue;
+						fdprintf(2,"Possibly reversed hunk %d at %ld\n",
+							TT.hunknum, p+k+1);
+						backwarn++;
+						break;
+					}
 				}
+				if (!patch_same(p+k, want+k)) break;
 			}
-			plist = plist->next;
+			if (k == m || matcheof) break;
 		}
 
-		// Is this EOF?
-		if (!data) {
-			// Does this hunk need to match EOF?
-			if (!plist && matcheof) break;
-
-			// File ended before we found a place for this hunk.
+		// File ended before we found a place for this hunk.
+		if (k != m || p < TT.linenum || p+m > TT.linecount) {
+			TT.linenum = TT.linecount;
 			fail_hunk();
-			goto done;
-		}
-		check = dlist_add(&buf, data);
-
-		// Compare this line with next expected line of hunk.
-		// todo: teach the strcmp() to ignore whitespace.
-
-		// A match can fail because the next line doesn't match, or because
-		// we hit the end of a hunk that needed EOF, and this isn't EOF.
 
-		// If match failed, flush first line of buffered data and
-		// recheck buffered data for a new match until we find one or run
-		// out of buffer.
-
-		for (;;) {
-			if (!plist || strcmp(check->data, plist->data+1)) {
-				// Match failed.  Write out first line of buffered data and
-				// recheck remaining buffered data for a new match.
-	
-				TT.state = 3;
-				check = llist_pop(&buf);
-				check->prev->next = buf;
-				buf->prev = check->prev;
-				do_line(check);
-				plist = TT.current_hunk;
-
-				// If we've reached the end of the buffer without confirming a
-				// match, read more lines.
-				if (check==buf) {
-					buf = 0;
-					break;
-				}
-				check = buf;
-			} else {
-				// This line matches.  Advance plist, detect successful match.
-				plist = plist->next;
-				if (!plist && !matcheof) goto out;
-				check = check->next;
-				if (check == buf) break;
-			}
+			return TT.state;
 		}
+	} else m = 0;
+
+	// We have a match.  Emit the lines before it and the changed data, in one
+	// write, and skip the lines it replaces.
+	patch_write(TT.linenum, p);
+	TT.linenum = p+m;
+	out = arena_alloc(&TT.arena, size+1);
+	for (size = 0, plist = TT.current_hunk; plist; plist = plist->next) {
+		if (*plist->data == "-+"[reverse]) continue;
+		i = strlen(plist->data+1);
+		memcpy(out+size, plist->data+1, i);
+		out[size += i] = '\n';
+		size++;
 	}
-out:
-	// We have a match.  Emit changed data.
-	TT.state = "-+"[reverse];
+	xwrite(TT.fileout, out, size);
+
+	TT.state = 1;
 	llist_free(TT.current_hunk, do_line);
 	TT.current_hunk = NULL;
-	TT.state = 1;
-done:
-	if (buf) {
-		buf->prev->next = NULL;
-		llist_free(buf, do_line);
-	}
 
 	return TT.state;
 }
 
+static char *patch_keep(char *s, long len)
+{
+	char *line = arena_alloc(&TT.arena, len+1);
+
+	memcpy(line, s, len);
+	line[len] = 0;
+
+	return line;
+}
+
+// Next line of the patch: from TT.filepatch, or a -j worker's section.  It's
+// in TT.arena, which do_patch() empties whenever no hunk is using it.
+
+static char *patch_line(void)
+{
+	char *line, *eol;
+	long len;
+
+	if (!TT.section) {
+		if (!(eol = get_rawline(TT.filepatch, &len, '\n'))) return NULL;
+		if (eol[len-1] == '\n') len--;
+		line = patch_keep(eol, len);
+		free(eol);
+
+		return line;
+	}
+	if (TT.section == TT.sectionend) return NULL;
+
+	eol = memchr(TT.section, '\n', TT.sectionend-TT.section);
+	if (!eol) eol = TT.sectionend;
+	line = patch_keep(TT.section, eol-TT.section);
+	TT.section = eol < TT.sectionend ? eol+1 : eol;
+
+	return line;
+}
+
 // state 0: Not in a hunk, look for +++.
 // state 1: Found +++ file indicator, look for @@
 // state 2: In hunk: counting initial context lines
 // state 3: In hunk: getting body
 
-void patch_main(void)
+static void do_patch(void)
 {
 	int reverse = toys.optflags & FLAG_REVERSE, state = 0;
 	char *oldname = NULL, *newname = NULL;
 
-	if (TT.infile) TT.filepatch = xopen(TT.infile, O_RDONLY);
 	TT.filein = TT.fileout = -1;
 
 	// Loop through the lines in the patch
 	for(;;) {
 		char *patchline;
 
-		patchline = get_line(TT.filepatch);
+		if (!TT.current_hunk) arena_free(&TT.arena, 1);
+		patchline = patch_line();
 		if (!patchline) break;
 
 		// Other versions of patch accept damaged patches,
 		// so we need to also.
-		if (!*patchline) {
-			free(patchline);
-			patchline = xstrdup(" ");
-		}
+		if (!*patchline) patchline = " ";
 
 		// Are we assembling a hunk?
 		if (state >= 2) {
 			if (*patchline==' ' || *patchline=='+' || *patchline=='-') {
-				dlist_add(&TT.current_hunk, patchline);
+				dlist_add_arena(&TT.arena, &TT.current_hunk, patchline);
 
 				if (*patchline != '+') TT.oldlen--;
 				if (*patchline != '-') TT.newlen--;
@@ -344,6 +481,7 @@ void patch_main(void)
 						TT.filein = xopen(name, O_RDWR);
 					}
 					TT.fileout = copy_tempfile(TT.filein, name, &TT.tempname);
+					patch_load(TT.filein);
 					TT.linenum = 0;
 					TT.hunknum = 0;
 				}
@@ -353,16 +491,216 @@ void patch_main(void)
 
 			continue;
 		}
-
-		// If we didn't continue above, discard this line.
-		free(patchline);
 	}
 
 	finish_oldfile();
 
 	if (CFG_TOYBOX_FREE) {
-		close(TT.filepatch);
 		free(oldname);
 		free(newname);
+		arena_free(&TT.arena, 0);
+	}
+}
+
+// With -j, the patch is read into memory and split into a section per file,
+// starting at its "--- " line, and up to N forked workers each apply one
+// section as a patch of its own (do_patch() keeps its state in TT and gives
+// up with error_exit(), so a worker is a process rather than a thread).  A
+// section naming a file an earlier section does waits for that one to finish.
+// Workers print to memfds, copied to stdout and stderr in patch order.
+
+struct patch_section {
+	char *start, *end;
+	int after, out, err, done;
+	pid_t pid;
+};
+
+// The file a "--- " or "+++ " line names, the way do_patch() finds it: up to
+// the tab before the date, less the -p prefix.  NULL for /dev/null.
+
+static char *patch_key(char *line, char *eol, long *len)
+{
+	char *s, *name = line+4, *end;
+	int i = 0;
+
+	for (s = name; s < eol && *s != '\t' && *s != '\n'; s++)
+		if (*s == '\\' && s+1 < eol) s++;
+	end = s;
+	if (end-name == 9 && !memcmp(name, "/dev/null", 9)) return NULL;
+	for (s = name; s < end;) {
+		if ((toys.optflags & FLAG_PATHLEN) && TT.prefix == i) break;
+		if (*(s++) == '/') {
+			name = s;
+			i++;
+		}
 	}
+	*len = end-name;
+
+	return name;
+}
+
+// Split the patch into sections, following do_patch()'s hunk counting so
+// that a "--- " line inside a hunk doesn't start one.  A corrupt hunk ends
+// the splitting: do_patch() dies there, and doesn't get to later files.
+
+static struct patch_section *patch_split(char *patch, long size, long *count)
+{
+	struct patch_section *secs = NULL;
+	struct patch_key {
+		char *name;
+		long len, section;
+	} *keys;
+	char *pos, *eol, *end = patch+size, *name;
+	long oldlen = 0, newlen = 0, a, b, n = 0, slots, i, len;
+	int hunk = 0, plus = 1;
+
+	for (pos = patch; pos < end; pos = eol) {
+		eol = memchr(pos, '\n', end-pos);
+		eol = eol ? eol+1 : end;
+
+		if (hunk) {
+			if (*pos==' ' || *pos=='+' || *pos=='-' || *pos=='\n') {
+				if (*pos != '+') oldlen--;
+				if (*pos != '-') newlen--;
+				if (!oldlen && !newlen) hunk = 0;
+			} else hunk = plus = 0;
+			continue;
+		}
+
+		if (!strncmp(pos, "--- ", 4)) {
+			if (plus) {
+				if (!(n&255))
+					secs = xrealloc(secs, (n+256)*sizeof(struct patch_section));
+				if (n) secs[n-1].end = pos;
+				memset(secs+n, 0, sizeof(struct patch_section));
+				secs[n].start = n ? pos : patch;
+				secs[n++].after = -1;
+				plus = 0;
+			}
+		} else if (!strncmp(pos, "+++ ", 4)) plus++;
+		else if (plus && !strncmp(pos, "@@ -", 4)) {
+			if (sscanf(pos+4, "%ld,%ld +%ld,%ld", &a, &oldlen, &b, &newlen) != 4)
+				break;
+			hunk++;
+		}
+	}
+	if (!n) {
+		secs = xzalloc(sizeof(struct patch_section));
+		secs->start = patch;
+		secs->after = -1;
+		n++;
+	}
+	secs[n-1].end = end;
+
+	// Find the sections sharing a file, through a hash table of the names
+	// with the last section to name each.
+	for (slots = 1024; slots < 4*n; slots *= 2);
+	keys = xzalloc(slots*sizeof(struct patch_key));
+	for (i = 0; i < n; i++) {
+		for (pos = secs[i].start; pos < secs[i].end; pos = eol) {
+			eol = memchr(pos, '\n', secs[i].end-pos);
+			eol = eol ? eol+1 : secs[i].end;
+			if (strncmp(pos, "--- ", 4) && strncmp(pos, "+++ ", 4)) continue;
+			if (!(name = patch_key(pos, eol, &len))) continue;
+
+			for (a = patch_hash(name, len) & (slots-1); keys[a].name;
+				a = (a+1) & (slots-1))
+			{
+				if (keys[a].len == len && !memcmp(keys[a].name, name, len)) break;
+			}
+			if (keys[a].name && keys[a].section != i
+				&& keys[a].section > secs[i].after)
+					secs[i].after = keys[a].section;
+			keys[a].name = name;
+			keys[a].len = len;
+			keys[a].section = i;
+		}
+	}
+	free(keys);
+	*count = n;
+
+	return secs;
+}
+
+static void patch_start(struct patch_section *sec)
+{
+	if (0>(sec->out = memfd_create("patch", 0))
+		|| 0>(sec->err = memfd_create("patch", 0)))
+			perror_exit("memfd_create");
+	fflush(NULL);
+	if (!(sec->pid = fork())) {
+		dup2(sec->out, 1);
+		dup2(sec->err, 2);
+		TT.section = sec->start;
+		TT.sectionend = sec->end;
+		do_patch();
+		exit(toys.exitval);
+	}
+	if (sec->pid < 0) perror_exit("fork");
+}
+
+static void patch_parallel(void)
+{
+	struct patch_section *secs;
+	char *patch = NULL;
+	long size = 0, len, count, next = 0, printed = 0, running = 0, i;
+	int status;
+	pid_t pid;
+
+	for (;;) {
+		patch = xrealloc(patch, size+65536);
+		if (!(len = xread(TT.filepatch, patch+size, 65536))) break;
+		size += len;
+	}
+	secs = patch_split(patch, size, &count);
+
+	while (printed < count) {
+		// Start sections in order while there are free workers, and it's not
+		// too far ahead of the output.
+		while (running < TT.jobs && next < count && next < printed+4*TT.jobs
+			&& (secs[next].after < 0 || secs[secs[next].after].done))
+		{
+			patch_start(secs+next++);
+			running++;
+		}
+
+		if (secs[printed].done) {
+			struct patch_section *sec = secs+printed++;
+
+			lseek(sec->out, 0, SEEK_SET);
+			xsendfile(sec->out, 1);
+			lseek(sec->err, 0, SEEK_SET);
+			xsendfile(sec->err, 2);
+			close(sec->out);
+			close(sec->err);
+			continue;
+		}
+
+		if (0>(pid = waitpid(-1, &status, 0))) {
+			if (errno == EINTR) continue;
+			perror_exit("waitpid");
+		}
+		for (i = printed; i < next; i++) {
+			if (secs[i].pid != pid) continue;
+			secs[i].done++;
+			running--;
+			if (!WIFEXITED(status) || WEXITSTATUS(status)) toys.exitval = 1;
+			break;
+		}
+	}
+
+	if (CFG_TOYBOX_FREE) {
+		free(secs);
+		free(patch);
+	}
+}
+
+void patch_main(void)
+{
+	if (TT.infile) TT.filepatch = xopen(TT.infile, O_RDONLY);
+
+	if (TT.jobs > 1) patch_parallel();
+	else do_patch();
+
+	if (CFG_TOYBOX_FREE) close(TT.filepatch);
 }
@@ -10,12 +10,20 @@ USE_SED(NEWTOY(sed, "irne*", TOYFLAG_BIN))
 
 config SED
 	bool "sed"
-	default n
+	default y
 	help
-	  usage: sed [-irn] {command | [-e command]...} [FILE...]
+	  usage: sed [-inr] {command | [-e command]...} [FILE...]
 
 	  Stream EDitor, transforms text by appling commands to each line
 	  of input.
+
+	  -e	Add command to the script (else the first argument is the script)
+	  -i	Edit each FILE in place
+	  -n	Don't print the pattern space at the end of each cycle
+	  -r	Use extended regular expressions
+
+	  Commands are the POSIX ones ({}=abcdDgGhHilnNpPqrstwxy:#) plus
+	  Q (quit without printing), T (branch if no s///) and z (zap).
 */
 
 #include "toys.h"
@@ -23,41 +31,992 @@ config SED
 
 DEFINE_GLOBALS(
 	struct arg_list *commands;
+
+	struct sed_command *program;
+	struct sed_regex *lastre;
+	struct sed_buf *pattern, *hold, *work;
+
+	// Input: the files left to open, the current one, and its buffer.
+	char **files;
+	int fd, noeol, quit, substituted;
+	char *inbuf;
+	long instart, inend, linenum;
+
+	// Output (stdout or the -i temporary file), and the a and r commands
+	// waiting for the end of the cycle.
+	char *outbuf, *tempname;
+	long outlen;
+	int outfd, nonl;
+	struct sed_command **append;
+	long appendlen;
 )
 
 #define TT this.sed
 
+#define FLAG_e 1
+#define FLAG_n 2
+#define FLAG_r 4
+#define FLAG_i 8
+
+#define SED_BUF 65536
+
+// A compiled regex.  Every match contains must (at the start of the line if
+// bol), so lines without it are rejected by memchr()/memmem() without
+// calling regexec().  A regex that is nothing but must (literal) doesn't
+// need regexec() at all.  An empty regex (//) reuses the last one matched.
+struct sed_regex {
+	regex_t reg;
+	char *must;
+	int mustlen, bol, literal, empty;
+};
+
 struct sed_command {
 	// Doubly linked list of commands.
 	struct sed_command *next, *prev;
 
+	// Where b, t and T branch to (NULL for the end of the script), or the
+	// matching } of a {.
+	struct sed_command *jump;
+
 	// Regexes for s/match/data/ and /match_begin/,/match_end/command
-	regex_t *match, *match_begin, *match_end;
+	struct sed_regex *match, *match_begin, *match_end;
 
-	// For numeric ranges ala 10,20command
+	// For numeric ranges ala 10,20command, -1 is $.
 	int first_line, last_line;
 
-	// Which match to replace, 0 for all.
+	// Which match to replace, 0 for the first.  Also the exit code of q and
+	// the line length of l.
 	int which;
 
 	// s and w commands can write to a file.  Slight optimization: we use 0
 	// instead of -1 to mean no file here, because even when there's no stdin
-	// our input file would take fd 0.
+	// our input file would take fd 0.  Fd 1 is the main output.
 	int outfd;
 
-	// Data string for (saicytb)
-	char *data;
+	// Data string for (saicytb), and the file of r and w.
+	char *data, *file;
+	long datalen;
+
+	// For s: the offsets in data where \0-\9 (&) go, and the group number,
+	// in pairs ending with -1; the number of groups used; the g and p flags.
+	int *refs, nmatch;
+	char global, print;
+
+	// Address negated with !, and whether a range is in progress.
+	char not, active;
 
 	// Which command letter is this?
 	char command;
 };
 
+struct sed_buf {
+	char *str;
+	long len, size;
+};
+
+// Append len bytes to a buffer, keeping it NUL terminated for regexec().
+static void sed_add(struct sed_buf *buf, char *str, long len)
+{
+	if (buf->len+len >= buf->size) {
+		buf->size = 2*(buf->len+len)+64;
+		buf->str = xrealloc(buf->str, buf->size);
+	}
+	memcpy(buf->str+buf->len, str, len);
+	buf->str[buf->len += len] = 0;
+}
+
+// Output
+
+static void sed_flush(void)
+{
+	if (TT.outlen) xwrite(TT.outfd, TT.outbuf, TT.outlen);
+	TT.outlen = 0;
+}
+
+static void sed_write(char *str, long len)
+{
+	// The last line of a file without a newline gets one only if more
+	// output follows.
+	if (TT.nonl) {
+		TT.nonl = 0;
+		sed_write("\n", 1);
+	}
+	if (TT.outlen+len > SED_BUF) {
+		sed_flush();
+		if (len > SED_BUF) {
+			xwrite(TT.outfd, str, len);
+			return;
+		}
+	}
+	memcpy(TT.outbuf+TT.outlen, str, len);
+	TT.outlen += len;
+}
+
+static void sed_print(char *str, long len, int eol)
+{
+	sed_write(str, len);
+	if (eol) sed_write("\n", 1);
+	else TT.nonl = 1;
+}
+
+// Write a line to the file of a w command (or s///w).
+static void sed_wline(int fd, char *str, long len)
+{
+	if (fd == 1) sed_print(str, len, 1);
+	else {
+		xwrite(fd, str, len);
+		xwrite(fd, "\n", 1);
+	}
+}
+
+static void sed_pattern(void)
+{
+	sed_print(TT.pattern->str, TT.pattern->len, !TT.noeol);
+}
+
+// Print the text of the a and r commands run this cycle.
+static void sed_appended(void)
+{
+	long i;
+
+	for (i = 0; i < TT.appendlen; i++) {
+		struct sed_command *c = TT.append[i];
+
+		if (c->command == 'a') sed_print(c->data, c->datalen, 1);
+		else {
+			int fd = open(c->file, O_RDONLY), len;
+			char *buf = xiobuf(0);
+
+			if (fd == -1) continue;
+			while ((len = read(fd, buf, IOBUF_SIZE)) > 0)
+				sed_write(buf, len);
+			close(fd);
+		}
+	}
+	TT.appendlen = 0;
+}
+
+// l: the pattern space with nonprintable characters escaped, wrapped at
+// width characters (no wrapping for 0 or 1).
+static void sed_list(int width)
+{
+	char *from = "\\\a\b\f\n\r\t\v", *to = "\\abfnrtv", out[8], *p;
+	long i, col = 0;
+
+	for (i = 0; i < TT.pattern->len; i++) {
+		unsigned char c = TT.pattern->str[i];
+		int len;
+
+		if (c && (p = strchr(from, c))) len = sprintf(out, "\\%c", to[p-from]);
+		else if (c >= ' ' && c < 127) len = sprintf(out, "%c", c);
+		else len = sprintf(out, "\\%03o", c);
+		if (width > 1 && col+len > width-1) {
+			sed_write("\\\n", 2);
+			col = 0;
+		}
+		sed_write(out, len);
+		col += len;
+	}
+	sed_write("$\n", 2);
+}
+
+// Input
+
+// Refill the input buffer from the current file.  Output is flushed first,
+// so a slow pipe (tail -f | sed) sees each line once sed has to wait.
+static int sed_fill(void)
+{
+	long len;
+
+	sed_flush();
+	if (TT.fd == -1) return 0;
+	while ((len = read(TT.fd, TT.inbuf, SED_BUF)) < 0 && errno == EINTR);
+	if (len > 0) {
+		TT.instart = 0;
+		TT.inend = len;
+		return 1;
+	}
+	if (len < 0) {
+		perror_msg("read");
+		toys.exitval = 1;
+	}
+	if (TT.fd) close(TT.fd);
+	TT.fd = -1;
+	return 0;
+}
+
+// Open the next input file.  Returns 0 when there are none left.
+static int sed_open(void)
+{
+	while (*TT.files) {
+		char *name = *TT.files++;
+
+		if (!strcmp(name, "-")) TT.fd = 0;
+		else if (-1 == (TT.fd = open(name, O_RDONLY))) {
+			perror_msg("%s", name);
+			toys.exitval = 1;
+			continue;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+// Is the line just read the last one?  (For the $ address.)
+static int sed_last(void)
+{
+	while (TT.instart == TT.inend)
+		if (!sed_fill() && !sed_open()) return 1;
+	return 0;
+}
+
+// Append the next line of input to the pattern space.  Returns 0 at the end
+// of input.  Each file's last line ends there, newline or not.
+static int sed_read(void)
+{
+	int got = 0;
+
+	for (;;) {
+		char *str, *nl;
+
+		if (TT.instart == TT.inend && !sed_fill()) {
+			if (got || !sed_open()) break;
+			continue;
+		}
+		str = TT.inbuf+TT.instart;
+		nl = memchr(str, '\n', TT.inend-TT.instart);
+		got = 1;
+		if (nl) {
+			sed_add(TT.pattern, str, nl-str);
+			TT.instart += nl+1-str;
+			TT.noeol = 0;
+			TT.linenum++;
+			return 1;
+		}
+		sed_add(TT.pattern, str, TT.inend-TT.instart);
+		TT.instart = TT.inend;
+	}
+	if (got) {
+		TT.noeol = 1;
+		TT.linenum++;
+	}
+	return got;
+}
+
+// Matching
+
+// Search the pattern space from start, like regexec() with REG_STARTEND:
+// offsets in m are from the start of the pattern space.  Returns 0 for
+// a match.
+static int sed_regexec(struct sed_regex *r, long start, regmatch_t *m,
+	int nmatch)
+{
+	char *str = TT.pattern->str, *found;
+	long len = TT.pattern->len;
+	regmatch_t rm[1];
+	int i;
+
+	if (r->empty) {
+		if (!(r = TT.lastre)) error_exit("no previous regex");
+	} else TT.lastre = r;
+
+	if (r->must) {
+		if (r->bol)
+			found = !start && len >= r->mustlen
+				&& !memcmp(str, r->must, r->mustlen) ? str : NULL;
+		else if (r->mustlen == 1) found = memchr(str+start, *r->must, len-start);
+		else found = memmem(str+start, len-start, r->must, r->mustlen);
+		if (!found) return REG_NOMATCH;
+		if (r->literal) {
+			for (i = 0; i<nmatch; i++) m[i].rm_so = m[i].rm_eo = -1;
+			if (nmatch) {
+				m->rm_so = found-str;
+				m->rm_eo = m->rm_so+r->mustlen;
+			}
+			return 0;
+		}
+	}
+
+	if (!m) m = rm;
+#ifdef REG_STARTEND
+	m->rm_so = start;
+	m->rm_eo = len;
+	return regexec(&r->reg, str, nmatch, m, REG_STARTEND);
+#else
+	if (regexec(&r->reg, str+start, nmatch, m, start ? REG_NOTBOL : 0))
+		return REG_NOMATCH;
+	for (i = 0; i<nmatch; i++) {
+		if (m[i].rm_so == -1) continue;
+		m[i].rm_so += start;
+		m[i].rm_eo += start;
+	}
+	return 0;
+#endif
+}
+
+static int sed_address(int line, struct sed_regex *re)
+{
+	if (re) return !sed_regexec(re, 0, NULL, 0);
+	if (line == -1) return sed_last();
+	return TT.linenum == line;
+}
+
+// Does this command apply to the current line?  A range starts on a line
+// matching the first address and ends on the line matching the second (a
+// line number that has already gone by ends it on the first line).
+static int sed_selected(struct sed_command *c)
+{
+	int hit = 1;
+
+	if (!c->first_line && !c->match_begin);
+	else if (!c->last_line && !c->match_end)
+		hit = sed_address(c->first_line, c->match_begin);
+	else if (c->active) {
+		if (c->match_end) c->active = !sed_address(0, c->match_end);
+		else if (c->last_line == -1) c->active = !sed_last();
+		else c->active = TT.linenum < c->last_line;
+	} else if ((hit = sed_address(c->first_line, c->match_begin))) {
+		if (c->match_end) c->active = 1;
+		else if (c->last_line == -1) c->active = !sed_last();
+		else c->active = TT.linenum < c->last_line;
+	}
+
+	return hit ^ c->not;
+}
+
+// s/regex/replacement/flags, building the new line in TT.work.
+static int sed_subst(struct sed_command *c)
+{
+	struct sed_buf *work = TT.work;
+	char *str = TT.pattern->str;
+	long pos = 0, prev = -1, count = 0;
+	regmatch_t m[10];
+	int replaced = 0;
+
+	work->len = 0;
+	while (pos <= TT.pattern->len && !sed_regexec(c->match, pos, m, c->nmatch)) {
+		long so = m->rm_so, eo = m->rm_eo;
+
+		// An empty match right after the last match doesn't count.
+		if (so == eo && so == prev) {
+			if (so == TT.pattern->len) break;
+			sed_add(work, str+pos, so+1-pos);
+			pos = so+1;
+			continue;
+		}
+
+		sed_add(work, str+pos, so-pos);
+		if (++count < c->which) sed_add(work, str+so, eo-so);
+		else {
+			int *ref, last = 0;
+
+			for (ref = c->refs; *ref >= 0; ref += 2) {
+				regmatch_t *group = m+ref[1];
+
+				sed_add(work, c->data+last, ref[0]-last);
+				last = ref[0];
+				if (group->rm_so >= 0)
+					sed_add(work, str+group->rm_so, group->rm_eo-group->rm_so);
+			}
+			sed_add(work, c->data+last, c->datalen-last);
+			replaced = 1;
+			if (!c->global) {
+				pos = eo;
+				break;
+			}
+		}
+		prev = pos = eo;
+		if (so == eo) {
+			if (eo == TT.pattern->len) break;
+			sed_add(work, str+pos++, 1);
+		}
+	}
+	if (!replaced) return 0;
+
+	sed_add(work, str+pos, TT.pattern->len-pos);
+	TT.work = TT.pattern;
+	TT.pattern = work;
+
+	return 1;
+}
+
+// Run the script on each line of input, until it runs out or q.
+static void sed_run(void)
+{
+	struct sed_command *c;
+	int restart = 0;
+
+	while (!TT.quit) {
+		if (!restart) {
+			TT.pattern->len = 0;
+			if (!sed_read()) break;
+			TT.substituted = 0;
+		}
+		restart = 0;
+
+		for (c = TT.program; c;) {
+			struct sed_buf *swap;
+			char *nl;
+			long i;
+
+			if (!sed_selected(c)) {
+				c = c->command == '{' ? c->jump : c->next;
+				continue;
+			}
+
+			switch (c->command) {
+			case '=':
+				sed_write(toybuf, sprintf(toybuf, "%ld\n", TT.linenum));
+				break;
+			case 'a':
+			case 'r':
+				if (!(TT.appendlen&15))
+					TT.append = xrealloc(TT.append, (TT.appendlen+16)*sizeof(c));
+				TT.append[TT.appendlen++] = c;
+				break;
+			case 'b':
+				c = c->jump;
+				continue;
+			case 'c':
+				// A range is replaced as a whole.
+				if (c->not || !c->active) sed_print(c->data, c->datalen, 1);
+				goto delete;
+			case 'd':
+				goto delete;
+			case 'D':
+				if (!(nl = memchr(TT.pattern->str, '\n', TT.pattern->len)))
+					goto delete;
+				i = nl+1-TT.pattern->str;
+				memmove(TT.pattern->str, nl+1, TT.pattern->len-i+1);
+				TT.pattern->len -= i;
+				restart = 1;
+				goto delete;
+			case 'g':
+				TT.pattern->len = 0;
+				sed_add(TT.pattern, TT.hold->str, TT.hold->len);
+				break;
+			case 'G':
+				sed_add(TT.pattern, "\n", 1);
+				sed_add(TT.pattern, TT.hold->str, TT.hold->len);
+				break;
+			case 'h':
+				TT.hold->len = 0;
+				sed_add(TT.hold, TT.pattern->str, TT.pattern->len);
+				break;
+			case 'H':
+				sed_add(TT.hold, "\n", 1);
+				sed_add(TT.hold, TT.pattern->str, TT.pattern->len);
+				break;
+			case 'i':
+				sed_print(c->data, c->datalen, 1);
+				break;
+			case 'l':
+				sed_list(c->which);
+				break;
+			case 'n':
+				// Without a next line, end the cycle (printing) and quit.
+				if (sed_last()) goto quit;
+				if (!(toys.optflags & FLAG_n)) sed_pattern();
+				sed_appended();
+				TT.pattern->len = 0;
+				sed_read();
+				break;
+			case 'N':
+				if (sed_last()) goto quit;
+				sed_appended();
+				sed_add(TT.pattern, "\n", 1);
+				sed_read();
+				break;
+			case 'p':
+				sed_pattern();
+				break;
+			case 'P':
+				nl = memchr(TT.pattern->str, '\n', TT.pattern->len);
+				sed_print(TT.pattern->str,
+					nl ? nl-TT.pattern->str : TT.pattern->len, 1);
+				break;
+			case 'q':
+				toys.exitval = c->which;
+				goto quit;
+			case 'Q':
+				toys.exitval = c->which;
+				TT.quit = 1;
+				return;
+			case 's':
+				if (!sed_subst(c)) break;
+				TT.substituted = 1;
+				if (c->print) sed_pattern();
+				if (c->outfd)
+					sed_wline(c->outfd, TT.pattern->str, TT.pattern->len);
+				break;
+			case 't':
+			case 'T':
+				if (TT.substituted == (c->command == 't')) {
+					TT.substituted = 0;
+					c = c->jump;
+					continue;
+				}
+				TT.substituted = 0;
+				break;
+			case 'w':
+				sed_wline(c->outfd, TT.pattern->str, TT.pattern->len);
+				break;
+			case 'x':
+				swap = TT.pattern;
+				TT.pattern = TT.hold;
+				TT.hold = swap;
+				break;
+			case 'y':
+				for (i = 0; i < TT.pattern->len; i++)
+					TT.pattern->str[i] = c->data[(unsigned char)TT.pattern->str[i]];
+				break;
+			case 'z':
+				TT.pattern->len = 0;
+				*TT.pattern->str = 0;
+				break;
+			}
+			c = c->next;
+		}
+
+		if (0) {
+quit:
+			TT.quit = 1;
+		}
+		if (!(toys.optflags & FLAG_n)) sed_pattern();
+delete:
+		sed_appended();
+	}
+}
+
+// Parsing
+
+// Copy up to the next unescaped delimiter, which ends up just past *pstr.
+// A regex gets \n and \t turned into the characters (regcomp() doesn't know
+// them) and keeps its other escapes; an escaped delimiter is always just
+// the delimiter.
+static char *sed_delimited(char **pstr, char delim, int regex)
+{
+	char *str = *pstr, *out, *o;
+
+	o = out = xmalloc(strlen(str)+1);
+	while (*str != delim) {
+		if (!*str || (regex && *str == '\n')) error_exit("unterminated '%c'", delim);
+		if (*str == '\\' && str[1]) {
+			if (str[1] == delim || (regex && strchr("nt", str[1]))) {
+				str++;
+				*o++ = *str == delim ? delim : (*str == 'n' ? '\n' : '\t');
+				str++;
+				continue;
+			}
+			*o++ = *str++;
+		}
+		*o++ = *str++;
+	}
+	*o = 0;
+	*pstr = str+1;
+
+	return out;
+}
+
+// Find the literal string a regex starts with (after a ^), stopping at the
+// first special character and leaving out a character with a repeat after
+// it.  Alternation could match without it, so that gets no prefilter.
+static void sed_must(struct sed_regex *r, char *re, int ere)
+{
+	char *special = ere ? ".[\\*^$()+?{|" : ".[\\*^$", *o;
+
+	if (ere ? !!strchr(re, '|') : !!strstr(re, "\\|")) return;
+	if (*re == '^') {
+		r->bol = 1;
+		re++;
+	}
+	o = r->must = xmalloc(strlen(re)+1);
+	while (*re) {
+		char c = *re, *next = re+1;
+
+		if (c == '\\') {
+			if (!*next || !strchr(ere ? ".[]*^$\\/(){}+?|" : ".[]*^$\\/", *next))
+				break;
+			c = *next++;
+		} else if (strchr(special, c)) break;
+
+		// A repeat makes the character optional (or a run of them).
+		if (*next == '*' || (ere ? !!strchr("+?{", *next)
+				: (*next == '\\' && next[1] && strchr("+?{", next[1]))))
+			break;
+
+		*o++ = c;
+		re = next;
+	}
+	r->mustlen = o-r->must;
+	r->literal = !*re && r->mustlen;
+	if (!r->mustlen) {
+		free(r->must);
+		r->must = NULL;
+	}
+}
+
+static struct sed_regex *sed_regcomp(char *str, int cflags)
+{
+	struct sed_regex *r = xzalloc(sizeof(struct sed_regex));
+
+	if (toys.optflags & FLAG_r) cflags |= REG_EXTENDED;
+	if (!*str) r->empty = 1;
+	else {
+		xregcomp(&r->reg, str, cflags);
+		if (!(cflags & (REG_ICASE|REG_NEWLINE)))
+			sed_must(r, str, cflags & REG_EXTENDED);
+	}
+	free(str);
+
+	return r;
+}
+
+static void sed_regfree(struct sed_regex *r)
+{
+	if (!r) return;
+	if (!r->empty) regfree(&r->reg);
+	free(r->must);
+	free(r);
+}
+
+// A line number, $, /regex/ or \cregexc, with I or M flags after a regex.
+static char *sed_addr(char *str, int *line, struct sed_regex **re)
+{
+	if (isdigit(*str)) {
+		*line = strtol(str, &str, 10);
+		if (!*line) error_exit("invalid usage of line address 0");
+	} else if (*str == '$') {
+		*line = -1;
+		str++;
+	} else if (*str == '/' || *str == '\\') {
+		char delim = *str == '\\' ? *++str : '/', *pattern;
+		int cflags = 0;
+
+		str++;
+		pattern = sed_delimited(&str, delim, 1);
+		for (;; str++) {
+			if (*str == 'I') cflags |= REG_ICASE;
+			else if (*str == 'M') cflags |= REG_NEWLINE;
+			else break;
+		}
+		*re = sed_regcomp(pattern, cflags);
+	}
+
+	return str;
+}
+
+// Text for a, i and c: "a text" or "a\" newline "text", with \newline
+// continuing it on the next line.
+static char *sed_text(char **pstr, long *len)
+{
+	char *str = *pstr, *out, *o;
+
+	while (isblank(*str)) str++;
+	if (*str == '\\') str += 1 + (str[1] == '\n');
+	o = out = xmalloc(strlen(str)+1);
+	while (*str && *str != '\n') {
+		if (*str == '\\' && str[1]) str++;
+		*o++ = *str++;
+	}
+	*o = 0;
+	*len = o-out;
+	*pstr = str;
+
+	return out;
+}
+
+// The rest of the line, for r, w and s///w.
+static char *sed_filename(char **pstr)
+{
+	char *str = *pstr, *end;
+
+	while (isblank(*str)) str++;
+	if (!(end = strchr(str, '\n'))) end = str+strlen(str);
+	if (end == str) error_exit("missing filename");
+	*pstr = end;
+
+	return xstrndup(str, end-str);
+}
+
+// Files written by w are opened (truncated) once, however many commands
+// name them.
+static int sed_wfile(char *name)
+{
+	struct sed_command *c;
+
+	if (!strcmp(name, "/dev/stdout")) return 1;
+	if (!strcmp(name, "/dev/stderr")) return 2;
+	for (c = TT.program; c; c = c->next)
+		if (c->outfd > 2 && !strcmp(c->file, name)) return c->outfd;
+
+	return xcreate(name, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+}
+
+// The replacement of s: \0-\9 and & become refs into the match, \n a
+// newline and other escaped characters themselves.
+static void sed_rhs(struct sed_command *c, char *str)
+{
+	char *out;
+	int *ref;
+
+	out = c->data = xmalloc(strlen(str)+1);
+	ref = c->refs = xmalloc((2*strlen(str)+1)*sizeof(int));
+	c->nmatch = 1;
+	for (; *str; str++) {
+		int group = 0;
+
+		if (*str == '\\' && str[1]) {
+			str++;
+			if (!isdigit(*str)) {
+				*out++ = *str == 'n' ? '\n' : (*str == 't' ? '\t' : *str);
+				continue;
+			}
+			group = *str-'0';
+		} else if (*str != '&') {
+			*out++ = *str;
+			continue;
+		}
+		*ref++ = out-c->data;
+		*ref++ = group;
+		if (group >= c->nmatch) c->nmatch = group+1;
+	}
+	*ref = -1;
+	c->datalen = out-c->data;
+}
+
+// Only whitespace, a comment, ; or } can follow a command.
+static char *sed_end(char *str)
+{
+	while (isblank(*str)) str++;
+	if (*str && !strchr(";\n}#", *str))
+		error_exit("extra characters after command");
+
+	return str;
+}
+
+// Compile the script into TT.program.
+static void sed_compile(char *str)
+{
+	struct sed_command *c, *last = NULL, *open = NULL, *label;
+
+	for (;;) {
+		char *s;
+
+		while (isspace(*str) || *str == ';') str++;
+		if (!*str) break;
+		if (*str == '#') {
+			while (*str && *str != '\n') str++;
+			continue;
+		}
+
+		c = xzalloc(sizeof(struct sed_command));
+		if (last) last->next = c;
+		else TT.program = c;
+		c->prev = last;
+		last = c;
+
+		str = sed_addr(str, &c->first_line, &c->match_begin);
+		if ((c->first_line || c->match_begin) && *str == ',') {
+			while (isblank(*++str));
+			str = sed_addr(str, &c->last_line, &c->match_end);
+			if (!c->last_line && !c->match_end) error_exit("unexpected ','");
+		}
+		while (isblank(*str)) str++;
+		for (; *str == '!'; c->not = 1) while (isblank(*++str));
+
+		s = str;
+		if (!(c->command = *str++)) error_exit("missing command");
+		if ((c->first_line || c->match_begin) && strchr(":}", c->command))
+			error_exit("%c doesn't want any addresses", c->command);
+		switch (c->command) {
+		case '{':
+			c->jump = open;
+			open = c;
+			continue;
+		case '}':
+			if (!open) error_exit("unexpected '}'");
+			label = open->jump;
+			open->jump = c;
+			open = label;
+			break;
+		case '=': case 'd': case 'D': case 'g': case 'G': case 'h': case 'H':
+		case 'n': case 'N': case 'p': case 'P': case 'x': case 'z':
+			break;
+		case 'l': case 'q': case 'Q':
+			while (isblank(*str)) str++;
+			c->which = isdigit(*str) ? strtol(str, &str, 10)
+				: (c->command == 'l' ? 70 : 0);
+			break;
+		case 'a': case 'i': case 'c':
+			c->data = sed_text(&str, &c->datalen);
+			continue;
+		case 'r':
+			c->file = sed_filename(&str);
+			continue;
+		case 'w':
+			c->file = sed_filename(&str);
+			c->outfd = sed_wfile(c->file);
+			continue;
+		case ':':
+		case 'b': case 't': case 'T':
+			while (isblank(*str)) str++;
+			for (s = str; *str && !strchr(c->command == ':' ? ";\n" : ";\n}", *str);)
+				str++;
+			while (str > s && isblank(str[-1])) str--;
+			if (str > s) c->data = xstrndup(s, str-s);
+			else if (c->command == ':') error_exit("\":\" lacks a label");
+			break;
+		case 's': {
+			char delim = *str++, *regex, *rhs;
+			int cflags = 0;
+
+			if (!delim || delim == '\n' || delim == '\\')
+				error_exit("unterminated 's'");
+			regex = sed_delimited(&str, delim, 1);
+			rhs = sed_delimited(&str, delim, 0);
+			sed_rhs(c, rhs);
+			free(rhs);
+			for (;; str++) {
+				if (*str == 'g') c->global = 1;
+				else if (*str == 'p') c->print = 1;
+				else if (*str == 'i' || *str == 'I') cflags |= REG_ICASE;
+				else if (*str == 'm' || *str == 'M') cflags |= REG_NEWLINE;
+				else if (isdigit(*str)) {
+					if (!(c->which = strtol(str, &str, 10)))
+						error_exit("s///0");
+					str--;
+				} else break;
+			}
+			c->match = sed_regcomp(regex, cflags);
+			if (!c->match->empty && c->nmatch-1 > c->match->reg.re_nsub)
+				error_exit("invalid reference \\%d on s command's RHS",
+					c->nmatch-1);
+			if (*str == 'w') {
+				str++;
+				c->file = sed_filename(&str);
+				c->outfd = sed_wfile(c->file);
+				continue;
+			}
+			break;
+		}
+		case 'y': {
+			char delim = *str++, *from, *to, *f, *t;
+			int i;
+
+			if (!delim || delim == '\n' || delim == '\\')
+				error_exit("unterminated 'y'");
+			from = sed_delimited(&str, delim, 0);
+			to = sed_delimited(&str, delim, 0);
+			c->data = xmalloc(256);
+			for (i = 0; i<256; i++) c->data[i] = i;
+			for (f = from, t = to; *f && *t; f++, t++) {
+				char fc = *f, tc = *t;
+
+				if (fc == '\\' && f[1]) fc = *++f == 'n' ? '\n' : *f;
+				if (tc == '\\' && t[1]) tc = *++t == 'n' ? '\n' : *t;
+				c->data[(unsigned char)fc] = tc;
+			}
+			if (*f || *t)
+				error_exit("strings for 'y' command are different lengths");
+			free(from);
+			free(to);
+			break;
+		}
+		default:
+			error_exit("unknown command '%c'", *s);
+		}
+		str = sed_end(str);
+	}
+	if (open) error_exit("unmatched '{'");
+
+	// Resolve the labels of b, t and T.
+	for (c = TT.program; c; c = c->next) {
+		if (!strchr("btT", c->command) || !c->data) continue;
+		for (label = TT.program; label; label = label->next)
+			if (label->command == ':' && !strcmp(label->data, c->data)) break;
+		if (!label) error_exit("can't find label for jump to '%s'", c->data);
+		c->jump = label;
+	}
+}
+
 void sed_main(void)
 {
-	struct arg_list *test;
+	struct arg_list *arg;
+	struct sed_command *c;
+	char **files = toys.optargs, *script;
+	static char *stdin_only[] = {"-", NULL}, *none[] = {NULL};
+
+	// The -e scripts are joined with newlines, else the first argument is
+	// the script.
+	if (TT.commands) {
+		long len = 0;
+
+		for (arg = TT.commands; arg; arg = arg->next) len += strlen(arg->arg)+1;
+		*(script = xmalloc(len+1)) = 0;
+		for (arg = TT.commands; arg; arg = arg->next) {
+			strcat(script, arg->arg);
+			strcat(script, "\n");
+		}
+	} else {
+		if (!*files) error_exit("no script");
+		script = xstrdup(*files++);
+	}
+	if (script[0] == '#' && script[1] == 'n' && (!script[2] || script[2] == '\n'))
+		toys.optflags |= FLAG_n;
+	sed_compile(script);
+
+	TT.pattern = xzalloc(sizeof(struct sed_buf));
+	TT.hold = xzalloc(sizeof(struct sed_buf));
+	TT.work = xzalloc(sizeof(struct sed_buf));
+	sed_add(TT.pattern, "", 0);
+	sed_add(TT.hold, "", 0);
+	sed_add(TT.work, "", 0);
+	TT.inbuf = xmalloc(SED_BUF);
+	TT.outbuf = xmalloc(SED_BUF);
+	TT.fd = -1;
 
-	for (test = TT.commands; test; test = test->next)
-		dprintf(2,"command=%s\n",test->arg);
+	if (toys.optflags & FLAG_i) {
+		// Each file is its own input, with its own line numbers and $.
+		if (!*files) error_exit("no input files");
+		for (; *files && !TT.quit; files++) {
+			if (-1 == (TT.fd = open(*files, O_RDONLY))) {
+				perror_msg("%s", *files);
+				toys.exitval = 1;
+				continue;
+			}
+			TT.files = none;
+			TT.outfd = copy_tempfile(TT.fd, *files, &TT.tempname);
+			TT.linenum = TT.instart = TT.inend = TT.nonl = 0;
+			for (c = TT.program; c; c = c->next) c->active = 0;
+			sed_run();
+			sed_flush();
+			if (TT.fd > 0) close(TT.fd);
+			TT.fd = -1;
+			replace_tempfile(-1, TT.outfd, &TT.tempname);
+		}
+	} else {
+		TT.files = *files ? files : stdin_only;
+		TT.outfd = 1;
+		sed_run();
+		sed_flush();
+	}
 
-	printf("Hello world\n");
+	if (CFG_TOYBOX_FREE) {
+		while (TT.program) {
+			c = TT.program;
+			TT.program = c->next;
+			sed_regfree(c->match);
+			sed_regfree(c->match_begin);
+			sed_regfree(c->match_end);
+			free(c->data);
+			free(c->file);
+			free(c->refs);
+			free(c);
+		}
+		free(script);
+		free(TT.inbuf);
+		free(TT.outbuf);
+		free(TT.append);
+	}
 }
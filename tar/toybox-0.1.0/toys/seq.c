@@ -21,6 +21,66 @@ config SEQ
 
 #include "toys.h"
 
+#define SEQ_BUF 65536
+
+// Integers below 2**53 are exact in a double, and can't overflow when added.
+static int seq_integral(double d)
+{
+	return d > -(1LL<<53) && d < (1LL<<53) && (double)(long long)d == d;
+}
+
+// Write count integers from first by increment without printf, in SEQ_BUF
+// sized writes.  Counting up from zero or more, the number is kept as ASCII
+// in num and the increment's digits are added to it in place; otherwise each
+// number is converted on its own.
+
+static void seq_int(long long first, long long increment, long long count)
+{
+	char *out = xmalloc(SEQ_BUF), num[32], inc[24], *end = num+sizeof(num)-1,
+		*start;
+	int len = 0, inclen = 0;
+	unsigned long long u;
+
+	*end = '\n';
+	start = end;
+	for (u = first<0 ? -(unsigned long long)first : first; u || start==end;
+		u /= 10) *--start = '0'+u%10;
+	if (first<0) *--start = '-';
+	for (u = increment; increment>0 && u; u /= 10) inc[inclen++] = u%10;
+
+	while (count--) {
+		if (len > SEQ_BUF-sizeof(num)) {
+			xwrite(1, out, len);
+			len = 0;
+		}
+		memcpy(out+len, start, end+1-start);
+		len += end+1-start;
+		if (!count) break;
+
+		if (first>=0 && increment>0) {
+			char *p = end-1;
+			int i, carry = 0;
+
+			for (i = 0; i<inclen || carry; i++, p--) {
+				int digit;
+
+				if (p<start) *(start = p) = '0';
+				digit = *p-'0' + carry + (i<inclen ? inc[i] : 0);
+				carry = digit>9;
+				*p = '0' + digit - 10*carry;
+			}
+		} else {
+			first += increment;
+			start = end;
+			for (u = first<0 ? -(unsigned long long)first : first;
+				u || start==end; u /= 10) *--start = '0'+u%10;
+			if (first<0) *--start = '-';
+		}
+	}
+	xwrite(1, out, len);
+	if (CFG_TOYBOX_FREE) free(out);
+}
+
 void seq_main(void)
 {
 	double first, increment, last, dd;
@@ -37,6 +97,15 @@ void seq_main(void)
 			last = atof(toys.optargs[toys.optc-1]);
 	}
 
+	// Whole numbers count exactly, in a 64 bit integer.
+	if (seq_integral(first) && seq_integral(increment) && seq_integral(last)) {
+		long long f = first, i = increment, l = last;
+
+		if (i>0 && f<=l) seq_int(f, i, (l-f)/i+1);
+		else if (i<0 && f>=l) seq_int(f, i, (f-l)/-i+1);
+		return;
+	}
+
 	// Yes, we're looping on a double.  Yes rounding errors can accumulate if
 	// you use a non-integer increment.  Deal with it.
 	for (dd=first; (increment>0 && dd<=last) || (increment <0 && dd>=last);
@@ -9,34 +9,53 @@
  *
  * Not in SUSv3.
 
-USE_SHA1SUM(NEWTOY(sha1sum, NULL, TOYFLAG_USR|TOYFLAG_BIN))
+USE_SHA1SUM(NEWTOY(sha1sum, "j#", TOYFLAG_USR|TOYFLAG_BIN))
 
 config SHA1SUM
 	bool "sha1sum"
 	default y
 	help
-	  usage: sha1sum [file...]
+	  usage: sha1sum [-j N] [file...]
 
 	  Calculate sha1 hash of files (or stdin).
+
+		-j	hash N files at once (output stays in order)
 */
 
 #include <toys.h>
+#include <pthread.h>
+
+DEFINE_GLOBALS(
+	long jobs;
+)
+
+#define TT this.sha1sum
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA1_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define SHA1_ARM
+#endif
 
 struct sha1 {
 	uint32_t state[5];
-	uint32_t oldstate[5];
 	uint64_t count;
-	union {
-		unsigned char c[64];
-		uint32_t i[16];
-	} buffer;
+	unsigned char buffer[64];
 };
 
 static void sha1_init(struct sha1 *this);
-static void sha1_transform(struct sha1 *this);
 static void sha1_update(struct sha1 *this, char *data, unsigned int len);
 static void sha1_final(struct sha1 *this, char digest[20]);
 
+// Hash this many consecutive 64-byte blocks into state[].  Set by
+// sha1_pick() (before any threads start) to the fastest version this CPU can
+// run.
+static void (*sha1_blocks)(uint32_t *state, unsigned char *data, unsigned blocks);
+
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
 // blk0() and blk() perform the initial expand.
@@ -52,47 +71,219 @@ static void sha1_final(struct sha1 *this, char digest[20]);
 
 static const uint32_t rconsts[]={0x5A827999,0x6ED9EBA1,0x8F1BBCDC,0xCA62C1D6};
 
-// Hash a single 512-bit block. This is the core of the algorithm.
+// Portable version, which expands the message as it goes.
 
-static void sha1_transform(struct sha1 *this)
+static void sha1_scalar(uint32_t *state, unsigned char *data, unsigned blocks)
 {
 	int i, j, k, count;
-	uint32_t *block = this->buffer.i;
+	uint32_t block[16], oldstate[5];
 	uint32_t *rot[5], *temp;
 
-	// Copy context->state[] to working vars
-	for (i=0; i<5; i++) {
-		this->oldstate[i] = this->state[i];
-		rot[i] = this->state + i;
-	}
-	// 4 rounds of 20 operations each.
-	for (i=count=0; i<4; i++) {
-		for (j=0; j<20; j++) {
-			uint32_t work;
-
-			work = *rot[2] ^ *rot[3];
-			if (!i) work = (work & *rot[1]) ^ *rot[3];
-			else {
-				if (i==2)
-					work = ((*rot[1]|*rot[2])&*rot[3])|(*rot[1]&*rot[2]);
-				else work ^= *rot[1];
+	for (; blocks--; data += 64) {
+		memcpy(block, data, 64);
+
+		// Copy state[] to working vars
+		for (i=0; i<5; i++) {
+			oldstate[i] = state[i];
+			rot[i] = state + i;
+		}
+		// 4 rounds of 20 operations each.
+		for (i=count=0; i<4; i++) {
+			for (j=0; j<20; j++) {
+				uint32_t work;
+
+				work = *rot[2] ^ *rot[3];
+				if (!i) work = (work & *rot[1]) ^ *rot[3];
+				else {
+					if (i==2)
+						work = ((*rot[1]|*rot[2])&*rot[3])|(*rot[1]&*rot[2]);
+					else work ^= *rot[1];
+				}
+				if (!i && j<16) work += blk0(count);
+				else work += blk(count);
+				*rot[4] += work + rol(*rot[0],5) + rconsts[i];
+				*rot[1] = rol(*rot[1],30);
+
+				// Rotate by one for next time.
+				temp = rot[4];
+				for (k=4; k; k--) rot[k] = rot[k-1];
+				*rot = temp;
+				count++;
 			}
-			if (!i && j<16) work += blk0(count);
-			else work += blk(count);
-			*rot[4] += work + rol(*rot[0],5) + rconsts[i];
-			*rot[1] = rol(*rot[1],30);
-
-			// Rotate by one for next time.
-			temp = rot[4];
-			for (k=4; k; k--) rot[k] = rot[k-1];
-			*rot = temp;
-			count++;
 		}
+		// Add the previous values of state[]
+		for (i=0; i<5; i++) state[i] += oldstate[i];
+	}
+}
+
+#ifdef SHA1_X86
+
+// The 80 rounds, given the whole expanded message with the round constants
+// already added in (by the SSSE3 version).
+
+static void sha1_rounds(uint32_t *state, uint32_t *wk)
+{
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+		e = state[4], work;
+	int i;
+
+	// A loop per round function, so there's no test in the loop.
+#define ROUND(f) work = (f) + rol(a,5) + e + wk[i]; \
+	e = d; d = c; c = rol(b,30); b = a; a = work;
+	for (i=0; i<20; i++) {ROUND(((c^d)&b)^d)}
+	for (; i<40; i++) {ROUND(b^c^d)}
+	for (; i<60; i++) {ROUND(((b|c)&d)|(b&c))}
+	for (; i<80; i++) {ROUND(b^c^d)}
+#undef ROUND
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+// Expand the message four words at a time with SSSE3, the rounds are still
+// scalar.  w[i] needs w[i-3], which for the last of four words is the first
+// of the same four: xor it in afterwards.  From w[32] on, the equivalent
+// w[i] = rol(w[i-6]^w[i-16]^w[i-28]^w[i-32], 2) has no such dependency.
+
+#define sha1_rol4(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32-n))
+
+__attribute__((target("ssse3")))
+static void sha1_ssse3(uint32_t *state, unsigned char *data, unsigned blocks)
+{
+	const __m128i swap = _mm_set_epi8(12,13,14,15,8,9,10,11,4,5,6,7,0,1,2,3);
+	__m128i w[20], x;
+	uint32_t wk[80];
+	int i;
+
+	for (; blocks--; data += 64) {
+		for (i=0; i<4; i++)
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128((void *)(data+16*i)), swap);
+		for (; i<8; i++) {
+			// w[i-3..i-1] and a zero, then fix the last word.
+			x = _mm_srli_si128(w[i-1], 4);
+			x = _mm_xor_si128(x, _mm_alignr_epi8(w[i-3], w[i-4], 8));
+			x = _mm_xor_si128(x, _mm_xor_si128(w[i-2], w[i-4]));
+			x = sha1_rol4(x, 1);
+			w[i] = _mm_xor_si128(x, sha1_rol4(_mm_slli_si128(x, 12), 1));
+		}
+		for (; i<20; i++) {
+			x = _mm_alignr_epi8(w[i-1], w[i-2], 8);
+			x = _mm_xor_si128(x, _mm_xor_si128(w[i-4], w[i-7]));
+			w[i] = sha1_rol4(_mm_xor_si128(x, w[i-8]), 2);
+		}
+		for (i=0; i<20; i++)
+			_mm_storeu_si128((void *)(wk+4*i),
+				_mm_add_epi32(w[i], _mm_set1_epi32(rconsts[i/5])));
+		sha1_rounds(state, wk);
+	}
+}
+
+// The SHA extensions do four rounds (and a step of the message expansion)
+// per instruction.  The round function has to be an immediate, and the
+// compiler won't unroll the 20 steps for us, so they're a macro.
+
+#define SHANI_STEP(i) \
+	if (i<4) m[i] = _mm_shuffle_epi8(_mm_loadu_si128((void *)(data+16*i)), swap); \
+	e = i ? _mm_sha1nexte_epu32(e, m[i&3]) : _mm_add_epi32(e, m[0]); \
+	next = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, i/5); \
+	e = next; \
+	if (i>=3 && i<19) m[(i+1)&3] = _mm_sha1msg2_epu32(m[(i+1)&3], m[i&3]); \
+	if (i>=2 && i<18) m[(i+2)&3] = _mm_xor_si128(m[(i+2)&3], m[i&3]); \
+	if (i>=1 && i<17) m[(i+3)&3] = _mm_sha1msg1_epu32(m[(i+3)&3], m[i&3]);
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_shani(uint32_t *state, unsigned char *data, unsigned blocks)
+{
+	const __m128i swap = _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+	__m128i abcd, e, next, abcd_saved, e_saved, m[4];
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((void *)state), 0x1B);
+	e = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; blocks--; data += 64) {
+		abcd_saved = abcd;
+		e_saved = e;
+
+		// Each step's e comes from the abcd before the previous step.
+		SHANI_STEP(0) SHANI_STEP(1) SHANI_STEP(2) SHANI_STEP(3) SHANI_STEP(4)
+		SHANI_STEP(5) SHANI_STEP(6) SHANI_STEP(7) SHANI_STEP(8) SHANI_STEP(9)
+		SHANI_STEP(10) SHANI_STEP(11) SHANI_STEP(12) SHANI_STEP(13)
+		SHANI_STEP(14) SHANI_STEP(15) SHANI_STEP(16) SHANI_STEP(17)
+		SHANI_STEP(18) SHANI_STEP(19)
+
+		e = _mm_sha1nexte_epu32(e, e_saved);
+		abcd = _mm_add_epi32(abcd, abcd_saved);
 	}
-	// Add the previous values of state[]
-	for (i=0; i<5; i++) this->state[i] += this->oldstate[i];
+	_mm_storeu_si128((void *)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e, 3);
 }
 
+static void sha1_pick(void)
+{
+	unsigned a, b, c, d;
+
+	sha1_blocks = sha1_scalar;
+	if (!__get_cpuid(1, &a, &b, &c, &d)) return;
+	if (c & bit_SSSE3) sha1_blocks = sha1_ssse3;
+	if ((c & bit_SSE4_1) && __get_cpuid_max(0, 0) >= 7) {
+		__cpuid_count(7, 0, a, b, c, d);
+		if (b & bit_SHA) sha1_blocks = sha1_shani;
+	}
+}
+
+#elif defined(SHA1_ARM)
+
+// ARMv8 crypto extensions: four rounds per instruction, with the round
+// function picked by the instruction.
+
+__attribute__((target("+crypto")))
+static void sha1_arm(uint32_t *state, unsigned char *data, unsigned blocks)
+{
+	uint32x4_t abcd, abcd_saved, wk, m[4];
+	uint32_t e, e_saved, next;
+	int i;
+
+	abcd = vld1q_u32(state);
+	e = state[4];
+
+	for (; blocks--; data += 64) {
+		abcd_saved = abcd;
+		e_saved = e;
+		for (i=0; i<4; i++)
+			m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data+16*i)));
+		for (i=0; i<20; i++) {
+			wk = vaddq_u32(m[i&3], vdupq_n_u32(rconsts[i/5]));
+			next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+			if (i<5) abcd = vsha1cq_u32(abcd, e, wk);
+			else if (i>=10 && i<15) abcd = vsha1mq_u32(abcd, e, wk);
+			else abcd = vsha1pq_u32(abcd, e, wk);
+			e = next;
+			if (i<16) m[i&3] = vsha1su1q_u32(vsha1su0q_u32(m[i&3], m[(i+1)&3],
+				m[(i+2)&3]), m[(i+3)&3]);
+		}
+		abcd = vaddq_u32(abcd, abcd_saved);
+		e += e_saved;
+	}
+	vst1q_u32(state, abcd);
+	state[4] = e;
+}
+
+static void sha1_pick(void)
+{
+	sha1_blocks = (getauxval(AT_HWCAP) & HWCAP_SHA1) ? sha1_arm : sha1_scalar;
+}
+
+#else
+
+static void sha1_pick(void)
+{
+	sha1_blocks = sha1_scalar;
+}
+
+#endif
 
 // Initialize a struct sha1.
 
@@ -107,7 +298,8 @@ static void sha1_init(struct sha1 *this)
 	this->count = 0;
 }
 
-// Fill the 64-byte working buffer and call sha1_transform() when full.
+// Hash whole blocks straight from data, only copying a partial one into
+// the 64-byte working buffer.
 
 void sha1_update(struct sha1 *this, char *data, unsigned int len)
 {
@@ -118,17 +310,18 @@ void sha1_update(struct sha1 *this, char *data, unsigned int len)
 
 	// Enough data to process a frame?
 	if ((j + len) > 63) {
-		i = 64-j;
-		memcpy(this->buffer.c + j, data, i);
-		sha1_transform(this);
-		for ( ; i + 63 < len; i += 64) {
-			memcpy(this->buffer.c, data + i, 64);
-			sha1_transform(this);
+		i = 0;
+		if (j) {
+			i = 64-j;
+			memcpy(this->buffer + j, data, i);
+			sha1_blocks(this->state, this->buffer, 1);
 		}
+		sha1_blocks(this->state, (unsigned char *)data + i, (len-i)/64);
+		i += (len-i) & ~63;
 		j = 0;
 	} else i = 0;
 	// Grab remaining chunk
-	memcpy(this->buffer.c + j, data + i, len - i);
+	memcpy(this->buffer + j, data + i, len - i);
 }
 
 // Add padding and return the message digest.
@@ -152,8 +345,8 @@ void sha1_final(struct sha1 *this, char digest[20])
 		buf = 0;
 	} while ((this->count & 63) != 56);
 	for (i = 0; i < 8; i++)
-	  this->buffer.c[56+i] = count >> (8*(7-i));
-	sha1_transform(this);
+	  this->buffer[56+i] = count >> (8*(7-i));
+	sha1_blocks(this->state, this->buffer, 1);
 
 	for (i = 0; i < 20; i++)
 		digest[i] = this->state[i>>2] >> ((3-(i & 3)) * 8);
@@ -161,25 +354,121 @@ void sha1_final(struct sha1 *this, char digest[20])
 	memset(this, 0, sizeof(struct sha1));
 }
 
-// Callback for loopfiles()
+// Hash everything left in fd.
 
-static void do_sha1(int fd, char *name)
+static void sha1_fd(int fd, char digest[20])
 {
 	struct sha1 this;
 	int len;
 
+	// toybuf's 4k would be a system call per microsecond at these speeds.
+	char *buf = xiobuf(0);
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 	sha1_init(&this);
 	for (;;) {
-		len = read(fd, toybuf, sizeof(toybuf));
+		len = read(fd, buf, IOBUF_SIZE);
 		if (len<1) break;
-		sha1_update(&this, toybuf, len);
+		sha1_update(&this, buf, len);
 	}
-	sha1_final(&this, toybuf);
-	for (len = 0; len < 20; len++) printf("%02x", toybuf[len]);
+	sha1_final(&this, digest);
+}
+
+static void sha1_print(char digest[20], char *name)
+{
+	int i;
+
+	for (i = 0; i < 20; i++) printf("%02x", (unsigned char)digest[i]);
 	printf("  %s\n", name);
 }
 
+// Callback for loopfiles_read(): hash each chunk, print at the end of a file.
+
+static struct sha1 sha1_this;
+
+static void do_sha1(char *name, char *data, long len)
+{
+	if (len) sha1_update(&sha1_this, data, len);
+	else {
+		sha1_final(&sha1_this, toybuf);
+		sha1_print(toybuf, name);
+		sha1_init(&sha1_this);
+	}
+}
+
+// With -j, workers take the files in turn and the main thread prints each
+// result (or error) once it and all the ones before it are in.  Lots of
+// small files are then N opens and reads in flight instead of one.
+
+static struct sha1_file {
+	char digest[20];
+	int err, done;
+} *sha1_files;
+static int sha1_next;
+static pthread_mutex_t sha1_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sha1_ready = PTHREAD_COND_INITIALIZER;
+
+static void *sha1_worker(void *unused)
+{
+	struct sha1_file *file;
+	char *name;
+	int i, fd;
+
+	for (;;) {
+		pthread_mutex_lock(&sha1_lock);
+		i = sha1_next++;
+		pthread_mutex_unlock(&sha1_lock);
+		if (i >= toys.optc) return NULL;
+
+		file = sha1_files+i;
+		name = toys.optargs[i];
+		if (!strcmp(name, "-")) fd = 0;
+		else if (0>(fd = open(name, O_RDONLY))) file->err = errno;
+		if (fd>=0) {
+			sha1_fd(fd, file->digest);
+			if (fd) close(fd);
+		}
+
+		pthread_mutex_lock(&sha1_lock);
+		file->done++;
+		pthread_cond_broadcast(&sha1_ready);
+		pthread_mutex_unlock(&sha1_lock);
+	}
+}
+
 void sha1sum_main(void)
 {
-	loopfiles(toys.optargs, do_sha1);
+	pthread_t *workers;
+	int i;
+
+	sha1_pick();
+	if (TT.jobs<2 || toys.optc<2) {
+		sha1_init(&sha1_this);
+		loopfiles_read(toys.optargs, do_sha1);
+		return;
+	}
+
+	sha1_files = xzalloc(toys.optc*sizeof(struct sha1_file));
+	if (TT.jobs > toys.optc) TT.jobs = toys.optc;
+	workers = xmalloc(TT.jobs*sizeof(pthread_t));
+	for (i=0; i<TT.jobs; i++)
+		if (pthread_create(workers+i, NULL, sha1_worker, NULL))
+			perror_exit("pthread_create");
+
+	for (i=0; i<toys.optc; i++) {
+		pthread_mutex_lock(&sha1_lock);
+		while (!sha1_files[i].done) pthread_cond_wait(&sha1_ready, &sha1_lock);
+		pthread_mutex_unlock(&sha1_lock);
+		if (sha1_files[i].err) {
+			errno = sha1_files[i].err;
+			perror_msg("%s", toys.optargs[i]);
+			toys.exitval = 1;
+		} else sha1_print(sha1_files[i].digest, toys.optargs[i]);
+	}
+
+	for (i=0; i<TT.jobs; i++) pthread_join(workers[i], NULL);
+	if (CFG_TOYBOX_FREE) {
+		free(workers);
+		free(sha1_files);
+	}
 }
@@ -6,7 +6,7 @@
  *
  * See http://www.opengroup.org/onlinepubs/007904975/utilities/sort.html
 
-USE_SORT(NEWTOY(sort, USE_SORT_BIG("S:T:m" "o:k*t:bgMcszdfi") "run", TOYFLAG_USR|TOYFLAG_BIN))
+USE_SORT(NEWTOY(sort, USE_SORT_PARALLEL("(parallel):") USE_SORT_BIG("S:T:m" "o:k*t:bgMcszdfi") "run", TOYFLAG_USR|TOYFLAG_BIN))
 
 config SORT
     bool "sort"
@@ -25,7 +25,7 @@ config SORT_BIG
     default y
     depends on SORT
     help
-      usage: sort [-bcdfgiMsz] [-k#[,#[x]] [-t X]] [-o FILE]
+      usage: sort [-bcdfgimMsz] [-k#[,#[x]] [-t X]] [-o FILE] [-S SIZE] [-T DIR]
 
       -b    ignore leading blanks (or trailing blanks in second part of key)
       -c    check whether input is sorted
@@ -33,12 +33,15 @@ config SORT_BIG
       -f    force uppercase (case insensitive sort)
       -g    general numeric sort (double precision with nan and inf)
       -i    ignore nonprinting characters
+      -m    merge already sorted files
       -M    month sort (jan, feb, etc).
       -s    skip fallback sort (only sort with keys)
       -z    zero (null) terminated input
       -k    sort by "key" (see below)
       -t    use a key separator other than whitespace
       -o    output to FILE instead of stdout
+      -S    use at most SIZE memory (in K, or with a b/K/M/G/T/% suffix)
+      -T    put temporary files in DIR instead of $TMPDIR or /tmp
 
       This version of sort requires floating point.
 
@@ -48,20 +51,52 @@ config SORT_BIG
       of the fourth word.  Specifying multiple keys uses the later keys as
       tie breakers, in order.  A type specifier appended to a sort key
           (such as -2,2n) applies only to sorting that key.
+
+      Input that doesn't fit in the -S size (half the physical memory by
+      default) is sorted in pieces that fit, saved to temporary files, and
+      merged.
+
+config SORT_PARALLEL
+    bool "  parallel sort (--parallel)"
+    default y
+    depends on SORT_BIG
+    help
+      usage: sort [--parallel=N]
+
+      --parallel    sort with N threads
 */
 
 #include "toys.h"
 #include <math.h>
+#include <pthread.h>
 
 DEFINE_GLOBALS(
     char *key_separator;
     struct arg_list *raw_keys;
     char *outfile;
-    char *ignore1, ignore2;   // GNU compatability NOPs for -S and -T.
+    char *tempdir;
+    char *size;
+    char *parallel;
 
     void *key_list;
-    int linecount;
-    char **lines;
+    int keycount, linecount, linealloc;
+    struct sort_line **lines;
+    char **scratch;             // make_line()'s key copies
+    int plain;                  // byte order of whole lines, see sort_range()
+    char *slab;                 // where TT.lines are allocated
+    long slab_used;
+    struct sort_map {
+        char *addr;
+        long len;
+    } *maps;                    // input files TT.lines point into
+    int mapcount;
+
+    long budget, bytes;     // -S, and how much of it TT.lines uses
+    int threads;            // --parallel
+    int *runs, runcount;    // Temporary files of sorted lines (or -m input)
+    char run_end;           // Line end in TT.runs: 0, or -m input's
+    char *outbuf;
+    int outlen;
 )
 
 #define TT this.sort
@@ -84,10 +119,11 @@ DEFINE_GLOBALS(
 #define FLAG_M    512  // Sort type: date
 #define FLAG_g   1024  // Sort type: strtod()
 #define FLAG_b   2048  // Ignore leading blanks
+#define FLAG_m  32768  // Merge presorted input
 
 // Left off dealing with FLAG_b/FLAG_bb logic...
 
-#define FLAG_bb 32768  // Ignore trailing blanks
+#define FLAG_bb (1<<30)  // Ignore trailing blanks
 
 struct sort_key
 {
@@ -118,6 +154,10 @@ static char *get_key_data(char *str, struct sort_key *key, int flags)
             end=0;
             for (i=1; i < key->range[2*j]+j; i++) {
 
+                // Step over the separator ending the previous field
+                if (i>1 && TT.key_separator && str[end]==*TT.key_separator)
+                    end++;
+
                 // Skip leading blanks
                 if (str[end] && !TT.key_separator)
                     while (isspace(str[end])) end++;
@@ -181,132 +221,660 @@ static struct sort_key *add_key(void)
     void **stupid_compiler = &TT.key_list;
     struct sort_key **pkey = (struct sort_key **)stupid_compiler;
 
+    TT.keycount++;
     while (*pkey) pkey = &((*pkey)->next_key);
     return *pkey = xzalloc(sizeof(struct sort_key));
 }
 
-// Perform actual comparison
-static int compare_values(int flags, char *x, char *y)
-{
-    int ff = flags & (FLAG_n|FLAG_g|FLAG_M);
-
-    // Ascii sort
-    if (!ff) return strcmp(x, y);
+// A key, extracted once per line: the (-dfib modified) string for an ascii
+// sort, or the number (or month) and what kind of number it is.
 
-    if (CFG_SORT_BIG && ff == FLAG_g) {
-        char *xx,*yy;
-        double dx = strtod(x,&xx), dy = strtod(y,&yy);
-        int xinf, yinf;
+struct sort_value
+{
+    char *str;
+    double num;
+    int class;                  // Not a number < NaN < number
+};
 
-        // not numbers < NaN < -infinity < numbers < +infinity)
+#define SORT_NAN    1
+#define SORT_NUMBER 2
 
-        if (x==xx) return y==yy ? 0 : -1;
-        if (y==yy) return 1;
+// A line and its keys, in one allocation: the struct, an array of one
+// sort_value per key, the line, and the key strings that had to be copied.
+struct sort_line
+{
+    char *line;
+    struct sort_value value[];
+};
 
-        // Check for isnan
-        if (dx!=dx) return (dy!=dy) ? 0 : -1;
-        if (dy!=dy) return 1;
+static void set_value(int flags, struct sort_value *value, char *str)
+{
+    int ff = flags & (FLAG_n|FLAG_g|FLAG_M);
 
-        // Check for infinity.  (Could underflow, but avoids needing libm.)
-        xinf = (1.0/dx == 0.0);
-        yinf = (1.0/dy == 0.0);
-        if (xinf) {
-            if(dx<0) return (yinf && dy<0) ? 0 : -1;
-            return (yinf && dy>0) ? 0 : 1;
-        }
-        if (yinf) return dy<0 ? 1 : -1;
+    value->class = SORT_NUMBER;
+    if (CFG_SORT_BIG && ff == FLAG_g) {
+        char *end;
 
-        return dx>dy ? 1 : (dx<dy ? -1 : 0);
+        value->num = strtod(str, &end);
+        if (end == str) value->class = 0;
+        else if (value->num != value->num) value->class = SORT_NAN;
     } else if (CFG_SORT_BIG && ff == FLAG_M) {
         struct tm thyme;
-        int dx;
-        char *xx,*yy;
 
-        xx = strptime(x,"%b",&thyme);
-        dx = thyme.tm_mon;
-        yy = strptime(y,"%b",&thyme);
-        if (!xx) return !yy ? 0 : -1;
-        else if (!yy) return 1;
-        else return dx==thyme.tm_mon ? 0 : dx-thyme.tm_mon;
+        if (strptime(str, "%b", &thyme)) value->num = thyme.tm_mon;
+        else value->class = 0;
 
     // This has to be ff == FLAG_n
     } else {
-        // Full floating point version of -n
-        if (CFG_SORT_BIG) {
-            double dx = atof(x), dy = atof(y);
+        // Full floating point version of -n, or integer for tiny systems
+        value->num = CFG_SORT_BIG ? atof(str) : atoi(str);
+    }
+}
+
+// TT.lines are allocated from 1M slabs (each starting with a pointer to
+// the previous one), and all freed at once when they've been written out.
+
+#define SORT_SLAB (1<<20)
+
+static void *slab_alloc(long size)
+{
+    void *ptr;
 
-            return dx>dy ? 1 : (dx<dy ? -1 : 0);
-        // Integer version of -n for tiny systems
-        } else return atoi(x)-atoi(y);
+    size = (size+sizeof(long)-1) & ~(sizeof(long)-1);
+    if (!TT.slab || TT.slab_used+size > SORT_SLAB) {
+        char *slab = xmalloc(size+sizeof(char *) > SORT_SLAB
+            ? size+sizeof(char *) : SORT_SLAB);
+
+        *(char **)slab = TT.slab;
+        TT.slab = slab;
+        TT.slab_used = sizeof(char *);
     }
+    ptr = TT.slab+TT.slab_used;
+    TT.slab_used += size;
+
+    return ptr;
 }
 
+static void slab_free(void)
+{
+    while (TT.slab) {
+        char *prev = *(char **)TT.slab;
 
-// Callback from qsort(): Iterate through key_list and perform comparisons.
-static int compare_keys(const void *xarg, const void *yarg)
+        free(TT.slab);
+        TT.slab = prev;
+    }
+}
+
+// Replace str (from get_line()) with a sort_line holding it and its keys.
+// If size is NULL the sort_line is malloc()ed, otherwise it goes in the slab
+// and the memory used is added to it.  A mapped str is left where it is.
+
+static struct sort_line *make_line(char *str, int mapped, long *size)
 {
-    int flags = toys.optflags, retval = 0;
-    char *x, *y, **xx = (char **)xarg, **yy = (char **)yarg;
     struct sort_key *key;
+    struct sort_line *line;
+    struct sort_value *value;
+    long len = strlen(str)+1, total;
+    int flags, i;
+    char *data;
+
+    // Chop out and modify key chunks, handling -dfib, to see how big a
+    // block they need.  Numeric keys only need their number.
+    total = sizeof(struct sort_line) + TT.keycount*sizeof(struct sort_value)
+        + (mapped ? 0 : len);
+    for (key = TT.key_list, i = 0; key; key = key->next_key, i++) {
+        flags = key->flags ? key->flags : toys.optflags;
+        TT.scratch[i] = get_key_data(str, key, flags);
+        if (TT.scratch[i] != str && !(flags & (FLAG_n|FLAG_g|FLAG_M)))
+            total += strlen(TT.scratch[i])+1;
+    }
 
-    if (CFG_SORT_BIG) {
-        for (key=(struct sort_key *)TT.key_list; !retval && key;
-             key = key->next_key)
-        {
-            flags = key->flags ? key->flags : toys.optflags;
+    line = size ? slab_alloc(total) : xmalloc(total);
+    value = line->value;
+    data = (char *)(value+TT.keycount);
+    if (mapped) line->line = str;
+    else {
+        line->line = memcpy(data, str, len);
+        data += len;
+    }
+    for (key = TT.key_list, i = 0; key; key = key->next_key, i++, value++) {
+        char *key_data = TT.scratch[i];
+
+        flags = key->flags ? key->flags : toys.optflags;
+        if (flags & (FLAG_n|FLAG_g|FLAG_M)) {
+            set_value(flags, value, key_data);
+            value->str = NULL;
+        } else if (key_data == str) value->str = line->line;
+        else {
+            value->str = strcpy(data, key_data);
+            data += strlen(data)+1;
+        }
+        if (key_data != str) free(key_data);
+    }
+    if (!mapped) free(str);
+
+    // Count the pointer to it, and the mapped page it dirtied.
+    if (size) *size += total + sizeof(struct sort_line *) + (mapped ? len : 0);
 
-            // Chop out and modify key chunks, handling -dfib
+    return line;
+}
+
+// Compare two precomputed keys.
+static int compare_values(int flags, struct sort_value *x, struct sort_value *y)
+{
+    int ff = flags & (FLAG_n|FLAG_g|FLAG_M);
 
-            x = get_key_data(*xx, key, flags);
-            y = get_key_data(*yy, key, flags);
+    // Ascii sort
+    if (!ff) return strcmp(x->str, y->str);
 
-            retval = compare_values(flags, x, y);
+    // not numbers < NaN < -infinity < numbers < +infinity, and non-months
+    // before months.
+    if (x->class != y->class) return x->class - y->class;
+    if (x->class != SORT_NUMBER) return 0;
 
-            // Free the copies get_key_data() made.
+    return x->num>y->num ? 1 : (x->num<y->num ? -1 : 0);
+}
 
-            if (x != *xx) free(x);
-            if (y != *yy) free(y);
 
-            if (retval) break;
-        }
-    } else retval = compare_values(flags, *xx, *yy);
+// Callback from qsort(): Iterate through key_list and perform comparisons.
+static int compare_keys(const void *xarg, const void *yarg)
+{
+    int flags = toys.optflags, retval = 0, i;
+    struct sort_line *x = *(struct sort_line **)xarg,
+        *y = *(struct sort_line **)yarg;
+    struct sort_key *key;
+
+    for (key = TT.key_list, i = 0; key; key = key->next_key, i++) {
+        flags = key->flags ? key->flags : toys.optflags;
+        retval = compare_values(flags, x->value+i, y->value+i);
+        if (retval) break;
+    }
 
     // Perform fallback sort if necessary
     if (!retval && !(CFG_SORT_BIG && (toys.optflags&FLAG_s))) {
-        retval = strcmp(*xx, *yy);
+        retval = strcmp(x->line, y->line);
         flags = toys.optflags;
     }
 
     return retval * ((flags&FLAG_r) ? -1 : 1);
 }
 
+// Plain byte order sorts of whole lines don't need compare_keys(): sort
+// those with a multikey quicksort, which partitions by one character at a
+// time (less than, equal to or greater than the pivot's) and only looks at
+// the next character within the "equal" part, so no compare ever rescans a
+// common prefix.
+
+#define SORT_CHAR(x, depth) ((unsigned char)(x)->line[depth])
+
+static void sort_bytes(struct sort_line **a, long n, int depth)
+{
+    struct sort_line *swap;
+    long lt, gt, i, j;
+    int pivot, c;
+
+    while (n > 1) {
+        // Insertion sort small ranges.
+        if (n < 16) {
+            for (i=1; i<n; i++)
+                for (j=i; j && strcmp(a[j-1]->line+depth, a[j]->line+depth)>0;
+                    j--)
+                {
+                    swap = a[j];
+                    a[j] = a[j-1];
+                    a[j-1] = swap;
+                }
+            return;
+        }
+
+        // Median of three for the pivot.
+        c = SORT_CHAR(a[n/2], depth);
+        pivot = SORT_CHAR(a[0], depth);
+        i = SORT_CHAR(a[n-1], depth);
+        if ((pivot<c) == (c<i)) pivot = c;
+        else if ((pivot<i) == (i<c)) pivot = i;
+
+        for (lt=0, gt=n-1, i=0; i<=gt;) {
+            c = SORT_CHAR(a[i], depth);
+            if (c == pivot) {
+                i++;
+                continue;
+            }
+            swap = a[i];
+            if (c < pivot) {
+                a[i++] = a[lt];
+                a[lt++] = swap;
+            } else {
+                a[i] = a[gt];
+                a[gt--] = swap;
+            }
+        }
+        sort_bytes(a, lt, depth);
+        sort_bytes(a+gt+1, n-gt-1, depth);
+
+        // Lines equal to here that ended are all the same.
+        if (!pivot) return;
+        a += lt;
+        n = gt+1-lt;
+        depth++;
+    }
+}
+
+static void sort_range(struct sort_line **a, long n)
+{
+    long i;
+
+    if (!TT.plain) {
+        qsort(a, n, sizeof(struct sort_line *), compare_keys);
+        return;
+    }
+    sort_bytes(a, n, 0);
+
+    // Only identical lines compare equal, so their order doesn't matter.
+    if (toys.optflags&FLAG_r) {
+        for (i=0; i<n/2; i++) {
+            struct sort_line *swap = a[i];
+
+            a[i] = a[n-1-i];
+            a[n-1-i] = swap;
+        }
+    }
+}
+
+// --parallel: each thread sorts a slice of TT.lines, then adjacent slices
+// are merged in pairs until there's one left.  Each round of merges is split
+// into as many pieces as there are threads, by cutting the left slice at
+// even intervals and the right one where those lines would go.  Equal lines
+// are taken from the left first, so -s stays as stable as qsort() is.
+
+struct sort_task
+{
+    struct sort_line **a, **aend, **b, **bend, **out;
+};
+
+static void *sort_slice(void *arg)
+{
+    struct sort_task *t = arg;
+
+    sort_range(t->a, t->aend-t->a);
+
+    return 0;
+}
+
+static void *merge_slices(void *arg)
+{
+    struct sort_task *t = arg;
+
+    while (t->a<t->aend && t->b<t->bend)
+        *t->out++ = compare_keys(t->b, t->a) < 0 ? *t->b++ : *t->a++;
+    memcpy(t->out, t->a, (t->aend-t->a)*sizeof(struct sort_line *));
+    memcpy(t->out+(t->aend-t->a), t->b,
+        (t->bend-t->b)*sizeof(struct sort_line *));
+
+    return 0;
+}
+
+// Run tasks[0] on this thread and the others on new ones.
+static void run_tasks(void *(*function)(void *), struct sort_task *tasks,
+    int count)
+{
+    pthread_t *threads = xmalloc(count*sizeof(pthread_t));
+    int i;
+
+    for (i=1; i<count; i++)
+        if (pthread_create(threads+i, NULL, function, tasks+i))
+            perror_exit("pthread_create");
+    function(tasks);
+    for (i=1; i<count; i++) pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+// First line in [lo, hi) that doesn't sort before *key.
+static struct sort_line **lower_bound(struct sort_line **lo,
+    struct sort_line **hi, struct sort_line **key)
+{
+    while (lo<hi) {
+        struct sort_line **mid = lo+(hi-lo)/2;
+
+        if (compare_keys(mid, key) < 0) lo = mid+1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+static void sort_parallel(int threads)
+{
+    long n = TT.linecount;
+    struct sort_line **from = TT.lines, **swap,
+        **to = xmalloc(n*sizeof(struct sort_line *));
+    struct sort_task *tasks = xmalloc(threads*sizeof(struct sort_task)), *t;
+    int width, count, i, j, parts;
+
+#define SLICE(i) (from+n*((i)<threads ? (i) : threads)/threads)
+    for (i=0; i<threads; i++) {
+        tasks[i].a = SLICE(i);
+        tasks[i].aend = SLICE(i+1);
+    }
+    run_tasks(sort_slice, tasks, threads);
+
+    for (width=1; width<threads; width*=2) {
+        count = 0;
+        for (i=0; i<threads; i+=2*width) {
+            struct sort_line **a = SLICE(i), **b = SLICE(i+width),
+                **end = SLICE(i+2*width);
+
+            // This pair gets the threads that sorted it.
+            parts = threads-i < 2*width ? threads-i : 2*width;
+            for (j=0; j<parts; j++) {
+                t = tasks+count++;
+                t->a = j ? t[-1].aend : a;
+                t->b = j ? t[-1].bend : b;
+                if (j == parts-1) {
+                    t->aend = b;
+                    t->bend = end;
+                } else {
+                    t->aend = a+(b-a)*(j+1)/parts;
+                    t->bend = t->aend==b ? end : lower_bound(t->b, end, t->aend);
+                }
+                t->out = to+(t->a-from)+(t->b-b);
+            }
+        }
+        run_tasks(merge_slices, tasks, count);
+        swap = from;
+        from = to;
+        to = swap;
+    }
+#undef SLICE
+
+    if (from != TT.lines) {
+        memcpy(TT.lines, from, n*sizeof(struct sort_line *));
+        to = from;
+    }
+    free(to);
+    free(tasks);
+}
+
+// Sort TT.lines, and drop duplicates for -u.
+static void sort_lines(void)
+{
+    int idx, jdx;
+
+    // Not worth starting threads for small inputs.
+    if (CFG_SORT_PARALLEL && TT.threads>1 && TT.linecount >= 1024*TT.threads)
+        sort_parallel(TT.threads);
+    else sort_range(TT.lines, TT.linecount);
+
+    // handle unique (-u)
+    if (toys.optflags&FLAG_u) {
+        for (jdx=0, idx=1; idx<TT.linecount; idx++) {
+            if (compare_keys(&TT.lines[jdx], &TT.lines[idx]))
+                TT.lines[++jdx] = TT.lines[idx];
+        }
+        if (TT.linecount) TT.linecount = jdx+1;
+    }
+}
+
+// Buffered output of a line followed by end.  Call with NULL to flush.
+
+#define SORT_BUF 65536
+
+static void sort_write(int fd, char *s, char end)
+{
+    int len = s ? strlen(s)+1 : 0;
+
+    if (!TT.outbuf) TT.outbuf = xmalloc(SORT_BUF);
+    if (!s || TT.outlen+len > SORT_BUF) {
+        xwrite(fd, TT.outbuf, TT.outlen);
+        TT.outlen = 0;
+    }
+    if (len > SORT_BUF) {
+        xwrite(fd, s, len-1);
+        xwrite(fd, &end, 1);
+    } else if (s) {
+        memcpy(TT.outbuf+TT.outlen, s, len-1);
+        TT.outbuf[TT.outlen+len-1] = end;
+        TT.outlen += len;
+    }
+}
+
+// One sorted run being merged: a temporary file, or TT.lines (fd -1).
+struct sort_run
+{
+    int fd;
+    int idx;                    // next line of TT.lines
+    struct sort_line *line;     // current line, NULL at the end
+};
+
+static struct sort_line *run_next(struct sort_run *run)
+{
+    char *str;
+    long len;
+
+    if (run->fd == -1)
+        run->line = run->idx<TT.linecount ? TT.lines[run->idx++] : NULL;
+    else if ((str = get_rawline(run->fd, &len, TT.run_end))) {
+        if (TT.run_end && len && str[len-1] == TT.run_end) str[len-1] = 0;
+        run->line = make_line(str, 0, NULL);
+    } else run->line = NULL;
+
+    return run->line;
+}
+
+// Does x come out before y?  Equal lines come out in the order of their
+// runs, which is input order, and finished runs never do.
+static int beats(struct sort_run *x, struct sort_run *y)
+{
+    int retval;
+
+    if (!x->line || !y->line) return !y->line;
+    retval = compare_keys(&x->line, &y->line);
+
+    return retval ? retval<0 : x<y;
+}
+
+// Write TT.lines and the temporary files from TT.runs[first] on to fd in
+// order.  The runs are the leaves of a tournament tree: tree[0] is the run
+// with the next line, and each node above the leaves holds the run that lost
+// the match there, so replacing the winner's line only replays the matches
+// on its path to the root.  The files are closed and TT.lines is emptied.
+// (Lines from files are malloc()ed, the others are in the slab.)
+
+static void sort_merge(int fd, int first, char end)
+{
+    int count = TT.runcount-first+1, i, pos, winner, swap;
+    struct sort_run *runs = xmalloc(count*sizeof(struct sort_run)), *run;
+    int *tree = xmalloc(count*sizeof(int));
+    struct sort_line *last = NULL;
+    int last_fd = -1;
+
+    sort_lines();
+    for (i=0; i<count; i++) tree[i] = -1;
+    for (i=0; i<count; i++) {
+        runs[i].fd = i<count-1 ? TT.runs[first+i] : -1;
+        runs[i].idx = 0;
+        run_next(runs+i);
+
+        // Wait at the first empty node on the way up for an opponent.
+        for (winner=i, pos=(i+count)/2; pos; pos/=2) {
+            if (tree[pos] == -1) {
+                tree[pos] = winner;
+                break;
+            }
+            if (beats(runs+tree[pos], runs+winner)) {
+                swap = tree[pos];
+                tree[pos] = winner;
+                winner = swap;
+            }
+        }
+        if (!pos) tree[0] = winner;
+    }
+
+    while ((run = runs+tree[0])->line) {
+
+        // Lines within a run are already unique, but not across runs.
+        if ((toys.optflags&FLAG_u) && last
+            && !compare_keys(&last, &run->line))
+        {
+            if (run->fd != -1) free(run->line);
+        } else {
+            sort_write(fd, run->line->line, end);
+            if (last_fd != -1) free(last);
+            last = run->line;
+            last_fd = run->fd;
+        }
+        run_next(run);
+
+        for (winner=tree[0], pos=(winner+count)/2; pos; pos/=2) {
+            if (beats(runs+tree[pos], runs+winner)) {
+                swap = tree[pos];
+                tree[pos] = winner;
+                winner = swap;
+            }
+        }
+        tree[0] = winner;
+    }
+    sort_write(fd, NULL, 0);
+
+    if (last_fd != -1) free(last);
+    for (i=0; i<count-1; i++) xclose(runs[i].fd);
+    free(runs);
+    free(tree);
+    TT.runcount = first;
+    TT.linecount = TT.bytes = 0;
+
+    // Nothing points into the slab or the files read so far now.
+    slab_free();
+    while (TT.mapcount--)
+        munmap(TT.maps[TT.mapcount].addr, TT.maps[TT.mapcount].len);
+    TT.mapcount = 0;
+}
+
+// Move TT.lines out to a temporary file of \0 terminated lines.  Past
+// SORT_FANIN files, merge them all into one instead, so only that many
+// are ever open (each with its read-ahead buffer).
+
+#define SORT_FANIN 32
+
+static void sort_spill(void)
+{
+    char *dir = TT.tempdir ? TT.tempdir : getenv("TMPDIR"), *name;
+    int fd;
+
+    name = xmsprintf("%s/sortXXXXXX", dir ? dir : "/tmp");
+    if (-1 == (fd = mkstemp(name))) perror_exit("%s", name);
+    unlink(name);
+    free(name);
+
+    if (!(TT.runcount&(SORT_FANIN-1)))
+        TT.runs = xrealloc(TT.runs, sizeof(int)*(TT.runcount+SORT_FANIN));
+    sort_merge(fd, TT.runcount == SORT_FANIN ? 0 : TT.runcount, 0);
+    lseek(fd, 0, SEEK_SET);
+    TT.runs[TT.runcount++] = fd;
+}
+
+// Parse -S: K by default, or b, K, M, G, T, or % of physical memory.
+static long sort_size(char *size)
+{
+    char *end, *suffix = "BKMGT", *unit = suffix+1;
+    long long n = strtoll(size, &end, 10);
+
+    if (*end == '%') {
+        n = (long double)sysconf(_SC_PHYS_PAGES)*sysconf(_SC_PAGESIZE)*n/100;
+        unit = suffix;
+        end++;
+    } else if (*end) unit = strchr(suffix, toupper(*end++));
+    if (end == size || n < 0 || !unit || *end)
+        error_exit("Bad -S '%s'", size);
+    while (unit-- > suffix) n *= 1024;
+
+    return n;
+}
+
+// Append a line to TT.lines, spilling them to disk when they get too big.
+static void add_line(char *str, int mapped)
+{
+    if (TT.linecount == TT.linealloc) {
+        TT.linealloc = TT.linealloc ? 2*TT.linealloc : 64;
+        TT.lines = xrealloc(TT.lines,
+            sizeof(struct sort_line *)*TT.linealloc);
+    }
+    TT.lines[TT.linecount++] = make_line(str, mapped, &TT.bytes);
+    if (TT.bytes > TT.budget) sort_spill();
+}
+
+// Read a regular file by mapping it (privately, so the line ends can be
+// replaced with NUL in place) instead of allocating each line.  Returns 0
+// when it can't be mapped.
+
+static int sort_map(int fd, char end)
+{
+    struct stat st;
+    char *map, *pos, *eol, *stop;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    off_t offset;
+
+    // /proc files are "regular" files of size 0.
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size<1
+        || st.st_size != (size_t)st.st_size) return 0;
+    if (-1 == (offset = lseek(fd, 0, SEEK_CUR)) || offset >= st.st_size)
+        return 0;
+    map = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return 0;
+
+    stop = map+st.st_size;
+    for (pos = map+offset; pos<stop; pos = eol+1) {
+        // A last line with no end has no room for the NUL, so copy that one.
+        if (!(eol = memchr(pos, end, stop-pos))) {
+            add_line(xstrndup(pos, stop-pos), 0);
+            break;
+        }
+        *eol = 0;
+        add_line(pos, 1);
+
+        // Lines that went to disk don't need their pages any more.
+        if (!TT.linecount)
+            madvise(map, (eol+1-map) & ~(pagesize-1), MADV_DONTNEED);
+    }
+    lseek(fd, 0, SEEK_END);
+
+    if (!(TT.mapcount&15))
+        TT.maps = xrealloc(TT.maps, sizeof(struct sort_map)*(TT.mapcount+16));
+    TT.maps[TT.mapcount].addr = map;
+    TT.maps[TT.mapcount++].len = st.st_size;
+
+    return 1;
+}
+
 // Callback from loopfiles to handle input files.
 static void sort_read(int fd, char *name)
 {
+    int zero = CFG_SORT_BIG && (toys.optflags&FLAG_z);
+
+    // handle -c below so we don't allocate more memory than necessary.
+    if (!(CFG_SORT_BIG && (toys.optflags&FLAG_c))
+        && sort_map(fd, zero ? 0 : '\n')) return;
+
     // Read each line from file, appending to a big array.
 
     for (;;) {
-        char * line = (CFG_SORT_BIG && (toys.optflags&FLAG_z))
-                       ? get_rawline(fd, NULL, 0) : get_line(fd);
+        char *str = zero ? get_rawline(fd, NULL, 0) : get_line(fd);
+        struct sort_line *line;
 
-        if (!line) break;
+        if (!str) break;
 
-        // handle -c here so we don't allocate more memory than necessary.
         if (CFG_SORT_BIG && (toys.optflags&FLAG_c)) {
             int j = (toys.optflags&FLAG_u) ? -1 : 0;
 
-            if (TT.linecount && compare_keys((char *)TT.lines,line)>j)
+            line = make_line(str, 0, NULL);
+            if (TT.linecount && compare_keys(TT.lines, &line)>j)
                 error_exit("%s: Check line %d\n", name, TT.linecount);
 
-            if (TT.lines) free(TT.lines);
-            else TT.linecount = 0;
-            TT.lines = (char **)line;
-        } else {
-            if (!(TT.linecount&63))
-                TT.lines = xrealloc(TT.lines, sizeof(char *)*(TT.linecount+64));
-            TT.lines[TT.linecount] = line;
-        }
-        TT.linecount++;
+            if (TT.lines) free(*TT.lines);
+            else TT.lines = xmalloc(sizeof(struct sort_line *));
+            *TT.lines = line;
+            TT.linecount++;
+        } else add_line(str, 0);
     }
 }
 
@@ -337,7 +905,10 @@ void sort_main(void)
 
                 // Handle flags appended to a key type.
                 for (;*temp;temp++) {
-                    char *temp2, *optlist;
+                    // The flags in FLAG_ bit order, highest first (not
+                    // toys.which->options: long options come before them)
+                    static char keyflags[] = "bgMcszdfirun";
+                    char *temp2;
 
                     // Note that a second comma becomes an "Unknown key" error.
 
@@ -348,15 +919,12 @@ void sort_main(void)
 
                     // Which flag is this?
 
-                    optlist = toys.which->options;
-                    temp2 = index(optlist, *temp);
-                    flag = (1<<(optlist-temp2+strlen(optlist)-1));
+                    temp2 = strchr(keyflags, *temp);
+                    flag = temp2 ? 1<<(keyflags-temp2+sizeof(keyflags)-2) : 0;
 
                     // Was it a flag that can apply to a key?
 
-                    if (!temp2 || flag>FLAG_b
-                        || (flag&(FLAG_u|FLAG_c|FLAG_s|FLAG_z)))
-                    {
+                    if (!flag || (flag&(FLAG_u|FLAG_c|FLAG_s|FLAG_z))) {
                         error_exit("Unknown key option.");
                     }
                     // b after , means strip _trailing_ space, not leading.
@@ -371,40 +939,60 @@ void sort_main(void)
     if (toys.optflags&FLAG_b) toys.optflags |= FLAG_bb;
 
     // If no keys, perform alphabetic sort over the whole line.
-    if (CFG_SORT_BIG && !TT.key_list) add_key()->range[0] = 1;
+    if (!TT.key_list) add_key()->range[0] = 1;
+    TT.scratch = xmalloc(TT.keycount*sizeof(char *));
+    if (TT.keycount == 1) {
+        struct sort_key *key = TT.key_list;
+
+        TT.plain = key->range[0]==1 && !key->range[1] && !key->range[2]
+            && !key->range[3] && !((key->flags ? key->flags : toys.optflags)
+                & (FLAG_n|FLAG_g|FLAG_M|FLAG_b|FLAG_d|FLAG_f|FLAG_i|FLAG_bb));
+    }
 
-    // Open input files and read data, populating TT.lines[TT.linecount]
-    loopfiles(toys.optargs, sort_read);
+    if (CFG_SORT_PARALLEL && TT.parallel) {
+        char *end;
+        long n = strtol(TT.parallel, &end, 10);
 
-    // The compare (-c) logic was handled in sort_read(),
-    // so if we got here, we're done.
-    if (CFG_SORT_BIG && (toys.optflags&FLAG_c)) return;
+        if (end == TT.parallel || *end || n < 1 || n > INT_MAX)
+            error_exit("Bad --parallel '%s'", TT.parallel);
+        TT.threads = n;
+    }
+    if (CFG_SORT_BIG && TT.size) TT.budget = sort_size(TT.size);
+    else TT.budget = sysconf(_SC_PHYS_PAGES)/2*sysconf(_SC_PAGESIZE);
 
-    // Perform the actual sort
-    qsort(TT.lines, TT.linecount, sizeof(char *), compare_keys);
+    // Open input files and read data, populating TT.lines[TT.linecount]
+    // -m input is already sorted, so each file is just a run to merge.
+    if (CFG_SORT_BIG && (toys.optflags&FLAG_m) && !(toys.optflags&FLAG_c)) {
+        char *dash[] = {"-", NULL}, **arg = *toys.optargs ? toys.optargs : dash;
 
-    // handle unique (-u)
-    if (toys.optflags&FLAG_u) {
-        int jdx;
+        for (; *arg; arg++) {
+            int in = strcmp(*arg, "-") ? open(*arg, O_RDONLY) : 0;
 
-        for (jdx=0, idx=1; idx<TT.linecount; idx++) {
-            if (!compare_keys(&TT.lines[jdx], &TT.lines[idx]))
-                free(TT.lines[idx]);
-            else TT.lines[++jdx] = TT.lines[idx];
+            if (in<0) {
+                perror_msg("%s", *arg);
+                toys.exitval = 1;
+                continue;
+            }
+            if (!(TT.runcount&63))
+                TT.runs = xrealloc(TT.runs, sizeof(int)*(TT.runcount+64));
+            TT.runs[TT.runcount++] = in;
         }
-        if (TT.linecount) TT.linecount = jdx+1;
-    }
+        TT.run_end = (toys.optflags&FLAG_z) ? 0 : '\n';
+    } else loopfiles(toys.optargs, sort_read);
 
-    // Output result
-    for (idx = 0; idx<TT.linecount; idx++) {
-        char *s = TT.lines[idx];
-        xwrite(fd, s, strlen(s));
-        if (CFG_TOYBOX_FREE) free(s);
-        xwrite(fd, "\n", 1);
-    }
+    // The compare (-c) logic was handled in sort_read(),
+    // so if we got here, we're done.
+    if (CFG_SORT_BIG && (toys.optflags&FLAG_c)) return;
+
+    // Perform the actual sort, merging in what was spilled to disk.
+    sort_merge(fd, 0, '\n');
 
     if (CFG_TOYBOX_FREE) {
       if (fd != 1) close(fd);
       free(TT.lines);
+      free(TT.scratch);
+      free(TT.maps);
+      free(TT.runs);
+      free(TT.outbuf);
     }
 }
@@ -46,29 +46,153 @@ static void do_tee_open(int fd, char *name)
     TT.outputs = temp;
 }
 
+// When stdin is a pipe the data doesn't have to come out of the kernel:
+// tee() duplicates what's in stdin into a pipe per output file, splice()
+// moves it from there to the file, and stdout (the last output) gets it
+// spliced straight from stdin, which uses it up.  Outputs that can't be
+// spliced to (O_APPEND files, ttys) get read() and write() from their pipe.
+
+#define TEE_BUF (1<<17)
+
+struct tee_out {
+    int fd, pipe[2], slow;
+    long len;           // How much of this round is in pipe
+};
+
+// Move len bytes from the pipe "from" to out.  If writing fails, the rest
+// is thrown away.
+
+static void tee_move(struct tee_out *out, int from, long len, char *buf)
+{
+    int fd = out->fd;
+
+    while (len > 0) {
+        long n = -1;
+
+        if (fd != -1 && !out->slow) {
+            n = splice(from, NULL, fd, NULL, len, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EINVAL) out->slow++;
+            if (n < 0 && !out->slow) {
+                toys.exitval = 1;
+                fd = -1;
+            }
+        }
+        if (n < 0) {
+            n = read(from, buf, len < TEE_BUF ? len : TEE_BUF);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 1) perror_exit("read");
+            if (fd != -1 && n != writeall(fd, buf, n)) {
+                toys.exitval = 1;
+                fd = -1;
+            }
+        }
+        len -= n;
+    }
+}
+
+// Returns 0 if stdin can't be tee()d after all.
+
+static int tee_pipes(struct tee_out *outs, int count, char *buf)
+{
+    long cap = fcntl(0, F_GETPIPE_SZ), n;
+    int i, short_tee;
+
+    if (cap < 1) return 0;
+    for (i=0; i<count-1; i++) {
+        if (pipe(outs[i].pipe)) perror_exit("pipe");
+        fcntl(outs[i].pipe[1], F_SETPIPE_SZ, cap);
+    }
+
+    for (;;) {
+        if (count == 1) n = 0;
+        else if (0 > (n = tee(0, outs[0].pipe[1], cap, 0))) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL) return 0;
+            perror_exit("tee");
+        }
+
+        // Each output's pipe gets the same n bytes, unless it has fewer
+        // slots than stdin has buffers for them.
+        outs[0].len = n;
+        for (i=1; i<count-1; i++) {
+            long m;
+
+            while (0 > (m = tee(0, outs[i].pipe[1], n, 0)) && errno == EINTR);
+            outs[i].len = m < 0 ? 0 : m;
+        }
+        short_tee = 0;
+        for (i=0; i<count-1; i++) {
+            if (outs[i].len < n) short_tee++;
+            tee_move(outs+i, outs[i].pipe[0], outs[i].len, buf);
+        }
+
+        // Use it up from stdin, giving it to stdout on the way.  With just
+        // stdout there's no round length, take whatever comes.
+        if (count == 1) {
+            n = outs->slow ? read(0, buf, TEE_BUF)
+                : splice(0, NULL, 1, NULL, cap, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EINVAL && !outs->slow) {
+                outs->slow++;
+                continue;
+            }
+            if (n < 0) perror_exit("read");
+            if (outs->slow && n != writeall(1, buf, n)) toys.exitval = 1;
+        } else if (short_tee) {
+            xreadall(0, buf, n);
+            if (n != writeall(1, buf, n)) toys.exitval = 1;
+            for (i=0; i<count-1; i++)
+                if (outs[i].len < n && n-outs[i].len
+                    != writeall(outs[i].fd, buf+outs[i].len, n-outs[i].len))
+                    toys.exitval = 1;
+        } else tee_move(outs+count-1, 0, n, buf);
+        if (!n) break;
+    }
+
+    return 1;
+}
+
 void tee_main(void)
 {
+    struct fd_list *fdl;
+    struct tee_out *outs;
+    struct stat st;
+    char *buf;
+    int count = 1, i;
+
     if (toys.optflags&2) signal(SIGINT, SIG_IGN);
 
     // Open output files
     loopfiles_rw(toys.optargs,
         O_RDWR|O_CREAT|((toys.optflags&1)?O_APPEND:O_TRUNC), do_tee_open);
 
-    for (;;) {
-        struct fd_list *fdl;
-        int len;
+    // Each output file, plus stdout last.
+    for (fdl = TT.outputs; fdl; fdl = fdl->next) count++;
+    outs = xzalloc(count*sizeof(struct tee_out));
+    for (i=0, fdl = TT.outputs; fdl; fdl = fdl->next) outs[i++].fd = fdl->fd;
+    outs[i].fd = 1;
 
-        // Read data from stdin
-        len = xread(0, toybuf, sizeof(toybuf));
-        if (len<1) break;
+    // Rounds are at most one pipe's worth, make buf big enough for that.
+    i = fcntl(0, F_GETPIPE_SZ);
+    buf = xmalloc(i > TEE_BUF ? i : TEE_BUF);
 
-        // Write data to each output file, plus stdout.
-        fdl = TT.outputs;
+    if (fstat(0, &st) || !S_ISFIFO(st.st_mode) || !tee_pipes(outs, count, buf)) {
         for (;;) {
-            if(len != writeall(fdl ? fdl->fd : 1, toybuf, len)) toys.exitval=1;
-            if (!fdl) break;
-            fdl = fdl->next;
+            int len;
+
+            // Read data from stdin
+            len = xread(0, buf, TEE_BUF);
+            if (len<1) break;
+
+            // Write data to each output file, plus stdout.
+            for (i=0; i<count; i++)
+                if (len != writeall(outs[i].fd, buf, len)) toys.exitval=1;
         }
     }
 
+    if (CFG_TOYBOX_FREE) {
+        free(outs);
+        free(buf);
+    }
 }
@@ -18,6 +18,7 @@
 
 USE_TOYSH(NEWTOY(cd, NULL, TOYFLAG_NOFORK))
 USE_TOYSH(NEWTOY(exit, NULL, TOYFLAG_NOFORK))
+USE_TOYSH(NEWTOY(hash, "r", TOYFLAG_NOFORK))
 USE_TOYSH(OLDTOY(sh, toysh, "c:i", TOYFLAG_BIN))
 USE_TOYSH(NEWTOY(toysh, "c:i", TOYFLAG_BIN))
 
@@ -148,6 +149,18 @@ config EXIT
 	  Exit shell.  If no return value supplied on command line, use value
 	  of most recent command, or 0 if none.
 
+config HASH
+	bool
+	default n
+	depends on TOYSH
+	help
+	  usage: hash [-r] [command...]
+
+	  Look up commands in $PATH and remember where they are, or list the
+	  remembered commands.  The list is emptied when $PATH changes.
+
+	  -r	Forget all remembered commands.
+
 config CD
 	bool
 	default n
@@ -265,7 +278,14 @@ static char *parse_pipeline(char *cmdline, struct pipeline *line)
 					start++;
 					break;
 				}
-				// handle | & < > >> << || &&
+				// The next command of this pipeline reads this one's output.
+				if (*start=='|' && start[1]!='|') {
+					(*cmd)->flags |= TOYSH_FLAG_PIPE;
+					cmd = &((*cmd)->next);
+					start++;
+					continue;
+				}
+				// handle & < > >> << || &&
 			}
 			break;
 		}
@@ -277,6 +297,38 @@ static char *parse_pipeline(char *cmdline, struct pipeline *line)
 	return start;
 }
 
+// Start one command with its stdin and stdout moved to in and out (-1 leaves
+// them alone).  Toybox applets run from this binary without a $PATH search;
+// they can't run as threads of the shell, since every applet uses the global
+// toys and this.  Other commands come from the $PATH cache, or are searched
+// for by libc if it can't help.  Returns the pid, or -1.
+static int spawn_command(struct command *cmd, int in, int out)
+{
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+	char *exe;
+	int err = ENOENT;
+
+	posix_spawn_file_actions_init(&actions);
+	if (in != -1) posix_spawn_file_actions_adddup2(&actions, in, 0);
+	if (out != -1) posix_spawn_file_actions_adddup2(&actions, out, 1);
+	if (toy_find(cmd->argv[0]))
+		err = posix_spawn(&pid, "/proc/self/exe", &actions, 0, cmd->argv,
+			environ);
+	if (err && (exe = path_cache_find(getenv("PATH"), cmd->argv[0]))) {
+		err = posix_spawn(&pid, exe, &actions, 0, cmd->argv, environ);
+		if (err) path_cache_flush();
+	}
+	if (err) err = posix_spawnp(&pid, cmd->argv[0], &actions, 0, cmd->argv,
+			environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (!err) return pid;
+
+	errno = err;
+	perror_msg("%s", cmd->argv[0]);
+	return -1;
+}
+
 // Execute the commands in a pipeline
 static void run_pipeline(struct pipeline *line)
 {
@@ -284,9 +336,18 @@ static void run_pipeline(struct pipeline *line)
 	struct command *cmd = line->cmd;
 	if (!cmd || !cmd->argc) return;
 
+	for (; cmd; cmd = cmd->next) {
+		if (!cmd->argc || (!cmd->next && (cmd->flags & TOYSH_FLAG_PIPE))) {
+			error_msg("syntax error near '|'");
+			return;
+		}
+	}
+	cmd = line->cmd;
+
 	tl = toy_find(cmd->argv[0]);
-	// Is this command a builtin that should run in this process?
-	if (tl && (tl->flags & TOYFLAG_NOFORK)) {
+	// Is this command a builtin that should run in this process?  (In a
+	// pipeline it runs in a child like everything else, as in other shells.)
+	if (!cmd->next && tl && (tl->flags & TOYFLAG_NOFORK)) {
 		struct toy_context temp;
 
 		// This fakes lots of what toybox_main() does.
@@ -299,15 +360,29 @@ static void run_pipeline(struct pipeline *line)
 		if (toys.old_umask) umask(toys.old_umask);
 		memcpy(&toys, &temp, sizeof(struct toy_context));
 	} else {
-		int status;
+		int status = 127<<8, in = -1, pipes[2];
+
+		// Start every command before waiting for any, connecting each one's
+		// stdout to the next one's stdin.  The pipes are close-on-exec, so
+		// each child only keeps the two ends moved onto its stdin and stdout.
+		for (; cmd; cmd = cmd->next) {
+			pipes[0] = pipes[1] = -1;
+			if (cmd->next && pipe2(pipes, O_CLOEXEC)) perror_exit("pipe");
+			cmd->pid = spawn_command(cmd, in, pipes[1]);
+			if (in != -1) close(in);
+			if (pipes[1] != -1) close(pipes[1]);
+			in = pipes[0];
+		}
 
-		cmd->pid = vfork();
-		if (!cmd->pid) xexec(cmd->argv);
-		else waitpid(cmd->pid, &status, 0);
+		// The exit code of a pipeline is that of its last command.
+		for (cmd = line->cmd; cmd; cmd = cmd->next) {
+			status = 127<<8;
+			if (cmd->pid != -1) waitpid(cmd->pid, &status, 0);
 
-		if (CFG_TOYSH_FLOWCTL || CFG_TOYSH_PIPES) {
-			if (WIFEXITED(status)) cmd->pid = WEXITSTATUS(status);
-			if (WIFSIGNALED(status)) cmd->pid = WTERMSIG(status);
+			if (CFG_TOYSH_FLOWCTL || CFG_TOYSH_PIPES) {
+				if (WIFEXITED(status)) cmd->pid = WEXITSTATUS(status);
+				if (WIFSIGNALED(status)) cmd->pid = WTERMSIG(status);
+			}
 		}
 	}
 
@@ -357,6 +432,26 @@ void exit_main(void)
 	exit(*toys.optargs ? atoi(*toys.optargs) : 0);
 }
 
+static void hash_show(char *filename, char *found)
+{
+	puts(found);
+}
+
+void hash_main(void)
+{
+	char **arg;
+
+	if (toys.optflags) path_cache_flush();
+	else if (!*toys.optargs) path_cache_walk(hash_show);
+
+	for (arg = toys.optargs; *arg; arg++) {
+		if (!path_cache_find(getenv("PATH"), *arg)) {
+			error_msg("%s: not found", *arg);
+			toys.exitval = 1;
+		}
+	}
+}
+
 void toysh_main(void)
 {
 	FILE *f;
@@ -43,6 +43,15 @@ static int which_in_path(char *filename)
 		}
 	}
 
+	// The first match comes from the $PATH cache shared with the shell.
+	if (!toys.optflags) {
+		char *found = path_cache_find(getenv("PATH"), filename);
+
+		if (!found) return 1;
+		puts(found);
+		return 0;
+	}
+
 	// Search $PATH for matches.
 	list = find_in_path(getenv("PATH"), filename);
 	if (!list) return 1;
@@ -51,11 +60,6 @@ static int which_in_path(char *filename)
 	while (list) {
 		if (!access(list->str, X_OK)) {
 			puts(list->str);
-			// If we should stop at one match, do so
-			if (!toys.optflags) {
-				llist_free(list, NULL);
-				break;
-			}
 		}
 		free(llist_pop(&list));
 	}
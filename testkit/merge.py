@@ -0,0 +1,103 @@
+# Merges the TK_REPORT files of a sharded TestKit run.
+#
+#   TK_RUN= TK_SHARD=1/3 TK_REPORT=report-1.json ./a.out    (one run per
+#   TK_RUN= TK_SHARD=2/3 TK_REPORT=report-2.json ./a.out     machine)
+#   TK_RUN= TK_SHARD=3/3 TK_REPORT=report-3.json ./a.out
+#   python3 merge.py -o report.json -j junit.xml report-*.json
+#
+# Checks that every shard is there exactly once, prints the failed test
+# cases, the pass count and the slowest test cases of the whole suite, and
+# how long each shard took (to see whether they are balanced). -o writes
+# the merged report (in declaration order, as one TK_REPORT would be), -j
+# the results as one JUnit XML test suite. Exits with 1 if a test case
+# failed or a shard is missing.
+
+import argparse
+import json
+import sys
+from xml.sax.saxutils import quoteattr
+
+SLOWEST = 5
+
+
+def read(paths):
+    shards, results, errors = {}, {}, []
+    for path in paths:
+        with open(path) as f:
+            report = json.load(f)
+        for r in report:
+            i, n = (int(x) for x in r.get("shard", "1/1").split("/"))
+            if shards.setdefault((i, n), path) != path:
+                errors.append(f"{path}: shard {i}/{n} is also in {shards[(i, n)]}")
+                break
+            if r["index"] in results:
+                errors.append(f"{path}: {r['name']} is also in {results[r['index']]['file']}")
+            results[r["index"]] = dict(r, file=path)
+    counts = {n for i, n in shards}
+    if len(counts) > 1:
+        errors.append(f"shards of different splits: {', '.join(sorted(f'{i}/{n}' for i, n in shards))}")
+    elif counts:
+        n = counts.pop()
+        for i in range(1, n + 1):
+            if (i, n) not in shards:
+                errors.append(f"shard {i}/{n} is missing (or had no test cases)")
+    return [results[k] for k in sorted(results)], shards, errors
+
+
+def junit(results, out):
+    failures = sum(not r["passed"] for r in results)
+    wall = sum(r["wall_ms"] for r in results) / 1e3
+    with open(out, "w") as f:
+        f.write('<?xml version="1.0" encoding="UTF-8"?>\n')
+        f.write(f'<testsuite name="testkit" tests="{len(results)}" failures="{failures}" time="{wall:.3f}">\n')
+        for r in results:
+            attrs = f'name={quoteattr(r["name"])} classname="testkit" file={quoteattr(r["loc"])} time="{r["wall_ms"] / 1e3:.3f}"'
+            if r["passed"]:
+                f.write(f"  <testcase {attrs}/>\n")
+            else:
+                f.write(f'  <testcase {attrs}>\n    <failure type={quoteattr(r.get("status", "fail"))}/>\n  </testcase>\n')
+        f.write("</testsuite>\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Merge the TK_REPORT files of TK_SHARD runs.")
+    parser.add_argument("-o", metavar="FILE", help="write the merged report to FILE")
+    parser.add_argument("-j", metavar="FILE", help="write JUnit XML results to FILE")
+    parser.add_argument("reports", nargs="+")
+    args = parser.parse_args()
+
+    results, shards, errors = read(args.reports)
+    for e in errors:
+        print(f"- Error: {e}")
+
+    for r in results:
+        if not r["passed"]:
+            print(f"- [FAIL] {r['name']} ({r['loc']}) - {r.get('status', 'fail')}, shard {r.get('shard', '1/1')}")
+    passed = sum(r["passed"] for r in results)
+    print(f"- {passed}/{len(results)} test cases passed.")
+
+    n = min(len(results), SLOWEST)
+    print(f"- Slowest {n} test cases (wall, user, sys, max RSS):")
+    for r in sorted(results, key=lambda r: -r["wall_ms"])[:n]:
+        print(f"    {r['wall_ms']:8.1f} ms {r['user_ms']:8.1f} ms {r['sys_ms']:8.1f} ms "
+              f"{r['max_rss_kib']:8d} KiB  {r['name']} ({r['loc']})")
+
+    print("- Shards (test cases, total wall time):")
+    for i, n in sorted(shards):
+        mine = [r for r in results if r.get("shard", "1/1") == f"{i}/{n}"]
+        print(f"    {i}/{n} {len(mine):6d} {sum(r['wall_ms'] for r in mine):10.1f} ms  {shards[(i, n)]}")
+
+    if args.o:
+        with open(args.o, "w") as f:
+            f.write("[\n")
+            for k, r in enumerate(results):
+                r = {key: v for key, v in r.items() if key != "file"}
+                f.write("  " + json.dumps(r) + ("," if k + 1 < len(results) else "") + "\n")
+            f.write("]\n")
+    if args.j:
+        junit(results, args.j)
+
+    sys.exit(1 if errors or passed < len(results) else 0)
+
+
+main()
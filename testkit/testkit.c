@@ -1,18 +1,30 @@
+#define _GNU_SOURCE  // memfd_create()
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/fcntl.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/stat.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <linux/perf_event.h>
 #include "testkit.h"
 
 static struct tk_testcase tests[TK_MAX_TESTS];
+static void (*setups[TK_MAX_SETUPS])(void);
 
 /**
  * Add a test case to the test suite. Handles both system tests (calling
- * main with command-line arguments) and unit tests. This is the only
- * externally visible function in TestKit.
+ * main with command-line arguments) and unit tests. This, tk_add_setup()
+ * and tk_alloc_stats() are the externally visible functions in TestKit
+ * (besides the malloc() wrappers).
  */
 void tk_add_test(struct tk_testcase t) {
     static int ntests = 0;
@@ -60,10 +72,239 @@ void tk_add_test(struct tk_testcase t) {
     ntests++;
 }
 
+/**
+ * Add a global setup function (TestSetup), run once in the worker process
+ * before all test cases are forked from it.
+ */
+void tk_add_setup(void (*setup)(void)) {
+    static int nsetups = 0;
+
+    if (!getenv(TK_RUN) && !getenv(TK_VERBOSE)) {
+        return;
+    }
+
+    tk_assert(nsetups < TK_MAX_SETUPS,
+              "TestKit supports up to %d setup functions", TK_MAX_SETUPS);
+
+    setups[nsetups++] = setup;
+}
+
 // ------------------------------------------------------------------------
 // Below are testkit internal functions for running test cases.
 
-static int run_testcase(struct tk_testcase *t, char *buf) {
+static void set_time_limit(int ms) {
+    // SIGALRM after ms milliseconds of wall time, like alarm() but finer.
+    struct itimerval it = {
+        .it_value = { .tv_sec = ms / 1000, .tv_usec = ms % 1000 * 1000 },
+    };
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/** Benchmark result, written by the test process into shared memory. */
+struct tk_bench_result {
+    int done;
+    long ops; // operations per batch
+    int samples, outliers;
+    double ns_per_op, stddev;
+};
+
+/** Hardware (and one software) counters, with TK_PERF. */
+#define TK_PERF_EVENTS 5
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} perf_events[TK_PERF_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses" },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page_faults" },
+};
+
+/** Counter values of one test case; an unavailable counter is not valid. */
+struct tk_perf_result {
+    int valid[TK_PERF_EVENTS];
+    uint64_t count[TK_PERF_EVENTS];
+};
+
+/** Everything a test process reports back, in memory shared with it. */
+struct tk_shared {
+    struct tk_bench_result bench;
+    struct tk_perf_result perf;
+    struct tk_alloc_stats alloc;
+};
+
+// Heap use is counted into this while a test body runs (see the malloc()
+// wrappers at the end of this file). It points into shared memory, so the
+// main() process of a system test counts into it as well.
+static struct tk_alloc_stats *alloc_stats;
+
+static int perf_fds[TK_PERF_EVENTS];
+
+static void perf_start(void) {
+    // Count user-space events of this process and of the processes it
+    // forks (main() of a system test). Each counter is opened on its own
+    // so that the available ones still work where others are missing
+    // (virtual machines often have no hardware counters at all).
+    for (int i = 0; i < TK_PERF_EVENTS; i++) {
+        perf_fds[i] = -1;
+        if (!getenv(TK_PERF)) {
+            continue;
+        }
+
+        struct perf_event_attr attr = {
+            .type = perf_events[i].type,
+            .size = sizeof(attr),
+            .config = perf_events[i].config,
+            .disabled = 1,
+            .inherit = 1,
+            .exclude_kernel = 1,
+            .exclude_hv = 1,
+        };
+        perf_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    for (int i = 0; i < TK_PERF_EVENTS; i++) {
+        if (perf_fds[i] >= 0) {
+            ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void perf_stop(struct tk_perf_result *res) {
+    for (int i = 0; i < TK_PERF_EVENTS; i++) {
+        if (perf_fds[i] >= 0) {
+            ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    for (int i = 0; i < TK_PERF_EVENTS; i++) {
+        if (perf_fds[i] >= 0) {
+            uint64_t count;
+            if (read(perf_fds[i], &count, sizeof(count)) == sizeof(count)) {
+                res->valid[i] = 1;
+                res->count[i] = count;
+            }
+            close(perf_fds[i]);
+            perf_fds[i] = -1;
+        }
+    }
+}
+
+static void measure_start(struct tk_shared *res) {
+    // Around the test body only: counters and heap tracking.
+    perf_start();
+    res->alloc.tracked = 1;
+    alloc_stats = &res->alloc;
+}
+
+static void measure_stop(struct tk_shared *res) {
+    alloc_stats = NULL;
+    perf_stop(&res->perf);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double time_batch(void (*body)(void), long ops) {
+    double start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        body();
+    }
+    return now_ns() - start;
+}
+
+static double square_root(double x) {
+    // Newton's method; saves linking with -lm.
+    double r = x > 1 ? x : 1;
+    for (int i = 0; i < 64; i++) {
+        r = (r + x / r) / 2;
+    }
+    return r;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_benchmark(struct tk_testcase *t, struct tk_bench_result *res) {
+    // Calibrate: grow the batch until it takes TK_BENCH_BATCH_NS. These
+    // runs also warm up caches, branch predictors and lazy mappings.
+    long ops = 1;
+    for (;;) {
+        double ns = time_batch(t->bench, ops);
+        if (ns >= TK_BENCH_BATCH_NS) {
+            break;
+        }
+        double scale = ns > 0 ? 1.2 * TK_BENCH_BATCH_NS / ns : 10;
+        ops = ops * (scale > 10 ? 10 : scale < 2 ? 2 : scale);
+    }
+
+    double samples[TK_BENCH_SAMPLES], dev[TK_BENCH_SAMPLES];
+    for (int i = 0; i < TK_BENCH_SAMPLES; i++) {
+        samples[i] = time_batch(t->bench, ops) / ops;
+    }
+
+    // Drop the samples more than 3 median absolute deviations from the
+    // median (interrupts, page faults, other processes).
+    qsort(samples, TK_BENCH_SAMPLES, sizeof(double), cmp_double);
+    double median = samples[TK_BENCH_SAMPLES / 2];
+    for (int i = 0; i < TK_BENCH_SAMPLES; i++) {
+        dev[i] = samples[i] > median ? samples[i] - median : median - samples[i];
+    }
+    qsort(dev, TK_BENCH_SAMPLES, sizeof(double), cmp_double);
+    double limit = 3 * 1.4826 * dev[TK_BENCH_SAMPLES / 2];
+
+    double sum = 0, sum2 = 0;
+    int n = 0;
+    for (int i = 0; i < TK_BENCH_SAMPLES; i++) {
+        double d = samples[i] > median ? samples[i] - median : median - samples[i];
+        if (limit == 0 || d <= limit) {
+            sum += samples[i];
+            sum2 += samples[i] * samples[i];
+            n++;
+        }
+    }
+    double mean = sum / n, var = sum2 / n - mean * mean;
+
+    *res = (struct tk_bench_result) {
+        .done = 1,
+        .ops = ops,
+        .samples = TK_BENCH_SAMPLES,
+        .outliers = TK_BENCH_SAMPLES - n,
+        .ns_per_op = mean,
+        .stddev = var > 0 ? square_root(var) : 0,
+    };
+}
+
+static char *read_output(int fd, size_t *len) {
+    // The whole capture file so far, NUL-terminated (for strstr() and
+    // friends), with its length in *len.
+    struct stat st;
+    tk_assert(fstat(fd, &st) == 0, "fstat() should succeed");
+
+    char *out = malloc(st.st_size + 1);
+    tk_assert(out, "malloc() should succeed");
+    size_t n = 0;
+    while (n < st.st_size) {
+        ssize_t r = pread(fd, out + n, st.st_size - n, n);
+        if (r <= 0) break;
+        n += r;
+    }
+    out[n] = '\0';
+    *len = n;
+    return out;
+}
+
+static int run_testcase(struct tk_testcase *t, int fd,
+                        struct tk_shared *res) {
     int r = 0;
 
     if (t->init) {
@@ -71,27 +312,28 @@ static int run_testcase(struct tk_testcase *t, char *buf) {
         t->init();
     }
 
-    // Redirect both stdout and stderr to a memory buffer. This only
-    // affects calls to printf() and fprintf() to stdout and stderr.
-    // Writes to file descriptors will not be captured, nor will writes
-    // to redirected file descriptors.
+    // Redirect both stdout and stderr to an in-memory file (memfd), which
+    // grows as needed. This only affects calls to printf() and fprintf()
+    // to stdout and stderr. Writes to file descriptors will not be
+    // captured, nor will writes to redirected file descriptors.
 
-    FILE *fp = fmemopen(buf, TK_OUTPUT_LIMIT - 1, "w+");
-    tk_assert(fp, "fmemopen() should succeed");
+    FILE *fp = fdopen(fd, "w");
+    tk_assert(fp, "fdopen() should succeed");
     setbuf(fp, NULL);
     stdout = stderr = fp;
 
     if (t->stest) {
         // Run system test: call main() manually
         int main(int, const char **, const char **);
-        extern const char **environ;
 
+        measure_start(res);
         pid_t child_pid = fork();
         if (child_pid == 0) {
-            exit(main(t->argc, t->argv, environ));
+            exit(main(t->argc, t->argv, (const char **)environ));
         } else {
             int status;
             waitpid(child_pid, &status, 0);
+            measure_stop(res);
             if (WIFEXITED(status)) {
                 r = WEXITSTATUS(status);
             } else if (WIFSIGNALED(status)) {
@@ -101,14 +343,25 @@ static int run_testcase(struct tk_testcase *t, char *buf) {
             }
 
             // Runt the bottom-half (test code).
+            size_t len;
+            char *output = read_output(fd, &len);
             t->stest(&(struct tk_result) {
                 .exit_status = r,
-                .output = buf,
+                .output = output,
+                .output_len = len,
             });
+            free(output);
         }
+    } else if (t->bench) {
+        // Run benchmark: time the test code.
+        measure_start(res);
+        run_benchmark(t, &res->bench);
+        measure_stop(res);
     } else {
         // Run unit test: just run the test code.
+        measure_start(res);
         t->utest();
+        measure_stop(res);
     }
 
     fclose(fp);
@@ -120,7 +373,7 @@ static void run_cleanup(struct tk_testcase *t) {
         pid_t fini_pid = fork();
         if (fini_pid == 0) {
             // Cleanup function may also timeout.
-            alarm(TK_TIME_LIMIT_SEC);
+            set_time_limit(TK_TIME_LIMIT_MS);
             t->fini();
             exit(0);
         } else {
@@ -170,6 +423,439 @@ static bool check_results(struct tk_testcase *t, int status) {
     return succ;
 }
 
+/** A test case process, from fork() until its result is printed. */
+struct tk_run {
+    pid_t pid; // test case process, or 0 once it has exited
+    int status; // its status from waitpid()
+    int fd; // its capture file from the pool, while running
+    char *output; // copy of its output, once it has exited
+    size_t output_len;
+    struct timespec start; // when it was forked
+    double wall_ms; // from fork() to exit
+    struct rusage usage; // CPU time and max RSS, from wait4()
+    uint64_t digest; // FNV-1a of its output
+    bool passed;
+};
+
+static struct tk_run runs[TK_MAX_TESTS];
+
+// With TK_SHARD=i/n, tests[] only keeps the test cases of shard i (1 to
+// n); suite_index[] has their positions in the whole suite (suite_size
+// test cases).
+static int shard_index = 1, shard_count = 1;
+static int suite_index[TK_MAX_TESTS], suite_size;
+
+// Benchmark results and counters of all test cases (shared with the test
+// processes), and the baseline to compare benchmarks with.
+static struct tk_shared *shared;
+
+struct tk_baseline {
+    char name[64];
+    double ns_per_op;
+};
+
+static struct tk_baseline *baseline;
+static int nbaseline;
+
+// Output is captured in memfds shared with the test processes: they grow
+// with the output, so there is neither a size limit nor a large buffer
+// per test. There is one per job, created once and emptied for reuse.
+static int *free_fds;
+static int nfree_fds;
+
+static int get_jobs(void) {
+    // Number of test cases in flight: TK_JOBS, or one per CPU.
+    const char *s = getenv(TK_JOBS);
+    long jobs = (s && *s) ? atol(s) : sysconf(_SC_NPROCESSORS_ONLN);
+    return jobs > 0 ? jobs : 1;
+}
+
+static void start_testcase(int i) {
+    struct tk_testcase *t = &tests[i];
+    struct tk_run *run = &runs[i];
+
+    tk_assert(nfree_fds > 0, "A capture file should be free for each job");
+    run->fd = free_fds[--nfree_fds];
+
+    // Run test case in a separated process.
+    clock_gettime(CLOCK_MONOTONIC, &run->start);
+    pid_t pid = fork();
+    tk_assert(pid >= 0, "fork() should succeed");
+    if (pid == 0) {
+        // Child: run test case for TIME_LIMIT.
+        set_time_limit(t->time_limit_ms > 0 ? t->time_limit_ms
+                                            : TK_TIME_LIMIT_MS);
+        exit(run_testcase(t, run->fd, &shared[i]));
+    }
+    run->pid = pid;
+}
+
+static uint64_t digest(const char *buf, size_t len) {
+    // 64-bit FNV-1a: enough to tell whether the output of a test case
+    // changed between runs (or shards) without keeping it.
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)buf[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void wait_testcase(int ntests) {
+    // Wait for whichever running test case finishes first and run its
+    // t->fini(); its result is printed later, in declaration order.
+    int status;
+    struct rusage usage;
+    struct timespec now;
+    pid_t pid = wait4(-1, &status, 0, &usage);
+    tk_assert(pid > 0, "wait4() should succeed");
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int i = 0; i < ntests; i++) {
+        if (runs[i].pid == pid) {
+            runs[i].pid = 0;
+            runs[i].status = status;
+
+            // The usage includes the main() process of a system test,
+            // which the test process has waited for.
+            runs[i].usage = usage;
+            runs[i].wall_ms = (now.tv_sec - runs[i].start.tv_sec) * 1e3 +
+                              (now.tv_nsec - runs[i].start.tv_nsec) / 1e6;
+
+            // Empty the capture file for the next test case; the output
+            // is kept until it is printed.
+            int fd = runs[i].fd;
+            runs[i].output = read_output(fd, &runs[i].output_len);
+            runs[i].digest = digest(runs[i].output, runs[i].output_len);
+            tk_assert(ftruncate(fd, 0) == 0, "ftruncate() should succeed");
+            lseek(fd, 0, SEEK_SET);
+            free_fds[nfree_fds++] = fd;
+
+            // Cleanup code is also ran in a separate process.
+            run_cleanup(&tests[i]);
+            return;
+        }
+    }
+}
+
+static double tv_ms(struct timeval tv) {
+    return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+static void load_baseline(void) {
+    // A baseline file has one "name ns_per_op" line per benchmark, as
+    // written by TK_BENCH_SAVE.
+    const char *file = getenv(TK_BENCH_BASELINE);
+    if (!file) {
+        return;
+    }
+
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        printf("- Cannot open benchmark baseline %s\n", file);
+        return;
+    }
+
+    struct tk_baseline b;
+    while (fscanf(fp, "%63s %lf", b.name, &b.ns_per_op) == 2) {
+        baseline = realloc(baseline, (nbaseline + 1) * sizeof(b));
+        tk_assert(baseline, "realloc() should succeed");
+        baseline[nbaseline++] = b;
+    }
+    fclose(fp);
+}
+
+static bool check_benchmark(struct tk_testcase *t,
+                            struct tk_bench_result *res) {
+    // Print the benchmark result under its PASS line; compare it with
+    // the baseline, if there is one for it.
+    printf("    %.4g ns/op (+- %.2g), %.3g ops/s; %d samples of %ld ops, "
+           "%d outlier%s\n",
+           res->ns_per_op, res->stddev, 1e9 / res->ns_per_op, res->samples,
+           res->ops, res->outliers, res->outliers == 1 ? "" : "s");
+
+    const char *s = getenv(TK_BENCH_THRESHOLD_V);
+    double threshold = s ? atof(s) : TK_BENCH_THRESHOLD;
+
+    for (int i = 0; i < nbaseline; i++) {
+        if (strcmp(baseline[i].name, t->name) == 0) {
+            double change = 100 * (res->ns_per_op / baseline[i].ns_per_op - 1);
+            if (change > threshold) {
+                printf("    %s: %+.1f%% from baseline %.4g ns/op\n",
+                       pcol("Regression", 31), change, baseline[i].ns_per_op);
+                return false;
+            }
+            printf("    %+.1f%% from baseline %.4g ns/op\n",
+                   change, baseline[i].ns_per_op);
+            return true;
+        }
+    }
+    return true;
+}
+
+static void print_perf(struct tk_perf_result *res) {
+    // Under TK_VERBOSE: the counters of a test case, "n/a" where the
+    // counter could not be opened.
+    printf("    perf:");
+    for (int i = 0; i < TK_PERF_EVENTS; i++) {
+        if (res->valid[i]) {
+            printf(" %llu %s", (unsigned long long)res->count[i],
+                   perf_events[i].name);
+        } else {
+            printf(" n/a %s", perf_events[i].name);
+        }
+        printf(i + 1 < TK_PERF_EVENTS ? "," : "");
+    }
+    if (res->valid[0] && res->valid[1] && res->count[0]) {
+        printf(" (%.2f IPC)", (double)res->count[1] / res->count[0]);
+    }
+    printf("\n");
+}
+
+static void print_alloc(struct tk_alloc_stats *a) {
+    // With TK_ALLOC: heap use of the test body, next to its result.
+    printf("    heap: %ld allocations (%lld bytes), %ld frees, "
+           "peak %lld bytes live, %lld bytes still live at the end\n",
+           a->allocs, a->bytes, a->frees, a->peak, a->live);
+}
+
+static int select_shard(int ntests) {
+    // TK_SHARD=i/n: keep every n-th test case, starting with the i-th, so
+    // that n machines running the same binary split the suite between
+    // them. Declaration order decides, so shards get a similar mix.
+    for (int i = 0; i < ntests; i++) {
+        suite_index[i] = i;
+    }
+    suite_size = ntests;
+
+    const char *s = getenv(TK_SHARD);
+    if (!s) {
+        return ntests;
+    }
+    tk_assert(sscanf(s, "%d/%d", &shard_index, &shard_count) == 2 &&
+              shard_count >= 1 && shard_index >= 1 &&
+              shard_index <= shard_count,
+              "TK_SHARD should be i/n with 1 <= i <= n, got \"%s\"", s);
+
+    int n = 0;
+    for (int i = shard_index - 1; i < ntests; i += shard_count) {
+        tests[n] = tests[i];
+        suite_index[n++] = i;
+    }
+    for (int i = n; i < ntests; i++) {
+        tests[i].enabled = 0;
+    }
+    return n;
+}
+
+static const char *result_status(struct tk_run *run) {
+    // The outcome of a test case in one word, for the reports.
+    if (run->passed) {
+        return "pass";
+    } else if (WIFEXITED(run->status)) {
+        return "regression"; // a benchmark slower than its baseline
+    } else if (WIFSIGNALED(run->status)) {
+        switch (WTERMSIG(run->status)) {
+            case SIGALRM: return "timeout";
+            case SIGABRT: return "assertion";
+            case SIGSEGV: return "segfault";
+            default: return "signal";
+        }
+    }
+    return "error";
+}
+
+static void json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', fp);
+        }
+        fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static void write_report(int ntests) {
+    // With TK_REPORT=<file>: a JSON array with an object per test case,
+    // for scripts that track performance over time, and for merge.py to
+    // put the reports of TK_SHARD runs back together.
+    const char *file = getenv(TK_REPORT);
+    if (!file) {
+        return;
+    }
+
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        printf("- Cannot write report to %s\n", file);
+        return;
+    }
+
+    fprintf(fp, "[\n");
+    for (int i = 0; i < ntests; i++) {
+        struct tk_run *run = &runs[i];
+        struct tk_shared *res = &shared[i];
+
+        fprintf(fp, "  {\"name\": ");
+        json_string(fp, tests[i].name);
+        fprintf(fp, ", \"loc\": ");
+        json_string(fp, tests[i].loc);
+        fprintf(fp, ", \"index\": %d, \"shard\": \"%d/%d\", "
+                    "\"passed\": %s, \"status\": \"%s\", "
+                    "\"wall_ms\": %.3f, \"user_ms\": %.3f, "
+                    "\"sys_ms\": %.3f, \"max_rss_kib\": %ld, "
+                    "\"output_bytes\": %zu, \"output_digest\": \"%016llx\"",
+                suite_index[i], shard_index, shard_count,
+                run->passed ? "true" : "false", result_status(run),
+                run->wall_ms, tv_ms(run->usage.ru_utime),
+                tv_ms(run->usage.ru_stime), run->usage.ru_maxrss,
+                run->output_len, (unsigned long long)run->digest);
+        if (res->alloc.tracked) {
+            fprintf(fp, ", \"allocs\": %ld, \"alloc_bytes\": %lld, "
+                        "\"frees\": %ld, \"peak_bytes\": %lld, "
+                        "\"live_bytes\": %lld",
+                    res->alloc.allocs, res->alloc.bytes, res->alloc.frees,
+                    res->alloc.peak, res->alloc.live);
+        }
+        if (res->bench.done) {
+            fprintf(fp, ", \"ns_per_op\": %.6g, \"stddev_ns\": %.6g",
+                    res->bench.ns_per_op, res->bench.stddev);
+        }
+        if (getenv(TK_PERF)) {
+            for (int k = 0; k < TK_PERF_EVENTS; k++) {
+                if (res->perf.valid[k]) {
+                    fprintf(fp, ", \"%s\": %llu", perf_events[k].name,
+                            (unsigned long long)res->perf.count[k]);
+                } else {
+                    fprintf(fp, ", \"%s\": null", perf_events[k].name);
+                }
+            }
+        }
+        fprintf(fp, "}%s\n", i + 1 < ntests ? "," : "");
+    }
+    fprintf(fp, "]\n");
+    fclose(fp);
+}
+
+static void xml_string(FILE *fp, const char *s, size_t len) {
+    // Escaped for XML text and attributes; control characters (which XML
+    // 1.0 cannot have at all) become '?'.
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        switch (c) {
+            case '&': fputs("&amp;", fp); break;
+            case '<': fputs("&lt;", fp); break;
+            case '>': fputs("&gt;", fp); break;
+            case '"': fputs("&quot;", fp); break;
+            default:
+                fputc(c < 0x20 && c != '\t' && c != '\n' && c != '\r' ? '?' : c,
+                      fp);
+        }
+    }
+}
+
+static void write_junit(int ntests) {
+    // With TK_JUNIT=<file>: the results as a JUnit XML test suite, which
+    // CI servers understand. Failed test cases come with their output.
+    const char *file = getenv(TK_JUNIT);
+    if (!file) {
+        return;
+    }
+
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        printf("- Cannot write JUnit results to %s\n", file);
+        return;
+    }
+
+    const char *suite = program_invocation_short_name;
+    int failures = 0;
+    double wall_ms = 0;
+    for (int i = 0; i < ntests; i++) {
+        failures += !runs[i].passed;
+        wall_ms += runs[i].wall_ms;
+    }
+
+    fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(fp, "<testsuite name=\"");
+    xml_string(fp, suite, strlen(suite));
+    fprintf(fp, "\" tests=\"%d\" failures=\"%d\" time=\"%.3f\">\n",
+            ntests, failures, wall_ms / 1e3);
+    if (shard_count > 1) {
+        fprintf(fp, "  <properties><property name=\"shard\" "
+                    "value=\"%d/%d\"/></properties>\n",
+                shard_index, shard_count);
+    }
+    for (int i = 0; i < ntests; i++) {
+        struct tk_run *run = &runs[i];
+
+        fprintf(fp, "  <testcase name=\"");
+        xml_string(fp, tests[i].name, strlen(tests[i].name));
+        fprintf(fp, "\" classname=\"");
+        xml_string(fp, suite, strlen(suite));
+        fprintf(fp, "\" file=\"");
+        xml_string(fp, tests[i].loc, strlen(tests[i].loc));
+        fprintf(fp, "\" time=\"%.3f\"", run->wall_ms / 1e3);
+        if (run->passed) {
+            fprintf(fp, "/>\n");
+            continue;
+        }
+        fprintf(fp, ">\n    <failure type=\"%s\"/>\n", result_status(run));
+        if (run->output_len) {
+            fprintf(fp, "    <system-out>");
+            xml_string(fp, run->output, run->output_len);
+            fprintf(fp, "</system-out>\n");
+        }
+        fprintf(fp, "  </testcase>\n");
+    }
+    fprintf(fp, "</testsuite>\n");
+    fclose(fp);
+}
+
+static void save_benchmarks(int ntests) {
+    const char *file = getenv(TK_BENCH_SAVE);
+    if (!file) {
+        return;
+    }
+
+    FILE *fp = fopen(file, "w");
+    if (!fp) {
+        printf("- Cannot write benchmark results to %s\n", file);
+        return;
+    }
+    for (int i = 0; i < ntests; i++) {
+        if (shared[i].bench.done) {
+            fprintf(fp, "%s %.6g\n", tests[i].name, shared[i].bench.ns_per_op);
+        }
+    }
+    fclose(fp);
+}
+
+static int by_wall_time(const void *a, const void *b) {
+    double x = runs[*(const int *)a].wall_ms, y = runs[*(const int *)b].wall_ms;
+    return (x < y) - (x > y);
+}
+
+static void print_slowest(int ntests) {
+    // Report the test cases that took the longest, to catch performance
+    // regressions early (not just failures).
+    int order[TK_MAX_TESTS];
+    for (int i = 0; i < ntests; i++) {
+        order[i] = i;
+    }
+    qsort(order, ntests, sizeof(int), by_wall_time);
+
+    int n = ntests < TK_SLOWEST ? ntests : TK_SLOWEST;
+    printf("- Slowest %d test cases (wall, user, sys, max RSS):\n", n);
+    for (int k = 0; k < n; k++) {
+        struct tk_testcase *t = &tests[order[k]];
+        struct tk_run *run = &runs[order[k]];
+        printf("    %8.1f ms %8.1f ms %8.1f ms %8ld KiB  %s (%s)\n",
+               run->wall_ms, tv_ms(run->usage.ru_utime),
+               tv_ms(run->usage.ru_stime), run->usage.ru_maxrss,
+               t->name, t->loc);
+    }
+}
+
 static void run_all_testcases(void) {
     if (!tests[0].enabled) {
         // Don't bother non-testing runs.
@@ -178,6 +864,7 @@ static void run_all_testcases(void) {
 
     // There are test cases only if there's TK_RUN or TK_VERBOSE.
     bool verbose = getenv(TK_VERBOSE) != NULL;
+    int jobs = get_jobs();
 
     // Creating subprocesses may cause multiple atexit flushes to the stdio
     // buffers. Clean them immediately and set stdout to non-buffered mode.
@@ -185,47 +872,96 @@ static void run_all_testcases(void) {
     fflush(stderr);
     setbuf(stdout, NULL);
     setbuf(stderr, NULL);
-    printf("\nTestKit\n");
-
     int passed = 0, ntests = 0;
+    while (ntests < TK_MAX_TESTS && tests[ntests].enabled) {
+        ntests++;
+    }
+    ntests = select_shard(ntests);
+    if (shard_count > 1) {
+        printf("\nTestKit (shard %d/%d: %d of %d test cases)\n",
+               shard_index, shard_count, ntests, suite_size);
+    } else {
+        printf("\nTestKit\n");
+    }
 
-    for (int i = 0; tests[i].enabled; i++, ntests++) {
-        struct tk_testcase *t = &tests[i];
-
-        char *buf = mmap(NULL,
-            TK_OUTPUT_LIMIT,
-            PROT_READ | PROT_WRITE,
-            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-        tk_assert(buf != MAP_FAILED, "mmap() should succeed");
-
-        // Run test case in a separated process.
-        pid_t pid = fork();
-        if (pid == 0) {
-            // Child: run test case for TIME_LIMIT.
-            alarm(TK_TIME_LIMIT_SEC);
-            exit(run_testcase(t, buf));
-        } else {
-            // Parent: wait for child and run t->fini().
-            int status;
-            waitpid(pid, &status, 0);
+    if (jobs > ntests) {
+        jobs = ntests;
+    }
+    // (A shard may have no test cases at all; mmap() needs a size.)
+    size_t shared_size = (ntests ? ntests : 1) * sizeof(struct tk_shared);
+    shared = mmap(NULL,
+        shared_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    tk_assert(shared != MAP_FAILED, "mmap() should succeed");
+    load_baseline();
+    free_fds = malloc(jobs * sizeof(int));
+    tk_assert(free_fds, "malloc() should succeed");
+    for (nfree_fds = 0; nfree_fds < jobs; nfree_fds++) {
+        free_fds[nfree_fds] = memfd_create("testkit-output", MFD_CLOEXEC);
+        tk_assert(free_fds[nfree_fds] >= 0, "memfd_create() should succeed");
+    }
+
+    // Keep up to jobs test cases running. Test i is started when test
+    // i - jobs has finished, and printed as soon as all tests before it
+    // are printed.
+    int started = 0, printed = 0, running = 0;
+    while (printed < ntests) {
+        if (started < ntests && running < jobs) {
+            start_testcase(started++);
+            running++;
+        } else if (printed < started && runs[printed].pid == 0) {
+            struct tk_testcase *t = &tests[printed];
+            struct tk_run *run = &runs[printed];
+            char *buf = run->output;
+            size_t len = run->output_len;
+
+            bool succ = check_results(t, run->status);
+            if (succ && shared[printed].bench.done) {
+                succ = check_benchmark(t, &shared[printed].bench);
+            }
+            if (verbose && getenv(TK_PERF)) {
+                print_perf(&shared[printed].perf);
+            }
+            if (getenv(TK_ALLOC) && shared[printed].alloc.tracked) {
+                print_alloc(&shared[printed].alloc);
+            }
+            run->passed = succ;
 
-            if (check_results(t, status)) {
+            if (succ) {
                 passed++;
             } else if (verbose) {
-                printf(pcol("%s", 90), buf);
-                if (!buf[0] || buf[strlen(buf) - 1] != '\n') {
+                printf(pcol("%.*s", 90), (int)len, buf);
+                if (!len || buf[len - 1] != '\n') {
                     printf("\n");
                 }
             }
 
-            // Cleanup code is also ran in a separate process.
-            run_cleanup(t);
+            // JUnit results have the output of failed test cases.
+            if (succ || !getenv(TK_JUNIT)) {
+                free(buf);
+                run->output = NULL;
+            }
+            printed++;
+        } else {
+            wait_testcase(started);
+            running--;
         }
-
-        munmap(buf, TK_OUTPUT_LIMIT);
     }
 
+    save_benchmarks(ntests);
+    write_report(ntests);
+    write_junit(ntests);
+    munmap(shared, shared_size);
+    for (int i = 0; i < nfree_fds; i++) {
+        close(free_fds[i]);
+    }
+    free(free_fds);
+    for (int i = 0; i < ntests; i++) {
+        free(runs[i].output);
+    }
     printf("- %d/%d test cases passed.\n", passed, ntests);
+    print_slowest(ntests);
 }
 
 static int worker_pid;
@@ -236,29 +972,44 @@ static void notify_worker() {
     // tests in the worker process may not be correctly initialized.
 
     write(pipe_write, tests, sizeof(tests));
+    write(pipe_write, setups, sizeof(setups));
     close(pipe_write);
 
     // Wait for the worker to complete
     waitpid(worker_pid, NULL, 0);
 }
 
-static void worker_process() {
-    // tk_register_hook() creates a forked process to run this.
-    // Read the tests array from the pipe and run all test cases.
-
+static void read_array(void *array, size_t size) {
     ssize_t bytes_read;
 
-    for (bytes_read = 0; bytes_read < sizeof(tests); ) {
+    for (bytes_read = 0; bytes_read < size; ) {
         ssize_t result = read(pipe_read,
-            (char *)tests + bytes_read,
-            sizeof(tests) - bytes_read
+            (char *)array + bytes_read,
+            size - bytes_read
         );
         if (result <= 0) break; // Error or EOF
         bytes_read += result;
     }
+}
+
+static void worker_process() {
+    // tk_register_hook() creates a forked process to run this.
+    // Read the tests and setups arrays from the pipe and run all test
+    // cases.
 
+    read_array(tests, sizeof(tests));
+    read_array(setups, sizeof(setups));
     close(pipe_read);
 
+    // The worker is the fork server of all test cases: the global setup
+    // runs here once, and every test process starts from a copy of the
+    // state it leaves.
+    if (tests[0].enabled) {
+        for (int i = 0; i < TK_MAX_SETUPS && setups[i]; i++) {
+            setups[i]();
+        }
+    }
+
     run_all_testcases();
     exit(0);
 }
@@ -289,3 +1040,101 @@ void tk_register_hook(void) {
         atexit(notify_worker);
     }
 }
+
+// ------------------------------------------------------------------------
+// Below are the heap allocation wrappers. Linking with testkit.c replaces
+// malloc() and friends; they forward to the C library, and count while a
+// test body runs. Live bytes are counted as malloc_usable_size() and are
+// relative to the start of the test, so freeing memory allocated before
+// (say, in a TestSetup) makes them go down.
+
+#ifndef TK_NO_ALLOC_TRACKING
+
+#include <malloc.h>
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+static void count_alloc(void *ptr, size_t size) {
+    struct tk_alloc_stats *a = alloc_stats;
+    if (a && ptr) {
+        long long usable = malloc_usable_size(ptr);
+        __atomic_add_fetch(&a->allocs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&a->bytes, size, __ATOMIC_RELAXED);
+        long long live =
+            __atomic_add_fetch(&a->live, usable, __ATOMIC_RELAXED);
+        long long peak = __atomic_load_n(&a->peak, __ATOMIC_RELAXED);
+        while (live > peak &&
+               !__atomic_compare_exchange_n(&a->peak, &peak, live, true,
+                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void count_free(void *ptr) {
+    struct tk_alloc_stats *a = alloc_stats;
+    if (a && ptr) {
+        __atomic_add_fetch(&a->frees, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&a->live, (long long)malloc_usable_size(ptr),
+                           __ATOMIC_RELAXED);
+    }
+}
+
+void *malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+    count_alloc(ptr, size);
+    return ptr;
+}
+
+void *calloc(size_t n, size_t size) {
+    void *ptr = __libc_calloc(n, size);
+    count_alloc(ptr, n * size);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    // Counted as a free of the old block and an allocation of the new
+    // one. A failed realloc() leaves the old block live: count it back.
+    count_free(ptr);
+    void *new_ptr = __libc_realloc(ptr, size);
+    if (!new_ptr && ptr && size) {
+        count_alloc(ptr, 0);
+        return NULL;
+    }
+    count_alloc(new_ptr, size);
+    return new_ptr;
+}
+
+void free(void *ptr) {
+    count_free(ptr);
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    void *ptr = __libc_memalign(alignment, size);
+    count_alloc(ptr, size);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    void *ptr = memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+#endif
+
+const struct tk_alloc_stats *tk_alloc_stats(void) {
+    static const struct tk_alloc_stats none;
+    return alloc_stats ? alloc_stats : &none;
+}
@@ -14,6 +14,23 @@
  * - Set TK_RUN environment variable (regardless of its value), all test
  *   cases will automatically run after the (normal) program exits.
  * - Set TK_VERBOSE will print program outputs for failed test cases.
+ * - Each test case has a time limit of one second; set a tighter one with
+ *   .time_limit_ms (for example `UnitTest(fast, .time_limit_ms = 50)`).
+ *   The slowest test cases, with their CPU time and memory, are reported
+ *   at the end.
+ * - Set TK_PERF to count cycles, instructions, cache misses, branch misses
+ *   and page faults (perf_event_open) during each test body; TK_VERBOSE
+ *   prints them. Set TK_REPORT=<file> to also write every result, with
+ *   timing and counters, to a JSON file.
+ * - Set TK_ALLOC to print the heap use (allocations, bytes, peak) of each
+ *   test body. Tests can also check it with tk_assert_allocs_le().
+ * - Set TK_JOBS to the number of test cases run at the same time (default:
+ *   one per CPU; TK_JOBS=1 runs them one by one). Results are printed in
+ *   declaration order either way.
+ * - Set TK_SHARD=i/n (1 <= i <= n) to run only every n-th test case,
+ *   starting with the i-th: n machines with the same binary split the
+ *   suite. TK_REPORT files of the shards are merged by merge.py. Set
+ *   TK_JUNIT=<file> to also write the results as JUnit XML.
  * 
  * Minimal Example (test.c):
  * 
@@ -32,23 +49,63 @@
 
 /** Maximum number of allowed test cases. */
 #define TK_MAX_TESTS       1024
+/** Maximum number of global setup functions (TestSetup). */
+#define TK_MAX_SETUPS      64
 /** Time limit (in seconds) for each test case. */
 #define TK_TIME_LIMIT_SEC  1
-/** Output limit (bytes) for output capture in struct tk_result. */
-#define TK_OUTPUT_LIMIT    (1 << 20)
+/** Default time limit (in milliseconds); tests may set .time_limit_ms. */
+#define TK_TIME_LIMIT_MS   (TK_TIME_LIMIT_SEC * 1000)
+/** Number of test cases in the slowest-tests report. */
+#define TK_SLOWEST         5
 
 #define TK_MAX_ARGV_LEN    64
 
+/** Benchmarks: timed batches per result, and the length of each batch. */
+#define TK_BENCH_SAMPLES   20
+#define TK_BENCH_BATCH_NS  10000000
+/** Default regression threshold (percent) against TK_BENCH_BASELINE. */
+#define TK_BENCH_THRESHOLD 10
+
 /** Environment variables for enabling TestKit. */
 #define TK_RUN     "TK_RUN"
 #define TK_VERBOSE "TK_VERBOSE"
+#define TK_JOBS    "TK_JOBS"
+#define TK_SHARD   "TK_SHARD"
+
+/** Environment variables for hardware counters and the JSON report. */
+#define TK_PERF    "TK_PERF"
+#define TK_REPORT  "TK_REPORT"
+#define TK_ALLOC   "TK_ALLOC"
+#define TK_JUNIT   "TK_JUNIT"
+
+/** Environment variables for benchmark baselines (see Benchmark). */
+#define TK_BENCH_BASELINE    "TK_BENCH_BASELINE"
+#define TK_BENCH_SAVE        "TK_BENCH_SAVE"
+#define TK_BENCH_THRESHOLD_V "TK_BENCH_THRESHOLD"
 
 /** System test run result: exit status and combined stdout and stderr. */
 struct tk_result {
     int exit_status;
-    const char *output;
+    const char *output; // NUL-terminated, but may also contain NULs
+    size_t output_len;
 };
 
+/**
+ * Heap use of the running test body: testkit.c wraps malloc(), calloc(),
+ * realloc(), free() and the aligned allocators. Byte counts of live memory
+ * are malloc_usable_size() sizes. Compile testkit.c with
+ * -DTK_NO_ALLOC_TRACKING to keep the C library allocator untouched.
+ */
+struct tk_alloc_stats {
+    int tracked; // whether the test body ran with tracking
+    long allocs, frees;
+    long long bytes; // total requested
+    long long live, peak; // live bytes now, and at most
+};
+
+/** Heap use of the current test body so far (all zero outside of it). */
+const struct tk_alloc_stats *tk_alloc_stats(void);
+
 /**
  * A test case with initialization, test, and finalization functions.
  * Unit tests are "one-time" function runners; system tests are invocation
@@ -61,10 +118,14 @@ struct tk_testcase {
     const char *loc; // the program location of this test case
     void (*init)(void); // pre-test setup function (optional)
     void (*fini)(void); // post-test cleanup function (optional)
+    int time_limit_ms; // time limit (optional; default TK_TIME_LIMIT_MS)
 
     // For unit tests:
     void (*utest)(void); // unit test body
 
+    // For benchmarks:
+    void (*bench)(void); // benchmark body, one operation
+
     // For system tests:
     void (*stest)(struct tk_result *); // test body
     int argc;
@@ -91,6 +152,25 @@ struct tk_testcase {
         } \
     } while (0)
 
+/**
+ * Allocation budgets for hot paths: fails if the test body so far made more
+ * than n allocations, or had more than n bytes live at a time. Example:
+ *
+ *   UnitTest(no_alloc_lookup) {
+ *     lookup(table, "key");
+ *     tk_assert_allocs_le(0);
+ *   }
+ */
+#define tk_assert_allocs_le(n) \
+    tk_assert(tk_alloc_stats()->allocs <= (n), \
+              "Expected at most %ld allocations, got %ld", \
+              (long)(n), tk_alloc_stats()->allocs)
+
+#define tk_assert_peak_le(n) \
+    tk_assert(tk_alloc_stats()->peak <= (n), \
+              "Expected at most %lld bytes live, got %lld", \
+              (long long)(n), tk_alloc_stats()->peak)
+
 #ifdef assert
     // Override system "assert": it uses fd instead of stderr
     #undef assert
@@ -164,6 +244,88 @@ struct tk_testcase {
         .argv = (const char **)argv_, \
         __VA_ARGS__)
 
+/**
+ * Declares a global setup function that runs once before all test cases.
+ *
+ * Every test case runs in a process forked from the TestKit worker. Setup
+ * functions run in the worker itself, so whatever they build (tables,
+ * parsed input files, caches) is inherited by each test case instead of
+ * being rebuilt by every .init.
+ *
+ * Example:
+ *
+ *   static struct table *table;
+ *
+ *   TestSetup(load_table) {
+ *     table = load_table("big-input.txt");
+ *   }
+ *
+ * Notes:
+ *
+ * - Setup functions run in registration order.
+ * - Test cases get a copy (fork()) of the state: changes made by one test
+ *   case are not seen by the others.
+ * - A setup function is not protected by a time limit, and a crash in it
+ *   stops the whole test run.
+ */
+#define TestSetup(name) \
+    static void TK_UNIQUE_NAME(name)(void); \
+    \
+    __attribute__((constructor)) \
+    void TK_UNIQUE_NAME(reg##name)() { \
+        void tk_add_setup(void (*setup)(void)); \
+        tk_add_setup(TK_UNIQUE_NAME(name)); \
+    } \
+    \
+    static void TK_UNIQUE_NAME(name)(void)
+
+/**
+ * Declares a microbenchmark: the body is one operation, and TestKit runs
+ * it over and over to measure how long it takes.
+ *
+ * Parameters:
+ *
+ * - name: Benchmark name.
+ * - Variadic arguments: Additional named fields (such as .init, .fini,
+ *   .time_limit_ms), like UnitTest.
+ * - Must be followed by the benchmark body.
+ *
+ * Example:
+ *
+ *   Benchmark(hash_lookup, .init = fill_table) {
+ *     tk_do_not_optimize(lookup(table, "key"));
+ *   }
+ *
+ * will be reported as:
+ *
+ *   - [PASS] hash_lookup (test.c:12)
+ *       23.4 ns/op (+- 0.3), 4.27e+07 ops/s; 20 samples of 425984 ops, 1 outlier
+ *
+ * Notes:
+ *
+ * - The number of operations per timed batch is calibrated so that a
+ *   batch takes about TK_BENCH_BATCH_NS; the calibration runs double as
+ *   warm-up. Of TK_BENCH_SAMPLES batches, those far from the median
+ *   (more than 3 median absolute deviations) are dropped as outliers.
+ * - Use tk_do_not_optimize() on results, or the compiler may remove the
+ *   work being measured.
+ * - Set TK_BENCH_SAVE=<file> to write all results (name and ns/op) to a
+ *   file, and TK_BENCH_BASELINE=<file> to compare with a saved file: a
+ *   benchmark more than TK_BENCH_THRESHOLD percent (default 10) slower
+ *   than its baseline fails.
+ * - Test cases run in parallel (TK_JOBS) disturb each other; use
+ *   TK_JOBS=1 for numbers worth comparing.
+ */
+#define Benchmark(name, ...) \
+    __tk_testcase(name, void, bench, __VA_ARGS__)
+
+/** Keeps the compiler from optimizing away the computation of x. */
+#define tk_do_not_optimize(x) \
+    do { \
+        __typeof__(x) __tk_value = (x); \
+        __asm__ volatile("" : : "g"(&__tk_value) : "memory"); \
+    } while (0)
+
 // ------------------------------------------------------------------------
 // Below are helpers.
 
@@ -237,7 +399,8 @@ struct tk_testcase {
  *   // "UnitTest(inf_loop)" expands to the code above.
  *   { while (1); }
  * 
- * TestKit will stop this loop after TK_TIME_LIMIT_SEC seconds.
+ * TestKit will stop this loop after TK_TIME_LIMIT_SEC seconds (or after
+ * .time_limit_ms milliseconds, if the test case sets it).
  */
 #define __tk_testcase(name_, body_arg, test, ...) \
     /* Declare the test function, e.g., __tk_test_example. */ \